@@ -282,8 +282,15 @@ daemonConfigNew(bool privileged ATTRIBUTE_UNUSED)
 
     data->max_requests = 20;
     data->max_client_requests = 5;
+    data->compression_threshold = 0;
+
+    data->max_client_rate = 0;
+    data->max_client_burst = 0;
+    data->max_proc_rate = 0;
+    data->max_proc_burst = 0;
 
     data->log_buffer_size = 64;
+    data->log_queue_size = 1024;
 
     data->audit_level = 1;
     data->audit_logging = 0;
@@ -292,6 +299,9 @@ daemonConfigNew(bool privileged ATTRIBUTE_UNUSED)
     data->keepalive_count = 5;
     data->keepalive_required = 0;
 
+    data->host_stats_interval = 0;
+    data->host_stats_window = 60;
+
     localhost = virGetHostname(NULL);
     if (localhost == NULL) {
         /* we couldn't resolve the hostname; assume that we are
@@ -430,6 +440,12 @@ daemonConfigLoadOptions(struct daemonConfig *data,
 
     GET_CONF_INT(conf, filename, max_requests);
     GET_CONF_INT(conf, filename, max_client_requests);
+    GET_CONF_INT(conf, filename, compression_threshold);
+
+    GET_CONF_INT(conf, filename, max_client_rate);
+    GET_CONF_INT(conf, filename, max_client_burst);
+    GET_CONF_INT(conf, filename, max_proc_rate);
+    GET_CONF_INT(conf, filename, max_proc_burst);
 
     GET_CONF_INT(conf, filename, audit_level);
     GET_CONF_INT(conf, filename, audit_logging);
@@ -440,11 +456,15 @@ daemonConfigLoadOptions(struct daemonConfig *data,
     GET_CONF_STR(conf, filename, log_filters);
     GET_CONF_STR(conf, filename, log_outputs);
     GET_CONF_INT(conf, filename, log_buffer_size);
+    GET_CONF_INT(conf, filename, log_queue_size);
 
     GET_CONF_INT(conf, filename, keepalive_interval);
     GET_CONF_INT(conf, filename, keepalive_count);
     GET_CONF_INT(conf, filename, keepalive_required);
 
+    GET_CONF_INT(conf, filename, host_stats_interval);
+    GET_CONF_INT(conf, filename, host_stats_window);
+
     return 0;
 
 error:
@@ -66,11 +66,18 @@ struct daemonConfig {
 
     int max_requests;
     int max_client_requests;
+    int compression_threshold;
+
+    int max_client_rate;
+    int max_client_burst;
+    int max_proc_rate;
+    int max_proc_burst;
 
     int log_level;
     char *log_filters;
     char *log_outputs;
     int log_buffer_size;
+    int log_queue_size;
 
     int audit_level;
     int audit_logging;
@@ -78,6 +85,9 @@ struct daemonConfig {
     int keepalive_interval;
     unsigned int keepalive_count;
     int keepalive_required;
+
+    unsigned int host_stats_interval;
+    unsigned int host_stats_window;
 };
 
 
@@ -54,6 +54,7 @@
 #include "viraudit.h"
 #include "locking/lock_manager.h"
 #include "virstring.h"
+#include "nodeinfo.h"
 
 #ifdef WITH_DRIVER_MODULES
 # include "driver.h"
@@ -519,6 +520,8 @@ static int daemonSetupNetworking(virNetServerPtr srv,
                                                      false,
                                                      config->max_client_requests)))
                 goto error;
+            virNetServerServiceSetCompressThreshold(svcTCP,
+                                                    config->compression_threshold);
 
             if (virNetServerAddService(srv, svcTCP,
                                        config->mdns_adv ? "_libvirt._tcp" : NULL) < 0)
@@ -561,6 +564,8 @@ static int daemonSetupNetworking(virNetServerPtr srv,
                 virObjectUnref(ctxt);
                 goto error;
             }
+            virNetServerServiceSetCompressThreshold(svcTLS,
+                                                    config->compression_threshold);
             if (virNetServerAddService(srv, svcTLS,
                                        config->mdns_adv &&
                                        !config->listen_tcp ? "_libvirt._tcp" : NULL) < 0)
@@ -640,6 +645,8 @@ daemonSetupLogging(struct daemonConfig *config,
 
     virLogSetBufferSize(config->log_buffer_size);
 
+    virLogSetQueueSize(config->log_queue_size);
+
     if (virLogGetNbFilters() == 0)
         virLogParseFilters(config->log_filters);
 
@@ -1342,6 +1349,15 @@ int main(int argc, char **argv) {
         goto cleanup;
     }
 
+    if (virNetServerSetRateLimits(srv,
+                                  config->max_client_rate,
+                                  config->max_client_burst,
+                                  config->max_proc_rate,
+                                  config->max_proc_burst) < 0) {
+        ret = VIR_DAEMON_ERR_INIT;
+        goto cleanup;
+    }
+
     /* Beyond this point, nothing should rely on using
      * getuid/geteuid() == 0, for privilege level checks.
      */
@@ -1358,6 +1374,16 @@ int main(int argc, char **argv) {
     remoteProcs[REMOTE_PROC_AUTH_SASL_STEP].needAuth = false;
     remoteProcs[REMOTE_PROC_AUTH_SASL_START].needAuth = false;
     remoteProcs[REMOTE_PROC_AUTH_POLKIT].needAuth = false;
+    remoteProcs[REMOTE_PROC_CONNECT_OPEN].batchable = false;
+    remoteProcs[REMOTE_PROC_CONNECT_CLOSE].batchable = false;
+    remoteProcs[REMOTE_PROC_AUTH_LIST].batchable = false;
+    remoteProcs[REMOTE_PROC_AUTH_SASL_INIT].batchable = false;
+    remoteProcs[REMOTE_PROC_AUTH_SASL_STEP].batchable = false;
+    remoteProcs[REMOTE_PROC_AUTH_SASL_START].batchable = false;
+    remoteProcs[REMOTE_PROC_AUTH_POLKIT].batchable = false;
+    remoteProcs[REMOTE_PROC_DOMAIN_OPEN_GRAPHICS].batchable = false;
+    remoteProcs[REMOTE_PROC_CONNECT_MULTI_CALL].batchable = false;
+    remoteProcs[REMOTE_PROC_CONNECT_ENABLE_COMPRESSION].batchable = false;
     if (!(remoteProgram = virNetServerProgramNew(REMOTE_PROGRAM,
                                                  REMOTE_PROTOCOL_VERSION,
                                                  remoteProcs,
@@ -1417,6 +1443,15 @@ int main(int argc, char **argv) {
     }
     virAuditLog(config->audit_logging);
 
+    if (config->host_stats_interval &&
+        nodeStatsSamplerStart(config->host_stats_interval,
+                              config->host_stats_window) < 0) {
+        virErrorPtr err = virGetLastError();
+        VIR_WARN("Unable to start host statistics sampler: %s",
+                 err && err->message ? err->message : _("unknown error"));
+        virResetLastError();
+    }
+
     /* setup the hooks if any */
     if (virHookInitialize() < 0) {
         ret = VIR_DAEMON_ERR_HOOKS;
@@ -1515,5 +1550,7 @@ cleanup:
 
     virStateCleanup();
 
+    nodeStatsSamplerStop();
+
     return ret;
 }
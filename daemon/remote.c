@@ -3729,6 +3729,11 @@ static int remoteDispatchConnectSupportsFeature(virNetServerPtr server ATTRIBUTE
         goto done;
     }
 
+    if (args->feature == VIR_DRV_FEATURE_PROGRAM_MULTI_CALL) {
+        supported = 1;
+        goto done;
+    }
+
     if (!priv->conn) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
         goto cleanup;
@@ -3756,6 +3761,109 @@ cleanup:
 }
 
 
+static int
+remoteDispatchConnectEnableCompression(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                       virNetServerClientPtr client,
+                                       virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                       virNetMessageErrorPtr rerr,
+                                       remote_connect_enable_compression_args *args)
+{
+    int rv = -1;
+    unsigned int flags = args->flags;
+
+    virCheckFlagsGoto(0, cleanup);
+
+    if (virNetServerClientEnableCompression(client) < 0)
+        goto cleanup;
+
+    rv = 0;
+
+cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    return rv;
+}
+
+
+static int
+remoteDispatchConnectMultiCall(virNetServerPtr server,
+                               virNetServerClientPtr client,
+                               virNetMessagePtr msg,
+                               virNetMessageErrorPtr rerr,
+                               remote_connect_multi_call_args *args,
+                               remote_connect_multi_call_ret *ret)
+{
+    int rv = -1;
+    unsigned int flags = args->flags;
+    remote_connect_multi_call_result *results = NULL;
+    size_t nresults = 0;
+    size_t total = 0;
+    size_t i;
+
+    virCheckFlagsGoto(REMOTE_CONNECT_MULTI_CALL_STOP_ON_ERROR, cleanup);
+
+    if (args->calls.calls_len > REMOTE_CONNECT_MULTI_CALL_MAX) {
+        virReportError(VIR_ERR_RPC,
+                       _("too many sub-calls %d for limit %d"),
+                       args->calls.calls_len, REMOTE_CONNECT_MULTI_CALL_MAX);
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(results, args->calls.calls_len) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    for (i = 0 ; i < args->calls.calls_len ; i++) {
+        remote_connect_multi_call_entry *call = &args->calls.calls_val[i];
+        char *data = NULL;
+        size_t len;
+        int status;
+
+        if ((status = virNetServerProgramDispatchSubCall(remoteProgram,
+                                                         server, client, msg,
+                                                         call->proc,
+                                                         call->args.args_val,
+                                                         call->args.args_len,
+                                                         REMOTE_CONNECT_MULTI_CALL_PAYLOAD_MAX,
+                                                         &data, &len)) < 0)
+            goto cleanup;
+
+        results[i].data.data_val = data;
+        results[i].data.data_len = len;
+        results[i].status = status;
+        nresults++;
+
+        /* Fail early rather than when encoding the whole reply */
+        total += len;
+        if (total > REMOTE_CONNECT_MULTI_CALL_PAYLOAD_MAX) {
+            virReportError(VIR_ERR_RPC,
+                           _("compound call reply too large after %zu sub-calls"),
+                           i + 1);
+            goto cleanup;
+        }
+
+        if (status != VIR_NET_OK &&
+            (flags & REMOTE_CONNECT_MULTI_CALL_STOP_ON_ERROR))
+            break;
+    }
+
+    ret->results.results_val = results;
+    ret->results.results_len = nresults;
+    results = NULL;
+    nresults = 0;
+    rv = 0;
+
+cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    for (i = 0 ; i < nresults ; i++)
+        VIR_FREE(results[i].data.data_val);
+    VIR_FREE(results);
+    return rv;
+}
+
+
 static int
 remoteDispatchDomainOpenGraphics(virNetServerPtr server ATTRIBUTE_UNUSED,
                                  virNetServerClientPtr client ATTRIBUTE_UNUSED,
@@ -107,6 +107,7 @@ virCapabilitiesFreeHostNUMACell(virCapsHostNUMACellPtr cell)
     virCapabilitiesClearHostNUMACellCPUTopology(cell->cpus, cell->ncpus);
 
     VIR_FREE(cell->cpus);
+    VIR_FREE(cell->pageinfo);
     VIR_FREE(cell);
 }
 
@@ -295,6 +296,40 @@ virCapabilitiesAddHostNUMACell(virCapsPtr caps,
 }
 
 
+/**
+ * virCapabilitiesSetHostNUMACellPageInfo:
+ * @caps: capabilities to extend
+ * @num: ID number of NUMA cell
+ * @npageinfo: number of page sizes
+ * @pageinfo: array of page size structures, the pointer is stolen
+ *
+ * Records the page sizes available on the NUMA cell @num, which
+ * must have been registered before
+ */
+int
+virCapabilitiesSetHostNUMACellPageInfo(virCapsPtr caps,
+                                       int num,
+                                       int npageinfo,
+                                       virCapsHostNUMACellPageInfoPtr pageinfo)
+{
+    int i;
+
+    for (i = 0; i < caps->host.nnumaCell; i++) {
+        virCapsHostNUMACellPtr cell = caps->host.numaCell[i];
+
+        if (cell->num != num)
+            continue;
+
+        VIR_FREE(cell->pageinfo);
+        cell->npageinfo = npageinfo;
+        cell->pageinfo = pageinfo;
+        return 0;
+    }
+
+    return -1;
+}
+
+
 /**
  * virCapabilitiesSetHostCPU:
  * @caps: capabilities to extend
@@ -720,6 +755,13 @@ virCapabilitiesFormatNUMATopology(virBufferPtr xml,
                               "          <memory unit='KiB'>%llu</memory>\n",
                               cells[i]->mem);
 
+        for (j = 0; j < cells[i]->npageinfo; j++) {
+            virBufferAsprintf(xml,
+                              "          <pages unit='KiB' size='%u'>%llu</pages>\n",
+                              cells[i]->pageinfo[j].size,
+                              cells[i]->pageinfo[j].avail);
+        }
+
         virBufferAsprintf(xml, "          <cpus num='%d'>\n", cells[i]->ncpus);
         for (j = 0; j < cells[i]->ncpus; j++) {
             virBufferAsprintf(xml, "            <cpu id='%d'",
@@ -94,6 +94,13 @@ struct _virCapsHostNUMACellCPU {
     virBitmapPtr siblings;
 };
 
+typedef struct _virCapsHostNUMACellPageInfo virCapsHostNUMACellPageInfo;
+typedef virCapsHostNUMACellPageInfo *virCapsHostNUMACellPageInfoPtr;
+struct _virCapsHostNUMACellPageInfo {
+    unsigned int size;      /* page size in kibibytes */
+    unsigned long long avail;   /* the size of pool */
+};
+
 typedef struct _virCapsHostNUMACell virCapsHostNUMACell;
 typedef virCapsHostNUMACell *virCapsHostNUMACellPtr;
 struct _virCapsHostNUMACell {
@@ -101,6 +108,8 @@ struct _virCapsHostNUMACell {
     int ncpus;
     unsigned long long mem; /* in kibibytes */
     virCapsHostNUMACellCPUPtr cpus;
+    int npageinfo;
+    virCapsHostNUMACellPageInfoPtr pageinfo;
 };
 
 typedef struct _virCapsHostSecModel virCapsHostSecModel;
@@ -187,6 +196,12 @@ virCapabilitiesAddHostNUMACell(virCapsPtr caps,
                                unsigned long long mem,
                                virCapsHostNUMACellCPUPtr cpus);
 
+extern int
+virCapabilitiesSetHostNUMACellPageInfo(virCapsPtr caps,
+                                       int num,
+                                       int npageinfo,
+                                       virCapsHostNUMACellPageInfoPtr pageinfo);
+
 
 extern int
 virCapabilitiesSetHostCPU(virCapsPtr caps,
@@ -52,6 +52,8 @@
 #include "device_conf.h"
 #include "virtpm.h"
 #include "virstring.h"
+#include "intprops.h"
+#include "stat-time.h"
 
 #define VIR_FROM_THIS VIR_FROM_DOMAIN
 
@@ -60,12 +62,72 @@
 verify(VIR_DOMAIN_VIRT_LAST <= 32);
 
 
+typedef struct _virDomainObjListSnapshotEntry virDomainObjListSnapshotEntry;
+typedef virDomainObjListSnapshotEntry *virDomainObjListSnapshotEntryPtr;
+struct _virDomainObjListSnapshotEntry {
+    virDomainObjPtr obj;
+    char *name;
+    int id;
+};
+
+/* An immutable copy of the list membership, with the name and
+ * running ID of each domain, so readers can list domains without
+ * taking the list lock or any domain lock. It is built from the
+ * membership array by the first reader after a change. The names
+ * of all entries are packed into @names */
+typedef struct _virDomainObjListSnapshot virDomainObjListSnapshot;
+typedef virDomainObjListSnapshot *virDomainObjListSnapshotPtr;
+struct _virDomainObjListSnapshot {
+    virObject parent;
+
+    size_t nentries;
+    virDomainObjListSnapshotEntryPtr entries;
+    char *names;
+};
+
 struct _virDomainObjList {
     virObjectLockable parent;
 
     /* uuid string -> virDomainObj  mapping
      * for O(1), lockless lookup-by-uuid */
     virHashTable *objs;
+
+    /* name -> virDomainObj mapping for O(1), lockless
+     * lookup-by-name. Holds no references of its own */
+    virHashTable *objsName;
+
+    /* id string -> virDomainObj mapping of running domains
+     * for O(1) lookup-by-id without holding the list lock.
+     * IDs change while only the domain is locked, so this
+     * has a lock of its own, nested inside any domain lock */
+    virMutex idsLock;
+    virHashTable *ids;
+
+    /* Name and ID of every domain in the list, updated in place
+     * as domains come, go and change their ID. Entries hold no
+     * references. Also protected by idsLock. If memory ran out
+     * while updating it, @membersBroken is set and readers walk
+     * @objs under the list lock instead */
+    size_t nmembers;
+    size_t nmembers_max;
+    virDomainObjListSnapshotEntryPtr members;
+    size_t nactive;
+    bool membersBroken;
+
+    /* Bytes taken by the names of all members, including the
+     * terminating NULs. Also protected by idsLock */
+    size_t membersNamesLen;
+
+    /* Copy of @members handed out to readers, NULL if it needs to
+     * be built again. Also protected by idsLock */
+    virDomainObjListSnapshotPtr snapshot;
+
+    /* What to parse the config of domains loaded lazily
+     * by virDomainObjListLoadAllConfigsCached with. Also
+     * protected by idsLock, as it changes on reload */
+    virCapsPtr caps;
+    virDomainXMLOptionPtr xmlopt;
+    unsigned int expectedVirtTypes;
 };
 
 
@@ -746,9 +808,11 @@ VIR_ENUM_IMPL(virDomainTPMBackend, VIR_DOMAIN_TPM_TYPE_LAST,
 
 static virClassPtr virDomainObjClass;
 static virClassPtr virDomainObjListClass;
+static virClassPtr virDomainObjListSnapshotClass;
 static virClassPtr virDomainXMLOptionClass;
 static void virDomainObjDispose(void *obj);
 static void virDomainObjListDispose(void *obj);
+static void virDomainObjListSnapshotDispose(void *obj);
 static void virDomainXMLOptionClassDispose(void *obj);
 
 static int virDomainObjOnceInit(void)
@@ -765,6 +829,12 @@ static int virDomainObjOnceInit(void)
                                               virDomainObjListDispose)))
         return -1;
 
+    if (!(virDomainObjListSnapshotClass = virClassNew(virClassForObject(),
+                                                      "virDomainObjListSnapshot",
+                                                      sizeof(virDomainObjListSnapshot),
+                                                      virDomainObjListSnapshotDispose)))
+        return -1;
+
     if (!(virDomainXMLOptionClass = virClassNew(virClassForObject(),
                                                 "virDomainXMLOption",
                                                 sizeof(virDomainXMLOption),
@@ -921,7 +991,16 @@ virDomainObjListPtr virDomainObjListNew(void)
     if (!(doms = virObjectLockableNew(virDomainObjListClass)))
         return NULL;
 
-    if (!(doms->objs = virHashCreate(50, virDomainObjListDataFree))) {
+    if (virMutexInit(&doms->idsLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot initialize mutex"));
+        virObjectUnref(doms);
+        return NULL;
+    }
+
+    if (!(doms->objs = virHashCreateOpen(50, virDomainObjListDataFree)) ||
+        !(doms->objsName = virHashCreateOpen(50, NULL)) ||
+        !(doms->ids = virHashCreateOpen(50, NULL))) {
         virObjectUnref(doms);
         return NULL;
     }
@@ -933,36 +1012,411 @@ virDomainObjListPtr virDomainObjListNew(void)
 static void virDomainObjListDispose(void *obj)
 {
     virDomainObjListPtr doms = obj;
+    size_t i;
 
+    for (i = 0; i < doms->nmembers; i++)
+        VIR_FREE(doms->members[i].name);
+    VIR_FREE(doms->members);
+    virObjectUnref(doms->snapshot);
+    virObjectUnref(doms->caps);
+    virObjectUnref(doms->xmlopt);
+    virHashFree(doms->ids);
+    virHashFree(doms->objsName);
     virHashFree(doms->objs);
+    virMutexDestroy(&doms->idsLock);
+}
+
+
+/*
+ * The caller must hold doms->idsLock, and a lock
+ * on 'dom' or on the list
+ */
+static void virDomainObjListUnindexID(virDomainObjListPtr doms,
+                                      virDomainObjPtr dom,
+                                      int id)
+{
+    char idstr[INT_BUFSIZE_BOUND(id)];
+
+    if (id == -1)
+        return;
+
+    snprintf(idstr, sizeof(idstr), "%d", id);
+    if (virHashLookup(doms->ids, idstr) == dom)
+        virHashRemoveEntry(doms->ids, idstr);
+}
+
+static void virDomainObjListIndexID(virDomainObjListPtr doms,
+                                    virDomainObjPtr dom)
+{
+    char idstr[INT_BUFSIZE_BOUND(dom->def->id)];
+
+    if (dom->def->id == -1)
+        return;
+
+    snprintf(idstr, sizeof(idstr), "%d", dom->def->id);
+    ignore_value(virHashUpdateEntry(doms->ids, idstr, dom));
+}
+
+static void virDomainObjListSnapshotDispose(void *obj)
+{
+    virDomainObjListSnapshotPtr snap = obj;
+    size_t i;
+
+    for (i = 0; i < snap->nentries; i++)
+        virObjectUnref(snap->entries[i].obj);
+    VIR_FREE(snap->entries);
+    VIR_FREE(snap->names);
+}
+
+
+/*
+ * Drop 'dom' from the membership of the list if 'remove' is true,
+ * or otherwise add it or update its entry from its current
+ * definition. The caller must hold doms->idsLock and a lock on
+ * 'dom'. If memory runs out, readers go back to walking the list
+ * under its lock.
+ */
+static void virDomainObjListSnapshotUpdate(virDomainObjListPtr doms,
+                                           virDomainObjPtr dom,
+                                           bool remove)
+{
+    virDomainObjListSnapshotEntryPtr entry = NULL;
+    char *name;
+    size_t i;
+
+    if (doms->membersBroken)
+        return;
+
+    if (dom->listIndex < doms->nmembers &&
+        doms->members[dom->listIndex].obj == dom)
+        entry = &doms->members[dom->listIndex];
+
+    /* the next reader builds a fresh copy */
+    virObjectUnref(doms->snapshot);
+    doms->snapshot = NULL;
+
+    if (remove) {
+        if (!entry)
+            return;
+        if (entry->id != -1)
+            doms->nactive--;
+        doms->membersNamesLen -= strlen(entry->name) + 1;
+        VIR_FREE(entry->name);
+        /* fill the hole with the last entry */
+        *entry = doms->members[--doms->nmembers];
+        entry->obj->listIndex = entry - doms->members;
+        return;
+    }
+
+    if (!entry) {
+        if (VIR_RESIZE_N(doms->members, doms->nmembers_max,
+                         doms->nmembers, 1) < 0)
+            goto no_memory;
+        entry = &doms->members[doms->nmembers];
+        entry->obj = dom;
+        entry->name = NULL;
+        entry->id = -1;
+        dom->listIndex = doms->nmembers++;
+    }
+
+    if (!entry->name || STRNEQ(entry->name, dom->def->name)) {
+        if (!(name = strdup(dom->def->name)))
+            goto no_memory;
+        if (entry->name)
+            doms->membersNamesLen -= strlen(entry->name) + 1;
+        doms->membersNamesLen += strlen(name) + 1;
+        VIR_FREE(entry->name);
+        entry->name = name;
+    }
+
+    doms->nactive += (dom->def->id != -1) - (entry->id != -1);
+    entry->id = dom->def->id;
+    return;
+
+no_memory:
+    virReportOOMError();
+    VIR_WARN("Unable to update domain list membership, "
+             "falling back to locked listing");
+    for (i = 0; i < doms->nmembers; i++)
+        VIR_FREE(doms->members[i].name);
+    VIR_FREE(doms->members);
+    doms->nmembers = doms->nmembers_max = doms->nactive = 0;
+    doms->membersNamesLen = 0;
+    doms->membersBroken = true;
+}
+
+
+/*
+ * Allocate a copy of the membership with room for 'nentries'
+ * entries and 'namesLen' bytes of names, to be filled in by
+ * virDomainObjListSnapshotFill
+ */
+static virDomainObjListSnapshotPtr
+virDomainObjListSnapshotNew(size_t nentries,
+                            size_t namesLen)
+{
+    virDomainObjListSnapshotPtr snap;
+
+    if (!(snap = virObjectNew(virDomainObjListSnapshotClass)))
+        return NULL;
+
+    if (VIR_ALLOC_N(snap->entries, nentries) < 0 ||
+        VIR_ALLOC_N(snap->names, namesLen) < 0) {
+        virReportOOMError();
+        virObjectUnref(snap);
+        return NULL;
+    }
+
+    return snap;
+}
+
+
+/*
+ * Copy the membership of the list into 'snap', which was allocated
+ * for 'nentries' entries and 'namesLen' bytes of names. This only
+ * copies memory and takes references, so it is cheap enough to do
+ * with doms->idsLock held, which the caller must. Returns false if
+ * the membership grew too large for 'snap' meanwhile.
+ */
+static bool
+virDomainObjListSnapshotFill(virDomainObjListPtr doms,
+                             virDomainObjListSnapshotPtr snap,
+                             size_t nentries,
+                             size_t namesLen)
+{
+    virDomainObjListSnapshotEntryPtr entry;
+    char *name = snap->names;
+    size_t len;
+    size_t i;
+
+    if (doms->nmembers > nentries || doms->membersNamesLen > namesLen)
+        return false;
+
+    for (i = 0; i < doms->nmembers; i++) {
+        entry = &snap->entries[snap->nentries];
+        len = strlen(doms->members[i].name) + 1;
+        entry->name = memcpy(name, doms->members[i].name, len);
+        name += len;
+        entry->obj = virObjectRef(doms->members[i].obj);
+        entry->id = doms->members[i].id;
+        snap->nentries++;
+    }
+
+    return true;
+}
+
+
+/*
+ * Get a reference to a copy of the current membership, or NULL
+ * if readers have to walk the list under its lock. The copy is
+ * allocated with doms->idsLock released, and only filled in once
+ * it is taken again, so that writers aren't held up by a reader
+ * building a fresh copy. If the membership grew meanwhile, the
+ * allocation is tried again with the new size.
+ */
+static virDomainObjListSnapshotPtr
+virDomainObjListSnapshotGet(virDomainObjListPtr doms)
+{
+    virDomainObjListSnapshotPtr snap = NULL;
+    virDomainObjListSnapshotPtr ret;
+    size_t nentries = 0;
+    size_t namesLen = 0;
+
+    virMutexLock(&doms->idsLock);
+    while (!doms->snapshot && !doms->membersBroken) {
+        if (snap &&
+            virDomainObjListSnapshotFill(doms, snap, nentries, namesLen)) {
+            doms->snapshot = snap;
+            snap = NULL;
+            break;
+        }
+
+        nentries = doms->nmembers;
+        namesLen = doms->membersNamesLen;
+        virMutexUnlock(&doms->idsLock);
+
+        virObjectUnref(snap);
+        snap = virDomainObjListSnapshotNew(nentries, namesLen);
+
+        virMutexLock(&doms->idsLock);
+        if (!snap)
+            break;
+    }
+    ret = virObjectRef(doms->snapshot);
+    virMutexUnlock(&doms->idsLock);
+
+    /* Another reader may have stored its copy first */
+    virObjectUnref(snap);
+
+    return ret;
 }
 
 
-static int virDomainObjListSearchID(const void *payload,
+static int virDomainObjListMatchObj(const void *payload,
                                     const void *name ATTRIBUTE_UNUSED,
                                     const void *data)
 {
-    virDomainObjPtr obj = (virDomainObjPtr)payload;
-    const int *id = data;
-    int want = 0;
+    return payload == data;
+}
 
-    virObjectLock(obj);
-    if (virDomainObjIsActive(obj) &&
-        obj->def->id == *id)
-        want = 1;
-    virObjectUnlock(obj);
-    return want;
+
+/*
+ * Change the ID of 'dom' as it starts or stops, keeping
+ * the lookup-by-id index up to date. The caller must
+ * hold a lock on 'dom', and may or may not hold the list
+ * lock.
+ */
+void virDomainObjListSetID(virDomainObjListPtr doms,
+                           virDomainObjPtr dom,
+                           int id)
+{
+    virMutexLock(&doms->idsLock);
+    virDomainObjListUnindexID(doms, dom, dom->def->id);
+    dom->def->id = id;
+    virDomainObjListIndexID(doms, dom);
+    virDomainObjListSnapshotUpdate(doms, dom, false);
+    virMutexUnlock(&doms->idsLock);
 }
 
+
 virDomainObjPtr virDomainObjListFindByID(const virDomainObjListPtr doms,
                                          int id)
 {
     virDomainObjPtr obj;
+    char idstr[INT_BUFSIZE_BOUND(id)];
+
+    snprintf(idstr, sizeof(idstr), "%d", id);
+
+    virMutexLock(&doms->idsLock);
+    if ((obj = virHashLookup(doms->ids, idstr)))
+        virObjectRef(obj);
+    virMutexUnlock(&doms->idsLock);
+
+    if (!obj)
+        return NULL;
+
+    virObjectLock(obj);
+
+    /* The domain may have stopped, or been removed from
+     * the list, while we waited for its lock. As long as
+     * it is still indexed, the list holds a reference */
+    virMutexLock(&doms->idsLock);
+    if (virHashLookup(doms->ids, idstr) != obj ||
+        !virDomainObjIsActive(obj) ||
+        obj->def->id != id) {
+        virMutexUnlock(&doms->idsLock);
+        virObjectUnlock(obj);
+        virObjectUnref(obj);
+        return NULL;
+    }
+    virMutexUnlock(&doms->idsLock);
+
+    virObjectUnref(obj);
+    return obj;
+}
+
+
+/**
+ * virDomainObjListLoadDef:
+ * @doms: the list @dom belongs to
+ * @dom: a locked domain
+ *
+ * Parse the config of a domain which virDomainObjListLoadAllConfigsCached
+ * only loaded the name and UUID of, if it hasn't been yet.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virDomainObjListLoadDef(virDomainObjListPtr doms,
+                            virDomainObjPtr dom)
+{
+    virCapsPtr caps;
+    virDomainXMLOptionPtr xmlopt;
+    unsigned int expectedVirtTypes;
+    virDomainDefPtr def = NULL;
+    int ret = -1;
+
+    if (!dom->defFile)
+        return 0;
+
+    virMutexLock(&doms->idsLock);
+    caps = virObjectRef(doms->caps);
+    xmlopt = virObjectRef(doms->xmlopt);
+    expectedVirtTypes = doms->expectedVirtTypes;
+    virMutexUnlock(&doms->idsLock);
+
+    VIR_DEBUG("Loading deferred config file '%s'", dom->defFile);
+    if (!(def = virDomainDefParseFile(dom->defFile, caps, xmlopt,
+                                      expectedVirtTypes,
+                                      VIR_DOMAIN_XML_INACTIVE)))
+        goto cleanup;
+
+    if (STRNEQ(def->name, dom->def->name) ||
+        memcmp(def->uuid, dom->def->uuid, VIR_UUID_BUFLEN) != 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("config file '%s' no longer matches domain '%s'"),
+                       dom->defFile, dom->def->name);
+        goto cleanup;
+    }
+
+    virDomainDefFree(dom->def);
+    dom->def = def;
+    def = NULL;
+    VIR_FREE(dom->defFile);
+    ret = 0;
+
+cleanup:
+    virDomainDefFree(def);
+    virObjectUnref(caps);
+    virObjectUnref(xmlopt);
+    return ret;
+}
+
+
+/*
+ * Forget about 'dom', which the caller has locked along with the
+ * list, because its deferred config failed to load. That leaves the
+ * list as if the config had been parsed right away, which skips
+ * broken configs. 'dom' is unlocked, and may be gone on return.
+ */
+static void
+virDomainObjListDropDeferred(virDomainObjListPtr doms,
+                             virDomainObjPtr dom)
+{
+    virErrorPtr err = virGetLastError();
+
+    VIR_ERROR(_("Failed to load config for domain '%s': %s"),
+              dom->def->name, err ? err->message : _("unknown error"));
+    virResetLastError();
+    virDomainObjListRemoveLocked(doms, dom);
+}
+
+
+/*
+ * Finish a lookup of 'obj', found under 'key' in 'table' and locked
+ * by the caller, by loading its definition if that was deferred. If
+ * that fails, take the locks in order and look the domain up again,
+ * as another thread may have loaded or replaced it meanwhile
+ */
+static virDomainObjPtr
+virDomainObjListFindLoad(virDomainObjListPtr doms,
+                         virHashTablePtr table,
+                         const void *key,
+                         virDomainObjPtr obj)
+{
+    if (!obj || virDomainObjListLoadDef(doms, obj) == 0)
+        return obj;
+
+    virObjectUnlock(obj);
     virObjectLock(doms);
-    obj = virHashSearch(doms->objs, virDomainObjListSearchID, &id);
-    if (obj)
+    if ((obj = virHashLookup(table, key))) {
         virObjectLock(obj);
+        if (virDomainObjListLoadDef(doms, obj) < 0) {
+            virDomainObjListDropDeferred(doms, obj);
+            obj = NULL;
+        }
+    }
     virObjectUnlock(doms);
+
     return obj;
 }
 
@@ -980,21 +1434,7 @@ virDomainObjPtr virDomainObjListFindByUUID(const virDomainObjListPtr doms,
     if (obj)
         virObjectLock(obj);
     virObjectUnlock(doms);
-    return obj;
-}
-
-static int virDomainObjListSearchName(const void *payload,
-                                      const void *name ATTRIBUTE_UNUSED,
-                                      const void *data)
-{
-    virDomainObjPtr obj = (virDomainObjPtr)payload;
-    int want = 0;
-
-    virObjectLock(obj);
-    if (STREQ(obj->def->name, (const char *)data))
-        want = 1;
-    virObjectUnlock(obj);
-    return want;
+    return virDomainObjListFindLoad(doms, doms->objs, uuidstr, obj);
 }
 
 virDomainObjPtr virDomainObjListFindByName(const virDomainObjListPtr doms,
@@ -1002,11 +1442,11 @@ virDomainObjPtr virDomainObjListFindByName(const virDomainObjListPtr doms,
 {
     virDomainObjPtr obj;
     virObjectLock(doms);
-    obj = virHashSearch(doms->objs, virDomainObjListSearchName, name);
+    obj = virHashLookup(doms->objsName, name);
     if (obj)
         virObjectLock(obj);
     virObjectUnlock(doms);
-    return obj;
+    return virDomainObjListFindLoad(doms, doms->objsName, name, obj);
 }
 
 
@@ -1986,7 +2426,17 @@ void virDomainDefFree(virDomainDefPtr def)
 
     virDomainVcpuPinDefFree(def->cputune.emulatorpin);
 
+    virDomainVcpuPinDefArrayFree(def->cputune.iothreadspin,
+                                 def->cputune.niothreadspin);
+
     virBitmapFree(def->numatune.memory.nodemask);
+    for (i = 0; i < def->numatune.nmem_nodes; i++)
+        virBitmapFree(def->numatune.mem_nodes[i].nodeset);
+    VIR_FREE(def->numatune.mem_nodes);
+
+    for (i = 0; i < def->mem.nhugepages; i++)
+        virBitmapFree(def->mem.hugepages[i].nodeset);
+    VIR_FREE(def->mem.hugepages);
 
     virSysinfoDefFree(def->sysinfo);
 
@@ -2007,6 +2457,7 @@ static void virDomainObjDispose(void *obj)
     VIR_DEBUG("obj=%p", dom);
     virDomainDefFree(dom->def);
     virDomainDefFree(dom->newDef);
+    VIR_FREE(dom->defFile);
 
     if (dom->privateDataFreeFunc)
         (dom->privateDataFreeFunc)(dom->privateData);
@@ -2103,15 +2554,29 @@ virDomainObjListAddLocked(virDomainObjListPtr doms,
 {
     virDomainObjPtr vm;
     char uuidstr[VIR_UUID_STRING_BUFLEN];
+    int oldid;
 
     if (oldDef)
         *oldDef = false;
 
     virUUIDFormat(def->uuid, uuidstr);
 
+    /* The current definition may be kept as the persistent one, so
+     * load it if it was deferred. If that fails, the domain is replaced,
+     * like it would be if its config had been skipped right away */
+    if ((vm = virHashLookup(doms->objs, uuidstr)) ||
+        (vm = virHashLookup(doms->objsName, def->name))) {
+        virObjectLock(vm);
+        if (virDomainObjListLoadDef(doms, vm) < 0)
+            virDomainObjListDropDeferred(doms, vm);
+        else
+            virObjectUnlock(vm);
+    }
+
     /* See if a VM with matching UUID already exists */
     if ((vm = virHashLookup(doms->objs, uuidstr))) {
         virObjectLock(vm);
+
         /* UUID matches, but if names don't match, refuse it */
         if (STRNEQ(vm->def->name, def->name)) {
             virUUIDFormat(vm->def->uuid, uuidstr);
@@ -2131,13 +2596,21 @@ virDomainObjListAddLocked(virDomainObjListPtr doms,
             }
         }
 
+        oldid = vm->def->id;
         virDomainObjAssignDef(vm,
                               def,
                               !!(flags & VIR_DOMAIN_OBJ_LIST_ADD_LIVE),
                               oldDef);
+        if (vm->def->id != oldid) {
+            virMutexLock(&doms->idsLock);
+            virDomainObjListUnindexID(doms, vm, oldid);
+            virDomainObjListIndexID(doms, vm);
+            virDomainObjListSnapshotUpdate(doms, vm, false);
+            virMutexUnlock(&doms->idsLock);
+        }
     } else {
         /* UUID does not match, but if a name matches, refuse it */
-        if ((vm = virHashSearch(doms->objs, virDomainObjListSearchName, def->name))) {
+        if ((vm = virHashLookup(doms->objsName, def->name))) {
             virObjectLock(vm);
             virUUIDFormat(vm->def->uuid, uuidstr);
             virReportError(VIR_ERR_OPERATION_FAILED,
@@ -2155,6 +2628,16 @@ virDomainObjListAddLocked(virDomainObjListPtr doms,
             virObjectUnref(vm);
             return NULL;
         }
+
+        if (virHashAddEntry(doms->objsName, def->name, vm) < 0) {
+            virHashRemoveEntry(doms->objs, uuidstr);
+            return NULL;
+        }
+
+        virMutexLock(&doms->idsLock);
+        virDomainObjListIndexID(doms, vm);
+        virDomainObjListSnapshotUpdate(doms, vm, false);
+        virMutexUnlock(&doms->idsLock);
     }
 cleanup:
     return vm;
@@ -2300,20 +2783,38 @@ cleanup:
 void virDomainObjListRemove(virDomainObjListPtr doms,
                             virDomainObjPtr dom)
 {
-    char uuidstr[VIR_UUID_STRING_BUFLEN];
-
-    virUUIDFormat(dom->def->uuid, uuidstr);
     virObjectRef(dom);
     virObjectUnlock(dom);
 
     virObjectLock(doms);
     virObjectLock(dom);
-    virHashRemoveEntry(doms->objs, uuidstr);
-    virObjectUnlock(dom);
+    virDomainObjListRemoveLocked(doms, dom);
     virObjectUnref(dom);
     virObjectUnlock(doms);
 }
 
+/*
+ * Same as virDomainObjListRemove, for callers which already
+ * hold the lock of @doms, including virDomainObjListForEach
+ * callbacks removing the domain they were called for.
+ * The @dom lock is released, and @dom may be gone on return.
+ */
+void virDomainObjListRemoveLocked(virDomainObjListPtr doms,
+                                  virDomainObjPtr dom)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+    virUUIDFormat(dom->def->uuid, uuidstr);
+    virMutexLock(&doms->idsLock);
+    virHashRemoveSet(doms->ids, virDomainObjListMatchObj, dom);
+    virDomainObjListSnapshotUpdate(doms, dom, true);
+    virMutexUnlock(&doms->idsLock);
+    if (virHashLookup(doms->objsName, dom->def->name) == dom)
+        virHashRemoveEntry(doms->objsName, dom->def->name);
+    virObjectUnlock(dom);
+    virHashRemoveEntry(doms->objs, uuidstr);
+}
+
 static int
 virDomainDeviceCCWAddressIsValid(virDomainDeviceCCWAddressPtr addr)
 {
@@ -4414,6 +4915,7 @@ virDomainDiskDefParseXML(virDomainXMLOptionPtr xmlopt,
     char *ioeventfd = NULL;
     char *event_idx = NULL;
     char *copy_on_read = NULL;
+    char *iothread = NULL;
     char *mirror = NULL;
     char *mirrorFormat = NULL;
     bool mirroring = false;
@@ -4658,6 +5160,7 @@ virDomainDiskDefParseXML(virDomainXMLOptionPtr xmlopt,
                 ioeventfd = virXMLPropString(cur, "ioeventfd");
                 event_idx = virXMLPropString(cur, "event_idx");
                 copy_on_read = virXMLPropString(cur, "copy_on_read");
+                iothread = virXMLPropString(cur, "iothread");
             } else if (!mirror && xmlStrEqual(cur->name, BAD_CAST "mirror") &&
                        !(flags & VIR_DOMAIN_XML_INACTIVE)) {
                 char *ready;
@@ -5104,6 +5607,21 @@ virDomainDiskDefParseXML(virDomainXMLOptionPtr xmlopt,
         def->copy_on_read = cor;
     }
 
+    if (iothread) {
+        if (def->bus != VIR_DOMAIN_DISK_BUS_VIRTIO) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                           _("disk iothread supported only for virtio bus"));
+            goto error;
+        }
+
+        if (virStrToLong_ui(iothread, NULL, 10, &def->iothread) < 0 ||
+            def->iothread == 0) {
+            virReportError(VIR_ERR_XML_ERROR,
+                           _("Invalid disk iothread '%s'"), iothread);
+            goto error;
+        }
+    }
+
     if (devaddr) {
         if (virDomainParseLegacyDeviceAddress(devaddr,
                                               &def->info.addr.pci) < 0) {
@@ -5223,6 +5741,7 @@ cleanup:
     VIR_FREE(ioeventfd);
     VIR_FREE(event_idx);
     VIR_FREE(copy_on_read);
+    VIR_FREE(iothread);
     VIR_FREE(devaddr);
     VIR_FREE(serial);
     virStorageEncryptionFree(encryption);
@@ -5818,6 +6337,7 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
     char *txmode = NULL;
     char *ioeventfd = NULL;
     char *event_idx = NULL;
+    char *queues = NULL;
     char *filter = NULL;
     char *internal = NULL;
     char *devaddr = NULL;
@@ -5929,6 +6449,7 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
                 txmode = virXMLPropString(cur, "txmode");
                 ioeventfd = virXMLPropString(cur, "ioeventfd");
                 event_idx = virXMLPropString(cur, "event_idx");
+                queues = virXMLPropString(cur, "queues");
             } else if (xmlStrEqual(cur->name, BAD_CAST "filterref")) {
                 if (filter) {
                     virReportError(VIR_ERR_XML_ERROR, "%s",
@@ -6219,6 +6740,19 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             }
             def->driver.virtio.event_idx = idx;
         }
+        if (queues) {
+            unsigned int q;
+            if (virStrToLong_ui(queues, NULL, 10, &q) < 0 || q == 0) {
+                virReportError(VIR_ERR_XML_ERROR,
+                               _("Malformed 'queues' value '%s'"), queues);
+                goto error;
+            }
+            def->driver.virtio.queues = q;
+        }
+    } else if (queues) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                       _("'queues' is only supported by virtio interfaces"));
+        goto error;
     }
 
     def->linkstate = VIR_DOMAIN_NET_INTERFACE_LINK_STATE_DEFAULT;
@@ -6272,6 +6806,7 @@ cleanup:
     VIR_FREE(txmode);
     VIR_FREE(ioeventfd);
     VIR_FREE(event_idx);
+    VIR_FREE(queues);
     VIR_FREE(filter);
     VIR_FREE(type);
     VIR_FREE(internal);
@@ -9870,28 +10405,321 @@ error:
     goto cleanup;
 }
 
-/*
- * Return the vcpupin related with the vcpu id on SUCCESS, or
- * NULL on failure.
+
+/* Parse the XML definition for a iothreadpin, which has the form of
+ *
+ *   <iothreadpin iothread='1' cpuset='2'/>
+ *
+ * The iothread id is stored as the vcpuid of the returned pin
+ * definition and ranges from 1 to @iothreads.
  */
-virDomainVcpuPinDefPtr
-virDomainLookupVcpuPin(virDomainDefPtr def,
-                       int vcpuid)
+static virDomainVcpuPinDefPtr
+virDomainIOThreadPinDefParseXML(const xmlNodePtr node,
+                                xmlXPathContextPtr ctxt,
+                                unsigned int iothreads)
 {
-    int i;
+    virDomainVcpuPinDefPtr def;
+    xmlNodePtr oldnode = ctxt->node;
+    unsigned int iothreadid;
+    char *tmp = NULL;
 
-    if (!def->cputune.vcpupin)
+    if (VIR_ALLOC(def) < 0) {
+        virReportOOMError();
         return NULL;
-
-    for (i = 0; i < def->cputune.nvcpupin; i++) {
-        if (def->cputune.vcpupin[i]->vcpuid == vcpuid)
-            return def->cputune.vcpupin[i];
     }
 
-    return NULL;
-}
+    ctxt->node = node;
 
-int
+    if (!(tmp = virXPathString("string(./@iothread)", ctxt))) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("missing iothread id in iothreadpin"));
+        goto error;
+    }
+
+    if (virStrToLong_ui(tmp, NULL, 10, &iothreadid) < 0) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("invalid setting for iothread '%s'"), tmp);
+        goto error;
+    }
+    VIR_FREE(tmp);
+
+    if (iothreadid == 0 || iothreadid > iothreads) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("iothread id '%u' must be in range [1, %u]"),
+                       iothreadid, iothreads);
+        goto error;
+    }
+
+    def->vcpuid = iothreadid;
+
+    if (!(tmp = virXMLPropString(node, "cpuset"))) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("missing cpuset for iothreadpin"));
+        goto error;
+    }
+
+    if (virBitmapParse(tmp, 0, &def->cpumask, VIR_DOMAIN_CPUMASK_LEN) < 0)
+        goto error;
+
+cleanup:
+    VIR_FREE(tmp);
+    ctxt->node = oldnode;
+    return def;
+
+error:
+    virDomainVcpuPinDefFree(def);
+    def = NULL;
+    goto cleanup;
+}
+
+
+/* Parse the XML definition for a hugepage size, which has the form of
+ *
+ *   <page size='1' unit='G' nodeset='0-1'/>
+ *
+ * The size is stored in KiB. A page without nodeset sets the default
+ * size for all guest NUMA cells not listed elsewhere.
+ */
+static int
+virDomainHugepageParseXML(const xmlNodePtr node,
+                          virDomainHugePagePtr hugepage)
+{
+    char *size = NULL;
+    char *unit = NULL;
+    char *nodeset = NULL;
+    unsigned long long bytes;
+    int ret = -1;
+
+    if (!(size = virXMLPropString(node, "size"))) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("missing hugepage size"));
+        goto cleanup;
+    }
+
+    if (virStrToLong_ull(size, NULL, 10, &bytes) < 0) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("invalid hugepage size '%s'"), size);
+        goto cleanup;
+    }
+
+    unit = virXMLPropString(node, "unit");
+    if (virScaleInteger(&bytes, unit, 1024, ULLONG_MAX) < 0)
+        goto cleanup;
+
+    if (!(hugepage->size = VIR_DIV_UP(bytes, 1024))) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("hugepage size can't be zero"));
+        goto cleanup;
+    }
+
+    if ((nodeset = virXMLPropString(node, "nodeset")) &&
+        virBitmapParse(nodeset, 0, &hugepage->nodeset,
+                       VIR_DOMAIN_CPUMASK_LEN) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(size);
+    VIR_FREE(unit);
+    VIR_FREE(nodeset);
+    return ret;
+}
+
+
+/* Parse the XML definition for a per guest NUMA cell memory binding,
+ * which has the form of
+ *
+ *   <memnode cellid='0' mode='strict' nodeset='1'/>
+ */
+static int
+virDomainNumatuneMemNodeParseXML(virDomainDefPtr def,
+                                 const xmlNodePtr node)
+{
+    virNumaTuneNodeDefPtr mem_node;
+    unsigned int cellid;
+    char *tmp = NULL;
+    int mode = VIR_DOMAIN_NUMATUNE_MEM_STRICT;
+    int ret = -1;
+
+    if (!(tmp = virXMLPropString(node, "cellid"))) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("missing cellid in memnode"));
+        goto cleanup;
+    }
+
+    if (virStrToLong_ui(tmp, NULL, 10, &cellid) < 0 ||
+        cellid >= VIR_DOMAIN_CPUMASK_LEN) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("invalid cellid '%s' in memnode"), tmp);
+        goto cleanup;
+    }
+    VIR_FREE(tmp);
+
+    if (cellid < def->numatune.nmem_nodes &&
+        def->numatune.mem_nodes[cellid].nodeset) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("multiple memnode elements with cellid %u"),
+                       cellid);
+        goto cleanup;
+    }
+
+    if ((tmp = virXMLPropString(node, "mode")) &&
+        (mode = virDomainNumatuneMemModeTypeFromString(tmp)) < 0) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("Unsupported NUMA memory tuning mode '%s'"), tmp);
+        goto cleanup;
+    }
+    VIR_FREE(tmp);
+
+    if (cellid >= def->numatune.nmem_nodes &&
+        VIR_EXPAND_N(def->numatune.mem_nodes, def->numatune.nmem_nodes,
+                     cellid + 1 - def->numatune.nmem_nodes) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+    mem_node = &def->numatune.mem_nodes[cellid];
+
+    if (!(tmp = virXMLPropString(node, "nodeset"))) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("missing nodeset for memnode with cellid %u"),
+                       cellid);
+        goto cleanup;
+    }
+
+    if (virBitmapParse(tmp, 0, &mem_node->nodeset,
+                       VIR_DOMAIN_CPUMASK_LEN) < 0)
+        goto cleanup;
+    mem_node->mode = mode;
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(tmp);
+    return ret;
+}
+
+
+/* Check the per guest NUMA cell memory settings against the cells
+ * actually defined in <cpu><numa>. */
+static int
+virDomainDefNumaCellsValidate(virDomainDefPtr def)
+{
+    size_t ncells = def->cpu ? def->cpu->ncells : 0;
+    bool has_default = false;
+    virBitmapPtr seen = NULL;
+    int ret = -1;
+    size_t i;
+
+    for (i = 0; i < def->numatune.nmem_nodes; i++) {
+        if (!def->numatune.mem_nodes[i].nodeset)
+            continue;
+
+        if (i >= ncells) {
+            virReportError(VIR_ERR_XML_ERROR,
+                           _("memnode cellid %zu doesn't match any "
+                             "guest NUMA cell"), i);
+            goto cleanup;
+        }
+
+        if (def->numatune.memory.placement_mode ==
+            VIR_NUMA_TUNE_MEM_PLACEMENT_MODE_AUTO) {
+            virReportError(VIR_ERR_XML_ERROR, "%s",
+                           _("per-node memory binding is not compatible "
+                             "with automatic NUMA placement"));
+            goto cleanup;
+        }
+
+        /* The nodeset of the whole domain is enforced too, so the
+         * cell can't be bound outside of it */
+        if (def->numatune.memory.nodemask) {
+            int node = -1;
+
+            while ((node = virBitmapNextSetBit(def->numatune.mem_nodes[i].nodeset,
+                                               node)) >= 0) {
+                bool set;
+
+                if (virBitmapGetBit(def->numatune.memory.nodemask,
+                                    node, &set) < 0 || !set) {
+                    virReportError(VIR_ERR_XML_ERROR,
+                                   _("memnode cellid %zu is bound to host "
+                                     "node %d outside of the domain's "
+                                     "nodeset"), i, node);
+                    goto cleanup;
+                }
+            }
+        }
+    }
+
+    if (!(seen = virBitmapNew(VIR_DOMAIN_CPUMASK_LEN))) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    for (i = 0; i < def->mem.nhugepages; i++) {
+        virBitmapPtr nodeset = def->mem.hugepages[i].nodeset;
+        int cell = -1;
+
+        if (!nodeset) {
+            if (has_default) {
+                virReportError(VIR_ERR_XML_ERROR, "%s",
+                               _("only one default hugepage size is "
+                                 "allowed"));
+                goto cleanup;
+            }
+            has_default = true;
+            continue;
+        }
+
+        while ((cell = virBitmapNextSetBit(nodeset, cell)) >= 0) {
+            bool dup;
+
+            if ((size_t) cell >= ncells) {
+                virReportError(VIR_ERR_XML_ERROR,
+                               _("hugepage nodeset refers to guest NUMA "
+                                 "cell %d which doesn't exist"), cell);
+                goto cleanup;
+            }
+            if (virBitmapGetBit(seen, cell, &dup) < 0 || dup) {
+                virReportError(VIR_ERR_XML_ERROR,
+                               _("guest NUMA cell %d has multiple "
+                                 "hugepage sizes"), cell);
+                goto cleanup;
+            }
+            ignore_value(virBitmapSetBit(seen, cell));
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    virBitmapFree(seen);
+    return ret;
+}
+
+
+/*
+ * Return the vcpupin related with the vcpu id on SUCCESS, or
+ * NULL on failure.
+ */
+virDomainVcpuPinDefPtr
+virDomainLookupVcpuPin(virDomainDefPtr def,
+                       int vcpuid)
+{
+    int i;
+
+    if (!def->cputune.vcpupin)
+        return NULL;
+
+    for (i = 0; i < def->cputune.nvcpupin; i++) {
+        if (def->cputune.vcpupin[i]->vcpuid == vcpuid)
+            return def->cputune.vcpupin[i];
+    }
+
+    return NULL;
+}
+
+int
 virDomainDefMaybeAddController(virDomainDefPtr def,
                                int type,
                                int idx,
@@ -10157,9 +10985,28 @@ virDomainDefParseXML(xmlDocPtr xml,
         def->mem.cur_balloon = def->mem.max_balloon;
     }
 
-    if ((node = virXPathNode("./memoryBacking/hugepages", ctxt)))
+    if ((node = virXPathNode("./memoryBacking/hugepages", ctxt))) {
         def->mem.hugepage_backed = true;
 
+        if ((n = virXPathNodeSet("./memoryBacking/hugepages/page",
+                                 ctxt, &nodes)) < 0)
+            goto error;
+
+        if (n && VIR_ALLOC_N(def->mem.hugepages, n) < 0)
+            goto no_memory;
+
+        for (i = 0; i < n; i++) {
+            if (virDomainHugepageParseXML(nodes[i],
+                                          &def->mem.hugepages[i]) < 0)
+                goto error;
+            def->mem.nhugepages++;
+        }
+        VIR_FREE(nodes);
+    }
+
+    if (virXPathNode("./memoryBacking/locked", ctxt))
+        def->mem.locked = true;
+
     /* Extract blkio cgroup tunables */
     if (virXPathUInt("string(./blkiotune/weight)", ctxt,
                      &def->blkio.weight) < 0)
@@ -10275,6 +11122,20 @@ virDomainDefParseXML(xmlDocPtr xml,
         }
     }
 
+    n = virXPathULong("string(./iothreads[1])", ctxt, &count);
+    if (n == -2) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("iothreads count must be an integer"));
+        goto error;
+    } else if (n == 0) {
+        if ((unsigned int) count != count) {
+            virReportError(VIR_ERR_XML_ERROR,
+                           _("invalid iothreads count '%lu'"), count);
+            goto error;
+        }
+        def->iothreads = count;
+    }
+
     /* Extract cpu tunables. */
     if (virXPathULong("string(./cputune/shares[1])", ctxt,
                       &def->cputune.shares) < -1) {
@@ -10445,6 +11306,35 @@ virDomainDefParseXML(xmlDocPtr xml,
     }
     VIR_FREE(nodes);
 
+    if ((n = virXPathNodeSet("./cputune/iothreadpin", ctxt, &nodes)) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot extract iothreadpin nodes"));
+        goto error;
+    }
+
+    if (n && VIR_ALLOC_N(def->cputune.iothreadspin, n) < 0)
+        goto no_memory;
+
+    for (i = 0; i < n; i++) {
+        virDomainVcpuPinDefPtr iothreadpin;
+
+        if (!(iothreadpin = virDomainIOThreadPinDefParseXML(nodes[i], ctxt,
+                                                            def->iothreads)))
+            goto error;
+
+        if (virDomainVcpuPinIsDuplicate(def->cputune.iothreadspin,
+                                        def->cputune.niothreadspin,
+                                        iothreadpin->vcpuid)) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("duplicate iothreadpin for same iothread"));
+            virDomainVcpuPinDefFree(iothreadpin);
+            goto error;
+        }
+
+        def->cputune.iothreadspin[def->cputune.niothreadspin++] = iothreadpin;
+    }
+    VIR_FREE(nodes);
+
     /* Extract numatune if exists. */
     if ((n = virXPathNodeSet("./numatune", ctxt, &nodes)) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -10541,6 +11431,9 @@ virDomainDefParseXML(xmlDocPtr xml,
                         def->placement_mode = VIR_DOMAIN_CPU_PLACEMENT_MODE_AUTO;
 
                     def->numatune.memory.placement_mode = placement_mode;
+                } else if (xmlStrEqual(cur->name, BAD_CAST "memnode")) {
+                    if (virDomainNumatuneMemNodeParseXML(def, cur) < 0)
+                        goto error;
                 } else {
                     virReportError(VIR_ERR_XML_ERROR,
                                    _("unsupported XML element %s"),
@@ -11565,6 +12458,9 @@ virDomainDefParseXML(xmlDocPtr xml,
         }
     }
 
+    if (virDomainDefNumaCellsValidate(def) < 0)
+        goto error;
+
     if ((node = virXPathNode("./sysinfo[1]", ctxt)) != NULL) {
         xmlNodePtr oldnode = ctxt->node;
         ctxt->node = node;
@@ -13514,7 +14410,8 @@ virDomainDiskDefFormat(virBufferPtr buf,
     virBufferAddLit(buf, ">\n");
 
     if (def->driverName || def->format > 0 || def->cachemode ||
-        def->ioeventfd || def->event_idx || def->copy_on_read) {
+        def->ioeventfd || def->event_idx || def->copy_on_read ||
+        def->iothread) {
         virBufferAddLit(buf, "      <driver");
         if (def->driverName)
             virBufferAsprintf(buf, " name='%s'", def->driverName);
@@ -13535,6 +14432,8 @@ virDomainDiskDefFormat(virBufferPtr buf,
             virBufferAsprintf(buf, " event_idx='%s'", event_idx);
         if (def->copy_on_read)
             virBufferAsprintf(buf, " copy_on_read='%s'", copy_on_read);
+        if (def->iothread)
+            virBufferAsprintf(buf, " iothread='%u'", def->iothread);
         virBufferAddLit(buf, "/>\n");
     }
 
@@ -14141,7 +15040,8 @@ virDomainNetDefFormat(virBufferPtr buf,
         virBufferEscapeString(buf, "<model type='%s'/>\n",
                               def->model);
         if (STREQ(def->model, "virtio") &&
-            (def->driver.virtio.name || def->driver.virtio.txmode)) {
+            (def->driver.virtio.name || def->driver.virtio.txmode ||
+             def->driver.virtio.queues)) {
             virBufferAddLit(buf, "<driver");
             if (def->driver.virtio.name) {
                 virBufferAsprintf(buf, " name='%s'",
@@ -14159,6 +15059,8 @@ virDomainNetDefFormat(virBufferPtr buf,
                 virBufferAsprintf(buf, " event_idx='%s'",
                                   virDomainVirtioEventIdxTypeToString(def->driver.virtio.event_idx));
             }
+            if (def->driver.virtio.queues)
+                virBufferAsprintf(buf, " queues='%u'", def->driver.virtio.queues);
             virBufferAddLit(buf, "/>\n");
         }
     }
@@ -15464,11 +16366,30 @@ virDomainDefFormatInternal(virDomainDefPtr def,
         def->mem.swap_hard_limit)
         virBufferAddLit(buf, "  </memtune>\n");
 
-    if (def->mem.hugepage_backed) {
-        virBufferStrcat(buf,
-                        "  <memoryBacking>\n",
-                        "    <hugepages/>\n",
-                        "  </memoryBacking>\n", NULL);
+    if (def->mem.hugepage_backed || def->mem.locked) {
+        virBufferAddLit(buf, "  <memoryBacking>\n");
+        if (def->mem.hugepage_backed && !def->mem.nhugepages) {
+            virBufferAddLit(buf, "    <hugepages/>\n");
+        } else if (def->mem.hugepage_backed) {
+            virBufferAddLit(buf, "    <hugepages>\n");
+            for (i = 0; i < def->mem.nhugepages; i++) {
+                virBufferAsprintf(buf, "      <page size='%llu' unit='KiB'",
+                                  def->mem.hugepages[i].size);
+                if (def->mem.hugepages[i].nodeset) {
+                    char *nodeset;
+
+                    if (!(nodeset = virBitmapFormat(def->mem.hugepages[i].nodeset)))
+                        goto no_memory;
+                    virBufferAsprintf(buf, " nodeset='%s'", nodeset);
+                    VIR_FREE(nodeset);
+                }
+                virBufferAddLit(buf, "/>\n");
+            }
+            virBufferAddLit(buf, "    </hugepages>\n");
+        }
+        if (def->mem.locked)
+            virBufferAddLit(buf, "    <locked/>\n");
+        virBufferAddLit(buf, "  </memoryBacking>\n");
     }
 
     virBufferAddLit(buf, "  <vcpu");
@@ -15486,10 +16407,13 @@ virDomainDefFormatInternal(virDomainDefPtr def,
         virBufferAsprintf(buf, " current='%u'", def->vcpus);
     virBufferAsprintf(buf, ">%u</vcpu>\n", def->maxvcpus);
 
+    if (def->iothreads > 0)
+        virBufferAsprintf(buf, "  <iothreads>%u</iothreads>\n", def->iothreads);
+
     if (def->cputune.shares ||
         (def->cputune.nvcpupin && !virDomainIsAllVcpupinInherited(def)) ||
         def->cputune.period || def->cputune.quota ||
-        def->cputune.emulatorpin ||
+        def->cputune.emulatorpin || def->cputune.niothreadspin ||
         def->cputune.emulator_period || def->cputune.emulator_quota)
         virBufferAddLit(buf, "  <cputune>\n");
 
@@ -15547,22 +16471,41 @@ virDomainDefFormatInternal(virDomainDefPtr def,
         virBufferAsprintf(buf, "cpuset='%s'/>\n", cpumask);
         VIR_FREE(cpumask);
     }
+
+    for (i = 0; i < def->cputune.niothreadspin; i++) {
+        char *cpumask;
+
+        if (!(cpumask = virBitmapFormat(def->cputune.iothreadspin[i]->cpumask))) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           "%s", _("failed to format cpuset for iothreadpin"));
+            goto error;
+        }
+
+        virBufferAsprintf(buf, "    <iothreadpin iothread='%u' cpuset='%s'/>\n",
+                          def->cputune.iothreadspin[i]->vcpuid, cpumask);
+        VIR_FREE(cpumask);
+    }
+
     if (def->cputune.shares ||
         (def->cputune.nvcpupin && !virDomainIsAllVcpupinInherited(def)) ||
         def->cputune.period || def->cputune.quota ||
-        def->cputune.emulatorpin ||
+        def->cputune.emulatorpin || def->cputune.niothreadspin ||
         def->cputune.emulator_period || def->cputune.emulator_quota)
         virBufferAddLit(buf, "  </cputune>\n");
 
     if (def->numatune.memory.nodemask ||
-        def->numatune.memory.placement_mode) {
+        def->numatune.memory.placement_mode ||
+        def->numatune.nmem_nodes) {
         virBufferAddLit(buf, "  <numatune>\n");
         const char *mode;
         char *nodemask = NULL;
         const char *placement;
 
-        mode = virDomainNumatuneMemModeTypeToString(def->numatune.memory.mode);
-        virBufferAsprintf(buf, "    <memory mode='%s' ", mode);
+        if (def->numatune.memory.nodemask ||
+            def->numatune.memory.placement_mode) {
+            mode = virDomainNumatuneMemModeTypeToString(def->numatune.memory.mode);
+            virBufferAsprintf(buf, "    <memory mode='%s' ", mode);
+        }
 
         if (def->numatune.memory.placement_mode ==
             VIR_NUMA_TUNE_MEM_PLACEMENT_MODE_STATIC) {
@@ -15579,6 +16522,21 @@ virDomainDefFormatInternal(virDomainDefPtr def,
             placement = virNumaTuneMemPlacementModeTypeToString(def->numatune.memory.placement_mode);
             virBufferAsprintf(buf, "placement='%s'/>\n", placement);
         }
+
+        for (i = 0; i < def->numatune.nmem_nodes; i++) {
+            virNumaTuneNodeDefPtr mem_node = &def->numatune.mem_nodes[i];
+
+            if (!mem_node->nodeset)
+                continue;
+
+            if (!(nodemask = virBitmapFormat(mem_node->nodeset)))
+                goto no_memory;
+            mode = virDomainNumatuneMemModeTypeToString(mem_node->mode);
+            virBufferAsprintf(buf,
+                              "    <memnode cellid='%d' mode='%s' nodeset='%s'/>\n",
+                              i, mode, nodemask);
+            VIR_FREE(nodemask);
+        }
         virBufferAddLit(buf, "  </numatune>\n");
     }
 
@@ -16216,9 +17174,28 @@ virDomainObjListLoadStatus(virDomainObjListPtr doms,
         goto error;
     }
 
+    if (virHashLookup(doms->objsName, obj->def->name) != NULL) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("unexpected domain %s already exists"),
+                       obj->def->name);
+        goto error;
+    }
+
     if (virHashAddEntry(doms->objs, uuidstr, obj) < 0)
         goto error;
 
+    if (virHashAddEntry(doms->objsName, obj->def->name, obj) < 0) {
+        /* Steal back the reference the list took */
+        virObjectRef(obj);
+        virHashRemoveEntry(doms->objs, uuidstr);
+        goto error;
+    }
+
+    virMutexLock(&doms->idsLock);
+    virDomainObjListIndexID(doms, obj);
+    virDomainObjListSnapshotUpdate(doms, obj, false);
+    virMutexUnlock(&doms->idsLock);
+
     if (notify)
         (*notify)(obj, 1, opaque);
 
@@ -16301,6 +17278,376 @@ virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
     return 0;
 }
 
+
+/* Index of the configs loaded by virDomainObjListLoadAllConfigsCached.
+ * After a header line, each line describes one config file as
+ *
+ *   <uuid> <size> <mtime sec>.<mtime nsec> <name>
+ *
+ * and is only trusted as long as the size and mtime still match. */
+#define VIR_DOMAIN_INDEX_HEADER "libvirt-domain-index"
+#define VIR_DOMAIN_INDEX_MAX_LEN (32 * 1024 * 1024)
+
+typedef struct _virDomainIndexEntry virDomainIndexEntry;
+typedef virDomainIndexEntry *virDomainIndexEntryPtr;
+struct _virDomainIndexEntry {
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    unsigned long long size;
+    struct timespec mtime;
+};
+
+static void
+virDomainIndexEntryFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    VIR_FREE(payload);
+}
+
+
+static int
+virDomainIndexParseLine(char *line,
+                        virHashTablePtr index)
+{
+    virDomainIndexEntryPtr entry = NULL;
+    char *tmp;
+    char *name;
+    long long sec;
+    long nsec;
+
+    if (VIR_ALLOC(entry) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (!(tmp = strchr(line, ' ')))
+        goto malformed;
+    *tmp++ = '\0';
+    if (virUUIDParse(line, entry->uuid) < 0 ||
+        virStrToLong_ull(tmp, &tmp, 10, &entry->size) < 0 ||
+        *tmp++ != ' ' ||
+        virStrToLong_ll(tmp, &tmp, 10, &sec) < 0 ||
+        *tmp++ != '.' ||
+        virStrToLong_l(tmp, &name, 10, &nsec) < 0 ||
+        *name++ != ' ' ||
+        !*name)
+        goto malformed;
+
+    entry->mtime.tv_sec = sec;
+    entry->mtime.tv_nsec = nsec;
+
+    if (virHashAddEntry(index, name, entry) < 0) {
+        VIR_FREE(entry);
+        return -1;
+    }
+    return 0;
+
+malformed:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("malformed domain index entry"));
+    VIR_FREE(entry);
+    return -1;
+}
+
+
+/*
+ * Read the index in 'path', returning an empty one if it is
+ * missing, unreadable, or written by another libvirt version.
+ */
+static virHashTablePtr
+virDomainIndexRead(const char *path)
+{
+    virHashTablePtr index;
+    char *content = NULL;
+    char *header = NULL;
+    char *line;
+    char *next;
+
+    if (!(index = virHashCreate(50, virDomainIndexEntryFree)))
+        return NULL;
+
+    if (!virFileExists(path))
+        return index;
+
+    if (virFileReadAll(path, VIR_DOMAIN_INDEX_MAX_LEN, &content) < 0 ||
+        virAsprintf(&header, "%s %lu\n",
+                    VIR_DOMAIN_INDEX_HEADER,
+                    (unsigned long)LIBVIR_VERSION_NUMBER) < 0)
+        goto ignore;
+
+    if (!STRPREFIX(content, header)) {
+        VIR_DEBUG("Ignoring domain index '%s' of another version", path);
+        goto cleanup;
+    }
+
+    for (line = content + strlen(header); *line; line = next) {
+        if (!(next = strchr(line, '\n')))
+            break;
+        *next++ = '\0';
+        if (virDomainIndexParseLine(line, index) < 0)
+            goto ignore;
+    }
+
+cleanup:
+    VIR_FREE(content);
+    VIR_FREE(header);
+    return index;
+
+ignore:
+    VIR_WARN("Ignoring domain index '%s'", path);
+    virResetLastError();
+    virHashRemoveAll(index);
+    goto cleanup;
+}
+
+
+static int
+virDomainIndexWriteBuf(int fd, void *opaque)
+{
+    virBufferPtr buf = opaque;
+    const char *content = virBufferCurrentContent(buf);
+    size_t len = virBufferUse(buf);
+
+    if (safewrite(fd, content, len) != len)
+        return -1;
+    return 0;
+}
+
+
+static void
+virDomainIndexAdd(virBufferPtr buf,
+                  const char *name,
+                  const unsigned char *uuid,
+                  struct stat *sb)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    struct timespec mtime = get_stat_mtime(sb);
+
+    /* Lines can't represent such names, they will just be parsed */
+    if (strchr(name, '\n'))
+        return;
+
+    virUUIDFormat(uuid, uuidstr);
+    virBufferAsprintf(buf, "%s %llu %lld.%09ld %s\n",
+                      uuidstr, (unsigned long long)sb->st_size,
+                      (long long)mtime.tv_sec, (long)mtime.tv_nsec, name);
+}
+
+
+/*
+ * Add a domain with just the name and UUID recorded in the
+ * index for 'name', deferring the parsing of 'configFile'
+ * to virDomainObjListLoadDef. The caller must hold the list
+ * lock, and have checked neither the name nor the UUID is
+ * in use.
+ */
+static virDomainObjPtr
+virDomainObjListLoadConfigLazy(virDomainObjListPtr doms,
+                               virDomainXMLOptionPtr xmlopt,
+                               const char *configFile,
+                               const char *autostartDir,
+                               const char *name,
+                               const unsigned char *uuid,
+                               virDomainLoadConfigNotify notify,
+                               void *opaque)
+{
+    char *autostartLink = NULL;
+    char *defFile = NULL;
+    virDomainDefPtr def = NULL;
+    virDomainObjPtr dom;
+    int autostart;
+
+    if ((autostartLink = virDomainConfigFile(autostartDir, name)) == NULL)
+        goto error;
+
+    if ((autostart = virFileLinkPointsTo(autostartLink, configFile)) < 0)
+        goto error;
+
+    if (!(defFile = strdup(configFile)) ||
+        VIR_ALLOC(def) < 0 ||
+        !(def->name = strdup(name)))
+        goto no_memory;
+    def->id = -1;
+    memcpy(def->uuid, uuid, VIR_UUID_BUFLEN);
+
+    if (!(dom = virDomainObjListAddLocked(doms, def, xmlopt, 0, NULL)))
+        goto error;
+    def = NULL;
+
+    dom->defFile = defFile;
+    dom->autostart = autostart;
+
+    if (notify)
+        (*notify)(dom, 1, opaque);
+
+    VIR_FREE(autostartLink);
+    return dom;
+
+no_memory:
+    virReportOOMError();
+error:
+    VIR_FREE(autostartLink);
+    VIR_FREE(defFile);
+    virDomainDefFree(def);
+    return NULL;
+}
+
+
+/**
+ * virDomainObjListLoadAllConfigsCached:
+ *
+ * Like virDomainObjListLoadAllConfigs for persistent configs, except
+ * that configs unchanged since the index in @cacheFile was written
+ * are not parsed until the domain is first looked up. The index is
+ * then rewritten to describe the configs found in @configDir.
+ */
+int
+virDomainObjListLoadAllConfigsCached(virDomainObjListPtr doms,
+                                     const char *configDir,
+                                     const char *autostartDir,
+                                     const char *cacheFile,
+                                     virCapsPtr caps,
+                                     virDomainXMLOptionPtr xmlopt,
+                                     unsigned int expectedVirtTypes,
+                                     virDomainLoadConfigNotify notify,
+                                     void *opaque)
+{
+    DIR *dir;
+    struct dirent *entry;
+    virHashTablePtr index = NULL;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virCapsPtr oldCaps;
+    virDomainXMLOptionPtr oldXMLOpt;
+    size_t nparsed = 0;
+    size_t ndeferred = 0;
+
+    VIR_INFO("Scanning for configs in %s using index %s",
+             configDir, cacheFile);
+
+    if (!(dir = opendir(configDir))) {
+        if (errno == ENOENT)
+            return 0;
+        virReportSystemError(errno,
+                             _("Failed to open dir '%s'"),
+                             configDir);
+        return -1;
+    }
+
+    if (!(index = virDomainIndexRead(cacheFile))) {
+        closedir(dir);
+        return -1;
+    }
+
+    virObjectLock(doms);
+
+    virMutexLock(&doms->idsLock);
+    oldCaps = doms->caps;
+    oldXMLOpt = doms->xmlopt;
+    doms->caps = virObjectRef(caps);
+    doms->xmlopt = virObjectRef(xmlopt);
+    doms->expectedVirtTypes = expectedVirtTypes;
+    virMutexUnlock(&doms->idsLock);
+    virObjectUnref(oldCaps);
+    virObjectUnref(oldXMLOpt);
+
+    virBufferAsprintf(&buf, "%s %lu\n", VIR_DOMAIN_INDEX_HEADER,
+                      (unsigned long)LIBVIR_VERSION_NUMBER);
+
+    while ((entry = readdir(dir))) {
+        virDomainObjPtr dom = NULL;
+        virDomainIndexEntryPtr cached;
+        char *configFile = NULL;
+        struct stat sb;
+        bool haveStat;
+
+        if (entry->d_name[0] == '.')
+            continue;
+
+        if (!virFileStripSuffix(entry->d_name, ".xml"))
+            continue;
+
+        if (!(configFile = virDomainConfigFile(configDir, entry->d_name)))
+            continue;
+
+        haveStat = stat(configFile, &sb) == 0;
+        cached = virHashLookup(index, entry->d_name);
+
+        if (haveStat && cached &&
+            cached->size == sb.st_size &&
+            cached->mtime.tv_sec == get_stat_mtime(&sb).tv_sec &&
+            cached->mtime.tv_nsec == get_stat_mtime(&sb).tv_nsec) {
+            char uuidstr[VIR_UUID_STRING_BUFLEN];
+            virDomainObjPtr other;
+
+            virUUIDFormat(cached->uuid, uuidstr);
+            other = virHashLookup(doms->objs, uuidstr);
+
+            if (!other && !virHashLookup(doms->objsName, entry->d_name)) {
+                VIR_DEBUG("Deferring config file '%s.xml'", entry->d_name);
+                dom = virDomainObjListLoadConfigLazy(doms, xmlopt,
+                                                     configFile,
+                                                     autostartDir,
+                                                     entry->d_name,
+                                                     cached->uuid,
+                                                     notify, opaque);
+                ndeferred++;
+            } else if (other) {
+                /* Still not parsed since the last load, nothing changed */
+                virObjectLock(other);
+                if (other->defFile &&
+                    STREQ(other->def->name, entry->d_name) &&
+                    STREQ(other->defFile, configFile)) {
+                    dom = other;
+                    ndeferred++;
+                } else {
+                    virObjectUnlock(other);
+                }
+            }
+        }
+
+        if (!dom) {
+            /* NB: ignoring errors, so one malformed config doesn't
+               kill the whole process */
+            VIR_INFO("Loading config file '%s.xml'", entry->d_name);
+            dom = virDomainObjListLoadConfig(doms,
+                                             caps,
+                                             xmlopt,
+                                             configDir,
+                                             autostartDir,
+                                             entry->d_name,
+                                             expectedVirtTypes,
+                                             notify,
+                                             opaque);
+            nparsed++;
+        }
+
+        if (dom) {
+            if (haveStat)
+                virDomainIndexAdd(&buf, entry->d_name, dom->def->uuid, &sb);
+            virObjectUnlock(dom);
+            dom->persistent = 1;
+        }
+        VIR_FREE(configFile);
+    }
+
+    closedir(dir);
+    virObjectUnlock(doms);
+
+    VIR_DEBUG("Parsed %zu configs, deferred %zu", nparsed, ndeferred);
+
+    /* The index only saves work, so failing to update it is harmless */
+    if (virBufferError(&buf)) {
+        virReportOOMError();
+        VIR_WARN("Unable to update domain index '%s'", cacheFile);
+    } else if (virFileRewrite(cacheFile, S_IRUSR | S_IWUSR,
+                              virDomainIndexWriteBuf, &buf) < 0) {
+        VIR_WARN("Unable to update domain index '%s'", cacheFile);
+    }
+    virResetLastError();
+
+    virBufferFreeAndReset(&buf);
+    virHashFree(index);
+    return 0;
+}
+
 int
 virDomainDeleteConfig(const char *configDir,
                       const char *autostartDir,
@@ -16430,6 +17777,15 @@ virDomainObjListNumOfDomains(virDomainObjListPtr doms,
                              int active)
 {
     int count = 0;
+
+    virMutexLock(&doms->idsLock);
+    if (!doms->membersBroken) {
+        count = active ? doms->nactive : doms->nmembers - doms->nactive;
+        virMutexUnlock(&doms->idsLock);
+        return count;
+    }
+    virMutexUnlock(&doms->idsLock);
+
     virObjectLock(doms);
     if (active)
         virHashForEach(doms->objs, virDomainObjListCountActive, &count);
@@ -16464,6 +17820,18 @@ virDomainObjListGetActiveIDs(virDomainObjListPtr doms,
                              int maxids)
 {
     struct virDomainIDData data = { 0, maxids, ids };
+    virDomainObjListSnapshotPtr snap;
+    size_t i;
+
+    if ((snap = virDomainObjListSnapshotGet(doms))) {
+        for (i = 0; i < snap->nentries && data.numids < maxids; i++) {
+            if (snap->entries[i].id != -1)
+                ids[data.numids++] = snap->entries[i].id;
+        }
+        virObjectUnref(snap);
+        return data.numids;
+    }
+
     virObjectLock(doms);
     virHashForEach(doms->objs, virDomainObjListCopyActiveIDs, &data);
     virObjectUnlock(doms);
@@ -16505,10 +17873,26 @@ virDomainObjListGetInactiveNames(virDomainObjListPtr doms,
                                  int maxnames)
 {
     struct virDomainNameData data = { 0, 0, maxnames, names };
+    virDomainObjListSnapshotPtr snap;
+    size_t j;
     int i;
-    virObjectLock(doms);
-    virHashForEach(doms->objs, virDomainObjListCopyInactiveNames, &data);
-    virObjectUnlock(doms);
+
+    if ((snap = virDomainObjListSnapshotGet(doms))) {
+        for (j = 0; j < snap->nentries && data.numnames < maxnames; j++) {
+            if (snap->entries[j].id != -1)
+                continue;
+            if (!(names[data.numnames] = strdup(snap->entries[j].name))) {
+                data.oom = 1;
+                break;
+            }
+            data.numnames++;
+        }
+        virObjectUnref(snap);
+    } else {
+        virObjectLock(doms);
+        virHashForEach(doms->objs, virDomainObjListCopyInactiveNames, &data);
+        virObjectUnlock(doms);
+    }
     if (data.oom) {
         for (i = 0 ; i < data.numnames ; i++)
             VIR_FREE(data.names[i]);
@@ -16521,6 +17905,8 @@ virDomainObjListGetInactiveNames(virDomainObjListPtr doms,
 
 
 struct virDomainListIterData {
+    virDomainObjListPtr doms;
+    bool load;
     virDomainObjListIterator callback;
     void *opaque;
     int ret;
@@ -16532,8 +17918,23 @@ virDomainObjListHelper(void *payload,
                        void *opaque)
 {
     struct virDomainListIterData *data = opaque;
+    virDomainObjPtr obj = payload;
+    int rc = 0;
 
-    if (data->callback(payload, data->opaque) < 0)
+    if (data->load) {
+        virObjectLock(obj);
+        if ((rc = virDomainObjListLoadDef(data->doms, obj)) < 0)
+            virDomainObjListDropDeferred(data->doms, obj);
+        else
+            virObjectUnlock(obj);
+    }
+
+    if (rc < 0) {
+        data->ret = -1;
+        return;
+    }
+
+    if (data->callback(obj, data->opaque) < 0)
         data->ret = -1;
 }
 
@@ -16543,7 +17944,26 @@ virDomainObjListForEach(virDomainObjListPtr doms,
                         void *opaque)
 {
     struct virDomainListIterData data = {
-        callback, opaque, 0,
+        doms, true, callback, opaque, 0,
+    };
+    virObjectLock(doms);
+    virHashForEach(doms->objs, virDomainObjListHelper, &data);
+    virObjectUnlock(doms);
+    return data.ret;
+}
+
+/*
+ * Like virDomainObjListForEach, except that the callback may get
+ * domains whose config is still to be loaded by virDomainObjListLoadDef.
+ * Suitable for callbacks which only look at the name, UUID and state.
+ */
+int
+virDomainObjListForEachLazy(virDomainObjListPtr doms,
+                            virDomainObjListIterator callback,
+                            void *opaque)
+{
+    struct virDomainListIterData data = {
+        doms, false, callback, opaque, 0,
     };
     virObjectLock(doms);
     virHashForEach(doms->objs, virDomainObjListHelper, &data);
@@ -17307,7 +18727,7 @@ virDomainListPopulate(void *payload,
     /* just count the machines */
     if (!data->domains) {
         data->ndomains++;
-        return;
+        goto cleanup;
     }
 
     if (!(dom = virGetDomain(data->conn, vm->def->name, vm->def->uuid))) {
@@ -17333,18 +18753,33 @@ virDomainObjListExport(virDomainObjListPtr doms,
 {
     int ret = -1;
     int i;
+    size_t j;
+    size_t count;
+    virDomainObjListSnapshotPtr snap;
 
     struct virDomainListData data = { conn, NULL, flags, 0, false };
 
-    virObjectLock(doms);
+    /* Without a snapshot, hold the list lock for the whole walk */
+    if ((snap = virDomainObjListSnapshotGet(doms))) {
+        count = snap->nentries;
+    } else {
+        virObjectLock(doms);
+        count = virHashSize(doms->objs);
+    }
+
     if (domains) {
-        if (VIR_ALLOC_N(data.domains, virHashSize(doms->objs) + 1) < 0) {
+        if (VIR_ALLOC_N(data.domains, count + 1) < 0) {
             virReportOOMError();
             goto cleanup;
         }
     }
 
-    virHashForEach(doms->objs, virDomainListPopulate, &data);
+    if (snap) {
+        for (j = 0; j < snap->nentries; j++)
+            virDomainListPopulate(snap->entries[j].obj, NULL, &data);
+    } else {
+        virHashForEach(doms->objs, virDomainListPopulate, &data);
+    }
 
     if (data.error)
         goto cleanup;
@@ -17360,13 +18795,15 @@ virDomainObjListExport(virDomainObjListPtr doms,
 
 cleanup:
     if (data.domains) {
-        int count = virHashSize(doms->objs);
-        for (i = 0; i < count; i++)
+        for (i = 0; i < data.ndomains; i++)
             virObjectUnref(data.domains[i]);
     }
 
     VIR_FREE(data.domains);
-    virObjectUnlock(doms);
+    if (snap)
+        virObjectUnref(snap);
+    else
+        virObjectUnlock(doms);
     return ret;
 }
 
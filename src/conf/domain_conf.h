@@ -689,6 +689,7 @@ struct _virDomainDiskDef {
     int ioeventfd;
     int event_idx;
     int copy_on_read;
+    unsigned int iothread; /* unused = 0, > 0 specific thread # */
     int snapshot; /* enum virDomainSnapshotLocation, snapshot_conf.h */
     int startupPolicy; /* enum virDomainStartupPolicy */
     bool readonly;
@@ -912,6 +913,7 @@ struct _virDomainNetDef {
             enum virDomainNetVirtioTxModeType txmode;
             enum virDomainIoEventFd ioeventfd;
             enum virDomainVirtioEventIdx event_idx;
+            unsigned int queues; /* Multiqueue virtio-net */
         } virtio;
     } driver;
     union {
@@ -1812,6 +1814,13 @@ struct _virDomainResourceDef {
     char *partition;
 };
 
+typedef struct _virDomainHugePage virDomainHugePage;
+typedef virDomainHugePage *virDomainHugePagePtr;
+struct _virDomainHugePage {
+    virBitmapPtr nodeset;       /* guest NUMA cells, NULL for the default */
+    unsigned long long size;    /* hugepage size in KiB */
+};
+
 /*
  * Guest VM main configuration
  *
@@ -1839,6 +1848,9 @@ struct _virDomainDef {
         unsigned long long max_balloon; /* in kibibytes */
         unsigned long long cur_balloon; /* in kibibytes */
         bool hugepage_backed;
+        size_t nhugepages;
+        virDomainHugePagePtr hugepages;
+        bool locked;
         int dump_core; /* enum virDomainMemDump */
         unsigned long long hard_limit; /* in kibibytes */
         unsigned long long soft_limit; /* in kibibytes */
@@ -1850,6 +1862,8 @@ struct _virDomainDef {
     int placement_mode;
     virBitmapPtr cpumask;
 
+    unsigned int iothreads;
+
     struct {
         unsigned long shares;
         unsigned long long period;
@@ -1859,6 +1873,8 @@ struct _virDomainDef {
         int nvcpupin;
         virDomainVcpuPinDefPtr *vcpupin;
         virDomainVcpuPinDefPtr emulatorpin;
+        int niothreadspin;
+        virDomainVcpuPinDefPtr *iothreadspin;
     } cputune;
 
     virNumaTuneDef numatune;
@@ -1992,11 +2008,19 @@ struct _virDomainObj {
     virDomainDefPtr def; /* The current definition */
     virDomainDefPtr newDef; /* New definition to activate at shutdown */
 
+    /* Config file still to be parsed, in which case @def only
+     * holds the name and UUID. See virDomainObjListLoadDef */
+    char *defFile;
+
     virDomainSnapshotObjListPtr snapshots;
     virDomainSnapshotObjPtr current_snapshot;
 
     bool hasManagedSave;
 
+    /* Slot in the membership array of the domain list, which
+     * is protected by the list's ID lock rather than by ours */
+    size_t listIndex;
+
     void *privateData;
     void (*privateDataFreeFunc)(void *);
 
@@ -2186,6 +2210,11 @@ virDomainDefPtr virDomainObjCopyPersistentDef(virDomainObjPtr dom,
 
 void virDomainObjListRemove(virDomainObjListPtr doms,
                             virDomainObjPtr dom);
+void virDomainObjListRemoveLocked(virDomainObjListPtr doms,
+                                  virDomainObjPtr dom);
+void virDomainObjListSetID(virDomainObjListPtr doms,
+                           virDomainObjPtr dom,
+                           int id);
 
 virDomainDeviceDefPtr virDomainDeviceDefParse(const char *xmlStr,
                                               virDomainDefPtr def,
@@ -2339,6 +2368,19 @@ int virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
                                    virDomainLoadConfigNotify notify,
                                    void *opaque);
 
+int virDomainObjListLoadAllConfigsCached(virDomainObjListPtr doms,
+                                         const char *configDir,
+                                         const char *autostartDir,
+                                         const char *cacheFile,
+                                         virCapsPtr caps,
+                                         virDomainXMLOptionPtr xmlopt,
+                                         unsigned int expectedVirtTypes,
+                                         virDomainLoadConfigNotify notify,
+                                         void *opaque);
+
+int virDomainObjListLoadDef(virDomainObjListPtr doms,
+                            virDomainObjPtr dom);
+
 int virDomainDeleteConfig(const char *configDir,
                           const char *autostartDir,
                           virDomainObjPtr dom);
@@ -2370,6 +2412,9 @@ typedef int (*virDomainObjListIterator)(virDomainObjPtr dom,
 int virDomainObjListForEach(virDomainObjListPtr doms,
                             virDomainObjListIterator callback,
                             void *opaque);
+int virDomainObjListForEachLazy(virDomainObjListPtr doms,
+                                virDomainObjListIterator callback,
+                                void *opaque);
 
 typedef int (*virDomainSmartcardDefIterator)(virDomainDefPtr def,
                                              virDomainSmartcardDefPtr dev,
@@ -44,6 +44,7 @@
 #include "c-ctype.h"
 #include "virfile.h"
 #include "virstring.h"
+#include "virhash.h"
 
 #define MAX_BRIDGE_ID 256
 #define VIR_FROM_THIS VIR_FROM_NETWORK
@@ -114,6 +115,32 @@ virNetworkForwardIfDefClear(virNetworkForwardIfDefPtr def)
         VIR_FREE(def->device.dev);
 }
 
+/* Index over a network's forward.ifs pool, so that picking the device
+ * for a new connection and finding the device of an existing one do
+ * not have to walk the whole pool. heap holds every ifs index ordered
+ * on (connections, index), so its top is the first of the least used
+ * devices; devs maps device names and PCI addresses to ifs entries.
+ */
+struct _virNetworkForwardIfIndex {
+    virNetworkForwardIfDefPtr ifs; /* the array the index was built for */
+    size_t nifs;
+    size_t *heap;
+    size_t *pos;                   /* pos[i] is the heap slot of ifs[i] */
+    virHashTablePtr devs;
+};
+
+static void
+virNetworkForwardIfIndexFree(virNetworkForwardIfIndexPtr idx)
+{
+    if (!idx)
+        return;
+
+    VIR_FREE(idx->heap);
+    VIR_FREE(idx->pos);
+    virHashFree(idx->devs);
+    VIR_FREE(idx);
+}
+
 static void
 virNetworkForwardPfDefClear(virNetworkForwardPfDefPtr def)
 {
@@ -200,6 +227,9 @@ virNetworkForwardDefClear(virNetworkForwardDefPtr def)
         virNetworkForwardIfDefClear(&def->ifs[ii]);
     }
     VIR_FREE(def->ifs);
+
+    virNetworkForwardIfIndexFree(def->ifsIndex);
+    def->ifsIndex = NULL;
 }
 
 void
@@ -2434,6 +2464,248 @@ virPortGroupDefPtr virPortGroupFindByName(virNetworkDefPtr net,
     return NULL;
 }
 
+/* PCI keys are longer than any interface name can be, so they
+ * never collide with one */
+#define VIR_NETWORK_FORWARD_IF_PCI_KEYLEN 48
+
+static void
+virNetworkForwardIfPCIKey(virDevicePCIAddressPtr addr, char *key)
+{
+    snprintf(key, VIR_NETWORK_FORWARD_IF_PCI_KEYLEN,
+             "pci:%04x:%02x:%02x.%x",
+             addr->domain, addr->bus, addr->slot, addr->function);
+}
+
+static bool
+virNetworkForwardIfIndexLess(virNetworkForwardIfIndexPtr idx,
+                             size_t a, size_t b)
+{
+    if (idx->ifs[a].connections != idx->ifs[b].connections)
+        return idx->ifs[a].connections < idx->ifs[b].connections;
+    return a < b;
+}
+
+static void
+virNetworkForwardIfIndexSwap(virNetworkForwardIfIndexPtr idx,
+                             size_t i, size_t j)
+{
+    size_t tmp = idx->heap[i];
+
+    idx->heap[i] = idx->heap[j];
+    idx->heap[j] = tmp;
+    idx->pos[idx->heap[i]] = i;
+    idx->pos[idx->heap[j]] = j;
+}
+
+static void
+virNetworkForwardIfIndexSiftUp(virNetworkForwardIfIndexPtr idx,
+                               size_t slot)
+{
+    while (slot > 0) {
+        size_t parent = (slot - 1) / 2;
+
+        if (!virNetworkForwardIfIndexLess(idx, idx->heap[slot],
+                                          idx->heap[parent]))
+            break;
+        virNetworkForwardIfIndexSwap(idx, slot, parent);
+        slot = parent;
+    }
+}
+
+static void
+virNetworkForwardIfIndexSiftDown(virNetworkForwardIfIndexPtr idx,
+                                 size_t slot)
+{
+    for (;;) {
+        size_t child = 2 * slot + 1;
+
+        if (child >= idx->nifs)
+            break;
+        if (child + 1 < idx->nifs &&
+            virNetworkForwardIfIndexLess(idx, idx->heap[child + 1],
+                                         idx->heap[child]))
+            child++;
+        if (!virNetworkForwardIfIndexLess(idx, idx->heap[child],
+                                          idx->heap[slot]))
+            break;
+        virNetworkForwardIfIndexSwap(idx, slot, child);
+        slot = child;
+    }
+}
+
+/* Return the index of def->forward.ifs, (re)building it if the pool
+ * was changed since it was last used */
+static virNetworkForwardIfIndexPtr
+virNetworkForwardIfIndexGet(virNetworkDefPtr def)
+{
+    virNetworkForwardDefPtr forward = &def->forward;
+    virNetworkForwardIfIndexPtr idx = forward->ifsIndex;
+    char pcikey[VIR_NETWORK_FORWARD_IF_PCI_KEYLEN];
+    const char *key;
+    size_t ii;
+
+    if (idx && idx->ifs == forward->ifs && idx->nifs == forward->nifs)
+        return idx;
+
+    virNetworkForwardIfIndexFree(idx);
+    forward->ifsIndex = NULL;
+
+    if (VIR_ALLOC(idx) < 0 ||
+        VIR_ALLOC_N(idx->heap, MAX(forward->nifs, 1)) < 0 ||
+        VIR_ALLOC_N(idx->pos, MAX(forward->nifs, 1)) < 0) {
+        virReportOOMError();
+        goto error;
+    }
+    if (!(idx->devs = virHashCreate(forward->nifs, NULL)))
+        goto error;
+
+    idx->ifs = forward->ifs;
+    idx->nifs = forward->nifs;
+
+    for (ii = 0; ii < idx->nifs; ii++) {
+        idx->heap[ii] = idx->pos[ii] = ii;
+
+        if (idx->ifs[ii].type == VIR_NETWORK_FORWARD_HOSTDEV_DEVICE_PCI) {
+            virNetworkForwardIfPCIKey(&idx->ifs[ii].device.pci, pcikey);
+            key = pcikey;
+        } else {
+            key = idx->ifs[ii].device.dev;
+        }
+
+        /* like a linear search would, the first of duplicates wins */
+        if (key && !virHashLookup(idx->devs, key) &&
+            virHashAddEntry(idx->devs, key, &idx->ifs[ii]) < 0)
+            goto error;
+    }
+
+    for (ii = idx->nifs / 2; ii-- > 0;)
+        virNetworkForwardIfIndexSiftDown(idx, ii);
+
+    forward->ifsIndex = idx;
+    return idx;
+
+error:
+    virNetworkForwardIfIndexFree(idx);
+    return NULL;
+}
+
+/*
+ * virNetworkForwardIfFindByDev:
+ * @def: the network definition
+ * @dev: name of the device to look for
+ * @ifdef: set to the matching forward interface, or NULL
+ *
+ * Returns 0 whether or not @dev is in the pool of @def, -1 on error
+ */
+int
+virNetworkForwardIfFindByDev(virNetworkDefPtr def,
+                             const char *dev,
+                             virNetworkForwardIfDefPtr *ifdef)
+{
+    virNetworkForwardIfIndexPtr idx;
+    virNetworkForwardIfDefPtr found;
+
+    *ifdef = NULL;
+    if (!(idx = virNetworkForwardIfIndexGet(def)))
+        return -1;
+
+    if ((found = virHashLookup(idx->devs, dev)) &&
+        found->type == VIR_NETWORK_FORWARD_HOSTDEV_DEVICE_NETDEV)
+        *ifdef = found;
+    return 0;
+}
+
+/*
+ * virNetworkForwardIfFindByPCI:
+ * @def: the network definition
+ * @addr: PCI address of the device to look for
+ * @ifdef: set to the matching forward interface, or NULL
+ *
+ * Returns 0 whether or not @addr is in the pool of @def, -1 on error
+ */
+int
+virNetworkForwardIfFindByPCI(virNetworkDefPtr def,
+                             virDevicePCIAddressPtr addr,
+                             virNetworkForwardIfDefPtr *ifdef)
+{
+    virNetworkForwardIfIndexPtr idx;
+    virNetworkForwardIfDefPtr found;
+    char key[VIR_NETWORK_FORWARD_IF_PCI_KEYLEN];
+
+    *ifdef = NULL;
+    if (!(idx = virNetworkForwardIfIndexGet(def)))
+        return -1;
+
+    virNetworkForwardIfPCIKey(addr, key);
+    if ((found = virHashLookup(idx->devs, key)) &&
+        found->type == VIR_NETWORK_FORWARD_HOSTDEV_DEVICE_PCI)
+        *ifdef = found;
+    return 0;
+}
+
+/*
+ * virNetworkForwardIfLeastUsed:
+ * @def: the network definition
+ * @exclusive: only accept a device with no connections
+ * @ifdef: set to the chosen forward interface, or NULL
+ *
+ * Picks the device with the fewest connections from the pool of @def,
+ * the first one in the pool among equals. If @exclusive is true and
+ * every device is in use, or if the pool is empty, @ifdef is NULL.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int
+virNetworkForwardIfLeastUsed(virNetworkDefPtr def,
+                             bool exclusive,
+                             virNetworkForwardIfDefPtr *ifdef)
+{
+    virNetworkForwardIfIndexPtr idx;
+    virNetworkForwardIfDefPtr top;
+
+    *ifdef = NULL;
+    if (!(idx = virNetworkForwardIfIndexGet(def)))
+        return -1;
+
+    if (idx->nifs == 0)
+        return 0;
+
+    top = &idx->ifs[idx->heap[0]];
+    if (!exclusive || top->connections == 0)
+        *ifdef = top;
+    return 0;
+}
+
+/*
+ * virNetworkForwardIfAddConnections:
+ * @def: the network definition
+ * @ifdef: a forward interface of @def
+ * @delta: number of connections gained (or lost, if negative)
+ *
+ * Changes the connection count of @ifdef, keeping the index of the
+ * pool in order. All changes to the count of a pool device have to
+ * go through here.
+ */
+void
+virNetworkForwardIfAddConnections(virNetworkDefPtr def,
+                                  virNetworkForwardIfDefPtr ifdef,
+                                  int delta)
+{
+    virNetworkForwardIfIndexPtr idx = def->forward.ifsIndex;
+    size_t slot;
+
+    ifdef->connections += delta;
+
+    /* a stale index is rebuilt from the counts on its next use */
+    if (!idx || idx->ifs != def->forward.ifs ||
+        idx->nifs != def->forward.nifs)
+        return;
+
+    slot = idx->pos[ifdef - idx->ifs];
+    virNetworkForwardIfIndexSiftUp(idx, slot);
+    virNetworkForwardIfIndexSiftDown(idx, idx->pos[ifdef - idx->ifs]);
+}
+
 int virNetworkSaveXML(const char *configDir,
                       virNetworkDefPtr def,
                       const char *xml)
@@ -3295,6 +3567,10 @@ virNetworkDefUpdateForwardInterface(virNetworkDefPtr def,
         goto cleanup;
     }
 
+    /* the entries moved, so the index has to be rebuilt */
+    virNetworkForwardIfIndexFree(def->forward.ifsIndex);
+    def->forward.ifsIndex = NULL;
+
     ret = 0;
 cleanup:
     virNetworkForwardIfDefClear(&iface);
@@ -168,6 +168,10 @@ struct _virNetworkForwardPfDef {
     int connections; /* how many guest interfaces are connected to this device? */
 };
 
+/* lookup index over the forward.ifs pool, private to network_conf.c */
+typedef struct _virNetworkForwardIfIndex virNetworkForwardIfIndex;
+typedef virNetworkForwardIfIndex *virNetworkForwardIfIndexPtr;
+
 typedef struct _virNetworkForwardDef virNetworkForwardDef;
 typedef virNetworkForwardDef *virNetworkForwardDefPtr;
 struct _virNetworkForwardDef {
@@ -183,6 +187,8 @@ struct _virNetworkForwardDef {
 
     size_t nifs;
     virNetworkForwardIfDefPtr ifs;
+    /* built on first use, dropped whenever ifs changes */
+    virNetworkForwardIfIndexPtr ifsIndex;
 
     /* ranges for NAT */
     virSocketAddrRange addr;
@@ -308,6 +314,19 @@ virNetworkDefForwardIf(const virNetworkDefPtr def, size_t n)
 virPortGroupDefPtr virPortGroupFindByName(virNetworkDefPtr net,
                                           const char *portgroup);
 
+int virNetworkForwardIfFindByDev(virNetworkDefPtr def,
+                                 const char *dev,
+                                 virNetworkForwardIfDefPtr *ifdef);
+int virNetworkForwardIfFindByPCI(virNetworkDefPtr def,
+                                 virDevicePCIAddressPtr addr,
+                                 virNetworkForwardIfDefPtr *ifdef);
+int virNetworkForwardIfLeastUsed(virNetworkDefPtr def,
+                                 bool exclusive,
+                                 virNetworkForwardIfDefPtr *ifdef);
+void virNetworkForwardIfAddConnections(virNetworkDefPtr def,
+                                       virNetworkForwardIfDefPtr ifdef,
+                                       int delta);
+
 virNetworkIpDefPtr
 virNetworkDefGetIpByIndex(const virNetworkDefPtr def,
                           int family, size_t n);
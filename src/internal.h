@@ -398,18 +398,16 @@
 
 #  define PROBE_EXPAND(NAME, ARGS) NAME(ARGS)
 #  define PROBE(NAME, FMT, ...)                              \
-    VIR_DEBUG_INT(VIR_LOG_FROM_TRACE,                        \
-                  __FILE__, __LINE__, __func__,              \
-                  #NAME ": " FMT, __VA_ARGS__);              \
+    VIR_DEBUG_CALLSITE(VIR_LOG_FROM_TRACE,                   \
+                       #NAME ": " FMT, __VA_ARGS__);         \
     if (LIBVIRT_ ## NAME ## _ENABLED()) {                    \
         PROBE_EXPAND(LIBVIRT_ ## NAME,                       \
                      VIR_ADD_CASTS(__VA_ARGS__));            \
     }
 # else
 #  define PROBE(NAME, FMT, ...)                              \
-    VIR_DEBUG_INT(VIR_LOG_FROM_TRACE,                        \
-                  __FILE__, __LINE__, __func__,              \
-                  #NAME ": " FMT, __VA_ARGS__);
+    VIR_DEBUG_CALLSITE(VIR_LOG_FROM_TRACE,                   \
+                       #NAME ": " FMT, __VA_ARGS__);
 # endif
 
 
@@ -6616,7 +6616,7 @@ error:
  * @params: pointer to node cpu time parameter objects
  * @nparams: number of node cpu time parameter (this value should be same or
  *          less than the number of parameters supported)
- * @flags: extra flags; not used yet, so callers should always pass 0
+ * @flags: bitwise-OR of virNodeGetCPUStatsFlags
  *
  * This function provides individual cpu statistics of the node.
  * If you want to get total cpu statistics of the node, you must specify
@@ -6660,6 +6660,11 @@ error:
  *     The CPU utilization. The usage value is in percent and 100%
  *     represents all CPUs on the server.
  *
+ * With VIR_NODE_CPU_STATS_AVERAGE in @flags, the only statistic
+ * returned is VIR_NODE_CPU_STATS_UTILIZATION, averaged over the history
+ * kept by the host statistics sampler of the daemon. This fails if
+ * the daemon does not sample host statistics.
+ *
  * Returns -1 in case of error, 0 in case of success.
  */
 int virNodeGetCPUStats(virConnectPtr conn,
@@ -110,6 +110,11 @@ enum {
      * Support for offline migration.
      */
     VIR_DRV_FEATURE_MIGRATION_OFFLINE = 12,
+
+    /*
+     * Remote party supports compound calls (REMOTE_PROC_CONNECT_MULTI_CALL).
+     */
+    VIR_DRV_FEATURE_PROGRAM_MULTI_CALL = 13,
 };
 
 
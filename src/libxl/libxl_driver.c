@@ -629,7 +629,7 @@ libxlVmCleanup(libxlDriverPrivatePtr driver,
     }
 
     if (vm->persistent) {
-        vm->def->id = -1;
+        virDomainObjListSetID(driver->domains, vm, -1);
         virDomainObjSetState(vm, VIR_DOMAIN_SHUTOFF, reason);
     }
 
@@ -977,7 +977,7 @@ libxlVmStart(libxlDriverPrivatePtr driver, virDomainObjPtr vm,
         goto error;
     }
 
-    vm->def->id = domid;
+    virDomainObjListSetID(driver->domains, vm, domid);
     if ((dom_xml = virDomainDefFormat(vm->def, 0)) == NULL)
         goto error;
 
@@ -1024,7 +1024,7 @@ libxlVmStart(libxlDriverPrivatePtr driver, virDomainObjPtr vm,
 error:
     if (domid > 0) {
         libxl_domain_destroy(priv->ctx, domid, NULL);
-        vm->def->id = -1;
+        virDomainObjListSetID(driver->domains, vm, -1);
         virDomainObjSetState(vm, VIR_DOMAIN_SHUTOFF, VIR_DOMAIN_SHUTOFF_FAILED);
     }
     libxl_domain_config_dispose(&d_config);
@@ -1070,7 +1070,7 @@ libxlReconnectDomain(virDomainObjPtr vm,
     }
 
     /* Update domid in case it changed (e.g. reboot) while we were gone? */
-    vm->def->id = d_info.domid;
+    virDomainObjListSetID(driver->domains, vm, d_info.domid);
     virDomainObjSetState(vm, VIR_DOMAIN_RUNNING, VIR_DOMAIN_RUNNING_UNKNOWN);
 
     if (!driver->nactive && driver->inhibitCallback)
@@ -513,36 +513,40 @@ static int virLXCControllerSetupCpuAffinity(virLXCControllerPtr ctrl)
 }
 
 
-static int virLXCControllerGetNumadAdvice(virLXCControllerPtr ctrl,
-                                          virBitmapPtr *mask)
+/*
+ * Pick host NUMA nodes for the container if 'placement' of either
+ * <vcpu> or <numatune> is 'auto'. The controller only knows about
+ * its own container, so the choice is driven by the host topology
+ * and the memory currently free on each node.
+ */
+static int virLXCControllerGetAutoPlacement(virLXCControllerPtr ctrl,
+                                            virBitmapPtr *mask)
 {
-    virBitmapPtr nodemask = NULL;
-    char *nodeset = NULL;
+    virNumaPlacementPtr placement = NULL;
+    virNumaPlacementNodePtr nodes = NULL;
+    size_t nnodes = 0;
     int ret = -1;
 
-    /* Get the advisory nodeset from numad if 'placement' of
-     * either <vcpu> or <numatune> is 'auto'.
-     */
-    if ((ctrl->def->placement_mode ==
-         VIR_DOMAIN_CPU_PLACEMENT_MODE_AUTO) ||
-        (ctrl->def->numatune.memory.placement_mode ==
-         VIR_NUMA_TUNE_MEM_PLACEMENT_MODE_AUTO)) {
-        nodeset = virNumaGetAutoPlacementAdvice(ctrl->def->vcpus,
-                                                ctrl->def->mem.cur_balloon);
-        if (!nodeset)
-            goto cleanup;
+    *mask = NULL;
 
-        VIR_DEBUG("Nodeset returned from numad: %s", nodeset);
+    if ((ctrl->def->placement_mode !=
+         VIR_DOMAIN_CPU_PLACEMENT_MODE_AUTO) &&
+        (ctrl->def->numatune.memory.placement_mode !=
+         VIR_NUMA_TUNE_MEM_PLACEMENT_MODE_AUTO))
+        return 0;
 
-        if (virBitmapParse(nodeset, 0, &nodemask, VIR_DOMAIN_CPUMASK_LEN) < 0)
-            goto cleanup;
-    }
+    if (!(placement = virNumaPlacementNew()) ||
+        nodeGetNumaPlacementNodes(&nodes, &nnodes) < 0 ||
+        virNumaPlacementChoose(placement, nodes, nnodes,
+                               ctrl->def->vcpus, ctrl->def->mem.cur_balloon,
+                               mask, NULL) < 0)
+        goto cleanup;
 
     ret = 0;
-    *mask = nodemask;
 
 cleanup:
-    VIR_FREE(nodeset);
+    virNumaPlacementNodesFree(nodes, nnodes);
+    virObjectUnref(placement);
     return ret;
 }
 
@@ -562,7 +566,7 @@ static int virLXCControllerSetupResourceLimits(virLXCControllerPtr ctrl,
     virBitmapPtr nodemask = NULL;
     int ret = -1;
 
-    if (virLXCControllerGetNumadAdvice(ctrl, &nodemask) < 0 ||
+    if (virLXCControllerGetAutoPlacement(ctrl, &nodemask) < 0 ||
         virNumaSetupMemoryPolicy(ctrl->def->numatune, nodemask) < 0)
         goto cleanup;
 
@@ -253,7 +253,7 @@ static void virLXCProcessCleanup(virLXCDriverPtr driver,
 
     virDomainObjSetState(vm, VIR_DOMAIN_SHUTOFF, reason);
     vm->pid = -1;
-    vm->def->id = -1;
+    virDomainObjListSetID(driver->domains, vm, -1);
 
     driver->nactive--;
     if (!driver->nactive && driver->inhibitCallback)
@@ -1270,7 +1270,7 @@ int virLXCProcessStart(virConnectPtr conn,
 
     priv->stopReason = VIR_DOMAIN_EVENT_STOPPED_FAILED;
     priv->wantReboot = false;
-    vm->def->id = vm->pid;
+    virDomainObjListSetID(driver->domains, vm, vm->pid);
     virDomainObjSetState(vm, VIR_DOMAIN_RUNNING, reason);
     priv->doneStopEvent = false;
 
@@ -1454,7 +1454,7 @@ virLXCProcessReconnectDomain(virDomainObjPtr vm,
     priv = vm->privateData;
 
     if (vm->pid != 0) {
-        vm->def->id = vm->pid;
+        virDomainObjListSetID(driver->domains, vm, vm->pid);
         virDomainObjSetState(vm, VIR_DOMAIN_RUNNING,
                              VIR_DOMAIN_RUNNING_UNKNOWN);
 
@@ -1490,7 +1490,7 @@ virLXCProcessReconnectDomain(virDomainObjPtr vm,
         }
 
     } else {
-        vm->def->id = -1;
+        virDomainObjListSetID(driver->domains, vm, -1);
     }
 
     ret = 0;
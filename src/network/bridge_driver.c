@@ -82,6 +82,10 @@ struct network_driver {
     char *dnsmasqStateDir;
     char *radvdStateDir;
     dnsmasqCapsPtr dnsmasqCaps;
+
+    /* network name -> dnsmasqContext of each running dnsmasq that
+     * reads its hosts from directories, see networkRefreshDhcpDaemon */
+    virHashTablePtr dnsmasqContexts;
 };
 
 
@@ -124,6 +128,12 @@ static int networkUnplugBandwidth(virNetworkObjPtr net,
 
 static struct network_driver *driverState = NULL;
 
+static void
+networkDnsmasqContextFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    dnsmasqContextFree(payload);
+}
+
 static char *
 networkDnsmasqLeaseFileNameDefault(const char *netname)
 {
@@ -424,6 +434,10 @@ networkStateInitialize(bool privileged,
         goto out_of_memory;
     }
 
+    if (!(driverState->dnsmasqContexts
+          = virHashCreate(0, networkDnsmasqContextFree)))
+        goto error;
+
     /* if this fails now, it will be retried later with dnsmasqCapsRefresh() */
     driverState->dnsmasqCaps = dnsmasqCapsNewFromBinary(DNSMASQ);
 
@@ -535,6 +549,7 @@ networkStateCleanup(void) {
         iptablesContextFree(driverState->iptables);
 
     virObjectUnref(driverState->dnsmasqCaps);
+    virHashFree(driverState->dnsmasqContexts);
 
     networkDriverUnlock(driverState);
     virMutexDestroy(&driverState->lock);
@@ -971,15 +986,24 @@ networkDnsmasqConfContents(virNetworkObjPtr network,
      * listening for DHCP, we should write a 0-length hosts
      * file to allow for runtime additions.
      */
-    if (ipv4def || ipv6def)
-        virBufferAsprintf(&configbuf, "dhcp-hostsfile=%s\n",
-                          dctx->hostsfile->path);
+    if (ipv4def || ipv6def) {
+        if (dctx->hostsfile->saved)
+            virBufferAsprintf(&configbuf, "dhcp-hostsdir=%s\n",
+                              dctx->hostsfile->dirpath);
+        else
+            virBufferAsprintf(&configbuf, "dhcp-hostsfile=%s\n",
+                              dctx->hostsfile->path);
+    }
 
     /* Likewise, always create this file and put it on the
      * commandline, to allow for runtime additions.
      */
-    virBufferAsprintf(&configbuf, "addn-hosts=%s\n",
-                      dctx->addnhostsfile->path);
+    if (dctx->addnhostsfile->saved)
+        virBufferAsprintf(&configbuf, "hostsdir=%s\n",
+                          dctx->addnhostsfile->dirpath);
+    else
+        virBufferAsprintf(&configbuf, "addn-hosts=%s\n",
+                          dctx->addnhostsfile->path);
 
     /* Are we doing RA instead of radvd? */
     if (DNSMASQ_RA_SUPPORT(caps)) {
@@ -1097,12 +1121,18 @@ networkStartDhcpDaemon(struct network_driver *driver,
         goto cleanup;
     }
 
+    virHashRemoveEntry(driver->dnsmasqContexts, network->def->name);
+
     dctx = dnsmasqContextNew(network->def->name, driverState->dnsmasqStateDir);
     if (dctx == NULL)
         goto cleanup;
 
     dnsmasqCapsRefresh(&driver->dnsmasqCaps, false);
 
+    if (dnsmasqCapsGet(driver->dnsmasqCaps, DNSMASQ_CAPS_HOSTSDIR) &&
+        dnsmasqContextUseHostsDirs(dctx) < 0)
+        goto cleanup;
+
     ret = networkBuildDhcpDaemonCommandLine(network, &cmd, pidfile,
                                             dctx, driver->dnsmasqCaps);
     if (ret < 0)
@@ -1130,6 +1160,16 @@ networkStartDhcpDaemon(struct network_driver *driver,
     if (ret < 0)
         goto cleanup;
 
+    /* keep what was written to the hosts directories around, so that
+     * later updates only need to touch the hosts that change */
+    if (dctx->hostsfile->saved) {
+        ret = virHashAddEntry(driver->dnsmasqContexts,
+                              network->def->name, dctx);
+        if (ret < 0)
+            goto cleanup;
+        dctx = NULL;
+    }
+
     ret = 0;
 cleanup:
     VIR_FREE(pidfile);
@@ -1143,6 +1183,10 @@ cleanup:
  *  them.   This only works for the dhcp-hostsfile and the
  *  addn-hosts file.
  *
+ *  When dnsmasq reads its hosts from directories instead, only the
+ *  files of the hosts that changed are rewritten, and no SIGHUP is
+ *  needed when hosts were merely added.
+ *
  *  Returns 0 on success, -1 on failure.
  */
 static int
@@ -1152,6 +1196,8 @@ networkRefreshDhcpDaemon(struct network_driver *driver,
     int ret = -1, ii;
     virNetworkIpDefPtr ipdef, ipv4def, ipv6def;
     dnsmasqContext *dctx = NULL;
+    bool newctx = false;
+    bool reload = true;
 
     /* if no IP addresses specified, nothing to do */
     if (!virNetworkDefGetIpByIndex(network->def, AF_UNSPEC, 0))
@@ -1162,9 +1208,20 @@ networkRefreshDhcpDaemon(struct network_driver *driver,
         return networkStartDhcpDaemon(driver, network);
 
     VIR_INFO("Refreshing dnsmasq for network %s", network->def->bridge);
-    if (!(dctx = dnsmasqContextNew(network->def->name,
-                                   driverState->dnsmasqStateDir))) {
-        goto cleanup;
+    if ((dctx = virHashLookup(driver->dnsmasqContexts, network->def->name))) {
+        dnsmasqClearHosts(dctx);
+    } else {
+        if (!(dctx = dnsmasqContextNew(network->def->name,
+                                       driverState->dnsmasqStateDir))) {
+            goto cleanup;
+        }
+        newctx = true;
+
+        /* dnsmasq was started by an earlier libvirtd; the hosts
+         * directories only exist if it was told to read them */
+        if (virFileIsDir(dctx->addnhostsfile->dirpath) &&
+            dnsmasqContextUseHostsDirs(dctx) < 0)
+            goto cleanup;
     }
 
     /* Look for first IPv4 address that has dhcp defined.
@@ -1196,12 +1253,28 @@ networkRefreshDhcpDaemon(struct network_driver *driver,
     if (networkBuildDnsmasqHostsList(dctx, &network->def->dns) < 0)
        goto cleanup;
 
-    if ((ret = dnsmasqSave(dctx)) < 0)
+    if (newctx) {
+        if (dnsmasqSave(dctx) < 0)
+            goto cleanup;
+    } else if (dnsmasqUpdate(dctx, &reload) < 0) {
+        /* the files no longer match what was recorded, start over
+         * with a full save next time */
+        virHashRemoveEntry(driver->dnsmasqContexts, network->def->name);
+        dctx = NULL;
         goto cleanup;
+    }
 
-    ret = kill(network->dnsmasqPid, SIGHUP);
+    if (newctx && dctx->hostsfile->saved) {
+        if (virHashAddEntry(driver->dnsmasqContexts,
+                            network->def->name, dctx) < 0)
+            goto cleanup;
+        newctx = false;
+    }
+
+    ret = reload ? kill(network->dnsmasqPid, SIGHUP) : 0;
 cleanup:
-    dnsmasqContextFree(dctx);
+    if (newctx)
+        dnsmasqContextFree(dctx);
     return ret;
 }
 
@@ -2445,7 +2518,7 @@ networkStartNetworkVirtual(struct network_driver *driver,
         /* Keep tun fd open and interface up to allow for IPv6 DAD to happen */
         if (virNetDevTapCreateInBridgePort(network->def->bridge,
                                            &macTapIfName, &network->def->mac,
-                                           NULL, &tapfd, NULL, NULL,
+                                           NULL, &tapfd, 1, NULL, NULL,
                                            VIR_NETDEV_TAP_CREATE_USE_MAC_FOR_BRIDGE |
                                            VIR_NETDEV_TAP_CREATE_IFUP |
                                            VIR_NETDEV_TAP_CREATE_PERSIST) < 0) {
@@ -2545,6 +2618,7 @@ networkStartNetworkVirtual(struct network_driver *driver,
         kill(network->dnsmasqPid, SIGTERM);
         network->dnsmasqPid = -1;
     }
+    virHashRemoveEntry(driver->dnsmasqContexts, network->def->name);
 
  err3:
     if (!save_err)
@@ -2599,6 +2673,7 @@ static int networkShutdownNetworkVirtual(struct network_driver *driver,
 
     if (network->dnsmasqPid > 0)
         kill(network->dnsmasqPid, SIGTERM);
+    virHashRemoveEntry(driver->dnsmasqContexts, network->def->name);
 
     if (network->def->mac_specified) {
         char *macTapIfName = networkBridgeDummyNicName(network->def->bridge);
@@ -3766,7 +3841,6 @@ networkAllocateActualDevice(virDomainNetDefPtr iface)
     virNetDevVPortProfilePtr virtport = iface->virtPortProfile;
     virNetDevVlanPtr vlan = NULL;
     virNetworkForwardIfDefPtr dev = NULL;
-    int ii;
     int ret = -1;
 
     if (iface->type != VIR_DOMAIN_NET_TYPE_NETWORK)
@@ -3905,12 +3979,8 @@ networkAllocateActualDevice(virDomainNetDefPtr iface)
         }
 
         /* pick first dev with 0 connections */
-        for (ii = 0; ii < netdef->forward.nifs; ii++) {
-            if (netdef->forward.ifs[ii].connections == 0) {
-                dev = &netdef->forward.ifs[ii];
-                break;
-            }
-        }
+        if (virNetworkForwardIfLeastUsed(netdef, true, &dev) < 0)
+            goto error;
         if (!dev) {
             virReportError(VIR_ERR_INTERNAL_ERROR,
                            _("network '%s' requires exclusive access "
@@ -4058,19 +4128,12 @@ networkAllocateActualDevice(virDomainNetDefPtr iface)
                   == VIR_NETDEV_VPORT_PROFILE_8021QBH))) {
 
                 /* pick first dev with 0 connections */
-                for (ii = 0; ii < netdef->forward.nifs; ii++) {
-                    if (netdef->forward.ifs[ii].connections == 0) {
-                        dev = &netdef->forward.ifs[ii];
-                        break;
-                    }
-                }
+                if (virNetworkForwardIfLeastUsed(netdef, true, &dev) < 0)
+                    goto error;
             } else {
                 /* pick least used dev */
-                dev = &netdef->forward.ifs[0];
-                for (ii = 1; ii < netdef->forward.nifs; ii++) {
-                    if (netdef->forward.ifs[ii].connections < dev->connections)
-                        dev = &netdef->forward.ifs[ii];
-                }
+                if (virNetworkForwardIfLeastUsed(netdef, false, &dev) < 0)
+                    goto error;
             }
             /* dev points at the physical device we want to use */
             if (!dev) {
@@ -4125,7 +4188,7 @@ validate:
 
     if (dev) {
         /* we are now assured of success, so mark the allocation */
-        dev->connections++;
+        virNetworkForwardIfAddConnections(netdef, dev, 1);
         if (actualType != VIR_DOMAIN_NET_TYPE_HOSTDEV) {
             VIR_DEBUG("Using physical device %s, %d connections",
                       dev->device.dev, dev->connections);
@@ -4175,7 +4238,7 @@ networkNotifyActualDevice(virDomainNetDefPtr iface)
     virNetworkObjPtr network;
     virNetworkDefPtr netdef;
     virNetworkForwardIfDefPtr dev = NULL;
-    int ii, ret = -1;
+    int ret = -1;
 
     if (iface->type != VIR_DOMAIN_NET_TYPE_NETWORK)
        return 0;
@@ -4222,14 +4285,8 @@ networkNotifyActualDevice(virDomainNetDefPtr iface)
         }
 
         /* find the matching interface and increment its connections */
-        for (ii = 0; ii < netdef->forward.nifs; ii++) {
-            if (netdef->forward.ifs[ii].type
-                == VIR_NETWORK_FORWARD_HOSTDEV_DEVICE_NETDEV &&
-                STREQ(actualDev, netdef->forward.ifs[ii].device.dev)) {
-                dev = &netdef->forward.ifs[ii];
-                break;
-            }
-        }
+        if (virNetworkForwardIfFindByDev(netdef, actualDev, &dev) < 0)
+            goto error;
         /* dev points at the physical device we want to use */
         if (!dev) {
             virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -4257,7 +4314,7 @@ networkNotifyActualDevice(virDomainNetDefPtr iface)
         }
 
         /* we are now assured of success, so mark the allocation */
-        dev->connections++;
+        virNetworkForwardIfAddConnections(netdef, dev, 1);
         VIR_DEBUG("Using physical device %s, connections %d",
                   dev->device.dev, dev->connections);
 
@@ -4273,15 +4330,10 @@ networkNotifyActualDevice(virDomainNetDefPtr iface)
         }
 
         /* find the matching interface and increment its connections */
-        for (ii = 0; ii < netdef->forward.nifs; ii++) {
-            if (netdef->forward.ifs[ii].type
-                == VIR_NETWORK_FORWARD_HOSTDEV_DEVICE_PCI &&
-                virDevicePCIAddressEqual(&hostdev->source.subsys.u.pci.addr,
-                                         &netdef->forward.ifs[ii].device.pci)) {
-                dev = &netdef->forward.ifs[ii];
-                break;
-            }
-        }
+        if (virNetworkForwardIfFindByPCI(netdef,
+                                         &hostdev->source.subsys.u.pci.addr,
+                                         &dev) < 0)
+            goto error;
         /* dev points at the physical device we want to use */
         if (!dev) {
             virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -4312,7 +4364,7 @@ networkNotifyActualDevice(virDomainNetDefPtr iface)
         }
 
         /* we are now assured of success, so mark the allocation */
-        dev->connections++;
+        virNetworkForwardIfAddConnections(netdef, dev, 1);
         VIR_DEBUG("Using physical device %04x:%02x:%02x.%x, connections %d",
                   dev->device.pci.domain, dev->device.pci.bus,
                   dev->device.pci.slot, dev->device.pci.function,
@@ -4352,7 +4404,7 @@ networkReleaseActualDevice(virDomainNetDefPtr iface)
     virNetworkObjPtr network;
     virNetworkDefPtr netdef;
     virNetworkForwardIfDefPtr dev = NULL;
-    int ii, ret = -1;
+    int ret = -1;
 
     if (iface->type != VIR_DOMAIN_NET_TYPE_NETWORK)
        return 0;
@@ -4400,14 +4452,8 @@ networkReleaseActualDevice(virDomainNetDefPtr iface)
             goto error;
         }
 
-        for (ii = 0; ii < netdef->forward.nifs; ii++) {
-            if (netdef->forward.ifs[ii].type
-                == VIR_NETWORK_FORWARD_HOSTDEV_DEVICE_NETDEV &&
-                STREQ(actualDev, netdef->forward.ifs[ii].device.dev)) {
-                dev = &netdef->forward.ifs[ii];
-                break;
-            }
-        }
+        if (virNetworkForwardIfFindByDev(netdef, actualDev, &dev) < 0)
+            goto error;
 
         if (!dev) {
             virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -4417,7 +4463,7 @@ networkReleaseActualDevice(virDomainNetDefPtr iface)
             goto error;
         }
 
-        dev->connections--;
+        virNetworkForwardIfAddConnections(netdef, dev, -1);
         VIR_DEBUG("Releasing physical device %s, connections %d",
                   dev->device.dev, dev->connections);
 
@@ -4431,15 +4477,10 @@ networkReleaseActualDevice(virDomainNetDefPtr iface)
             goto error;
         }
 
-        for (ii = 0; ii < netdef->forward.nifs; ii++) {
-            if (netdef->forward.ifs[ii].type
-                == VIR_NETWORK_FORWARD_HOSTDEV_DEVICE_PCI &&
-                virDevicePCIAddressEqual(&hostdev->source.subsys.u.pci.addr,
-                                         &netdef->forward.ifs[ii].device.pci)) {
-                dev = &netdef->forward.ifs[ii];
-                break;
-            }
-        }
+        if (virNetworkForwardIfFindByPCI(netdef,
+                                         &hostdev->source.subsys.u.pci.addr,
+                                         &dev) < 0)
+            goto error;
 
         if (!dev) {
             virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -4453,7 +4494,7 @@ networkReleaseActualDevice(virDomainNetDefPtr iface)
                 goto error;
         }
 
-        dev->connections--;
+        virNetworkForwardIfAddConnections(netdef, dev, -1);
         VIR_DEBUG("Releasing physical device %04x:%02x:%02x.%x, connections %d",
                   dev->device.pci.domain, dev->device.pci.bus,
                   dev->device.pci.slot, dev->device.pci.function,
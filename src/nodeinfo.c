@@ -55,6 +55,9 @@
 #include "virfile.h"
 #include "virtypedparam.h"
 #include "virstring.h"
+#include "virthread.h"
+#include "viratomic.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -88,11 +91,36 @@ freebsdNodeGetCPUCount(void)
 # define LINUX_NB_MEMORY_STATS_ALL 4
 # define LINUX_NB_MEMORY_STATS_CELL 2
 
+typedef struct _nodeCPUTimes nodeCPUTimes;
+typedef nodeCPUTimes *nodeCPUTimesPtr;
+struct _nodeCPUTimes {
+    bool online;
+    unsigned long long kernel;  /* all in nanoseconds */
+    unsigned long long user;
+    unsigned long long idle;
+    unsigned long long iowait;
+};
+
 /* NB, this is not static as we need to call it from the testsuite */
 int linuxNodeInfoCPUPopulate(FILE *cpuinfo,
                              const char *sysfs_dir,
                              virNodeInfoPtr nodeinfo);
 
+/* NB, this is not static as we need to call it from the testsuite */
+int linuxNodeGetNumaPlacementNodes(const char *sysfs_dir,
+                                   virNumaPlacementNodePtr *nodes,
+                                   size_t *nnodes);
+
+/* NB, these are not static as we need to call them from the testsuite */
+int linuxNodeStatsSamplerInit(size_t ncpus,
+                              size_t ncells,
+                              unsigned int interval,
+                              unsigned int window);
+int linuxNodeStatsSamplerCollect(const char *procstat,
+                                 const char *meminfo,
+                                 const char *sysfs_dir,
+                                 unsigned long long when);
+
 static int linuxNodeGetCPUStats(FILE *procstat,
                                 int cpuNum,
                                 virNodeCPUStatsPtr params,
@@ -600,6 +628,29 @@ cleanup:
 
 # define TICK_TO_NSEC (1000ull * 1000ull * 1000ull / sysconf(_SC_CLK_TCK))
 
+/* Parse a "cpu" or "cpuN" line of /proc/stat into @times,
+ * returns -1 if the line does not hold CPU times */
+static int
+linuxNodeParseCPUTimes(const char *line,
+                       nodeCPUTimesPtr times)
+{
+    unsigned long long usr = 0, ni = 0, sys = 0, idle = 0, iowait = 0;
+    unsigned long long irq = 0, softirq = 0, steal, guest, guest_nice;
+
+    if (sscanf(line,
+               "%*s %llu %llu %llu %llu %llu" // user ~ iowait
+               "%llu %llu %llu %llu %llu",    // irq  ~ guest_nice
+               &usr, &ni, &sys, &idle, &iowait,
+               &irq, &softirq, &steal, &guest, &guest_nice) < 4)
+        return -1;
+
+    times->kernel = (sys + irq + softirq) * TICK_TO_NSEC;
+    times->user = (usr + ni) * TICK_TO_NSEC;
+    times->idle = idle * TICK_TO_NSEC;
+    times->iowait = iowait * TICK_TO_NSEC;
+    return 0;
+}
+
 int linuxNodeGetCPUStats(FILE *procstat,
                          int cpuNum,
                          virNodeCPUStatsPtr params,
@@ -607,8 +658,7 @@ int linuxNodeGetCPUStats(FILE *procstat,
 {
     int ret = -1;
     char line[1024];
-    unsigned long long usr, ni, sys, idle, iowait;
-    unsigned long long irq, softirq, steal, guest, guest_nice;
+    nodeCPUTimes times;
     char cpu_header[3 + INT_BUFSIZE_BOUND(cpuNum)];
 
     if ((*nparams) == 0) {
@@ -637,13 +687,8 @@ int linuxNodeGetCPUStats(FILE *procstat,
         if (STRPREFIX(buf, cpu_header)) { /* aka logical CPU time */
             int i;
 
-            if (sscanf(buf,
-                       "%*s %llu %llu %llu %llu %llu" // user ~ iowait
-                       "%llu %llu %llu %llu %llu",    // irq  ~ guest_nice
-                       &usr, &ni, &sys, &idle, &iowait,
-                       &irq, &softirq, &steal, &guest, &guest_nice) < 4) {
+            if (linuxNodeParseCPUTimes(buf, &times) < 0)
                 continue;
-            }
 
             for (i = 0; i < *nparams; i++) {
                 virNodeCPUStatsPtr param = &params[i];
@@ -655,7 +700,7 @@ int linuxNodeGetCPUStats(FILE *procstat,
                                        "%s", _("Field kernel cpu time too long for destination"));
                         goto cleanup;
                     }
-                    param->value = (sys + irq + softirq) * TICK_TO_NSEC;
+                    param->value = times.kernel;
                     break;
 
                 case 1: /* fill user cpu time here */
@@ -664,7 +709,7 @@ int linuxNodeGetCPUStats(FILE *procstat,
                                        "%s", _("Field kernel cpu time too long for destination"));
                         goto cleanup;
                     }
-                    param->value = (usr + ni) * TICK_TO_NSEC;
+                    param->value = times.user;
                     break;
 
                 case 2: /* fill idle cpu time here */
@@ -673,7 +718,7 @@ int linuxNodeGetCPUStats(FILE *procstat,
                                        "%s", _("Field kernel cpu time too long for destination"));
                         goto cleanup;
                     }
-                    param->value = idle * TICK_TO_NSEC;
+                    param->value = times.idle;
                     break;
 
                 case 3: /* fill iowait cpu time here */
@@ -682,7 +727,7 @@ int linuxNodeGetCPUStats(FILE *procstat,
                                        "%s", _("Field kernel cpu time too long for destination"));
                         goto cleanup;
                     }
-                    param->value = iowait * TICK_TO_NSEC;
+                    param->value = times.iowait;
                     break;
 
                 default:
@@ -864,6 +909,640 @@ error:
     virBitmapFree(map);
     return NULL;
 }
+
+
+static int
+linuxNodeComparePlacementNodes(const void *a, const void *b)
+{
+    const virNumaPlacementNode *na = a;
+    const virNumaPlacementNode *nb = b;
+
+    return na->id < nb->id ? -1 : na->id > nb->id;
+}
+
+
+/*
+ * Read CPUs, total and free memory of every NUMA node from
+ * DIR/node/nodeN. Nodes are returned sorted by their number.
+ * If the kernel does not expose NUMA nodes at all, @nnodes is
+ * set to 0 and 0 is returned.
+ */
+int
+linuxNodeGetNumaPlacementNodes(const char *sysfs_dir,
+                               virNumaPlacementNodePtr *nodes,
+                               size_t *nnodes)
+{
+    virNumaPlacementNodePtr tmp = NULL;
+    size_t ntmp = 0;
+    char *sysfs_nodedir = NULL;
+    char *path = NULL;
+    char *str = NULL;
+    DIR *nodedir = NULL;
+    struct dirent *nodedirent;
+    FILE *meminfo = NULL;
+    unsigned int node;
+    int ret = -1;
+
+    *nodes = NULL;
+    *nnodes = 0;
+
+    if (virAsprintf(&sysfs_nodedir, "%s/node", sysfs_dir) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    if (!(nodedir = opendir(sysfs_nodedir))) {
+        /* the host isn't probably running a NUMA architecture */
+        ret = 0;
+        goto cleanup;
+    }
+
+    errno = 0;
+    while ((nodedirent = readdir(nodedir))) {
+        virNodeMemoryStats params[LINUX_NB_MEMORY_STATS_CELL];
+        int nparams = LINUX_NB_MEMORY_STATS_CELL;
+        virNumaPlacementNodePtr cur;
+        const char *cpulist;
+        int i;
+
+        if (sscanf(nodedirent->d_name, "node%u", &node) != 1)
+            continue;
+
+        if (VIR_EXPAND_N(tmp, ntmp, 1) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        cur = &tmp[ntmp - 1];
+        cur->id = node;
+
+        if (virAsprintf(&path, "%s/%s/cpulist",
+                        sysfs_nodedir, nodedirent->d_name) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        if (virFileReadAll(path, 5 * VIR_DOMAIN_CPUMASK_LEN, &str) < 0)
+            goto cleanup;
+
+        /* Memory only nodes have an empty cpulist */
+        cpulist = str;
+        virSkipSpaces(&cpulist);
+        if (!*cpulist) {
+            if (!(cur->cpus = virBitmapNew(VIR_DOMAIN_CPUMASK_LEN))) {
+                virReportOOMError();
+                goto cleanup;
+            }
+        } else if (virBitmapParse(cpulist, 0, &cur->cpus,
+                                  VIR_DOMAIN_CPUMASK_LEN) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("failed to parse %s"), path);
+            goto cleanup;
+        }
+        VIR_FREE(str);
+        VIR_FREE(path);
+
+        if (virAsprintf(&path, "%s/%s/meminfo",
+                        sysfs_nodedir, nodedirent->d_name) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        if (!(meminfo = fopen(path, "r"))) {
+            virReportSystemError(errno, _("cannot open %s"), path);
+            goto cleanup;
+        }
+        if (linuxNodeGetMemoryStats(meminfo, node, params, &nparams) < 0)
+            goto cleanup;
+        VIR_FORCE_FCLOSE(meminfo);
+        VIR_FREE(path);
+
+        for (i = 0; i < nparams; i++) {
+            if (STREQ(params[i].field, VIR_NODE_MEMORY_STATS_TOTAL))
+                cur->memTotal = params[i].value;
+            else if (STREQ(params[i].field, VIR_NODE_MEMORY_STATS_FREE))
+                cur->memFree = params[i].value;
+        }
+
+        errno = 0;
+    }
+
+    if (errno) {
+        virReportSystemError(errno, _("problem reading %s"), sysfs_nodedir);
+        goto cleanup;
+    }
+
+    qsort(tmp, ntmp, sizeof(*tmp), linuxNodeComparePlacementNodes);
+
+    *nodes = tmp;
+    *nnodes = ntmp;
+    tmp = NULL;
+    ntmp = 0;
+    ret = 0;
+
+cleanup:
+    if (nodedir)
+        closedir(nodedir);
+    VIR_FORCE_FCLOSE(meminfo);
+    virNumaPlacementNodesFree(tmp, ntmp);
+    VIR_FREE(sysfs_nodedir);
+    VIR_FREE(path);
+    VIR_FREE(str);
+    return ret;
+}
+
+
+/*
+ * Host statistics sampler
+ *
+ * When enabled, a background thread reads /proc/stat, /proc/meminfo
+ * and the per node meminfo files every @interval seconds and the
+ * node stats APIs answer from the latest sample instead of parsing
+ * those files on each call.
+ *
+ * Samples live in a ring which doubles as the history used to
+ * compute rates. A slot is never modified in place while it is
+ * the newest one: the thread collects into a scratch sample,
+ * copies it into the oldest slot under that slot's sequence
+ * counter and only then publishes it. Readers never block; they
+ * copy what they need out of a slot and retry if its sequence
+ * counter was odd or changed meanwhile.
+ */
+typedef struct _nodeStatsSample nodeStatsSample;
+typedef nodeStatsSample *nodeStatsSamplePtr;
+struct _nodeStatsSample {
+    int seq;                        /* odd while the slot is rewritten */
+    unsigned long long when;        /* in milliseconds */
+    nodeCPUTimesPtr cpus;           /* [0] all CPUs, [n + 1] CPU n */
+    virNodeMemoryStats mem[LINUX_NB_MEMORY_STATS_ALL];
+    virNodeMemoryStats *cells;      /* LINUX_NB_MEMORY_STATS_CELL per cell,
+                                     * empty field if the cell is missing */
+};
+
+struct nodeStatsSampler {
+    virMutex lock;
+    virCond cond;
+    bool quit;
+    bool threaded;                  /* whether @thread was started */
+    virThread thread;
+    unsigned int interval;          /* in seconds */
+
+    size_t ncpus;                   /* entries of nodeStatsSample.cpus */
+    size_t ncells;
+    size_t nsamples;
+    nodeStatsSamplePtr samples;
+    nodeStatsSample scratch;
+
+    int published;                  /* number of samples published */
+};
+
+static struct nodeStatsSampler nodeStats;
+static int nodeStatsActive;
+
+typedef void (*nodeStatsCopyFunc)(nodeStatsSamplePtr sample,
+                                  void *opaque);
+
+
+static void
+nodeStatsSampleClear(nodeStatsSamplePtr sample)
+{
+    VIR_FREE(sample->cpus);
+    VIR_FREE(sample->cells);
+}
+
+
+static int
+nodeStatsSampleInit(nodeStatsSamplePtr sample)
+{
+    if (VIR_ALLOC_N(sample->cpus, nodeStats.ncpus) < 0 ||
+        VIR_ALLOC_N(sample->cells,
+                    nodeStats.ncells * LINUX_NB_MEMORY_STATS_CELL) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+    return 0;
+}
+
+
+static int
+nodeStatsCollectCPUs(const char *path,
+                     nodeStatsSamplePtr sample)
+{
+    FILE *procstat;
+    char line[1024];
+    size_t i;
+
+    if (!(procstat = fopen(path, "r"))) {
+        virReportSystemError(errno, _("cannot open %s"), path);
+        return -1;
+    }
+
+    for (i = 0; i < nodeStats.ncpus; i++)
+        sample->cpus[i].online = false;
+
+    while (fgets(line, sizeof(line), procstat) != NULL) {
+        unsigned int cpu;
+        size_t idx;
+
+        if (!STRPREFIX(line, "cpu"))
+            continue;
+
+        if (c_isspace(line[3]))
+            idx = 0;
+        else if (sscanf(line, "cpu%u", &cpu) == 1 && cpu + 1 < nodeStats.ncpus)
+            idx = cpu + 1;
+        else
+            continue;
+
+        if (linuxNodeParseCPUTimes(line, &sample->cpus[idx]) == 0)
+            sample->cpus[idx].online = true;
+    }
+
+    VIR_FORCE_FCLOSE(procstat);
+    return 0;
+}
+
+
+static int
+nodeStatsCollectMemory(const char *path,
+                       int cellNum,
+                       virNodeMemoryStatsPtr params,
+                       int nparams)
+{
+    FILE *meminfo;
+    int ret;
+
+    if (!(meminfo = fopen(path, "r"))) {
+        virReportSystemError(errno, _("cannot open %s"), path);
+        return -1;
+    }
+
+    ret = linuxNodeGetMemoryStats(meminfo, cellNum, params, &nparams);
+    VIR_FORCE_FCLOSE(meminfo);
+    return ret;
+}
+
+
+static int
+nodeStatsCollect(nodeStatsSamplePtr sample,
+                 const char *procstat,
+                 const char *meminfo,
+                 const char *sysfs_dir)
+{
+    char *path = NULL;
+    size_t i;
+
+    if (nodeStatsCollectCPUs(procstat, sample) < 0 ||
+        nodeStatsCollectMemory(meminfo, VIR_NODE_MEMORY_STATS_ALL_CELLS,
+                               sample->mem, LINUX_NB_MEMORY_STATS_ALL) < 0)
+        return -1;
+
+    for (i = 0; i < nodeStats.ncells; i++) {
+        virNodeMemoryStatsPtr cell =
+            &sample->cells[i * LINUX_NB_MEMORY_STATS_CELL];
+
+        if (virAsprintf(&path, "%s/node/node%zu/meminfo",
+                        sysfs_dir, i) < 0) {
+            virReportOOMError();
+            return -1;
+        }
+
+        /* Node numbers may have holes */
+        if (!virFileExists(path) ||
+            nodeStatsCollectMemory(path, i, cell,
+                                   LINUX_NB_MEMORY_STATS_CELL) < 0)
+            cell[0].field[0] = '\0';
+        VIR_FREE(path);
+    }
+
+    return 0;
+}
+
+
+static void
+nodeStatsPublish(void)
+{
+    nodeStatsSamplePtr slot = &nodeStats.samples[nodeStats.published %
+                                                 nodeStats.nsamples];
+    nodeStatsSamplePtr scratch = &nodeStats.scratch;
+
+    virAtomicIntInc(&slot->seq);
+    slot->when = scratch->when;
+    memcpy(slot->cpus, scratch->cpus,
+           sizeof(*slot->cpus) * nodeStats.ncpus);
+    memcpy(slot->mem, scratch->mem, sizeof(slot->mem));
+    memcpy(slot->cells, scratch->cells,
+           sizeof(*slot->cells) * nodeStats.ncells *
+           LINUX_NB_MEMORY_STATS_CELL);
+    virAtomicIntInc(&slot->seq);
+
+    virAtomicIntSet(&nodeStats.published, nodeStats.published + 1);
+}
+
+
+static void
+nodeStatsSamplerFree(void)
+{
+    size_t i;
+
+    if (nodeStats.samples) {
+        for (i = 0; i < nodeStats.nsamples; i++)
+            nodeStatsSampleClear(&nodeStats.samples[i]);
+        VIR_FREE(nodeStats.samples);
+    }
+    nodeStatsSampleClear(&nodeStats.scratch);
+    virCondDestroy(&nodeStats.cond);
+    virMutexDestroy(&nodeStats.lock);
+}
+
+
+/*
+ * Set up the sampler for @ncpus CPUs and @ncells NUMA cells and
+ * make the node stats APIs look for samples, without collecting
+ * any. nodeStatsSamplerStop undoes this.
+ */
+int
+linuxNodeStatsSamplerInit(size_t ncpus,
+                          size_t ncells,
+                          unsigned int interval,
+                          unsigned int window)
+{
+    size_t i;
+
+    memset(&nodeStats, 0, sizeof(nodeStats));
+    nodeStats.interval = interval;
+    nodeStats.ncpus = ncpus + 1;
+    nodeStats.ncells = ncells;
+    /* One more slot than the window needs, as the oldest one is
+     * the next to be rewritten */
+    nodeStats.nsamples = window / interval + 2;
+
+    if (virMutexInit(&nodeStats.lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to initialize mutex"));
+        return -1;
+    }
+    if (virCondInit(&nodeStats.cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to initialize condition variable"));
+        virMutexDestroy(&nodeStats.lock);
+        return -1;
+    }
+
+    if (VIR_ALLOC_N(nodeStats.samples, nodeStats.nsamples) < 0) {
+        virReportOOMError();
+        goto error;
+    }
+    for (i = 0; i < nodeStats.nsamples; i++) {
+        if (nodeStatsSampleInit(&nodeStats.samples[i]) < 0)
+            goto error;
+    }
+    if (nodeStatsSampleInit(&nodeStats.scratch) < 0)
+        goto error;
+
+    virAtomicIntSet(&nodeStatsActive, 1);
+    return 0;
+
+error:
+    nodeStatsSamplerFree();
+    return -1;
+}
+
+
+/*
+ * Collect a sample taken at @when from the given files and publish
+ * it. Only one thread at a time may call this, which is the sampler
+ * thread once it runs.
+ */
+int
+linuxNodeStatsSamplerCollect(const char *procstat,
+                             const char *meminfo,
+                             const char *sysfs_dir,
+                             unsigned long long when)
+{
+    nodeStats.scratch.when = when;
+    if (nodeStatsCollect(&nodeStats.scratch, procstat, meminfo, sysfs_dir) < 0)
+        return -1;
+    nodeStatsPublish();
+    return 0;
+}
+
+
+static void
+nodeStatsWorker(void *opaque ATTRIBUTE_UNUSED)
+{
+    unsigned long long now;
+
+    virMutexLock(&nodeStats.lock);
+    while (!nodeStats.quit) {
+        virMutexUnlock(&nodeStats.lock);
+
+        if (virTimeMillisNow(&now) < 0 ||
+            linuxNodeStatsSamplerCollect(PROCSTAT_PATH, MEMINFO_PATH,
+                                         SYSFS_SYSTEM_PATH, now) < 0) {
+            virErrorPtr err = virGetLastError();
+            VIR_WARN("Unable to sample host statistics: %s",
+                     err && err->message ? err->message : _("unknown error"));
+            virResetLastError();
+        }
+
+        virMutexLock(&nodeStats.lock);
+        if (nodeStats.quit || virTimeMillisNow(&now) < 0)
+            break;
+        while (!nodeStats.quit &&
+               virCondWaitUntil(&nodeStats.cond, &nodeStats.lock,
+                                now + nodeStats.interval * 1000ull) == 0)
+            ;
+    }
+    virMutexUnlock(&nodeStats.lock);
+}
+
+
+/*
+ * Let @copy take what it needs from the sample published @age
+ * samples before the latest one. Returns 1 if it did, 0 if the
+ * sampler is not running or has no such sample (anymore).
+ */
+static int
+nodeStatsRead(size_t age,
+              nodeStatsCopyFunc copy,
+              void *opaque)
+{
+    int published;
+    int seq;
+    nodeStatsSamplePtr slot;
+
+    if (!virAtomicIntGet(&nodeStatsActive))
+        return 0;
+
+    for (;;) {
+        published = virAtomicIntGet(&nodeStats.published);
+        if (published <= age || age >= nodeStats.nsamples - 1)
+            return 0;
+
+        slot = &nodeStats.samples[(published - 1 - age) % nodeStats.nsamples];
+        seq = virAtomicIntGet(&slot->seq);
+        if (seq & 1)
+            continue;
+
+        copy(slot, opaque);
+
+        if (virAtomicIntGet(&slot->seq) == seq)
+            return 1;
+    }
+}
+
+
+struct nodeStatsCPUData {
+    int cpuNum;
+    unsigned long long when;
+    nodeCPUTimes times;
+};
+
+static void
+nodeStatsCopyCPU(nodeStatsSamplePtr sample,
+                 void *opaque)
+{
+    struct nodeStatsCPUData *data = opaque;
+    size_t idx = data->cpuNum + 1;
+
+    data->when = sample->when;
+    if (idx < nodeStats.ncpus)
+        data->times = sample->cpus[idx];
+    else
+        data->times.online = false;
+}
+
+
+struct nodeStatsMemoryData {
+    int cellNum;
+    virNodeMemoryStats params[LINUX_NB_MEMORY_STATS_ALL];
+    bool found;
+};
+
+static void
+nodeStatsCopyMemory(nodeStatsSamplePtr sample,
+                    void *opaque)
+{
+    struct nodeStatsMemoryData *data = opaque;
+
+    data->found = false;
+    if (data->cellNum == VIR_NODE_MEMORY_STATS_ALL_CELLS) {
+        memcpy(data->params, sample->mem, sizeof(sample->mem));
+        data->found = true;
+    } else if (data->cellNum >= 0 && data->cellNum < nodeStats.ncells) {
+        virNodeMemoryStatsPtr cell =
+            &sample->cells[data->cellNum * LINUX_NB_MEMORY_STATS_CELL];
+
+        memcpy(data->params, cell,
+               sizeof(*cell) * LINUX_NB_MEMORY_STATS_CELL);
+        data->found = cell[0].field[0] != '\0';
+    }
+}
+
+
+/* Answer nodeGetCPUStats from the latest sample, returns 1 if done */
+static int
+nodeStatsGetCPUStats(int cpuNum,
+                     virNodeCPUStatsPtr params,
+                     int nparams)
+{
+    struct nodeStatsCPUData data = { .cpuNum = cpuNum };
+    const char *fields[LINUX_NB_CPU_STATS] = {
+        VIR_NODE_CPU_STATS_KERNEL, VIR_NODE_CPU_STATS_USER,
+        VIR_NODE_CPU_STATS_IDLE, VIR_NODE_CPU_STATS_IOWAIT,
+    };
+    unsigned long long values[LINUX_NB_CPU_STATS];
+    size_t i;
+
+    if (nparams != LINUX_NB_CPU_STATS ||
+        nodeStatsRead(0, nodeStatsCopyCPU, &data) != 1 ||
+        !data.times.online)
+        return 0;
+
+    values[0] = data.times.kernel;
+    values[1] = data.times.user;
+    values[2] = data.times.idle;
+    values[3] = data.times.iowait;
+    for (i = 0; i < LINUX_NB_CPU_STATS; i++) {
+        ignore_value(virStrcpyStatic(params[i].field, fields[i]));
+        params[i].value = values[i];
+    }
+    return 1;
+}
+
+
+/* Answer nodeGetMemoryStats from the latest sample, returns 1 if done */
+static int
+nodeStatsGetMemoryStats(int cellNum,
+                        virNodeMemoryStatsPtr params,
+                        int nparams)
+{
+    struct nodeStatsMemoryData data = { .cellNum = cellNum };
+    int expected = cellNum == VIR_NODE_MEMORY_STATS_ALL_CELLS ?
+        LINUX_NB_MEMORY_STATS_ALL : LINUX_NB_MEMORY_STATS_CELL;
+
+    if (nparams != expected ||
+        nodeStatsRead(0, nodeStatsCopyMemory, &data) != 1 ||
+        !data.found)
+        return 0;
+
+    memcpy(params, data.params, sizeof(*params) * nparams);
+    return 1;
+}
+
+
+struct nodeStatsFreeData {
+    int startCell;
+    int maxCells;
+    unsigned long long *freeMems;
+    int ncells;
+};
+
+static void
+nodeStatsCopyFree(nodeStatsSamplePtr sample,
+                  void *opaque)
+{
+    struct nodeStatsFreeData *data = opaque;
+    int cell;
+
+    data->ncells = 0;
+    for (cell = data->startCell;
+         cell < nodeStats.ncells && data->ncells < data->maxCells;
+         cell++) {
+        virNodeMemoryStatsPtr stats =
+            &sample->cells[cell * LINUX_NB_MEMORY_STATS_CELL];
+        size_t i;
+
+        if (stats[0].field[0] == '\0') {
+            data->ncells = 0;
+            return;
+        }
+        for (i = 0; i < LINUX_NB_MEMORY_STATS_CELL; i++) {
+            if (STREQ(stats[i].field, VIR_NODE_MEMORY_STATS_FREE))
+                data->freeMems[data->ncells] = stats[i].value * 1024;
+        }
+        data->ncells++;
+    }
+}
+
+
+/* Answer nodeGetCellsFreeMemory from the latest sample, returns the
+ * number of cells filled in or 0 if the caller has to read them */
+static int
+nodeStatsGetCellsFreeMemory(unsigned long long *freeMems,
+                            int startCell,
+                            int maxCells)
+{
+    struct nodeStatsFreeData data = {
+        .startCell = startCell,
+        .maxCells = maxCells,
+        .freeMems = freeMems,
+    };
+
+    if (startCell < 0 || startCell >= nodeStats.ncells ||
+        nodeStatsRead(0, nodeStatsCopyFree, &data) != 1)
+        return 0;
+
+    return data.ncells;
+}
 #endif
 
 int nodeGetInfo(virConnectPtr conn ATTRIBUTE_UNUSED, virNodeInfoPtr nodeinfo)
@@ -946,12 +1625,45 @@ int nodeGetCPUStats(virConnectPtr conn ATTRIBUTE_UNUSED,
                     int *nparams ATTRIBUTE_UNUSED,
                     unsigned int flags)
 {
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_NODE_CPU_STATS_AVERAGE, -1);
+
+    if (flags & VIR_NODE_CPU_STATS_AVERAGE) {
+        unsigned long long utilization;
+
+        if (*nparams == 0) {
+            *nparams = 1;
+            return 0;
+        }
+
+        if (*nparams != 1) {
+            virReportInvalidArg(*nparams,
+                                _("nparams in %s must be equal to %d"),
+                                __FUNCTION__, 1);
+            return -1;
+        }
+
+        if (nodeGetCPUUtilization(cpuNum, 0, &utilization) < 0)
+            return -1;
+
+        if (virStrcpyStatic(params[0].field,
+                            VIR_NODE_CPU_STATS_UTILIZATION) == NULL) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Field cpu utilization too long for destination"));
+            return -1;
+        }
+        params[0].value = utilization;
+        return 0;
+    }
 
 #ifdef __linux__
     {
         int ret;
-        FILE *procstat = fopen(PROCSTAT_PATH, "r");
+        FILE *procstat;
+
+        if (*nparams && nodeStatsGetCPUStats(cpuNum, params, *nparams))
+            return 0;
+
+        procstat = fopen(PROCSTAT_PATH, "r");
         if (!procstat) {
             virReportSystemError(errno,
                                  _("cannot open %s"), PROCSTAT_PATH);
@@ -983,6 +1695,9 @@ int nodeGetMemoryStats(virConnectPtr conn ATTRIBUTE_UNUSED,
         char *meminfo_path = NULL;
         FILE *meminfo;
 
+        if (*nparams && nodeStatsGetMemoryStats(cellNum, params, *nparams))
+            return 0;
+
         if (cellNum == VIR_NODE_MEMORY_STATS_ALL_CELLS) {
             meminfo_path = strdup(MEMINFO_PATH);
             if (!meminfo_path) {
@@ -1570,6 +2285,106 @@ nodeGetFreeMemoryFake(virConnectPtr conn ATTRIBUTE_UNUSED)
 
 static unsigned long long nodeGetCellMemory(int cell);
 
+static int
+nodeComparePageInfo(const void *a, const void *b)
+{
+    const virCapsHostNUMACellPageInfo *pa = a;
+    const virCapsHostNUMACellPageInfo *pb = b;
+
+    return pa->size < pb->size ? -1 : pa->size > pb->size;
+}
+
+/* Fill in the page sizes available on NUMA @cell, which has @memory
+ * KiB in total: the system page size first, then each hugepage size
+ * the kernel has a pool for, smallest first. */
+static int
+nodeGetCellPageInfo(int cell,
+                    unsigned long long memory,
+                    virCapsHostNUMACellPageInfoPtr *pageinfo,
+                    int *npageinfo)
+{
+    char *path = NULL;
+    char *buf = NULL;
+    DIR *dir = NULL;
+    struct dirent *ent;
+    virCapsHostNUMACellPageInfoPtr pages = NULL;
+    size_t npages = 0;
+    unsigned long long hugemem = 0;
+    long pagesize = sysconf(_SC_PAGESIZE) / 1024;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(pages, 1) < 0)
+        goto no_memory;
+    npages = 1;
+
+    if (virAsprintf(&path, "%s/node/node%d/hugepages",
+                    SYSFS_SYSTEM_PATH, cell) < 0)
+        goto no_memory;
+
+    /* Kernels without hugepage support, or with a single global
+     * pool only, have no per node directory */
+    if (!(dir = opendir(path)))
+        goto done;
+
+    while ((ent = readdir(dir))) {
+        unsigned int size;
+        unsigned long long count;
+        char *end;
+
+        if (!STRPREFIX(ent->d_name, "hugepages-") ||
+            virStrToLong_ui(ent->d_name + strlen("hugepages-"),
+                            &end, 10, &size) < 0 ||
+            STRNEQ(end, "kB"))
+            continue;
+
+        VIR_FREE(buf);
+        VIR_FREE(path);
+        if (virAsprintf(&path, "%s/node/node%d/hugepages/%s/nr_hugepages",
+                        SYSFS_SYSTEM_PATH, cell, ent->d_name) < 0)
+            goto no_memory;
+
+        if (virFileReadAll(path, 1024, &buf) < 0)
+            goto cleanup;
+
+        if (virStrToLong_ull(buf, &end, 10, &count) < 0 ||
+            (*end && *end != '\n')) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("unable to parse %s"), path);
+            goto cleanup;
+        }
+
+        if (VIR_EXPAND_N(pages, npages, 1) < 0)
+            goto no_memory;
+        pages[npages - 1].size = size;
+        pages[npages - 1].avail = count;
+        hugemem += count * size;
+    }
+
+    qsort(pages + 1, npages - 1, sizeof(*pages), nodeComparePageInfo);
+
+done:
+    /* Whatever is not reserved for hugepages is in system pages */
+    pages[0].size = pagesize;
+    pages[0].avail = memory > hugemem ? (memory - hugemem) / pagesize : 0;
+
+    *pageinfo = pages;
+    *npageinfo = npages;
+    pages = NULL;
+    ret = 0;
+
+cleanup:
+    if (dir)
+        closedir(dir);
+    VIR_FREE(pages);
+    VIR_FREE(buf);
+    VIR_FREE(path);
+    return ret;
+
+no_memory:
+    virReportOOMError();
+    goto cleanup;
+}
+
 static virBitmapPtr
 virNodeGetSiblingsList(const char *dir, int cpu_id)
 {
@@ -1631,6 +2446,8 @@ nodeCapsInitNUMA(virCapsPtr caps)
     unsigned long *allonesmask = NULL;
     unsigned long long memory;
     virCapsHostNUMACellCPUPtr cpus = NULL;
+    virCapsHostNUMACellPageInfoPtr pageinfo = NULL;
+    int npageinfo;
     int ret = -1;
     int max_n_cpus = NUMA_MAX_N_CPUS;
     int ncpus = 0;
@@ -1682,6 +2499,14 @@ nodeCapsInitNUMA(virCapsPtr caps)
 
         if (virCapabilitiesAddHostNUMACell(caps, n, ncpus, memory, cpus) < 0)
             goto cleanup;
+
+        if (nodeGetCellPageInfo(n, memory, &pageinfo, &npageinfo) < 0 ||
+            virCapabilitiesSetHostNUMACellPageInfo(caps, n, npageinfo,
+                                                   pageinfo) < 0) {
+            VIR_WARN("Unable to get page sizes of NUMA cell %d", n);
+            virResetLastError();
+            VIR_FREE(pageinfo);
+        }
     }
 
     ret = 0;
@@ -1713,6 +2538,10 @@ nodeGetCellsFreeMemory(virConnectPtr conn,
         return nodeGetCellsFreeMemoryFake(conn, freeMems,
                                           startCell, maxCells);
 
+    if ((ret = nodeStatsGetCellsFreeMemory(freeMems, startCell, maxCells)) > 0)
+        return ret;
+    ret = -1;
+
     maxCell = numa_max_node();
     if (startCell > maxCell) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -1825,3 +2654,236 @@ unsigned long long nodeGetFreeMemory(virConnectPtr conn)
     return nodeGetFreeMemoryFake(conn);
 }
 #endif
+
+
+/**
+ * nodeGetNumaPlacementNodes:
+ * @nodes: filled with the host NUMA nodes
+ * @nnodes: filled with the number of items in @nodes
+ *
+ * Gather what automatic NUMA placement needs to know about the
+ * host: the CPUs, total and free memory of each NUMA node. Hosts
+ * without NUMA are reported as a single node 0 holding all CPUs
+ * and memory. Free the result with virNumaPlacementNodesFree.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int
+nodeGetNumaPlacementNodes(virNumaPlacementNodePtr *nodes,
+                          size_t *nnodes)
+{
+    virBitmapPtr cpus;
+
+#ifdef __linux__
+    if (linuxNodeGetNumaPlacementNodes(SYSFS_SYSTEM_PATH, nodes, nnodes) < 0)
+        return -1;
+    if (*nnodes)
+        return 0;
+#endif
+
+    if (!(cpus = nodeGetCPUBitmap(NULL)))
+        return -1;
+
+    if (VIR_ALLOC_N(*nodes, 1) < 0) {
+        virReportOOMError();
+        virBitmapFree(cpus);
+        return -1;
+    }
+
+    (*nodes)[0].id = 0;
+    (*nodes)[0].cpus = cpus;
+    (*nodes)[0].memTotal = physmem_total() / 1024;
+    (*nodes)[0].memFree = physmem_available() / 1024;
+    *nnodes = 1;
+    return 0;
+}
+
+
+/**
+ * nodeStatsSamplerStart:
+ * @interval: seconds between two samples
+ * @window: seconds of history to keep for rates
+ *
+ * Start sampling host CPU and memory statistics in the background.
+ * nodeGetCPUStats, nodeGetMemoryStats and nodeGetCellsFreeMemory
+ * then answer from the latest sample, which is at most @interval
+ * seconds old, and nodeGetCPUUtilization can compute utilization
+ * over up to @window seconds.
+ *
+ * Returns 0 on success, -1 on error
+ */
+#ifdef __linux__
+int
+nodeStatsSamplerStart(unsigned int interval,
+                      unsigned int window)
+{
+    int ncpus;
+    size_t ncells = 0;
+    unsigned long long now;
+
+    if (virAtomicIntGet(&nodeStatsActive)) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("host statistics sampler is already running"));
+        return -1;
+    }
+
+    if (interval == 0) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("host statistics interval must be greater than 0"));
+        return -1;
+    }
+
+    if ((ncpus = nodeGetCPUCount()) < 0)
+        return -1;
+
+# if WITH_NUMACTL
+    if (numa_available() >= 0)
+        ncells = numa_max_node() + 1;
+# endif
+
+    if (linuxNodeStatsSamplerInit(ncpus, ncells, interval, window) < 0)
+        return -1;
+
+    /* Have a sample before anybody can look for one */
+    if (virTimeMillisNow(&now) < 0 ||
+        linuxNodeStatsSamplerCollect(PROCSTAT_PATH, MEMINFO_PATH,
+                                     SYSFS_SYSTEM_PATH, now) < 0)
+        goto error;
+
+    if (virThreadCreate(&nodeStats.thread, true, nodeStatsWorker, NULL) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to create host statistics thread"));
+        goto error;
+    }
+    nodeStats.threaded = true;
+
+    VIR_DEBUG("Sampling host statistics every %us, keeping %zu samples",
+              interval, nodeStats.nsamples);
+    return 0;
+
+error:
+    nodeStatsSamplerStop();
+    return -1;
+}
+#else
+int
+nodeStatsSamplerStart(unsigned int interval ATTRIBUTE_UNUSED,
+                      unsigned int window ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_NO_SUPPORT, "%s",
+                   _("host statistics sampling not implemented on this platform"));
+    return -1;
+}
+#endif
+
+
+/**
+ * nodeStatsSamplerStop:
+ *
+ * Stop the background sampler started by nodeStatsSamplerStart.
+ * Must not race with callers of the node stats APIs, so it is
+ * meant to be called on daemon shutdown once no more requests
+ * are being processed.
+ */
+void
+nodeStatsSamplerStop(void)
+{
+#ifdef __linux__
+    if (!virAtomicIntGet(&nodeStatsActive))
+        return;
+
+    virAtomicIntSet(&nodeStatsActive, 0);
+
+    if (nodeStats.threaded) {
+        virMutexLock(&nodeStats.lock);
+        nodeStats.quit = true;
+        virCondSignal(&nodeStats.cond);
+        virMutexUnlock(&nodeStats.lock);
+        virThreadJoin(&nodeStats.thread);
+    }
+
+    nodeStatsSamplerFree();
+#endif
+}
+
+
+/**
+ * nodeGetCPUUtilization:
+ * @cpuNum: CPU number or VIR_NODE_CPU_STATS_ALL_CPUS
+ * @seconds: length of the period, 0 for all of the history
+ * @utilization: filled with the utilization in percent
+ *
+ * Compute how busy @cpuNum was over the last @seconds from the
+ * samples kept by the host statistics sampler. If the history is
+ * shorter than @seconds, the whole history is used.
+ *
+ * Returns 0 on success, -1 on error
+ */
+#ifdef __linux__
+int
+nodeGetCPUUtilization(int cpuNum,
+                      unsigned int seconds,
+                      unsigned long long *utilization)
+{
+    struct nodeStatsCPUData newest = { .cpuNum = cpuNum };
+    struct nodeStatsCPUData oldest;
+    unsigned long long busy;
+    unsigned long long total;
+    size_t age;
+
+    if (!virAtomicIntGet(&nodeStatsActive)) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("host statistics sampling is not enabled"));
+        return -1;
+    }
+
+    if (nodeStatsRead(0, nodeStatsCopyCPU, &newest) != 1 ||
+        !newest.times.online) {
+        virReportInvalidArg(cpuNum,
+                            _("no statistics for cpuNum %d in %s"),
+                            cpuNum, __FUNCTION__);
+        return -1;
+    }
+
+    oldest = newest;
+    for (age = 1; ; age++) {
+        struct nodeStatsCPUData data = { .cpuNum = cpuNum };
+
+        if (nodeStatsRead(age, nodeStatsCopyCPU, &data) != 1 ||
+            !data.times.online)
+            break;
+
+        oldest = data;
+        if (seconds && newest.when - oldest.when >= seconds * 1000ull)
+            break;
+    }
+
+    if (oldest.when == newest.when) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("not enough host statistics samples yet"));
+        return -1;
+    }
+
+# define NODE_STATS_DELTA(field) \
+    (newest.times.field > oldest.times.field ? \
+     newest.times.field - oldest.times.field : 0)
+
+    busy = NODE_STATS_DELTA(kernel) + NODE_STATS_DELTA(user);
+    total = busy + NODE_STATS_DELTA(idle) + NODE_STATS_DELTA(iowait);
+
+# undef NODE_STATS_DELTA
+
+    *utilization = total ? busy * 100 / total : 0;
+    return 0;
+}
+#else
+int
+nodeGetCPUUtilization(int cpuNum ATTRIBUTE_UNUSED,
+                      unsigned int seconds ATTRIBUTE_UNUSED,
+                      unsigned long long *utilization ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_NO_SUPPORT, "%s",
+                   _("host statistics sampling not implemented on this platform"));
+    return -1;
+}
+#endif
@@ -25,6 +25,7 @@
 # define __VIR_NODEINFO_H__
 
 # include "capabilities.h"
+# include "virnuma.h"
 
 int nodeGetInfo(virConnectPtr conn, virNodeInfoPtr nodeinfo);
 int nodeCapsInitNUMA(virCapsPtr caps);
@@ -63,4 +64,14 @@ int nodeGetCPUMap(virConnectPtr conn,
                   unsigned int *online,
                   unsigned int flags);
 
+int nodeGetNumaPlacementNodes(virNumaPlacementNodePtr *nodes,
+                              size_t *nnodes);
+
+int nodeStatsSamplerStart(unsigned int interval,
+                          unsigned int window);
+void nodeStatsSamplerStop(void);
+int nodeGetCPUUtilization(int cpuNum,
+                          unsigned int seconds,
+                          unsigned long long *utilization);
+
 #endif /* __VIR_NODEINFO_H__*/
@@ -833,7 +833,7 @@ parallelsLoadDomain(parallelsConnPtr privconn, virJSONValuePtr jobj)
     if (STREQ(state, "running")) {
         virDomainObjSetState(dom, VIR_DOMAIN_RUNNING,
                              VIR_DOMAIN_RUNNING_BOOTED);
-        def->id = pdom->id;
+        virDomainObjListSetID(privconn->domains, dom, pdom->id);
     }
 
     if (STREQ(autostart, "on"))
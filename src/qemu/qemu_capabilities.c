@@ -224,6 +224,10 @@ VIR_ENUM_IMPL(virQEMUCaps, QEMU_CAPS_LAST,
               "pci-bridge", /* 141 */
               "vfio-pci", /* 142 */
               "vfio-pci.bootindex", /* 143 */
+              "iothread", /* 144 */
+              "memory-backend-ram", /* 145 */
+              "memory-backend-file", /* 146 */
+              "mlock", /* 147 */
     );
 
 struct _virQEMUCaps {
@@ -1010,6 +1014,8 @@ virQEMUCapsComputeCmdFlags(const char *help,
         virQEMUCapsSet(qemuCaps, QEMU_CAPS_NODEFCONFIG);
     if (strstr(help, "-no-user-config"))
         virQEMUCapsSet(qemuCaps, QEMU_CAPS_NO_USER_CONFIG);
+    if (strstr(help, "-realtime mlock"))
+        virQEMUCapsSet(qemuCaps, QEMU_CAPS_MLOCK);
     /* The trailing ' ' is important to avoid a bogus match */
     if (strstr(help, "-rtc "))
         virQEMUCapsSet(qemuCaps, QEMU_CAPS_RTC);
@@ -1354,6 +1360,9 @@ struct virQEMUCapsStringFlags virQEMUCapsObjectTypes[] = {
     { "spapr-nvram", QEMU_CAPS_DEVICE_NVRAM },
     { "pci-bridge", QEMU_CAPS_DEVICE_PCI_BRIDGE },
     { "vfio-pci", QEMU_CAPS_DEVICE_VFIO_PCI },
+    { "iothread", QEMU_CAPS_OBJECT_IOTHREAD },
+    { "memory-backend-ram", QEMU_CAPS_OBJECT_MEMORY_RAM },
+    { "memory-backend-file", QEMU_CAPS_OBJECT_MEMORY_FILE },
 };
 
 static struct virQEMUCapsStringFlags virQEMUCapsObjectPropsVirtioBlk[] = {
@@ -2515,9 +2524,11 @@ virQEMUCapsInitQMP(virQEMUCapsPtr qemuCaps,
 
     virQEMUCapsInitQMPBasic(qemuCaps);
 
-    /* USB option is supported v1.3.0 onwards */
-    if (qemuCaps->version >= 1003000)
+    /* USB option and -realtime mlock are supported v1.3.0 onwards */
+    if (qemuCaps->version >= 1003000) {
         virQEMUCapsSet(qemuCaps, QEMU_CAPS_MACHINE_USB_OPT);
+        virQEMUCapsSet(qemuCaps, QEMU_CAPS_MLOCK);
+    }
 
     if (!(archstr = qemuMonitorGetTargetArch(mon)))
         goto cleanup;
@@ -182,6 +182,10 @@ enum virQEMUCapsFlags {
     QEMU_CAPS_DEVICE_PCI_BRIDGE  = 141, /* -device pci-bridge */
     QEMU_CAPS_DEVICE_VFIO_PCI    = 142, /* -device vfio-pci */
     QEMU_CAPS_VFIO_PCI_BOOTINDEX = 143, /* bootindex param for vfio-pci device */
+    QEMU_CAPS_OBJECT_IOTHREAD    = 144, /* -object iothread */
+    QEMU_CAPS_OBJECT_MEMORY_RAM  = 145, /* -object memory-backend-ram */
+    QEMU_CAPS_OBJECT_MEMORY_FILE = 146, /* -object memory-backend-file */
+    QEMU_CAPS_MLOCK              = 147, /* -realtime mlock=on|off */
 
     QEMU_CAPS_LAST,                   /* this must always be the last item */
 };
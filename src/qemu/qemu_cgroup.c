@@ -378,6 +378,7 @@ int qemuInitCgroup(virQEMUDriverPtr driver,
     if (!cfg->privileged)
         goto done;
 
+    qemuDomainFreeVcpuCgroups(priv);
     virCgroupFree(&priv->cgroup);
 
     if (!vm->def->resource && startup) {
@@ -979,6 +980,72 @@ cleanup:
     return rc;
 }
 
+/*
+ * Move each IOThread into its own cgroup, next to the ones of the
+ * vCPUs, and bind it to the host CPUs of its <iothreadpin>, or to
+ * the ones of the emulator if it has none.
+ */
+int qemuSetupCgroupForIOThreads(virDomainObjPtr vm)
+{
+    virCgroupPtr cgroup_iothread = NULL;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virDomainDefPtr def = vm->def;
+    virDomainVcpuPinDefPtr pin;
+    virBitmapPtr cpumask;
+    int rc;
+    int i;
+
+    if (priv->cgroup == NULL || priv->niothreadpids == 0)
+        return 0;
+
+    for (i = 0; i < priv->niothreadpids; i++) {
+        /* IOThreads are numbered from 1 */
+        rc = virCgroupNewIOThread(priv->cgroup, i + 1, true, &cgroup_iothread);
+        if (rc < 0) {
+            virReportSystemError(-rc,
+                                 _("Unable to create iothread cgroup for %s"
+                                   "(iothread: %d)"),
+                                 def->name, i + 1);
+            goto cleanup;
+        }
+
+        rc = virCgroupAddTask(cgroup_iothread, priv->iothreadpids[i]);
+        if (rc < 0) {
+            virReportSystemError(-rc,
+                                 _("unable to add iothread %d task %d to cgroup"),
+                                 i + 1, priv->iothreadpids[i]);
+            goto cleanup;
+        }
+
+        if (virCgroupHasController(priv->cgroup, VIR_CGROUP_CONTROLLER_CPUSET)) {
+            cpumask = NULL;
+            if ((pin = virDomainVcpuPinFindByVcpu(def->cputune.iothreadspin,
+                                                  def->cputune.niothreadspin,
+                                                  i + 1)))
+                cpumask = pin->cpumask;
+            else if (def->placement_mode != VIR_DOMAIN_CPU_PLACEMENT_MODE_AUTO)
+                cpumask = def->cputune.emulatorpin ?
+                    def->cputune.emulatorpin->cpumask : def->cpumask;
+
+            if (cpumask &&
+                qemuSetupCgroupEmulatorPin(cgroup_iothread, cpumask) < 0)
+                goto cleanup;
+        }
+
+        virCgroupFree(&cgroup_iothread);
+    }
+
+    return 0;
+
+cleanup:
+    if (cgroup_iothread) {
+        virCgroupRemove(cgroup_iothread);
+        virCgroupFree(&cgroup_iothread);
+    }
+
+    return -1;
+}
+
 int qemuRemoveCgroup(virDomainObjPtr vm)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
@@ -986,6 +1053,7 @@ int qemuRemoveCgroup(virDomainObjPtr vm)
     if (priv->cgroup == NULL)
         return 0; /* Not supported, so claim success */
 
+    qemuDomainFreeVcpuCgroups(priv);
     return virCgroupRemove(priv->cgroup);
 }
 
@@ -113,6 +113,13 @@ VIR_ENUM_IMPL(qemuDeviceVideo, VIR_DOMAIN_VIDEO_TYPE_LAST,
               "", /* don't support vbox */
               "qxl-vga");
 
+VIR_ENUM_DECL(qemuNumaPolicy)
+
+VIR_ENUM_IMPL(qemuNumaPolicy, VIR_DOMAIN_NUMATUNE_MEM_LAST,
+              "bind",
+              "preferred",
+              "interleave");
+
 VIR_ENUM_DECL(qemuSoundCodec)
 
 VIR_ENUM_IMPL(qemuSoundCodec, VIR_DOMAIN_SOUND_CODEC_TYPE_LAST,
@@ -273,16 +280,35 @@ cleanup:
     return *tapfd < 0 ? -1 : 0;
 }
 
+/**
+ * qemuNetworkIfaceConnect:
+ * @def: the definition of the VM
+ * @conn: connection to look up networks with
+ * @driver: pointer to the driver instance
+ * @net: the interface to connect
+ * @qemuCaps: flags for qemu
+ * @tapfd: array to store the file descriptors of the TAP queues in
+ * @tapfdSize: number of queues to open
+ *
+ * Creates the TAP device of @net in its bridge, opening one file
+ * descriptor for each of @tapfdSize queues.
+ *
+ * Returns 0 on success or -1 in case of error.
+ */
 int
 qemuNetworkIfaceConnect(virDomainDefPtr def,
                         virConnectPtr conn,
                         virQEMUDriverPtr driver,
                         virDomainNetDefPtr net,
-                        virQEMUCapsPtr qemuCaps)
+                        virQEMUCapsPtr qemuCaps,
+                        int *tapfd,
+                        int tapfdSize)
 {
     char *brname = NULL;
     int err;
-    int tapfd = -1;
+    int ret = -1;
+    int i;
+    bool created = false;
     unsigned int tap_create_flags = VIR_NETDEV_TAP_CREATE_IFUP;
     bool template_ifname = false;
     int actualType = virDomainNetGetActualType(net);
@@ -350,23 +376,30 @@ qemuNetworkIfaceConnect(virDomainDefPtr def,
         tap_create_flags |= VIR_NETDEV_TAP_CREATE_VNET_HDR;
     }
 
-    if (cfg->privileged)
+    if (cfg->privileged) {
         err = virNetDevTapCreateInBridgePort(brname, &net->ifname, &net->mac,
-                                             def->uuid, &tapfd,
+                                             def->uuid, tapfd, tapfdSize,
                                              virDomainNetGetActualVirtPortProfile(net),
                                              virDomainNetGetActualVlan(net),
                                              tap_create_flags);
-    else
+    } else if (tapfdSize > 1) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                       _("multiqueue network is not supported by the "
+                         "bridge helper of unprivileged sessions"));
+        err = -1;
+    } else {
         err = qemuCreateInBridgePortWithHelper(cfg, brname,
                                                &net->ifname,
-                                               &tapfd, tap_create_flags);
+                                               tapfd, tap_create_flags);
+    }
 
-    virDomainAuditNetDevice(def, net, "/dev/net/tun", tapfd >= 0);
+    virDomainAuditNetDevice(def, net, "/dev/net/tun", err >= 0);
     if (err < 0) {
         if (template_ifname)
             VIR_FREE(net->ifname);
-        tapfd = -1;
+        goto cleanup;
     }
+    created = true;
 
     if (cfg->macFilter) {
         if ((err = networkAllowMacOnPort(driver, net->ifname, &net->mac))) {
@@ -376,43 +409,60 @@ qemuNetworkIfaceConnect(virDomainDefPtr def,
         }
     }
 
-    if (tapfd >= 0 &&
-        virNetDevBandwidthSet(net->ifname,
+    if (virNetDevBandwidthSet(net->ifname,
                               virDomainNetGetActualBandwidth(net),
                               false) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("cannot set bandwidth limits on %s"),
                        net->ifname);
-        VIR_FORCE_CLOSE(tapfd);
         goto cleanup;
     }
 
-    if (tapfd >= 0) {
-        if ((net->filter) && (net->ifname)) {
-            if (virDomainConfNWFilterInstantiate(conn, def->uuid, net) < 0)
-                VIR_FORCE_CLOSE(tapfd);
-        }
-    }
+    if (net->filter && net->ifname &&
+        virDomainConfNWFilterInstantiate(conn, def->uuid, net) < 0)
+        goto cleanup;
+
+    ret = 0;
 
 cleanup:
+    if (ret < 0 && created) {
+        for (i = 0; i < tapfdSize; i++)
+            VIR_FORCE_CLOSE(tapfd[i]);
+    }
     VIR_FREE(brname);
     virObjectUnref(cfg);
 
-    return tapfd;
+    return ret;
 }
 
 
+/**
+ * qemuOpenVhostNet:
+ * @def: the definition of the VM
+ * @net: the interface to open vhost-net for
+ * @qemuCaps: flags for qemu
+ * @vhostfd: array to store the file descriptors in
+ * @vhostfdSize: number of file descriptors wanted, one per queue
+ *
+ * Opens /dev/vhost-net once for each queue of @net, unless vhost-net
+ * can't or shouldn't be used with @net, in which case @vhostfdSize is
+ * set to zero.
+ *
+ * Returns 0 on success or -1 in case of error.
+ */
 int
 qemuOpenVhostNet(virDomainDefPtr def,
                  virDomainNetDefPtr net,
                  virQEMUCapsPtr qemuCaps,
-                 int *vhostfd)
+                 int *vhostfd,
+                 int *vhostfdSize)
 {
-    *vhostfd = -1;   /* assume we won't use vhost */
+    int i;
 
     /* If the config says explicitly to not use vhost, return now */
     if (net->driver.virtio.name == VIR_DOMAIN_NET_BACKEND_TYPE_QEMU) {
-       return 0;
+        *vhostfdSize = 0;
+        return 0;
     }
 
     /* If qemu doesn't support vhost-net mode (including the -netdev command
@@ -427,6 +477,7 @@ qemuOpenVhostNet(virDomainDefPtr def,
                                    "this QEMU binary"));
             return -1;
         }
+        *vhostfdSize = 0;
         return 0;
     }
 
@@ -438,23 +489,42 @@ qemuOpenVhostNet(virDomainDefPtr def,
                                    "virtio network interfaces"));
             return -1;
         }
+        *vhostfdSize = 0;
         return 0;
     }
 
-    *vhostfd = open("/dev/vhost-net", O_RDWR);
-    virDomainAuditNetDevice(def, net, "/dev/vhost-net", *vhostfd >= 0);
+    for (i = 0; i < *vhostfdSize; i++) {
+        vhostfd[i] = open("/dev/vhost-net", O_RDWR);
+        virDomainAuditNetDevice(def, net, "/dev/vhost-net", vhostfd[i] >= 0);
 
-    /* If the config says explicitly to use vhost and we couldn't open it,
-     * report an error.
-     */
-    if ((*vhostfd < 0) &&
-        (net->driver.virtio.name == VIR_DOMAIN_NET_BACKEND_TYPE_VHOST)) {
-        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
-                       "%s", _("vhost-net was requested for an interface, "
-                               "but is unavailable"));
-        return -1;
+        if (vhostfd[i] < 0) {
+            /* If the config says explicitly to use vhost and we couldn't
+             * open it, report an error.
+             */
+            if (net->driver.virtio.name == VIR_DOMAIN_NET_BACKEND_TYPE_VHOST) {
+                virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                               "%s", _("vhost-net was requested for an interface, "
+                                       "but is unavailable"));
+                goto error;
+            }
+            VIR_WARN("Unable to open vhost-net. Opened so far %d, requested %d",
+                     i, *vhostfdSize);
+            goto fallback;
+        }
     }
     return 0;
+
+fallback:
+    /* Silently fall back to the userspace backend for all queues */
+    while (i--)
+        VIR_FORCE_CLOSE(vhostfd[i]);
+    *vhostfdSize = 0;
+    return 0;
+
+error:
+    while (i--)
+        VIR_FORCE_CLOSE(vhostfd[i]);
+    return -1;
 }
 
 
@@ -3533,6 +3603,21 @@ qemuBuildDriveDevStr(virDomainDefPtr def,
         } else {
             virBufferAddLit(&opt, "virtio-blk-pci");
         }
+        if (disk->iothread) {
+            if (!virQEMUCapsGet(qemuCaps, QEMU_CAPS_OBJECT_IOTHREAD)) {
+                virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                               _("IOThreads not supported for this QEMU"));
+                goto error;
+            }
+            if (disk->iothread > def->iothreads) {
+                virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                               _("Disk iothread '%u' not defined in "
+                                 "iothreads count '%u'"),
+                               disk->iothread, def->iothreads);
+                goto error;
+            }
+            virBufferAsprintf(&opt, ",iothread=iothread%u", disk->iothread);
+        }
         qemuBuildIoEventFdStr(&opt, disk->ioeventfd, qemuCaps);
         if (disk->event_idx &&
             virQEMUCapsGet(qemuCaps, QEMU_CAPS_VIRTIO_BLK_EVENT_IDX)) {
@@ -3994,6 +4079,12 @@ qemuBuildNicDevStr(virDomainNetDefPtr net,
             virBufferAsprintf(&buf, ",event_idx=%s",
                               virDomainVirtioEventIdxTypeToString(net->driver.virtio.event_idx));
         }
+        if (net->driver.virtio.queues > 1) {
+            /* As advised at http://www.linux-kvm.org/page/Multiqueue
+             * use 2N+2 MSI-X vectors, N being the number of queues */
+            virBufferAsprintf(&buf, ",mq=on,vectors=%u",
+                              2 * net->driver.virtio.queues + 2);
+        }
     }
     if (vlan == -1)
         virBufferAsprintf(&buf, ",netdev=host%s", net->info.alias);
@@ -4027,10 +4118,13 @@ qemuBuildHostNetStr(virDomainNetDefPtr net,
                     virQEMUDriverPtr driver,
                     char type_sep,
                     int vlan,
-                    const char *tapfd,
-                    const char *vhostfd)
+                    char **tapfd,
+                    int tapfdSize,
+                    char **vhostfd,
+                    int vhostfdSize)
 {
     bool is_tap = false;
+    int i;
     virBuffer buf = VIR_BUFFER_INITIALIZER;
     enum virDomainNetType netType = virDomainNetGetActualType(net);
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
@@ -4052,7 +4146,19 @@ qemuBuildHostNetStr(virDomainNetDefPtr net,
     case VIR_DOMAIN_NET_TYPE_BRIDGE:
     case VIR_DOMAIN_NET_TYPE_NETWORK:
     case VIR_DOMAIN_NET_TYPE_DIRECT:
-        virBufferAsprintf(&buf, "tap%cfd=%s", type_sep, tapfd);
+        virBufferAsprintf(&buf, "tap%c", type_sep);
+        /* for one tapfd 'fd=' shall be used,
+         * for more than one 'fds=' is the right choice */
+        if (tapfdSize == 1) {
+            virBufferAsprintf(&buf, "fd=%s", tapfd[0]);
+        } else {
+            virBufferAddLit(&buf, "fds=");
+            for (i = 0; i < tapfdSize; i++) {
+                if (i)
+                    virBufferAddChar(&buf, ':');
+                virBufferAdd(&buf, tapfd[i], -1);
+            }
+        }
         type_sep = ',';
         is_tap = true;
         break;
@@ -4068,6 +4174,12 @@ qemuBuildHostNetStr(virDomainNetDefPtr net,
                               net->script);
             type_sep = ',';
         }
+        /* QEMU opens the queues of the TAP device itself */
+        if (net->driver.virtio.queues > 1) {
+            virBufferAsprintf(&buf, "%cqueues=%u", type_sep,
+                              net->driver.virtio.queues);
+            type_sep = ',';
+        }
         is_tap = true;
         break;
 
@@ -4112,8 +4224,19 @@ qemuBuildHostNetStr(virDomainNetDefPtr net,
     }
 
     if (is_tap) {
-        if (vhostfd && *vhostfd)
-            virBufferAsprintf(&buf, ",vhost=on,vhostfd=%s", vhostfd);
+        if (vhostfdSize) {
+            virBufferAddLit(&buf, ",vhost=on,");
+            if (vhostfdSize == 1) {
+                virBufferAsprintf(&buf, "vhostfd=%s", vhostfd[0]);
+            } else {
+                virBufferAddLit(&buf, "vhostfds=");
+                for (i = 0; i < vhostfdSize; i++) {
+                    if (i)
+                        virBufferAddChar(&buf, ':');
+                    virBufferAdd(&buf, vhostfd[i], -1);
+                }
+            }
+        }
         if (net->tune.sndbuf_specified)
             virBufferAsprintf(&buf, ",sndbuf=%lu", net->tune.sndbuf);
     }
@@ -5754,16 +5877,186 @@ qemuBuildSmpArgStr(const virDomainDefPtr def,
     return virBufferContentAndReset(&buf);
 }
 
+/* Look up the directory for memory backing files of hugepages of
+ * @size KiB (0 for the default size), reporting an error if there
+ * is none. */
+static const char *
+qemuBuildHugepagePath(virQEMUDriverConfigPtr cfg,
+                      unsigned long long size)
+{
+    const char *hugepagePath;
+
+    if (!cfg->hugetlbfsMount) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%s", _("hugetlbfs filesystem is not mounted"));
+        return NULL;
+    }
+    if (!cfg->hugepagePath) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%s", _("hugepages are disabled by administrator config"));
+        return NULL;
+    }
+    if (!(hugepagePath = qemuGetHugepagePath(cfg, size))) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("no hugetlbfs mount provides %llu KiB pages"),
+                       size);
+        return NULL;
+    }
+
+    return hugepagePath;
+}
+
+
+/* Return the size of hugepages backing guest NUMA @cell, or of the
+ * whole guest if @cell is -1. 0 means the default hugepage size. */
+static unsigned long long
+qemuGetHugepageSize(virDomainDefPtr def,
+                    int cell)
+{
+    size_t i;
+    unsigned long long size = 0;
+
+    for (i = 0; i < def->mem.nhugepages; i++) {
+        virDomainHugePagePtr hugepage = &def->mem.hugepages[i];
+        bool match = false;
+
+        if (!hugepage->nodeset) {
+            size = hugepage->size;
+            continue;
+        }
+
+        if (cell >= 0 &&
+            virBitmapGetBit(hugepage->nodeset, cell, &match) == 0 &&
+            match)
+            return hugepage->size;
+    }
+
+    return size;
+}
+
+
+/* Guest NUMA cells need a memory backend object of their own once
+ * they are bound to host nodes or backed by a specific page size. */
+static bool
+qemuNumaNeedsMemoryBackends(virDomainDefPtr def)
+{
+    size_t i;
+
+    if (def->numatune.nmem_nodes)
+        return true;
+
+    for (i = 0; i < def->mem.nhugepages; i++) {
+        if (def->mem.hugepages[i].nodeset)
+            return true;
+    }
+
+    return false;
+}
+
+
+static int
+qemuBuildMemoryCellBackendStr(virDomainDefPtr def,
+                              virQEMUDriverConfigPtr cfg,
+                              int cell,
+                              virBufferPtr buf)
+{
+    virNumaTuneNodeDefPtr mem_node = NULL;
+    char *nodeset = NULL;
+    char *p;
+    int ret = -1;
+
+    if (def->mem.hugepage_backed) {
+        const char *hugepagePath;
+
+        if (!(hugepagePath = qemuBuildHugepagePath(cfg,
+                                                   qemuGetHugepageSize(def, cell))))
+            goto cleanup;
+
+        virBufferAsprintf(buf, "memory-backend-file,id=ram-node%d,"
+                          "prealloc=yes,mem-path=%s", cell, hugepagePath);
+    } else {
+        virBufferAsprintf(buf, "memory-backend-ram,id=ram-node%d", cell);
+    }
+
+    virBufferAsprintf(buf, ",size=%uM", def->cpu->cells[cell].mem / 1024);
+
+    if (cell < def->numatune.nmem_nodes)
+        mem_node = &def->numatune.mem_nodes[cell];
+
+    if (mem_node && mem_node->nodeset) {
+        if (!(nodeset = virBitmapFormat(mem_node->nodeset))) {
+            virReportOOMError();
+            goto cleanup;
+        }
+
+        /* QEMU wants one host-nodes property per range */
+        virBufferAddLit(buf, ",host-nodes=");
+        for (p = nodeset; *p; p++) {
+            if (*p == ',')
+                virBufferAddLit(buf, ",host-nodes=");
+            else
+                virBufferAddChar(buf, *p);
+        }
+
+        virBufferAsprintf(buf, ",policy=%s",
+                          qemuNumaPolicyTypeToString(mem_node->mode));
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(nodeset);
+    return ret;
+}
+
+
 static int
-qemuBuildNumaArgStr(const virDomainDefPtr def, virCommandPtr cmd)
+qemuBuildNumaArgStr(const virDomainDefPtr def,
+                    virQEMUDriverConfigPtr cfg,
+                    virQEMUCapsPtr qemuCaps,
+                    virCommandPtr cmd)
 {
     int i;
     virBuffer buf = VIR_BUFFER_INITIALIZER;
     char *cpumask = NULL;
+    bool memdev = qemuNumaNeedsMemoryBackends(def);
     int ret = -1;
 
+    if (memdev) {
+        if (!virQEMUCapsGet(qemuCaps, QEMU_CAPS_OBJECT_MEMORY_RAM)) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                           _("per-node memory binding is not supported "
+                             "with this QEMU"));
+            goto cleanup;
+        }
+
+        if (def->mem.hugepage_backed &&
+            !virQEMUCapsGet(qemuCaps, QEMU_CAPS_OBJECT_MEMORY_FILE)) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                           _("per-node hugepage backing is not supported "
+                             "with this QEMU"));
+            goto cleanup;
+        }
+    }
+
     for (i = 0; i < def->cpu->ncells; i++) {
         VIR_FREE(cpumask);
+        def->cpu->cells[i].mem = VIR_DIV_UP(def->cpu->cells[i].mem,
+                                            1024) * 1024;
+
+        if (memdev) {
+            if (qemuBuildMemoryCellBackendStr(def, cfg, i, &buf) < 0)
+                goto cleanup;
+
+            if (virBufferError(&buf)) {
+                virReportOOMError();
+                goto cleanup;
+            }
+
+            virCommandAddArg(cmd, "-object");
+            virCommandAddArgBuffer(cmd, &buf);
+        }
+
         virCommandAddArg(cmd, "-numa");
         virBufferAsprintf(&buf, "node,nodeid=%d", def->cpu->cells[i].cellid);
         virBufferAddLit(&buf, ",cpus=");
@@ -5783,9 +6076,11 @@ qemuBuildNumaArgStr(const virDomainDefPtr def, virCommandPtr cmd)
             }
             virBufferAdd(&buf, cpumask, -1);
         }
-        def->cpu->cells[i].mem = VIR_DIV_UP(def->cpu->cells[i].mem,
-                                            1024) * 1024;
-        virBufferAsprintf(&buf, ",mem=%d", def->cpu->cells[i].mem / 1024);
+
+        if (memdev)
+            virBufferAsprintf(&buf, ",memdev=ram-node%d", i);
+        else
+            virBufferAsprintf(&buf, ",mem=%d", def->cpu->cells[i].mem / 1024);
 
         if (virBufferError(&buf)) {
             virReportOOMError();
@@ -6188,6 +6483,177 @@ qemuBuildGraphicsCommandLine(virQEMUDriverConfigPtr cfg,
     return 0;
 }
 
+static int
+qemuBuildInterfaceCommandLine(virCommandPtr cmd,
+                              virQEMUDriverPtr driver,
+                              virConnectPtr conn,
+                              virDomainDefPtr def,
+                              virDomainNetDefPtr net,
+                              virQEMUCapsPtr qemuCaps,
+                              int vlan,
+                              int bootindex,
+                              enum virNetDevVPortProfileOp vmop)
+{
+    int ret = -1;
+    char *nic = NULL, *host = NULL;
+    int *tapfd = NULL;
+    int tapfdSize = 0;
+    int *vhostfd = NULL;
+    int vhostfdSize = 0;
+    char **tapfdName = NULL;
+    char **vhostfdName = NULL;
+    int actualType = virDomainNetGetActualType(net);
+    bool connected = false;
+    int i;
+
+    if (actualType == VIR_DOMAIN_NET_TYPE_HOSTDEV) {
+        /* NET_TYPE_HOSTDEV devices are really hostdev devices, so
+         * their commandlines are constructed with other hostdevs.
+         */
+        return 0;
+    }
+
+    if (net->driver.virtio.queues > 1 &&
+        actualType != VIR_DOMAIN_NET_TYPE_NETWORK &&
+        actualType != VIR_DOMAIN_NET_TYPE_BRIDGE &&
+        actualType != VIR_DOMAIN_NET_TYPE_ETHERNET) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("multiqueue network is not supported for: %s"),
+                       virDomainNetTypeToString(actualType));
+        return -1;
+    }
+
+    if (actualType == VIR_DOMAIN_NET_TYPE_NETWORK ||
+        actualType == VIR_DOMAIN_NET_TYPE_BRIDGE) {
+        tapfdSize = net->driver.virtio.queues;
+        if (!tapfdSize)
+            tapfdSize = 1;
+
+        if (VIR_ALLOC_N(tapfd, tapfdSize) < 0 ||
+            VIR_ALLOC_N(tapfdName, tapfdSize) < 0)
+            goto no_memory;
+
+        memset(tapfd, -1, tapfdSize * sizeof(tapfd[0]));
+
+        if (qemuNetworkIfaceConnect(def, conn, driver, net,
+                                    qemuCaps, tapfd, tapfdSize) < 0)
+            goto cleanup;
+        connected = true;
+    } else if (actualType == VIR_DOMAIN_NET_TYPE_DIRECT) {
+        if (VIR_ALLOC(tapfd) < 0 || VIR_ALLOC(tapfdName) < 0)
+            goto no_memory;
+        tapfdSize = 1;
+        tapfd[0] = qemuPhysIfaceConnect(def, driver, net,
+                                        qemuCaps, vmop);
+        if (tapfd[0] < 0)
+            goto cleanup;
+        connected = true;
+    }
+
+    if (actualType == VIR_DOMAIN_NET_TYPE_NETWORK ||
+        actualType == VIR_DOMAIN_NET_TYPE_BRIDGE ||
+        actualType == VIR_DOMAIN_NET_TYPE_ETHERNET ||
+        actualType == VIR_DOMAIN_NET_TYPE_DIRECT) {
+        /* Attempt to use vhost-net mode for these types of
+           network device. A multiqueue ethernet device has its
+           queues opened by QEMU itself, which then can't be
+           given pre-opened vhost-net descriptors either */
+        if (actualType != VIR_DOMAIN_NET_TYPE_ETHERNET ||
+            net->driver.virtio.queues <= 1) {
+            vhostfdSize = net->driver.virtio.queues;
+            if (!vhostfdSize)
+                vhostfdSize = 1;
+
+            if (VIR_ALLOC_N(vhostfd, vhostfdSize) < 0 ||
+                VIR_ALLOC_N(vhostfdName, vhostfdSize) < 0)
+                goto no_memory;
+
+            memset(vhostfd, -1, vhostfdSize * sizeof(vhostfd[0]));
+
+            if (qemuOpenVhostNet(def, net, qemuCaps,
+                                 vhostfd, &vhostfdSize) < 0)
+                goto cleanup;
+        }
+    }
+
+    for (i = 0; i < tapfdSize; i++) {
+        if (virAsprintf(&tapfdName[i], "%d", tapfd[i]) < 0)
+            goto no_memory;
+        virCommandTransferFD(cmd, tapfd[i]);
+        tapfd[i] = -1;
+    }
+
+    for (i = 0; i < vhostfdSize; i++) {
+        if (virAsprintf(&vhostfdName[i], "%d", vhostfd[i]) < 0)
+            goto no_memory;
+        virCommandTransferFD(cmd, vhostfd[i]);
+        vhostfd[i] = -1;
+    }
+
+    /* Possible combinations:
+     *
+     *  1. Old way:   -net nic,model=e1000,vlan=1 -net tap,vlan=1
+     *  2. Semi-new:  -device e1000,vlan=1        -net tap,vlan=1
+     *  3. Best way:  -netdev type=tap,id=netdev1 -device e1000,id=netdev1
+     *
+     * NB, no support for -netdev without use of -device
+     */
+    if (virQEMUCapsGet(qemuCaps, QEMU_CAPS_NETDEV) &&
+        virQEMUCapsGet(qemuCaps, QEMU_CAPS_DEVICE)) {
+        if (!(host = qemuBuildHostNetStr(net, driver,
+                                         ',', vlan,
+                                         tapfdName, tapfdSize,
+                                         vhostfdName, vhostfdSize)))
+            goto cleanup;
+        virCommandAddArgList(cmd, "-netdev", host, NULL);
+    }
+    if (virQEMUCapsGet(qemuCaps, QEMU_CAPS_DEVICE)) {
+        if (!(nic = qemuBuildNicDevStr(net, vlan, bootindex, qemuCaps)))
+            goto cleanup;
+        virCommandAddArgList(cmd, "-device", nic, NULL);
+    } else {
+        if (!(nic = qemuBuildNicStr(net, "nic,", vlan)))
+            goto cleanup;
+        virCommandAddArgList(cmd, "-net", nic, NULL);
+    }
+    if (!(virQEMUCapsGet(qemuCaps, QEMU_CAPS_NETDEV) &&
+          virQEMUCapsGet(qemuCaps, QEMU_CAPS_DEVICE))) {
+        if (!(host = qemuBuildHostNetStr(net, driver,
+                                         ',', vlan,
+                                         tapfdName, tapfdSize,
+                                         vhostfdName, vhostfdSize)))
+            goto cleanup;
+        virCommandAddArgList(cmd, "-net", host, NULL);
+    }
+
+    ret = 0;
+
+cleanup:
+    if (ret < 0 && connected)
+        virDomainConfNWFilterTeardown(net);
+    for (i = 0; tapfd && i < tapfdSize; i++) {
+        VIR_FORCE_CLOSE(tapfd[i]);
+        if (tapfdName)
+            VIR_FREE(tapfdName[i]);
+    }
+    for (i = 0; vhostfd && i < vhostfdSize; i++) {
+        VIR_FORCE_CLOSE(vhostfd[i]);
+        if (vhostfdName)
+            VIR_FREE(vhostfdName[i]);
+    }
+    VIR_FREE(tapfd);
+    VIR_FREE(vhostfd);
+    VIR_FREE(tapfdName);
+    VIR_FREE(vhostfdName);
+    VIR_FREE(nic);
+    VIR_FREE(host);
+    return ret;
+
+no_memory:
+    virReportOOMError();
+    goto cleanup;
+}
+
 /*
  * Constructs a argv suitable for launching qemu with config defined
  * for a given virtual machine.
@@ -6302,17 +6768,15 @@ qemuBuildCommandLine(virConnectPtr conn,
     virCommandAddArg(cmd, "-m");
     def->mem.max_balloon = VIR_DIV_UP(def->mem.max_balloon, 1024) * 1024;
     virCommandAddArgFormat(cmd, "%llu", def->mem.max_balloon / 1024);
-    if (def->mem.hugepage_backed) {
-        if (!cfg->hugetlbfsMount) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           "%s", _("hugetlbfs filesystem is not mounted"));
+    /* With per-node memory backends the hugepages are set up
+     * along with the guest NUMA cells instead */
+    if (def->mem.hugepage_backed &&
+        !(def->cpu && def->cpu->ncells && qemuNumaNeedsMemoryBackends(def))) {
+        const char *hugepagePath;
+
+        if (!(hugepagePath = qemuBuildHugepagePath(cfg,
+                                                   qemuGetHugepageSize(def, -1))))
             goto error;
-        }
-        if (!cfg->hugepagePath) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           "%s", _("hugepages are disabled by administrator config"));
-            goto error;
-        }
         if (!virQEMUCapsGet(qemuCaps, QEMU_CAPS_MEM_PATH)) {
             virReportError(VIR_ERR_INTERNAL_ERROR,
                            _("hugepage backing not supported by '%s'"),
@@ -6320,7 +6784,27 @@ qemuBuildCommandLine(virConnectPtr conn,
             goto error;
         }
         virCommandAddArgList(cmd, "-mem-prealloc", "-mem-path",
-                             cfg->hugepagePath, NULL);
+                             hugepagePath, NULL);
+    }
+
+    if (def->mem.locked) {
+        if (!virQEMUCapsGet(qemuCaps, QEMU_CAPS_MLOCK)) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                           _("memory locking not supported by QEMU binary"));
+            goto error;
+        }
+        virCommandAddArgList(cmd, "-realtime", "mlock=on", NULL);
+
+        /* All of the guest memory will be locked, plus whatever
+         * QEMU needs for itself, which is hard to predict; use the
+         * hard limit if the user gave one, or the same 1GiB of slack
+         * as for VFIO otherwise.
+         */
+        if (def->mem.hard_limit)
+            virCommandSetMaxMemLock(cmd, def->mem.hard_limit * 1024);
+        else
+            virCommandSetMaxMemLock(cmd, (def->mem.max_balloon +
+                                          1024 * 1024) * 1024);
     }
 
     virCommandAddArg(cmd, "-smp");
@@ -6329,8 +6813,22 @@ qemuBuildCommandLine(virConnectPtr conn,
     virCommandAddArg(cmd, smp);
     VIR_FREE(smp);
 
+    if (def->iothreads > 0) {
+        if (!virQEMUCapsGet(qemuCaps, QEMU_CAPS_OBJECT_IOTHREAD)) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                           _("IOThreads not supported for this QEMU"));
+            goto error;
+        }
+
+        /* Create iothread objects using the defined iothreads value */
+        for (i = 1; i <= def->iothreads; i++) {
+            virCommandAddArg(cmd, "-object");
+            virCommandAddArgFormat(cmd, "iothread,id=iothread%d", i);
+        }
+    }
+
     if (def->cpu && def->cpu->ncells)
-        if (qemuBuildNumaArgStr(def, cmd) < 0)
+        if (qemuBuildNumaArgStr(def, cfg, qemuCaps, cmd) < 0)
             goto error;
 
     if (virQEMUCapsGet(qemuCaps, QEMU_CAPS_UUID))
@@ -7101,12 +7599,8 @@ qemuBuildCommandLine(virConnectPtr conn,
 
         for (i = 0 ; i < def->nnets ; i++) {
             virDomainNetDefPtr net = def->nets[i];
-            char *nic, *host;
-            char tapfd_name[50] = "";
-            char vhostfd_name[50] = "";
             int vlan;
             int bootindex = bootNet;
-            int actualType;
 
             bootNet = 0;
             if (!bootindex)
@@ -7126,8 +7620,7 @@ qemuBuildCommandLine(virConnectPtr conn,
             if (networkAllocateActualDevice(net) < 0)
                goto error;
 
-            actualType = virDomainNetGetActualType(net);
-            if (actualType == VIR_DOMAIN_NET_TYPE_HOSTDEV) {
+            if (virDomainNetGetActualType(net) == VIR_DOMAIN_NET_TYPE_HOSTDEV) {
                 if (net->type == VIR_DOMAIN_NET_TYPE_NETWORK) {
                     virDomainHostdevDefPtr hostdev = virDomainNetGetActualHostdev(net);
                     virDomainHostdevDefPtr found;
@@ -7163,96 +7656,13 @@ qemuBuildCommandLine(virConnectPtr conn,
                         goto error;
                     }
                 }
-                continue;
             }
 
-            if (actualType == VIR_DOMAIN_NET_TYPE_NETWORK ||
-                actualType == VIR_DOMAIN_NET_TYPE_BRIDGE) {
-                int tapfd = qemuNetworkIfaceConnect(def, conn, driver, net,
-                                                    qemuCaps);
-                if (tapfd < 0)
-                    goto error;
-
-                last_good_net = i;
-                virCommandTransferFD(cmd, tapfd);
-
-                if (snprintf(tapfd_name, sizeof(tapfd_name), "%d",
-                             tapfd) >= sizeof(tapfd_name))
-                    goto no_memory;
-            } else if (actualType == VIR_DOMAIN_NET_TYPE_DIRECT) {
-                int tapfd = qemuPhysIfaceConnect(def, driver, net,
-                                                 qemuCaps, vmop);
-                if (tapfd < 0)
-                    goto error;
-
-                last_good_net = i;
-                virCommandTransferFD(cmd, tapfd);
-
-                if (snprintf(tapfd_name, sizeof(tapfd_name), "%d",
-                             tapfd) >= sizeof(tapfd_name))
-                    goto no_memory;
-            }
-
-            if (actualType == VIR_DOMAIN_NET_TYPE_NETWORK ||
-                actualType == VIR_DOMAIN_NET_TYPE_BRIDGE ||
-                actualType == VIR_DOMAIN_NET_TYPE_ETHERNET ||
-                actualType == VIR_DOMAIN_NET_TYPE_DIRECT) {
-                /* Attempt to use vhost-net mode for these types of
-                   network device */
-                int vhostfd;
-
-                if (qemuOpenVhostNet(def, net, qemuCaps, &vhostfd) < 0)
-                    goto error;
-                if (vhostfd >= 0) {
-                    virCommandTransferFD(cmd, vhostfd);
-
-                    if (snprintf(vhostfd_name, sizeof(vhostfd_name), "%d",
-                                 vhostfd) >= sizeof(vhostfd_name))
-                        goto no_memory;
-                }
-            }
-            /* Possible combinations:
-             *
-             *  1. Old way:   -net nic,model=e1000,vlan=1 -net tap,vlan=1
-             *  2. Semi-new:  -device e1000,vlan=1        -net tap,vlan=1
-             *  3. Best way:  -netdev type=tap,id=netdev1 -device e1000,id=netdev1
-             *
-             * NB, no support for -netdev without use of -device
-             */
-            if (virQEMUCapsGet(qemuCaps, QEMU_CAPS_NETDEV) &&
-                virQEMUCapsGet(qemuCaps, QEMU_CAPS_DEVICE)) {
-                virCommandAddArg(cmd, "-netdev");
-                if (!(host = qemuBuildHostNetStr(net, driver,
-                                                 ',', vlan, tapfd_name,
-                                                 vhostfd_name)))
-                    goto error;
-                virCommandAddArg(cmd, host);
-                VIR_FREE(host);
-            }
-            if (virQEMUCapsGet(qemuCaps, QEMU_CAPS_DEVICE)) {
-                virCommandAddArg(cmd, "-device");
-                nic = qemuBuildNicDevStr(net, vlan, bootindex, qemuCaps);
-                if (!nic)
-                    goto error;
-                virCommandAddArg(cmd, nic);
-                VIR_FREE(nic);
-            } else {
-                virCommandAddArg(cmd, "-net");
-                if (!(nic = qemuBuildNicStr(net, "nic,", vlan)))
-                    goto error;
-                virCommandAddArg(cmd, nic);
-                VIR_FREE(nic);
-            }
-            if (!(virQEMUCapsGet(qemuCaps, QEMU_CAPS_NETDEV) &&
-                  virQEMUCapsGet(qemuCaps, QEMU_CAPS_DEVICE))) {
-                virCommandAddArg(cmd, "-net");
-                if (!(host = qemuBuildHostNetStr(net, driver,
-                                                 ',', vlan, tapfd_name,
-                                                 vhostfd_name)))
-                    goto error;
-                virCommandAddArg(cmd, host);
-                VIR_FREE(host);
-            }
+            if (qemuBuildInterfaceCommandLine(cmd, driver, conn, def, net,
+                                              qemuCaps, vlan, bootindex,
+                                              vmop) < 0)
+                goto error;
+            last_good_net = i;
         }
     }
 
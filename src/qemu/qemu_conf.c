@@ -265,7 +265,7 @@ error:
 static void virQEMUDriverConfigDispose(void *obj)
 {
     virQEMUDriverConfigPtr cfg = obj;
-
+    size_t i;
 
     virStringFreeList(cfg->cgroupDeviceACL);
 
@@ -291,6 +291,11 @@ static void virQEMUDriverConfigDispose(void *obj)
 
     VIR_FREE(cfg->hugetlbfsMount);
     VIR_FREE(cfg->hugepagePath);
+    for (i = 0; i < cfg->nhugetlbfs; i++) {
+        VIR_FREE(cfg->hugetlbfs[i].mnt_dir);
+        VIR_FREE(cfg->hugetlbfs[i].path);
+    }
+    VIR_FREE(cfg->hugetlbfs);
     VIR_FREE(cfg->bridgeHelperName);
 
     VIR_FREE(cfg->saveImageFormat);
@@ -498,7 +503,39 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
     GET_VALUE_BOOL("auto_dump_bypass_cache", cfg->autoDumpBypassCache);
     GET_VALUE_BOOL("auto_start_bypass_cache", cfg->autoStartBypassCache);
 
-    GET_VALUE_STR("hugetlbfs_mount", cfg->hugetlbfsMount);
+    /* The first mount point listed provides the default hugepage
+     * size, the others are used by guests asking for their page
+     * size explicitly */
+    p = virConfGetValue(conf, "hugetlbfs_mount");
+    if (p && p->type == VIR_CONF_LIST) {
+        size_t len;
+        virConfValuePtr pp;
+
+        for (len = 0, pp = p->list; pp; len++, pp = pp->next) {
+            if (pp->type != VIR_CONF_STRING) {
+                virReportError(VIR_ERR_CONF_SYNTAX, "%s",
+                               _("hugetlbfs_mount must be a list of strings"));
+                goto cleanup;
+            }
+        }
+
+        if (len) {
+            VIR_FREE(cfg->hugetlbfsMount);
+            if (!(cfg->hugetlbfsMount = strdup(p->list->str)))
+                goto no_memory;
+        }
+
+        if (len > 1 && VIR_ALLOC_N(cfg->hugetlbfs, len - 1) < 0)
+            goto no_memory;
+
+        for (pp = p->list->next; pp; pp = pp->next) {
+            if (!(cfg->hugetlbfs[cfg->nhugetlbfs].mnt_dir = strdup(pp->str)))
+                goto no_memory;
+            cfg->nhugetlbfs++;
+        }
+    } else {
+        GET_VALUE_STR("hugetlbfs_mount", cfg->hugetlbfsMount);
+    }
     GET_VALUE_STR("bridge_helper", cfg->bridgeHelperName);
 
     GET_VALUE_BOOL("mac_filter", cfg->macFilter);
@@ -533,6 +570,27 @@ no_memory:
 #undef GET_VALUE_LONG
 #undef GET_VALUE_STRING
 
+/* Return the directory where memory backing files for hugepages
+ * of @size KiB should be created, or the default one if @size is 0.
+ * Returns NULL if no hugetlbfs mount provides that page size. */
+const char *
+qemuGetHugepagePath(virQEMUDriverConfigPtr cfg,
+                    unsigned long long size)
+{
+    size_t i;
+
+    if (!size || size == cfg->hugepageSize)
+        return cfg->hugepagePath;
+
+    for (i = 0; i < cfg->nhugetlbfs; i++) {
+        if (cfg->hugetlbfs[i].path && cfg->hugetlbfs[i].size == size)
+            return cfg->hugetlbfs[i].path;
+    }
+
+    return NULL;
+}
+
+
 virQEMUDriverConfigPtr virQEMUDriverGetConfig(virQEMUDriverPtr driver)
 {
     virQEMUDriverConfigPtr conf;
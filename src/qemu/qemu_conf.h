@@ -55,6 +55,14 @@ typedef virQEMUDriver *virQEMUDriverPtr;
 typedef struct _virQEMUDriverConfig virQEMUDriverConfig;
 typedef virQEMUDriverConfig *virQEMUDriverConfigPtr;
 
+typedef struct _virQEMUHugeTLBFS virQEMUHugeTLBFS;
+typedef virQEMUHugeTLBFS *virQEMUHugeTLBFSPtr;
+struct _virQEMUHugeTLBFS {
+    char *mnt_dir;              /* where the hugetlbfs is mounted */
+    char *path;                 /* $mnt_dir/libvirt/qemu */
+    unsigned long long size;    /* page size in KiB */
+};
+
 /* Main driver config. The data in these object
  * instances is immutable, so can be accessed
  * without locking. Threads must, however, hold
@@ -116,6 +124,10 @@ struct _virQEMUDriverConfig {
 
     char *hugetlbfsMount;
     char *hugepagePath;
+    unsigned long long hugepageSize; /* in KiB, 0 if unknown */
+    /* Further hugetlbfs mounts providing other page sizes */
+    size_t nhugetlbfs;
+    virQEMUHugeTLBFSPtr hugetlbfs;
     char *bridgeHelperName;
 
     bool macFilter;
@@ -210,6 +222,9 @@ struct _virQEMUDriver {
     /* Immutable pointer, self-locking APIs */
     virPortAllocatorPtr remotePorts;
 
+    /* Immutable pointer, self-locking APIs */
+    virNumaPlacementPtr numaPlacement;
+
     /* Immutable pointer, lockless APIs*/
     virSysinfoDefPtr hostsysinfo;
 
@@ -218,6 +233,16 @@ struct _virQEMUDriver {
 
     /* Immutable pointer, self-clocking APIs */
     virQEMUCloseCallbacksPtr closeCallbacks;
+
+    /* Immutable timer ID, -1 when status XML is always written
+     * synchronously. Atomic access only to statusPending, which is
+     * set while the timer is armed */
+    int statusTimer;
+    int statusPending;
+
+    /* Immutable pointer, self-locking APIs. Writes the status XML
+     * when the timer fires, away from the event loop */
+    virThreadPoolPtr statusPool;
 };
 
 typedef struct _qemuDomainCmdlineDef qemuDomainCmdlineDef;
@@ -243,6 +268,9 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
 
 virQEMUDriverConfigPtr virQEMUDriverGetConfig(virQEMUDriverPtr driver);
 
+const char *qemuGetHugepagePath(virQEMUDriverConfigPtr cfg,
+                                unsigned long long size);
+
 virCapsPtr virQEMUDriverCreateCapabilities(virQEMUDriverPtr driver);
 virCapsPtr virQEMUDriverGetCapabilities(virQEMUDriverPtr driver,
                                         bool refresh);
@@ -38,6 +38,7 @@
 #include "virtime.h"
 #include "virstoragefile.h"
 #include "virstring.h"
+#include "viratomic.h"
 
 #include <sys/time.h>
 #include <fcntl.h>
@@ -236,12 +237,15 @@ qemuDomainObjPrivateFree(void *data)
 
     virObjectUnref(priv->qemuCaps);
 
+    qemuDomainFreeVcpuCgroups(priv);
     virCgroupFree(&priv->cgroup);
     qemuDomainPCIAddressSetFree(priv->pciaddrs);
     qemuDomainCCWAddressSetFree(priv->ccwaddrs);
     virDomainChrSourceDefFree(priv->monConfig);
     qemuDomainObjFreeJob(priv);
     VIR_FREE(priv->vcpupids);
+    VIR_FREE(priv->iothreadpids);
+    virBitmapFree(priv->autoNodeset);
     VIR_FREE(priv->lockState);
     VIR_FREE(priv->origname);
 
@@ -297,6 +301,16 @@ qemuDomainObjPrivateXMLFormat(virBufferPtr buf, void *data)
         virBufferAddLit(buf, "  </vcpus>\n");
     }
 
+    if (priv->niothreadpids) {
+        int i;
+        virBufferAddLit(buf, "  <iothreads>\n");
+        for (i = 0 ; i < priv->niothreadpids ; i++) {
+            virBufferAsprintf(buf, "    <iothread pid='%d'/>\n",
+                              priv->iothreadpids[i]);
+        }
+        virBufferAddLit(buf, "  </iothreads>\n");
+    }
+
     if (priv->qemuCaps) {
         int i;
         virBufferAddLit(buf, "  <qemuCaps>\n");
@@ -309,6 +323,17 @@ qemuDomainObjPrivateXMLFormat(virBufferPtr buf, void *data)
         virBufferAddLit(buf, "  </qemuCaps>\n");
     }
 
+    if (priv->autoNodeset) {
+        char *nodeset = virBitmapFormat(priv->autoNodeset);
+
+        if (!nodeset) {
+            virReportOOMError();
+            return -1;
+        }
+        virBufferAsprintf(buf, "  <autonodeset>%s</autonodeset>\n", nodeset);
+        VIR_FREE(nodeset);
+    }
+
     if (priv->lockState)
         virBufferAsprintf(buf, "  <lockstate>%s</lockstate>\n", priv->lockState);
 
@@ -409,6 +434,31 @@ qemuDomainObjPrivateXMLParse(xmlXPathContextPtr ctxt, void *data)
         VIR_FREE(nodes);
     }
 
+    n = virXPathNodeSet("./iothreads/iothread", ctxt, &nodes);
+    if (n < 0)
+        goto error;
+    if (n) {
+        priv->niothreadpids = n;
+        if (VIR_REALLOC_N(priv->iothreadpids, priv->niothreadpids) < 0) {
+            virReportOOMError();
+            goto error;
+        }
+
+        for (i = 0 ; i < n ; i++) {
+            char *pidstr = virXMLPropString(nodes[i], "pid");
+            if (!pidstr)
+                goto error;
+
+            if (virStrToLong_i(pidstr, NULL, 10,
+                               &(priv->iothreadpids[i])) < 0) {
+                VIR_FREE(pidstr);
+                goto error;
+            }
+            VIR_FREE(pidstr);
+        }
+        VIR_FREE(nodes);
+    }
+
     if ((n = virXPathNodeSet("./qemuCaps/flag", ctxt, &nodes)) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        "%s", _("failed to parse qemu capabilities flags"));
@@ -437,6 +487,15 @@ qemuDomainObjPrivateXMLParse(xmlXPathContextPtr ctxt, void *data)
     }
     VIR_FREE(nodes);
 
+    if ((tmp = virXPathString("string(./autonodeset)", ctxt))) {
+        if (virBitmapParse(tmp, 0, &priv->autoNodeset,
+                           VIR_DOMAIN_CPUMASK_LEN) < 0) {
+            VIR_FREE(tmp);
+            goto error;
+        }
+        VIR_FREE(tmp);
+    }
+
     priv->lockState = virXPathString("string(./lockstate)", ctxt);
 
     if ((tmp = virXPathString("string(./job[1]/@type)", ctxt))) {
@@ -483,6 +542,8 @@ qemuDomainObjPrivateXMLParse(xmlXPathContextPtr ctxt, void *data)
 error:
     virDomainChrSourceDefFree(priv->monConfig);
     priv->monConfig = NULL;
+    virBitmapFree(priv->autoNodeset);
+    priv->autoNodeset = NULL;
     VIR_FREE(nodes);
     virObjectUnref(qemuCaps);
     return -1;
@@ -827,17 +888,135 @@ virDomainDefParserConfig virQEMUDriverDomainDefParserConfig = {
 };
 
 
-static void
-qemuDomainObjSaveJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
+/**
+ * qemuDomainSaveStatus:
+ *
+ * Write the status XML of @vm, which must be locked, right away.
+ * This must be used whenever the status has to be on disk before
+ * going further, for instance for job recovery after a crash.
+ */
+int
+qemuDomainSaveStatus(virQEMUDriverPtr driver,
+                     virDomainObjPtr vm)
 {
+    qemuDomainObjPrivatePtr priv = vm->privateData;
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    int ret;
+
+    /* Whatever was pending is written now */
+    priv->statusDirty = false;
+    ret = virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm);
+
+    virObjectUnref(cfg);
+    return ret;
+}
+
+
+/**
+ * qemuDomainSaveStatusLater:
+ *
+ * Mark the status XML of @vm, which must be locked, as needing to be
+ * written, which happens QEMU_DOMAIN_STATUS_FLUSH_DELAY ms later at
+ * most, so that bursts of changes result in a single write. This is
+ * only for changes which can be lost when libvirtd crashes without
+ * any harm. State which reconnecting to qemu does not rebuild, such
+ * as the RTC adjustment, tray and balloon state, PM events or a
+ * pending fake reboot, must use qemuDomainSaveStatus instead.
+ */
+void
+qemuDomainSaveStatusLater(virQEMUDriverPtr driver,
+                          virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+
+    if (driver->statusTimer < 0) {
+        if (qemuDomainSaveStatus(driver, vm) < 0)
+            VIR_WARN("Failed to save status on vm %s", vm->def->name);
+        return;
+    }
+
+    priv->statusDirty = true;
+    if (virAtomicIntCompareExchange(&driver->statusPending, 0, 1))
+        virEventUpdateTimeout(driver->statusTimer,
+                              QEMU_DOMAIN_STATUS_FLUSH_DELAY);
+}
+
+
+static int
+qemuDomainFlushStatusOne(virDomainObjPtr vm,
+                         void *opaque)
+{
+    virQEMUDriverPtr driver = opaque;
+    qemuDomainObjPrivatePtr priv;
+
+    virObjectLock(vm);
+    priv = vm->privateData;
+    if (priv->statusDirty) {
+        if (!virDomainObjIsActive(vm))
+            priv->statusDirty = false;
+        else if (qemuDomainSaveStatus(driver, vm) < 0)
+            VIR_WARN("Failed to save status on vm %s", vm->def->name);
+    }
+    virObjectUnlock(vm);
+
+    return 0;
+}
+
+
+/**
+ * qemuDomainFlushStatus:
+ *
+ * Write the status XML of all domains marked by
+ * qemuDomainSaveStatusLater.
+ */
+void
+qemuDomainFlushStatus(virQEMUDriverPtr driver)
+{
+    /* Changes made from now on arm the timer again */
+    virAtomicIntSet(&driver->statusPending, 0);
+    virDomainObjListForEachLazy(driver->domains,
+                                qemuDomainFlushStatusOne, driver);
+}
+
+
+/**
+ * qemuDomainFlushStatusJob:
+ *
+ * Worker of driver->statusPool, the pending writes are done there
+ * rather than in the event loop, since they have to wait for domain
+ * locks and for the disk.
+ */
+void
+qemuDomainFlushStatusJob(void *jobdata ATTRIBUTE_UNUSED,
+                         void *opaque)
+{
+    virQEMUDriverPtr driver = opaque;
+
+    qemuDomainFlushStatus(driver);
+}
+
+
+void
+qemuDomainFlushStatusTimer(int timer,
+                           void *opaque)
+{
+    virQEMUDriverPtr driver = opaque;
 
+    virEventUpdateTimeout(timer, -1);
+    if (virThreadPoolSendJob(driver->statusPool, 0, NULL) < 0) {
+        VIR_WARN("Failed to queue status writes, trying again later");
+        virEventUpdateTimeout(timer, QEMU_DOMAIN_STATUS_FLUSH_DELAY);
+    }
+}
+
+
+static void
+qemuDomainObjSaveJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
+{
     if (virDomainObjIsActive(obj)) {
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, obj) < 0)
+        if (qemuDomainSaveStatus(driver, obj) < 0)
             VIR_WARN("Failed to save status on vm %s", obj->def->name);
     }
-
-    virObjectUnref(cfg);
 }
 
 void
@@ -1181,7 +1360,12 @@ qemuDomainObjExitMonitorInternal(virQEMUDriverPtr driver,
 
     if (priv->job.active == QEMU_JOB_ASYNC_NESTED) {
         qemuDomainObjResetJob(priv);
-        qemuDomainObjSaveJob(driver, obj);
+        /* Nested jobs are not recorded in the status, and anything the
+         * async job needs on disk is written by its phase changes, so
+         * frequent monitor calls such as migration progress polling
+         * only need to be written eventually */
+        if (virDomainObjIsActive(obj))
+            qemuDomainSaveStatusLater(driver, obj);
         virCondSignal(&priv->job.cond);
 
         virObjectUnref(obj);
@@ -1972,18 +2156,15 @@ qemuDomainSetFakeReboot(virQEMUDriverPtr driver,
                         bool value)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     if (priv->fakeReboot == value)
-        goto cleanup;
+        return;
 
     priv->fakeReboot = value;
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm) < 0)
+    /* Nothing tells us about a pending fake reboot when reconnecting */
+    if (qemuDomainSaveStatus(driver, vm) < 0)
         VIR_WARN("Failed to save status on vm %s", vm->def->name);
-
-cleanup:
-    virObjectUnref(cfg);
 }
 
 int
@@ -2130,34 +2311,165 @@ qemuDomainCleanupRun(virQEMUDriverPtr driver,
     priv->ncleanupCallbacks_max = 0;
 }
 
+/* With FORCE, the current chain of DISK is used as a cache when
+ * determining it again, so only the images which changed are probed,
+ * and REUSED is incremented by the number of those which were not */
+static int
+qemuDomainDetermineDiskChainInternal(virQEMUDriverConfigPtr cfg,
+                                     virDomainDiskDefPtr disk,
+                                     bool force,
+                                     size_t *reused)
+{
+    virStorageFileMetadataPtr cache = NULL;
+
+    if (!disk->src ||
+        disk->type == VIR_DOMAIN_DISK_TYPE_NETWORK ||
+        disk->type == VIR_DOMAIN_DISK_TYPE_VOLUME)
+        return 0;
+
+    if (disk->backingChain) {
+        if (!force)
+            return 0;
+        cache = disk->backingChain;
+        disk->backingChain = NULL;
+    }
+
+    disk->backingChain =
+        virStorageFileGetMetadataCached(disk->src, disk->format,
+                                        cfg->user, cfg->group,
+                                        cfg->allowDiskFormatProbing,
+                                        &cache, reused);
+    if (!disk->backingChain)
+        return -1;
+
+    return 0;
+}
+
 int
 qemuDomainDetermineDiskChain(virQEMUDriverPtr driver,
                              virDomainDiskDefPtr disk,
                              bool force)
 {
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
-    int ret = 0;
+    int ret;
 
-    if (!disk->src ||
-        disk->type == VIR_DOMAIN_DISK_TYPE_NETWORK ||
-        disk->type == VIR_DOMAIN_DISK_TYPE_VOLUME)
-        goto cleanup;
+    ret = qemuDomainDetermineDiskChainInternal(cfg, disk, force, NULL);
 
-    if (disk->backingChain) {
-        if (force) {
-            virStorageFileFreeMetadata(disk->backingChain);
-            disk->backingChain = NULL;
-        } else {
+    virObjectUnref(cfg);
+    return ret;
+}
+
+/**
+ * qemuDomainDetermineDiskChains:
+ *
+ * Determine the backing chains of all disks of @def, which are then
+ * shared by the cgroup, security and lock manager setup. Chains kept
+ * from a previous run are revalidated, reusing what is known about
+ * images which have not changed since.
+ */
+int
+qemuDomainDetermineDiskChains(virQEMUDriverPtr driver,
+                              virDomainDefPtr def)
+{
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    size_t reused = 0;
+    int ret = -1;
+    int i;
+
+    for (i = 0; i < def->ndisks; i++) {
+        if (qemuDomainDetermineDiskChainInternal(cfg, def->disks[i],
+                                                 true, &reused) < 0)
             goto cleanup;
-        }
     }
-    disk->backingChain = virStorageFileGetMetadata(disk->src, disk->format,
-                                                   cfg->user, cfg->group,
-                                                   cfg->allowDiskFormatProbing);
-    if (!disk->backingChain)
-        ret = -1;
+
+    VIR_DEBUG("Saved probing %zu backing chain images of %s",
+              reused, def->name);
+    ret = 0;
 
 cleanup:
     virObjectUnref(cfg);
     return ret;
 }
+
+/**
+ * qemuDomainKeepDiskChains:
+ *
+ * Move the backing chains of the disks of @src, typically the live
+ * definition of a domain being stopped, to the disks of @dst with the
+ * same target and source, so that they serve as a cache for the next
+ * start.
+ */
+void
+qemuDomainKeepDiskChains(virDomainDefPtr src,
+                         virDomainDefPtr dst)
+{
+    int i, j;
+
+    for (i = 0; i < dst->ndisks; i++) {
+        virDomainDiskDefPtr disk = dst->disks[i];
+
+        if (disk->backingChain)
+            continue;
+
+        for (j = 0; j < src->ndisks; j++) {
+            virDomainDiskDefPtr orig = src->disks[j];
+
+            if (STREQ(orig->dst, disk->dst) &&
+                STREQ_NULLABLE(orig->src, disk->src) &&
+                orig->type == disk->type &&
+                orig->format == disk->format) {
+                disk->backingChain = orig->backingChain;
+                orig->backingChain = NULL;
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * qemuDomainGetVcpuCgroup:
+ * @vm: the domain object
+ * @vcpu: id of the vCPU
+ *
+ * Returns the cgroup of @vcpu, looking it up only on first use so
+ * that its stat files stay open across stats queries. The group is
+ * owned by the domain and must not be freed by the caller. Returns
+ * NULL with an error reported on failure.
+ */
+virCgroupPtr
+qemuDomainGetVcpuCgroup(virDomainObjPtr vm,
+                        int vcpu)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    int rc;
+
+    if (vcpu >= priv->nvcpuCgroups &&
+        VIR_EXPAND_N(priv->vcpuCgroups, priv->nvcpuCgroups,
+                     vcpu + 1 - priv->nvcpuCgroups) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    if (!priv->vcpuCgroups[vcpu] &&
+        (rc = virCgroupNewVcpu(priv->cgroup, vcpu, false,
+                               &priv->vcpuCgroups[vcpu])) < 0) {
+        virReportSystemError(-rc,
+                             _("Unable to access cgroup of vcpu %d"),
+                             vcpu);
+        return NULL;
+    }
+
+    return priv->vcpuCgroups[vcpu];
+}
+
+
+void
+qemuDomainFreeVcpuCgroups(qemuDomainObjPrivatePtr priv)
+{
+    size_t i;
+
+    for (i = 0; i < priv->nvcpuCgroups; i++)
+        virCgroupFree(&priv->vcpuCgroups[i]);
+    VIR_FREE(priv->vcpuCgroups);
+    priv->nvcpuCgroups = 0;
+}
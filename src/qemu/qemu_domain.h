@@ -146,6 +146,9 @@ struct _qemuDomainObjPrivate {
     int nvcpupids;
     int *vcpupids;
 
+    int niothreadpids;
+    int *iothreadpids;
+
     qemuDomainPCIAddressSetPtr pciaddrs;
     qemuDomainCCWAddressSetPtr ccwaddrs;
     int persistentAddrs;
@@ -168,6 +171,16 @@ struct _qemuDomainObjPrivate {
     size_t ncleanupCallbacks_max;
 
     virCgroupPtr cgroup;
+    /* vCPU sub-cgroups kept open for stats collection, indexed by
+     * vCPU id, see qemuDomainGetVcpuCgroup */
+    virCgroupPtr *vcpuCgroups;
+    size_t nvcpuCgroups;
+
+    /* Host nodes picked by automatic NUMA placement */
+    virBitmapPtr autoNodeset;
+
+    /* The status XML needs writing, see qemuDomainSaveStatusLater */
+    bool statusDirty;
 };
 
 struct qemuDomainWatchdogEvent
@@ -183,6 +196,17 @@ int qemuDomainAsyncJobPhaseFromString(enum qemuDomainAsyncJob job,
 
 void qemuDomainEventFlush(int timer, void *opaque);
 
+/* How long status XML changes may wait to be written, in ms */
+# define QEMU_DOMAIN_STATUS_FLUSH_DELAY 200
+
+int qemuDomainSaveStatus(virQEMUDriverPtr driver,
+                         virDomainObjPtr vm);
+void qemuDomainSaveStatusLater(virQEMUDriverPtr driver,
+                               virDomainObjPtr vm);
+void qemuDomainFlushStatus(virQEMUDriverPtr driver);
+void qemuDomainFlushStatusJob(void *jobdata, void *opaque);
+void qemuDomainFlushStatusTimer(int timer, void *opaque);
+
 void qemuDomainEventQueue(virQEMUDriverPtr driver,
                           virDomainEventPtr event);
 
@@ -335,6 +359,10 @@ int qemuDomainCheckDiskPresence(virQEMUDriverPtr driver,
 int qemuDomainDetermineDiskChain(virQEMUDriverPtr driver,
                                  virDomainDiskDefPtr disk,
                                  bool force);
+int qemuDomainDetermineDiskChains(virQEMUDriverPtr driver,
+                                  virDomainDefPtr def);
+void qemuDomainKeepDiskChains(virDomainDefPtr src,
+                              virDomainDefPtr dst);
 
 int qemuDomainCleanupAdd(virDomainObjPtr vm,
                          qemuDomainCleanupCallback cb);
@@ -343,6 +371,10 @@ void qemuDomainCleanupRemove(virDomainObjPtr vm,
 void qemuDomainCleanupRun(virQEMUDriverPtr driver,
                           virDomainObjPtr vm);
 
+virCgroupPtr qemuDomainGetVcpuCgroup(virDomainObjPtr vm,
+                                     int vcpu);
+void qemuDomainFreeVcpuCgroups(qemuDomainObjPrivatePtr priv);
+
 extern virDomainXMLPrivateDataCallbacks virQEMUDriverPrivateDataCallbacks;
 extern virDomainXMLNamespace virQEMUDriverDomainXMLNamespace;
 extern virDomainDefParserConfig virQEMUDriverDomainDefParserConfig;
@@ -156,11 +156,13 @@ qemuVMDriverLock(void) {}
 static void
 qemuVMDriverUnlock(void) {}
 
+/* Filters are only applied to running domains, whose config is always
+ * loaded, so there is no point in loading the deferred configs */
 static int
 qemuVMFilterRebuild(virConnectPtr conn ATTRIBUTE_UNUSED,
                     virDomainObjListIterator iter, void *data)
 {
-    return virDomainObjListForEach(qemu_driver->domains, iter, data);
+    return virDomainObjListForEachLazy(qemu_driver->domains, iter, data);
 }
 
 static virNWFilterCallbackDriver qemuCallbackDriver = {
@@ -257,6 +259,17 @@ qemuAutostartDomain(virDomainObjPtr vm,
     virResetLastError();
     if (vm->autostart &&
         !virDomainObjIsActive(vm)) {
+        if (virDomainObjListLoadDef(data->driver->domains, vm) < 0) {
+            err = virGetLastError();
+            VIR_ERROR(_("Failed to load config of VM '%s': %s"),
+                      vm->def->name,
+                      err ? err->message : _("unknown error"));
+            /* Forget it, as if its config had been parsed at startup */
+            virDomainObjListRemoveLocked(data->driver->domains, vm);
+            vm = NULL;
+            goto cleanup;
+        }
+
         if (qemuDomainObjBeginJob(data->driver, vm,
                                   QEMU_JOB_MODIFY) < 0) {
             err = virGetLastError();
@@ -299,7 +312,7 @@ qemuAutostartDomains(virQEMUDriverPtr driver)
     /* Ignoring NULL conn which is mostly harmless here */
     struct qemuAutostartData data = { driver, conn };
 
-    virDomainObjListForEach(driver->domains, qemuAutostartDomain, &data);
+    virDomainObjListForEachLazy(driver->domains, qemuAutostartDomain, &data);
 
     if (conn)
         virConnectClose(conn);
@@ -540,6 +553,60 @@ qemuDomainFindMaxID(virDomainObjPtr vm,
 }
 
 
+/* Create the $MOUNTPOINT/libvirt/qemu directory within the hugetlbfs
+ * mounted at @mnt_dir, since we can't assume the root mount point has
+ * permissions that will let our spawned QEMU instances use it. The
+ * page size of the mount is stored in @size, or 0 if unknown.
+ */
+static int
+qemuStateInitHugepagePath(virQEMUDriverConfigPtr cfg,
+                          const char *mnt_dir,
+                          char **path,
+                          unsigned long long *size)
+{
+    char *membase = NULL;
+    char *mempath = NULL;
+    int ret = -1;
+
+    if (virAsprintf(&membase, "%s/libvirt", mnt_dir) < 0 ||
+        virAsprintf(&mempath, "%s/qemu", membase) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    if (virFileMakePath(mempath) < 0) {
+        virReportSystemError(errno,
+                             _("unable to create hugepage path %s"), mempath);
+        goto cleanup;
+    }
+    if (cfg->privileged) {
+        if (virFileUpdatePerm(membase, 0, S_IXGRP | S_IXOTH) < 0)
+            goto cleanup;
+        if (chown(mempath, cfg->user, cfg->group) < 0) {
+            virReportSystemError(errno,
+                                 _("unable to set ownership on %s to %d:%d"),
+                                 mempath, cfg->user,
+                                 cfg->group);
+            goto cleanup;
+        }
+    }
+
+    if (virFileGetHugepageSize(mnt_dir, size) < 0) {
+        VIR_WARN("Unable to get hugepage size of %s", mnt_dir);
+        *size = 0;
+    }
+
+    *path = mempath;
+    mempath = NULL;
+    ret = 0;
+
+cleanup:
+    VIR_FREE(membase);
+    VIR_FREE(mempath);
+    return ret;
+}
+
+
 /**
  * qemuStateInitialize:
  *
@@ -553,8 +620,8 @@ qemuStateInitialize(bool privileged,
     char *driverConf = NULL;
     virConnectPtr conn = NULL;
     char ebuf[1024];
-    char *membase = NULL;
-    char *mempath = NULL;
+    char *domainIndex = NULL;
+    size_t i;
     virQEMUDriverConfigPtr cfg;
     uid_t run_uid = -1;
     gid_t run_gid = -1;
@@ -562,6 +629,8 @@ qemuStateInitialize(bool privileged,
     if (VIR_ALLOC(qemu_driver) < 0)
         return -1;
 
+    qemu_driver->statusTimer = -1;
+
     if (virMutexInit(&qemu_driver->lock) < 0) {
         VIR_ERROR(_("cannot initialize mutex"));
         VIR_FREE(qemu_driver);
@@ -577,6 +646,17 @@ qemuStateInitialize(bool privileged,
     if (!(qemu_driver->domains = virDomainObjListNew()))
         goto error;
 
+    /* Batch status XML writes, unless there is no event loop to
+     * schedule them from, in which case they are all synchronous */
+    qemu_driver->statusPool = virThreadPoolNew(0, 1, 0,
+                                               qemuDomainFlushStatusJob,
+                                               qemu_driver);
+    if (!qemu_driver->statusPool)
+        goto error;
+    qemu_driver->statusTimer = virEventAddTimeout(-1,
+                                                  qemuDomainFlushStatusTimer,
+                                                  qemu_driver, NULL);
+
     /* Init domain events */
     qemu_driver->domainEventState = virDomainEventStateNew();
     if (!qemu_driver->domainEventState)
@@ -663,6 +743,9 @@ qemuStateInitialize(bool privileged,
                              cfg->remotePortMax)) == NULL)
         goto error;
 
+    if (!(qemu_driver->numaPlacement = virNumaPlacementNew()))
+        goto error;
+
     if (qemuSecurityInit(qemu_driver) < 0)
         goto error;
 
@@ -720,38 +803,24 @@ qemuStateInitialize(bool privileged,
         goto error;
 
     /* If hugetlbfs is present, then we need to create a sub-directory within
-     * it, since we can't assume the root mount point has permissions that
-     * will let our spawned QEMU instances use it.
+     * it for our spawned QEMU instances.
      *
      * NB the check for '/', since user may config "" to disable hugepages
      * even when mounted
      */
     if (cfg->hugetlbfsMount &&
         cfg->hugetlbfsMount[0] == '/') {
-        if (virAsprintf(&membase, "%s/libvirt",
-                        cfg->hugetlbfsMount) < 0 ||
-            virAsprintf(&mempath, "%s/qemu", membase) < 0)
-            goto out_of_memory;
-
-        if (virFileMakePath(mempath) < 0) {
-            virReportSystemError(errno,
-                                 _("unable to create hugepage path %s"), mempath);
+        if (qemuStateInitHugepagePath(cfg, cfg->hugetlbfsMount,
+                                      &cfg->hugepagePath,
+                                      &cfg->hugepageSize) < 0)
             goto error;
-        }
-        if (cfg->privileged) {
-            if (virFileUpdatePerm(membase, 0, S_IXGRP | S_IXOTH) < 0)
-                goto error;
-            if (chown(mempath, cfg->user, cfg->group) < 0) {
-                virReportSystemError(errno,
-                                     _("unable to set ownership on %s to %d:%d"),
-                                     mempath, cfg->user,
-                                     cfg->group);
+
+        for (i = 0; i < cfg->nhugetlbfs; i++) {
+            if (qemuStateInitHugepagePath(cfg, cfg->hugetlbfs[i].mnt_dir,
+                                          &cfg->hugetlbfs[i].path,
+                                          &cfg->hugetlbfs[i].size) < 0)
                 goto error;
-            }
         }
-        VIR_FREE(membase);
-
-        cfg->hugepagePath = mempath;
     }
 
     if (!(qemu_driver->closeCallbacks = virQEMUCloseCallbacksNew()))
@@ -782,24 +851,28 @@ qemuStateInitialize(bool privileged,
 
     qemuProcessReconnectAll(conn, qemu_driver);
 
-    /* Then inactive persistent configs */
-    if (virDomainObjListLoadAllConfigs(qemu_driver->domains,
-                                       cfg->configDir,
-                                       cfg->autostartDir, 0,
-                                       qemu_driver->caps,
-                                       qemu_driver->xmlopt,
-                                       QEMU_EXPECTED_VIRT_TYPES,
-                                       NULL, NULL) < 0)
+    /* Then inactive persistent configs, only parsing those which
+     * changed since the last start until they are needed */
+    if (virAsprintf(&domainIndex, "%s/domains.index", cfg->cacheDir) < 0)
+        goto out_of_memory;
+    if (virDomainObjListLoadAllConfigsCached(qemu_driver->domains,
+                                             cfg->configDir,
+                                             cfg->autostartDir,
+                                             domainIndex,
+                                             qemu_driver->caps,
+                                             qemu_driver->xmlopt,
+                                             QEMU_EXPECTED_VIRT_TYPES,
+                                             NULL, NULL) < 0)
         goto error;
 
 
-    virDomainObjListForEach(qemu_driver->domains,
-                            qemuDomainSnapshotLoad,
-                            cfg->snapshotDir);
+    virDomainObjListForEachLazy(qemu_driver->domains,
+                                qemuDomainSnapshotLoad,
+                                cfg->snapshotDir);
 
-    virDomainObjListForEach(qemu_driver->domains,
-                            qemuDomainManagedSaveLoad,
-                            qemu_driver);
+    virDomainObjListForEachLazy(qemu_driver->domains,
+                                qemuDomainManagedSaveLoad,
+                                qemu_driver);
 
     qemu_driver->workerPool = virThreadPoolNew(0, 1, 0, processWatchdogEvent, qemu_driver);
     if (!qemu_driver->workerPool)
@@ -811,6 +884,7 @@ qemuStateInitialize(bool privileged,
         virConnectClose(conn);
 
     virNWFilterRegisterCallbackDriver(&qemuCallbackDriver);
+    VIR_FREE(domainIndex);
     return 0;
 
 out_of_memory:
@@ -818,9 +892,8 @@ out_of_memory:
 error:
     if (conn)
         virConnectClose(conn);
+    VIR_FREE(domainIndex);
     VIR_FREE(driverConf);
-    VIR_FREE(membase);
-    VIR_FREE(mempath);
     qemuStateCleanup();
     return -1;
 }
@@ -849,6 +922,7 @@ static int
 qemuStateReload(void) {
     virQEMUDriverConfigPtr cfg = NULL;
     virCapsPtr caps = NULL;
+    char *domainIndex = NULL;
 
     if (!qemu_driver)
         return 0;
@@ -857,13 +931,19 @@ qemuStateReload(void) {
         goto cleanup;
 
     cfg = virQEMUDriverGetConfig(qemu_driver);
-    virDomainObjListLoadAllConfigs(qemu_driver->domains,
-                                   cfg->configDir,
-                                   cfg->autostartDir, 0,
-                                   caps, qemu_driver->xmlopt,
-                                   QEMU_EXPECTED_VIRT_TYPES,
-                                   qemuNotifyLoadDomain, qemu_driver);
+    if (virAsprintf(&domainIndex, "%s/domains.index", cfg->cacheDir) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+    virDomainObjListLoadAllConfigsCached(qemu_driver->domains,
+                                         cfg->configDir,
+                                         cfg->autostartDir,
+                                         domainIndex,
+                                         caps, qemu_driver->xmlopt,
+                                         QEMU_EXPECTED_VIRT_TYPES,
+                                         qemuNotifyLoadDomain, qemu_driver);
 cleanup:
+    VIR_FREE(domainIndex);
     virObjectUnref(cfg);
     virObjectUnref(caps);
     return 0;
@@ -942,6 +1022,18 @@ qemuStateCleanup(void) {
         return -1;
 
     virNWFilterUnRegisterCallbackDriver(&qemuCallbackDriver);
+
+    /* Write whatever status changes are still pending, once a
+     * flush which might be running is done */
+    if (qemu_driver->statusTimer >= 0) {
+        virEventRemoveTimeout(qemu_driver->statusTimer);
+        qemu_driver->statusTimer = -1;
+    }
+    virThreadPoolFree(qemu_driver->statusPool);
+    qemu_driver->statusPool = NULL;
+    if (qemu_driver->domains && qemu_driver->config)
+        qemuDomainFlushStatus(qemu_driver);
+
     virObjectUnref(qemu_driver->config);
     virObjectUnref(qemu_driver->activePciHostdevs);
     virObjectUnref(qemu_driver->inactivePciHostdevs);
@@ -952,6 +1044,7 @@ qemuStateCleanup(void) {
 
     virObjectUnref(qemu_driver->domains);
     virObjectUnref(qemu_driver->remotePorts);
+    virObjectUnref(qemu_driver->numaPlacement);
 
     virObjectUnref(qemu_driver->xmlopt);
 
@@ -3556,6 +3649,9 @@ static int qemuDomainHotplugVcpus(virQEMUDriverPtr driver,
         goto cleanup;
     }
 
+    /* vCPU cgroups are created or removed below */
+    qemuDomainFreeVcpuCgroups(priv);
+
     if (nvcpus > oldvcpus) {
         for (i = oldvcpus; i < nvcpus; i++) {
             if (priv->cgroup) {
@@ -14094,41 +14190,39 @@ qemuDomainGetTotalcpuStats(virDomainObjPtr vm,
                            virTypedParameterPtr params,
                            int nparams)
 {
-    unsigned long long cpu_time;
+    virCgroupStats stats;
+    unsigned int flags = VIR_CGROUP_STATS_CPU;
     int ret;
     qemuDomainObjPrivatePtr priv = vm->privateData;
 
     if (nparams == 0) /* return supported number of params */
         return QEMU_NB_TOTAL_CPU_STAT_PARAM;
-    /* entry 0 is cputime */
-    ret = virCgroupGetCpuacctUsage(priv->cgroup, &cpu_time);
+
+    if (nparams > 1)
+        flags |= VIR_CGROUP_STATS_CPU_TIMES;
+
+    ret = virCgroupGetStats(priv->cgroup, flags, &stats);
     if (ret < 0) {
         virReportSystemError(-ret, "%s", _("unable to get cpu account"));
         return -1;
     }
 
+    /* entry 0 is cputime */
     if (virTypedParameterAssign(&params[0], VIR_DOMAIN_CPU_STATS_CPUTIME,
-                                VIR_TYPED_PARAM_ULLONG, cpu_time) < 0)
+                                VIR_TYPED_PARAM_ULLONG, stats.cpuTime) < 0)
         return -1;
 
     if (nparams > 1) {
-        unsigned long long user;
-        unsigned long long sys;
-
-        ret = virCgroupGetCpuacctStat(priv->cgroup, &user, &sys);
-        if (ret < 0) {
-            virReportSystemError(-ret, "%s", _("unable to get cpu account"));
-            return -1;
-        }
-
         if (virTypedParameterAssign(&params[1],
                                     VIR_DOMAIN_CPU_STATS_USERTIME,
-                                    VIR_TYPED_PARAM_ULLONG, user) < 0)
+                                    VIR_TYPED_PARAM_ULLONG,
+                                    stats.userTime) < 0)
             return -1;
         if (nparams > 2 &&
             virTypedParameterAssign(&params[2],
                                     VIR_DOMAIN_CPU_STATS_SYSTEMTIME,
-                                    VIR_TYPED_PARAM_ULLONG, sys) < 0)
+                                    VIR_TYPED_PARAM_ULLONG,
+                                    stats.sysTime) < 0)
             return -1;
 
         if (nparams > QEMU_NB_TOTAL_CPU_STAT_PARAM)
@@ -14159,42 +14253,39 @@ getSumVcpuPercpuStats(virDomainObjPtr vm,
 {
     int ret = -1;
     int i;
-    char *buf = NULL;
     qemuDomainObjPrivatePtr priv = vm->privateData;
-    virCgroupPtr group_vcpu = NULL;
+    virCgroupPtr group_vcpu;
+    virCgroupStats stats = { 0 };
 
     for (i = 0; i < priv->nvcpupids; i++) {
-        char *pos;
-        unsigned long long tmp;
         int j;
+        int rc;
 
-        if (virCgroupNewVcpu(priv->cgroup, i, false, &group_vcpu) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("error accessing cgroup cpuacct for vcpu"));
+        if (!(group_vcpu = qemuDomainGetVcpuCgroup(vm, i)))
             goto cleanup;
-        }
 
-        if (virCgroupGetCpuacctPercpuUsage(group_vcpu, &buf) < 0)
+        if ((rc = virCgroupGetStats(group_vcpu, VIR_CGROUP_STATS_PERCPU,
+                                    &stats)) < 0) {
+            virReportSystemError(-rc, "%s",
+                                 _("unable to get cpu account of vcpu"));
             goto cleanup;
+        }
 
-        pos = buf;
-        for (j = 0; j < num; j++) {
-            if (virStrToLong_ull(pos, &pos, 10, &tmp) < 0) {
-                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                               _("cpuacct parse error"));
-                goto cleanup;
-            }
-            sum_cpu_time[j] += tmp;
+        if (stats.npercpuTime < num) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("cpuacct parse error"));
+            goto cleanup;
         }
 
-        virCgroupFree(&group_vcpu);
-        VIR_FREE(buf);
+        for (j = 0; j < num; j++)
+            sum_cpu_time[j] += stats.percpuTime[j];
+
+        virCgroupStatsClear(&stats);
     }
 
     ret = 0;
 cleanup:
-    virCgroupFree(&group_vcpu);
-    VIR_FREE(buf);
+    virCgroupStatsClear(&stats);
     return ret;
 }
 
@@ -14206,9 +14297,9 @@ qemuDomainGetPercpuStats(virDomainObjPtr vm,
                          unsigned int ncpus)
 {
     int rv = -1;
+    int rc;
     int i, id, max_id;
-    char *pos;
-    char *buf = NULL;
+    virCgroupStats stats = { 0 };
     unsigned long long *sum_cpu_time = NULL;
     unsigned long long *sum_cpu_pos;
     unsigned int n = 0;
@@ -14239,9 +14330,11 @@ qemuDomainGetPercpuStats(virDomainObjPtr vm,
     }
 
     /* we get percpu cputime accounting info. */
-    if (virCgroupGetCpuacctPercpuUsage(priv->cgroup, &buf))
+    if ((rc = virCgroupGetStats(priv->cgroup, VIR_CGROUP_STATS_PERCPU,
+                                &stats)) < 0) {
+        virReportSystemError(-rc, "%s", _("unable to get cpu account"));
         goto cleanup;
-    pos = buf;
+    }
     memset(params, 0, nparams * ncpus);
 
     /* return percpu cputime in index 0 */
@@ -14254,13 +14347,13 @@ qemuDomainGetPercpuStats(virDomainObjPtr vm,
         id = start_cpu + ncpus - 1;
 
     for (i = 0; i <= id; i++) {
-        if (virStrToLong_ull(pos, &pos, 10, &cpu_time) < 0) {
+        if (i >= stats.npercpuTime) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("cpuacct parse error"));
             goto cleanup;
-        } else {
-            n++;
         }
+        cpu_time = stats.percpuTime[i];
+        n++;
         if (i < start_cpu)
             continue;
         ent = &params[(i - start_cpu) * nparams + param_idx];
@@ -14298,7 +14391,7 @@ qemuDomainGetPercpuStats(virDomainObjPtr vm,
     rv = param_idx + 1;
 cleanup:
     VIR_FREE(sum_cpu_time);
-    VIR_FREE(buf);
+    virCgroupStatsClear(&stats);
     return rv;
 }
 
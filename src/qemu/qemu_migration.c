@@ -2158,7 +2158,7 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
     qemuMigrationJobSetPhase(driver, vm, QEMU_MIGRATION_PHASE_PREPARE);
 
     /* Domain starts inactive, even if the domain XML had an id field. */
-    vm->def->id = -1;
+    virDomainObjListSetID(driver->domains, vm, -1);
 
     if (flags & VIR_MIGRATE_OFFLINE)
         goto done;
@@ -1264,6 +1264,114 @@ int qemuMonitorJSONGetCPUInfo(qemuMonitorPtr mon,
 }
 
 
+/*
+ * Example return data
+ *
+ * {"return": [{"thread-id": 31980, "id": "iothread1"},
+ *             {"thread-id": 31981, "id": "iothread2"}]}
+ *
+ * The thread ids are returned ordered by the number of their
+ * "iothreadN" alias, i.e. (*pids)[N - 1] is the thread of iothreadN.
+ */
+static int
+qemuMonitorJSONExtractIOThreads(virJSONValuePtr reply,
+                                int **pids)
+{
+    virJSONValuePtr data;
+    int ret = -1;
+    int i;
+    int *threads = NULL;
+    int n;
+
+    if (!(data = virJSONValueObjectGet(reply, "return"))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("query-iothreads reply was missing return data"));
+        goto cleanup;
+    }
+
+    if (data->type != VIR_JSON_TYPE_ARRAY) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("query-iothreads reply data was not an array"));
+        goto cleanup;
+    }
+
+    if ((n = virJSONValueArraySize(data)) < 0)
+        goto cleanup;
+
+    if (n && VIR_ALLOC_N(threads, n) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    for (i = 0 ; i < n ; i++) {
+        virJSONValuePtr entry = virJSONValueArrayGet(data, i);
+        const char *id;
+        unsigned int num;
+        int thread;
+
+        if (!entry) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("query-iothreads reply data was missing array element"));
+            goto cleanup;
+        }
+
+        if (!(id = virJSONValueObjectGetString(entry, "id")) ||
+            !STRPREFIX(id, "iothread") ||
+            virStrToLong_ui(id + strlen("iothread"), NULL, 10, &num) < 0 ||
+            num == 0 || num > (unsigned int) n) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("unexpected iothread id '%s' in query-iothreads reply"),
+                           NULLSTR(id));
+            goto cleanup;
+        }
+
+        if (virJSONValueObjectGetNumberInt(entry, "thread-id", &thread) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("query-iothreads reply has malformed "
+                             "'thread-id' data"));
+            goto cleanup;
+        }
+
+        threads[num - 1] = thread;
+    }
+
+    *pids = threads;
+    threads = NULL;
+    ret = n;
+
+cleanup:
+    VIR_FREE(threads);
+    return ret;
+}
+
+
+int qemuMonitorJSONGetIOThreads(qemuMonitorPtr mon,
+                                int **pids)
+{
+    int ret;
+    virJSONValuePtr cmd = qemuMonitorJSONMakeCommand("query-iothreads",
+                                                     NULL);
+    virJSONValuePtr reply = NULL;
+
+    *pids = NULL;
+
+    if (!cmd)
+        return -1;
+
+    ret = qemuMonitorJSONCommand(mon, cmd, &reply);
+
+    if (ret == 0)
+        ret = qemuMonitorJSONCheckError(cmd, reply);
+
+    if (ret == 0)
+        ret = qemuMonitorJSONExtractIOThreads(reply, pids);
+
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+
 int qemuMonitorJSONGetVirtType(qemuMonitorPtr mon,
                                int *virtType)
 {
@@ -88,6 +88,9 @@ qemuProcessRemoveDomainStatus(virQEMUDriverPtr driver,
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     int ret = -1;
 
+    /* Don't let a pending write bring the file back */
+    priv->statusDirty = false;
+
     if (virAsprintf(&file, "%s/%s.xml", cfg->stateDir, vm->def->name) < 0) {
         virReportOOMError();
         goto cleanup;
@@ -634,7 +637,6 @@ qemuProcessHandleShutdown(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virQEMUDriverPtr driver = qemu_driver;
     qemuDomainObjPrivatePtr priv;
     virDomainEventPtr event = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     VIR_DEBUG("vm=%p", vm);
 
@@ -661,7 +663,7 @@ qemuProcessHandleShutdown(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                                      VIR_DOMAIN_EVENT_SHUTDOWN,
                                      VIR_DOMAIN_EVENT_SHUTDOWN_FINISHED);
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm) < 0) {
+    if (qemuDomainSaveStatus(driver, vm) < 0) {
         VIR_WARN("Unable to save status on vm %s after state change",
                  vm->def->name);
     }
@@ -675,7 +677,6 @@ unlock:
     virObjectUnlock(vm);
     if (event)
         qemuDomainEventQueue(driver, event);
-    virObjectUnref(cfg);
 
     return 0;
 }
@@ -687,7 +688,6 @@ qemuProcessHandleStop(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
 {
     virQEMUDriverPtr driver = qemu_driver;
     virDomainEventPtr event = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     if (virDomainObjGetState(vm, NULL) == VIR_DOMAIN_RUNNING) {
@@ -711,7 +711,7 @@ qemuProcessHandleStop(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
             VIR_WARN("Unable to release lease on %s", vm->def->name);
         VIR_DEBUG("Preserving lock state '%s'", NULLSTR(priv->lockState));
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm) < 0) {
+        if (qemuDomainSaveStatus(driver, vm) < 0) {
             VIR_WARN("Unable to save status on vm %s after state change",
                      vm->def->name);
         }
@@ -721,7 +721,6 @@ unlock:
     virObjectUnlock(vm);
     if (event)
         qemuDomainEventQueue(driver, event);
-    virObjectUnref(cfg);
 
     return 0;
 }
@@ -764,7 +763,7 @@ qemuProcessHandleResume(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
         }
         VIR_FREE(priv->lockState);
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm) < 0) {
+        if (qemuDomainSaveStatus(driver, vm) < 0) {
             VIR_WARN("Unable to save status on vm %s after state change",
                      vm->def->name);
         }
@@ -786,7 +785,6 @@ qemuProcessHandleRTCChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
 {
     virQEMUDriverPtr driver = qemu_driver;
     virDomainEventPtr event = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     event = virDomainEventRTCChangeNewFromObj(vm, offset);
@@ -794,14 +792,13 @@ qemuProcessHandleRTCChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     if (vm->def->clock.offset == VIR_DOMAIN_CLOCK_OFFSET_VARIABLE)
         vm->def->clock.data.variable.adjustment = offset;
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm) < 0)
+    if (qemuDomainSaveStatus(driver, vm) < 0)
         VIR_WARN("unable to save domain status with RTC change");
 
     virObjectUnlock(vm);
 
     if (event)
         qemuDomainEventQueue(driver, event);
-    virObjectUnref(cfg);
     return 0;
 }
 
@@ -814,7 +811,6 @@ qemuProcessHandleWatchdog(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virQEMUDriverPtr driver = qemu_driver;
     virDomainEventPtr watchdogEvent = NULL;
     virDomainEventPtr lifecycleEvent = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     watchdogEvent = virDomainEventWatchdogNewFromObj(vm, action);
@@ -834,7 +830,7 @@ qemuProcessHandleWatchdog(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
             VIR_WARN("Unable to release lease on %s", vm->def->name);
         VIR_DEBUG("Preserving lock state '%s'", NULLSTR(priv->lockState));
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm) < 0) {
+        if (qemuDomainSaveStatus(driver, vm) < 0) {
             VIR_WARN("Unable to save status on vm %s after watchdog event",
                      vm->def->name);
         }
@@ -866,7 +862,6 @@ qemuProcessHandleWatchdog(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     if (lifecycleEvent)
         qemuDomainEventQueue(driver, lifecycleEvent);
 
-    virObjectUnref(cfg);
     return 0;
 }
 
@@ -885,7 +880,6 @@ qemuProcessHandleIOError(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     const char *srcPath;
     const char *devAlias;
     virDomainDiskDefPtr disk;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     disk = qemuProcessFindDomainDiskByAlias(vm, diskAlias);
@@ -916,7 +910,7 @@ qemuProcessHandleIOError(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
             VIR_WARN("Unable to release lease on %s", vm->def->name);
         VIR_DEBUG("Preserving lock state '%s'", NULLSTR(priv->lockState));
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm) < 0)
+        if (qemuDomainSaveStatus(driver, vm) < 0)
             VIR_WARN("Unable to save status on vm %s after IO error", vm->def->name);
     }
     virObjectUnlock(vm);
@@ -927,7 +921,6 @@ qemuProcessHandleIOError(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
         qemuDomainEventQueue(driver, ioErrorEvent2);
     if (lifecycleEvent)
         qemuDomainEventQueue(driver, lifecycleEvent);
-    virObjectUnref(cfg);
     return 0;
 }
 
@@ -1079,7 +1072,6 @@ qemuProcessHandleTrayChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virQEMUDriverPtr driver = qemu_driver;
     virDomainEventPtr event = NULL;
     virDomainDiskDefPtr disk;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     disk = qemuProcessFindDomainDiskByAlias(vm, devAlias);
@@ -1094,7 +1086,7 @@ qemuProcessHandleTrayChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
         else if (reason == VIR_DOMAIN_EVENT_TRAY_CHANGE_CLOSE)
             disk->tray_status = VIR_DOMAIN_DISK_TRAY_CLOSED;
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm) < 0) {
+        if (qemuDomainSaveStatus(driver, vm) < 0) {
             VIR_WARN("Unable to save status on vm %s after tray moved event",
                      vm->def->name);
         }
@@ -1103,7 +1095,6 @@ qemuProcessHandleTrayChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virObjectUnlock(vm);
     if (event)
         qemuDomainEventQueue(driver, event);
-    virObjectUnref(cfg);
     return 0;
 }
 
@@ -1114,7 +1105,6 @@ qemuProcessHandlePMWakeup(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virQEMUDriverPtr driver = qemu_driver;
     virDomainEventPtr event = NULL;
     virDomainEventPtr lifecycleEvent = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     event = virDomainEventPMWakeupNewFromObj(vm);
@@ -1132,7 +1122,7 @@ qemuProcessHandlePMWakeup(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                                                   VIR_DOMAIN_EVENT_STARTED,
                                                   VIR_DOMAIN_EVENT_STARTED_WAKEUP);
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm) < 0) {
+        if (qemuDomainSaveStatus(driver, vm) < 0) {
             VIR_WARN("Unable to save status on vm %s after wakeup event",
                      vm->def->name);
         }
@@ -1143,7 +1133,6 @@ qemuProcessHandlePMWakeup(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
         qemuDomainEventQueue(driver, event);
     if (lifecycleEvent)
         qemuDomainEventQueue(driver, lifecycleEvent);
-    virObjectUnref(cfg);
     return 0;
 }
 
@@ -1154,7 +1143,6 @@ qemuProcessHandlePMSuspend(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virQEMUDriverPtr driver = qemu_driver;
     virDomainEventPtr event = NULL;
     virDomainEventPtr lifecycleEvent = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     event = virDomainEventPMSuspendNewFromObj(vm);
@@ -1171,7 +1159,7 @@ qemuProcessHandlePMSuspend(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                                      VIR_DOMAIN_EVENT_PMSUSPENDED,
                                      VIR_DOMAIN_EVENT_PMSUSPENDED_MEMORY);
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm) < 0) {
+        if (qemuDomainSaveStatus(driver, vm) < 0) {
             VIR_WARN("Unable to save status on vm %s after suspend event",
                      vm->def->name);
         }
@@ -1186,7 +1174,6 @@ qemuProcessHandlePMSuspend(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
         qemuDomainEventQueue(driver, event);
     if (lifecycleEvent)
         qemuDomainEventQueue(driver, lifecycleEvent);
-    virObjectUnref(cfg);
     return 0;
 }
 
@@ -1197,7 +1184,6 @@ qemuProcessHandleBalloonChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
 {
     virQEMUDriverPtr driver = qemu_driver;
     virDomainEventPtr event = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     event = virDomainEventBalloonChangeNewFromObj(vm, actual);
@@ -1206,14 +1192,13 @@ qemuProcessHandleBalloonChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
               vm->def->mem.cur_balloon, actual);
     vm->def->mem.cur_balloon = actual;
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm) < 0)
+    if (qemuDomainSaveStatus(driver, vm) < 0)
         VIR_WARN("unable to save domain status with balloon change");
 
     virObjectUnlock(vm);
 
     if (event)
         qemuDomainEventQueue(driver, event);
-    virObjectUnref(cfg);
     return 0;
 }
 
@@ -1224,7 +1209,6 @@ qemuProcessHandlePMSuspendDisk(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virQEMUDriverPtr driver = qemu_driver;
     virDomainEventPtr event = NULL;
     virDomainEventPtr lifecycleEvent = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     event = virDomainEventPMSuspendDiskNewFromObj(vm);
@@ -1241,7 +1225,7 @@ qemuProcessHandlePMSuspendDisk(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                                      VIR_DOMAIN_EVENT_PMSUSPENDED,
                                      VIR_DOMAIN_EVENT_PMSUSPENDED_DISK);
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm) < 0) {
+        if (qemuDomainSaveStatus(driver, vm) < 0) {
             VIR_WARN("Unable to save status on vm %s after suspend event",
                      vm->def->name);
         }
@@ -1256,7 +1240,6 @@ qemuProcessHandlePMSuspendDisk(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
         qemuDomainEventQueue(driver, event);
     if (lifecycleEvent)
         qemuDomainEventQueue(driver, lifecycleEvent);
-    virObjectUnref(cfg);
 
     return 0;
 }
@@ -1791,6 +1774,40 @@ qemuProcessDetectVcpuPIDs(virQEMUDriverPtr driver,
 }
 
 
+static int
+qemuProcessDetectIOThreadPIDs(virQEMUDriverPtr driver,
+                              virDomainObjPtr vm)
+{
+    int *iothreadpids = NULL;
+    int niothreadpids;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+
+    if (vm->def->iothreads == 0 ||
+        !virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_OBJECT_IOTHREAD))
+        return 0;
+
+    qemuDomainObjEnterMonitor(driver, vm);
+    niothreadpids = qemuMonitorGetIOThreads(priv->mon, &iothreadpids);
+    qemuDomainObjExitMonitor(driver, vm);
+
+    if (niothreadpids < 0)
+        return -1;
+
+    if (niothreadpids != vm->def->iothreads) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("got wrong number of IOThread pids from QEMU monitor. "
+                         "got %d, wanted %u"),
+                       niothreadpids, vm->def->iothreads);
+        VIR_FREE(iothreadpids);
+        return -1;
+    }
+
+    priv->niothreadpids = niothreadpids;
+    priv->iothreadpids = iothreadpids;
+    return 0;
+}
+
+
 /* Helper to prepare cpumap for affinity setting, convert
  * NUMA nodeset into cpuset if @nodemask is not NULL, otherwise
  * just return a new allocated bitmap.
@@ -1863,7 +1880,7 @@ qemuProcessInitCpuAffinity(virQEMUDriverPtr driver,
         return -1;
 
     if (vm->def->placement_mode == VIR_DOMAIN_CPU_PLACEMENT_MODE_AUTO) {
-        VIR_DEBUG("Set CPU affinity with advisory nodeset from numad");
+        VIR_DEBUG("Set CPU affinity with automatically placed nodeset");
         cpumapToSet = cpumap;
     } else {
         VIR_DEBUG("Set CPU affinity with specified cpuset");
@@ -1893,6 +1910,44 @@ cleanup:
     return ret;
 }
 
+
+/*
+ * Pick the host NUMA nodes for a domain whose <vcpu> or <numatune>
+ * placement is 'auto', taking the domains placed before it into
+ * account. The load is accounted by the maximum vCPU count and
+ * memory size, which cannot change while the domain is running,
+ * so that qemuProcessStop releases exactly what was reserved here.
+ */
+static int
+qemuProcessPlaceNuma(virQEMUDriverPtr driver,
+                     virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virNumaPlacementNodePtr nodes = NULL;
+    size_t nnodes = 0;
+    char *nodeset = NULL;
+    int ret = -1;
+
+    if (nodeGetNumaPlacementNodes(&nodes, &nnodes) < 0)
+        goto cleanup;
+
+    if (virNumaPlacementChoose(driver->numaPlacement, nodes, nnodes,
+                               vm->def->maxvcpus, vm->def->mem.max_balloon,
+                               &priv->autoNodeset, NULL) < 0)
+        goto cleanup;
+
+    nodeset = virBitmapFormat(priv->autoNodeset);
+    VIR_DEBUG("Automatic placement of %s on nodeset %s",
+              vm->def->name, NULLSTR(nodeset));
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(nodeset);
+    virNumaPlacementNodesFree(nodes, nnodes);
+    return ret;
+}
+
 /* set link states to down on interfaces at qemu start */
 static int
 qemuProcessSetLinkStates(virDomainObjPtr vm)
@@ -1979,6 +2034,32 @@ qemuProcessSetEmulatorAffinities(virConnectPtr conn ATTRIBUTE_UNUSED,
     return ret;
 }
 
+/* Set CPU affinities for IOThreads if iothreadpin xml provided. */
+static int
+qemuProcessSetIOThreadsAffinity(virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virDomainDefPtr def = vm->def;
+    int iothread, n;
+
+    for (n = 0; n < def->cputune.niothreadspin; n++) {
+        iothread = def->cputune.iothreadspin[n]->vcpuid;
+
+        /* IOThreads are numbered from 1 */
+        if (iothread > priv->niothreadpids) {
+            virReportError(VIR_ERR_OPERATION_INVALID,
+                           _("no thread id known for iothread %d"), iothread);
+            return -1;
+        }
+
+        if (virProcessSetAffinity(priv->iothreadpids[iothread - 1],
+                                  def->cputune.iothreadspin[n]->cpumask) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
 static int
 qemuProcessInitPasswords(virConnectPtr conn,
                          virQEMUDriverPtr driver,
@@ -2949,6 +3030,14 @@ qemuProcessReconnect(void *opaque)
     /* Job was started by the caller for us */
     qemuDomainObjTransferJob(obj);
 
+    /* Account for the load of an automatically placed domain
+     * before anything else gets placed next to it */
+    if (priv->autoNodeset &&
+        virNumaPlacementReserve(driver->numaPlacement, priv->autoNodeset,
+                                obj->def->maxvcpus,
+                                obj->def->mem.max_balloon) < 0)
+        goto error;
+
     /* Hold an extra reference because we can't allow 'vm' to be
      * deleted if qemuConnectMonitor() failed */
     virObjectRef(obj);
@@ -3037,7 +3126,7 @@ qemuProcessReconnect(void *opaque)
         goto error;
 
     /* update domain state XML with possibly updated state in virDomainObj */
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, obj) < 0)
+    if (qemuDomainSaveStatus(driver, obj) < 0)
         goto error;
 
     /* Run an hook to allow admins to do some magic */
@@ -3353,8 +3442,6 @@ int qemuProcessStart(virConnectPtr conn,
     struct qemuProcessHookData hookData;
     unsigned long cur_balloon;
     int i;
-    char *nodeset = NULL;
-    virBitmapPtr nodemask = NULL;
     unsigned int stop_flags;
     virQEMUDriverConfigPtr cfg;
     virCapsPtr caps = NULL;
@@ -3398,7 +3485,7 @@ int qemuProcessStart(virConnectPtr conn,
     if (virDomainObjSetDefTransient(caps, driver->xmlopt, vm, true) < 0)
         goto cleanup;
 
-    vm->def->id = qemuDriverAllocateID(driver);
+    virDomainObjListSetID(driver->domains, vm, qemuDriverAllocateID(driver));
     qemuDomainSetFakeReboot(driver, vm, false);
     virDomainObjSetState(vm, VIR_DOMAIN_SHUTOFF, VIR_DOMAIN_SHUTOFF_UNKNOWN);
 
@@ -3452,6 +3539,21 @@ int qemuProcessStart(virConnectPtr conn,
         }
     }
 
+    for (i = 0; i < vm->def->mem.nhugepages; i++) {
+        const char *hugepagePath;
+
+        hugepagePath = qemuGetHugepagePath(cfg, vm->def->mem.hugepages[i].size);
+        if (!hugepagePath || hugepagePath == cfg->hugepagePath)
+            continue;
+
+        if (virSecurityManagerSetHugepages(driver->securityManager,
+                                           vm->def, hugepagePath) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                    "%s", _("Unable to set huge path in security driver"));
+            goto cleanup;
+        }
+    }
+
     /* Ensure no historical cgroup for this VM is lying around bogus
      * settings */
     VIR_DEBUG("Ensuring no historical cgroup is lying around");
@@ -3528,34 +3630,22 @@ int qemuProcessStart(virConnectPtr conn,
                                     flags & VIR_QEMU_PROCESS_START_COLD) < 0)
         goto cleanup;
 
-    for (i = 0; i < vm->def->ndisks ; i++) {
-        if (qemuDomainDetermineDiskChain(driver, vm->def->disks[i],
-                                         false) < 0)
-            goto cleanup;
-    }
+    if (qemuDomainDetermineDiskChains(driver, vm->def) < 0)
+        goto cleanup;
 
-    /* Get the advisory nodeset from numad if 'placement' of
+    /* Place the domain on host NUMA nodes if 'placement' of
      * either <vcpu> or <numatune> is 'auto'.
      */
-    if ((vm->def->placement_mode ==
-         VIR_DOMAIN_CPU_PLACEMENT_MODE_AUTO) ||
-        (vm->def->numatune.memory.placement_mode ==
-         VIR_NUMA_TUNE_MEM_PLACEMENT_MODE_AUTO)) {
-        nodeset = virNumaGetAutoPlacementAdvice(vm->def->vcpus,
-                                                vm->def->mem.cur_balloon);
-        if (!nodeset)
-            goto cleanup;
-
-        VIR_DEBUG("Nodeset returned from numad: %s", nodeset);
-
-        if (virBitmapParse(nodeset, 0, &nodemask,
-                           VIR_DOMAIN_CPUMASK_LEN) < 0)
-            goto cleanup;
-    }
-    hookData.nodemask = nodemask;
+    if (((vm->def->placement_mode ==
+          VIR_DOMAIN_CPU_PLACEMENT_MODE_AUTO) ||
+         (vm->def->numatune.memory.placement_mode ==
+          VIR_NUMA_TUNE_MEM_PLACEMENT_MODE_AUTO)) &&
+        qemuProcessPlaceNuma(driver, vm) < 0)
+        goto cleanup;
+    hookData.nodemask = priv->autoNodeset;
 
     VIR_DEBUG("Setting up domain cgroup (if required)");
-    if (qemuSetupCgroup(driver, vm, nodemask) < 0)
+    if (qemuSetupCgroup(driver, vm, priv->autoNodeset) < 0)
         goto cleanup;
 
     if (VIR_ALLOC(priv->monConfig) < 0) {
@@ -3725,7 +3815,7 @@ int qemuProcessStart(virConnectPtr conn,
     }
 
     VIR_DEBUG("Writing early domain status to disk");
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm) < 0) {
+    if (qemuDomainSaveStatus(driver, vm) < 0) {
         goto cleanup;
     }
 
@@ -3798,8 +3888,18 @@ int qemuProcessStart(virConnectPtr conn,
     if (qemuSetupCgroupForVcpu(vm) < 0)
         goto cleanup;
 
+    VIR_DEBUG("Detecting IOThread PIDs");
+    if (qemuProcessDetectIOThreadPIDs(driver, vm) < 0)
+        goto cleanup;
+
     VIR_DEBUG("Setting cgroup for emulator (if required)");
-    if (qemuSetupCgroupForEmulator(driver, vm, nodemask) < 0)
+    if (qemuSetupCgroupForEmulator(driver, vm, priv->autoNodeset) < 0)
+        goto cleanup;
+
+    /* Must come after the emulator cgroup, which takes over all
+     * the threads still left in the cgroup of the domain */
+    VIR_DEBUG("Setting cgroup for each IOThread (if required)");
+    if (qemuSetupCgroupForIOThreads(vm) < 0)
         goto cleanup;
 
     VIR_DEBUG("Setting VCPU affinities");
@@ -3810,6 +3910,10 @@ int qemuProcessStart(virConnectPtr conn,
     if (qemuProcessSetEmulatorAffinities(conn, vm) < 0)
         goto cleanup;
 
+    VIR_DEBUG("Setting affinity of IOThreads");
+    if (qemuProcessSetIOThreadsAffinity(vm) < 0)
+        goto cleanup;
+
     VIR_DEBUG("Setting any required VM passwords");
     if (qemuProcessInitPasswords(conn, driver, vm) < 0)
         goto cleanup;
@@ -3876,7 +3980,7 @@ int qemuProcessStart(virConnectPtr conn,
         goto cleanup;
 
     VIR_DEBUG("Writing domain status to disk");
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm) < 0)
+    if (qemuDomainSaveStatus(driver, vm) < 0)
         goto cleanup;
 
     /* finally we can call the 'started' hook script if any */
@@ -3907,8 +4011,6 @@ cleanup:
     /* We jump here if we failed to start the VM for any reason, or
      * if we failed to initialize the now running VM. kill it off and
      * pretend we never started it */
-    VIR_FREE(nodeset);
-    virBitmapFree(nodemask);
     virCommandFree(cmd);
     VIR_FORCE_CLOSE(logfile);
     qemuProcessStop(driver, vm, VIR_DOMAIN_SHUTOFF_FAILED, stop_flags);
@@ -3979,7 +4081,7 @@ void qemuProcessStop(virQEMUDriverPtr driver,
      * can lock the vm, and then call qemuProcessStop(). So we should
      * set vm->def->id to -1 here to avoid qemuProcessStop() to be called twice.
      */
-    vm->def->id = -1;
+    virDomainObjListSetID(driver->domains, vm, -1);
 
     if (virAtomicIntDecAndTest(&driver->nactive) && driver->inhibitCallback)
         driver->inhibitCallback(false, driver->inhibitOpaque);
@@ -4138,6 +4240,7 @@ retry:
         VIR_WARN("Failed to remove cgroup for %s",
                  vm->def->name);
     }
+    qemuDomainFreeVcpuCgroups(priv);
     virCgroupFree(&priv->cgroup);
 
     qemuProcessRemoveDomainStatus(driver, vm);
@@ -4166,6 +4269,14 @@ retry:
     virDomainObjSetState(vm, VIR_DOMAIN_SHUTOFF, reason);
     VIR_FREE(priv->vcpupids);
     priv->nvcpupids = 0;
+    VIR_FREE(priv->iothreadpids);
+    priv->niothreadpids = 0;
+    if (priv->autoNodeset) {
+        virNumaPlacementRelease(driver->numaPlacement, priv->autoNodeset,
+                                vm->def->maxvcpus, vm->def->mem.max_balloon);
+        virBitmapFree(priv->autoNodeset);
+        priv->autoNodeset = NULL;
+    }
     virObjectUnref(priv->qemuCaps);
     priv->qemuCaps = NULL;
     VIR_FREE(priv->pidfile);
@@ -4182,6 +4293,7 @@ retry:
     }
 
     if (vm->newDef) {
+        qemuDomainKeepDiskChains(vm->def, vm->newDef);
         virDomainDefFree(vm->def);
         vm->def = vm->newDef;
         vm->def->id = -1;
@@ -4238,7 +4350,7 @@ int qemuProcessAttach(virConnectPtr conn ATTRIBUTE_UNUSED,
     if (virDomainObjSetDefTransient(caps, driver->xmlopt, vm, true) < 0)
         goto cleanup;
 
-    vm->def->id = qemuDriverAllocateID(driver);
+    virDomainObjListSetID(driver->domains, vm, qemuDriverAllocateID(driver));
 
     if (virAtomicIntInc(&driver->nactive) == 1 && driver->inhibitCallback)
         driver->inhibitCallback(true, driver->inhibitOpaque);
@@ -4345,6 +4457,10 @@ int qemuProcessAttach(virConnectPtr conn ATTRIBUTE_UNUSED,
     if (qemuProcessDetectVcpuPIDs(driver, vm) < 0)
         goto cleanup;
 
+    VIR_DEBUG("Detecting IOThread PIDs");
+    if (qemuProcessDetectIOThreadPIDs(driver, vm) < 0)
+        goto cleanup;
+
     /* If we have -device, then addresses are assigned explicitly.
      * If not, then we have to detect dynamic ones here */
     if (!virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_DEVICE)) {
@@ -4379,7 +4495,7 @@ int qemuProcessAttach(virConnectPtr conn ATTRIBUTE_UNUSED,
         virDomainObjSetState(vm, VIR_DOMAIN_PAUSED, reason);
 
     VIR_DEBUG("Writing domain status to disk");
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm) < 0)
+    if (qemuDomainSaveStatus(driver, vm) < 0)
         goto cleanup;
 
     /* Run an hook to allow admins to do some magic */
@@ -37,6 +37,7 @@
 #include "virbuffer.h"
 #include "remote_driver.h"
 #include "remote_protocol.h"
+#include "remote_multicall.h"
 #include "lxc_protocol.h"
 #include "qemu_protocol.h"
 #include "viralloc.h"
@@ -91,6 +92,8 @@ struct private_data {
     int localUses;              /* Ref count for private data */
     char *hostname;             /* Original hostname */
     bool serverKeepAlive;       /* Does server support keepalive protocol? */
+    bool checkedMultiCall;      /* Have we asked about compound calls yet? */
+    bool serverMultiCall;       /* Does server support compound calls? */
 
     virDomainEventStatePtr domainEventState;
 };
@@ -122,8 +125,13 @@ static int callFull(virConnectPtr conn, struct private_data *priv,
                     int proc_nr,
                     xdrproc_t args_filter, char *args,
                     xdrproc_t ret_filter, char *ret);
+static int callMulti(virConnectPtr conn, struct private_data *priv,
+                     unsigned int flags,
+                     remoteMultiCallPtr calls, size_t ncalls);
 static int remoteAuthenticate(virConnectPtr conn, struct private_data *priv,
                               virConnectAuthPtr auth, const char *authtype);
+static int remoteEnableCompression(virConnectPtr conn, struct private_data *priv,
+                                   unsigned int threshold);
 #if WITH_SASL
 static int remoteAuthSASL(virConnectPtr conn, struct private_data *priv,
                           virConnectAuthPtr auth, const char *mech);
@@ -488,6 +496,7 @@ doRemoteOpen(virConnectPtr conn,
     char *pkipath = NULL, *keyfile = NULL, *sshauth = NULL;
 
     char *knownHostsVerify = NULL,  *knownHosts = NULL;
+    unsigned int compressThreshold = 0;
 
     /* Return code from this function, and the private data. */
     int retcode = VIR_DRV_OPEN_ERROR;
@@ -541,6 +550,17 @@ doRemoteOpen(virConnectPtr conn,
             EXTRACT_URI_ARG_BOOL("no_verify", verify);
             EXTRACT_URI_ARG_BOOL("no_tty", tty);
 
+            if (STRCASEEQ(var->name, "compress")) {
+                if (virStrToLong_ui(var->value, NULL, 10, &compressThreshold) < 0) {
+                    virReportError(VIR_ERR_INVALID_ARG,
+                                   _("Failed to parse value of URI component %s"),
+                                   var->name);
+                    goto failed;
+                }
+                var->ignore = 1;
+                continue;
+            }
+
             if (STRCASEEQ(var->name, "authfile")) {
                 /* Strip this param, used by virauth.c */
                 var->ignore = 1;
@@ -799,6 +819,12 @@ doRemoteOpen(virConnectPtr conn,
     if (remoteAuthenticate(conn, priv, auth, authtype) == -1)
         goto failed;
 
+    /* Must be switched on before anything else, notably keepalive
+     * messages, can be in flight */
+    if (compressThreshold > 0 &&
+        remoteEnableCompression(conn, priv, compressThreshold) < 0)
+        goto failed;
+
     if (virNetClientKeepAliveIsSupported(priv->client)) {
         remote_connect_supports_feature_args args =
             { VIR_DRV_FEATURE_PROGRAM_KEEPALIVE };
@@ -2391,27 +2417,38 @@ remoteDomainCreate(virDomainPtr domain)
     remote_domain_create_args args;
     remote_domain_lookup_by_uuid_args args2;
     remote_domain_lookup_by_uuid_ret ret2;
+    remoteMultiCall calls[2];
     struct private_data *priv = domain->conn->privateData;
 
     remoteDriverLock(priv);
 
     make_nonnull_domain(&args.dom, domain);
 
-    if (call(domain->conn, priv, 0, REMOTE_PROC_DOMAIN_CREATE,
-             (xdrproc_t) xdr_remote_domain_create_args, (char *) &args,
-             (xdrproc_t) xdr_void, (char *) NULL) == -1)
-        goto done;
-
     /* Need to do a lookup figure out ID of newly started guest, because
      * bug in design of REMOTE_PROC_DOMAIN_CREATE means we aren't getting
-     * it returned.
+     * it returned. Both go out in one round trip, if the server lets us.
      */
     memcpy(args2.uuid, domain->uuid, VIR_UUID_BUFLEN);
     memset(&ret2, 0, sizeof(ret2));
-    if (call(domain->conn, priv, 0, REMOTE_PROC_DOMAIN_LOOKUP_BY_UUID,
-             (xdrproc_t) xdr_remote_domain_lookup_by_uuid_args, (char *) &args2,
-             (xdrproc_t) xdr_remote_domain_lookup_by_uuid_ret, (char *) &ret2) == -1)
+
+    memset(calls, 0, sizeof(calls));
+    calls[0].proc_nr = REMOTE_PROC_DOMAIN_CREATE;
+    calls[0].args_filter = (xdrproc_t) xdr_remote_domain_create_args;
+    calls[0].args = (char *) &args;
+    calls[0].ret_filter = (xdrproc_t) xdr_void;
+    calls[0].ret = (char *) NULL;
+    calls[1].proc_nr = REMOTE_PROC_DOMAIN_LOOKUP_BY_UUID;
+    calls[1].args_filter = (xdrproc_t) xdr_remote_domain_lookup_by_uuid_args;
+    calls[1].args = (char *) &args2;
+    calls[1].ret_filter = (xdrproc_t) xdr_remote_domain_lookup_by_uuid_ret;
+    calls[1].ret = (char *) &ret2;
+
+    if (callMulti(domain->conn, priv, REMOTE_CONNECT_MULTI_CALL_STOP_ON_ERROR,
+                  calls, ARRAY_CARDINALITY(calls)) == -1) {
+        if (calls[1].rv == 0)
+            xdr_free((xdrproc_t) &xdr_remote_domain_lookup_by_uuid_ret, (char *) &ret2);
         goto done;
+    }
 
     domain->id = ret2.dom.id;
     xdr_free((xdrproc_t) &xdr_remote_domain_lookup_by_uuid_ret, (char *) &ret2);
@@ -3502,6 +3539,41 @@ remoteNWFilterClose(virConnectPtr conn)
 
 /*----------------------------------------------------------------------*/
 
+/* Ask the server to switch the connection to compressed I/O. Servers
+ * which don't allow it for this connection, or predate it, are not
+ * fatal: we just carry on uncompressed */
+#if WITH_ZLIB
+static int
+remoteEnableCompression(virConnectPtr conn, struct private_data *priv,
+                        unsigned int threshold)
+{
+    remote_connect_enable_compression_args args = { 0 };
+
+    if (call(conn, priv, 0, REMOTE_PROC_CONNECT_ENABLE_COMPRESSION,
+             (xdrproc_t) xdr_remote_connect_enable_compression_args, (char *) &args,
+             (xdrproc_t) xdr_void, (char *) NULL) == -1) {
+        VIR_INFO("Not compressing connection since it is not allowed"
+                 " by the server");
+        virResetLastError();
+        return 0;
+    }
+
+    /* The server switched after sending us its reply, so we must
+     * follow suit before sending anything else */
+    return virNetClientSetCompression(priv->client, threshold);
+}
+#else
+static int
+remoteEnableCompression(virConnectPtr conn ATTRIBUTE_UNUSED,
+                        struct private_data *priv ATTRIBUTE_UNUSED,
+                        unsigned int threshold)
+{
+    VIR_WARN("Ignoring compress=%u URI parameter since compression"
+             " support is not available", threshold);
+    return 0;
+}
+#endif
+
 static int
 remoteAuthenticate(virConnectPtr conn, struct private_data *priv,
                    virConnectAuthPtr auth ATTRIBUTE_UNUSED,
@@ -5663,6 +5735,72 @@ call(virConnectPtr conn,
 }
 
 
+static bool
+remoteSupportsMultiCall(virConnectPtr conn,
+                        struct private_data *priv)
+{
+    remote_connect_supports_feature_args args =
+        { VIR_DRV_FEATURE_PROGRAM_MULTI_CALL };
+    remote_connect_supports_feature_ret ret = { 0 };
+
+    if (priv->checkedMultiCall)
+        return priv->serverMultiCall;
+
+    if (call(conn, priv, 0, REMOTE_PROC_CONNECT_SUPPORTS_FEATURE,
+             (xdrproc_t)xdr_remote_connect_supports_feature_args, (char *) &args,
+             (xdrproc_t)xdr_remote_connect_supports_feature_ret, (char *) &ret) == -1) {
+        virResetLastError();
+        return false;
+    }
+
+    priv->checkedMultiCall = true;
+    priv->serverMultiCall = !!ret.supported;
+    if (!priv->serverMultiCall)
+        VIR_INFO("Issuing calls one by one since compound calls are not"
+                 " supported by the server");
+
+    return priv->serverMultiCall;
+}
+
+
+struct callMultiData {
+    virConnectPtr conn;
+    struct private_data *priv;
+};
+
+
+static int
+callMultiOne(int proc_nr,
+             xdrproc_t args_filter, char *args,
+             xdrproc_t ret_filter, char *ret,
+             void *opaque)
+{
+    struct callMultiData *data = opaque;
+
+    return call(data->conn, data->priv, 0, proc_nr,
+                args_filter, args, ret_filter, ret);
+}
+
+
+/*
+ * Issue @calls in a single round trip if the server supports it,
+ * one by one otherwise, see remoteMultiCallRun.
+ */
+static int
+callMulti(virConnectPtr conn,
+          struct private_data *priv,
+          unsigned int flags,
+          remoteMultiCallPtr calls,
+          size_t ncalls)
+{
+    struct callMultiData data = { conn, priv };
+
+    return remoteMultiCallRun(calls, ncalls, flags,
+                              remoteSupportsMultiCall(conn, priv),
+                              callMultiOne, &data);
+}
+
+
 static int
 remoteDomainGetInterfaceParameters(virDomainPtr domain,
                                    const char *device,
@@ -0,0 +1,223 @@
+/*
+ * remote_multicall.c: issuing several remote calls in one round trip
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "remote_multicall.h"
+#include "virnetclientprogram.h"
+#include "virnetmessage.h"
+#include "viralloc.h"
+#include "virerror.h"
+
+#define VIR_FROM_THIS VIR_FROM_REMOTE
+
+
+/* Issue @calls one after another, the way a server which doesn't
+ * understand compound calls would have to see them. */
+static int
+remoteMultiCallFallback(remoteMultiCallPtr calls,
+                        size_t ncalls,
+                        unsigned int flags,
+                        remoteMultiCallFunc func,
+                        void *opaque)
+{
+    virErrorPtr err = NULL;
+    size_t i;
+
+    for (i = 0 ; i < ncalls ; i++) {
+        calls[i].rv = func(calls[i].proc_nr,
+                           calls[i].args_filter, calls[i].args,
+                           calls[i].ret_filter, calls[i].ret,
+                           opaque);
+        if (calls[i].rv < 0) {
+            if (!err)
+                err = virSaveLastError();
+            if (flags & REMOTE_CONNECT_MULTI_CALL_STOP_ON_ERROR)
+                break;
+        }
+    }
+
+    if (err) {
+        virSetError(err);
+        virFreeError(err);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * remoteMultiCallRun:
+ * @calls: the calls to issue, in order
+ * @ncalls: the number of @calls
+ * @flags: REMOTE_CONNECT_MULTI_CALL_* flags
+ * @compound: whether the server understands compound calls
+ * @func: issues a single call
+ * @opaque: passed to @func
+ *
+ * Issue all of @calls in a single REMOTE_PROC_CONNECT_MULTI_CALL round
+ * trip, which the server executes in order, or if @compound is false,
+ * issue them one by one through @func. Each call's 'rv' field reports
+ * whether it succeeded, and its 'ret' is filled in just as a single
+ * call would do. With REMOTE_CONNECT_MULTI_CALL_STOP_ON_ERROR, no
+ * further calls are executed once one has failed.
+ *
+ * Any sequence of calls the remote driver makes for a single API can
+ * go through here, as long as the later ones don't need the replies
+ * of the earlier ones. The server refuses streams, authentication and
+ * connection setup in a compound call.
+ *
+ * The caller must free the 'ret' of every call whose 'rv' is 0,
+ * even if -1 is returned.
+ *
+ * Returns 0 if all calls succeeded, or -1 with the error of the
+ * first failed call reported.
+ */
+int
+remoteMultiCallRun(remoteMultiCallPtr calls,
+                   size_t ncalls,
+                   unsigned int flags,
+                   bool compound,
+                   remoteMultiCallFunc func,
+                   void *opaque)
+{
+    int rv = -1;
+    remote_connect_multi_call_args args;
+    remote_connect_multi_call_ret ret;
+    size_t total = 0;
+    bool failed = false;
+    XDR xdr;
+    size_t i;
+
+    for (i = 0 ; i < ncalls ; i++)
+        calls[i].rv = -1;
+
+    if (ncalls > REMOTE_CONNECT_MULTI_CALL_MAX) {
+        virReportError(VIR_ERR_RPC,
+                       _("too many remote calls %zu for limit %d"),
+                       ncalls, REMOTE_CONNECT_MULTI_CALL_MAX);
+        return -1;
+    }
+
+    if (!compound)
+        return remoteMultiCallFallback(calls, ncalls, flags, func, opaque);
+
+    memset(&args, 0, sizeof(args));
+    memset(&ret, 0, sizeof(ret));
+    args.flags = flags;
+
+    if (VIR_ALLOC_N(args.calls.calls_val, ncalls) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+    args.calls.calls_len = ncalls;
+
+    for (i = 0 ; i < ncalls ; i++) {
+        remote_connect_multi_call_entry *entry = &args.calls.calls_val[i];
+        size_t len;
+
+        entry->proc = calls[i].proc_nr;
+        if (virNetMessageEncodeData(calls[i].args_filter, calls[i].args,
+                                    REMOTE_CONNECT_MULTI_CALL_PAYLOAD_MAX,
+                                    &entry->args.args_val, &len) < 0)
+            goto cleanup;
+        entry->args.args_len = len;
+
+        total += len;
+        if (total > REMOTE_CONNECT_MULTI_CALL_PAYLOAD_MAX) {
+            virReportError(VIR_ERR_RPC,
+                           _("compound call too large after %zu calls"),
+                           i + 1);
+            goto cleanup;
+        }
+    }
+
+    if (func(REMOTE_PROC_CONNECT_MULTI_CALL,
+             (xdrproc_t) xdr_remote_connect_multi_call_args, (char *) &args,
+             (xdrproc_t) xdr_remote_connect_multi_call_ret, (char *) &ret,
+             opaque) == -1)
+        goto cleanup;
+
+    if (ret.results.results_len > ncalls) {
+        virReportError(VIR_ERR_RPC,
+                       _("too many results %d for %zu calls"),
+                       ret.results.results_len, ncalls);
+        goto cleanup;
+    }
+
+    for (i = 0 ; i < ret.results.results_len ; i++) {
+        remote_connect_multi_call_result *result = &ret.results.results_val[i];
+
+        xdrmem_create(&xdr, result->data.data_val, result->data.data_len,
+                      XDR_DECODE);
+
+        if (result->status == VIR_NET_OK) {
+            if (!(*calls[i].ret_filter)(&xdr, calls[i].ret)) {
+                virReportError(VIR_ERR_RPC,
+                               _("Unable to decode reply of call %d"),
+                               calls[i].proc_nr);
+                xdr_destroy(&xdr);
+                goto cleanup;
+            }
+            calls[i].rv = 0;
+        } else if (result->status == VIR_NET_ERROR) {
+            virNetMessageError err;
+
+            memset(&err, 0, sizeof(err));
+            if (!xdr_virNetMessageError(&xdr, &err)) {
+                virReportError(VIR_ERR_RPC,
+                               _("Unable to decode error of call %d"),
+                               calls[i].proc_nr);
+                xdr_destroy(&xdr);
+                goto cleanup;
+            }
+            /* Only the first failure is of interest to the caller */
+            if (!failed)
+                virNetClientProgramReportError(&err);
+            xdr_free((xdrproc_t)xdr_virNetMessageError, (char *)&err);
+            failed = true;
+        } else {
+            virReportError(VIR_ERR_RPC,
+                           _("Unexpected status %d for call %d"),
+                           result->status, calls[i].proc_nr);
+            xdr_destroy(&xdr);
+            goto cleanup;
+        }
+
+        xdr_destroy(&xdr);
+    }
+
+    /* Only a failure may cut the list of executed calls short */
+    if (ret.results.results_len < ncalls && !failed) {
+        virReportError(VIR_ERR_RPC,
+                       _("only %d results for %zu calls"),
+                       ret.results.results_len, ncalls);
+        goto cleanup;
+    }
+
+    if (!failed)
+        rv = 0;
+
+cleanup:
+    xdr_free((xdrproc_t) xdr_remote_connect_multi_call_args, (char *) &args);
+    xdr_free((xdrproc_t) xdr_remote_connect_multi_call_ret, (char *) &ret);
+    return rv;
+}
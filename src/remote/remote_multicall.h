@@ -0,0 +1,58 @@
+/*
+ * remote_multicall.h: issuing several remote calls in one round trip
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VIR_REMOTE_MULTICALL_H__
+# define __VIR_REMOTE_MULTICALL_H__
+
+# include "internal.h"
+# include "remote_protocol.h"
+
+/* A single call to be issued as part of a compound call */
+typedef struct _remoteMultiCall remoteMultiCall;
+typedef remoteMultiCall *remoteMultiCallPtr;
+struct _remoteMultiCall {
+    int proc_nr;
+    xdrproc_t args_filter;
+    char *args;
+    xdrproc_t ret_filter;
+    char *ret;
+
+    int rv;             /* Filled in: 0 on success, -1 on failure or if
+                         * the call was never executed */
+};
+
+/*
+ * Issue a single call of the remote program and wait for its reply,
+ * the way the remote driver's call() does.
+ */
+typedef int (*remoteMultiCallFunc)(int proc_nr,
+                                   xdrproc_t args_filter, char *args,
+                                   xdrproc_t ret_filter, char *ret,
+                                   void *opaque);
+
+int remoteMultiCallRun(remoteMultiCallPtr calls,
+                       size_t ncalls,
+                       unsigned int flags,
+                       bool compound,
+                       remoteMultiCallFunc func,
+                       void *opaque)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(5) ATTRIBUTE_RETURN_CHECK;
+
+#endif /* __VIR_REMOTE_MULTICALL_H__ */
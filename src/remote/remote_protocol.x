@@ -234,6 +234,18 @@ const REMOTE_DOMAIN_DISK_ERRORS_MAX = 256;
  */
 const REMOTE_NODE_MEMORY_PARAMETERS_MAX = 64;
 
+/*
+ * Upper limit on number of sub-calls in a compound call
+ */
+const REMOTE_CONNECT_MULTI_CALL_MAX = 1024;
+
+/*
+ * Maximum length of the encoded arguments or return value of a single
+ * sub-call in a compound call.  The total size of the compound message
+ * is still bounded by VIR_NET_MESSAGE_MAX.
+ */
+const REMOTE_CONNECT_MULTI_CALL_PAYLOAD_MAX = 4194280;
+
 /* UUID.  VIR_UUID_BUFLEN definition comes from libvirt.h */
 typedef opaque remote_uuid[VIR_UUID_BUFLEN];
 
@@ -2744,6 +2756,40 @@ struct remote_domain_fstrim_args {
     unsigned int flags;
 };
 
+/* Stop executing sub-calls after the first one that fails */
+const REMOTE_CONNECT_MULTI_CALL_STOP_ON_ERROR = 1;
+
+/* A single sub-call of a compound call.  'args' holds the XDR encoded
+ * arguments struct of procedure 'proc' in this program. */
+struct remote_connect_multi_call_entry {
+    int proc;
+    opaque args<REMOTE_CONNECT_MULTI_CALL_PAYLOAD_MAX>;
+};
+
+/* Result of a single sub-call.  If 'status' is VIR_NET_OK, 'data' holds
+ * the XDR encoded return struct of the procedure, if it is VIR_NET_ERROR
+ * 'data' holds an XDR encoded remote_error. */
+struct remote_connect_multi_call_result {
+    int status;
+    opaque data<REMOTE_CONNECT_MULTI_CALL_PAYLOAD_MAX>;
+};
+
+struct remote_connect_multi_call_args {
+    remote_connect_multi_call_entry calls<REMOTE_CONNECT_MULTI_CALL_MAX>;
+    unsigned int flags;
+};
+
+/* One result per executed sub-call, in the order they were issued.
+ * With REMOTE_CONNECT_MULTI_CALL_STOP_ON_ERROR there may be fewer
+ * results than calls. */
+struct remote_connect_multi_call_ret {
+    remote_connect_multi_call_result results<REMOTE_CONNECT_MULTI_CALL_MAX>;
+};
+
+struct remote_connect_enable_compression_args {
+    unsigned int flags;
+};
+
 /*----- Protocol. -----*/
 
 /* Define the program number, protocol version and procedure numbers here. */
@@ -4434,6 +4480,16 @@ enum remote_procedure {
     /**
      * @generate: server
      */
-    REMOTE_PROC_NODE_DEVICE_DETACH_FLAGS = 301
+    REMOTE_PROC_NODE_DEVICE_DETACH_FLAGS = 301,
+
+    /**
+     * @generate: none
+     */
+    REMOTE_PROC_CONNECT_MULTI_CALL = 302,
+
+    /**
+     * @generate: none
+     */
+    REMOTE_PROC_CONNECT_ENABLE_COMPRESSION = 303
 
 };
@@ -996,11 +996,13 @@ elsif ($mode eq "server") {
     # args and return values, and the size of the args and
     # return value structs. All methods are marked as requiring
     # authentication. Methods are selectively relaxed in the
-    # daemon code which registers the program.
+    # daemon code which registers the program. Likewise all
+    # non-stream methods are marked as usable from a compound
+    # call, and the daemon code restricts those which are not.
 
     print "virNetServerProgramProc ${structprefix}Procs[] = {\n";
     for ($id = 0 ; $id <= $#calls ; $id++) {
-        my ($comment, $name, $argtype, $arglen, $argfilter, $retlen, $retfilter, $priority);
+        my ($comment, $name, $argtype, $arglen, $argfilter, $retlen, $retfilter, $priority, $batchable);
 
         if (defined $calls[$id] && !$calls[$id]->{msg}) {
             $comment = "/* Method $calls[$id]->{ProcName} => $id */";
@@ -1011,6 +1013,9 @@ elsif ($mode eq "server") {
             $retlen = $rettype ne "void" ? "sizeof($rettype)" : "0";
             $argfilter = $argtype ne "void" ? "xdr_$argtype" : "xdr_void";
             $retfilter = $rettype ne "void" ? "xdr_$rettype" : "xdr_void";
+            # Stream based methods need a message of their own, so they
+            # can't be embedded in a compound call
+            $batchable = $calls[$id]->{streamflag} eq "none" ? "true" : "false";
         } else {
             if ($calls[$id]->{msg}) {
                 $comment = "/* Async event $calls[$id]->{ProcName} => $id */";
@@ -1021,11 +1026,12 @@ elsif ($mode eq "server") {
             $arglen = $retlen = 0;
             $argfilter = "xdr_void";
             $retfilter = "xdr_void";
+            $batchable = "false";
         }
 
     $priority = defined $calls[$id]->{priority} ? $calls[$id]->{priority} : 0;
 
-        print "{ $comment\n   ${name},\n   $arglen,\n   (xdrproc_t)$argfilter,\n   $retlen,\n   (xdrproc_t)$retfilter,\n   true,\n   $priority\n},\n";
+        print "{ $comment\n   ${name},\n   $arglen,\n   (xdrproc_t)$argfilter,\n   $retlen,\n   (xdrproc_t)$retfilter,\n   true,\n   $priority,\n   $batchable\n},\n";
     }
     print "};\n";
     print "size_t ${structprefix}NProcs = ARRAY_CARDINALITY(${structprefix}Procs);\n";
@@ -41,7 +41,10 @@ struct _virKeepAlive {
     unsigned int countToDeath;
     time_t lastPacketReceived;
     time_t intervalStart;
-    int timer;
+    bool active;
+    /* Position in the scheduler heap, -1 when not queued. Protected
+     * by the scheduler lock rather than the object lock */
+    ssize_t heapIndex;
 
     virKeepAliveSendFunc sendCB;
     virKeepAliveDeadFunc deadCB;
@@ -50,6 +53,32 @@ struct _virKeepAlive {
 };
 
 
+/*
+ * All active keepalive objects share a single event loop timer. They
+ * are kept in a binary heap ordered by the time their interval ends,
+ * and the timer is armed for the earliest of those. Traffic received
+ * on a connection only moves its interval start, the heap entry is
+ * corrected lazily when it reaches the top. So a busy connection
+ * costs nothing until it goes quiet, and all connections due in the
+ * same second are dealt with in one timer callback.
+ */
+typedef struct _virKeepAliveHeapEntry virKeepAliveHeapEntry;
+struct _virKeepAliveHeapEntry {
+    time_t deadline;
+    virKeepAlivePtr ka;
+};
+
+static struct {
+    virMutex lock;
+    int timer;
+    time_t armed;   /* deadline the timer is currently set for, or 0 */
+
+    virKeepAliveHeapEntry *heap;
+    size_t nheap;
+    size_t nheap_max;
+} virKeepAliveSched;
+
+
 static virClassPtr virKeepAliveClass;
 static void virKeepAliveDispose(void *obj);
 
@@ -61,11 +90,211 @@ static int virKeepAliveOnceInit(void)
                                           virKeepAliveDispose)))
         return -1;
 
+    if (virMutexInit(&virKeepAliveSched.lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize keepalive scheduler"));
+        return -1;
+    }
+    virKeepAliveSched.timer = -1;
+
     return 0;
 }
 
 VIR_ONCE_GLOBAL_INIT(virKeepAlive)
 
+
+static void
+virKeepAliveHeapSet(size_t i, virKeepAliveHeapEntry entry)
+{
+    virKeepAliveSched.heap[i] = entry;
+    entry.ka->heapIndex = i;
+}
+
+
+static void
+virKeepAliveHeapSiftUp(size_t i)
+{
+    virKeepAliveHeapEntry entry = virKeepAliveSched.heap[i];
+
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (virKeepAliveSched.heap[parent].deadline <= entry.deadline)
+            break;
+        virKeepAliveHeapSet(i, virKeepAliveSched.heap[parent]);
+        i = parent;
+    }
+    virKeepAliveHeapSet(i, entry);
+}
+
+
+static void
+virKeepAliveHeapSiftDown(size_t i)
+{
+    virKeepAliveHeapEntry entry = virKeepAliveSched.heap[i];
+    size_t n = virKeepAliveSched.nheap;
+
+    while (2 * i + 1 < n) {
+        size_t child = 2 * i + 1;
+        if (child + 1 < n &&
+            virKeepAliveSched.heap[child + 1].deadline <
+            virKeepAliveSched.heap[child].deadline)
+            child++;
+        if (entry.deadline <= virKeepAliveSched.heap[child].deadline)
+            break;
+        virKeepAliveHeapSet(i, virKeepAliveSched.heap[child]);
+        i = child;
+    }
+    virKeepAliveHeapSet(i, entry);
+}
+
+
+/* Remove the entry at @i, the caller inherits its reference */
+static virKeepAlivePtr
+virKeepAliveHeapRemove(size_t i)
+{
+    virKeepAlivePtr ka = virKeepAliveSched.heap[i].ka;
+    time_t deadline = virKeepAliveSched.heap[i].deadline;
+
+    ka->heapIndex = -1;
+    virKeepAliveSched.nheap--;
+    if (i < virKeepAliveSched.nheap) {
+        virKeepAliveHeapSet(i, virKeepAliveSched.heap[virKeepAliveSched.nheap]);
+        if (virKeepAliveSched.heap[i].deadline < deadline)
+            virKeepAliveHeapSiftUp(i);
+        else
+            virKeepAliveHeapSiftDown(i);
+    }
+
+    return ka;
+}
+
+
+/* NB, these are not static as we need to call them from the testsuite */
+int virKeepAliveSchedAdd(virKeepAlivePtr ka, time_t deadline);
+bool virKeepAliveSchedRemove(virKeepAlivePtr ka);
+int virKeepAliveSchedTakeDue(time_t now,
+                             virKeepAlivePtr **due,
+                             size_t *ndue);
+
+
+/* Point the shared timer at the earliest deadline in the heap */
+static void
+virKeepAliveSchedArm(void)
+{
+    time_t deadline = 0;
+    time_t now;
+    int timeout = -1;
+
+    if (virKeepAliveSched.nheap)
+        deadline = virKeepAliveSched.heap[0].deadline;
+
+    /* Rearming the timer wakes up the event loop, so only do it
+     * when there is something new to wait for */
+    if (deadline == virKeepAliveSched.armed)
+        return;
+
+    if (deadline) {
+        now = time(NULL);
+        timeout = deadline > now ? deadline - now : 0;
+        /* Guard against overflow */
+        if (timeout > INT_MAX / 1000)
+            timeout = INT_MAX / 1000;
+        timeout *= 1000;
+    }
+
+    virKeepAliveSched.armed = deadline;
+    virEventUpdateTimeout(virKeepAliveSched.timer, timeout);
+}
+
+
+/* Queue @ka to be looked at once @deadline passes, unless it is
+ * queued already. The heap holds its own reference. Must be called
+ * with @ka locked, the scheduler lock nests inside object locks. */
+int
+virKeepAliveSchedAdd(virKeepAlivePtr ka, time_t deadline)
+{
+    int ret = -1;
+
+    virMutexLock(&virKeepAliveSched.lock);
+
+    if (ka->heapIndex >= 0) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (VIR_RESIZE_N(virKeepAliveSched.heap, virKeepAliveSched.nheap_max,
+                     virKeepAliveSched.nheap, 1) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    virKeepAliveSched.heap[virKeepAliveSched.nheap].deadline = deadline;
+    virKeepAliveSched.heap[virKeepAliveSched.nheap].ka = virObjectRef(ka);
+    virKeepAliveHeapSiftUp(virKeepAliveSched.nheap++);
+    virKeepAliveSchedArm();
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&virKeepAliveSched.lock);
+    return ret;
+}
+
+
+/* Drop @ka from the heap, returning true if the caller now owns the
+ * reference the heap held */
+bool
+virKeepAliveSchedRemove(virKeepAlivePtr ka)
+{
+    bool removed = false;
+
+    virMutexLock(&virKeepAliveSched.lock);
+    if (ka->heapIndex >= 0) {
+        virKeepAliveHeapRemove(ka->heapIndex);
+        virKeepAliveSchedArm();
+        removed = true;
+    }
+    virMutexUnlock(&virKeepAliveSched.lock);
+
+    return removed;
+}
+
+
+/* Take every keepalive whose deadline is no later than @now out of
+ * the heap into @due, earliest first, and point the timer at the
+ * rest. The caller inherits the references the heap held. */
+int
+virKeepAliveSchedTakeDue(time_t now,
+                         virKeepAlivePtr **due,
+                         size_t *ndue)
+{
+    int ret = -1;
+
+    *due = NULL;
+    *ndue = 0;
+
+    virMutexLock(&virKeepAliveSched.lock);
+
+    /* The timer restarted its period when it fired */
+    virKeepAliveSched.armed = 0;
+
+    if (virKeepAliveSched.nheap &&
+        VIR_ALLOC_N(*due, virKeepAliveSched.nheap) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    while (virKeepAliveSched.nheap &&
+           virKeepAliveSched.heap[0].deadline <= now)
+        (*due)[(*ndue)++] = virKeepAliveHeapRemove(0);
+
+    ret = 0;
+
+cleanup:
+    virKeepAliveSchedArm();
+    virMutexUnlock(&virKeepAliveSched.lock);
+    return ret;
+}
+
 static virNetMessagePtr
 virKeepAliveMessage(virKeepAlivePtr ka, int proc)
 {
@@ -121,11 +350,8 @@ virKeepAliveTimerInternal(virKeepAlivePtr ka,
     if (ka->interval <= 0 || ka->intervalStart == 0)
         return false;
 
-    if (now - ka->intervalStart < ka->interval) {
-        timeval = ka->interval - (now - ka->intervalStart);
-        virEventUpdateTimeout(ka->timer, timeval * 1000);
+    if (now - ka->intervalStart < ka->interval)
         return false;
-    }
 
     timeval = now - ka->lastPacketReceived;
     PROBE(RPC_KEEPALIVE_TIMEOUT,
@@ -143,29 +369,41 @@ virKeepAliveTimerInternal(virKeepAlivePtr ka,
         ka->countToDeath--;
         ka->intervalStart = now;
         *msg = virKeepAliveMessage(ka, KEEPALIVE_PROC_PING);
-        virEventUpdateTimeout(ka->timer, ka->interval * 1000);
         return false;
     }
 }
 
 
+/* Deal with @ka whose deadline passed, consuming the heap reference */
 static void
-virKeepAliveTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
+virKeepAliveTimerOne(virKeepAlivePtr ka)
 {
-    virKeepAlivePtr ka = opaque;
     virNetMessagePtr msg = NULL;
-    bool dead;
+    bool dead = false;
     void *client;
 
     virObjectLock(ka);
 
     client = ka->client;
+
+    /* Stopped while we were not looking */
+    if (!ka->active)
+        goto cleanup;
+
     dead = virKeepAliveTimerInternal(ka, &msg);
 
+    /* Unless the connection is dead, go back in the heap with the
+     * end of the current interval, which traffic may have moved */
+    if (!dead &&
+        virKeepAliveSchedAdd(ka, ka->intervalStart + ka->interval) < 0) {
+        VIR_WARN("Unable to reschedule keepalive for client %p", client);
+        ka->active = false;
+        goto cleanup;
+    }
+
     if (!dead && !msg)
         goto cleanup;
 
-    virObjectRef(ka);
     virObjectUnlock(ka);
 
     if (dead) {
@@ -175,11 +413,32 @@ virKeepAliveTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
         virNetMessageFree(msg);
     }
 
-    virObjectLock(ka);
     virObjectUnref(ka);
+    return;
 
 cleanup:
     virObjectUnlock(ka);
+    virObjectUnref(ka);
+}
+
+
+static void
+virKeepAliveTimer(int timer ATTRIBUTE_UNUSED, void *opaque ATTRIBUTE_UNUSED)
+{
+    virKeepAlivePtr *due;
+    size_t ndue;
+    size_t i;
+
+    if (virKeepAliveSchedTakeDue(time(NULL), &due, &ndue) < 0)
+        return;
+
+    if (ndue)
+        VIR_DEBUG("Checking %zu keepalive clients", ndue);
+
+    for (i = 0 ; i < ndue ; i++)
+        virKeepAliveTimerOne(due[i]);
+
+    VIR_FREE(due);
 }
 
 
@@ -204,7 +463,7 @@ virKeepAliveNew(int interval,
     ka->interval = interval;
     ka->count = count;
     ka->countToDeath = count;
-    ka->timer = -1;
+    ka->heapIndex = -1;
     ka->client = client;
     ka->sendCB = sendCB;
     ka->deadCB = deadCB;
@@ -238,11 +497,12 @@ virKeepAliveStart(virKeepAlivePtr ka,
     int ret = -1;
     time_t delay;
     int timeout;
+    int timer;
     time_t now;
 
     virObjectLock(ka);
 
-    if (ka->timer >= 0) {
+    if (ka->active) {
         VIR_DEBUG("Keepalive messages already enabled");
         ret = 0;
         goto cleanup;
@@ -282,13 +542,20 @@ virKeepAliveStart(virKeepAlivePtr ka,
     else
         timeout = ka->interval - delay;
     ka->intervalStart = now - (ka->interval - timeout);
-    ka->timer = virEventAddTimeout(timeout * 1000, virKeepAliveTimer,
-                                   ka, virObjectFreeCallback);
-    if (ka->timer < 0)
+
+    virMutexLock(&virKeepAliveSched.lock);
+    if (virKeepAliveSched.timer < 0)
+        virKeepAliveSched.timer = virEventAddTimeout(-1, virKeepAliveTimer,
+                                                     NULL, NULL);
+    timer = virKeepAliveSched.timer;
+    virMutexUnlock(&virKeepAliveSched.lock);
+    if (timer < 0)
+        goto cleanup;
+
+    if (virKeepAliveSchedAdd(ka, ka->intervalStart + ka->interval) < 0)
         goto cleanup;
 
-    /* the timer now has another reference to this object */
-    virObjectRef(ka);
+    ka->active = true;
     ret = 0;
 
 cleanup:
@@ -300,18 +567,21 @@ cleanup:
 void
 virKeepAliveStop(virKeepAlivePtr ka)
 {
+    bool removed;
+
     virObjectLock(ka);
 
     PROBE(RPC_KEEPALIVE_STOP,
           "ka=%p client=%p",
           ka, ka->client);
 
-    if (ka->timer > 0) {
-        virEventRemoveTimeout(ka->timer);
-        ka->timer = -1;
-    }
+    ka->active = false;
+    removed = virKeepAliveSchedRemove(ka);
 
     virObjectUnlock(ka);
+
+    if (removed)
+        virObjectUnref(ka);
 }
 
 
@@ -379,6 +649,9 @@ virKeepAliveCheckMessage(virKeepAlivePtr ka,
 
     virObjectLock(ka);
 
+    /* Any traffic proves the peer is alive. Only the interval is
+     * moved here, the scheduler notices when the old deadline comes
+     * up, which saves touching the event loop for every message */
     ka->countToDeath = ka->count;
     ka->lastPacketReceived = ka->intervalStart = time(NULL);
 
@@ -406,9 +679,6 @@ virKeepAliveCheckMessage(virKeepAlivePtr ka,
         }
     }
 
-    if (ka->timer >= 0)
-        virEventUpdateTimeout(ka->timer, ka->interval * 1000);
-
     virObjectUnlock(ka);
 
     return ret;
@@ -735,6 +735,18 @@ void virNetClientSetSASLSession(virNetClientPtr client,
 #endif
 
 
+int virNetClientSetCompression(virNetClientPtr client,
+                               size_t threshold)
+{
+    int ret;
+
+    virObjectLock(client);
+    ret = virNetSocketSetCompression(client->sock, threshold);
+    virObjectUnlock(client);
+    return ret;
+}
+
+
 #if WITH_GNUTLS
 int virNetClientSetTLSSession(virNetClientPtr client,
                               virNetTLSContextPtr tls)
@@ -983,15 +995,20 @@ virNetClientCallDispatchReply(virNetClientPtr client)
         return -1;
     }
 
-    if (VIR_REALLOC_N(thecall->msg->buffer, client->msg.bufferLength) < 0) {
-        virReportOOMError();
-        return -1;
-    }
-
-    memcpy(thecall->msg->buffer, client->msg.buffer, client->msg.bufferLength);
-    memcpy(&thecall->msg->header, &client->msg.header, sizeof(client->msg.header));
+    /* Hand the receive buffer over to the waiting call rather
+     * than copying it, so that the thread doing I/O on behalf of
+     * everyone else holds the client lock for as little time as
+     * possible. Decoding the reply is left to the caller's thread
+     * once it wakes up. The next read allocates a new buffer.
+     */
+    VIR_FREE(thecall->msg->buffer);
+    thecall->msg->buffer = client->msg.buffer;
     thecall->msg->bufferLength = client->msg.bufferLength;
     thecall->msg->bufferOffset = client->msg.bufferOffset;
+    client->msg.buffer = NULL;
+    client->msg.bufferLength = client->msg.bufferOffset = 0;
+
+    memcpy(&thecall->msg->header, &client->msg.header, sizeof(client->msg.header));
 
     thecall->msg->nfds = client->msg.nfds;
     thecall->msg->fds = client->msg.fds;
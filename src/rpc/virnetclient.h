@@ -114,6 +114,9 @@ int virNetClientSetTLSSession(virNetClientPtr client,
                               virNetTLSContextPtr tls);
 # endif
 
+int virNetClientSetCompression(virNetClientPtr client,
+                               size_t threshold);
+
 bool virNetClientIsEncrypted(virNetClientPtr client);
 bool virNetClientIsOpen(virNetClientPtr client);
 
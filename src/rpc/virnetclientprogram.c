@@ -115,21 +115,18 @@ int virNetClientProgramMatches(virNetClientProgramPtr prog,
 }
 
 
-static int
-virNetClientProgramDispatchError(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
-                                 virNetMessagePtr msg)
+/*
+ * @err: the error received from the server
+ *
+ * Raise an error which was received from the server as the
+ * local thread's last error.
+ */
+void
+virNetClientProgramReportError(virNetMessageErrorPtr err)
 {
-    virNetMessageError err;
-    int ret = -1;
-
-    memset(&err, 0, sizeof(err));
-
-    if (virNetMessageDecodePayload(msg, (xdrproc_t)xdr_virNetMessageError, &err) < 0)
-        goto cleanup;
-
     /* Interop for virErrorNumber glitch in 0.8.0, if server is
      * 0.7.1 through 0.7.7; see comments in virterror.h. */
-    switch (err.code) {
+    switch (err->code) {
     case VIR_WAR_NO_NWFILTER:
         /* no way to tell old VIR_WAR_NO_SECRET apart from
          * VIR_WAR_NO_NWFILTER, but both are very similar
@@ -140,49 +137,65 @@ virNetClientProgramDispatchError(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
     case VIR_ERR_BUILD_FIREWALL:
         /* server was trying to pass VIR_ERR_INVALID_SECRET,
          * VIR_ERR_NO_SECRET, or VIR_ERR_CONFIG_UNSUPPORTED */
-        if (err.domain != VIR_FROM_NWFILTER)
-            err.code += 4;
+        if (err->domain != VIR_FROM_NWFILTER)
+            err->code += 4;
         break;
     case VIR_WAR_NO_SECRET:
-        if (err.domain == VIR_FROM_QEMU)
-            err.code = VIR_ERR_OPERATION_TIMEOUT;
+        if (err->domain == VIR_FROM_QEMU)
+            err->code = VIR_ERR_OPERATION_TIMEOUT;
         break;
     case VIR_ERR_INVALID_SECRET:
-        if (err.domain == VIR_FROM_XEN)
-            err.code = VIR_ERR_MIGRATE_PERSIST_FAILED;
+        if (err->domain == VIR_FROM_XEN)
+            err->code = VIR_ERR_MIGRATE_PERSIST_FAILED;
         break;
     default:
         /* Nothing to alter. */
         break;
     }
 
-    if ((err.domain == VIR_FROM_REMOTE || err.domain == VIR_FROM_RPC) &&
-        err.code == VIR_ERR_RPC &&
-        err.level == VIR_ERR_ERROR &&
-        err.message &&
-        STRPREFIX(*err.message, "unknown procedure")) {
+    if ((err->domain == VIR_FROM_REMOTE || err->domain == VIR_FROM_RPC) &&
+        err->code == VIR_ERR_RPC &&
+        err->level == VIR_ERR_ERROR &&
+        err->message &&
+        STRPREFIX(*err->message, "unknown procedure")) {
         virRaiseErrorFull(__FILE__, __FUNCTION__, __LINE__,
-                          err.domain,
+                          err->domain,
                           VIR_ERR_NO_SUPPORT,
-                          err.level,
-                          err.str1 ? *err.str1 : NULL,
-                          err.str2 ? *err.str2 : NULL,
-                          err.str3 ? *err.str3 : NULL,
-                          err.int1,
-                          err.int2,
-                          "%s", *err.message);
+                          err->level,
+                          err->str1 ? *err->str1 : NULL,
+                          err->str2 ? *err->str2 : NULL,
+                          err->str3 ? *err->str3 : NULL,
+                          err->int1,
+                          err->int2,
+                          "%s", *err->message);
     } else {
         virRaiseErrorFull(__FILE__, __FUNCTION__, __LINE__,
-                          err.domain,
-                          err.code,
-                          err.level,
-                          err.str1 ? *err.str1 : NULL,
-                          err.str2 ? *err.str2 : NULL,
-                          err.str3 ? *err.str3 : NULL,
-                          err.int1,
-                          err.int2,
-                          "%s", err.message ? *err.message : _("Unknown error"));
+                          err->domain,
+                          err->code,
+                          err->level,
+                          err->str1 ? *err->str1 : NULL,
+                          err->str2 ? *err->str2 : NULL,
+                          err->str3 ? *err->str3 : NULL,
+                          err->int1,
+                          err->int2,
+                          "%s", err->message ? *err->message : _("Unknown error"));
     }
+}
+
+
+static int
+virNetClientProgramDispatchError(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
+                                 virNetMessagePtr msg)
+{
+    virNetMessageError err;
+    int ret = -1;
+
+    memset(&err, 0, sizeof(err));
+
+    if (virNetMessageDecodePayload(msg, (xdrproc_t)xdr_virNetMessageError, &err) < 0)
+        goto cleanup;
+
+    virNetClientProgramReportError(&err);
 
     ret = 0;
 
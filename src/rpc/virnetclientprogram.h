@@ -70,6 +70,9 @@ int virNetClientProgramDispatch(virNetClientProgramPtr prog,
                                 virNetClientPtr client,
                                 virNetMessagePtr msg);
 
+void virNetClientProgramReportError(virNetMessageErrorPtr err)
+    ATTRIBUTE_NONNULL(1);
+
 int virNetClientProgramCall(virNetClientProgramPtr prog,
                             virNetClientPtr client,
                             unsigned serial,
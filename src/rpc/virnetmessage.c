@@ -221,7 +221,7 @@ int virNetMessageEncodeHeader(virNetMessagePtr msg)
     int ret = -1;
     unsigned int len = 0;
 
-    msg->bufferLength = VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX;
+    msg->bufferLength = VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX;
     if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0) {
         virReportOOMError();
         return ret;
@@ -351,9 +351,28 @@ int virNetMessageEncodePayload(virNetMessagePtr msg,
     xdrmem_create(&xdr, msg->buffer + msg->bufferOffset,
                   msg->bufferLength - msg->bufferOffset, XDR_ENCODE);
 
-    if (!(*filter)(&xdr, data)) {
-        virReportError(VIR_ERR_RPC, "%s", _("Unable to encode message payload"));
-        goto error;
+    /* Try to encode the payload. If the buffer is too small, grow
+     * it and start over, until we hit the message size limit */
+    while (!(*filter)(&xdr, data)) {
+        size_t newlen = (msg->bufferLength - VIR_NET_MESSAGE_LEN_MAX) * 4;
+
+        if (newlen > VIR_NET_MESSAGE_MAX) {
+            virReportError(VIR_ERR_RPC, "%s", _("Unable to encode message payload"));
+            goto error;
+        }
+
+        xdr_destroy(&xdr);
+
+        msg->bufferLength = newlen + VIR_NET_MESSAGE_LEN_MAX;
+        if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0) {
+            virReportOOMError();
+            return -1;
+        }
+
+        xdrmem_create(&xdr, msg->buffer + msg->bufferOffset,
+                      msg->bufferLength - msg->bufferOffset, XDR_ENCODE);
+
+        VIR_DEBUG("Increased message buffer length = %zu", msg->bufferLength);
     }
 
     /* Get the length stored in buffer. */
@@ -415,11 +434,25 @@ int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
     XDR xdr;
     unsigned int msglen;
 
+    /* If the message buffer is too small for the payload, grow it */
     if ((msg->bufferLength - msg->bufferOffset) < len) {
-        virReportError(VIR_ERR_RPC,
-                    _("Stream data too long to send (%zu bytes needed, %zu bytes available)"),
-                    len, (msg->bufferLength - msg->bufferOffset));
-        return -1;
+        if ((msg->bufferOffset + len) >
+            (VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX)) {
+            virReportError(VIR_ERR_RPC,
+                           _("Stream data too long to send (%zu bytes needed, %zu bytes available)"),
+                           len, (VIR_NET_MESSAGE_MAX +
+                                 VIR_NET_MESSAGE_LEN_MAX -
+                                 msg->bufferOffset));
+            return -1;
+        }
+
+        msg->bufferLength = msg->bufferOffset + len;
+        if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0) {
+            virReportOOMError();
+            return -1;
+        }
+
+        VIR_DEBUG("Increased message buffer length = %zu", msg->bufferLength);
     }
 
     memcpy(msg->buffer + msg->bufferOffset, data, len);
@@ -470,6 +503,54 @@ error:
 }
 
 
+/*
+ * Encode @data on its own into a newly allocated buffer, which is
+ * grown as needed like the message buffer, up to @maxlen, and then
+ * shrunk to fit. Used for the payloads embedded in compound calls.
+ */
+int virNetMessageEncodeData(xdrproc_t filter,
+                            void *data,
+                            size_t maxlen,
+                            char **buf,
+                            size_t *buflen)
+{
+    XDR xdr;
+    char *tmp = NULL;
+    size_t len = MIN(VIR_NET_MESSAGE_DATA_INITIAL, maxlen);
+
+    for (;;) {
+        VIR_FREE(tmp);
+        if (VIR_ALLOC_N(tmp, len) < 0) {
+            virReportOOMError();
+            goto error;
+        }
+
+        xdrmem_create(&xdr, tmp, len, XDR_ENCODE);
+        if ((*filter)(&xdr, data))
+            break;
+        xdr_destroy(&xdr);
+
+        if (len == maxlen) {
+            virReportError(VIR_ERR_RPC, "%s", _("Unable to encode data, too large"));
+            goto error;
+        }
+        len = MIN(len * 4, maxlen);
+    }
+
+    *buflen = xdr_getpos(&xdr);
+    xdr_destroy(&xdr);
+
+    /* Shrinking can't fail, and an empty encoding is still allocated */
+    ignore_value(VIR_REALLOC_N(tmp, MAX(*buflen, 1)));
+    *buf = tmp;
+    return 0;
+
+error:
+    VIR_FREE(tmp);
+    return -1;
+}
+
+
 void virNetMessageSaveError(virNetMessageErrorPtr rerr)
 {
     /* This func may be called several times & the first
@@ -34,7 +34,7 @@ typedef void (*virNetMessageFreeCallback)(virNetMessagePtr msg, void *opaque);
 struct _virNetMessage {
     bool tracked;
 
-    char *buffer; /* Typically VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX */
+    char *buffer; /* Initially VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX */
     size_t bufferLength;
     size_t bufferOffset;
 
@@ -89,6 +89,17 @@ int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
 int virNetMessageEncodePayloadEmpty(virNetMessagePtr msg)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 
+/* Starting size of the buffer of virNetMessageEncodeData */
+# define VIR_NET_MESSAGE_DATA_INITIAL 1024
+
+int virNetMessageEncodeData(xdrproc_t filter,
+                            void *data,
+                            size_t maxlen,
+                            char **buf,
+                            size_t *buflen)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(4) ATTRIBUTE_NONNULL(5)
+    ATTRIBUTE_RETURN_CHECK;
+
 void virNetMessageSaveError(virNetMessageErrorPtr rerr)
     ATTRIBUTE_NONNULL(1);
 
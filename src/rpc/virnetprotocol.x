@@ -44,6 +44,12 @@
 
 /*----- Data types. -----*/
 
+/* Initial message size.
+ * When the message is being encoded, the buffer starts at this size
+ * and is grown as needed, up to VIR_NET_MESSAGE_MAX.
+ */
+const VIR_NET_MESSAGE_INITIAL = 65536;
+
 /* Maximum total message size (serialised). */
 const VIR_NET_MESSAGE_MAX = 4194304;
 
@@ -37,6 +37,9 @@
 #include "virfile.h"
 #include "virnetservermdns.h"
 #include "virdbus.h"
+#include "virhash.h"
+#include "virhashcode.h"
+#include "virtime.h"
 
 #ifndef SA_SIGINFO
 # define SA_SIGINFO 0
@@ -61,6 +64,38 @@ struct _virNetServerJob {
     virNetServerClientPtr client;
     virNetMessagePtr msg;
     virNetServerProgramPtr prog;
+    unsigned long long queued;
+
+    virNetServerJobPtr next;
+};
+
+/* A token bucket holding thousandths of a request, so that
+ * refills at low rates don't get lost to integer rounding */
+typedef struct _virNetServerBucket virNetServerBucket;
+typedef virNetServerBucket *virNetServerBucketPtr;
+
+struct _virNetServerBucket {
+    unsigned long long tokens;
+    unsigned long long stamp;
+};
+
+/* Per-client queue of bulk (non-priority) jobs. Workers take one
+ * job per ready flow in turn, so a single busy client can't starve
+ * the others of worker threads */
+typedef struct _virNetServerFlow virNetServerFlow;
+typedef virNetServerFlow *virNetServerFlowPtr;
+
+struct _virNetServerFlow {
+    virNetServerClientPtr client;
+
+    virNetServerJobPtr head;
+    virNetServerJobPtr tail;
+    size_t njobs;
+
+    virNetServerBucket bucket;
+
+    bool ready;
+    virNetServerFlowPtr next;
 };
 
 struct _virNetServer {
@@ -94,6 +129,25 @@ struct _virNetServer {
     unsigned int keepaliveCount;
     bool keepaliveRequired;
 
+    /* Fair queueing of bulk jobs: flows keyed by client, of
+     * which the non-empty ones are linked in round-robin order */
+    virHashTablePtr flows;
+    virNetServerFlowPtr readyHead;
+    virNetServerFlowPtr readyTail;
+    size_t nqueued;
+
+    /* Rate limits in requests per second, 0 for unlimited */
+    unsigned int clientRate;
+    unsigned int clientBurst;
+    unsigned int procRate;
+    unsigned int procBurst;
+    virHashTablePtr procBuckets;
+
+    /* Number of dequeue attempts that found every pending job
+     * throttled, to be retried when throttleTimer fires */
+    size_t deferred;
+    int throttleTimer;
+
     unsigned int quit :1;
 
 #ifdef WITH_GNUTLS
@@ -172,28 +226,482 @@ cleanup:
     return ret;
 }
 
+static void virNetServerJobFree(virNetServerJobPtr job)
+{
+    if (!job)
+        return;
+
+    virObjectUnref(job->prog);
+    virNetMessageFree(job->msg);
+    virObjectUnref(job->client);
+    VIR_FREE(job);
+}
+
+
+static uint32_t virNetServerFlowCode(const void *name, uint32_t seed)
+{
+    unsigned long client = (unsigned long)(intptr_t)name;
+    return virHashCodeGen(&client, sizeof(client), seed);
+}
+static bool virNetServerFlowEqual(const void *namea, const void *nameb)
+{
+    return namea == nameb;
+}
+static void *virNetServerFlowCopy(const void *name)
+{
+    return (void*)name;
+}
+
+static void virNetServerFlowFree(void *payload,
+                                 const void *name ATTRIBUTE_UNUSED)
+{
+    virNetServerFlowPtr flow = payload;
+    virNetServerJobPtr job;
+
+    while ((job = flow->head)) {
+        flow->head = job->next;
+        virNetServerJobFree(job);
+    }
+    virObjectUnref(flow->client);
+    VIR_FREE(flow);
+}
+
+static void virNetServerBucketFree(void *payload,
+                                   const void *name ATTRIBUTE_UNUSED)
+{
+    VIR_FREE(payload);
+}
+
+
+/*
+ * Top up @bucket for the time elapsed since it was last
+ * looked at, and return 0 if it holds a whole token, or
+ * the number of milliseconds until it will.
+ */
+static unsigned long long
+virNetServerBucketWait(virNetServerBucketPtr bucket,
+                       unsigned int rate,
+                       unsigned int burst,
+                       unsigned long long now)
+{
+    unsigned long long max = 1000ULL * (burst ? burst : 1);
+
+    if (!rate)
+        return 0;
+
+    if (!bucket->stamp) {
+        bucket->tokens = max;
+    } else if (now > bucket->stamp) {
+        bucket->tokens += (now - bucket->stamp) * rate;
+        if (bucket->tokens > max)
+            bucket->tokens = max;
+    }
+    bucket->stamp = now;
+
+    if (bucket->tokens >= 1000)
+        return 0;
+
+    return (1000 - bucket->tokens + rate - 1) / rate;
+}
+
+static void
+virNetServerBucketTake(virNetServerBucketPtr bucket,
+                       unsigned int rate)
+{
+    if (rate)
+        bucket->tokens -= 1000;
+}
+
+
+static virNetServerBucketPtr
+virNetServerProcBucket(virNetServerPtr srv,
+                       virNetMessagePtr msg)
+{
+    virNetServerBucketPtr bucket;
+    char key[32];
+
+    snprintf(key, sizeof(key), "%u:%d", msg->header.prog, msg->header.proc);
+
+    if ((bucket = virHashLookup(srv->procBuckets, key)))
+        return bucket;
+
+    if (VIR_ALLOC(bucket) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    if (virHashAddEntry(srv->procBuckets, key, bucket) < 0) {
+        VIR_FREE(bucket);
+        return NULL;
+    }
+
+    return bucket;
+}
+
+
+static void virNetServerFlowPushReady(virNetServerPtr srv,
+                                      virNetServerFlowPtr flow)
+{
+    flow->next = NULL;
+    if (srv->readyTail)
+        srv->readyTail->next = flow;
+    else
+        srv->readyHead = flow;
+    srv->readyTail = flow;
+}
+
+static virNetServerFlowPtr virNetServerFlowPopReady(virNetServerPtr srv)
+{
+    virNetServerFlowPtr flow = srv->readyHead;
+
+    if (!flow)
+        return NULL;
+
+    srv->readyHead = flow->next;
+    if (!srv->readyHead)
+        srv->readyTail = NULL;
+    flow->next = NULL;
+    return flow;
+}
+
+
+/*
+ * Queue a bulk @job on the flow of its client.
+ * Must be called with @srv locked.
+ */
+static int virNetServerFlowEnqueue(virNetServerPtr srv,
+                                   virNetServerJobPtr job)
+{
+    virNetServerFlowPtr flow;
+
+    if (!(flow = virHashLookup(srv->flows, job->client))) {
+        if (VIR_ALLOC(flow) < 0) {
+            virReportOOMError();
+            return -1;
+        }
+        flow->client = virObjectRef(job->client);
+
+        if (virHashAddEntry(srv->flows, job->client, flow) < 0) {
+            virObjectUnref(flow->client);
+            VIR_FREE(flow);
+            return -1;
+        }
+    }
+
+    if (flow->tail)
+        flow->tail->next = job;
+    else
+        flow->head = job;
+    flow->tail = job;
+    flow->njobs++;
+    srv->nqueued++;
+
+    if (!flow->ready) {
+        flow->ready = true;
+        virNetServerFlowPushReady(srv, flow);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Take back @job, which must be the last one queued on the flow
+ * of its client. Must be called with @srv locked.
+ */
+static void virNetServerFlowUnqueue(virNetServerPtr srv,
+                                    virNetServerJobPtr job)
+{
+    virNetServerFlowPtr flow = virHashLookup(srv->flows, job->client);
+    virNetServerFlowPtr prev;
+    virNetServerJobPtr last = NULL;
+
+    if (flow->head != job) {
+        for (last = flow->head; last->next != job; last = last->next)
+            ;
+        last->next = NULL;
+    } else {
+        flow->head = NULL;
+    }
+    flow->tail = last;
+    flow->njobs--;
+    srv->nqueued--;
+
+    if (flow->head)
+        return;
+
+    flow->ready = false;
+    if (srv->readyHead == flow) {
+        srv->readyHead = flow->next;
+        prev = NULL;
+    } else {
+        for (prev = srv->readyHead; prev->next != flow; prev = prev->next)
+            ;
+        prev->next = flow->next;
+    }
+    if (srv->readyTail == flow)
+        srv->readyTail = prev;
+    flow->next = NULL;
+}
+
+
+/*
+ * Take the next bulk job, visiting the clients with queued
+ * work in round-robin order and skipping those whose client
+ * or procedure rate limit is exhausted at @now, in milliseconds,
+ * or ignoring the limits if @now is 0. If nothing may run
+ * right now, NULL is returned and @wait is set to the number
+ * of milliseconds until something might, or 0 if the queue
+ * is simply empty. Must be called with @srv locked.
+ */
+static virNetServerJobPtr
+virNetServerFlowDequeue(virNetServerPtr srv,
+                        unsigned long long now,
+                        unsigned long long *wait)
+{
+    virNetServerFlowPtr first = NULL;
+    virNetServerFlowPtr flow;
+    bool limited = now && (srv->clientRate || srv->procRate);
+
+    *wait = 0;
+
+    while (srv->readyHead && srv->readyHead != first) {
+        virNetServerJobPtr job;
+        virNetServerBucketPtr procBucket = NULL;
+        unsigned long long delay = 0;
+
+        flow = virNetServerFlowPopReady(srv);
+        job = flow->head;
+
+        /* Let a closed client's backlog drain without delay */
+        if (limited && !virNetServerClientIsClosed(flow->client)) {
+            unsigned long long procDelay = 0;
+
+            delay = virNetServerBucketWait(&flow->bucket,
+                                           srv->clientRate,
+                                           srv->clientBurst,
+                                           now);
+
+            if (srv->procRate && job->prog &&
+                (procBucket = virNetServerProcBucket(srv, job->msg)))
+                procDelay = virNetServerBucketWait(procBucket,
+                                                   srv->procRate,
+                                                   srv->procBurst,
+                                                   now);
+            if (procDelay > delay)
+                delay = procDelay;
+        }
+
+        if (delay) {
+            PROBE(RPC_SERVER_JOB_THROTTLE,
+                  "server=%p client=%p prog=%d proc=%d delay=%llu",
+                  srv, flow->client, job->msg->header.prog,
+                  job->msg->header.proc, delay);
+
+            if (!*wait || delay < *wait)
+                *wait = delay;
+            if (!first)
+                first = flow;
+            virNetServerFlowPushReady(srv, flow);
+            continue;
+        }
+
+        if (limited) {
+            virNetServerBucketTake(&flow->bucket, srv->clientRate);
+            if (procBucket)
+                virNetServerBucketTake(procBucket, srv->procRate);
+        }
+
+        flow->head = job->next;
+        if (!flow->head)
+            flow->tail = NULL;
+        flow->njobs--;
+        srv->nqueued--;
+        job->next = NULL;
+
+        if (flow->head)
+            virNetServerFlowPushReady(srv, flow);
+        else
+            flow->ready = false;
+
+        return job;
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Forget the flow of @client once it has no queued work and
+ * the client has gone away. Must be called with @srv locked.
+ */
+static void virNetServerFlowRelease(virNetServerPtr srv,
+                                    virNetServerClientPtr client)
+{
+    virNetServerFlowPtr flow;
+
+    if (!(flow = virHashLookup(srv->flows, client)) ||
+        flow->njobs)
+        return;
+
+    virHashRemoveEntry(srv->flows, client);
+}
+
+
+/* NB, these are not static as we need to call them from the testsuite */
+int virNetServerFlowPush(virNetServerPtr srv,
+                         virNetServerClientPtr client,
+                         virNetServerProgramPtr prog,
+                         virNetMessagePtr msg);
+virNetMessagePtr virNetServerFlowPop(virNetServerPtr srv,
+                                     unsigned long long now,
+                                     virNetServerClientPtr *client,
+                                     unsigned long long *wait);
+
+/*
+ * Queue @msg of @client for @prog as virNetServerDispatchNewMessage
+ * does with bulk work, but without waking up a worker for it.
+ */
+int virNetServerFlowPush(virNetServerPtr srv,
+                         virNetServerClientPtr client,
+                         virNetServerProgramPtr prog,
+                         virNetMessagePtr msg)
+{
+    virNetServerJobPtr job;
+    int ret;
+
+    if (VIR_ALLOC(job) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    job->client = virObjectRef(client);
+    job->prog = virObjectRef(prog);
+    job->msg = msg;
+
+    virObjectLock(srv);
+    ret = virNetServerFlowEnqueue(srv, job);
+    virObjectUnlock(srv);
+
+    if (ret < 0) {
+        job->msg = NULL;
+        virNetServerJobFree(job);
+    }
+    return ret;
+}
+
+/*
+ * Take the message a worker would process next at @now, and
+ * the client which sent it, or NULL and @wait as explained in
+ * virNetServerFlowDequeue.
+ */
+virNetMessagePtr virNetServerFlowPop(virNetServerPtr srv,
+                                     unsigned long long now,
+                                     virNetServerClientPtr *client,
+                                     unsigned long long *wait)
+{
+    virNetServerJobPtr job;
+    virNetMessagePtr msg;
+
+    virObjectLock(srv);
+    job = virNetServerFlowDequeue(srv, now, wait);
+    virObjectUnlock(srv);
+
+    if (!job)
+        return NULL;
+
+    *client = job->client;
+    msg = job->msg;
+    job->msg = NULL;
+    virNetServerJobFree(job);
+    return msg;
+}
+
+
+static void virNetServerThrottleTimer(int timerid ATTRIBUTE_UNUSED,
+                                      void *opaque)
+{
+    virNetServerPtr srv = opaque;
+    size_t retry;
+
+    virObjectLock(srv);
+
+    virEventUpdateTimeout(srv->throttleTimer, -1);
+
+    retry = MIN(srv->deferred, srv->nqueued);
+    srv->deferred = 0;
+
+    VIR_DEBUG("server=%p retry=%zu queued=%zu", srv, retry, srv->nqueued);
+
+    while (retry--) {
+        if (virThreadPoolSendJob(srv->workers, 0, NULL) < 0) {
+            srv->deferred = retry + 1;
+            virEventUpdateTimeout(srv->throttleTimer, 1000);
+            break;
+        }
+    }
+
+    virObjectUnlock(srv);
+}
+
+
 static void virNetServerHandleJob(void *jobOpaque, void *opaque)
 {
     virNetServerPtr srv = opaque;
     virNetServerJobPtr job = jobOpaque;
+    unsigned long long now;
+
+    /* Bulk jobs are queued per client, and the thread pool only
+     * gets an empty placeholder telling us to take the next one */
+    if (!job) {
+        unsigned long long wait;
+
+        if (virTimeMillisNow(&now) < 0) {
+            VIR_WARN("Unable to read clock, ignoring rate limits");
+            virResetLastError();
+            now = 0;
+        }
+
+        virObjectLock(srv);
+        if (!(job = virNetServerFlowDequeue(srv, now, &wait)) && wait) {
+            srv->deferred++;
+            virEventUpdateTimeout(srv->throttleTimer, wait);
+        }
+        virObjectUnlock(srv);
+
+        if (!job)
+            return;
+    }
 
-    VIR_DEBUG("server=%p client=%p message=%p prog=%p",
-              srv, job->client, job->msg, job->prog);
+    if (virTimeMillisNow(&now) < 0) {
+        virResetLastError();
+        now = job->queued;
+    }
+
+    VIR_DEBUG("server=%p client=%p message=%p prog=%p waited=%llums",
+              srv, job->client, job->msg, job->prog, now - job->queued);
+
+    PROBE(RPC_SERVER_JOB_DISPATCH,
+          "server=%p client=%p prog=%d proc=%d wait=%llu",
+          srv, job->client, job->msg->header.prog,
+          job->msg->header.proc, now - job->queued);
 
     if (virNetServerProcessMsg(srv, job->client, job->prog, job->msg) < 0)
         goto error;
 
-    virObjectUnref(job->prog);
-    virObjectUnref(job->client);
-    VIR_FREE(job);
-    return;
+    job->msg = NULL;
+    goto cleanup;
 
 error:
-    virObjectUnref(job->prog);
-    virNetMessageFree(job->msg);
     virNetServerClientClose(job->client);
-    virObjectUnref(job->client);
-    VIR_FREE(job);
+
+cleanup:
+    if (virNetServerClientIsClosed(job->client)) {
+        virObjectLock(srv);
+        virNetServerFlowRelease(srv, job->client);
+        virObjectUnlock(srv);
+    }
+    virNetServerJobFree(job);
 }
 
 static int virNetServerDispatchNewMessage(virNetServerClientPtr client,
@@ -225,6 +733,11 @@ static int virNetServerDispatchNewMessage(virNetServerClientPtr client,
             goto cleanup;
         }
 
+        if (virTimeMillisNow(&job->queued) < 0) {
+            VIR_FREE(job);
+            goto cleanup;
+        }
+
         job->client = client;
         job->msg = msg;
 
@@ -234,7 +747,21 @@ static int virNetServerDispatchNewMessage(virNetServerClientPtr client,
             priority = virNetServerProgramGetPriority(prog, msg->header.proc);
         }
 
-        ret = virThreadPoolSendJob(srv->workers, priority, job);
+        PROBE(RPC_SERVER_JOB_QUEUE,
+              "server=%p client=%p prog=%d proc=%d priority=%u queued=%zu",
+              srv, client, msg->header.prog, msg->header.proc,
+              priority, srv->nqueued);
+
+        /* Priority work, and the error replies for unknown
+         * programs, bypass the per-client queues entirely */
+        if (priority || !prog) {
+            ret = virThreadPoolSendJob(srv->workers, priority, job);
+        } else if ((ret = virNetServerFlowEnqueue(srv, job)) == 0 &&
+                   (ret = virThreadPoolSendJob(srv->workers, 0, NULL)) < 0) {
+            /* No worker would ever be told to take it. Since @srv
+             * is still locked, it is the last job of its flow */
+            virNetServerFlowUnqueue(srv, job);
+        }
 
         if (ret < 0) {
             VIR_FREE(job);
@@ -308,6 +835,9 @@ static int virNetServerDispatchNewClient(virNetServerServicePtr svc,
                                          srv->clientPrivOpaque)))
         return -1;
 
+    virNetServerClientSetCompressThreshold(client,
+                                           virNetServerServiceGetCompressThreshold(svc));
+
     if (virNetServerAddClient(srv, client) < 0) {
         virNetServerClientClose(client);
         virObjectUnref(client);
@@ -386,6 +916,18 @@ virNetServerPtr virNetServerNew(size_t min_workers,
     srv->clientPrivOpaque = clientPrivOpaque;
     srv->privileged = geteuid() == 0;
     srv->autoShutdownInhibitFd = -1;
+    srv->throttleTimer = -1;
+
+    if (!(srv->flows = virHashCreateFull(32,
+                                         virNetServerFlowFree,
+                                         virNetServerFlowCode,
+                                         virNetServerFlowEqual,
+                                         virNetServerFlowCopy,
+                                         NULL)))
+        goto error;
+
+    if (!(srv->procBuckets = virHashCreate(32, virNetServerBucketFree)))
+        goto error;
 
     if (mdnsGroupName &&
         !(srv->mdnsGroupName = strdup(mdnsGroupName))) {
@@ -1121,6 +1663,9 @@ void virNetServerRun(virNetServerPtr srv)
                 virNetServerClientClose(srv->clients[i]);
             if (virNetServerClientIsClosed(srv->clients[i])) {
                 virNetServerClientPtr client = srv->clients[i];
+
+                virNetServerFlowRelease(srv, client);
+
                 if (srv->nclients > 1) {
                     memmove(srv->clients + i,
                             srv->clients + i + 1,
@@ -1145,6 +1690,56 @@ cleanup:
 }
 
 
+/**
+ * virNetServerSetRateLimits:
+ * @srv: the server
+ * @clientRate: requests per second allowed from each client
+ * @clientBurst: requests a client may issue at once after idling
+ * @procRate: requests per second allowed for each procedure
+ * @procBurst: requests of one procedure allowed at once after idling
+ *
+ * Limit how fast non-priority requests are handed to the worker
+ * threads. Requests over the limit stay queued rather than being
+ * rejected. A rate of 0 disables the corresponding limit.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virNetServerSetRateLimits(virNetServerPtr srv,
+                              unsigned int clientRate,
+                              unsigned int clientBurst,
+                              unsigned int procRate,
+                              unsigned int procBurst)
+{
+    int ret = -1;
+
+    virObjectLock(srv);
+
+    if ((clientRate || procRate) &&
+        srv->workers && srv->throttleTimer < 0 &&
+        (srv->throttleTimer = virEventAddTimeout(-1,
+                                                 virNetServerThrottleTimer,
+                                                 srv, NULL)) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Failed to register rate limit timer"));
+        goto cleanup;
+    }
+
+    VIR_DEBUG("srv=%p clientRate=%u clientBurst=%u procRate=%u procBurst=%u",
+              srv, clientRate, clientBurst, procRate, procBurst);
+
+    srv->clientRate = clientRate;
+    srv->clientBurst = clientBurst;
+    srv->procRate = procRate;
+    srv->procBurst = procBurst;
+
+    ret = 0;
+
+cleanup:
+    virObjectUnlock(srv);
+    return ret;
+}
+
+
 void virNetServerQuit(virNetServerPtr srv)
 {
     virObjectLock(srv);
@@ -1167,6 +1762,12 @@ void virNetServerDispose(void *obj)
 
     virThreadPoolFree(srv->workers);
 
+    if (srv->throttleTimer >= 0)
+        virEventRemoveTimeout(srv->throttleTimer);
+    srv->readyHead = srv->readyTail = NULL;
+    virHashFree(srv->flows);
+    virHashFree(srv->procBuckets);
+
     for (i = 0 ; i < srv->nsignals ; i++) {
         sigaction(srv->signals[i]->signum, &srv->signals[i]->oldaction, NULL);
         VIR_FREE(srv->signals[i]);
@@ -89,6 +89,12 @@ int virNetServerSetTLSContext(virNetServerPtr srv,
 void virNetServerUpdateServices(virNetServerPtr srv,
                                 bool enabled);
 
+int virNetServerSetRateLimits(virNetServerPtr srv,
+                              unsigned int clientRate,
+                              unsigned int clientBurst,
+                              unsigned int procRate,
+                              unsigned int procBurst);
+
 void virNetServerRun(virNetServerPtr srv);
 
 void virNetServerQuit(virNetServerPtr srv);
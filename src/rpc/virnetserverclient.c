@@ -73,6 +73,9 @@ struct _virNetServerClient
 #if WITH_SASL
     virNetSASLSessionPtr sasl;
 #endif
+    /* Compression threshold allowed by the service, 0 if disallowed */
+    size_t compressThreshold;
+    bool compressPending;
     int sockTimer; /* Timer to be fired upon cached data,
                     * so we jump out from poll() immediately */
 
@@ -829,6 +832,44 @@ virNetSASLSessionPtr virNetServerClientGetSASLSession(virNetServerClientPtr clie
 #endif
 
 
+void virNetServerClientSetCompressThreshold(virNetServerClientPtr client,
+                                            size_t threshold)
+{
+    virObjectLock(client);
+    client->compressThreshold = threshold;
+    virObjectUnlock(client);
+}
+
+
+int virNetServerClientEnableCompression(virNetServerClientPtr client)
+{
+    int ret = -1;
+
+    virObjectLock(client);
+    if (client->compressThreshold == 0) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("compression is not enabled for this service"));
+        goto cleanup;
+    }
+
+#if WITH_ZLIB
+    /* As with SASL, the reply confirming this is sent out
+     * uncompressed. Only once we complete the next 'tx'
+     * operation do we switch the socket over
+     */
+    client->compressPending = true;
+    ret = 0;
+#else
+    virReportError(VIR_ERR_NO_SUPPORT, "%s",
+                   _("RPC compression requires zlib support"));
+#endif
+
+cleanup:
+    virObjectUnlock(client);
+    return ret;
+}
+
+
 void *virNetServerClientGetPrivateData(virNetServerClientPtr client)
 {
     void *data;
@@ -1321,6 +1362,15 @@ virNetServerClientDispatchWrite(virNetServerClientPtr client)
             }
 #endif
 
+            if (client->compressPending) {
+                client->compressPending = false;
+                if (virNetSocketSetCompression(client->sock,
+                                               client->compressThreshold) < 0) {
+                    client->wantClose = true;
+                    return;
+                }
+            }
+
             /* Get finished msg from head of tx queue */
             msg = virNetMessageQueueServe(&client->tx);
 
@@ -92,6 +92,10 @@ void virNetServerClientSetSASLSession(virNetServerClientPtr client,
 virNetSASLSessionPtr virNetServerClientGetSASLSession(virNetServerClientPtr client);
 # endif
 
+void virNetServerClientSetCompressThreshold(virNetServerClientPtr client,
+                                            size_t threshold);
+int virNetServerClientEnableCompression(virNetServerClientPtr client);
+
 int virNetServerClientGetFD(virNetServerClientPtr client);
 
 bool virNetServerClientIsSecure(virNetServerClientPtr client);
@@ -508,6 +508,128 @@ error:
 }
 
 
+/*
+ * @server: the unlocked server object
+ * @client: the unlocked client object
+ * @msg: the compound method call the sub-call is embedded in
+ * @procedure: the procedure number of the sub-call
+ * @args: the XDR encoded arguments of the sub-call
+ * @argslen: the length of @args
+ * @maxlen: the largest encoded reply allowed
+ * @reply: filled with the newly allocated encoded reply
+ * @replylen: filled with the length of @reply
+ *
+ * This method is used to dispatch a single method call which
+ * was embedded in a compound call by the client. It decodes
+ * the arguments, invokes the method and encodes either the
+ * return value or the error into @reply. Unlike a normal call,
+ * no reply packet is sent, that is left to the compound call.
+ *
+ * Returns VIR_NET_OK if the method succeeded, VIR_NET_ERROR if
+ * it failed and @buf holds an encoded virNetMessageError, or -1
+ * upon fatal error
+ */
+int
+virNetServerProgramDispatchSubCall(virNetServerProgramPtr prog,
+                                   virNetServerPtr server,
+                                   virNetServerClientPtr client,
+                                   virNetMessagePtr msg,
+                                   int procedure,
+                                   const char *args,
+                                   size_t argslen,
+                                   size_t maxlen,
+                                   char **reply,
+                                   size_t *replylen)
+{
+    char *arg = NULL;
+    char *ret = NULL;
+    int rv = -1;
+    virNetServerProgramProcPtr dispatcher;
+    virNetMessageError rerr;
+    XDR xdr;
+
+    memset(&rerr, 0, sizeof(rerr));
+
+    VIR_DEBUG("prog=%d ver=%d proc=%d argslen=%zu",
+              prog->program, prog->version, procedure, argslen);
+
+    dispatcher = virNetServerProgramGetProc(prog, procedure);
+
+    if (!dispatcher) {
+        virReportError(VIR_ERR_RPC,
+                       _("unknown procedure: %d"),
+                       procedure);
+        goto error;
+    }
+
+    if (!dispatcher->batchable) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("procedure %d cannot be used in a compound call"),
+                       procedure);
+        goto error;
+    }
+
+    if (virNetServerClientNeedAuth(client) &&
+        dispatcher->needAuth) {
+        virReportError(VIR_ERR_RPC,
+                       "%s", _("authentication required"));
+        goto error;
+    }
+
+    if (VIR_ALLOC_N(arg, dispatcher->arg_len) < 0) {
+        virReportOOMError();
+        goto error;
+    }
+    if (VIR_ALLOC_N(ret, dispatcher->ret_len) < 0) {
+        virReportOOMError();
+        goto error;
+    }
+
+    xdrmem_create(&xdr, (char *)args, argslen, XDR_DECODE);
+    if (!(*dispatcher->arg_filter)(&xdr, arg)) {
+        virReportError(VIR_ERR_RPC, "%s", _("Unable to decode sub-call arguments"));
+        xdr_destroy(&xdr);
+        /* release whatever was decoded before the failure */
+        xdr_free(dispatcher->arg_filter, arg);
+        goto error;
+    }
+    xdr_destroy(&xdr);
+
+    /*
+     * The identity of the client was already set by the
+     * compound call we're embedded in, and the server and
+     * client objects are unlocked, just as for normal calls.
+     */
+    rv = (dispatcher->func)(server, client, msg, &rerr, arg, ret);
+
+    xdr_free(dispatcher->arg_filter, arg);
+
+    if (rv < 0)
+        goto error;
+
+    rv = virNetMessageEncodeData(dispatcher->ret_filter, ret,
+                                 maxlen, reply, replylen);
+    xdr_free(dispatcher->ret_filter, ret);
+    if (rv < 0)
+        goto error;
+
+    VIR_FREE(arg);
+    VIR_FREE(ret);
+    return VIR_NET_OK;
+
+error:
+    virNetMessageSaveError(&rerr);
+    rv = virNetMessageEncodeData((xdrproc_t)xdr_virNetMessageError,
+                                 &rerr, maxlen, reply, replylen);
+    xdr_free((xdrproc_t)xdr_virNetMessageError, (void*)&rerr);
+
+    VIR_FREE(arg);
+    VIR_FREE(ret);
+
+    return rv < 0 ? -1 : VIR_NET_ERROR;
+}
+
+
 int virNetServerProgramSendStreamData(virNetServerProgramPtr prog,
                                       virNetServerClientPtr client,
                                       virNetMessagePtr msg,
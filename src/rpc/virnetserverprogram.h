@@ -55,6 +55,7 @@ struct _virNetServerProgramProc {
     xdrproc_t ret_filter;
     bool needAuth;
     unsigned int priority;
+    bool batchable;
 };
 
 virNetServerProgramPtr virNetServerProgramNew(unsigned program,
@@ -76,6 +77,17 @@ int virNetServerProgramDispatch(virNetServerProgramPtr prog,
                                 virNetServerClientPtr client,
                                 virNetMessagePtr msg);
 
+int virNetServerProgramDispatchSubCall(virNetServerProgramPtr prog,
+                                       virNetServerPtr server,
+                                       virNetServerClientPtr client,
+                                       virNetMessagePtr msg,
+                                       int procedure,
+                                       const char *args,
+                                       size_t argslen,
+                                       size_t maxlen,
+                                       char **reply,
+                                       size_t *replylen);
+
 int virNetServerProgramSendReplyError(virNetServerProgramPtr prog,
                                       virNetServerClientPtr client,
                                       virNetMessagePtr msg,
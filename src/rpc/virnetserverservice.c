@@ -40,6 +40,7 @@ struct _virNetServerService {
     int auth;
     bool readonly;
     size_t nrequests_client_max;
+    size_t compress_threshold;
 
 #if WITH_GNUTLS
     virNetTLSContextPtr tls;
@@ -297,6 +298,17 @@ virNetServerServicePtr virNetServerServiceNewPostExecRestart(virJSONValuePtr obj
     }
     svc->nrequests_client_max = max;
 
+    /* Optional, since older daemons did not record it */
+    if (virJSONValueObjectHasKey(object, "compress_threshold") == 1) {
+        if (virJSONValueObjectGetNumberUint(object, "compress_threshold",
+                                            &max) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Malformed compress_threshold field in JSON state document"));
+            goto error;
+        }
+        svc->compress_threshold = max;
+    }
+
     if (!(socks = virJSONValueObjectGet(object, "socks"))) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("Missing socks field in JSON state document"));
@@ -363,6 +375,9 @@ virJSONValuePtr virNetServerServicePreExecRestart(virNetServerServicePtr svc)
         goto error;
     if (virJSONValueObjectAppendNumberUint(object, "nrequests_client_max", svc->nrequests_client_max) < 0)
         goto error;
+    if (svc->compress_threshold &&
+        virJSONValueObjectAppendNumberUint(object, "compress_threshold", svc->compress_threshold) < 0)
+        goto error;
 
     if (!(socks = virJSONValueNewArray()))
         goto error;
@@ -416,6 +431,28 @@ size_t virNetServerServiceGetMaxRequests(virNetServerServicePtr svc)
     return svc->nrequests_client_max;
 }
 
+
+/**
+ * virNetServerServiceSetCompressThreshold:
+ * @svc: the service
+ * @threshold: minimum message chunk size to compress, or 0
+ *
+ * Allow clients of @svc to switch their connection to compressed
+ * I/O. Chunks of at least @threshold bytes sent by the server are
+ * then deflated. A @threshold of 0 disallows compression.
+ */
+void virNetServerServiceSetCompressThreshold(virNetServerServicePtr svc,
+                                             size_t threshold)
+{
+    svc->compress_threshold = threshold;
+}
+
+
+size_t virNetServerServiceGetCompressThreshold(virNetServerServicePtr svc)
+{
+    return svc->compress_threshold;
+}
+
 #if WITH_GNUTLS
 virNetTLSContextPtr virNetServerServiceGetTLSContext(virNetServerServicePtr svc)
 {
@@ -71,6 +71,9 @@ int virNetServerServiceGetPort(virNetServerServicePtr svc);
 int virNetServerServiceGetAuth(virNetServerServicePtr svc);
 bool virNetServerServiceIsReadonly(virNetServerServicePtr svc);
 size_t virNetServerServiceGetMaxRequests(virNetServerServicePtr svc);
+void virNetServerServiceSetCompressThreshold(virNetServerServicePtr svc,
+                                             size_t threshold);
+size_t virNetServerServiceGetCompressThreshold(virNetServerServicePtr svc);
 # ifdef WITH_GNUTLS
 virNetTLSContextPtr virNetServerServiceGetTLSContext(virNetServerServicePtr svc);
 # endif
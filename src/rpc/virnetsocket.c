@@ -59,8 +59,27 @@
 # include "virnetsshsession.h"
 #endif
 
+#if WITH_ZLIB
+# include <zlib.h>
+#endif
+
 #define VIR_FROM_THIS VIR_FROM_RPC
 
+#if WITH_ZLIB
+/*
+ * When compression is enabled every chunk of data on the wire is
+ * preceded by an 8 byte header holding two big endian words. The
+ * first is the length of the data following the header, with the
+ * top bit set if that data is deflated; the second is the length of
+ * the data once inflated. Chunks never hold more than
+ * VIR_NET_SOCKET_COMPRESS_CHUNK_MAX bytes of raw data, which bounds
+ * the buffers needed on either side.
+ */
+# define VIR_NET_SOCKET_COMPRESS_HEADER 8
+# define VIR_NET_SOCKET_COMPRESS_FLAG 0x80000000U
+# define VIR_NET_SOCKET_COMPRESS_CHUNK_MAX (64 * 1024)
+#endif
+
 
 struct _virNetSocket {
     virObjectLockable parent;
@@ -98,6 +117,23 @@ struct _virNetSocket {
 #if WITH_SSH2
     virNetSSHSessionPtr sshSession;
 #endif
+#if WITH_ZLIB
+    bool compress;
+    size_t compressThreshold;
+
+    char *compressRx;
+    size_t compressRxLength;
+    size_t compressRxOffset;
+
+    char *compressDecoded;
+    size_t compressDecodedLength;
+    size_t compressDecodedOffset;
+
+    char *compressEncoded;
+    size_t compressEncodedLength;
+    size_t compressEncodedOffset;
+    size_t compressEncodedRaw;
+#endif
 };
 
 
@@ -429,6 +465,28 @@ int virNetSocketNewListenFD(int fd,
 }
 
 
+int virNetSocketNewConnectSockFD(int sockfd,
+                                 virNetSocketPtr *retsock)
+{
+    virSocketAddr localAddr;
+
+    *retsock = NULL;
+
+    memset(&localAddr, 0, sizeof(localAddr));
+
+    localAddr.len = sizeof(localAddr.data);
+    if (getsockname(sockfd, &localAddr.data.sa, &localAddr.len) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to get local socket name"));
+        return -1;
+    }
+
+    if (!(*retsock = virNetSocketNew(&localAddr, NULL, true, sockfd, -1, 0)))
+        return -1;
+
+    return 0;
+}
+
+
 int virNetSocketNewConnectTCP(const char *nodename,
                               const char *service,
                               virNetSocketPtr *retsock)
@@ -956,6 +1014,13 @@ virJSONValuePtr virNetSocketPreExecRestart(virNetSocketPtr sock)
         goto error;
     }
 #endif
+#if WITH_ZLIB
+    if (sock->compress) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Unable to save socket state when compression is active"));
+        goto error;
+    }
+#endif
 
     if (!(object = virJSONValueNewObject()))
         goto error;
@@ -1030,6 +1095,12 @@ void virNetSocketDispose(void *obj)
     virObjectUnref(sock->sshSession);
 #endif
 
+#if WITH_ZLIB
+    VIR_FREE(sock->compressRx);
+    VIR_FREE(sock->compressDecoded);
+    VIR_FREE(sock->compressEncoded);
+#endif
+
     VIR_FORCE_CLOSE(sock->fd);
     VIR_FORCE_CLOSE(sock->errfd);
 
@@ -1282,6 +1353,11 @@ bool virNetSocketHasCachedData(virNetSocketPtr sock ATTRIBUTE_UNUSED)
     if (sock->saslDecoded)
         hasCached = true;
 #endif
+
+#if WITH_ZLIB
+    if (sock->compressDecodedOffset < sock->compressDecodedLength)
+        hasCached = true;
+#endif
     virObjectUnlock(sock);
     return hasCached;
 }
@@ -1309,6 +1385,10 @@ bool virNetSocketHasPendingData(virNetSocketPtr sock ATTRIBUTE_UNUSED)
 #if WITH_SASL
     if (sock->saslEncoded)
         hasPending = true;
+#endif
+#if WITH_ZLIB
+    if (sock->compressEncodedLength)
+        hasPending = true;
 #endif
     virObjectUnlock(sock);
     return hasPending;
@@ -1516,16 +1596,272 @@ static ssize_t virNetSocketWriteSASL(virNetSocketPtr sock, const char *buf, size
 }
 #endif
 
+static ssize_t virNetSocketReadRaw(virNetSocketPtr sock, char *buf, size_t len)
+{
+#if WITH_SASL
+    if (sock->saslSession)
+        return virNetSocketReadSASL(sock, buf, len);
+#endif
+    return virNetSocketReadWire(sock, buf, len);
+}
+
+
+static ssize_t virNetSocketWriteRaw(virNetSocketPtr sock, const char *buf, size_t len)
+{
+#if WITH_SASL
+    if (sock->saslSession)
+        return virNetSocketWriteSASL(sock, buf, len);
+#endif
+    return virNetSocketWriteWire(sock, buf, len);
+}
+
+
+#if WITH_ZLIB
+static int virNetSocketCompressParseHeader(const char *hdr,
+                                           bool *compressed,
+                                           size_t *wireLen,
+                                           size_t *rawLen)
+{
+    const unsigned char *data = (const unsigned char *)hdr;
+    uint32_t word0 = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+        ((uint32_t)data[2] << 8) | data[3];
+    uint32_t word1 = ((uint32_t)data[4] << 24) | ((uint32_t)data[5] << 16) |
+        ((uint32_t)data[6] << 8) | data[7];
+
+    *compressed = !!(word0 & VIR_NET_SOCKET_COMPRESS_FLAG);
+    *wireLen = word0 & ~VIR_NET_SOCKET_COMPRESS_FLAG;
+    *rawLen = word1;
+
+    if (*rawLen == 0 ||
+        *rawLen > VIR_NET_SOCKET_COMPRESS_CHUNK_MAX ||
+        *wireLen == 0 ||
+        *wireLen > compressBound(VIR_NET_SOCKET_COMPRESS_CHUNK_MAX) ||
+        (!*compressed && *wireLen != *rawLen)) {
+        virReportError(VIR_ERR_RPC,
+                       _("Malformed compressed chunk header, length %zu, raw length %zu"),
+                       *wireLen, *rawLen);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static void virNetSocketCompressFormatHeader(char *hdr,
+                                             bool compressed,
+                                             size_t wireLen,
+                                             size_t rawLen)
+{
+    unsigned char *data = (unsigned char *)hdr;
+    uint32_t word0 = wireLen;
+    uint32_t word1 = rawLen;
+
+    if (compressed)
+        word0 |= VIR_NET_SOCKET_COMPRESS_FLAG;
+
+    data[0] = (word0 >> 24) & 0xff;
+    data[1] = (word0 >> 16) & 0xff;
+    data[2] = (word0 >> 8) & 0xff;
+    data[3] = word0 & 0xff;
+    data[4] = (word1 >> 24) & 0xff;
+    data[5] = (word1 >> 16) & 0xff;
+    data[6] = (word1 >> 8) & 0xff;
+    data[7] = word1 & 0xff;
+}
+
+
+static ssize_t virNetSocketReadCompress(virNetSocketPtr sock, char *buf, size_t len)
+{
+    size_t got;
+
+    /* Need to read another whole chunk off the wire */
+    while (sock->compressDecodedOffset == sock->compressDecodedLength) {
+        bool compressed;
+        size_t wireLen;
+        size_t rawLen;
+        ssize_t ret;
+
+        if (sock->compressRxLength == 0)
+            sock->compressRxLength = VIR_NET_SOCKET_COMPRESS_HEADER;
+
+        ret = virNetSocketReadRaw(sock,
+                                  sock->compressRx + sock->compressRxOffset,
+                                  sock->compressRxLength - sock->compressRxOffset);
+        if (ret <= 0)
+            return ret;
+
+        sock->compressRxOffset += ret;
+        if (sock->compressRxOffset < sock->compressRxLength)
+            continue;
+
+        if (virNetSocketCompressParseHeader(sock->compressRx, &compressed,
+                                            &wireLen, &rawLen) < 0)
+            return -1;
+
+        /* Got the header, now go back for the payload */
+        if (sock->compressRxLength == VIR_NET_SOCKET_COMPRESS_HEADER) {
+            sock->compressRxLength += wireLen;
+            continue;
+        }
+
+        if (compressed) {
+            uLongf outLen = VIR_NET_SOCKET_COMPRESS_CHUNK_MAX;
+            if (uncompress((Bytef *)sock->compressDecoded, &outLen,
+                           (const Bytef *)sock->compressRx +
+                           VIR_NET_SOCKET_COMPRESS_HEADER,
+                           wireLen) != Z_OK ||
+                outLen != rawLen) {
+                virReportError(VIR_ERR_RPC, "%s",
+                               _("Unable to inflate compressed chunk"));
+                return -1;
+            }
+        } else {
+            memcpy(sock->compressDecoded,
+                   sock->compressRx + VIR_NET_SOCKET_COMPRESS_HEADER,
+                   rawLen);
+        }
+
+        sock->compressDecodedLength = rawLen;
+        sock->compressDecodedOffset = 0;
+        sock->compressRxLength = sock->compressRxOffset = 0;
+    }
+
+    /* Some buffered decoded data to return now */
+    got = sock->compressDecodedLength - sock->compressDecodedOffset;
+
+    if (len > got)
+        len = got;
+
+    memcpy(buf, sock->compressDecoded + sock->compressDecodedOffset, len);
+    sock->compressDecodedOffset += len;
+
+    if (sock->compressDecodedOffset == sock->compressDecodedLength)
+        sock->compressDecodedOffset = sock->compressDecodedLength = 0;
+
+    return len;
+}
+
+
+static ssize_t virNetSocketWriteCompress(virNetSocketPtr sock, const char *buf, size_t len)
+{
+    ssize_t ret;
+
+    /* Not got any pending encoded data, so we need to frame raw stuff */
+    if (sock->compressEncodedLength == 0) {
+        size_t tosend = len;
+        uLongf wireLen = compressBound(VIR_NET_SOCKET_COMPRESS_CHUNK_MAX);
+        char *payload = sock->compressEncoded + VIR_NET_SOCKET_COMPRESS_HEADER;
+        bool compressed = false;
+
+        if (tosend > VIR_NET_SOCKET_COMPRESS_CHUNK_MAX)
+            tosend = VIR_NET_SOCKET_COMPRESS_CHUNK_MAX;
+
+        /* Only keep the deflated copy if it actually saves something */
+        if (tosend >= sock->compressThreshold &&
+            compress2((Bytef *)payload, &wireLen,
+                      (const Bytef *)buf, tosend, Z_BEST_SPEED) == Z_OK &&
+            wireLen < tosend) {
+            compressed = true;
+        } else {
+            memcpy(payload, buf, tosend);
+            wireLen = tosend;
+        }
+
+        virNetSocketCompressFormatHeader(sock->compressEncoded, compressed,
+                                         wireLen, tosend);
+        sock->compressEncodedLength = VIR_NET_SOCKET_COMPRESS_HEADER + wireLen;
+        sock->compressEncodedOffset = 0;
+        sock->compressEncodedRaw = tosend;
+    }
+
+    /* Send some of the encoded stuff out on the wire */
+    ret = virNetSocketWriteRaw(sock,
+                               sock->compressEncoded + sock->compressEncodedOffset,
+                               sock->compressEncodedLength - sock->compressEncodedOffset);
+
+    if (ret <= 0)
+        return ret; /* -1 error, 0 == egain */
+
+    sock->compressEncodedOffset += ret;
+
+    /* Sent the whole chunk, so tell the caller how much raw data it held */
+    if (sock->compressEncodedOffset == sock->compressEncodedLength) {
+        ret = sock->compressEncodedRaw;
+        sock->compressEncodedLength = sock->compressEncodedOffset = 0;
+        sock->compressEncodedRaw = 0;
+        return ret;
+    }
+
+    /* Still have stuff pending, pretend we didn't send any
+     * yet so the caller retries with the same buffer */
+    return 0;
+}
+#endif
+
+
+/**
+ * virNetSocketSetCompression:
+ * @sock: the socket
+ * @threshold: minimum size in bytes of a chunk worth compressing
+ *
+ * Switch the socket to framed, compressed I/O in both directions.
+ * Data written in chunks of at least @threshold bytes is deflated
+ * before being sent, smaller chunks are sent as is. The peer must
+ * switch at the same point in the data stream, so this is only safe
+ * to call on a message boundary that both sides agreed upon.
+ *
+ * Returns 0 on success, -1 on error
+ */
+#if WITH_ZLIB
+int virNetSocketSetCompression(virNetSocketPtr sock,
+                               size_t threshold)
+{
+    int ret = -1;
+
+    virObjectLock(sock);
+
+    if (!sock->compress) {
+        if (VIR_ALLOC_N(sock->compressRx, VIR_NET_SOCKET_COMPRESS_HEADER +
+                        compressBound(VIR_NET_SOCKET_COMPRESS_CHUNK_MAX)) < 0 ||
+            VIR_ALLOC_N(sock->compressDecoded,
+                        VIR_NET_SOCKET_COMPRESS_CHUNK_MAX) < 0 ||
+            VIR_ALLOC_N(sock->compressEncoded, VIR_NET_SOCKET_COMPRESS_HEADER +
+                        compressBound(VIR_NET_SOCKET_COMPRESS_CHUNK_MAX)) < 0) {
+            virReportOOMError();
+            VIR_FREE(sock->compressRx);
+            VIR_FREE(sock->compressDecoded);
+            goto cleanup;
+        }
+        sock->compress = true;
+    }
+    sock->compressThreshold = threshold;
+    ret = 0;
+
+cleanup:
+    virObjectUnlock(sock);
+    return ret;
+}
+#else
+int virNetSocketSetCompression(virNetSocketPtr sock ATTRIBUTE_UNUSED,
+                               size_t threshold ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_NO_SUPPORT, "%s",
+                   _("RPC compression requires zlib support"));
+    return -1;
+}
+#endif
+
+
 ssize_t virNetSocketRead(virNetSocketPtr sock, char *buf, size_t len)
 {
     ssize_t ret;
     virObjectLock(sock);
-#if WITH_SASL
-    if (sock->saslSession)
-        ret = virNetSocketReadSASL(sock, buf, len);
+#if WITH_ZLIB
+    if (sock->compress)
+        ret = virNetSocketReadCompress(sock, buf, len);
     else
 #endif
-        ret = virNetSocketReadWire(sock, buf, len);
+        ret = virNetSocketReadRaw(sock, buf, len);
     virObjectUnlock(sock);
     return ret;
 }
@@ -1535,12 +1871,12 @@ ssize_t virNetSocketWrite(virNetSocketPtr sock, const char *buf, size_t len)
     ssize_t ret;
 
     virObjectLock(sock);
-#if WITH_SASL
-    if (sock->saslSession)
-        ret = virNetSocketWriteSASL(sock, buf, len);
+#if WITH_ZLIB
+    if (sock->compress)
+        ret = virNetSocketWriteCompress(sock, buf, len);
     else
 #endif
-        ret = virNetSocketWriteWire(sock, buf, len);
+        ret = virNetSocketWriteRaw(sock, buf, len);
     virObjectUnlock(sock);
     return ret;
 }
@@ -58,6 +58,9 @@ int virNetSocketNewListenUNIX(const char *path,
 int virNetSocketNewListenFD(int fd,
                             virNetSocketPtr *addr);
 
+int virNetSocketNewConnectSockFD(int sockfd,
+                                 virNetSocketPtr *retsock);
+
 int virNetSocketNewConnectTCP(const char *nodename,
                               const char *service,
                               virNetSocketPtr *addr);
@@ -135,6 +138,8 @@ void virNetSocketSetTLSSession(virNetSocketPtr sock,
 void virNetSocketSetSASLSession(virNetSocketPtr sock,
                                 virNetSASLSessionPtr sess);
 # endif
+int virNetSocketSetCompression(virNetSocketPtr sock,
+                               size_t threshold);
 bool virNetSocketHasCachedData(virNetSocketPtr sock);
 bool virNetSocketHasPendingData(virNetSocketPtr sock);
 
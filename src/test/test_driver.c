@@ -477,10 +477,13 @@ cleanup:
 }
 
 static void
-testDomainShutdownState(virDomainPtr domain,
+testDomainShutdownState(testConnPtr privconn,
+                        virDomainPtr domain,
                         virDomainObjPtr privdom,
                         virDomainShutoffReason reason)
 {
+    virDomainObjListSetID(privconn->domains, privdom, -1);
+
     if (privdom->newDef) {
         virDomainDefFree(privdom->def);
         privdom->def = privdom->newDef;
@@ -506,7 +509,7 @@ testDomainStartState(virConnectPtr conn,
         goto cleanup;
 
     virDomainObjSetState(dom, VIR_DOMAIN_RUNNING, reason);
-    dom->def->id = privconn->nextDomID++;
+    virDomainObjListSetID(privconn->domains, dom, privconn->nextDomID++);
 
     if (virDomainObjSetDefTransient(privconn->caps,
                                     privconn->xmlopt,
@@ -517,7 +520,7 @@ testDomainStartState(virConnectPtr conn,
     ret = 0;
 cleanup:
     if (ret < 0)
-        testDomainShutdownState(NULL, dom, VIR_DOMAIN_SHUTOFF_FAILED);
+        testDomainShutdownState(privconn, NULL, dom, VIR_DOMAIN_SHUTOFF_FAILED);
     return ret;
 }
 
@@ -1265,14 +1268,15 @@ static char *testConnectGetCapabilities(virConnectPtr conn)
     return xml;
 }
 
+/* The listing APIs only touch privconn->domains, which is set up
+ * at open, released at close and does its own locking, so they
+ * don't need the driver lock */
 static int testConnectNumOfDomains(virConnectPtr conn)
 {
     testConnPtr privconn = conn->privateData;
     int count;
 
-    testDriverLock(privconn);
     count = virDomainObjListNumOfDomains(privconn->domains, 1);
-    testDriverUnlock(privconn);
 
     return count;
 }
@@ -1459,9 +1463,7 @@ static int testConnectListDomains(virConnectPtr conn,
     testConnPtr privconn = conn->privateData;
     int n;
 
-    testDriverLock(privconn);
     n = virDomainObjListGetActiveIDs(privconn->domains, ids, maxids);
-    testDriverUnlock(privconn);
 
     return n;
 }
@@ -1482,7 +1484,7 @@ static int testDomainDestroy(virDomainPtr domain)
         goto cleanup;
     }
 
-    testDomainShutdownState(domain, privdom, VIR_DOMAIN_SHUTOFF_DESTROYED);
+    testDomainShutdownState(privconn, domain, privdom, VIR_DOMAIN_SHUTOFF_DESTROYED);
     event = virDomainEventNewFromObj(privdom,
                                      VIR_DOMAIN_EVENT_STOPPED,
                                      VIR_DOMAIN_EVENT_STOPPED_DESTROYED);
@@ -1612,7 +1614,7 @@ static int testDomainShutdownFlags(virDomainPtr domain,
         goto cleanup;
     }
 
-    testDomainShutdownState(domain, privdom, VIR_DOMAIN_SHUTOFF_SHUTDOWN);
+    testDomainShutdownState(privconn, domain, privdom, VIR_DOMAIN_SHUTOFF_SHUTDOWN);
     event = virDomainEventNewFromObj(privdom,
                                      VIR_DOMAIN_EVENT_STOPPED,
                                      VIR_DOMAIN_EVENT_STOPPED_SHUTDOWN);
@@ -1687,7 +1689,7 @@ static int testDomainReboot(virDomainPtr domain,
     }
 
     if (virDomainObjGetState(privdom, NULL) == VIR_DOMAIN_SHUTOFF) {
-        testDomainShutdownState(domain, privdom, VIR_DOMAIN_SHUTOFF_SHUTDOWN);
+        testDomainShutdownState(privconn, domain, privdom, VIR_DOMAIN_SHUTOFF_SHUTDOWN);
         event = virDomainEventNewFromObj(privdom,
                                          VIR_DOMAIN_EVENT_STOPPED,
                                          VIR_DOMAIN_EVENT_STOPPED_SHUTDOWN);
@@ -1851,7 +1853,7 @@ testDomainSaveFlags(virDomainPtr domain, const char *path,
     }
     fd = -1;
 
-    testDomainShutdownState(domain, privdom, VIR_DOMAIN_SHUTOFF_SAVED);
+    testDomainShutdownState(privconn, domain, privdom, VIR_DOMAIN_SHUTOFF_SAVED);
     event = virDomainEventNewFromObj(privdom,
                                      VIR_DOMAIN_EVENT_STOPPED,
                                      VIR_DOMAIN_EVENT_STOPPED_SAVED);
@@ -2037,7 +2039,7 @@ static int testDomainCoreDump(virDomainPtr domain,
     }
 
     if (flags & VIR_DUMP_CRASH) {
-        testDomainShutdownState(domain, privdom, VIR_DOMAIN_SHUTOFF_CRASHED);
+        testDomainShutdownState(privconn, domain, privdom, VIR_DOMAIN_SHUTOFF_CRASHED);
         event = virDomainEventNewFromObj(privdom,
                                          VIR_DOMAIN_EVENT_STOPPED,
                                          VIR_DOMAIN_EVENT_STOPPED_CRASHED);
@@ -2471,9 +2473,7 @@ static int testConnectNumOfDefinedDomains(virConnectPtr conn) {
     testConnPtr privconn = conn->privateData;
     int count;
 
-    testDriverLock(privconn);
     count = virDomainObjListNumOfDomains(privconn->domains, 0);
-    testDriverUnlock(privconn);
 
     return count;
 }
@@ -2485,10 +2485,8 @@ static int testConnectListDefinedDomains(virConnectPtr conn,
     testConnPtr privconn = conn->privateData;
     int n;
 
-    testDriverLock(privconn);
     memset(names, 0, sizeof(*names)*maxnames);
     n = virDomainObjListGetInactiveNames(privconn->domains, names, maxnames);
-    testDriverUnlock(privconn);
 
     return n;
 }
@@ -5731,9 +5729,7 @@ static int testConnectListAllDomains(virConnectPtr conn,
 
     virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ALL, -1);
 
-    testDriverLock(privconn);
     ret = virDomainObjListExport(privconn->domains, conn, domains, flags);
-    testDriverUnlock(privconn);
 
     return ret;
 }
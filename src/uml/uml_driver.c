@@ -370,7 +370,7 @@ reread:
                 continue;
             }
 
-            dom->def->id = driver->nextvmid++;
+            virDomainObjListSetID(driver->domains, dom, driver->nextvmid++);
 
             if (!driver->nactive && driver->inhibitCallback)
                 driver->inhibitCallback(true, driver->inhibitOpaque);
@@ -1164,7 +1164,7 @@ static void umlShutdownVMDaemon(struct uml_driver *driver,
     }
 
     vm->pid = -1;
-    vm->def->id = -1;
+    virDomainObjListSetID(driver->domains, vm, -1);
     virDomainObjSetState(vm, VIR_DOMAIN_SHUTOFF, reason);
 
     virDomainConfVMNWFilterTeardown(vm);
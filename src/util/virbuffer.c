@@ -22,6 +22,7 @@
 
 #include <config.h>
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -32,6 +33,7 @@
 
 #include "virbuffer.h"
 #include "viralloc.h"
+#include "intprops.h"
 
 
 /* If adding more fields, ensure to edit buf.h to match
@@ -124,7 +126,12 @@ virBufferGrow(virBufferPtr buf, unsigned int len)
     if ((len + buf->use) < buf->size)
         return 0;
 
+    /* Grow at least geometrically, so that building a large
+     * document out of many small appends doesn't keep copying
+     * the content over and over */
     size = buf->use + len + 1000;
+    if (size - buf->size < buf->size && buf->size <= INT_MAX / 2)
+        size = buf->size * 2;
 
     if (VIR_REALLOC_N(buf->content, size) < 0) {
         virBufferSetError(buf, errno);
@@ -171,6 +178,26 @@ virBufferAdd(virBufferPtr buf, const char *str, int len)
     buf->content[buf->use] = '\0';
 }
 
+/*
+ * Append @len bytes of @str as is, without auto-indentation. The
+ * caller must have checked that @buf is not in error.
+ */
+static void
+virBufferAppend(virBufferPtr buf, const char *str, size_t len)
+{
+    if (len > INT_MAX - 1000 - buf->use) {
+        virBufferSetError(buf, ENOMEM);
+        return;
+    }
+
+    if (virBufferGrow(buf, len + 1) < 0)
+        return;
+
+    memcpy(&buf->content[buf->use], str, len);
+    buf->use += len;
+    buf->content[buf->use] = '\0';
+}
+
 /**
  * virBufferAddChar:
  * @buf: the buffer to append to
@@ -295,6 +322,145 @@ virBufferAsprintf(virBufferPtr buf, const char *format, ...)
     va_end(argptr);
 }
 
+/*
+ * Check whether all conversions in @format are plain %s, %c, %d, %i,
+ * %u or %x, optionally with a l, ll or z length modifier, so that
+ * virBufferFormatSimple can do without vsnprintf.
+ */
+static bool
+virBufferFormatIsSimple(const char *format)
+{
+    const char *cur = format;
+
+    while ((cur = strchr(cur, '%'))) {
+        cur++;
+        if (*cur == '%') {
+            cur++;
+            continue;
+        }
+        if (*cur == 'l') {
+            cur++;
+            if (*cur == 'l')
+                cur++;
+        } else if (*cur == 'z') {
+            cur++;
+        }
+        if (!*cur || !strchr("scdiux", *cur))
+            return false;
+        if (*cur == 's' || *cur == 'c') {
+            /* No length modifier allowed, %ls is a wide string */
+            if (cur[-1] != '%')
+                return false;
+        }
+        cur++;
+    }
+
+    return true;
+}
+
+/*
+ * Format @val into the end of @buf, in decimal or hex, returning
+ * where the digits start.
+ */
+static char *
+virBufferFormatNumber(char *end, unsigned long long val, bool hex)
+{
+    static const char digits[] = "0123456789abcdef";
+    unsigned int base = hex ? 16 : 10;
+
+    do {
+        *--end = digits[val % base];
+        val /= base;
+    } while (val);
+
+    return end;
+}
+
+/*
+ * Do the work of virBufferVasprintf for a @format accepted by
+ * virBufferFormatIsSimple.
+ */
+static void
+virBufferFormatSimple(virBufferPtr buf, const char *format, va_list argptr)
+{
+    char num[INT_BUFSIZE_BOUND(unsigned long long) + 1];
+    char *end = num + sizeof(num);
+    const char *cur = format;
+    const char *pct;
+
+    while ((pct = strchr(cur, '%'))) {
+        unsigned long long uval;
+        long long sval = 0;
+        int lengthMod = 0; /* 1: l, 2: ll, 3: z */
+        bool isSigned = false;
+        char *digits;
+        char c;
+
+        virBufferAppend(buf, cur, pct - cur);
+        cur = pct + 1;
+
+        if (*cur == '%') {
+            virBufferAppend(buf, "%", 1);
+            cur++;
+            continue;
+        }
+
+        if (*cur == 'l') {
+            lengthMod = 1;
+            if (*++cur == 'l') {
+                lengthMod = 2;
+                cur++;
+            }
+        } else if (*cur == 'z') {
+            lengthMod = 3;
+            cur++;
+        }
+
+        switch ((c = *cur++)) {
+        case 's': {
+            const char *str = va_arg(argptr, const char *);
+            if (!str)
+                str = "(null)";
+            virBufferAppend(buf, str, strlen(str));
+            continue;
+        }
+
+        case 'c':
+            c = va_arg(argptr, int);
+            virBufferAppend(buf, &c, 1);
+            continue;
+
+        case 'd':
+        case 'i':
+            isSigned = true;
+            switch (lengthMod) {
+            case 0: sval = va_arg(argptr, int); break;
+            case 1: sval = va_arg(argptr, long); break;
+            case 2: sval = va_arg(argptr, long long); break;
+            case 3: sval = va_arg(argptr, ssize_t); break;
+            }
+            uval = sval < 0 ? -(unsigned long long)sval : sval;
+            break;
+
+        default:
+            switch (lengthMod) {
+            case 0: uval = va_arg(argptr, unsigned int); break;
+            case 1: uval = va_arg(argptr, unsigned long); break;
+            case 2: uval = va_arg(argptr, unsigned long long); break;
+            default: uval = va_arg(argptr, size_t); break;
+            }
+            break;
+        }
+
+        digits = virBufferFormatNumber(end, uval, c == 'x');
+        if (isSigned && sval < 0)
+            *--digits = '-';
+        virBufferAppend(buf, digits, end - digits);
+    }
+
+    virBufferAppend(buf, cur, strlen(cur));
+}
+
 /**
  * virBufferVasprintf:
  * @buf: the buffer to append to
@@ -317,6 +483,13 @@ virBufferVasprintf(virBufferPtr buf, const char *format, va_list argptr)
 
     virBufferAddLit(buf, ""); /* auto-indent */
 
+    /* Most formats only substitute strings and integers, which
+     * are quicker to append directly than through vsnprintf */
+    if (virBufferFormatIsSimple(format)) {
+        virBufferFormatSimple(buf, format, argptr);
+        return;
+    }
+
     if (buf->size == 0 &&
         virBufferGrow(buf, 100) < 0)
         return;
@@ -351,6 +524,49 @@ virBufferVasprintf(virBufferPtr buf, const char *format, va_list argptr)
     buf->use += count;
 }
 
+/*
+ * Append @str escaped for XML, without auto-indentation. Characters
+ * which XML does not allow are dropped.
+ */
+static void
+virBufferEscapeXML(virBufferPtr buf, const char *str)
+{
+    const char *cur = str;
+    const char *start = str;
+    const char *entity;
+
+    for (; *cur; cur++) {
+        switch (*cur) {
+        case '<': entity = "&lt;"; break;
+        case '>': entity = "&gt;"; break;
+        case '&': entity = "&amp;"; break;
+        case '"': entity = "&quot;"; break;
+        case '\'': entity = "&apos;"; break;
+        case '\n':
+        case '\t':
+        case '\r':
+            continue;
+        default:
+            /*
+             * Just copy anything else. Note that character over 0x80
+             * are likely to give problem with UTF-8 XML, but since our
+             * string don't have an encoding it's hard to handle properly
+             * we have to assume it's UTF-8 too
+             */
+            if ((unsigned char)*cur >= 0x20)
+                continue;
+            entity = "";
+            break;
+        }
+
+        virBufferAppend(buf, start, cur - start);
+        virBufferAppend(buf, entity, strlen(entity));
+        start = cur + 1;
+    }
+
+    virBufferAppend(buf, start, cur - start);
+}
+
 /**
  * virBufferEscapeString:
  * @buf: the buffer to append to
@@ -365,9 +581,10 @@ virBufferVasprintf(virBufferPtr buf, const char *format, va_list argptr)
 void
 virBufferEscapeString(virBufferPtr buf, const char *format, const char *str)
 {
+    virBuffer tmp = VIR_BUFFER_INITIALIZER;
     int len;
-    char *escaped, *out;
-    const char *cur;
+    char *escaped;
+    const char *pct;
 
     if ((format == NULL) || (buf == NULL) || (str == NULL))
         return;
@@ -381,59 +598,24 @@ virBufferEscapeString(virBufferPtr buf, const char *format, const char *str)
         return;
     }
 
-    if (xalloc_oversized(6, len) ||
-        VIR_ALLOC_N(escaped, 6 * len + 1) < 0) {
-        virBufferSetError(buf, errno);
+    /* Escape straight into the buffer when @str is the only
+     * thing to substitute, as it is in almost all callers */
+    if ((pct = strchr(format, '%')) && pct[1] == 's' &&
+        !strchr(pct + 2, '%')) {
+        virBufferAddLit(buf, ""); /* auto-indent */
+        virBufferAppend(buf, format, pct - format);
+        virBufferEscapeXML(buf, str);
+        virBufferAppend(buf, pct + 2, strlen(pct + 2));
         return;
     }
 
-    cur = str;
-    out = escaped;
-    while (*cur != 0) {
-        if (*cur == '<') {
-            *out++ = '&';
-            *out++ = 'l';
-            *out++ = 't';
-            *out++ = ';';
-        } else if (*cur == '>') {
-            *out++ = '&';
-            *out++ = 'g';
-            *out++ = 't';
-            *out++ = ';';
-        } else if (*cur == '&') {
-            *out++ = '&';
-            *out++ = 'a';
-            *out++ = 'm';
-            *out++ = 'p';
-            *out++ = ';';
-        } else if (*cur == '"') {
-            *out++ = '&';
-            *out++ = 'q';
-            *out++ = 'u';
-            *out++ = 'o';
-            *out++ = 't';
-            *out++ = ';';
-        } else if (*cur == '\'') {
-            *out++ = '&';
-            *out++ = 'a';
-            *out++ = 'p';
-            *out++ = 'o';
-            *out++ = 's';
-            *out++ = ';';
-        } else if (((unsigned char)*cur >= 0x20) || (*cur == '\n') || (*cur == '\t') ||
-                   (*cur == '\r')) {
-            /*
-             * default case, just copy !
-             * Note that character over 0x80 are likely to give problem
-             * with UTF-8 XML, but since our string don't have an encoding
-             * it's hard to handle properly we have to assume it's UTF-8 too
-             */
-            *out++ = *cur;
-        }
-        cur++;
+    virBufferEscapeXML(&tmp, str);
+    if (virBufferError(&tmp)) {
+        virBufferSetError(buf, virBufferError(&tmp));
+        return;
     }
-    *out = 0;
 
+    escaped = virBufferContentAndReset(&tmp);
     virBufferAsprintf(buf, format, escaped);
     VIR_FREE(escaped);
 }
@@ -35,9 +35,9 @@
 typedef struct _virBuffer virBuffer;
 typedef virBuffer *virBufferPtr;
 
-# ifndef __VIR_BUFFER_C__
-#  define VIR_BUFFER_INITIALIZER { 0, 0, 0, 0, NULL }
+# define VIR_BUFFER_INITIALIZER { 0, 0, 0, 0, NULL }
 
+# ifndef __VIR_BUFFER_C__
 /* This struct must be kept in sync with the real struct
    in the buf.c impl file */
 struct _virBuffer {
@@ -38,6 +38,7 @@
 #include <sys/types.h>
 #include <signal.h>
 #include <dirent.h>
+#include <unistd.h>
 
 #define __VIR_CGROUP_ALLOW_INCLUDE_PRIV_H__
 #include "vircgrouppriv.h"
@@ -50,9 +51,17 @@
 #include "virhash.h"
 #include "virhashcode.h"
 #include "virstring.h"
+#include "viratomic.h"
 
 #define CGROUP_MAX_VAL 512
 
+/* Descriptors of stat files kept open, summed over all groups. Past
+ * this many the files are opened again on each read, so that polling
+ * lots of groups cannot run the process out of descriptors */
+#define VIR_CGROUP_STAT_FDS_MAX 256
+
+static int virCgroupStatFdCount;
+
 #define VIR_FROM_THIS VIR_FROM_CGROUP
 
 VIR_ENUM_IMPL(virCgroupController, VIR_CGROUP_CONTROLLER_LAST,
@@ -67,6 +76,27 @@ typedef enum {
                                        */
 } virCgroupFlags;
 
+/* Keep @fd open as the descriptor of @file, unless too many are */
+static bool virCgroupCacheStatFile(virCgroupPtr group, int file, int fd)
+{
+    if (virAtomicIntInc(&virCgroupStatFdCount) > VIR_CGROUP_STAT_FDS_MAX) {
+        ignore_value(virAtomicIntDecAndTest(&virCgroupStatFdCount));
+        return false;
+    }
+
+    group->statfds[file] = fd;
+    return true;
+}
+
+static void virCgroupCloseStatFile(virCgroupPtr group, int file)
+{
+    if (group->statfds[file] < 0)
+        return;
+
+    VIR_FORCE_CLOSE(group->statfds[file]);
+    ignore_value(virAtomicIntDecAndTest(&virCgroupStatFdCount));
+}
+
 /**
  * virCgroupFree:
  *
@@ -85,6 +115,9 @@ void virCgroupFree(virCgroupPtr *group)
         VIR_FREE((*group)->controllers[i].placement);
     }
 
+    for (i = 0 ; i < VIR_CGROUP_STAT_FILE_LAST ; i++)
+        virCgroupCloseStatFile(*group, i);
+
     VIR_FREE((*group)->path);
     VIR_FREE(*group);
 }
@@ -520,6 +553,146 @@ static int virCgroupSetValueStr(virCgroupPtr group,
     return rc;
 }
 
+static const struct {
+    int controller;
+    const char *key;
+} virCgroupStatFiles[VIR_CGROUP_STAT_FILE_LAST] = {
+    [VIR_CGROUP_STAT_FILE_CPUACCT_USAGE] =
+        { VIR_CGROUP_CONTROLLER_CPUACCT, "cpuacct.usage" },
+    [VIR_CGROUP_STAT_FILE_CPUACCT_PERCPU] =
+        { VIR_CGROUP_CONTROLLER_CPUACCT, "cpuacct.usage_percpu" },
+    [VIR_CGROUP_STAT_FILE_CPUACCT_STAT] =
+        { VIR_CGROUP_CONTROLLER_CPUACCT, "cpuacct.stat" },
+    [VIR_CGROUP_STAT_FILE_MEMORY_USAGE] =
+        { VIR_CGROUP_CONTROLLER_MEMORY, "memory.usage_in_bytes" },
+};
+
+static int virCgroupStatFileLookup(int controller, const char *key)
+{
+    int i;
+
+    for (i = 0 ; i < VIR_CGROUP_STAT_FILE_LAST ; i++) {
+        if (virCgroupStatFiles[i].controller == controller &&
+            STREQ(virCgroupStatFiles[i].key, key))
+            return i;
+    }
+    return -1;
+}
+
+static int virCgroupOpenStatFile(virCgroupPtr group, int file, int *fd)
+{
+    int rc;
+    char *keypath = NULL;
+
+    rc = virCgroupPathOfController(group,
+                                   virCgroupStatFiles[file].controller,
+                                   virCgroupStatFiles[file].key,
+                                   &keypath);
+    if (rc != 0) {
+        VIR_DEBUG("No path of %s, %s",
+                  group->path, virCgroupStatFiles[file].key);
+        return rc;
+    }
+
+    VIR_DEBUG("Open stat file %s", keypath);
+
+    if ((*fd = open(keypath, O_RDONLY | O_CLOEXEC)) < 0) {
+        rc = -errno;
+        VIR_DEBUG("Failed to open %s: %m", keypath);
+    }
+
+    VIR_FREE(keypath);
+
+    return rc;
+}
+
+/*
+ * Read one of the stat files, through its cached descriptor if it
+ * has one. The kernel regenerates the contents on every read from
+ * offset 0, so the descriptor is kept open for the lifetime of @group
+ * and each read costs a single pread() instead of open/read/close.
+ * Only files which are actually read get a descriptor, and once
+ * VIR_CGROUP_STAT_FDS_MAX are open the file is closed again after
+ * reading. If the cached descriptor has gone stale, because the
+ * cgroup directory was removed and created again, the file is
+ * reopened once.
+ */
+static int virCgroupReadStatFile(virCgroupPtr group,
+                                 int file,
+                                 char **value)
+{
+    int rc;
+    char *buf = NULL;
+    size_t size = 1024;
+    ssize_t got;
+    int fd = group->statfds[file];
+    bool cached = true;
+    bool reopened = false;
+
+    *value = NULL;
+
+    if (fd < 0) {
+        if ((rc = virCgroupOpenStatFile(group, file, &fd)) < 0)
+            return rc;
+        cached = virCgroupCacheStatFile(group, file, fd);
+        reopened = true;
+    }
+
+    for (;;) {
+        if (VIR_REALLOC_N(buf, size) < 0) {
+            rc = -ENOMEM;
+            goto cleanup;
+        }
+
+        got = pread(fd, buf, size - 1, 0);
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            rc = -errno;
+            VIR_DEBUG("Failed to read %s: %m", virCgroupStatFiles[file].key);
+            if (cached)
+                virCgroupCloseStatFile(group, file);
+            else
+                VIR_FORCE_CLOSE(fd);
+            fd = -1;
+            cached = false;
+            if (reopened)
+                goto cleanup;
+            if ((rc = virCgroupOpenStatFile(group, file, &fd)) < 0)
+                goto cleanup;
+            cached = virCgroupCacheStatFile(group, file, fd);
+            reopened = true;
+            continue;
+        }
+
+        /* The whole file is produced by a single read as long as
+         * it fits in the buffer, otherwise retry with a larger one */
+        if (got < size - 1)
+            break;
+
+        if (size >= 1024*1024) {
+            rc = -EFBIG;
+            goto cleanup;
+        }
+        size *= 2;
+    }
+
+    /* Terminated with '\n' has sometimes harmful effects to the caller */
+    if (got > 0 && buf[got - 1] == '\n')
+        got--;
+    buf[got] = '\0';
+
+    *value = buf;
+    buf = NULL;
+    rc = 0;
+
+cleanup:
+    VIR_FREE(buf);
+    if (!cached)
+        VIR_FORCE_CLOSE(fd);
+    return rc;
+}
+
 static int virCgroupGetValueStr(virCgroupPtr group,
                                 int controller,
                                 const char *key,
@@ -527,6 +700,10 @@ static int virCgroupGetValueStr(virCgroupPtr group,
 {
     int rc;
     char *keypath = NULL;
+    int file;
+
+    if ((file = virCgroupStatFileLookup(controller, key)) >= 0)
+        return virCgroupReadStatFile(group, file, value);
 
     *value = NULL;
 
@@ -810,6 +987,7 @@ static int virCgroupNew(const char *path,
 {
     int rc = 0;
     char *typpath = NULL;
+    int i;
 
     VIR_DEBUG("parent=%p path=%s controllers=%d",
               parent, path, controllers);
@@ -820,6 +998,9 @@ static int virCgroupNew(const char *path,
         goto err;
     }
 
+    for (i = 0 ; i < VIR_CGROUP_STAT_FILE_LAST ; i++)
+        (*group)->statfds[i] = -1;
+
     if (path[0] == '/' || !parent) {
         if (!((*group)->path = strdup(path))) {
             rc = -ENOMEM;
@@ -949,6 +1130,9 @@ int virCgroupRemove(virCgroupPtr group)
     char *grppath = NULL;
 
     VIR_DEBUG("Removing cgroup %s", group->path);
+    for (i = 0 ; i < VIR_CGROUP_STAT_FILE_LAST ; i++)
+        virCgroupCloseStatFile(group, i);
+
     for (i = 0 ; i < VIR_CGROUP_CONTROLLER_LAST ; i++) {
         /* Skip over controllers not mounted */
         if (!group->controllers[i].mountPoint)
@@ -1519,6 +1703,56 @@ int virCgroupNewVcpu(virCgroupPtr domain ATTRIBUTE_UNUSED,
 }
 #endif
 
+/**
+ * virCgroupNewIOThread:
+ *
+ * @domain: group for the domain
+ * @iothreadid: id of the iothread
+ * @create: true to create if not already existing
+ * @group: Pointer to returned virCgroupPtr
+ *
+ * Returns 0 on success or -errno on failure
+ */
+#if defined HAVE_MNTENT_H && defined HAVE_GETMNTENT_R
+int virCgroupNewIOThread(virCgroupPtr domain,
+                         int iothreadid,
+                         bool create,
+                         virCgroupPtr *group)
+{
+    int rc;
+    char *name;
+    int controllers;
+
+    if (virAsprintf(&name, "iothread%d", iothreadid) < 0)
+        return -ENOMEM;
+
+    controllers = ((1 << VIR_CGROUP_CONTROLLER_CPU) |
+                   (1 << VIR_CGROUP_CONTROLLER_CPUACCT) |
+                   (1 << VIR_CGROUP_CONTROLLER_CPUSET));
+
+    rc = virCgroupNew(name, domain, controllers, group);
+    VIR_FREE(name);
+
+    if (rc == 0) {
+        rc = virCgroupMakeGroup(domain, *group, create, VIR_CGROUP_NONE);
+        if (rc != 0) {
+            virCgroupRemove(*group);
+            virCgroupFree(group);
+        }
+    }
+
+    return rc;
+}
+#else
+int virCgroupNewIOThread(virCgroupPtr domain ATTRIBUTE_UNUSED,
+                         int iothreadid ATTRIBUTE_UNUSED,
+                         bool create ATTRIBUTE_UNUSED,
+                         virCgroupPtr *group ATTRIBUTE_UNUSED)
+{
+    return -ENXIO;
+}
+#endif
+
 /**
  * virCgroupNewEmulator:
  *
@@ -2232,52 +2466,149 @@ int virCgroupGetCpuacctPercpuUsage(virCgroupPtr group, char **usage)
 }
 
 #ifdef _SC_CLK_TCK
-int virCgroupGetCpuacctStat(virCgroupPtr group, unsigned long long *user,
-                            unsigned long long *sys)
+static int virCgroupParseCpuacctStat(char *str,
+                                     unsigned long long *user,
+                                     unsigned long long *sys)
 {
-    char *str;
     char *p;
-    int ret;
     static double scale = -1.0;
 
-    if ((ret = virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_CPUACCT,
-                                    "cpuacct.stat", &str)) < 0)
-        return ret;
     if (!(p = STRSKIP(str, "user ")) ||
         virStrToLong_ull(p, &p, 10, user) < 0 ||
         !(p = STRSKIP(p, "\nsystem ")) ||
-        virStrToLong_ull(p, NULL, 10, sys) < 0) {
-        ret = -EINVAL;
-        goto cleanup;
-    }
+        virStrToLong_ull(p, NULL, 10, sys) < 0)
+        return -EINVAL;
+
     /* times reported are in system ticks (generally 100 Hz), but that
      * rate can theoretically vary between machines.  Scale things
      * into approximate nanoseconds.  */
     if (scale < 0) {
         long ticks_per_sec = sysconf(_SC_CLK_TCK);
-        if (ticks_per_sec == -1) {
-            ret = -errno;
-            goto cleanup;
-        }
+        if (ticks_per_sec == -1)
+            return -errno;
         scale = 1000000000.0 / ticks_per_sec;
     }
     *user *= scale;
     *sys *= scale;
 
-    ret = 0;
-cleanup:
-    VIR_FREE(str);
-    return ret;
+    return 0;
 }
 #else
-int virCgroupGetCpuacctStat(virCgroupPtr group ATTRIBUTE_UNUSED,
-                            unsigned long long *user ATTRIBUTE_UNUSED,
-                            unsigned long long *sys ATTRIBUTE_UNUSED)
+static int virCgroupParseCpuacctStat(char *str ATTRIBUTE_UNUSED,
+                                     unsigned long long *user ATTRIBUTE_UNUSED,
+                                     unsigned long long *sys ATTRIBUTE_UNUSED)
 {
     return -ENOSYS;
 }
 #endif
 
+int virCgroupGetCpuacctStat(virCgroupPtr group, unsigned long long *user,
+                            unsigned long long *sys)
+{
+    char *str;
+    int ret;
+
+    if ((ret = virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_CPUACCT,
+                                    "cpuacct.stat", &str)) < 0)
+        return ret;
+
+    ret = virCgroupParseCpuacctStat(str, user, sys);
+
+    VIR_FREE(str);
+    return ret;
+}
+
+static int virCgroupParsePercpuUsage(char *str,
+                                     unsigned long long **usage,
+                                     size_t *nusage)
+{
+    char *p = str;
+    unsigned long long *times = NULL;
+    size_t ntimes = 0;
+    unsigned long long val;
+
+    while (*p) {
+        while (*p == ' ')
+            p++;
+        if (!*p)
+            break;
+        if (virStrToLong_ull(p, &p, 10, &val) < 0 ||
+            (*p && *p != ' ')) {
+            VIR_FREE(times);
+            return -EINVAL;
+        }
+        if (VIR_EXPAND_N(times, ntimes, 1) < 0) {
+            VIR_FREE(times);
+            return -ENOMEM;
+        }
+        times[ntimes - 1] = val;
+    }
+
+    *usage = times;
+    *nusage = ntimes;
+    return 0;
+}
+
+/**
+ * virCgroupGetStats:
+ *
+ * @group: The cgroup to read statistics of
+ * @flags: bitwise-OR of virCgroupStatsFlags selecting what to read
+ * @stats: Pointer to returned statistics
+ *
+ * Reads all the requested statistics of @group in one go, using
+ * the stat files kept open by @group, so that polling many groups
+ * does not cost an open and close per value. The per-CPU times
+ * must be released with virCgroupStatsClear().
+ *
+ * Returns: 0 on success, the -errno of the first failed read otherwise
+ */
+int virCgroupGetStats(virCgroupPtr group,
+                      unsigned int flags,
+                      virCgroupStatsPtr stats)
+{
+    char *str = NULL;
+    int rc = 0;
+
+    memset(stats, 0, sizeof(*stats));
+
+    if (flags & VIR_CGROUP_STATS_CPU &&
+        (rc = virCgroupGetValueU64(group, VIR_CGROUP_CONTROLLER_CPUACCT,
+                                   "cpuacct.usage", &stats->cpuTime)) < 0)
+        goto cleanup;
+
+    if (flags & VIR_CGROUP_STATS_CPU_TIMES &&
+        (rc = virCgroupGetCpuacctStat(group, &stats->userTime,
+                                      &stats->sysTime)) < 0)
+        goto cleanup;
+
+    if (flags & VIR_CGROUP_STATS_PERCPU) {
+        if ((rc = virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_CPUACCT,
+                                       "cpuacct.usage_percpu", &str)) < 0 ||
+            (rc = virCgroupParsePercpuUsage(str, &stats->percpuTime,
+                                            &stats->npercpuTime)) < 0)
+            goto cleanup;
+    }
+
+    if (flags & VIR_CGROUP_STATS_MEMORY &&
+        (rc = virCgroupGetValueU64(group, VIR_CGROUP_CONTROLLER_MEMORY,
+                                   "memory.usage_in_bytes",
+                                   &stats->memUsage)) < 0)
+        goto cleanup;
+
+cleanup:
+    VIR_FREE(str);
+    if (rc < 0)
+        virCgroupStatsClear(stats);
+    return rc;
+}
+
+void virCgroupStatsClear(virCgroupStatsPtr stats)
+{
+    VIR_FREE(stats->percpuTime);
+    stats->npercpuTime = 0;
+}
+
 int virCgroupSetFreezerState(virCgroupPtr group, const char *state)
 {
     return virCgroupSetValueStr(group,
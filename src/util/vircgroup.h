@@ -84,6 +84,12 @@ int virCgroupNewEmulator(virCgroupPtr domain,
                          virCgroupPtr *group)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(3);
 
+int virCgroupNewIOThread(virCgroupPtr domain,
+                         int iothreadid,
+                         bool create,
+                         virCgroupPtr *group)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(4);
+
 int virCgroupPathOfController(virCgroupPtr group,
                               int controller,
                               const char *key,
@@ -166,6 +172,29 @@ int virCgroupGetCpuacctPercpuUsage(virCgroupPtr group, char **usage);
 int virCgroupGetCpuacctStat(virCgroupPtr group, unsigned long long *user,
                             unsigned long long *sys);
 
+typedef enum {
+    VIR_CGROUP_STATS_CPU       = (1 << 0), /* cpuTime */
+    VIR_CGROUP_STATS_CPU_TIMES = (1 << 1), /* userTime and sysTime */
+    VIR_CGROUP_STATS_PERCPU    = (1 << 2), /* percpuTime */
+    VIR_CGROUP_STATS_MEMORY    = (1 << 3), /* memUsage */
+} virCgroupStatsFlags;
+
+typedef struct _virCgroupStats virCgroupStats;
+typedef virCgroupStats *virCgroupStatsPtr;
+struct _virCgroupStats {
+    unsigned long long cpuTime;     /* in nanoseconds */
+    unsigned long long userTime;    /* in nanoseconds */
+    unsigned long long sysTime;     /* in nanoseconds */
+    unsigned long long *percpuTime; /* in nanoseconds, indexed by host CPU */
+    size_t npercpuTime;
+    unsigned long long memUsage;    /* in bytes */
+};
+
+int virCgroupGetStats(virCgroupPtr group,
+                      unsigned int flags,
+                      virCgroupStatsPtr stats);
+void virCgroupStatsClear(virCgroupStatsPtr stats);
+
 int virCgroupSetFreezerState(virCgroupPtr group, const char *state);
 int virCgroupGetFreezerState(virCgroupPtr group, char **state);
 
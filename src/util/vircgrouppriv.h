@@ -42,10 +42,23 @@ struct virCgroupController {
     char *placement;
 };
 
+/* Stat files which are read often enough to be worth keeping open */
+enum {
+    VIR_CGROUP_STAT_FILE_CPUACCT_USAGE,
+    VIR_CGROUP_STAT_FILE_CPUACCT_PERCPU,
+    VIR_CGROUP_STAT_FILE_CPUACCT_STAT,
+    VIR_CGROUP_STAT_FILE_MEMORY_USAGE,
+
+    VIR_CGROUP_STAT_FILE_LAST
+};
+
 struct virCgroup {
     char *path;
 
     struct virCgroupController controllers[VIR_CGROUP_CONTROLLER_LAST];
+
+    /* Open descriptors of the stat files, or -1 until first read */
+    int statfds[VIR_CGROUP_STAT_FILE_LAST];
 };
 
 #endif /* __VIR_CGROUP_PRIV_H__ */
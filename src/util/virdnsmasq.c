@@ -34,6 +34,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <signal.h>
+#include <dirent.h>
 
 #ifdef HAVE_PATHS_H
 # include <paths.h>
@@ -42,6 +43,7 @@
 #include "internal.h"
 #include "datatypes.h"
 #include "virbitmap.h"
+#include "virbuffer.h"
 #include "virdnsmasq.h"
 #include "virutil.h"
 #include "vircommand.h"
@@ -54,11 +56,14 @@
 #define VIR_FROM_THIS VIR_FROM_NETWORK
 #define DNSMASQ_HOSTSFILE_SUFFIX "hostsfile"
 #define DNSMASQ_ADDNHOSTSFILE_SUFFIX "addnhosts"
+#define DNSMASQ_HOSTSDIR_SUFFIX "hostsdir"
+#define DNSMASQ_ADDNHOSTSDIR_SUFFIX "addnhostsdir"
 
 static void
 dhcphostFree(dnsmasqDhcpHost *host)
 {
     VIR_FREE(host->host);
+    VIR_FREE(host->ip);
 }
 
 static void
@@ -73,7 +78,7 @@ addnhostFree(dnsmasqAddnHost *host)
 }
 
 static void
-addnhostsFree(dnsmasqAddnHostsfile *addnhostsfile)
+addnhostsClear(dnsmasqAddnHostsfile *addnhostsfile)
 {
     unsigned int i;
 
@@ -85,8 +90,16 @@ addnhostsFree(dnsmasqAddnHostsfile *addnhostsfile)
 
         addnhostsfile->nhosts = 0;
     }
+}
+
+static void
+addnhostsFree(dnsmasqAddnHostsfile *addnhostsfile)
+{
+    addnhostsClear(addnhostsfile);
 
     VIR_FREE(addnhostsfile->path);
+    VIR_FREE(addnhostsfile->dirpath);
+    virHashFree(addnhostsfile->saved);
 
     VIR_FREE(addnhostsfile);
 }
@@ -159,7 +172,9 @@ addnhostsNew(const char *name,
     addnhostsfile->nhosts = 0;
 
     if (virAsprintf(&addnhostsfile->path, "%s/%s.%s", config_dir, name,
-                    DNSMASQ_ADDNHOSTSFILE_SUFFIX) < 0) {
+                    DNSMASQ_ADDNHOSTSFILE_SUFFIX) < 0 ||
+        virAsprintf(&addnhostsfile->dirpath, "%s/%s.%s", config_dir, name,
+                    DNSMASQ_ADDNHOSTSDIR_SUFFIX) < 0) {
         virReportOOMError();
         goto error;
     }
@@ -279,7 +294,7 @@ genericFileDelete(char *path)
 }
 
 static void
-hostsfileFree(dnsmasqHostsfile *hostsfile)
+hostsfileClear(dnsmasqHostsfile *hostsfile)
 {
     unsigned int i;
 
@@ -291,8 +306,16 @@ hostsfileFree(dnsmasqHostsfile *hostsfile)
 
         hostsfile->nhosts = 0;
     }
+}
+
+static void
+hostsfileFree(dnsmasqHostsfile *hostsfile)
+{
+    hostsfileClear(hostsfile);
 
     VIR_FREE(hostsfile->path);
+    VIR_FREE(hostsfile->dirpath);
+    virHashFree(hostsfile->saved);
 
     VIR_FREE(hostsfile);
 }
@@ -315,6 +338,9 @@ hostsfileAdd(dnsmasqHostsfile *hostsfile,
     if (!(ipstr = virSocketAddrFormat(ip)))
         return -1;
 
+    hostsfile->hosts[hostsfile->nhosts].host = NULL;
+    hostsfile->hosts[hostsfile->nhosts].ip = NULL;
+
     /* the first test determines if it is a dhcpv6 host */
     if (ipv6) {
         if (name && id) {
@@ -343,7 +369,7 @@ hostsfileAdd(dnsmasqHostsfile *hostsfile,
                         mac, ipstr) < 0)
             goto alloc_error;
     }
-    VIR_FREE(ipstr);
+    hostsfile->hosts[hostsfile->nhosts].ip = ipstr;
 
     hostsfile->nhosts++;
 
@@ -370,7 +396,9 @@ hostsfileNew(const char *name,
     hostsfile->nhosts = 0;
 
     if (virAsprintf(&hostsfile->path, "%s/%s.%s", config_dir, name,
-                    DNSMASQ_HOSTSFILE_SUFFIX) < 0) {
+                    DNSMASQ_HOSTSFILE_SUFFIX) < 0 ||
+        virAsprintf(&hostsfile->dirpath, "%s/%s.%s", config_dir, name,
+                    DNSMASQ_HOSTSDIR_SUFFIX) < 0) {
         virReportOOMError();
         goto error;
     }
@@ -452,6 +480,295 @@ hostsfileSave(dnsmasqHostsfile *hostsfile)
     return 0;
 }
 
+/*
+ * With --dhcp-hostsdir and --hostsdir, dnsmasq reads every file in a
+ * directory and notices new or changed files there by itself. We keep
+ * the entries for each IP address in a file of its own, so that
+ * adding a host only needs one small file written. dnsmasq forgets
+ * the entries of a changed or removed file only when it rereads all
+ * of its configuration on SIGHUP, though.
+ */
+static void
+hostsdirEntryFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    VIR_FREE(payload);
+}
+
+/* Append @line to the file contents in @entries named @name */
+static int
+hostsdirAddEntry(virHashTablePtr entries,
+                 const char *name,
+                 const char *line)
+{
+    const char *old = virHashLookup(entries, name);
+    char *contents;
+
+    if (virAsprintf(&contents, "%s%s\n", old ? old : "", line) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (virHashUpdateEntry(entries, name, contents) < 0) {
+        VIR_FREE(contents);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+hostsdirWriteFile(const char *dirpath,
+                  const char *name,
+                  const char *contents)
+{
+    char *path = NULL;
+    char *tmp = NULL;
+    int ret = -1;
+
+    /* dnsmasq ignores files whose name starts with a dot, so it never
+     * sees a half written file */
+    if (virAsprintf(&path, "%s/%s", dirpath, name) < 0 ||
+        virAsprintf(&tmp, "%s/.%s.new", dirpath, name) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    if (virFileWriteStr(tmp, contents, 0644) < 0 ||
+        rename(tmp, path) < 0) {
+        virReportSystemError(errno, _("cannot write config file '%s'"),
+                             path);
+        unlink(tmp);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(path);
+    VIR_FREE(tmp);
+    return ret;
+}
+
+struct hostsdirSyncData {
+    const char *dirpath;
+    virHashTablePtr saved;
+    virHashTablePtr wanted;
+    bool reload;
+    int ret;
+};
+
+static void
+hostsdirWriteIterator(void *payload,
+                      const void *name,
+                      void *opaque)
+{
+    struct hostsdirSyncData *data = opaque;
+    const char *contents = payload;
+    const char *saved;
+    char *copy;
+
+    if (data->ret < 0)
+        return;
+
+    saved = virHashLookup(data->saved, name);
+    if (saved && STREQ(saved, contents))
+        return;
+
+    if (!(copy = strdup(contents))) {
+        virReportOOMError();
+        data->ret = -1;
+        return;
+    }
+
+    if (hostsdirWriteFile(data->dirpath, name, contents) < 0 ||
+        virHashUpdateEntry(data->saved, name, copy) < 0) {
+        VIR_FREE(copy);
+        data->ret = -1;
+        return;
+    }
+
+    if (saved)
+        data->reload = true;
+}
+
+static int
+hostsdirRemoveSearcher(const void *payload ATTRIBUTE_UNUSED,
+                       const void *name,
+                       const void *opaque)
+{
+    const struct hostsdirSyncData *data = opaque;
+    char *path;
+
+    if (virHashLookup(data->wanted, name))
+        return 0;
+
+    if (virAsprintf(&path, "%s/%s", data->dirpath,
+                    (const char *)name) < 0) {
+        virReportOOMError();
+        return 0;
+    }
+
+    if (unlink(path) < 0 && errno != ENOENT) {
+        char ebuf[1024];
+        VIR_WARN("cannot remove config file '%s': %s",
+                 path, virStrerror(errno, ebuf, sizeof(ebuf)));
+    }
+
+    VIR_FREE(path);
+    return 1;
+}
+
+/* Bring the files in @dirpath, last written as recorded in @saved, in
+ * line with @wanted. *@reload is set if dnsmasq needs a SIGHUP to
+ * forget entries that were changed or removed. */
+static int
+hostsdirSync(const char *dirpath,
+             virHashTablePtr saved,
+             virHashTablePtr wanted,
+             bool *reload)
+{
+    struct hostsdirSyncData data = {
+        .dirpath = dirpath,
+        .saved = saved,
+        .wanted = wanted,
+    };
+
+    virHashForEach(wanted, hostsdirWriteIterator, &data);
+    if (data.ret < 0)
+        return -1;
+
+    if (virHashRemoveSet(saved, hostsdirRemoveSearcher, &data) > 0)
+        data.reload = true;
+
+    if (data.reload)
+        *reload = true;
+    return 0;
+}
+
+/* Remove all files in @dirpath, creating it if needed. The directory
+ * itself is kept as a running dnsmasq may be watching it. */
+static int
+hostsdirClear(const char *dirpath,
+              virHashTablePtr saved)
+{
+    DIR *dh;
+    struct dirent *de;
+    char *path = NULL;
+    int ret = -1;
+
+    virHashRemoveAll(saved);
+
+    if (virFileMakePath(dirpath) < 0) {
+        virReportSystemError(errno, _("cannot create config directory '%s'"),
+                             dirpath);
+        return -1;
+    }
+
+    if (!(dh = opendir(dirpath))) {
+        virReportSystemError(errno, _("Cannot open dir '%s'"), dirpath);
+        return -1;
+    }
+
+    while ((de = readdir(dh)) != NULL) {
+        if (STREQ(de->d_name, ".") || STREQ(de->d_name, ".."))
+            continue;
+
+        if (virAsprintf(&path, "%s/%s", dirpath, de->d_name) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+
+        if (unlink(path) < 0 && errno != ENOENT) {
+            virReportSystemError(errno, _("cannot remove config file '%s'"),
+                                 path);
+            goto cleanup;
+        }
+        VIR_FREE(path);
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(path);
+    closedir(dh);
+    return ret;
+}
+
+static int
+genericDirDelete(const char *path)
+{
+    if (!virFileIsDir(path))
+        return 0;
+
+    return virFileDeleteTree(path);
+}
+
+static int
+hostsfileSync(dnsmasqHostsfile *hostsfile,
+              bool *reload)
+{
+    virHashTablePtr wanted;
+    unsigned int i;
+    int ret = -1;
+
+    if (!(wanted = virHashCreate(hostsfile->nhosts + 1, hostsdirEntryFree)))
+        return -1;
+
+    for (i = 0; i < hostsfile->nhosts; i++) {
+        if (hostsdirAddEntry(wanted, hostsfile->hosts[i].ip,
+                             hostsfile->hosts[i].host) < 0)
+            goto cleanup;
+    }
+
+    ret = hostsdirSync(hostsfile->dirpath, hostsfile->saved, wanted, reload);
+
+cleanup:
+    virHashFree(wanted);
+    return ret;
+}
+
+static int
+addnhostsSync(dnsmasqAddnHostsfile *addnhostsfile,
+              bool *reload)
+{
+    virHashTablePtr wanted;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    unsigned int i, ii;
+    char *line = NULL;
+    int ret = -1;
+
+    if (!(wanted = virHashCreate(addnhostsfile->nhosts + 1,
+                                 hostsdirEntryFree)))
+        return -1;
+
+    /* same format as addnhostsWrite */
+    for (i = 0; i < addnhostsfile->nhosts; i++) {
+        virBufferAsprintf(&buf, "%s\t", addnhostsfile->hosts[i].ip);
+        for (ii = 0; ii < addnhostsfile->hosts[i].nhostnames; ii++)
+            virBufferAsprintf(&buf, "%s\t",
+                              addnhostsfile->hosts[i].hostnames[ii]);
+
+        if (virBufferError(&buf)) {
+            virBufferFreeAndReset(&buf);
+            virReportOOMError();
+            goto cleanup;
+        }
+
+        line = virBufferContentAndReset(&buf);
+        if (hostsdirAddEntry(wanted, addnhostsfile->hosts[i].ip, line) < 0)
+            goto cleanup;
+        VIR_FREE(line);
+    }
+
+    ret = hostsdirSync(addnhostsfile->dirpath, addnhostsfile->saved,
+                       wanted, reload);
+
+cleanup:
+    VIR_FREE(line);
+    virHashFree(wanted);
+    return ret;
+}
+
 /**
  * dnsmasqContextNew:
  *
@@ -509,6 +826,45 @@ dnsmasqContextFree(dnsmasqContext *ctx)
     VIR_FREE(ctx);
 }
 
+/**
+ * dnsmasqContextUseHostsDirs:
+ * @ctx: pointer to the dnsmasq context for each network
+ *
+ * Keep the hosts in dnsmasq's dhcp-hostsdir and hostsdir, one file
+ * per IP address, instead of the dhcp-hostsfile and addn-hosts files.
+ * This lets dnsmasqUpdate pass most changes to dnsmasq without
+ * making it reload its configuration.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+dnsmasqContextUseHostsDirs(dnsmasqContext *ctx)
+{
+    if (!ctx->hostsfile->saved &&
+        !(ctx->hostsfile->saved = virHashCreate(0, hostsdirEntryFree)))
+        return -1;
+
+    if (!ctx->addnhostsfile->saved &&
+        !(ctx->addnhostsfile->saved = virHashCreate(0, hostsdirEntryFree)))
+        return -1;
+
+    return 0;
+}
+
+/**
+ * dnsmasqClearHosts:
+ * @ctx: pointer to the dnsmasq context for each network
+ *
+ * Forget the hosts added to @ctx so that the lists can be built
+ * again. What was saved to disk is still known to dnsmasqUpdate.
+ */
+void
+dnsmasqClearHosts(dnsmasqContext *ctx)
+{
+    hostsfileClear(ctx->hostsfile);
+    addnhostsClear(ctx->addnhostsfile);
+}
+
 /**
  * dnsmasqAddDhcpHost:
  * @ctx: pointer to the dnsmasq context for each network
@@ -553,9 +909,10 @@ dnsmasqAddHost(dnsmasqContext *ctx,
  * Saves all the configurations associated with a context to disk.
  */
 int
-dnsmasqSave(const dnsmasqContext *ctx)
+dnsmasqSave(dnsmasqContext *ctx)
 {
     int ret = 0;
+    bool reload;
 
     if (virFileMakePath(ctx->config_dir) < 0) {
         virReportSystemError(errno, _("cannot create config directory '%s'"),
@@ -563,17 +920,65 @@ dnsmasqSave(const dnsmasqContext *ctx)
         return -1;
     }
 
-    if (ctx->hostsfile)
-        ret = hostsfileSave(ctx->hostsfile);
+    if (ctx->hostsfile->saved) {
+        if (hostsdirClear(ctx->hostsfile->dirpath, ctx->hostsfile->saved) < 0 ||
+            hostsfileSync(ctx->hostsfile, &reload) < 0 ||
+            hostsdirClear(ctx->addnhostsfile->dirpath,
+                          ctx->addnhostsfile->saved) < 0 ||
+            addnhostsSync(ctx->addnhostsfile, &reload) < 0)
+            return -1;
+
+        genericFileDelete(ctx->hostsfile->path);
+        genericFileDelete(ctx->addnhostsfile->path);
+        return 0;
+    }
+
+    ret = hostsfileSave(ctx->hostsfile);
+    if (ret == 0)
+        ret = addnhostsSave(ctx->addnhostsfile);
+
+    /* the directories left behind by an earlier dnsmasq must go,
+     * networkRefreshDhcpDaemon looks for them */
     if (ret == 0) {
-        if (ctx->addnhostsfile)
-            ret = addnhostsSave(ctx->addnhostsfile);
+        genericDirDelete(ctx->hostsfile->dirpath);
+        genericDirDelete(ctx->addnhostsfile->dirpath);
     }
 
     return ret;
 }
 
 
+/**
+ * dnsmasqUpdate:
+ * @ctx: pointer to the dnsmasq context for each network
+ * @reload: set to true if dnsmasq must be sent SIGHUP to see the changes
+ *
+ * Saves the hosts of a context to disk. With hosts directories (see
+ * dnsmasqContextUseHostsDirs) only the files of the hosts that changed
+ * since the last dnsmasqSave or dnsmasqUpdate on @ctx are written,
+ * and dnsmasq picks up hosts that are merely added without a reload.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+dnsmasqUpdate(dnsmasqContext *ctx,
+              bool *reload)
+{
+    *reload = false;
+
+    if (!ctx->hostsfile->saved) {
+        *reload = true;
+        return dnsmasqSave(ctx);
+    }
+
+    if (hostsfileSync(ctx->hostsfile, reload) < 0 ||
+        addnhostsSync(ctx->addnhostsfile, reload) < 0)
+        return -1;
+
+    return 0;
+}
+
+
 /**
  * dnsmasqDelete:
  * @ctx: pointer to the dnsmasq context for each network
@@ -585,10 +990,16 @@ dnsmasqDelete(const dnsmasqContext *ctx)
 {
     int ret = 0;
 
-    if (ctx->hostsfile)
+    if (ctx->hostsfile) {
         ret = genericFileDelete(ctx->hostsfile->path);
-    if (ctx->addnhostsfile)
+        if (genericDirDelete(ctx->hostsfile->dirpath) < 0)
+            ret = -1;
+    }
+    if (ctx->addnhostsfile) {
         ret = genericFileDelete(ctx->addnhostsfile->path);
+        if (genericDirDelete(ctx->addnhostsfile->dirpath) < 0)
+            ret = -1;
+    }
 
     return ret;
 }
@@ -688,6 +1099,9 @@ dnsmasqCapsSetFromBuffer(dnsmasqCapsPtr caps, const char *buf)
     if (strstr(buf, "--bind-interfaces with SO_BINDTODEVICE"))
         dnsmasqCapsSet(caps, DNSMASQ_CAPS_BINDTODEVICE);
 
+    if (strstr(buf, "--dhcp-hostsdir") && strstr(buf, " --hostsdir"))
+        dnsmasqCapsSet(caps, DNSMASQ_CAPS_HOSTSDIR);
+
     VIR_INFO("dnsmasq version is %d.%d, --bind-dynamic is %spresent, "
              "SO_BINDTODEVICE is %sin use",
              (int)caps->version / 1000000,
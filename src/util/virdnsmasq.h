@@ -25,6 +25,7 @@
 # define __DNSMASQ_H__
 
 # include "virobject.h"
+# include "virhash.h"
 # include "virsocketaddr.h"
 
 typedef struct
@@ -34,6 +35,7 @@ typedef struct
      * "01:23:45:67:89:0a,foo,10.0.0.3".
      */
     char *host;
+    char *ip;   /* names the entry's file in dnsmasq's dhcp-hostsdir */
 
 } dnsmasqDhcpHost;
 
@@ -43,6 +45,9 @@ typedef struct
     dnsmasqDhcpHost *hosts;
 
     char            *path;  /* Absolute path of dnsmasq's hostsfile. */
+    char            *dirpath; /* Absolute path of dnsmasq's dhcp-hostsdir. */
+    virHashTablePtr  saved; /* File name -> contents of the files in
+                             * dirpath, NULL when hostsfile is used. */
 } dnsmasqHostsfile;
 
 typedef struct
@@ -59,6 +64,9 @@ typedef struct
     dnsmasqAddnHost *hosts;
 
     char            *path;  /* Absolute path of dnsmasq's hostsfile. */
+    char            *dirpath; /* Absolute path of dnsmasq's hostsdir. */
+    virHashTablePtr  saved; /* File name -> contents of the files in
+                             * dirpath, NULL when path is used. */
 } dnsmasqAddnHostsfile;
 
 typedef struct
@@ -71,6 +79,7 @@ typedef struct
 typedef enum {
    DNSMASQ_CAPS_BIND_DYNAMIC = 0, /* support for --bind-dynamic */
    DNSMASQ_CAPS_BINDTODEVICE = 1, /* uses SO_BINDTODEVICE for --bind-interfaces */
+   DNSMASQ_CAPS_HOSTSDIR = 2,     /* support for --dhcp-hostsdir and --hostsdir */
 
    DNSMASQ_CAPS_LAST,             /* this must always be the last item */
 } dnsmasqCapsFlags;
@@ -82,6 +91,8 @@ typedef dnsmasqCaps *dnsmasqCapsPtr;
 dnsmasqContext * dnsmasqContextNew(const char *network_name,
                                    const char *config_dir);
 void             dnsmasqContextFree(dnsmasqContext *ctx);
+int              dnsmasqContextUseHostsDirs(dnsmasqContext *ctx);
+void             dnsmasqClearHosts(dnsmasqContext *ctx);
 int              dnsmasqAddDhcpHost(dnsmasqContext *ctx,
                                     const char *mac,
                                     virSocketAddr *ip,
@@ -91,7 +102,9 @@ int              dnsmasqAddDhcpHost(dnsmasqContext *ctx,
 int              dnsmasqAddHost(dnsmasqContext *ctx,
                                 virSocketAddr *ip,
                                 const char *name);
-int              dnsmasqSave(const dnsmasqContext *ctx);
+int              dnsmasqSave(dnsmasqContext *ctx);
+int              dnsmasqUpdate(dnsmasqContext *ctx,
+                               bool *reload);
 int              dnsmasqDelete(const dnsmasqContext *ctx);
 int              dnsmasqReload(pid_t pid);
 
@@ -1,5 +1,5 @@
 /*
- * virhash.c: chained hash tables
+ * virhash.c: chained and open addressing hash tables
  *
  * Reference: Your favorite introductory book on algorithms
  *
@@ -54,6 +54,27 @@ struct _virHashEntry {
     void *payload;
 };
 
+/*
+ * A slot of an open addressing table. @dist is the distance from the
+ * slot the hash code points to, plus one, and 0 for an empty slot.
+ * Entries removed while iterating are left in place with a NULL @name
+ * until the iteration is over, so that nothing moves under it.
+ */
+typedef struct _virHashSlot virHashSlot;
+typedef virHashSlot *virHashSlotPtr;
+struct _virHashSlot {
+    uint32_t code;
+    uint32_t dist;
+    void *name;
+    void *payload;
+};
+
+#define VIR_HASH_SLOT_USED(slot) ((slot)->dist != 0)
+#define VIR_HASH_SLOT_DEAD(slot) ((slot)->dist != 0 && (slot)->name == NULL)
+
+/* How many old slots each change migrates while growing */
+#define VIR_HASH_MIGRATE_STEP 4
+
 /*
  * The entire hash table
  */
@@ -66,6 +87,22 @@ struct _virHashTable {
     bool iterating;
     /* Pointer to the current entry during iteration. */
     virHashEntryPtr current;
+
+    /*
+     * Open addressing tables use robin hood hashing in @slots instead
+     * of @table, with @size being a power of 2. When growing, the
+     * entries are migrated from @oldslots a few at a time by each
+     * change, starting at @oldpos, lookups going through both arrays
+     * meanwhile.
+     */
+    virHashSlotPtr slots;
+    virHashSlotPtr oldslots;
+    size_t oldsize;
+    size_t oldpos;
+    size_t oldElems;
+    size_t deadElems;
+    virHashSlotPtr currentSlot;
+
     virHashDataFree dataFree;
     virHashKeyCode keyCode;
     virHashKeyEqual keyEqual;
@@ -169,6 +206,319 @@ virHashTablePtr virHashCreate(ssize_t size, virHashDataFree dataFree)
                              virHashStrFree);
 }
 
+
+/**
+ * virHashCreateOpenFull:
+ * @size: the expected number of elements
+ * @dataFree: callback to free data
+ * @keyCode: callback to compute hash code
+ * @keyEqual: callback to compare hash keys
+ * @keyCopy: callback to copy hash keys
+ * @keyFree: callback to free keys
+ *
+ * Create a new virHashTablePtr storing its entries in a single array
+ * with open addressing instead of chaining them. This saves an
+ * allocation per entry, keeps hash codes so that they are never
+ * recomputed, and spreads the cost of growing over the following
+ * changes. The table is used through the same API.
+ *
+ * Returns the newly created object, or NULL if an error occurred.
+ */
+virHashTablePtr virHashCreateOpenFull(ssize_t size,
+                                      virHashDataFree dataFree,
+                                      virHashKeyCode keyCode,
+                                      virHashKeyEqual keyEqual,
+                                      virHashKeyCopy keyCopy,
+                                      virHashKeyFree keyFree)
+{
+    virHashTablePtr table = NULL;
+    size_t nslots = 8;
+
+    if (size <= 0)
+        size = 32;
+
+    /* Keep the load under 7/8 */
+    while (nslots / 8 * 7 < (size_t) size)
+        nslots *= 2;
+
+    if (VIR_ALLOC(table) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    table->seed = virRandomBits(32);
+    table->size = nslots;
+    table->nbElems = 0;
+    table->dataFree = dataFree;
+    table->keyCode = keyCode;
+    table->keyEqual = keyEqual;
+    table->keyCopy = keyCopy;
+    table->keyFree = keyFree;
+
+    if (VIR_ALLOC_N(table->slots, nslots) < 0) {
+        virReportOOMError();
+        VIR_FREE(table);
+        return NULL;
+    }
+
+    return table;
+}
+
+
+/**
+ * virHashCreateOpen:
+ * @size: the expected number of elements
+ * @dataFree: callback to free data
+ *
+ * Create a new virHashTablePtr with string keys, using open addressing,
+ * see virHashCreateOpenFull.
+ *
+ * Returns the newly created object, or NULL if an error occurred.
+ */
+virHashTablePtr virHashCreateOpen(ssize_t size, virHashDataFree dataFree)
+{
+    return virHashCreateOpenFull(size,
+                                 dataFree,
+                                 virHashStrCode,
+                                 virHashStrEqual,
+                                 virHashStrCopy,
+                                 virHashStrFree);
+}
+
+
+static virHashSlotPtr
+virHashOpenFind(virHashSlotPtr slots,
+                size_t size,
+                virHashKeyEqual keyEqual,
+                uint32_t code,
+                const void *name)
+{
+    size_t pos = code & (size - 1);
+    uint32_t dist = 1;
+
+    for (;;) {
+        virHashSlotPtr slot = &slots[pos];
+
+        /* robin hood: the entry would have been stored before this one */
+        if (slot->dist < dist)
+            return NULL;
+        if (slot->code == code && slot->name && keyEqual(slot->name, name))
+            return slot;
+
+        pos = (pos + 1) & (size - 1);
+        dist++;
+    }
+}
+
+
+static virHashSlotPtr
+virHashOpenLookup(virHashTablePtr table,
+                  uint32_t code,
+                  const void *name)
+{
+    virHashSlotPtr slot;
+
+    slot = virHashOpenFind(table->slots, table->size, table->keyEqual,
+                           code, name);
+    if (!slot && table->oldslots)
+        slot = virHashOpenFind(table->oldslots, table->oldsize,
+                               table->keyEqual, code, name);
+    return slot;
+}
+
+
+/*
+ * Insert an entry known not to be in @slots yet, moving richer
+ * entries forward as needed
+ */
+static void
+virHashOpenInsert(virHashSlotPtr slots,
+                  size_t size,
+                  uint32_t code,
+                  void *name,
+                  void *payload)
+{
+    virHashSlot entry = { code, 1, name, payload };
+    size_t pos = code & (size - 1);
+
+    for (;;) {
+        virHashSlotPtr slot = &slots[pos];
+
+        if (!VIR_HASH_SLOT_USED(slot)) {
+            *slot = entry;
+            return;
+        }
+        if (slot->dist < entry.dist) {
+            virHashSlot tmp = *slot;
+            *slot = entry;
+            entry = tmp;
+        }
+
+        pos = (pos + 1) & (size - 1);
+        entry.dist++;
+    }
+}
+
+
+/*
+ * Empty the slot at @pos, shifting back the following entries
+ * which aren't in their ideal slot
+ */
+static void
+virHashOpenDelete(virHashSlotPtr slots,
+                  size_t size,
+                  size_t pos)
+{
+    for (;;) {
+        size_t next = (pos + 1) & (size - 1);
+
+        if (slots[next].dist <= 1) {
+            memset(&slots[pos], 0, sizeof(slots[pos]));
+            return;
+        }
+        slots[pos] = slots[next];
+        slots[pos].dist--;
+        pos = next;
+    }
+}
+
+
+/*
+ * Move up to @count old slots to the new array. Since the old slots
+ * are emptied in order, the entries following them get shifted back,
+ * so that the ones not migrated yet can still be found.
+ */
+static void
+virHashOpenMigrate(virHashTablePtr table, size_t count)
+{
+    while (table->oldslots && count--) {
+        virHashSlotPtr slot = &table->oldslots[table->oldpos];
+
+        if (VIR_HASH_SLOT_USED(slot)) {
+            virHashOpenInsert(table->slots, table->size,
+                              slot->code, slot->name, slot->payload);
+            virHashOpenDelete(table->oldslots, table->oldsize,
+                              table->oldpos);
+            table->oldElems--;
+        } else {
+            table->oldpos++;
+        }
+
+        if (table->oldElems == 0 || table->oldpos == table->oldsize) {
+            VIR_FREE(table->oldslots);
+            table->oldsize = 0;
+            table->oldpos = 0;
+            table->oldElems = 0;
+        }
+    }
+}
+
+
+static int
+virHashOpenGrow(virHashTablePtr table)
+{
+    virHashSlotPtr slots;
+
+    /* Finish the previous migration first */
+    virHashOpenMigrate(table, SIZE_MAX);
+
+    if (VIR_ALLOC_N(slots, table->size * 2) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    table->oldslots = table->slots;
+    table->oldsize = table->size;
+    table->oldpos = 0;
+    table->oldElems = table->nbElems;
+    table->slots = slots;
+    table->size *= 2;
+
+    return 0;
+}
+
+
+/*
+ * Actually remove the entries left in place while iterating
+ */
+static void
+virHashOpenPurge(virHashTablePtr table)
+{
+    while (table->deadElems) {
+        size_t i;
+
+        for (i = 0; i < table->size; i++) {
+            while (VIR_HASH_SLOT_DEAD(&table->slots[i])) {
+                virHashOpenDelete(table->slots, table->size, i);
+                table->deadElems--;
+            }
+        }
+        for (i = table->oldpos; table->oldslots && i < table->oldsize; i++) {
+            while (VIR_HASH_SLOT_DEAD(&table->oldslots[i])) {
+                virHashOpenDelete(table->oldslots, table->oldsize, i);
+                table->deadElems--;
+            }
+        }
+    }
+}
+
+
+/*
+ * Remove the entry in @slot, which is either in the new or old array
+ */
+static void
+virHashOpenRemoveSlot(virHashTablePtr table, virHashSlotPtr slot)
+{
+    bool old = table->oldslots &&
+        slot >= table->oldslots && slot < table->oldslots + table->oldsize;
+
+    if (table->dataFree)
+        table->dataFree(slot->payload, slot->name);
+    if (table->keyFree)
+        table->keyFree(slot->name);
+
+    table->nbElems--;
+    if (old)
+        table->oldElems--;
+
+    if (table->iterating) {
+        slot->name = NULL;
+        slot->payload = NULL;
+        table->deadElems++;
+    } else if (old) {
+        virHashOpenDelete(table->oldslots, table->oldsize,
+                          slot - table->oldslots);
+    } else {
+        virHashOpenDelete(table->slots, table->size, slot - table->slots);
+    }
+}
+
+
+/*
+ * Call @iter on every live slot, in the new array then in the part of
+ * the old one not migrated yet, stopping when it returns true
+ */
+static void
+virHashOpenForEach(virHashTablePtr table,
+                   bool (*iter)(virHashTablePtr table,
+                                virHashSlotPtr slot,
+                                void *opaque),
+                   void *opaque)
+{
+    size_t i;
+
+    for (i = 0; i < table->size; i++) {
+        virHashSlotPtr slot = &table->slots[i];
+        if (slot->name && iter(table, slot, opaque))
+            return;
+    }
+    for (i = table->oldpos; table->oldslots && i < table->oldsize; i++) {
+        virHashSlotPtr slot = &table->oldslots[i];
+        if (slot->name && iter(table, slot, opaque))
+            return;
+    }
+}
+
 /**
  * virHashGrow:
  * @table: the hash table
@@ -233,6 +583,16 @@ virHashGrow(virHashTablePtr table, size_t size)
     return 0;
 }
 
+static bool
+virHashOpenFreeIter(virHashTablePtr table,
+                    virHashSlotPtr slot,
+                    void *opaque ATTRIBUTE_UNUSED)
+{
+    /* Leaves a dead slot, the arrays are about to be freed anyway */
+    virHashOpenRemoveSlot(table, slot);
+    return false;
+}
+
 /**
  * virHashFree:
  * @table: the hash table
@@ -248,6 +608,15 @@ virHashFree(virHashTablePtr table)
     if (table == NULL)
         return;
 
+    if (table->slots) {
+        table->iterating = true;
+        virHashOpenForEach(table, virHashOpenFreeIter, NULL);
+        VIR_FREE(table->slots);
+        VIR_FREE(table->oldslots);
+        VIR_FREE(table);
+        return;
+    }
+
     for (i = 0; i < table->size; i++) {
         virHashEntryPtr iter = table->table[i];
         while (iter) {
@@ -266,6 +635,41 @@ virHashFree(virHashTablePtr table)
     VIR_FREE(table);
 }
 
+static int
+virHashOpenAddOrUpdateEntry(virHashTablePtr table, const void *name,
+                            void *userdata,
+                            bool is_update)
+{
+    uint32_t code = table->keyCode(name, table->seed);
+    virHashSlotPtr slot;
+    char *new_name;
+
+    if ((slot = virHashOpenLookup(table, code, name))) {
+        if (!is_update)
+            return -1;
+        if (table->dataFree)
+            table->dataFree(slot->payload, slot->name);
+        slot->payload = userdata;
+        return 0;
+    }
+
+    virHashOpenMigrate(table, VIR_HASH_MIGRATE_STEP);
+
+    if (table->nbElems + 1 > table->size / 8 * 7 &&
+        virHashOpenGrow(table) < 0)
+        return -1;
+
+    if (!(new_name = table->keyCopy(name))) {
+        virReportOOMError();
+        return -1;
+    }
+
+    virHashOpenInsert(table->slots, table->size, code, new_name, userdata);
+    table->nbElems++;
+
+    return 0;
+}
+
 static int
 virHashAddOrUpdateEntry(virHashTablePtr table, const void *name,
                         void *userdata,
@@ -281,6 +685,9 @@ virHashAddOrUpdateEntry(virHashTablePtr table, const void *name,
     if (table->iterating)
         virHashIterationError(-1);
 
+    if (table->slots)
+        return virHashOpenAddOrUpdateEntry(table, name, userdata, is_update);
+
     key = virHashComputeKey(table, name);
 
     /* Check for duplicate entry */
@@ -371,6 +778,14 @@ virHashLookup(virHashTablePtr table, const void *name)
     if (!table || !name)
         return NULL;
 
+    if (table->slots) {
+        virHashSlotPtr slot;
+
+        slot = virHashOpenLookup(table, table->keyCode(name, table->seed),
+                                 name);
+        return slot ? slot->payload : NULL;
+    }
+
     key = virHashComputeKey(table, name);
     for (entry = table->table[key]; entry; entry = entry->next) {
         if (table->keyEqual(entry->name, name))
@@ -458,6 +873,22 @@ virHashRemoveEntry(virHashTablePtr table, const void *name)
     if (table == NULL || name == NULL)
         return -1;
 
+    if (table->slots) {
+        virHashSlotPtr slot;
+
+        slot = virHashOpenLookup(table, table->keyCode(name, table->seed),
+                                 name);
+        if (!slot)
+            return -1;
+        if (table->iterating && table->currentSlot != slot)
+            virHashIterationError(-1);
+
+        virHashOpenRemoveSlot(table, slot);
+        if (!table->iterating)
+            virHashOpenMigrate(table, VIR_HASH_MIGRATE_STEP);
+        return 0;
+    }
+
     nextptr = table->table + virHashComputeKey(table, name);
     for (entry = *nextptr; entry; entry = entry->next) {
         if (table->keyEqual(entry->name, name)) {
@@ -492,6 +923,26 @@ virHashRemoveEntry(virHashTablePtr table, const void *name)
  *
  * Returns number of items iterated over upon completion, -1 on failure
  */
+struct virHashOpenForEachData {
+    virHashIterator iter;
+    void *data;
+    size_t count;
+};
+
+static bool
+virHashOpenForEachIter(virHashTablePtr table,
+                       virHashSlotPtr slot,
+                       void *opaque)
+{
+    struct virHashOpenForEachData *data = opaque;
+
+    table->currentSlot = slot;
+    data->iter(slot->payload, slot->name, data->data);
+    table->currentSlot = NULL;
+    data->count++;
+    return false;
+}
+
 ssize_t
 virHashForEach(virHashTablePtr table, virHashIterator iter, void *data)
 {
@@ -503,6 +954,16 @@ virHashForEach(virHashTablePtr table, virHashIterator iter, void *data)
     if (table->iterating)
         virHashIterationError(-1);
 
+    if (table->slots) {
+        struct virHashOpenForEachData opaque = { iter, data, 0 };
+
+        table->iterating = true;
+        virHashOpenForEach(table, virHashOpenForEachIter, &opaque);
+        table->iterating = false;
+        virHashOpenPurge(table);
+        return opaque.count;
+    }
+
     table->iterating = true;
     table->current = NULL;
     for (i = 0 ; i < table->size ; i++) {
@@ -536,6 +997,27 @@ virHashForEach(virHashTablePtr table, virHashIterator iter, void *data)
  *
  * Returns number of items removed on success, -1 on failure
  */
+struct virHashOpenSearchData {
+    virHashSearcher iter;
+    const void *data;
+    size_t count;
+    void *found;
+};
+
+static bool
+virHashOpenRemoveSetIter(virHashTablePtr table,
+                         virHashSlotPtr slot,
+                         void *opaque)
+{
+    struct virHashOpenSearchData *data = opaque;
+
+    if (data->iter(slot->payload, slot->name, data->data)) {
+        virHashOpenRemoveSlot(table, slot);
+        data->count++;
+    }
+    return false;
+}
+
 ssize_t
 virHashRemoveSet(virHashTablePtr table,
                  virHashSearcher iter,
@@ -549,6 +1031,16 @@ virHashRemoveSet(virHashTablePtr table,
     if (table->iterating)
         virHashIterationError(-1);
 
+    if (table->slots) {
+        struct virHashOpenSearchData opaque = { iter, data, 0, NULL };
+
+        table->iterating = true;
+        virHashOpenForEach(table, virHashOpenRemoveSetIter, &opaque);
+        table->iterating = false;
+        virHashOpenPurge(table);
+        return opaque.count;
+    }
+
     table->iterating = true;
     table->current = NULL;
     for (i = 0 ; i < table->size ; i++) {
@@ -611,6 +1103,20 @@ virHashRemoveAll(virHashTablePtr table)
  * returns non-zero will be returned by this function.
  * The elements are processed in a undefined order
  */
+static bool
+virHashOpenSearchIter(virHashTablePtr table ATTRIBUTE_UNUSED,
+                      virHashSlotPtr slot,
+                      void *opaque)
+{
+    struct virHashOpenSearchData *data = opaque;
+
+    if (data->iter(slot->payload, slot->name, data->data)) {
+        data->found = slot->payload;
+        return true;
+    }
+    return false;
+}
+
 void *virHashSearch(virHashTablePtr table,
                     virHashSearcher iter,
                     const void *data)
@@ -623,6 +1129,15 @@ void *virHashSearch(virHashTablePtr table,
     if (table->iterating)
         virHashIterationError(NULL);
 
+    if (table->slots) {
+        struct virHashOpenSearchData opaque = { iter, data, 0, NULL };
+
+        table->iterating = true;
+        virHashOpenForEach(table, virHashOpenSearchIter, &opaque);
+        table->iterating = false;
+        return opaque.found;
+    }
+
     table->iterating = true;
     table->current = NULL;
     for (i = 0 ; i < table->size ; i++) {
@@ -107,6 +107,14 @@ virHashTablePtr virHashCreateFull(ssize_t size,
                                   virHashKeyEqual keyEqual,
                                   virHashKeyCopy keyCopy,
                                   virHashKeyFree keyFree);
+virHashTablePtr virHashCreateOpen(ssize_t size,
+                                  virHashDataFree dataFree);
+virHashTablePtr virHashCreateOpenFull(ssize_t size,
+                                      virHashDataFree dataFree,
+                                      virHashKeyCode keyCode,
+                                      virHashKeyEqual keyEqual,
+                                      virHashKeyCopy keyCopy,
+                                      virHashKeyFree keyFree);
 void virHashFree(virHashTablePtr table);
 ssize_t virHashSize(virHashTablePtr table);
 ssize_t virHashTableSize(virHashTablePtr table);
@@ -51,6 +51,7 @@
 #include "virtime.h"
 #include "intprops.h"
 #include "virstring.h"
+#include "viratomic.h"
 
 /* Journald output is only supported on Linux new enough to expose
  * htole64.  */
@@ -69,14 +70,60 @@ VIR_ENUM_IMPL(virLogSource, VIR_LOG_FROM_LAST,
               "library");
 
 /*
- * A logging buffer to keep some history over logs
+ * Logging buffers to keep some history over logs
+ *
+ * Each thread records into its own ring, so recording needs no lock.
+ * A ring only ever has one writer, its owning thread, which publishes
+ * the @head and @tail byte positions after writing or before
+ * overwriting the records in between. Each record carries a global
+ * sequence number so that the rings can be merged back in order when
+ * dumped. The rings of exited threads are kept, and reused by new
+ * threads. Rings whose @epoch differs from virLogRingEpoch are stale
+ * and considered empty, which is how they get reset or resized without
+ * touching them from other threads.
+ *
+ * The buffer and its size are swapped as a whole on resize, with the
+ * lock held. A dump may run in a signal handler and can't take the
+ * lock, so the buffers and rings which got unlinked are put aside and
+ * only freed once no dump can still be reading them.
  */
+struct _virLogRingData {
+    struct _virLogRingData *next;   /* once put aside */
+    unsigned int size;              /* power of 2 */
+    char buf[];
+};
+typedef struct _virLogRingData virLogRingData;
+typedef virLogRingData *virLogRingDataPtr;
+
+struct _virLogRing {
+    struct _virLogRing *next;
+    bool owned;
+    virLogRingDataPtr volatile data;
+    int epoch;
+    volatile int head;
+    volatile int tail;
+    virLogRingDataPtr dumpData;     /* only used when dumping */
+    unsigned int dumpPos;
+    unsigned int dumpEnd;
+};
+typedef struct _virLogRing virLogRing;
+typedef virLogRing *virLogRingPtr;
+
+struct _virLogRecord {
+    unsigned int seq;
+    unsigned int len;
+};
+typedef struct _virLogRecord virLogRecord;
+typedef virLogRecord *virLogRecordPtr;
 
 static int virLogSize = 64 * 1024;
-static char *virLogBuffer = NULL;
-static int virLogLen = 0;
-static int virLogStart = 0;
-static int virLogEnd = 0;
+static virLogRingPtr virLogRings = NULL;
+static virThreadLocal virLogRingLocal;
+static volatile int virLogRingEpoch = 0;
+static volatile int virLogRingSeq = 0;
+static volatile int virLogRingDumping = 0;
+static virLogRingPtr virLogRingsUnused = NULL;
+static virLogRingDataPtr virLogRingDataUnused = NULL;
 static regex_t *virLogRegex = NULL;
 
 
@@ -128,8 +175,28 @@ static int virLogNbOutputs = 0;
  */
 static virLogPriority virLogDefaultPriority = VIR_LOG_DEFAULT;
 
+/*
+ * Settings for asynchronous outputs
+ */
+static unsigned int virLogQueueSize = 1024;
+
+/*
+ * Generation of the filtering setup, used by call sites to detect
+ * that their cached decision is stale. Only modified with the lock held.
+ */
+volatile unsigned int virLogFiltersSerial = VIR_LOG_CALLSITE_SERIAL_STEP;
+
 static int virLogResetFilters(void);
 static int virLogResetOutputs(void);
+static void virLogVMessageState(unsigned int state,
+                                virLogSource source,
+                                virLogPriority priority,
+                                const char *filename,
+                                int linenr,
+                                const char *funcname,
+                                virLogMetadataPtr metadata,
+                                const char *fmt,
+                                va_list vargs) ATTRIBUTE_FMT_PRINTF(8, 0);
 static void virLogOutputToFd(virLogSource src,
                              virLogPriority priority,
                              const char *filename,
@@ -161,6 +228,23 @@ virLogUnlock(void)
 }
 
 
+/*
+ * Invalidate all the decisions cached by the call sites, must be called
+ * with the lock held after the filters, the default priority or the
+ * debug buffer changed
+ */
+static void
+virLogFiltersChanged(void)
+{
+    unsigned int serial = VIR_LOG_CALLSITE_GET(&virLogFiltersSerial);
+
+    serial += VIR_LOG_CALLSITE_SERIAL_STEP;
+    if (serial == 0)
+        serial = VIR_LOG_CALLSITE_SERIAL_STEP;
+    VIR_LOG_CALLSITE_SET(&virLogFiltersSerial, serial);
+}
+
+
 static const char *
 virLogOutputString(virLogDestination ldest)
 {
@@ -173,6 +257,10 @@ virLogOutputString(virLogDestination ldest)
         return "file";
     case VIR_LOG_TO_JOURNALD:
         return "journald";
+    case VIR_LOG_TO_ASYNC_FILE:
+        return "asyncfile";
+    case VIR_LOG_TO_BINARY_FILE:
+        return "binaryfile";
     }
     return "unknown";
 }
@@ -195,33 +283,91 @@ virLogPriorityString(virLogPriority lvl)
 }
 
 
+static void
+virLogRingRelease(void *opaque)
+{
+    virLogRingPtr ring = opaque;
+
+    /* Keep the history around, but let another thread take over */
+    virLogLock();
+    ring->owned = false;
+    virLogUnlock();
+}
+
+
+/*
+ * Free the rings and buffers put aside, unless a dump is running, in
+ * which case they are left for the next call. Must be called with the
+ * lock held.
+ */
+static void
+virLogRingsCollect(void)
+{
+    virLogRingPtr ring;
+    virLogRingDataPtr data;
+
+    if (!virLogRingsUnused && !virLogRingDataUnused)
+        return;
+
+    /*
+     * Checking that no dump is running and starting to free must be a
+     * single step. A dump starting once we hold the counter at -1 can
+     * only reach what is still linked, and the final increment leaves
+     * it counted.
+     */
+    if (!virAtomicIntCompareExchange(&virLogRingDumping, 0, -1))
+        return;
+
+    while ((ring = virLogRingsUnused)) {
+        virLogRingsUnused = ring->next;
+        VIR_FREE(ring->data);
+        VIR_FREE(ring);
+    }
+    while ((data = virLogRingDataUnused)) {
+        virLogRingDataUnused = data->next;
+        VIR_FREE(data);
+    }
+
+    virAtomicIntInc(&virLogRingDumping);
+}
+
+
+/*
+ * Free the rings no thread owns anymore, along with their history.
+ * Must be called with the lock held.
+ */
+static void
+virLogRingsTrim(void)
+{
+    virLogRingPtr *prev = &virLogRings;
+    virLogRingPtr ring;
+
+    while ((ring = *prev)) {
+        if (ring->owned) {
+            prev = &ring->next;
+            continue;
+        }
+        *prev = ring->next;
+        ring->next = virLogRingsUnused;
+        virLogRingsUnused = ring;
+    }
+
+    virLogRingsCollect();
+}
+
+
 static int
 virLogOnceInit(void)
 {
-    const char *pbm = NULL;
-
     if (virMutexInit(&virLogMutex) < 0)
         return -1;
 
+    if (virThreadLocalInit(&virLogRingLocal, virLogRingRelease) < 0)
+        return -1;
+
     virLogLock();
-    if (VIR_ALLOC_N(virLogBuffer, virLogSize + 1) < 0) {
-        /*
-         * The debug buffer is not a critical component, allow startup
-         * even in case of failure to allocate it in case of a
-         * configuration mistake.
-         */
-        virLogSize = 64 * 1024;
-        if (VIR_ALLOC_N(virLogBuffer, virLogSize + 1) < 0) {
-            pbm = "Failed to allocate debug buffer: deactivating debug log\n";
-            virLogSize = 0;
-        } else {
-            pbm = "Failed to allocate debug buffer: reduced to 64 kB\n";
-        }
-    }
-    virLogLen = 0;
-    virLogStart = 0;
-    virLogEnd = 0;
     virLogDefaultPriority = VIR_LOG_DEFAULT;
+    virLogFiltersChanged();
 
     if (VIR_ALLOC(virLogRegex) >= 0) {
         if (regcomp(virLogRegex, VIR_LOG_REGEX, REG_EXTENDED) != 0)
@@ -229,8 +375,6 @@ virLogOnceInit(void)
     }
 
     virLogUnlock();
-    if (pbm)
-        VIR_WARN("%s", pbm);
     return 0;
 }
 
@@ -241,19 +385,17 @@ VIR_ONCE_GLOBAL_INIT(virLog)
  * virLogSetBufferSize:
  * @size: size of the buffer in kilobytes or <= 0 to deactivate
  *
- * Dynamically set the size or deactivate the logging buffer used to keep
- * a trace of all recent debug output. Note that the content of the buffer
- * is lost if it gets reallocated.
+ * Dynamically set the size or deactivate the logging buffers used to keep
+ * a trace of all recent debug output. Each thread gets a buffer of that
+ * size, rounded down to a power of 2, allocated the first time it logs.
+ * Note that the content of the buffers is lost if they get resized.
  *
  * Return -1 in case of failure or 0 in case of success
  */
 int
 virLogSetBufferSize(int size)
 {
-    int ret = 0;
-    int oldsize;
-    char *oldLogBuffer;
-    const char *pbm = NULL;
+    unsigned int bytes;
 
     if (size < 0)
         size = 0;
@@ -261,38 +403,26 @@ virLogSetBufferSize(int size)
     if (virLogInitialize() < 0)
         return -1;
 
-    if (size * 1024 == virLogSize)
-        return ret;
-
-    virLogLock();
-
-    oldsize = virLogSize;
-    oldLogBuffer = virLogBuffer;
-
     if (INT_MAX / 1024 <= size) {
-        pbm = "Requested log size of %d kB too large\n";
-        ret = -1;
-        goto error;
+        VIR_ERROR("Requested log size of %d kB too large", size);
+        return -1;
     }
 
-    virLogSize = size * 1024;
-    if (VIR_ALLOC_N(virLogBuffer, virLogSize + 1) < 0) {
-        pbm = "Failed to allocate debug buffer of %d kB\n";
-        virLogBuffer = oldLogBuffer;
-        virLogSize = oldsize;
-        ret = -1;
-        goto error;
-    }
-    VIR_FREE(oldLogBuffer);
-    virLogLen = 0;
-    virLogStart = 0;
-    virLogEnd = 0;
+    bytes = size * 1024;
+    while (bytes & (bytes - 1))
+        bytes &= bytes - 1;
 
-error:
+    if (bytes == (unsigned int) virLogSize)
+        return 0;
+
+    virLogLock();
+    virLogSize = bytes;
+    virAtomicIntInc(&virLogRingEpoch);
+    if (bytes == 0)
+        virLogRingsTrim();
+    virLogFiltersChanged();
     virLogUnlock();
-    if (pbm)
-        VIR_ERROR(pbm, size);
-    return ret;
+    return 0;
 }
 
 
@@ -312,54 +442,163 @@ virLogReset(void)
     virLogLock();
     virLogResetFilters();
     virLogResetOutputs();
-    virLogLen = 0;
-    virLogStart = 0;
-    virLogEnd = 0;
+    virAtomicIntInc(&virLogRingEpoch);
+    virLogRingsTrim();
     virLogDefaultPriority = VIR_LOG_DEFAULT;
+    virLogFiltersChanged();
     virLogUnlock();
     return 0;
 }
 
 
 /*
- * Store a string in the ring buffer
+ * Get the ring of the calling thread, allocating or adopting one on
+ * first use, and resetting it if it became stale
  */
+static virLogRingPtr
+virLogRingGet(void)
+{
+    virLogRingPtr ring = virThreadLocalGet(&virLogRingLocal);
+    int epoch = virAtomicIntGet(&virLogRingEpoch);
+
+    if (!ring) {
+        virLogLock();
+        for (ring = virLogRings; ring; ring = ring->next) {
+            if (!ring->owned)
+                break;
+        }
+        if (!ring) {
+            if (VIR_ALLOC(ring) < 0) {
+                virLogUnlock();
+                return NULL;
+            }
+            ring->epoch = epoch - 1;
+            ring->next = virLogRings;
+            virLogRings = ring;
+        }
+        ring->owned = true;
+        virLogUnlock();
+
+        if (virThreadLocalSet(&virLogRingLocal, ring) < 0) {
+            virLogRingRelease(ring);
+            return NULL;
+        }
+    }
+
+    if (ring->epoch != epoch) {
+        virLogRingDataPtr old = ring->data;
+        virLogRingDataPtr data = NULL;
+
+        virLogLock();
+        virAtomicIntSet(&ring->tail, virAtomicIntGet(&ring->head));
+        if ((old ? old->size : 0) != (unsigned int) virLogSize) {
+            if (virLogSize &&
+                VIR_ALLOC_VAR(data, char, virLogSize) < 0) {
+                virLogUnlock();
+                return NULL;
+            }
+            if (data)
+                data->size = virLogSize;
+            ring->data = data;
+            /* A dump may still be reading the old buffer */
+            if (old) {
+                old->next = virLogRingDataUnused;
+                virLogRingDataUnused = old;
+            }
+            virLogRingsCollect();
+        }
+        ring->epoch = epoch;
+        virLogUnlock();
+    }
+
+    return ring->data ? ring : NULL;
+}
+
+
 static void
-virLogStr(const char *str)
+virLogRingWrite(virLogRingDataPtr ring,
+                unsigned int pos,
+                const void *data,
+                unsigned int len)
 {
-    int tmp;
-    int len;
+    unsigned int off = pos & (ring->size - 1);
+    unsigned int tmp = ring->size - off;
 
-    if ((str == NULL) || (virLogBuffer == NULL) || (virLogSize <= 0))
-        return;
-    len = strlen(str);
-    if (len >= virLogSize)
-        return;
+    if (len <= tmp) {
+        memcpy(ring->buf + off, data, len);
+    } else {
+        memcpy(ring->buf + off, data, tmp);
+        memcpy(ring->buf, (const char *)data + tmp, len - tmp);
+    }
+}
 
-    /*
-     * copy the data and reset the end, we cycle over the end of the buffer
-     */
-    if (virLogEnd + len >= virLogSize) {
-        tmp = virLogSize - virLogEnd;
-        memcpy(&virLogBuffer[virLogEnd], str, tmp);
-        memcpy(&virLogBuffer[0], &str[tmp], len - tmp);
-        virLogEnd = len - tmp;
+
+static void
+virLogRingRead(virLogRingDataPtr ring,
+               unsigned int pos,
+               void *data,
+               unsigned int len)
+{
+    unsigned int off = pos & (ring->size - 1);
+    unsigned int tmp = ring->size - off;
+
+    if (len <= tmp) {
+        memcpy(data, ring->buf + off, len);
     } else {
-        memcpy(&virLogBuffer[virLogEnd], str, len);
-        virLogEnd += len;
+        memcpy(data, ring->buf + off, tmp);
+        memcpy((char *)data + tmp, ring->buf, len - tmp);
     }
-    virLogBuffer[virLogEnd] = 0;
+}
+
+
+/*
+ * Store a message in the ring buffer of the calling thread
+ */
+static void
+virLogStr(const char *timestamp, const char *msg)
+{
+    virLogRingPtr ring;
+    virLogRingDataPtr data;
+    virLogRecord rec;
+    unsigned int tslen, msglen, need;
+    unsigned int head, tail;
+
+    if (virLogSize <= 0 || !(ring = virLogRingGet()))
+        return;
+    data = ring->data;
+
+    tslen = strlen(timestamp);
+    msglen = strlen(msg);
+    rec.len = tslen + 2 + msglen;
+    need = sizeof(rec) + rec.len;
+    if (need > data->size)
+        return;
+
     /*
-     * Update the log length, and if full move the start index
+     * drop the oldest records until there is enough room, and publish
+     * the new tail before overwriting them
      */
-    virLogLen += len;
-    if (virLogLen > virLogSize) {
-        tmp = virLogLen - virLogSize;
-        virLogLen = virLogSize;
-        virLogStart += tmp;
-        if (virLogStart >= virLogSize)
-            virLogStart -= virLogSize;
+    head = ring->head;
+    tail = ring->tail;
+    while (head + need - tail > data->size) {
+        virLogRecord old;
+        virLogRingRead(data, tail, &old, sizeof(old));
+        tail += sizeof(old) + old.len;
     }
+    if (tail != (unsigned int) ring->tail)
+        virAtomicIntSet(&ring->tail, tail);
+
+    rec.seq = virAtomicIntInc(&virLogRingSeq);
+    virLogRingWrite(data, head, &rec, sizeof(rec));
+    head += sizeof(rec);
+    virLogRingWrite(data, head, timestamp, tslen);
+    head += tslen;
+    virLogRingWrite(data, head, ": ", 2);
+    head += 2;
+    virLogRingWrite(data, head, msg, msglen);
+    head += msglen;
+
+    virAtomicIntSet(&ring->head, head);
 }
 
 
@@ -398,8 +637,10 @@ virLogDumpAllFD(const char *msg, int len)
 void
 virLogEmergencyDumpAll(int signum)
 {
-    int len;
-    int oldLogStart, oldLogLen;
+    virLogRingPtr ring;
+    virLogRingDataPtr data;
+    unsigned int pos, off, len;
+    int epoch;
 
     switch (signum) {
 #ifdef SIGFPE
@@ -436,7 +677,7 @@ virLogEmergencyDumpAll(int signum)
             virLogDumpAllFD("Caught unexpected signal", -1);
             break;
     }
-    if ((virLogBuffer == NULL) || (virLogSize <= 0)) {
+    if (virLogSize <= 0) {
         virLogDumpAllFD(" internal log buffer deactivated\n", -1);
         return;
     }
@@ -444,35 +685,68 @@ virLogEmergencyDumpAll(int signum)
     virLogDumpAllFD(" dumping internal log buffer:\n", -1);
     virLogDumpAllFD("\n\n    ====== start of log =====\n\n", -1);
 
+    /* Keep rings and buffers from being freed until we are done */
+    virAtomicIntInc(&virLogRingDumping);
+
     /*
-     * Since we can't lock the buffer safely from a signal handler
-     * we mark it as empty in case of concurrent access, and proceed
-     * with the data, at worse we will output something a bit weird
-     * if another thread start logging messages at the same time.
-     * Note that virLogStr() uses virLogEnd for the computations and
-     * writes to the buffer and only then updates virLogLen and virLogStart
-     * so it's best to reset it first.
+     * Since we can't lock anything safely from a signal handler, we
+     * take the content of each ring as published by its owner and
+     * then mark them all as empty. At worse we will output something
+     * a bit weird if another thread overwrites its oldest records
+     * while we are dumping them.
      */
-    oldLogStart = virLogStart;
-    oldLogLen = virLogLen;
-    virLogEnd = 0;
-    virLogLen = 0;
-    virLogStart = 0;
-
-    while (oldLogLen > 0) {
-        if (oldLogStart + oldLogLen < virLogSize) {
-            virLogBuffer[oldLogStart + oldLogLen] = 0;
-            virLogDumpAllFD(&virLogBuffer[oldLogStart], oldLogLen);
-            oldLogStart += oldLogLen;
-            oldLogLen = 0;
+    epoch = virAtomicIntGet(&virLogRingEpoch);
+    for (ring = virLogRings; ring; ring = ring->next) {
+        ring->dumpPos = ring->dumpEnd = 0;
+        ring->dumpData = ring->data;
+        if (ring->epoch != epoch || !ring->dumpData)
+            continue;
+        ring->dumpPos = virAtomicIntGet(&ring->tail);
+        ring->dumpEnd = virAtomicIntGet(&ring->head);
+        /* positions left over from before a resize */
+        if (ring->dumpEnd - ring->dumpPos > ring->dumpData->size)
+            ring->dumpPos = ring->dumpEnd;
+    }
+    virAtomicIntInc(&virLogRingEpoch);
+
+    /*
+     * Merge the rings by always picking the record with the lowest
+     * sequence number among their oldest ones
+     */
+    for (;;) {
+        virLogRingPtr next = NULL;
+        virLogRecord nextrec = { 0, 0 };
+        virLogRecord rec;
+
+        for (ring = virLogRings; ring; ring = ring->next) {
+            if (ring->dumpEnd - ring->dumpPos < sizeof(rec))
+                continue;
+            virLogRingRead(ring->dumpData, ring->dumpPos, &rec, sizeof(rec));
+            if (rec.len > ring->dumpEnd - ring->dumpPos - sizeof(rec)) {
+                ring->dumpPos = ring->dumpEnd;
+                continue;
+            }
+            if (!next || (int) (rec.seq - nextrec.seq) < 0) {
+                next = ring;
+                nextrec = rec;
+            }
+        }
+        if (!next)
+            break;
+
+        data = next->dumpData;
+        pos = next->dumpPos + sizeof(nextrec);
+        off = pos & (data->size - 1);
+        len = data->size - off;
+        if (nextrec.len <= len) {
+            virLogDumpAllFD(data->buf + off, nextrec.len);
         } else {
-            len = virLogSize - oldLogStart;
-            virLogBuffer[virLogSize] = 0;
-            virLogDumpAllFD(&virLogBuffer[oldLogStart], len);
-            oldLogLen -= len;
-            oldLogStart = 0;
+            virLogDumpAllFD(data->buf + off, len);
+            virLogDumpAllFD(data->buf, nextrec.len - len);
         }
+        next->dumpPos = pos + nextrec.len;
     }
+    ignore_value(virAtomicIntDecAndTest(&virLogRingDumping));
     virLogDumpAllFD("\n\n     ====== end of log =====\n\n", -1);
 }
 
@@ -497,7 +771,41 @@ virLogSetDefaultPriority(virLogPriority priority)
     if (virLogInitialize() < 0)
         return -1;
 
+    virLogLock();
     virLogDefaultPriority = priority;
+    virLogFiltersChanged();
+    virLogUnlock();
+    return 0;
+}
+
+
+/**
+ * virLogSetQueueSize:
+ * @size: the number of messages
+ *
+ * Set how many messages can be queued for each asynchronous output
+ * defined afterwards, rounded up to a power of 2.
+ *
+ * Returns 0 if successful, -1 in case of error.
+ */
+int
+virLogSetQueueSize(int size)
+{
+    unsigned int slots = 2;
+
+    if (size <= 0 || size > INT_MAX / 2) {
+        VIR_WARN("Ignoring invalid log queue size %d", size);
+        return -1;
+    }
+    if (virLogInitialize() < 0)
+        return -1;
+
+    while (slots < (unsigned int) size)
+        slots <<= 1;
+
+    virLogLock();
+    virLogQueueSize = slots;
+    virLogUnlock();
     return 0;
 }
 
@@ -518,6 +826,7 @@ virLogResetFilters(void)
         VIR_FREE(virLogFilters[i].match);
     VIR_FREE(virLogFilters);
     virLogNbFilters = 0;
+    virLogFiltersChanged();
     return i;
 }
 
@@ -553,6 +862,7 @@ virLogDefineFilter(const char *match,
     for (i = 0;i < virLogNbFilters;i++) {
         if (STREQ(virLogFilters[i].match, match)) {
             virLogFilters[i].priority = priority;
+            virLogFiltersChanged();
             goto cleanup;
         }
     }
@@ -572,6 +882,7 @@ virLogDefineFilter(const char *match,
     virLogFilters[i].priority = priority;
     virLogFilters[i].flags = flags;
     virLogNbFilters++;
+    virLogFiltersChanged();
 cleanup:
     virLogUnlock();
     return i;
@@ -584,7 +895,8 @@ cleanup:
  *
  * Check the input of the message against the existing filters. Currently
  * the match is just a substring check of the category used as the input
- * string, a more subtle approach could be used instead
+ * string, a more subtle approach could be used instead. Must be called
+ * with the lock held.
  *
  * Returns 0 if not matched or the new priority if found.
  */
@@ -595,7 +907,6 @@ virLogFiltersCheck(const char *input,
     int ret = 0;
     int i;
 
-    virLogLock();
     for (i = 0;i < virLogNbFilters;i++) {
         if (strstr(input, virLogFilters[i].match)) {
             ret = virLogFilters[i].priority;
@@ -603,11 +914,57 @@ virLogFiltersCheck(const char *input,
             break;
         }
     }
-    virLogUnlock();
     return ret;
 }
 
 
+/**
+ * virLogCallsiteUpdate:
+ * @site: the call site cache
+ * @filename: file where the call site lives
+ *
+ * Run the filters against @filename and store the outcome in @site,
+ * tagged with the current virLogFiltersSerial.
+ *
+ * Returns the new state of @site
+ */
+unsigned int
+virLogCallsiteUpdate(virLogCallsitePtr site,
+                     const char *filename)
+{
+    unsigned int state;
+    unsigned int filterflags = 0;
+    int fprio;
+    int record;
+
+    if (virLogInitialize() < 0) {
+        /* Drop everything, but retry on the next message */
+        return VIR_LOG_CALLSITE_PRIORITY_MASK |
+            (VIR_LOG_CALLSITE_PRIORITY_MASK << VIR_LOG_CALLSITE_RECORD_SHIFT);
+    }
+
+    virLogLock();
+    fprio = virLogFiltersCheck(filename, &filterflags);
+    if (fprio == 0)
+        fprio = virLogDefaultPriority;
+
+    /* Everything goes to the debug buffer if there is one */
+    if (virLogSize > 0)
+        record = VIR_LOG_DEBUG;
+    else
+        record = fprio;
+
+    state = VIR_LOG_CALLSITE_GET(&virLogFiltersSerial) | fprio |
+        (record << VIR_LOG_CALLSITE_RECORD_SHIFT);
+    if (filterflags & VIR_LOG_STACK_TRACE)
+        state |= VIR_LOG_CALLSITE_STACK_TRACE;
+    VIR_LOG_CALLSITE_SET(&site->state, state);
+    virLogUnlock();
+
+    return state;
+}
+
+
 /**
  * virLogResetOutputs:
  *
@@ -664,7 +1021,8 @@ virLogDefineOutput(virLogOutputFunc f,
     if (f == NULL)
         return -1;
 
-    if (dest == VIR_LOG_TO_SYSLOG || dest == VIR_LOG_TO_FILE) {
+    if (dest == VIR_LOG_TO_SYSLOG || dest == VIR_LOG_TO_FILE ||
+        dest == VIR_LOG_TO_ASYNC_FILE || dest == VIR_LOG_TO_BINARY_FILE) {
         if (name == NULL)
             return -1;
         ndup = strdup(name);
@@ -774,6 +1132,38 @@ virLogMessage(virLogSource source,
 }
 
 
+/**
+ * virLogCallsiteMessage:
+ * @site: the call site cache
+ * @source: where is that message coming from
+ * @priority: the priority level
+ * @filename: file where the message was emitted
+ * @linenr: line where the message was emitted
+ * @funcname: the function emitting the (debug) message
+ * @fmt: the string format
+ * @...: the arguments
+ *
+ * Same as virLogMessage but relying on the filtering decision cached
+ * in @site, see VIR_LOG_CALLSITE
+ */
+void
+virLogCallsiteMessage(virLogCallsitePtr site,
+                      virLogSource source,
+                      virLogPriority priority,
+                      const char *filename,
+                      int linenr,
+                      const char *funcname,
+                      const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    virLogVMessageState(VIR_LOG_CALLSITE_GET(&site->state), source, priority,
+                        filename, linenr, funcname,
+                        NULL, fmt, ap);
+    va_end(ap);
+}
+
+
 /**
  * virLogVMessage:
  * @source: where is that message coming from
@@ -797,12 +1187,39 @@ virLogVMessage(virLogSource source,
                virLogMetadataPtr metadata,
                const char *fmt,
                va_list vargs)
+{
+    virLogCallsite site = { 0 };
+
+    /*
+     * check against list of specific logging patterns
+     */
+    virLogCallsiteUpdate(&site, filename);
+    virLogVMessageState(site.state, source, priority,
+                        filename, linenr, funcname,
+                        metadata, fmt, vargs);
+}
+
+
+/*
+ * Format, store and emit a message, @state being the filtering
+ * decision for @filename as computed by virLogCallsiteUpdate
+ */
+static void
+virLogVMessageState(unsigned int state,
+                    virLogSource source,
+                    virLogPriority priority,
+                    const char *filename,
+                    int linenr,
+                    const char *funcname,
+                    virLogMetadataPtr metadata,
+                    const char *fmt,
+                    va_list vargs)
 {
     static bool logVersionStderr = true;
     char *str = NULL;
     char *msg = NULL;
     char timestamp[VIR_TIME_STRING_BUFLEN];
-    int fprio, i, ret;
+    int i, ret;
     int saved_errno = errno;
     int emit = 1;
     unsigned int filterflags = 0;
@@ -813,18 +1230,14 @@ virLogVMessage(virLogSource source,
     if (fmt == NULL)
         goto cleanup;
 
-    /*
-     * check against list of specific logging patterns
-     */
-    fprio = virLogFiltersCheck(filename, &filterflags);
-    if (fprio == 0) {
-        if (priority < virLogDefaultPriority)
-            emit = 0;
-    } else if (priority < fprio) {
+    if (priority < (state & VIR_LOG_CALLSITE_PRIORITY_MASK))
         emit = 0;
-    }
+    if (state & VIR_LOG_CALLSITE_STACK_TRACE)
+        filterflags |= VIR_LOG_STACK_TRACE;
 
-    if ((emit == 0) && ((virLogBuffer == NULL) || (virLogSize <= 0)))
+    if ((emit == 0) &&
+        (priority < ((state >> VIR_LOG_CALLSITE_RECORD_SHIFT) &
+                     VIR_LOG_CALLSITE_PRIORITY_MASK)))
         goto cleanup;
 
     /*
@@ -849,11 +1262,7 @@ virLogVMessage(virLogSource source,
      *       threads, but avoid intermixing. Maybe set up locks per output
      *       to improve paralellism.
      */
-    virLogLock();
-    virLogStr(timestamp);
-    virLogStr(": ");
-    virLogStr(msg);
-    virLogUnlock();
+    virLogStr(timestamp, msg);
     if (emit == 0)
         goto cleanup;
 
@@ -991,6 +1400,419 @@ virLogAddOutputToFile(virLogPriority priority,
 }
 
 
+/*
+ * Asynchronous outputs
+ *
+ * Messages are turned into self contained records by the logging thread,
+ * queued in a bounded ring of slots, and written out by a dedicated
+ * writer thread, so that a stalled disk doesn't stall the callers.
+ * Outputs are always called with virLogLock held, so there is a single
+ * producer at a time, and a single consumer, the writer thread. Each
+ * slot holds a sequence number telling whether it is free for position
+ * @pos (seq == pos) or holds the record queued at @pos (seq == pos + 1).
+ * Messages which don't fit are dropped and counted rather than waited
+ * for, since waiting would stall every logging thread behind the global
+ * lock. The mutex and condition are only used to put the writer to sleep.
+ */
+#define VIR_LOG_BINARY_MAGIC "VIRLOG01"
+#define VIR_LOG_BINARY_VERSION 1
+#define VIR_LOG_BINARY_HEADER_LEN 32
+
+struct _virLogAsyncRecord {
+    size_t len;
+    char data[];
+};
+typedef struct _virLogAsyncRecord virLogAsyncRecord;
+typedef virLogAsyncRecord *virLogAsyncRecordPtr;
+
+struct _virLogAsyncSlot {
+    volatile int seq;
+    virLogAsyncRecordPtr rec;
+};
+typedef struct _virLogAsyncSlot virLogAsyncSlot;
+typedef virLogAsyncSlot *virLogAsyncSlotPtr;
+
+struct _virLogAsync {
+    int fd;
+    bool binary;
+
+    unsigned int size;              /* power of 2 */
+    virLogAsyncSlotPtr slots;
+    unsigned int enqueuePos;        /* under virLogLock */
+    unsigned int dequeuePos;        /* writer thread only */
+
+    volatile int dropped;
+
+    virMutex lock;
+    virCond wakeWriter;
+    volatile int writerSleeping;
+    bool quit;
+    virThread writer;
+};
+typedef struct _virLogAsync virLogAsync;
+typedef virLogAsync *virLogAsyncPtr;
+
+
+static void
+virLogBinaryPut16(char *buf, unsigned int val)
+{
+    buf[0] = val & 0xff;
+    buf[1] = (val >> 8) & 0xff;
+}
+
+
+static void
+virLogBinaryPut32(char *buf, unsigned int val)
+{
+    virLogBinaryPut16(buf, val & 0xffff);
+    virLogBinaryPut16(buf + 2, val >> 16);
+}
+
+
+static void
+virLogBinaryPut64(char *buf, unsigned long long val)
+{
+    virLogBinaryPut32(buf, val & 0xffffffff);
+    virLogBinaryPut32(buf + 4, val >> 32);
+}
+
+
+/*
+ * Encode a message in the binary format, all integers being little
+ * endian and strings not NUL terminated:
+ *
+ *   0  uint32  record length, including this field
+ *   4  uint8   format version
+ *   5  uint8   source, see virLogSource
+ *   6  uint8   priority, see virLogPriority
+ *   7  uint8   flags, see virLogFlags
+ *   8  uint64  timestamp, milliseconds since the epoch
+ *  16  uint64  thread ID
+ *  24  uint32  line number
+ *  28  uint16  file name length
+ *  30  uint16  function name length
+ *  32  file name, function name, and the unformatted message
+ *      taking up the rest of the record
+ *
+ * Files hold VIR_LOG_BINARY_MAGIC followed by the records.
+ */
+static virLogAsyncRecordPtr
+virLogAsyncEncodeBinary(virLogSource source,
+                        virLogPriority priority,
+                        const char *filename,
+                        int linenr,
+                        const char *funcname,
+                        unsigned int flags,
+                        const char *rawstr)
+{
+    virLogAsyncRecordPtr rec;
+    unsigned long long now;
+    size_t filelen = filename ? strlen(filename) : 0;
+    size_t funclen = funcname ? strlen(funcname) : 0;
+    size_t msglen = strlen(rawstr);
+    size_t len;
+    char *buf;
+
+    filelen = MIN(filelen, 0xffff);
+    funclen = MIN(funclen, 0xffff);
+    len = VIR_LOG_BINARY_HEADER_LEN + filelen + funclen + msglen;
+    if (len > UINT_MAX ||
+        VIR_ALLOC_VAR(rec, char, len) < 0)
+        return NULL;
+
+    if (virTimeMillisNow(&now) < 0)
+        now = 0;
+
+    rec->len = len;
+    buf = rec->data;
+    virLogBinaryPut32(buf, len);
+    buf[4] = VIR_LOG_BINARY_VERSION;
+    buf[5] = source;
+    buf[6] = priority;
+    buf[7] = flags;
+    virLogBinaryPut64(buf + 8, now);
+    virLogBinaryPut64(buf + 16, virThreadSelfID());
+    virLogBinaryPut32(buf + 24, linenr);
+    virLogBinaryPut16(buf + 28, filelen);
+    virLogBinaryPut16(buf + 30, funclen);
+    buf += VIR_LOG_BINARY_HEADER_LEN;
+    memcpy(buf, filename, filelen);
+    memcpy(buf + filelen, funcname, funclen);
+    memcpy(buf + filelen + funclen, rawstr, msglen);
+
+    return rec;
+}
+
+
+static virLogAsyncRecordPtr
+virLogAsyncEncodeText(const char *timestamp,
+                      const char *str)
+{
+    virLogAsyncRecordPtr rec;
+    size_t tslen = strlen(timestamp);
+    size_t len = strlen(str);
+
+    if (VIR_ALLOC_VAR(rec, char, tslen + 2 + len) < 0)
+        return NULL;
+
+    rec->len = tslen + 2 + len;
+    memcpy(rec->data, timestamp, tslen);
+    memcpy(rec->data + tslen, ": ", 2);
+    memcpy(rec->data + tslen + 2, str, len);
+
+    return rec;
+}
+
+
+static bool
+virLogAsyncPush(virLogAsyncPtr async,
+                virLogAsyncRecordPtr rec)
+{
+    unsigned int pos = async->enqueuePos;
+    virLogAsyncSlotPtr slot = &async->slots[pos & (async->size - 1)];
+
+    /* still holding the record queued one lap ago */
+    if (virAtomicIntGet(&slot->seq) != (int) pos)
+        return false;
+
+    slot->rec = rec;
+    virAtomicIntSet(&slot->seq, pos + 1);
+    async->enqueuePos++;
+    return true;
+}
+
+
+static virLogAsyncRecordPtr
+virLogAsyncPop(virLogAsyncPtr async)
+{
+    unsigned int pos = async->dequeuePos;
+    virLogAsyncSlotPtr slot = &async->slots[pos & (async->size - 1)];
+    virLogAsyncRecordPtr rec;
+
+    if (virAtomicIntGet(&slot->seq) != (int) (pos + 1))
+        return NULL;
+
+    rec = slot->rec;
+    slot->rec = NULL;
+    virAtomicIntSet(&slot->seq, pos + async->size);
+    async->dequeuePos++;
+    return rec;
+}
+
+
+/*
+ * Record in the log itself that messages were dropped
+ */
+static void
+virLogAsyncWriteNote(virLogAsyncPtr async,
+                     const char *fmt,
+                     int count)
+{
+    virLogAsyncRecordPtr rec;
+    char timestamp[VIR_TIME_STRING_BUFLEN];
+    char *str = NULL;
+    char *msg = NULL;
+
+    if (virAsprintf(&str, fmt, count) < 0)
+        return;
+
+    if (async->binary) {
+        rec = virLogAsyncEncodeBinary(VIR_LOG_FROM_FILE, VIR_LOG_WARN,
+                                      __FILE__, __LINE__, __func__, 0, str);
+    } else {
+        if (virTimeStringNowRaw(timestamp) < 0)
+            timestamp[0] = '\0';
+        if (virLogFormatString(&msg, __LINE__, __func__,
+                               VIR_LOG_WARN, str) < 0)
+            goto cleanup;
+        rec = virLogAsyncEncodeText(timestamp, msg);
+    }
+
+    if (rec)
+        ignore_value(safewrite(async->fd, rec->data, rec->len));
+    VIR_FREE(rec);
+
+cleanup:
+    VIR_FREE(str);
+    VIR_FREE(msg);
+}
+
+
+/*
+ * The writer thread. It must not log anything, which could end up
+ * waiting for itself.
+ */
+static void
+virLogAsyncWriter(void *opaque)
+{
+    virLogAsyncPtr async = opaque;
+    int dropped = 0;
+    bool quit = false;
+
+    for (;;) {
+        virLogAsyncRecordPtr rec;
+        int tmp;
+
+        while ((rec = virLogAsyncPop(async))) {
+            ignore_value(safewrite(async->fd, rec->data, rec->len));
+            VIR_FREE(rec);
+        }
+
+        if ((tmp = virAtomicIntGet(&async->dropped)) != dropped) {
+            virLogAsyncWriteNote(async, "Log queue overflow, %d messages "
+                                 "dropped", tmp - dropped);
+            dropped = tmp;
+        }
+
+        if (quit)
+            break;
+
+        virMutexLock(&async->lock);
+        virAtomicIntSet(&async->writerSleeping, 1);
+        while (!async->quit &&
+               virAtomicIntGet(&async->slots[async->dequeuePos &
+                                             (async->size - 1)].seq) !=
+               (int) (async->dequeuePos + 1)) {
+            if (virCondWait(&async->wakeWriter, &async->lock) < 0)
+                break;
+        }
+        virAtomicIntSet(&async->writerSleeping, 0);
+        /* drain what's left before leaving */
+        quit = async->quit;
+        virMutexUnlock(&async->lock);
+    }
+}
+
+
+static void
+virLogOutputToAsync(virLogSource source,
+                    virLogPriority priority,
+                    const char *filename,
+                    int linenr,
+                    const char *funcname,
+                    const char *timestamp,
+                    virLogMetadataPtr metadata ATTRIBUTE_UNUSED,
+                    unsigned int flags,
+                    const char *rawstr,
+                    const char *str,
+                    void *data)
+{
+    virLogAsyncPtr async = data;
+    virLogAsyncRecordPtr rec;
+
+    if (async->binary)
+        rec = virLogAsyncEncodeBinary(source, priority, filename, linenr,
+                                      funcname, flags, rawstr);
+    else
+        rec = virLogAsyncEncodeText(timestamp, str);
+    if (!rec)
+        return;
+
+    if (!virLogAsyncPush(async, rec)) {
+        virAtomicIntInc(&async->dropped);
+        VIR_FREE(rec);
+    }
+
+    if (virAtomicIntGet(&async->writerSleeping)) {
+        virMutexLock(&async->lock);
+        virCondSignal(&async->wakeWriter);
+        virMutexUnlock(&async->lock);
+    }
+}
+
+
+static void
+virLogAsyncFree(virLogAsyncPtr async)
+{
+    virLogAsyncRecordPtr rec;
+
+    if (!async)
+        return;
+
+    while ((rec = virLogAsyncPop(async)))
+        VIR_FREE(rec);
+    VIR_FREE(async->slots);
+    virCondDestroy(&async->wakeWriter);
+    virMutexDestroy(&async->lock);
+    VIR_LOG_CLOSE(async->fd);
+    VIR_FREE(async);
+}
+
+
+static void
+virLogCloseAsync(void *data)
+{
+    virLogAsyncPtr async = data;
+
+    virMutexLock(&async->lock);
+    async->quit = true;
+    virCondSignal(&async->wakeWriter);
+    virMutexUnlock(&async->lock);
+
+    virThreadJoin(&async->writer);
+    virLogAsyncFree(async);
+}
+
+
+static int
+virLogAddOutputToAsync(virLogPriority priority,
+                       const char *file,
+                       bool binary)
+{
+    virLogAsyncPtr async;
+    struct stat sb;
+    unsigned int i;
+
+    if (VIR_ALLOC(async) < 0)
+        return -1;
+    async->fd = -1;
+
+    if (virMutexInit(&async->lock) < 0) {
+        VIR_FREE(async);
+        return -1;
+    }
+    if (virCondInit(&async->wakeWriter) < 0) {
+        virMutexDestroy(&async->lock);
+        VIR_FREE(async);
+        return -1;
+    }
+
+    async->binary = binary;
+    async->size = virLogQueueSize;
+    if (VIR_ALLOC_N(async->slots, async->size) < 0)
+        goto error;
+    for (i = 0; i < async->size; i++)
+        async->slots[i].seq = i;
+
+    async->fd = open(file, O_CREAT | O_APPEND | O_WRONLY, S_IRUSR | S_IWUSR);
+    if (async->fd < 0)
+        goto error;
+
+    if (binary &&
+        fstat(async->fd, &sb) == 0 && sb.st_size == 0 &&
+        safewrite(async->fd, VIR_LOG_BINARY_MAGIC,
+                  strlen(VIR_LOG_BINARY_MAGIC)) < 0)
+        goto error;
+
+    if (virThreadCreate(&async->writer, true, virLogAsyncWriter, async) < 0)
+        goto error;
+
+    if (virLogDefineOutput(virLogOutputToAsync, virLogCloseAsync, async,
+                           priority,
+                           binary ? VIR_LOG_TO_BINARY_FILE :
+                           VIR_LOG_TO_ASYNC_FILE,
+                           file, 0) < 0) {
+        virLogCloseAsync(async);
+        return -1;
+    }
+    return 0;
+
+error:
+    virLogAsyncFree(async);
+    return -1;
+}
+
+
 #if HAVE_SYSLOG_H
 static int
 virLogPrioritySyslog(virLogPriority priority)
@@ -1280,6 +2102,12 @@ static int virLogAddOutputToJournald(int priority)
  *       use syslog for the output and use the given name as the ident
  *    x:file:file_path
  *       output to a file, with the given filepath
+ *    x:asyncfile:file_path
+ *       same as file, but written by a separate thread, see
+ *       virLogSetQueueSize
+ *    x:binaryfile:file_path
+ *       output to a file in a compact binary format, written by a
+ *       separate thread
  * In all case the x prefix is the minimal level, acting as a filter
  *    1: DEBUG
  *    2: INFO
@@ -1336,8 +2164,21 @@ virLogParseOutputs(const char *outputs)
                 count++;
             VIR_FREE(name);
 #endif /* HAVE_SYSLOG_H */
-        } else if (STREQLEN(cur, "file", 4)) {
-            cur += 4;
+        } else if (STREQLEN(cur, "file", 4) ||
+                   STREQLEN(cur, "asyncfile", 9) ||
+                   STREQLEN(cur, "binaryfile", 10)) {
+            virLogDestination dest = VIR_LOG_TO_FILE;
+            int rc;
+
+            if (STREQLEN(cur, "asyncfile", 9)) {
+                dest = VIR_LOG_TO_ASYNC_FILE;
+                cur += 9;
+            } else if (STREQLEN(cur, "binaryfile", 10)) {
+                dest = VIR_LOG_TO_BINARY_FILE;
+                cur += 10;
+            } else {
+                cur += 4;
+            }
             if (*cur != ':')
                 goto cleanup;
             cur++;
@@ -1353,7 +2194,12 @@ virLogParseOutputs(const char *outputs)
                 VIR_FREE(name);
                 return -1; /* skip warning here because setting was fine */
             }
-            if (virLogAddOutputToFile(prio, abspath) == 0)
+            if (dest == VIR_LOG_TO_FILE)
+                rc = virLogAddOutputToFile(prio, abspath);
+            else
+                rc = virLogAddOutputToAsync(prio, abspath,
+                                            dest == VIR_LOG_TO_BINARY_FILE);
+            if (rc == 0)
                 count++;
             VIR_FREE(name);
             VIR_FREE(abspath);
@@ -1507,6 +2353,8 @@ virLogGetOutputs(void)
         switch (dest) {
             case VIR_LOG_TO_SYSLOG:
             case VIR_LOG_TO_FILE:
+            case VIR_LOG_TO_ASYNC_FILE:
+            case VIR_LOG_TO_BINARY_FILE:
                 virBufferAsprintf(&outputbuf, "%d:%s:%s",
                                   virLogOutputs[i].priority,
                                   virLogOutputString(dest),
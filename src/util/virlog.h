@@ -24,6 +24,7 @@
 
 # include "internal.h"
 # include "virbuffer.h"
+# include "viratomic.h"
 
 /*
  * To be made public
@@ -42,6 +43,8 @@ typedef enum {
     VIR_LOG_TO_SYSLOG,
     VIR_LOG_TO_FILE,
     VIR_LOG_TO_JOURNALD,
+    VIR_LOG_TO_ASYNC_FILE,
+    VIR_LOG_TO_BINARY_FILE,
 } virLogDestination;
 
 typedef enum {
@@ -54,6 +57,78 @@ typedef enum {
     VIR_LOG_FROM_LAST,
 } virLogSource;
 
+/*
+ * Every call site using one of the VIR_DEBUG/VIR_INFO/VIR_WARN/VIR_ERROR
+ * macros below keeps a static copy of the filter decision for its source
+ * file, packed in a single word together with the value of
+ * virLogFiltersSerial it was computed for. As long as the filters, the
+ * default priority and the debug buffer don't change, deciding that a
+ * message is to be dropped needs no lock and no string matching.
+ */
+# define VIR_LOG_CALLSITE_PRIORITY_MASK  0x07
+# define VIR_LOG_CALLSITE_RECORD_SHIFT   3
+# define VIR_LOG_CALLSITE_STACK_TRACE    (1 << 6)
+# define VIR_LOG_CALLSITE_SERIAL_STEP    (1 << 8)
+# define VIR_LOG_CALLSITE_SERIAL_MASK    (~(VIR_LOG_CALLSITE_SERIAL_STEP - 1))
+
+/* Both the state of a call site and virLogFiltersSerial are shared by
+ * all threads without a lock. Each is a single word, so reading them
+ * needs no more than an acquire load; virAtomicIntGet would put a full
+ * barrier in front of every disabled message. Updates are rare and
+ * use virAtomicIntSet. */
+struct _virLogCallsite {
+    volatile unsigned int state;
+};
+typedef struct _virLogCallsite virLogCallsite;
+typedef virLogCallsite *virLogCallsitePtr;
+
+extern volatile unsigned int virLogFiltersSerial;
+
+# ifdef __ATOMIC_ACQUIRE
+#  define VIR_LOG_CALLSITE_GET(ptr) \
+    ((unsigned int) __atomic_load_n((ptr), __ATOMIC_ACQUIRE))
+# else
+#  define VIR_LOG_CALLSITE_GET(ptr) \
+    ((unsigned int) *(ptr))
+# endif
+# define VIR_LOG_CALLSITE_SET(ptr, val) \
+    virAtomicIntSet((volatile int *) (ptr), (int) (val))
+
+extern unsigned int virLogCallsiteUpdate(virLogCallsitePtr site,
+                                         const char *filename);
+
+/**
+ * virLogCallsiteEnabled:
+ * @site: the call site cache
+ * @priority: the priority of the message
+ * @filename: file where the message is emitted
+ *
+ * Returns true if a message of @priority from @site has to be formatted,
+ * refreshing the cached decision first if the filters changed.
+ */
+static inline bool
+virLogCallsiteEnabled(virLogCallsitePtr site,
+                      virLogPriority priority,
+                      const char *filename)
+{
+    unsigned int state = VIR_LOG_CALLSITE_GET(&site->state);
+
+    if ((state & VIR_LOG_CALLSITE_SERIAL_MASK) !=
+        VIR_LOG_CALLSITE_GET(&virLogFiltersSerial))
+        state = virLogCallsiteUpdate(site, filename);
+
+    return priority >= ((state >> VIR_LOG_CALLSITE_RECORD_SHIFT) &
+                        VIR_LOG_CALLSITE_PRIORITY_MASK);
+}
+
+# define VIR_LOG_CALLSITE(src, priority, ...)                            \
+    do {                                                                \
+        static virLogCallsite virLogSite;                               \
+        if (virLogCallsiteEnabled(&virLogSite, priority, __FILE__))     \
+            virLogCallsiteMessage(&virLogSite, src, priority, __FILE__, \
+                                  __LINE__, __func__, __VA_ARGS__);     \
+    } while (0)
+
 /*
  * If configured with --enable-debug=yes then library calls
  * are printed to stderr for debugging or to an appropriate channel
@@ -62,6 +137,8 @@ typedef enum {
 # ifdef ENABLE_DEBUG
 #  define VIR_DEBUG_INT(src, filename, linenr, funcname, ...)           \
     virLogMessage(src, VIR_LOG_DEBUG, filename, linenr, funcname, NULL, __VA_ARGS__)
+#  define VIR_DEBUG_CALLSITE(src, ...)                                  \
+    VIR_LOG_CALLSITE(src, VIR_LOG_DEBUG, __VA_ARGS__)
 # else
 /**
  * virLogEatParams:
@@ -75,6 +152,8 @@ static inline void virLogEatParams(virLogSource unused, ...)
 }
 #  define VIR_DEBUG_INT(src, filename, linenr, funcname, ...)           \
     virLogEatParams(src, filename, linenr, funcname, __VA_ARGS__)
+#  define VIR_DEBUG_CALLSITE(src, ...)                                  \
+    virLogEatParams(src, __VA_ARGS__)
 # endif /* !ENABLE_DEBUG */
 
 # define VIR_INFO_INT(src, filename, linenr, funcname, ...)             \
@@ -85,13 +164,13 @@ static inline void virLogEatParams(virLogSource unused, ...)
     virLogMessage(src, VIR_LOG_ERROR, filename, linenr, funcname, NULL, __VA_ARGS__)
 
 # define VIR_DEBUG(...)                                                 \
-    VIR_DEBUG_INT(VIR_LOG_FROM_FILE, __FILE__, __LINE__, __func__, __VA_ARGS__)
+    VIR_DEBUG_CALLSITE(VIR_LOG_FROM_FILE, __VA_ARGS__)
 # define VIR_INFO(...)                                                  \
-    VIR_INFO_INT(VIR_LOG_FROM_FILE, __FILE__, __LINE__, __func__, __VA_ARGS__)
+    VIR_LOG_CALLSITE(VIR_LOG_FROM_FILE, VIR_LOG_INFO, __VA_ARGS__)
 # define VIR_WARN(...)                                                  \
-    VIR_WARN_INT(VIR_LOG_FROM_FILE, __FILE__, __LINE__, __func__, __VA_ARGS__)
+    VIR_LOG_CALLSITE(VIR_LOG_FROM_FILE, VIR_LOG_WARN, __VA_ARGS__)
 # define VIR_ERROR(...)                                                 \
-    VIR_ERROR_INT(VIR_LOG_FROM_FILE, __FILE__, __LINE__, __func__, __VA_ARGS__)
+    VIR_LOG_CALLSITE(VIR_LOG_FROM_FILE, VIR_LOG_ERROR, __VA_ARGS__)
 
 
 struct _virLogMetadata {
@@ -149,6 +228,7 @@ extern char *virLogGetFilters(void);
 extern char *virLogGetOutputs(void);
 extern virLogPriority virLogGetDefaultPriority(void);
 extern int virLogSetDefaultPriority(virLogPriority priority);
+extern int virLogSetQueueSize(int size);
 extern void virLogSetFromEnv(void);
 extern int virLogDefineFilter(const char *match,
                               virLogPriority priority,
@@ -186,6 +266,13 @@ extern void virLogVMessage(virLogSource src,
                            virLogMetadataPtr metadata,
                            const char *fmt,
                            va_list vargs) ATTRIBUTE_FMT_PRINTF(7, 0);
+extern void virLogCallsiteMessage(virLogCallsitePtr site,
+                                  virLogSource src,
+                                  virLogPriority priority,
+                                  const char *filename,
+                                  int linenr,
+                                  const char *funcname,
+                                  const char *fmt, ...) ATTRIBUTE_FMT_PRINTF(7, 8);
 extern int virLogSetBufferSize(int size);
 extern void virLogEmergencyDumpAll(int signum);
 
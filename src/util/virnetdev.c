@@ -23,6 +23,7 @@
 #include <config.h>
 
 #include "virnetdev.h"
+#include "virnetdevbridge.h"
 #include "virmacaddr.h"
 #include "virfile.h"
 #include "virerror.h"
@@ -950,6 +951,350 @@ int virNetDevValidateConfig(const char *ifname ATTRIBUTE_UNUSED,
 #endif
 
 
+#if defined(__linux__) && defined(HAVE_LIBNL)
+/* NB, these are not static as we need to call them from the testsuite */
+struct nl_msg *virNetDevLinkSetMsgNew(const char *ifname,
+                                      const virNetDevLinkInfoPtr info);
+int virNetDevLinkInfoParse(struct nlmsghdr *resp,
+                           virNetDevLinkInfoPtr info);
+bool virNetDevLinkMasterIgnored(const virNetDevLinkInfoPtr info,
+                                int err,
+                                const virNetDevLinkInfoPtr actual);
+
+static struct nl_msg *
+virNetDevLinkMsgNew(int type,
+                    const char *ifname,
+                    struct ifinfomsg *ifinfo)
+{
+    struct nl_msg *nl_msg;
+
+    if (!(nl_msg = nlmsg_alloc_simple(type, NLM_F_REQUEST))) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    if (nlmsg_append(nl_msg, ifinfo, sizeof(*ifinfo), NLMSG_ALIGNTO) < 0 ||
+        nla_put(nl_msg, IFLA_IFNAME, strlen(ifname) + 1, ifname) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+        nlmsg_free(nl_msg);
+        return NULL;
+    }
+
+    return nl_msg;
+}
+
+
+/*
+ * Build the RTM_SETLINK request changing the attributes of @ifname
+ * selected by @info->fields.
+ */
+struct nl_msg *
+virNetDevLinkSetMsgNew(const char *ifname,
+                       const virNetDevLinkInfoPtr info)
+{
+    struct ifinfomsg ifinfo = {
+        .ifi_family = AF_UNSPEC,
+    };
+    struct nl_msg *nl_msg;
+
+    if (info->fields & VIR_NETDEV_LINK_ONLINE) {
+        ifinfo.ifi_change = IFF_UP;
+        ifinfo.ifi_flags = info->online ? IFF_UP : 0;
+    }
+
+    if (!(nl_msg = virNetDevLinkMsgNew(RTM_SETLINK, ifname, &ifinfo)))
+        return NULL;
+
+    if (info->fields & VIR_NETDEV_LINK_MAC) {
+        unsigned char mac[VIR_MAC_BUFLEN];
+
+        virMacAddrGetRaw(&info->mac, mac);
+        if (nla_put(nl_msg, IFLA_ADDRESS, sizeof(mac), mac) < 0)
+            goto buffer_too_small;
+    }
+
+    if ((info->fields & VIR_NETDEV_LINK_MTU) &&
+        nla_put_u32(nl_msg, IFLA_MTU, info->mtu) < 0)
+        goto buffer_too_small;
+
+    if ((info->fields & VIR_NETDEV_LINK_MASTER) &&
+        nla_put_u32(nl_msg, IFLA_MASTER, info->master) < 0)
+        goto buffer_too_small;
+
+    return nl_msg;
+
+buffer_too_small:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("allocated netlink buffer is too small"));
+    nlmsg_free(nl_msg);
+    return NULL;
+}
+
+
+/*
+ * Fill @info from the kernel's RTM_NEWLINK answer @resp.
+ */
+int
+virNetDevLinkInfoParse(struct nlmsghdr *resp,
+                       virNetDevLinkInfoPtr info)
+{
+    struct ifinfomsg *ifi;
+    struct nlattr *tb[IFLA_MAX + 1];
+
+    memset(info, 0, sizeof(*info));
+
+    if (!resp || resp->nlmsg_type != RTM_NEWLINK ||
+        nlmsg_parse(resp, sizeof(*ifi), tb, IFLA_MAX, NULL) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("malformed netlink response message"));
+        return -1;
+    }
+
+    ifi = nlmsg_data(resp);
+    info->ifindex = ifi->ifi_index;
+    info->online = !!(ifi->ifi_flags & IFF_UP);
+    info->fields = VIR_NETDEV_LINK_ONLINE;
+
+    if (tb[IFLA_MTU]) {
+        info->mtu = nla_get_u32(tb[IFLA_MTU]);
+        info->fields |= VIR_NETDEV_LINK_MTU;
+    }
+
+    if (tb[IFLA_ADDRESS] && nla_len(tb[IFLA_ADDRESS]) == VIR_MAC_BUFLEN) {
+        virMacAddrSetRaw(&info->mac, nla_data(tb[IFLA_ADDRESS]));
+        info->fields |= VIR_NETDEV_LINK_MAC;
+    }
+
+    if (tb[IFLA_MASTER]) {
+        info->master = nla_get_u32(tb[IFLA_MASTER]);
+        info->fields |= VIR_NETDEV_LINK_MASTER;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Tell whether the bridge asked for in @info still has to be set
+ * with the bridge ioctl, given the answer @err to the RTM_SETLINK
+ * request and, if that succeeded, the link attributes @actual read
+ * back afterwards. Kernels older than 2.6.39 either refuse
+ * IFLA_MASTER altogether, in which case nothing was changed, or
+ * silently ignore it and apply the rest.
+ */
+bool
+virNetDevLinkMasterIgnored(const virNetDevLinkInfoPtr info,
+                           int err,
+                           const virNetDevLinkInfoPtr actual)
+{
+    if (!(info->fields & VIR_NETDEV_LINK_MASTER))
+        return false;
+
+    if (err < 0)
+        return err == -EOPNOTSUPP;
+
+    return !(actual->fields & VIR_NETDEV_LINK_MASTER) ||
+        actual->master != info->master;
+}
+
+
+/**
+ * virNetDevGetLinkInfo:
+ * @ifname: the interface name
+ * @info: where to store the link attributes
+ *
+ * Query the index, MTU, MAC address, state and bridge of @ifname
+ * with a single request. @info->fields tells which of the attributes
+ * were reported; @info->ifindex always is.
+ *
+ * Returns 0 in case of success or -1 on failure.
+ */
+int virNetDevGetLinkInfo(const char *ifname,
+                         virNetDevLinkInfoPtr info)
+{
+    int ret = -1;
+    struct ifinfomsg ifinfo = {
+        .ifi_family = AF_UNSPEC,
+    };
+    struct nlmsghdr *resp = NULL;
+    struct nl_msg *nl_msg;
+    int err;
+
+    memset(info, 0, sizeof(*info));
+
+    if (!(nl_msg = virNetDevLinkMsgNew(RTM_GETLINK, ifname, &ifinfo)))
+        return -1;
+
+    if (virNetlinkCommandBatch(&nl_msg, 1, &err, &resp, NETLINK_ROUTE) < 0)
+        goto cleanup;
+
+    if (err < 0) {
+        virReportSystemError(-err,
+                             _("Cannot get interface link info on '%s'"),
+                             ifname);
+        goto cleanup;
+    }
+
+    if (virNetDevLinkInfoParse(resp, info) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    nlmsg_free(nl_msg);
+    VIR_FREE(resp);
+    return ret;
+}
+
+
+/**
+ * virNetDevSetLinkInfo:
+ * @ifname: the interface name
+ * @info: the link attributes to set
+ *
+ * Change the attributes of @ifname selected by @info->fields with a
+ * single request: the MAC address and MTU are set first, then the
+ * interface is brought up or down and finally added to the bridge
+ * whose index is @info->master. When a bridge is given, the link is
+ * read back in the same batch and the bridge ioctl is used if the
+ * kernel did not add the port.
+ *
+ * Returns 0 in case of success or -1 on failure.
+ */
+int virNetDevSetLinkInfo(const char *ifname,
+                         const virNetDevLinkInfoPtr info)
+{
+    int ret = -1;
+    struct ifinfomsg ifinfo = {
+        .ifi_family = AF_UNSPEC,
+    };
+    struct nl_msg *msgs[2] = { NULL, NULL };
+    struct nlmsghdr *resps[2] = { NULL, NULL };
+    int errs[2];
+    size_t nmsgs = 1;
+    virNetDevLinkInfo actual;
+    virNetDevLinkInfo rest;
+    char brname[IF_NAMESIZE];
+
+    memset(&actual, 0, sizeof(actual));
+
+    if (!(msgs[0] = virNetDevLinkSetMsgNew(ifname, info)))
+        return -1;
+
+    if (info->fields & VIR_NETDEV_LINK_MASTER) {
+        if (!(msgs[1] = virNetDevLinkMsgNew(RTM_GETLINK, ifname, &ifinfo)))
+            goto cleanup;
+        nmsgs++;
+    }
+
+    if (virNetlinkCommandBatch(msgs, nmsgs, errs, resps, NETLINK_ROUTE) < 0)
+        goto cleanup;
+
+    if (errs[0] == 0 && nmsgs > 1) {
+        if (errs[1] < 0) {
+            virReportSystemError(-errs[1],
+                                 _("Cannot get interface link info on '%s'"),
+                                 ifname);
+            goto cleanup;
+        }
+        if (virNetDevLinkInfoParse(resps[1], &actual) < 0)
+            goto cleanup;
+    }
+
+    if (!virNetDevLinkMasterIgnored(info, errs[0], &actual)) {
+        if (errs[0] < 0) {
+            virReportSystemError(-errs[0],
+                                 _("Cannot set interface link info on '%s'"),
+                                 ifname);
+            goto cleanup;
+        }
+        ret = 0;
+        goto cleanup;
+    }
+
+    /* If the whole request was refused, apply everything but the
+     * bridge again, still before adding the port */
+    rest = *info;
+    rest.fields &= ~VIR_NETDEV_LINK_MASTER;
+    if (errs[0] < 0 && rest.fields &&
+        virNetDevSetLinkInfo(ifname, &rest) < 0)
+        goto cleanup;
+
+    if (!if_indextoname(info->master, brname)) {
+        virReportSystemError(errno,
+                             _("Unable to get name of interface %d"),
+                             info->master);
+        goto cleanup;
+    }
+
+    if (virNetDevBridgeAddPort(brname, ifname) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    nlmsg_free(msgs[0]);
+    nlmsg_free(msgs[1]);
+    VIR_FREE(resps[0]);
+    VIR_FREE(resps[1]);
+    return ret;
+}
+#else /* !(defined(__linux__) && defined(HAVE_LIBNL)) */
+int virNetDevGetLinkInfo(const char *ifname,
+                         virNetDevLinkInfoPtr info)
+{
+    int mtu;
+
+    memset(info, 0, sizeof(*info));
+
+    if (virNetDevGetIndex(ifname, &info->ifindex) < 0 ||
+        (mtu = virNetDevGetMTU(ifname)) < 0 ||
+        virNetDevGetMAC(ifname, &info->mac) < 0 ||
+        virNetDevIsOnline(ifname, &info->online) < 0)
+        return -1;
+
+    info->mtu = mtu;
+    info->fields = VIR_NETDEV_LINK_MTU | VIR_NETDEV_LINK_MAC |
+        VIR_NETDEV_LINK_ONLINE;
+    return 0;
+}
+
+
+int virNetDevSetLinkInfo(const char *ifname,
+                         const virNetDevLinkInfoPtr info)
+{
+    if ((info->fields & VIR_NETDEV_LINK_MAC) &&
+        virNetDevSetMAC(ifname, &info->mac) < 0)
+        return -1;
+
+    if ((info->fields & VIR_NETDEV_LINK_MTU) &&
+        virNetDevSetMTU(ifname, info->mtu) < 0)
+        return -1;
+
+    if ((info->fields & VIR_NETDEV_LINK_ONLINE) &&
+        virNetDevSetOnline(ifname, info->online) < 0)
+        return -1;
+
+    if (info->fields & VIR_NETDEV_LINK_MASTER) {
+        char brname[IF_NAMESIZE];
+
+        if (!if_indextoname(info->master, brname)) {
+            virReportSystemError(errno,
+                                 _("Unable to get name of interface %d"),
+                                 info->master);
+            return -1;
+        }
+
+        if (virNetDevBridgeAddPort(brname, ifname) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+#endif /* !(defined(__linux__) && defined(HAVE_LIBNL)) */
+
+
 #ifdef __linux__
 # define NET_SYSFS "/sys/class/net/"
 
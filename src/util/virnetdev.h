@@ -84,6 +84,31 @@ int virNetDevSetName(const char *ifname, const char *newifname)
 int virNetDevGetIndex(const char *ifname, int *ifindex)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
 
+typedef enum {
+    VIR_NETDEV_LINK_MTU    = (1 << 0),
+    VIR_NETDEV_LINK_MAC    = (1 << 1),
+    VIR_NETDEV_LINK_ONLINE = (1 << 2),
+    VIR_NETDEV_LINK_MASTER = (1 << 3),
+} virNetDevLinkField;
+
+typedef struct _virNetDevLinkInfo virNetDevLinkInfo;
+typedef virNetDevLinkInfo *virNetDevLinkInfoPtr;
+struct _virNetDevLinkInfo {
+    unsigned int fields; /* bitwise-OR of virNetDevLinkField */
+    int ifindex;         /* only reported, never changed */
+    int mtu;
+    virMacAddr mac;
+    bool online;
+    int master;          /* ifindex of the bridge the link is part of */
+};
+
+int virNetDevGetLinkInfo(const char *ifname,
+                         virNetDevLinkInfoPtr info)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+int virNetDevSetLinkInfo(const char *ifname,
+                         const virNetDevLinkInfoPtr info)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+
 int virNetDevGetVLanID(const char *ifname, int *vlanid)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
 
@@ -27,6 +27,24 @@
 #include "viralloc.h"
 #include "virerror.h"
 #include "virstring.h"
+#include "virfile.h"
+#include "virnetdev.h"
+#include "virnetlink.h"
+#include "virthread.h"
+#include "virlog.h"
+
+#if defined(__linux__) && defined(HAVE_LIBNL)
+# include <stdio.h>
+# include <arpa/inet.h>
+# include <linux/if_ether.h>
+# include <linux/pkt_cls.h>
+# include <linux/pkt_sched.h>
+# include <linux/rtnetlink.h>
+
+/* QoS is configured by talking rtnetlink directly rather
+ * than by running tc(8) several times per interface */
+# define VIR_NETDEV_BANDWIDTH_NETLINK 1
+#endif
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -42,25 +60,837 @@ virNetDevBandwidthFree(virNetDevBandwidthPtr def)
 }
 
 
-/**
- * virNetDevBandwidthSet:
- * @ifname: on which interface
- * @bandwidth: rates to set (may be NULL)
- * @hierarchical_class: whether to create hierarchical class
- *
- * This function enables QoS on specified interface
- * and set given traffic limits for both, incoming
- * and outgoing traffic. Any previous setting get
- * overwritten. If @hierarchical_class is TRUE, create
- * hierarchical class. It is used to guarantee minimal
- * throughput ('floor' attribute in NIC).
+#ifdef VIR_NETDEV_BANDWIDTH_NETLINK
+
+/* Defaults of tc(8), so that QoS ends up configured in the kernel
+ * exactly as the equivalent tc command line would do it */
+# define VIR_NETDEV_BANDWIDTH_HTB_MTU 1600
+# define VIR_NETDEV_BANDWIDTH_POLICE_MTU (64 * 1024)
+# define VIR_NETDEV_BANDWIDTH_SFQ_PERTURB 10
+
+/* Packet scheduler clock, see /proc/net/psched */
+static double virNetDevBandwidthTickInUsec = 1;
+static unsigned int virNetDevBandwidthHz = 100;
+
+static int
+virNetDevBandwidthOnceInit(void)
+{
+    FILE *fp;
+    unsigned int t2us, us2t, clockRes, hz;
+
+    /* Keep the defaults if the file cannot be read, like tc does */
+    if (!(fp = fopen("/proc/net/psched", "r")))
+        return 0;
+
+    if (fscanf(fp, "%08x%08x%08x%08x", &t2us, &us2t, &clockRes, &hz) == 4 &&
+        us2t) {
+        if (clockRes == 1000000000)
+            t2us = us2t;
+        virNetDevBandwidthTickInUsec = (double)t2us / us2t *
+            ((double)clockRes / 1000000);
+        if (clockRes == 1000000)
+            virNetDevBandwidthHz = hz;
+    }
+
+    VIR_FORCE_FCLOSE(fp);
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virNetDevBandwidth)
+
+
+/* NB, these are not static as we need to call them from the testsuite */
+struct nl_msg *virNetDevBandwidthHTBClassMsgNew(int ifindex,
+                                                int flags,
+                                                uint32_t parent,
+                                                uint32_t classid,
+                                                unsigned long long rate,
+                                                unsigned long long ceil,
+                                                unsigned long long burst);
+struct nl_msg *virNetDevBandwidthU32FilterMsgNew(int ifindex,
+                                                 uint32_t parent,
+                                                 uint32_t prio,
+                                                 const virMacAddrPtr mac,
+                                                 uint32_t classid,
+                                                 unsigned long long rate,
+                                                 unsigned long long burst);
+
+
+/* Time in scheduler ticks to send @size bytes at @rate bytes/s */
+static unsigned int
+virNetDevBandwidthXmitTime(unsigned long long rate,
+                           unsigned long long size)
+{
+    unsigned int usec = 1000000 * ((double)size / rate);
+
+    return usec * virNetDevBandwidthTickInUsec;
+}
+
+
+static void
+virNetDevBandwidthRateTable(struct tc_ratespec *spec,
+                            uint32_t *rtab,
+                            unsigned long long rate,
+                            unsigned int mtu)
+{
+    int cell_log = 0;
+    size_t i;
+
+    memset(spec, 0, sizeof(*spec));
+    spec->rate = rate > UINT32_MAX ? UINT32_MAX : rate;
+
+    while ((mtu >> cell_log) > 255)
+        cell_log++;
+
+    for (i = 0; i < 256; i++)
+        rtab[i] = virNetDevBandwidthXmitTime(spec->rate, (i + 1) << cell_log);
+
+    spec->cell_align = -1;
+    spec->cell_log = cell_log;
+# ifdef TC_LINKLAYER_MASK
+    spec->linklayer = TC_LINKLAYER_ETHERNET;
+# endif
+}
+
+
+/* Start a new traffic control request on interface @ifindex */
+static struct nl_msg *
+virNetDevBandwidthMsgNew(int ifindex,
+                         int type,
+                         int flags,
+                         uint32_t parent,
+                         uint32_t handle,
+                         uint32_t info,
+                         const char *kind)
+{
+    struct nl_msg *nl_msg;
+    struct tcmsg tcm = {
+        .tcm_family = AF_UNSPEC,
+        .tcm_ifindex = ifindex,
+        .tcm_parent = parent,
+        .tcm_handle = handle,
+        .tcm_info = info,
+    };
+
+    if (!(nl_msg = nlmsg_alloc_simple(type, NLM_F_REQUEST | flags))) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    if (nlmsg_append(nl_msg, &tcm, sizeof(tcm), NLMSG_ALIGNTO) < 0 ||
+        (kind && nla_put_string(nl_msg, TCA_KIND, kind) < 0)) {
+        nlmsg_free(nl_msg);
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+        return NULL;
+    }
+
+    return nl_msg;
+}
+
+
+static struct nl_msg *
+virNetDevBandwidthHTBQdiscMsgNew(int ifindex,
+                                 uint32_t defcls)
+{
+    struct nl_msg *nl_msg;
+    struct nlattr *opts;
+    struct tc_htb_glob glob = {
+        .version = TC_HTB_PROTOVER,
+        .rate2quantum = 10,
+        .defcls = defcls,
+    };
+
+    if (!(nl_msg = virNetDevBandwidthMsgNew(ifindex, RTM_NEWQDISC,
+                                            NLM_F_CREATE | NLM_F_EXCL,
+                                            TC_H_ROOT, TC_H_MAKE(1 << 16, 0),
+                                            0, "htb")))
+        return NULL;
+
+    if (!(opts = nla_nest_start(nl_msg, TCA_OPTIONS)) ||
+        nla_put(nl_msg, TCA_HTB_INIT, sizeof(glob), &glob) < 0) {
+        nlmsg_free(nl_msg);
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+        return NULL;
+    }
+    nla_nest_end(nl_msg, opts);
+
+    return nl_msg;
+}
+
+
+/*
+ * Build the request adding or, if @flags is 0, changing an HTB class.
+ * @rate and @ceil are in kbytes/s, @ceil defaults to @rate when 0;
+ * @burst is in kbytes and is computed from @rate when 0.
+ */
+struct nl_msg *
+virNetDevBandwidthHTBClassMsgNew(int ifindex,
+                                 int flags,
+                                 uint32_t parent,
+                                 uint32_t classid,
+                                 unsigned long long rate,
+                                 unsigned long long ceil,
+                                 unsigned long long burst)
+{
+    struct nl_msg *nl_msg = NULL;
+    struct nlattr *opts;
+    struct tc_htb_opt opt;
+    uint32_t *rtab = NULL;
+    unsigned long long buffer;
+    unsigned long long cbuffer;
+
+    if (VIR_ALLOC_N(rtab, 2 * 256) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    rate *= 1000;
+    ceil = ceil ? ceil * 1000 : rate;
+    buffer = burst ? burst * 1024 :
+        rate / virNetDevBandwidthHz + VIR_NETDEV_BANDWIDTH_HTB_MTU;
+    cbuffer = ceil / virNetDevBandwidthHz + VIR_NETDEV_BANDWIDTH_HTB_MTU;
+
+    memset(&opt, 0, sizeof(opt));
+    virNetDevBandwidthRateTable(&opt.rate, rtab, rate,
+                                VIR_NETDEV_BANDWIDTH_HTB_MTU);
+    opt.buffer = virNetDevBandwidthXmitTime(rate, buffer);
+    virNetDevBandwidthRateTable(&opt.ceil, rtab + 256, ceil,
+                                VIR_NETDEV_BANDWIDTH_HTB_MTU);
+    opt.cbuffer = virNetDevBandwidthXmitTime(ceil, cbuffer);
+
+    if (!(nl_msg = virNetDevBandwidthMsgNew(ifindex, RTM_NEWTCLASS, flags,
+                                            parent, classid, 0, "htb")))
+        goto cleanup;
+
+    if (!(opts = nla_nest_start(nl_msg, TCA_OPTIONS)) ||
+        nla_put(nl_msg, TCA_HTB_PARMS, sizeof(opt), &opt) < 0 ||
+        nla_put(nl_msg, TCA_HTB_RTAB, 256 * sizeof(*rtab), rtab) < 0 ||
+        nla_put(nl_msg, TCA_HTB_CTAB, 256 * sizeof(*rtab), rtab + 256) < 0) {
+        nlmsg_free(nl_msg);
+        nl_msg = NULL;
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+        goto cleanup;
+    }
+    nla_nest_end(nl_msg, opts);
+
+cleanup:
+    VIR_FREE(rtab);
+    return nl_msg;
+}
+
+
+static struct nl_msg *
+virNetDevBandwidthSFQQdiscMsgNew(int ifindex,
+                                 uint32_t parent,
+                                 uint32_t handle)
+{
+    struct nl_msg *nl_msg;
+    struct tc_sfq_qopt qopt = {
+        .perturb_period = VIR_NETDEV_BANDWIDTH_SFQ_PERTURB,
+    };
+
+    if (!(nl_msg = virNetDevBandwidthMsgNew(ifindex, RTM_NEWQDISC,
+                                            NLM_F_CREATE | NLM_F_EXCL,
+                                            parent, handle, 0, "sfq")))
+        return NULL;
+
+    if (nla_put(nl_msg, TCA_OPTIONS, sizeof(qopt), &qopt) < 0) {
+        nlmsg_free(nl_msg);
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+        return NULL;
+    }
+
+    return nl_msg;
+}
+
+
+static struct nl_msg *
+virNetDevBandwidthIngressQdiscMsgNew(int ifindex)
+{
+    return virNetDevBandwidthMsgNew(ifindex, RTM_NEWQDISC,
+                                    NLM_F_CREATE | NLM_F_EXCL,
+                                    TC_H_INGRESS, TC_H_MAKE(TC_H_INGRESS, 0),
+                                    0, "ingress");
+}
+
+
+/* Filter sending all IP traffic marked 1 into class @classid */
+static struct nl_msg *
+virNetDevBandwidthFWFilterMsgNew(int ifindex,
+                                 uint32_t parent,
+                                 uint32_t classid)
+{
+    struct nl_msg *nl_msg;
+    struct nlattr *opts;
+
+    if (!(nl_msg = virNetDevBandwidthMsgNew(ifindex, RTM_NEWTFILTER,
+                                            NLM_F_CREATE | NLM_F_EXCL,
+                                            parent, 1,
+                                            TC_H_MAKE(0, htons(ETH_P_IP)),
+                                            "fw")))
+        return NULL;
+
+    if (!(opts = nla_nest_start(nl_msg, TCA_OPTIONS)) ||
+        nla_put_u32(nl_msg, TCA_FW_CLASSID, classid) < 0) {
+        nlmsg_free(nl_msg);
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+        return NULL;
+    }
+    nla_nest_end(nl_msg, opts);
+
+    return nl_msg;
+}
+
+
+/*
+ * Build the request adding an u32 filter into @classid, matching the
+ * IPv4 packets coming from @mac, or all of them when @mac is NULL, and
+ * optionally policing the traffic to @rate kbytes/s with @burst kbytes
+ * bursts.
+ */
+struct nl_msg *
+virNetDevBandwidthU32FilterMsgNew(int ifindex,
+                                  uint32_t parent,
+                                  uint32_t prio,
+                                  const virMacAddrPtr mac,
+                                  uint32_t classid,
+                                  unsigned long long rate,
+                                  unsigned long long burst)
+{
+    struct nl_msg *nl_msg;
+    struct nlattr *opts;
+    struct nlattr *police_opts;
+    struct tc_police police;
+    uint32_t rtab[256];
+    struct {
+        struct tc_u32_sel sel;
+        struct tc_u32_key keys[3];
+    } u32;
+
+    memset(&u32, 0, sizeof(u32));
+    u32.sel.flags = TC_U32_TERMINAL;
+    if (mac) {
+        unsigned char ifmac[VIR_MAC_BUFLEN];
+
+        virMacAddrGetRaw(mac, ifmac);
+
+        /* Since libvirt does not know anything about interface IP
+         * address(es), match the IPv4 ethertype and the source MAC
+         * address relative to the network header, as the tc command
+         * 'match u16 0x0800 0xffff at -2 match u32 ... at -12
+         * match u16 ... at -14' does */
+        u32.sel.nkeys = 3;
+        u32.keys[0].val = htonl(0x0800);
+        u32.keys[0].mask = htonl(0xffff);
+        u32.keys[0].off = -4;
+        u32.keys[1].val = htonl(ifmac[2] << 24 | ifmac[3] << 16 |
+                                ifmac[4] << 8 | ifmac[5]);
+        u32.keys[1].mask = 0xffffffff;
+        u32.keys[1].off = -12;
+        u32.keys[2].val = htonl(ifmac[0] << 8 | ifmac[1]);
+        u32.keys[2].mask = htonl(0xffff);
+        u32.keys[2].off = -16;
+    } else {
+        /* match ip src 0.0.0.0/0 */
+        u32.sel.nkeys = 1;
+        u32.keys[0].off = 12;
+    }
+
+    if (!(nl_msg = virNetDevBandwidthMsgNew(ifindex, RTM_NEWTFILTER,
+                                            NLM_F_CREATE | NLM_F_EXCL, parent,
+                                            0, TC_H_MAKE(prio << 16,
+                                                         htons(ETH_P_IP)),
+                                            "u32")))
+        return NULL;
+
+    if (!(opts = nla_nest_start(nl_msg, TCA_OPTIONS)))
+        goto buffer_too_small;
+
+    if (rate) {
+        rate *= 1000;
+        memset(&police, 0, sizeof(police));
+        police.action = TC_POLICE_SHOT;
+        police.mtu = VIR_NETDEV_BANDWIDTH_POLICE_MTU;
+        virNetDevBandwidthRateTable(&police.rate, rtab, rate,
+                                    VIR_NETDEV_BANDWIDTH_POLICE_MTU);
+        police.burst = virNetDevBandwidthXmitTime(rate, burst * 1024);
+
+        if (!(police_opts = nla_nest_start(nl_msg, TCA_U32_POLICE)) ||
+            nla_put(nl_msg, TCA_POLICE_TBF, sizeof(police), &police) < 0 ||
+            nla_put(nl_msg, TCA_POLICE_RATE, sizeof(rtab), rtab) < 0)
+            goto buffer_too_small;
+        nla_nest_end(nl_msg, police_opts);
+    }
+
+    if (nla_put_u32(nl_msg, TCA_U32_CLASSID, classid) < 0 ||
+        nla_put(nl_msg, TCA_U32_SEL,
+                sizeof(u32.sel) + u32.sel.nkeys * sizeof(u32.keys[0]),
+                &u32) < 0)
+        goto buffer_too_small;
+    nla_nest_end(nl_msg, opts);
+
+    return nl_msg;
+
+buffer_too_small:
+    nlmsg_free(nl_msg);
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("allocated netlink buffer is too small"));
+    return NULL;
+}
+
+
+/* All the changes made to one interface, sent in a single go */
+typedef struct _virNetDevBandwidthBatch virNetDevBandwidthBatch;
+typedef virNetDevBandwidthBatch *virNetDevBandwidthBatchPtr;
+struct _virNetDevBandwidthBatch {
+    const char *ifname;
+    int ifindex;
+
+    struct nl_msg **msgs;
+    bool *check; /* whether the request is allowed to fail */
+    size_t nmsgs;
+};
+
+static int
+virNetDevBandwidthBatchInit(virNetDevBandwidthBatchPtr batch,
+                            const char *ifname)
+{
+    memset(batch, 0, sizeof(*batch));
+    batch->ifname = ifname;
+
+    if (virNetDevBandwidthInitialize() < 0)
+        return -1;
+
+    return virNetDevGetIndex(ifname, &batch->ifindex);
+}
+
+
+static void
+virNetDevBandwidthBatchClear(virNetDevBandwidthBatchPtr batch)
+{
+    size_t i;
+
+    for (i = 0; i < batch->nmsgs; i++)
+        nlmsg_free(batch->msgs[i]);
+    VIR_FREE(batch->msgs);
+    VIR_FREE(batch->check);
+    batch->nmsgs = 0;
+}
+
+
+/* Queue @nl_msg on @batch, which takes ownership of it. If @check is
+ * false, a failure of the request is ignored. A NULL @nl_msg is the
+ * failure of its builder, which has already been reported. */
+static int
+virNetDevBandwidthBatchAdd(virNetDevBandwidthBatchPtr batch,
+                           struct nl_msg *nl_msg,
+                           bool check)
+{
+    if (!nl_msg)
+        return -1;
+
+    if (VIR_REALLOC_N(batch->msgs, batch->nmsgs + 1) < 0 ||
+        VIR_REALLOC_N(batch->check, batch->nmsgs + 1) < 0) {
+        nlmsg_free(nl_msg);
+        virReportOOMError();
+        return -1;
+    }
+
+    batch->msgs[batch->nmsgs] = nl_msg;
+    batch->check[batch->nmsgs] = check;
+    batch->nmsgs++;
+    return 0;
+}
+
+
+/*
+ * Send the requests queued on @batch.
  *
- * Return 0 on success, -1 otherwise.
+ * Returns 0 on success, -1 on error, or 1 without reporting an error
+ * if the kernel refused one of the requests as unsupported or invalid,
+ * in which case the caller should do the same with tc(8), whose
+ * requests older kernels may still understand.
  */
-int
-virNetDevBandwidthSet(const char *ifname,
-                      virNetDevBandwidthPtr bandwidth,
-                      bool hierarchical_class)
+static int
+virNetDevBandwidthBatchRun(virNetDevBandwidthBatchPtr batch)
+{
+    int ret = -1;
+    int *errors = NULL;
+    char ebuf[1024];
+    size_t i;
+
+    if (VIR_ALLOC_N(errors, batch->nmsgs) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    if (virNetlinkCommandBatch(batch->msgs, batch->nmsgs,
+                               errors, NULL, NETLINK_ROUTE) < 0)
+        goto cleanup;
+
+    for (i = 0; i < batch->nmsgs; i++) {
+        if (!batch->check[i] || errors[i] >= 0)
+            continue;
+
+        if (errors[i] == -EOPNOTSUPP || errors[i] == -EINVAL) {
+            VIR_WARN("Kernel refused QoS request on interface '%s': %s, "
+                     "falling back to tc",
+                     batch->ifname, virStrerror(-errors[i], ebuf,
+                                                sizeof(ebuf)));
+            ret = 1;
+            goto cleanup;
+        }
+
+        virReportSystemError(-errors[i],
+                             _("Unable to set QoS on interface '%s'"),
+                             batch->ifname);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(errors);
+    virNetDevBandwidthBatchClear(batch);
+    return ret;
+}
+
+
+static int
+virNetDevBandwidthAddDelete(virNetDevBandwidthBatchPtr batch,
+                            int type,
+                            uint32_t parent,
+                            uint32_t handle,
+                            uint32_t info,
+                            const char *kind)
+{
+    struct nl_msg *nl_msg;
+
+    nl_msg = virNetDevBandwidthMsgNew(batch->ifindex, type, 0,
+                                      parent, handle, info, kind);
+
+    /* Like with tc, removing what is not there is not an error */
+    return virNetDevBandwidthBatchAdd(batch, nl_msg, false);
+}
+
+
+static int
+virNetDevBandwidthAddHTBQdisc(virNetDevBandwidthBatchPtr batch,
+                              uint32_t defcls)
+{
+    struct nl_msg *nl_msg;
+
+    nl_msg = virNetDevBandwidthHTBQdiscMsgNew(batch->ifindex, defcls);
+    return virNetDevBandwidthBatchAdd(batch, nl_msg, true);
+}
+
+
+static int
+virNetDevBandwidthAddHTBClass(virNetDevBandwidthBatchPtr batch,
+                              int flags,
+                              uint32_t parent,
+                              uint32_t classid,
+                              unsigned long long rate,
+                              unsigned long long ceil,
+                              unsigned long long burst)
+{
+    struct nl_msg *nl_msg;
+
+    nl_msg = virNetDevBandwidthHTBClassMsgNew(batch->ifindex, flags, parent,
+                                              classid, rate, ceil, burst);
+    return virNetDevBandwidthBatchAdd(batch, nl_msg, true);
+}
+
+
+static int
+virNetDevBandwidthAddSFQQdisc(virNetDevBandwidthBatchPtr batch,
+                              uint32_t parent,
+                              uint32_t handle)
+{
+    struct nl_msg *nl_msg;
+
+    nl_msg = virNetDevBandwidthSFQQdiscMsgNew(batch->ifindex, parent, handle);
+    return virNetDevBandwidthBatchAdd(batch, nl_msg, true);
+}
+
+
+static int
+virNetDevBandwidthAddIngressQdisc(virNetDevBandwidthBatchPtr batch)
+{
+    struct nl_msg *nl_msg;
+
+    nl_msg = virNetDevBandwidthIngressQdiscMsgNew(batch->ifindex);
+    return virNetDevBandwidthBatchAdd(batch, nl_msg, true);
+}
+
+
+static int
+virNetDevBandwidthAddFWFilter(virNetDevBandwidthBatchPtr batch,
+                              uint32_t parent,
+                              uint32_t classid)
+{
+    struct nl_msg *nl_msg;
+
+    nl_msg = virNetDevBandwidthFWFilterMsgNew(batch->ifindex, parent, classid);
+    return virNetDevBandwidthBatchAdd(batch, nl_msg, true);
+}
+
+
+static int
+virNetDevBandwidthAddU32Filter(virNetDevBandwidthBatchPtr batch,
+                               uint32_t parent,
+                               uint32_t prio,
+                               const virMacAddrPtr mac,
+                               uint32_t classid,
+                               unsigned long long rate,
+                               unsigned long long burst)
+{
+    struct nl_msg *nl_msg;
+
+    nl_msg = virNetDevBandwidthU32FilterMsgNew(batch->ifindex, parent, prio,
+                                               mac, classid, rate, burst);
+    return virNetDevBandwidthBatchAdd(batch, nl_msg, true);
+}
+
+
+static int
+virNetDevBandwidthAddClear(virNetDevBandwidthBatchPtr batch)
+{
+    if (virNetDevBandwidthAddDelete(batch, RTM_DELQDISC,
+                                    TC_H_ROOT, 0, 0, NULL) < 0 ||
+        virNetDevBandwidthAddDelete(batch, RTM_DELQDISC, TC_H_INGRESS,
+                                    TC_H_MAKE(TC_H_INGRESS, 0), 0,
+                                    "ingress") < 0)
+        return -1;
+    return 0;
+}
+
+
+/* The qdiscs, classes and filters are the same as those created by
+ * the tc based implementation below, see the description there.
+ * Like virNetDevBandwidthBatchRun, these return 1 when the kernel
+ * refused a request and tc should be used instead. */
+static int
+virNetDevBandwidthSetNetlink(const char *ifname,
+                             virNetDevBandwidthPtr bandwidth,
+                             bool hierarchical_class)
+{
+    virNetDevBandwidthBatch batch;
+    int ret = -1;
+
+    if (virNetDevBandwidthBatchInit(&batch, ifname) < 0)
+        return -1;
+
+    if (virNetDevBandwidthAddClear(&batch) < 0)
+        goto cleanup;
+
+    if (bandwidth->in && bandwidth->in->average) {
+        virNetDevBandwidthRatePtr in = bandwidth->in;
+        uint32_t classid = hierarchical_class ? 2 : 1;
+
+        if (virNetDevBandwidthAddHTBQdisc(&batch, classid) < 0)
+            goto cleanup;
+
+        if (hierarchical_class &&
+            virNetDevBandwidthAddHTBClass(&batch, NLM_F_CREATE | NLM_F_EXCL,
+                                          TC_H_MAKE(1 << 16, 0),
+                                          TC_H_MAKE(1 << 16, 1),
+                                          in->average, in->peak, 0) < 0)
+            goto cleanup;
+
+        if (virNetDevBandwidthAddHTBClass(&batch, NLM_F_CREATE | NLM_F_EXCL,
+                                          TC_H_MAKE(1 << 16,
+                                                    hierarchical_class ? 1 : 0),
+                                          TC_H_MAKE(1 << 16, classid),
+                                          in->average, in->peak,
+                                          in->burst) < 0 ||
+            virNetDevBandwidthAddSFQQdisc(&batch, TC_H_MAKE(1 << 16, classid),
+                                          TC_H_MAKE(2 << 16, 0)) < 0 ||
+            virNetDevBandwidthAddFWFilter(&batch, TC_H_MAKE(1 << 16, 0), 1) < 0)
+            goto cleanup;
+    }
+
+    if (bandwidth->out) {
+        virNetDevBandwidthRatePtr out = bandwidth->out;
+
+        if (virNetDevBandwidthAddIngressQdisc(&batch) < 0 ||
+            virNetDevBandwidthAddU32Filter(&batch, TC_H_MAKE(TC_H_INGRESS, 0),
+                                           0, NULL, 1, out->average,
+                                           out->burst ? out->burst :
+                                           out->average) < 0)
+            goto cleanup;
+    }
+
+    ret = virNetDevBandwidthBatchRun(&batch);
+
+cleanup:
+    virNetDevBandwidthBatchClear(&batch);
+    return ret;
+}
+
+
+static int
+virNetDevBandwidthClearNetlink(const char *ifname)
+{
+    virNetDevBandwidthBatch batch;
+    int rc;
+    int ret = -1;
+
+    /* Like 'tc qdisc del', succeed on interfaces that are gone */
+    if ((rc = virNetDevExists(ifname)) <= 0)
+        return rc;
+
+    if (virNetDevBandwidthBatchInit(&batch, ifname) < 0)
+        return -1;
+
+    if (virNetDevBandwidthAddClear(&batch) < 0)
+        goto cleanup;
+
+    ret = virNetDevBandwidthBatchRun(&batch);
+
+cleanup:
+    virNetDevBandwidthBatchClear(&batch);
+    return ret;
+}
+
+
+static int
+virNetDevBandwidthPlugNetlink(const char *brname,
+                              virNetDevBandwidthPtr net_bandwidth,
+                              const virMacAddrPtr ifmac_ptr,
+                              virNetDevBandwidthPtr bandwidth,
+                              unsigned int id)
+{
+    virNetDevBandwidthBatch batch;
+    int ret = -1;
+
+    if (virNetDevBandwidthBatchInit(&batch, brname) < 0)
+        return -1;
+
+    if (virNetDevBandwidthAddHTBClass(&batch, NLM_F_CREATE | NLM_F_EXCL,
+                                      TC_H_MAKE(1 << 16, 1),
+                                      TC_H_MAKE(1 << 16, id),
+                                      bandwidth->in->floor,
+                                      net_bandwidth->in->peak ?
+                                      net_bandwidth->in->peak :
+                                      net_bandwidth->in->average, 0) < 0 ||
+        virNetDevBandwidthAddSFQQdisc(&batch, TC_H_MAKE(1 << 16, id),
+                                      TC_H_MAKE(id << 16, 0)) < 0 ||
+        virNetDevBandwidthAddU32Filter(&batch, 0, id, ifmac_ptr,
+                                       TC_H_MAKE(1 << 16, id), 0, 0) < 0)
+        goto cleanup;
+
+    ret = virNetDevBandwidthBatchRun(&batch);
+
+cleanup:
+    virNetDevBandwidthBatchClear(&batch);
+    return ret;
+}
+
+
+static int
+virNetDevBandwidthUnplugNetlink(const char *brname,
+                                unsigned int id)
+{
+    virNetDevBandwidthBatch batch;
+    int ret = -1;
+
+    if (virNetDevBandwidthBatchInit(&batch, brname) < 0)
+        return -1;
+
+    if (virNetDevBandwidthAddDelete(&batch, RTM_DELQDISC,
+                                    TC_H_MAKE(1 << 16, id),
+                                    TC_H_MAKE(id << 16, 0), 0, NULL) < 0 ||
+        virNetDevBandwidthAddDelete(&batch, RTM_DELTFILTER, 0, 0,
+                                    TC_H_MAKE(id << 16, 0), NULL) < 0 ||
+        virNetDevBandwidthAddDelete(&batch, RTM_DELTCLASS, 0,
+                                    TC_H_MAKE(1 << 16, id), 0, NULL) < 0)
+        goto cleanup;
+
+    ret = virNetDevBandwidthBatchRun(&batch);
+
+cleanup:
+    virNetDevBandwidthBatchClear(&batch);
+    return ret;
+}
+
+
+static int
+virNetDevBandwidthUpdateRateNetlink(const char *ifname,
+                                    const char *class_id,
+                                    virNetDevBandwidthPtr bandwidth,
+                                    unsigned long long new_rate)
+{
+    virNetDevBandwidthBatch batch;
+    unsigned int major;
+    unsigned int minor;
+    char *sep;
+    int ret = -1;
+
+    if (virStrToLong_ui(class_id, &sep, 16, &major) < 0 || *sep != ':' ||
+        virStrToLong_ui(sep + 1, NULL, 16, &minor) < 0 ||
+        major > 0xffff || minor > 0xffff) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Invalid class ID '%s'"), class_id);
+        return -1;
+    }
+
+    if (virNetDevBandwidthBatchInit(&batch, ifname) < 0)
+        return -1;
+
+    if (virNetDevBandwidthAddHTBClass(&batch, 0, 0,
+                                      TC_H_MAKE(major << 16, minor),
+                                      new_rate,
+                                      bandwidth->in->peak ?
+                                      bandwidth->in->peak :
+                                      bandwidth->in->average, 0) < 0)
+        goto cleanup;
+
+    ret = virNetDevBandwidthBatchRun(&batch);
+
+cleanup:
+    virNetDevBandwidthBatchClear(&batch);
+    return ret;
+}
+
+#endif /* VIR_NETDEV_BANDWIDTH_NETLINK */
+
+
+static int
+virNetDevBandwidthClearTC(const char *ifname)
+{
+    int ret = 0;
+    int dummy; /* for ignoring the exit status */
+    virCommandPtr cmd = NULL;
+
+    cmd = virCommandNew(TC);
+    virCommandAddArgList(cmd, "qdisc", "del", "dev", ifname, "root", NULL);
+
+    if (virCommandRun(cmd, &dummy) < 0)
+        ret = -1;
+
+    virCommandFree(cmd);
+
+    cmd = virCommandNew(TC);
+    virCommandAddArgList(cmd, "qdisc",  "del", "dev", ifname, "ingress", NULL);
+
+    if (virCommandRun(cmd, &dummy) < 0)
+        ret = -1;
+
+    virCommandFree(cmd);
+
+    return ret;
+}
+
+static int
+virNetDevBandwidthSetTC(const char *ifname,
+                        virNetDevBandwidthPtr bandwidth,
+                        bool hierarchical_class)
 {
     int ret = -1;
     virCommandPtr cmd = NULL;
@@ -68,13 +898,7 @@ virNetDevBandwidthSet(const char *ifname,
     char *peak = NULL;
     char *burst = NULL;
 
-    if (!bandwidth) {
-        /* nothing to be enabled */
-        ret = 0;
-        goto cleanup;
-    }
-
-    virNetDevBandwidthClear(ifname);
+    virNetDevBandwidthClearTC(ifname);
 
     if (bandwidth->in && bandwidth->in->average) {
         if (virAsprintf(&average, "%llukbps", bandwidth->in->average) < 0)
@@ -199,48 +1023,256 @@ virNetDevBandwidthSet(const char *ifname,
         if (virCommandRun(cmd, NULL) < 0)
             goto cleanup;
 
-        VIR_FREE(average);
-        VIR_FREE(peak);
-        VIR_FREE(burst);
-    }
+        VIR_FREE(average);
+        VIR_FREE(peak);
+        VIR_FREE(burst);
+    }
+
+    if (bandwidth->out) {
+        if (virAsprintf(&average, "%llukbps", bandwidth->out->average) < 0)
+            goto cleanup;
+        if (virAsprintf(&burst, "%llukb", bandwidth->out->burst ?
+                        bandwidth->out->burst : bandwidth->out->average) < 0)
+            goto cleanup;
+
+        virCommandFree(cmd);
+        cmd = virCommandNew(TC);
+            virCommandAddArgList(cmd, "qdisc", "add", "dev", ifname,
+                                 "ingress", NULL);
+
+        if (virCommandRun(cmd, NULL) < 0)
+            goto cleanup;
+
+        virCommandFree(cmd);
+        cmd = virCommandNew(TC);
+        virCommandAddArgList(cmd, "filter", "add", "dev", ifname, "parent",
+                             "ffff:", "protocol", "ip", "u32", "match", "ip",
+                             "src", "0.0.0.0/0", "police", "rate", average,
+                             "burst", burst, "mtu", "64kb", "drop", "flowid",
+                             ":1", NULL);
+
+        if (virCommandRun(cmd, NULL) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virCommandFree(cmd);
+    VIR_FREE(average);
+    VIR_FREE(peak);
+    VIR_FREE(burst);
+    return ret;
+}
+
+static int
+virNetDevBandwidthPlugTC(const char *brname,
+                         virNetDevBandwidthPtr net_bandwidth,
+                         const virMacAddrPtr ifmac_ptr,
+                         virNetDevBandwidthPtr bandwidth,
+                         unsigned int id)
+{
+    int ret = -1;
+    virCommandPtr cmd = NULL;
+    char *class_id = NULL;
+    char *qdisc_id = NULL;
+    char *filter_id = NULL;
+    char *floor = NULL;
+    char *ceil = NULL;
+    unsigned char ifmac[VIR_MAC_BUFLEN];
+    char *mac[2] = {NULL, NULL};
+
+    virMacAddrGetRaw(ifmac_ptr, ifmac);
+
+    if (virAsprintf(&class_id, "1:%x", id) < 0 ||
+        virAsprintf(&qdisc_id, "%x:", id) < 0 ||
+        virAsprintf(&filter_id, "%u", id) < 0 ||
+        virAsprintf(&mac[0], "0x%02x%02x%02x%02x", ifmac[2],
+                    ifmac[3], ifmac[4], ifmac[5]) < 0 ||
+        virAsprintf(&mac[1], "0x%02x%02x", ifmac[0], ifmac[1]) < 0 ||
+        virAsprintf(&floor, "%llukbps", bandwidth->in->floor) < 0 ||
+        virAsprintf(&ceil, "%llukbps", net_bandwidth->in->peak ?
+                    net_bandwidth->in->peak :
+                    net_bandwidth->in->average) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    cmd = virCommandNew(TC);
+    virCommandAddArgList(cmd, "class", "add", "dev", brname, "parent", "1:1",
+                         "classid", class_id, "htb", "rate", floor,
+                         "ceil", ceil, NULL);
+
+    if (virCommandRun(cmd, NULL) < 0)
+        goto cleanup;
+
+    virCommandFree(cmd);
+    cmd = virCommandNew(TC);
+    virCommandAddArgList(cmd, "qdisc", "add", "dev", brname, "parent",
+                         class_id, "handle", qdisc_id, "sfq", "perturb",
+                         "10", NULL);
+
+    if (virCommandRun(cmd, NULL) < 0)
+        goto cleanup;
+
+    virCommandFree(cmd);
+    cmd = virCommandNew(TC);
+    /* Okay, this not nice. But since libvirt does not know anything about
+     * interface IP address(es), and tc fw filter simply refuse to use ebtables
+     * marks, we need to use u32 selector to match MAC address.
+     * If libvirt will ever know something, remove this FIXME
+     */
+    virCommandAddArgList(cmd, "filter", "add", "dev", brname, "protocol", "ip",
+                         "prio", filter_id, "u32",
+                         "match", "u16", "0x0800", "0xffff", "at", "-2",
+                         "match", "u32", mac[0], "0xffffffff", "at", "-12",
+                         "match", "u16", mac[1], "0xffff", "at", "-14",
+                         "flowid", class_id, NULL);
+
+    if (virCommandRun(cmd, NULL) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(mac[1]);
+    VIR_FREE(mac[0]);
+    VIR_FREE(ceil);
+    VIR_FREE(floor);
+    VIR_FREE(filter_id);
+    VIR_FREE(qdisc_id);
+    VIR_FREE(class_id);
+    virCommandFree(cmd);
+    return ret;
+}
+
+static int
+virNetDevBandwidthUnplugTC(const char *brname,
+                           unsigned int id)
+{
+    int ret = -1;
+    int cmd_ret = 0;
+    virCommandPtr cmd = NULL;
+    char *class_id = NULL;
+    char *qdisc_id = NULL;
+    char *filter_id = NULL;
+
+    if (virAsprintf(&class_id, "1:%x", id) < 0 ||
+        virAsprintf(&qdisc_id, "%x:", id) < 0 ||
+        virAsprintf(&filter_id, "%u", id) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    cmd = virCommandNew(TC);
+    virCommandAddArgList(cmd, "qdisc", "del", "dev", brname,
+                         "handle", qdisc_id, NULL);
+
+    /* Don't threat tc errors as fatal, but
+     * try to remove as much as possible */
+    if (virCommandRun(cmd, &cmd_ret) < 0)
+        goto cleanup;
+
+    virCommandFree(cmd);
+    cmd = virCommandNew(TC);
+    virCommandAddArgList(cmd, "filter", "del", "dev", brname,
+                         "prio", filter_id, NULL);
+
+    if (virCommandRun(cmd, &cmd_ret) < 0)
+        goto cleanup;
+
+    cmd = virCommandNew(TC);
+    virCommandAddArgList(cmd, "class", "del", "dev", brname,
+                         "classid", class_id, NULL);
 
-    if (bandwidth->out) {
-        if (virAsprintf(&average, "%llukbps", bandwidth->out->average) < 0)
-            goto cleanup;
-        if (virAsprintf(&burst, "%llukb", bandwidth->out->burst ?
-                        bandwidth->out->burst : bandwidth->out->average) < 0)
-            goto cleanup;
+    if (virCommandRun(cmd, &cmd_ret) < 0)
+        goto cleanup;
 
-        virCommandFree(cmd);
-        cmd = virCommandNew(TC);
-            virCommandAddArgList(cmd, "qdisc", "add", "dev", ifname,
-                                 "ingress", NULL);
+    ret = 0;
 
-        if (virCommandRun(cmd, NULL) < 0)
-            goto cleanup;
+cleanup:
+    VIR_FREE(filter_id);
+    VIR_FREE(qdisc_id);
+    VIR_FREE(class_id);
+    virCommandFree(cmd);
+    return ret;
+}
 
-        virCommandFree(cmd);
-        cmd = virCommandNew(TC);
-        virCommandAddArgList(cmd, "filter", "add", "dev", ifname, "parent",
-                             "ffff:", "protocol", "ip", "u32", "match", "ip",
-                             "src", "0.0.0.0/0", "police", "rate", average,
-                             "burst", burst, "mtu", "64kb", "drop", "flowid",
-                             ":1", NULL);
+static int
+virNetDevBandwidthUpdateRateTC(const char *ifname,
+                               const char *class_id,
+                               virNetDevBandwidthPtr bandwidth,
+                               unsigned long long new_rate)
+{
+    int ret = -1;
+    virCommandPtr cmd = NULL;
+    char *rate = NULL;
+    char *ceil = NULL;
 
-        if (virCommandRun(cmd, NULL) < 0)
-            goto cleanup;
+    if (virAsprintf(&rate, "%llukbps", new_rate) < 0 ||
+        virAsprintf(&ceil, "%llukbps", bandwidth->in->peak ?
+                    bandwidth->in->peak :
+                    bandwidth->in->average) < 0) {
+        virReportOOMError();
+        goto cleanup;
     }
 
+    cmd = virCommandNew(TC);
+    virCommandAddArgList(cmd, "class", "change", "dev", ifname,
+                         "classid", class_id, "htb", "rate", rate,
+                         "ceil", ceil, NULL);
+
+    if (virCommandRun(cmd, NULL) < 0)
+        goto cleanup;
+
     ret = 0;
 
 cleanup:
     virCommandFree(cmd);
-    VIR_FREE(average);
-    VIR_FREE(peak);
-    VIR_FREE(burst);
+    VIR_FREE(rate);
+    VIR_FREE(ceil);
     return ret;
 }
 
+
+/**
+ * virNetDevBandwidthSet:
+ * @ifname: on which interface
+ * @bandwidth: rates to set (may be NULL)
+ * @hierarchical_class: whether to create hierarchical class
+ *
+ * This function enables QoS on specified interface
+ * and set given traffic limits for both, incoming
+ * and outgoing traffic. Any previous setting get
+ * overwritten. If @hierarchical_class is TRUE, create
+ * hierarchical class. It is used to guarantee minimal
+ * throughput ('floor' attribute in NIC).
+ *
+ * Return 0 on success, -1 otherwise.
+ */
+int
+virNetDevBandwidthSet(const char *ifname,
+                      virNetDevBandwidthPtr bandwidth,
+                      bool hierarchical_class)
+{
+#ifdef VIR_NETDEV_BANDWIDTH_NETLINK
+    int ret;
+#endif
+
+    if (!bandwidth) {
+        /* nothing to be enabled */
+        return 0;
+    }
+
+#ifdef VIR_NETDEV_BANDWIDTH_NETLINK
+    /* Whatever the refused request left behind is cleared by tc */
+    if ((ret = virNetDevBandwidthSetNetlink(ifname, bandwidth,
+                                            hierarchical_class)) <= 0)
+        return ret;
+#endif
+    return virNetDevBandwidthSetTC(ifname, bandwidth, hierarchical_class);
+}
+
 /**
  * virNetDevBandwidthClear:
  * @ifname: on which interface
@@ -254,27 +1286,13 @@ cleanup:
 int
 virNetDevBandwidthClear(const char *ifname)
 {
-    int ret = 0;
-    int dummy; /* for ignoring the exit status */
-    virCommandPtr cmd = NULL;
-
-    cmd = virCommandNew(TC);
-    virCommandAddArgList(cmd, "qdisc", "del", "dev", ifname, "root", NULL);
-
-    if (virCommandRun(cmd, &dummy) < 0)
-        ret = -1;
-
-    virCommandFree(cmd);
-
-    cmd = virCommandNew(TC);
-    virCommandAddArgList(cmd, "qdisc",  "del", "dev", ifname, "ingress", NULL);
-
-    if (virCommandRun(cmd, &dummy) < 0)
-        ret = -1;
-
-    virCommandFree(cmd);
+#ifdef VIR_NETDEV_BANDWIDTH_NETLINK
+    int ret;
 
-    return ret;
+    if ((ret = virNetDevBandwidthClearNetlink(ifname)) <= 0)
+        return ret;
+#endif
+    return virNetDevBandwidthClearTC(ifname);
 }
 
 /*
@@ -381,26 +1399,18 @@ virNetDevBandwidthPlug(const char *brname,
                        virNetDevBandwidthPtr bandwidth,
                        unsigned int id)
 {
-    int ret = -1;
-    virCommandPtr cmd = NULL;
-    char *class_id = NULL;
-    char *qdisc_id = NULL;
-    char *filter_id = NULL;
-    char *floor = NULL;
-    char *ceil = NULL;
-    unsigned char ifmac[VIR_MAC_BUFLEN];
     char ifmacStr[VIR_MAC_STRING_BUFLEN];
-    char *mac[2] = {NULL, NULL};
+#ifdef VIR_NETDEV_BANDWIDTH_NETLINK
+    int ret;
+#endif
 
     if (id <= 2) {
         virReportError(VIR_ERR_INTERNAL_ERROR, _("Invalid class ID %d"), id);
         return -1;
     }
 
-    virMacAddrGetRaw(ifmac_ptr, ifmac);
-    virMacAddrFormat(ifmac_ptr, ifmacStr);
-
     if (!net_bandwidth || !net_bandwidth->in) {
+        virMacAddrFormat(ifmac_ptr, ifmacStr);
         virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                        _("Bridge '%s' has no QoS set, therefore "
                          "unable to set 'floor' on '%s'"),
@@ -408,66 +1418,18 @@ virNetDevBandwidthPlug(const char *brname,
         return -1;
     }
 
-    if (virAsprintf(&class_id, "1:%x", id) < 0 ||
-        virAsprintf(&qdisc_id, "%x:", id) < 0 ||
-        virAsprintf(&filter_id, "%u", id) < 0 ||
-        virAsprintf(&mac[0], "0x%02x%02x%02x%02x", ifmac[2],
-                    ifmac[3], ifmac[4], ifmac[5]) < 0 ||
-        virAsprintf(&mac[1], "0x%02x%02x", ifmac[0], ifmac[1]) < 0 ||
-        virAsprintf(&floor, "%llukbps", bandwidth->in->floor) < 0 ||
-        virAsprintf(&ceil, "%llukbps", net_bandwidth->in->peak ?
-                    net_bandwidth->in->peak :
-                    net_bandwidth->in->average) < 0) {
-        virReportOOMError();
-        goto cleanup;
-    }
-
-    cmd = virCommandNew(TC);
-    virCommandAddArgList(cmd, "class", "add", "dev", brname, "parent", "1:1",
-                         "classid", class_id, "htb", "rate", floor,
-                         "ceil", ceil, NULL);
-
-    if (virCommandRun(cmd, NULL) < 0)
-        goto cleanup;
-
-    virCommandFree(cmd);
-    cmd = virCommandNew(TC);
-    virCommandAddArgList(cmd, "qdisc", "add", "dev", brname, "parent",
-                         class_id, "handle", qdisc_id, "sfq", "perturb",
-                         "10", NULL);
-
-    if (virCommandRun(cmd, NULL) < 0)
-        goto cleanup;
-
-    virCommandFree(cmd);
-    cmd = virCommandNew(TC);
-    /* Okay, this not nice. But since libvirt does not know anything about
-     * interface IP address(es), and tc fw filter simply refuse to use ebtables
-     * marks, we need to use u32 selector to match MAC address.
-     * If libvirt will ever know something, remove this FIXME
-     */
-    virCommandAddArgList(cmd, "filter", "add", "dev", brname, "protocol", "ip",
-                         "prio", filter_id, "u32",
-                         "match", "u16", "0x0800", "0xffff", "at", "-2",
-                         "match", "u32", mac[0], "0xffffffff", "at", "-12",
-                         "match", "u16", mac[1], "0xffff", "at", "-14",
-                         "flowid", class_id, NULL);
-
-    if (virCommandRun(cmd, NULL) < 0)
-        goto cleanup;
-
-    ret = 0;
+#ifdef VIR_NETDEV_BANDWIDTH_NETLINK
+    if ((ret = virNetDevBandwidthPlugNetlink(brname, net_bandwidth, ifmac_ptr,
+                                             bandwidth, id)) <= 0)
+        return ret;
 
-cleanup:
-    VIR_FREE(mac[1]);
-    VIR_FREE(mac[0]);
-    VIR_FREE(ceil);
-    VIR_FREE(floor);
-    VIR_FREE(filter_id);
-    VIR_FREE(qdisc_id);
-    VIR_FREE(class_id);
-    virCommandFree(cmd);
-    return ret;
+    /* The requests preceding the refused one did take effect,
+     * remove them so that tc can add them again */
+    if (virNetDevBandwidthUnplugNetlink(brname, id) < 0)
+        return -1;
+#endif
+    return virNetDevBandwidthPlugTC(brname, net_bandwidth, ifmac_ptr,
+                                    bandwidth, id);
 }
 
 /*
@@ -483,57 +1445,18 @@ int
 virNetDevBandwidthUnplug(const char *brname,
                          unsigned int id)
 {
-    int ret = -1;
-    int cmd_ret = 0;
-    virCommandPtr cmd = NULL;
-    char *class_id = NULL;
-    char *qdisc_id = NULL;
-    char *filter_id = NULL;
-
     if (id <= 2) {
         virReportError(VIR_ERR_INTERNAL_ERROR, _("Invalid class ID %d"), id);
         return -1;
     }
 
-    if (virAsprintf(&class_id, "1:%x", id) < 0 ||
-        virAsprintf(&qdisc_id, "%x:", id) < 0 ||
-        virAsprintf(&filter_id, "%u", id) < 0) {
-        virReportOOMError();
-        goto cleanup;
-    }
-
-    cmd = virCommandNew(TC);
-    virCommandAddArgList(cmd, "qdisc", "del", "dev", brname,
-                         "handle", qdisc_id, NULL);
-
-    /* Don't threat tc errors as fatal, but
-     * try to remove as much as possible */
-    if (virCommandRun(cmd, &cmd_ret) < 0)
-        goto cleanup;
-
-    virCommandFree(cmd);
-    cmd = virCommandNew(TC);
-    virCommandAddArgList(cmd, "filter", "del", "dev", brname,
-                         "prio", filter_id, NULL);
-
-    if (virCommandRun(cmd, &cmd_ret) < 0)
-        goto cleanup;
-
-    cmd = virCommandNew(TC);
-    virCommandAddArgList(cmd, "class", "del", "dev", brname,
-                         "classid", class_id, NULL);
-
-    if (virCommandRun(cmd, &cmd_ret) < 0)
-        goto cleanup;
-
-    ret = 0;
+#ifdef VIR_NETDEV_BANDWIDTH_NETLINK
+    int ret;
 
-cleanup:
-    VIR_FREE(filter_id);
-    VIR_FREE(qdisc_id);
-    VIR_FREE(class_id);
-    virCommandFree(cmd);
-    return ret;
+    if ((ret = virNetDevBandwidthUnplugNetlink(brname, id)) <= 0)
+        return ret;
+#endif
+    return virNetDevBandwidthUnplugTC(brname, id);
 }
 
 /**
@@ -555,32 +1478,13 @@ virNetDevBandwidthUpdateRate(const char *ifname,
                              virNetDevBandwidthPtr bandwidth,
                              unsigned long long new_rate)
 {
-    int ret = -1;
-    virCommandPtr cmd = NULL;
-    char *rate = NULL;
-    char *ceil = NULL;
-
-    if (virAsprintf(&rate, "%llukbps", new_rate) < 0 ||
-        virAsprintf(&ceil, "%llukbps", bandwidth->in->peak ?
-                    bandwidth->in->peak :
-                    bandwidth->in->average) < 0) {
-        virReportOOMError();
-        goto cleanup;
-    }
-
-    cmd = virCommandNew(TC);
-    virCommandAddArgList(cmd, "class", "change", "dev", ifname,
-                         "classid", class_id, "htb", "rate", rate,
-                         "ceil", ceil, NULL);
-
-    if (virCommandRun(cmd, NULL) < 0)
-        goto cleanup;
-
-    ret = 0;
-
-cleanup:
-    virCommandFree(cmd);
-    VIR_FREE(rate);
-    VIR_FREE(ceil);
-    return ret;
+#ifdef VIR_NETDEV_BANDWIDTH_NETLINK
+    int ret;
+
+    if ((ret = virNetDevBandwidthUpdateRateNetlink(ifname, class_id,
+                                                   bandwidth, new_rate)) <= 0)
+        return ret;
+#endif
+    return virNetDevBandwidthUpdateRateTC(ifname, class_id,
+                                          bandwidth, new_rate);
 }
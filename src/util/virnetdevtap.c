@@ -140,7 +140,8 @@ virNetDevProbeVnetHdr(int tapfd)
 /**
  * virNetDevTapCreate:
  * @ifname: the interface name
- * @tapfd: file descriptor return value for the new tap device
+ * @tapfd: array of file descriptor return value for the new tap device
+ * @tapfdSize: number of file descriptors in @tapfd
  * @flags: OR of virNetDevTapCreateFlags. Only one flag is recognized:
  *
  *   VIR_NETDEV_TAP_CREATE_VNET_HDR
@@ -148,8 +149,10 @@ virNetDevProbeVnetHdr(int tapfd)
  *   VIR_NETDEV_TAP_CREATE_PERSIST
  *     - The device will persist after the file descriptor is closed
  *
- * Creates a tap interface.
- * If the @tapfd parameter is supplied, the open tap device file descriptor
+ * Creates a tap interface. If @tapfdSize is greater than one, the
+ * device is created with IFF_MULTI_QUEUE and one file descriptor
+ * is opened for each of its queues.
+ * If the @tapfd parameter is supplied, the open tap device file descriptors
  * will be returned, otherwise the TAP device will be closed. The caller must
  * use virNetDevTapDelete to remove a persistent TAP device when it is no
  * longer needed.
@@ -158,71 +161,99 @@ virNetDevProbeVnetHdr(int tapfd)
  */
 int virNetDevTapCreate(char **ifname,
                        int *tapfd,
+                       int tapfdSize,
                        unsigned int flags)
 {
-    int fd;
+    int fd = -1;
     struct ifreq ifr;
     int ret = -1;
+    int nfds = tapfd ? tapfdSize : 1;
+    int i;
+
+    for (i = 0; i < nfds; i++) {
+        if ((fd = open("/dev/net/tun", O_RDWR)) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to open /dev/net/tun, is tun module loaded?"));
+            goto cleanup;
+        }
 
-    if ((fd = open("/dev/net/tun", O_RDWR)) < 0) {
-        virReportSystemError(errno, "%s",
-                             _("Unable to open /dev/net/tun, is tun module loaded?"));
-        return -1;
-    }
+        memset(&ifr, 0, sizeof(ifr));
 
-    memset(&ifr, 0, sizeof(ifr));
+        ifr.ifr_flags = IFF_TAP|IFF_NO_PI;
 
-    ifr.ifr_flags = IFF_TAP|IFF_NO_PI;
+        if (nfds > 1) {
+# ifdef IFF_MULTI_QUEUE
+            ifr.ifr_flags |= IFF_MULTI_QUEUE;
+# else
+            virReportSystemError(ENOTSUP, "%s",
+                                 _("Multiqueue devices are not supported on "
+                                   "this system"));
+            goto cleanup;
+# endif
+        }
 
 # ifdef IFF_VNET_HDR
-    if ((flags &  VIR_NETDEV_TAP_CREATE_VNET_HDR) &&
-        virNetDevProbeVnetHdr(fd))
-        ifr.ifr_flags |= IFF_VNET_HDR;
+        if ((flags &  VIR_NETDEV_TAP_CREATE_VNET_HDR) &&
+            virNetDevProbeVnetHdr(fd))
+            ifr.ifr_flags |= IFF_VNET_HDR;
 # endif
 
-    if (virStrcpyStatic(ifr.ifr_name, *ifname) == NULL) {
-        virReportSystemError(ERANGE,
-                             _("Network interface name '%s' is too long"),
-                             *ifname);
-        goto cleanup;
+        if (virStrcpyStatic(ifr.ifr_name, *ifname) == NULL) {
+            virReportSystemError(ERANGE,
+                                 _("Network interface name '%s' is too long"),
+                                 *ifname);
+            goto cleanup;
 
-    }
+        }
 
-    if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
-        virReportSystemError(errno,
-                             _("Unable to create tap device %s"),
-                             NULLSTR(*ifname));
-        goto cleanup;
-    }
+        if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
+            virReportSystemError(errno,
+                                 _("Unable to create tap device %s"),
+                                 NULLSTR(*ifname));
+            goto cleanup;
+        }
 
-    if ((flags & VIR_NETDEV_TAP_CREATE_PERSIST) &&
-        (errno = ioctl(fd, TUNSETPERSIST, 1))) {
-        virReportSystemError(errno,
-                             _("Unable to set tap device %s to persistent"),
-                             NULLSTR(*ifname));
-        goto cleanup;
-    }
+        if (i == 0) {
+            /* Attach the other queues to the device the kernel
+             * picked a name for */
+            VIR_FREE(*ifname);
+            if (!(*ifname = strdup(ifr.ifr_name))) {
+                virReportOOMError();
+                goto cleanup;
+            }
+
+            if ((flags & VIR_NETDEV_TAP_CREATE_PERSIST) &&
+                (errno = ioctl(fd, TUNSETPERSIST, 1))) {
+                virReportSystemError(errno,
+                                     _("Unable to set tap device %s to persistent"),
+                                     NULLSTR(*ifname));
+                goto cleanup;
+            }
+        }
 
-    VIR_FREE(*ifname);
-    if (!(*ifname = strdup(ifr.ifr_name))) {
-        virReportOOMError();
-        goto cleanup;
+        if (tapfd)
+            tapfd[i] = fd;
+        else
+            VIR_FORCE_CLOSE(fd);
+        fd = -1;
     }
-    if (tapfd)
-        *tapfd = fd;
-    else
-        VIR_FORCE_CLOSE(fd);
 
     ret = 0;
 
 cleanup:
-    if (ret < 0)
+    if (ret < 0) {
         VIR_FORCE_CLOSE(fd);
+        /* Closing the queues opened so far would leave the
+         * persistent device behind */
+        if (i > 0 && (flags & VIR_NETDEV_TAP_CREATE_PERSIST))
+            ignore_value(ioctl(tapfd[0], TUNSETPERSIST, 0));
+        while (tapfd && i--)
+            VIR_FORCE_CLOSE(tapfd[i]);
+    }
 
     return ret;
 }
 
-
 int virNetDevTapDelete(const char *ifname)
 {
     struct ifreq try;
@@ -266,6 +297,7 @@ cleanup:
 #else /* ! TUNSETIFF */
 int virNetDevTapCreate(char **ifname ATTRIBUTE_UNUSED,
                        int *tapfd ATTRIBUTE_UNUSED,
+                       int tapfdSize ATTRIBUTE_UNUSED,
                        unsigned int flags ATTRIBUTE_UNUSED)
 {
     virReportSystemError(ENOSYS, "%s",
@@ -286,7 +318,8 @@ int virNetDevTapDelete(const char *ifname ATTRIBUTE_UNUSED)
  * @brname: the bridge name
  * @ifname: the interface name (or name template)
  * @macaddr: desired MAC address
- * @tapfd: file descriptor return value for the new tap device
+ * @tapfd: array of file descriptor return value for the new tap device
+ * @tapfdSize: number of file descriptors in @tapfd
  * @virtPortProfile: bridge/port specific configuration
  * @flags: OR of virNetDevTapCreateFlags:
 
@@ -302,7 +335,7 @@ int virNetDevTapDelete(const char *ifname ATTRIBUTE_UNUSED)
  * This function creates a new tap device on a bridge. @ifname can be either
  * a fixed name or a name template with '%d' for dynamic name allocation.
  * in either case the final name for the bridge will be stored in @ifname.
- * If the @tapfd parameter is supplied, the open tap device file descriptor
+ * If the @tapfd parameter is supplied, the open tap device file descriptors
  * will be returned, otherwise the TAP device will be closed. The caller must
  * use virNetDevTapDelete to remove a persistent TAP device when it is no
  * longer needed.
@@ -314,23 +347,35 @@ int virNetDevTapCreateInBridgePort(const char *brname,
                                    const virMacAddrPtr macaddr,
                                    const unsigned char *vmuuid,
                                    int *tapfd,
+                                   int tapfdSize,
                                    virNetDevVPortProfilePtr virtPortProfile,
                                    virNetDevVlanPtr virtVlan,
                                    unsigned int flags)
 {
-    virMacAddr tapmac;
+    virNetDevLinkInfo bridge;
+    virNetDevLinkInfo tap = { 0 };
     char macaddrstr[VIR_MAC_STRING_BUFLEN];
+    int i;
 
-    if (virNetDevTapCreate(ifname, tapfd, flags) < 0)
+    if (virNetDevTapCreate(ifname, tapfd, tapfdSize, flags) < 0)
         return -1;
 
+    if (virNetDevGetLinkInfo(brname, &bridge) < 0)
+        goto error;
+
+    if (!(bridge.fields & VIR_NETDEV_LINK_MTU)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Cannot get interface MTU on '%s'"), brname);
+        goto error;
+    }
+
     /* We need to set the interface MAC before adding it
      * to the bridge, because the bridge assumes the lowest
      * MAC of all enslaved interfaces & we don't want it
      * seeing the kernel allocate random MAC for the TAP
      * device before we set our static MAC.
      */
-    virMacAddrSet(&tapmac, macaddr);
+    virMacAddrSet(&tap.mac, macaddr);
     if (!(flags & VIR_NETDEV_TAP_CREATE_USE_MAC_FOR_BRIDGE)) {
         if (macaddr->addr[0] == 0xFE) {
             /* For normal use, the tap device's MAC address cannot
@@ -344,37 +389,39 @@ int virNetDevTapCreateInBridgePort(const char *brname,
                            virMacAddrFormat(macaddr, macaddrstr));
             goto error;
         }
-        tapmac.addr[0] = 0xFE; /* Discourage bridge from using TAP dev MAC */
+        tap.mac.addr[0] = 0xFE; /* Discourage bridge from using TAP dev MAC */
     }
 
-    if (virNetDevSetMAC(*ifname, &tapmac) < 0)
-        goto error;
-
     /* We need to set the interface MTU before adding it
      * to the bridge, because the bridge will have its
      * MTU adjusted automatically when we add the new interface.
+     * virNetDevSetLinkInfo applies the MAC and MTU first, then
+     * the link state and the bridge.
      */
-    if (virNetDevSetMTUFromDevice(*ifname, brname) < 0)
-        goto error;
+    tap.fields = VIR_NETDEV_LINK_MAC | VIR_NETDEV_LINK_MTU |
+        VIR_NETDEV_LINK_ONLINE;
+    tap.mtu = bridge.mtu;
+    tap.online = !!(flags & VIR_NETDEV_TAP_CREATE_IFUP);
 
     if (virtPortProfile) {
+        if (virNetDevSetLinkInfo(*ifname, &tap) < 0)
+            goto error;
         if (virNetDevOpenvswitchAddPort(brname, *ifname, macaddr, vmuuid,
                                         virtPortProfile, virtVlan) < 0) {
             goto error;
         }
     } else {
-        if (virNetDevBridgeAddPort(brname, *ifname) < 0)
+        tap.fields |= VIR_NETDEV_LINK_MASTER;
+        tap.master = bridge.ifindex;
+        if (virNetDevSetLinkInfo(*ifname, &tap) < 0)
             goto error;
     }
 
-    if (virNetDevSetOnline(*ifname, !!(flags & VIR_NETDEV_TAP_CREATE_IFUP)) < 0)
-        goto error;
-
     return 0;
 
  error:
-    if (tapfd)
-        VIR_FORCE_CLOSE(*tapfd);
+    for (i = 0; tapfd && i < tapfdSize; i++)
+        VIR_FORCE_CLOSE(tapfd[i]);
 
     return -1;
 }
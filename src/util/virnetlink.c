@@ -41,6 +41,7 @@
 #include "virthread.h"
 #include "virmacaddr.h"
 #include "virerror.h"
+#include "virutil.h"
 
 #ifndef SOL_NETLINK
 # define SOL_NETLINK 270
@@ -103,6 +104,24 @@ static int nextWatch = 1;
 static virNetlinkEventSrvPrivatePtr server[MAX_LINKS] = {NULL};
 static virNetlinkHandle *placeholder_nlhandle = NULL;
 
+/* NETLINK_ROUTE socket shared by all callers of virNetlinkCommandBatch */
+static virMutex virNetlinkRouteLock;
+static virNetlinkHandle *virNetlinkRouteHandle = NULL;
+static uint32_t virNetlinkRouteSeq;
+
+static int
+virNetlinkRouteOnceInit(void)
+{
+    if (virMutexInit(&virNetlinkRouteLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to initialize netlink mutex"));
+        return -1;
+    }
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virNetlinkRoute)
+
 /* Function definitions */
 
 /**
@@ -147,7 +166,8 @@ virNetlinkStartup(void)
  * virNetlinkShutdown:
  *
  * Undo any initialization done by virNetlinkStartup. This currently
- * destroys the placeholder nl_handle.
+ * destroys the placeholder nl_handle and closes the socket shared by
+ * virNetlinkCommandBatch.
  */
 void
 virNetlinkShutdown(void)
@@ -156,6 +176,14 @@ virNetlinkShutdown(void)
         virNetlinkFree(placeholder_nlhandle);
         placeholder_nlhandle = NULL;
     }
+    /* the handle is only ever set once the lock is initialized */
+    if (virNetlinkRouteHandle) {
+        virMutexLock(&virNetlinkRouteLock);
+        if (virNetlinkRouteHandle)
+            virNetlinkFree(virNetlinkRouteHandle);
+        virNetlinkRouteHandle = NULL;
+        virMutexUnlock(&virNetlinkRouteLock);
+    }
 }
 
 /**
@@ -275,6 +303,228 @@ error:
     return rc;
 }
 
+static virNetlinkHandle *
+virNetlinkBatchConnect(unsigned int protocol)
+{
+    virNetlinkHandle *nlhandle;
+    int fd;
+
+    if (!(nlhandle = virNetlinkAlloc())) {
+        virReportSystemError(errno,
+                             "%s", _("cannot allocate nlhandle for netlink"));
+        return NULL;
+    }
+
+    if (nl_connect(nlhandle, protocol) < 0) {
+        virReportSystemError(errno,
+                        _("cannot connect to netlink socket with protocol %d"),
+                             protocol);
+        goto error;
+    }
+
+    if ((fd = nl_socket_get_fd(nlhandle)) < 0) {
+        virReportSystemError(errno,
+                             "%s", _("cannot get netlink socket fd"));
+        goto error;
+    }
+
+    if (virSetInherit(fd, false) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Cannot set close-on-exec flag for socket"));
+        goto error;
+    }
+
+    return nlhandle;
+
+error:
+    virNetlinkFree(nlhandle);
+    return NULL;
+}
+
+/**
+ * virNetlinkCommandBatch:
+ * @msgs: requests to send, each of them asking for an ACK
+ * @nmsgs: number of requests
+ * @errors: filled in with the kernel's answer to each request,
+ *      0 or a negative errno value
+ * @resps: if not NULL, filled in with a copy of the reply to each
+ *      request (NULL for requests that got nothing but the ACK);
+ *      the caller must free them
+ * @protocol: netlink protocol
+ *
+ * Send all of @msgs in one go on a single netlink socket and collect
+ * the acknowledgements. The kernel handles the requests in order and
+ * carries on after a failed one, so @errors tells which of them took
+ * effect.
+ *
+ * NETLINK_ROUTE requests go through a socket that is opened on first
+ * use and kept for later calls; it is dropped and reopened after any
+ * failure to talk to the kernel.
+ *
+ * Returns 0 once all the answers were received, -1 on error.
+ */
+int virNetlinkCommandBatch(struct nl_msg **msgs,
+                           size_t nmsgs,
+                           int *errors,
+                           struct nlmsghdr **resps,
+                           unsigned int protocol)
+{
+    int ret = -1;
+    struct sockaddr_nl nladdr = {
+            .nl_family = AF_NETLINK,
+    };
+    struct iovec *iov = NULL;
+    struct msghdr msg = {
+            .msg_name = &nladdr,
+            .msg_namelen = sizeof(nladdr),
+    };
+    char *buf = NULL;
+    size_t bufsize = 16384;
+    size_t pending = nmsgs;
+    virNetlinkHandle *nlhandle = NULL;
+    bool shared = protocol == NETLINK_ROUTE;
+    uint32_t seqbase = 0;
+    int fd;
+    size_t i;
+
+    if (protocol >= MAX_LINKS) {
+        virReportSystemError(EINVAL,
+                             _("invalid protocol argument: %d"), protocol);
+        return -1;
+    }
+
+    for (i = 0; resps && i < nmsgs; i++)
+        resps[i] = NULL;
+
+    if (nmsgs == 0)
+        return 0;
+
+    if (VIR_ALLOC_N(iov, nmsgs) < 0 ||
+        VIR_ALLOC_N(buf, bufsize) < 0) {
+        virReportOOMError();
+        VIR_FREE(iov);
+        return -1;
+    }
+
+    if (shared) {
+        if (virNetlinkRouteInitialize() < 0) {
+            shared = false;
+            goto cleanup;
+        }
+        virMutexLock(&virNetlinkRouteLock);
+        if (!virNetlinkRouteHandle &&
+            !(virNetlinkRouteHandle = virNetlinkBatchConnect(protocol)))
+            goto cleanup;
+        nlhandle = virNetlinkRouteHandle;
+
+        /* Replies to an earlier batch that timed out may still
+         * arrive, so keep the sequence numbers unique on this socket */
+        seqbase = virNetlinkRouteSeq;
+        virNetlinkRouteSeq += nmsgs;
+    } else if (!(nlhandle = virNetlinkBatchConnect(protocol))) {
+        goto cleanup;
+    }
+
+    fd = nl_socket_get_fd(nlhandle);
+
+    for (i = 0; i < nmsgs; i++) {
+        struct nlmsghdr *nlmsg = nlmsg_hdr(msgs[i]);
+
+        nlmsg->nlmsg_seq = seqbase + i + 1;
+        nlmsg->nlmsg_pid = 0;
+        nlmsg->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+        iov[i].iov_base = nlmsg;
+        iov[i].iov_len = nlmsg->nlmsg_len;
+        errors[i] = -ETIMEDOUT;
+    }
+    msg.msg_iov = iov;
+    msg.msg_iovlen = nmsgs;
+
+    if (sendmsg(fd, &msg, 0) < 0) {
+        virReportSystemError(errno,
+                             "%s", _("cannot send to netlink socket"));
+        goto cleanup;
+    }
+
+    while (pending > 0) {
+        struct timeval tv = {
+            .tv_sec = NETLINK_ACK_TIMEOUT_S,
+        };
+        fd_set readfds;
+        struct nlmsghdr *resp;
+        ssize_t len;
+        int n;
+
+        FD_ZERO(&readfds);
+        FD_SET(fd, &readfds);
+
+        n = select(fd + 1, &readfds, NULL, NULL, &tv);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                virReportSystemError(errno, "%s",
+                                     _("error in select call"));
+            else
+                virReportSystemError(ETIMEDOUT, "%s",
+                                     _("no valid netlink response was received"));
+            goto cleanup;
+        }
+
+        if ((len = recv(fd, buf, bufsize, 0)) < 0) {
+            if (errno == EINTR)
+                continue;
+            virReportSystemError(errno, "%s",
+                                 _("cannot receive from netlink socket"));
+            goto cleanup;
+        }
+
+        for (resp = (struct nlmsghdr *) buf; NLMSG_OK(resp, len);
+             resp = NLMSG_NEXT(resp, len)) {
+            struct nlmsgerr *err = NLMSG_DATA(resp);
+            uint32_t idx = resp->nlmsg_seq - seqbase - 1;
+
+            if (idx >= nmsgs || errors[idx] != -ETIMEDOUT)
+                continue;
+
+            if (resp->nlmsg_type != NLMSG_ERROR) {
+                if (resps && !resps[idx]) {
+                    if (VIR_ALLOC_N(resps[idx], resp->nlmsg_len) < 0) {
+                        virReportOOMError();
+                        goto cleanup;
+                    }
+                    memcpy(resps[idx], resp, resp->nlmsg_len);
+                }
+                continue;
+            }
+
+            if (resp->nlmsg_len < NLMSG_LENGTH(sizeof(*err)))
+                continue;
+
+            errors[idx] = err->error;
+            pending--;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    if (ret < 0) {
+        for (i = 0; resps && i < nmsgs; i++)
+            VIR_FREE(resps[i]);
+    }
+    if (nlhandle && (!shared || ret < 0)) {
+        virNetlinkFree(nlhandle);
+        if (shared)
+            virNetlinkRouteHandle = NULL;
+    }
+    if (shared)
+        virMutexUnlock(&virNetlinkRouteLock);
+    VIR_FREE(buf);
+    VIR_FREE(iov);
+    return ret;
+}
+
 static void
 virNetlinkEventServerLock(virNetlinkEventSrvPrivatePtr driver)
 {
@@ -763,6 +1013,16 @@ int virNetlinkCommand(struct nl_msg *nl_msg ATTRIBUTE_UNUSED,
     return -1;
 }
 
+int virNetlinkCommandBatch(struct nl_msg **msgs ATTRIBUTE_UNUSED,
+                           size_t nmsgs ATTRIBUTE_UNUSED,
+                           int *errors ATTRIBUTE_UNUSED,
+                           struct nlmsghdr **resps ATTRIBUTE_UNUSED,
+                           unsigned int protocol ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
 /**
  * stopNetlinkEventServer: stop the monitor to receive netlink
  * messages for libvirtd
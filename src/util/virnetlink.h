@@ -53,6 +53,10 @@ int virNetlinkCommand(struct nl_msg *nl_msg,
                       uint32_t src_pid, uint32_t dst_pid,
                       unsigned int protocol, unsigned int groups);
 
+int virNetlinkCommandBatch(struct nl_msg **msgs, size_t nmsgs,
+                           int *errors, struct nlmsghdr **resps,
+                           unsigned int protocol);
+
 typedef void (*virNetlinkEventHandleCallback)(struct nlmsghdr *,
                                               unsigned int length,
                                               struct sockaddr_nl *peer,
@@ -21,15 +21,18 @@
 
 #include <config.h>
 
+#include <stdlib.h>
+
 #if WITH_NUMACTL
 # define NUMA_VERSION1_COMPATIBILITY 1
 # include <numa.h>
 #endif
 
 #include "virnuma.h"
-#include "vircommand.h"
+#include "viralloc.h"
 #include "virerror.h"
 #include "virlog.h"
+#include "virobject.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -45,38 +48,375 @@ VIR_ENUM_IMPL(virNumaTuneMemPlacementMode,
               "static",
               "auto");
 
-#if HAVE_NUMAD
-char *
-virNumaGetAutoPlacementAdvice(unsigned short vcpus,
-                              unsigned long long balloon)
+/* Automatic placement hands out nodesets of the same size the
+ * domain XML parser uses for cpusets and nodesets */
+#define VIR_NUMA_PLACEMENT_NODESET_LEN 1024
+
+struct _virNumaPlacement {
+    virObjectLockable parent;
+
+    /* Resources promised to already placed guests, indexed by
+     * host node number */
+    size_t nnodes;
+    unsigned long long *memory; /* in KiB */
+    unsigned int *vcpus;
+};
+
+typedef struct _virNumaPlacementCandidate virNumaPlacementCandidate;
+typedef virNumaPlacementCandidate *virNumaPlacementCandidatePtr;
+struct _virNumaPlacementCandidate {
+    virNumaPlacementNodePtr node;
+    size_t ncpus;
+    unsigned long long avail;   /* memory still usable, in KiB */
+    unsigned int vcpus;         /* vCPUs already placed on the node */
+};
+
+static virClassPtr virNumaPlacementClass;
+
+static void virNumaPlacementDispose(void *obj);
+
+static int virNumaPlacementOnceInit(void)
+{
+    if (!(virNumaPlacementClass = virClassNew(virClassForObjectLockable(),
+                                              "virNumaPlacement",
+                                              sizeof(virNumaPlacement),
+                                              virNumaPlacementDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virNumaPlacement)
+
+
+/**
+ * virNumaPlacementNew:
+ *
+ * Create the bookkeeping used for automatic NUMA placement. A
+ * driver keeps one of these for its whole lifetime so that each
+ * new guest is placed with the load of the previous ones in mind.
+ *
+ * Returns a new placement object or NULL on error
+ */
+virNumaPlacementPtr
+virNumaPlacementNew(void)
+{
+    if (virNumaPlacementInitialize() < 0)
+        return NULL;
+
+    return virObjectLockableNew(virNumaPlacementClass);
+}
+
+
+static void
+virNumaPlacementDispose(void *obj)
+{
+    virNumaPlacementPtr placement = obj;
+
+    VIR_FREE(placement->memory);
+    VIR_FREE(placement->vcpus);
+}
+
+
+void
+virNumaPlacementNodesFree(virNumaPlacementNodePtr nodes,
+                          size_t nnodes)
+{
+    size_t i;
+
+    if (!nodes)
+        return;
+
+    for (i = 0; i < nnodes; i++)
+        virBitmapFree(nodes[i].cpus);
+    VIR_FREE(nodes);
+}
+
+
+/*
+ * Spread @vcpus and @memory evenly over the nodes in @nodeset and
+ * add them to, or take them away from, the committed load. The
+ * remainder goes to the lowest numbered nodes so that releasing a
+ * guest undoes exactly what reserving it did.
+ *
+ * Must be called with @placement locked.
+ */
+static int
+virNumaPlacementAccount(virNumaPlacementPtr placement,
+                        virBitmapPtr nodeset,
+                        unsigned short vcpus,
+                        unsigned long long memory,
+                        bool add)
+{
+    size_t count = virBitmapCountBits(nodeset);
+    ssize_t node = -1;
+    ssize_t last = -1;
+    size_t n = 0;
+
+    if (!count)
+        return 0;
+
+    while ((node = virBitmapNextSetBit(nodeset, node)) >= 0)
+        last = node;
+
+    if (add && last >= placement->nnodes) {
+        size_t nmemory = placement->nnodes;
+        size_t grow = last + 1 - placement->nnodes;
+
+        if (VIR_EXPAND_N(placement->memory, nmemory, grow) < 0 ||
+            VIR_EXPAND_N(placement->vcpus, placement->nnodes, grow) < 0) {
+            virReportOOMError();
+            return -1;
+        }
+    }
+
+    node = -1;
+    while ((node = virBitmapNextSetBit(nodeset, node)) >= 0 &&
+           node < placement->nnodes) {
+        unsigned long long memShare = memory / count + (n < memory % count);
+        unsigned int vcpuShare = vcpus / count + (n < vcpus % count);
+
+        n++;
+        if (add) {
+            placement->memory[node] += memShare;
+            placement->vcpus[node] += vcpuShare;
+        } else {
+            placement->memory[node] -= MIN(memShare, placement->memory[node]);
+            placement->vcpus[node] -= MIN(vcpuShare, placement->vcpus[node]);
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Order candidates from the most to the least attractive: nodes
+ * with CPUs before memory only nodes, then the lowest vCPU per
+ * host CPU ratio, then the most usable memory, then the lowest
+ * node number so that the outcome never depends on qsort.
+ */
+static int
+virNumaPlacementCandidateCompare(const void *a,
+                                 const void *b)
 {
-    virCommandPtr cmd = NULL;
-    char *output = NULL;
+    const virNumaPlacementCandidate *ca = a;
+    const virNumaPlacementCandidate *cb = b;
+    unsigned long long loadA;
+    unsigned long long loadB;
+
+    if (!ca->ncpus != !cb->ncpus)
+        return ca->ncpus ? -1 : 1;
+
+    loadA = (unsigned long long) ca->vcpus * cb->ncpus;
+    loadB = (unsigned long long) cb->vcpus * ca->ncpus;
+    if (loadA != loadB)
+        return loadA < loadB ? -1 : 1;
+
+    if (ca->avail != cb->avail)
+        return ca->avail > cb->avail ? -1 : 1;
 
-    cmd = virCommandNewArgList(NUMAD, "-w", NULL);
-    virCommandAddArgFormat(cmd, "%d:%llu", vcpus,
-                           VIR_DIV_UP(balloon, 1024));
+    if (ca->node->id != cb->node->id)
+        return ca->node->id < cb->node->id ? -1 : 1;
 
-    virCommandSetOutputBuffer(cmd, &output);
+    return 0;
+}
 
-    if (virCommandRun(cmd, NULL) < 0)
+
+/**
+ * virNumaPlacementChoose:
+ * @placement: bookkeeping of already placed guests
+ * @nodes: host NUMA topology together with current free memory
+ * @nnodes: number of items in @nodes
+ * @vcpus: number of vCPUs of the guest
+ * @memory: guest memory in KiB
+ * @nodeset: filled with the chosen host nodes
+ * @cpuset: if not NULL, filled with the host CPUs of those nodes
+ *
+ * Pick host NUMA nodes for a guest whose placement is 'auto'.
+ * A single node is preferred: the least loaded one that can hold
+ * both the vCPUs and the memory of the guest. If there is no such
+ * node, nodes are added in the same order of preference until the
+ * guest fits, and if even that fails every node is used.
+ *
+ * Memory a node can give is its free memory, but never more than
+ * its size minus what earlier guests were promised, because those
+ * might not have touched all of their memory yet. The chosen load
+ * is reserved in @placement before the lock is dropped, so guests
+ * started concurrently do not all end up on the same node. The
+ * caller must hand the same nodeset, vCPU count and memory size
+ * to virNumaPlacementRelease once the guest is gone.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int
+virNumaPlacementChoose(virNumaPlacementPtr placement,
+                       virNumaPlacementNodePtr nodes,
+                       size_t nnodes,
+                       unsigned short vcpus,
+                       unsigned long long memory,
+                       virBitmapPtr *nodeset,
+                       virBitmapPtr *cpuset)
+{
+    virNumaPlacementCandidatePtr cands = NULL;
+    virBitmapPtr chosenNodes = NULL;
+    virBitmapPtr chosenCpus = NULL;
+    size_t ncpus = 0;
+    size_t maxcpus = 0;
+    unsigned long long avail = 0;
+    size_t nchosen = 0;
+    size_t i;
+    int ret = -1;
+
+    virObjectLock(placement);
+
+    if (nnodes == 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("Failed to query numad for the "
-                         "advisory nodeset"));
+                       _("no host NUMA nodes available for automatic "
+                         "placement"));
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(cands, nnodes) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    for (i = 0; i < nnodes; i++) {
+        virNumaPlacementNodePtr node = &nodes[i];
+        unsigned long long committed = 0;
+
+        if (node->id >= VIR_NUMA_PLACEMENT_NODESET_LEN) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("host NUMA node %u is out of range"), node->id);
+            goto cleanup;
+        }
+
+        cands[i].node = node;
+        if (node->cpus) {
+            cands[i].ncpus = virBitmapCountBits(node->cpus);
+            maxcpus = MAX(maxcpus, virBitmapSize(node->cpus));
+        }
+        if (node->id < placement->nnodes) {
+            committed = placement->memory[node->id];
+            cands[i].vcpus = placement->vcpus[node->id];
+        }
+        if (node->memTotal > committed)
+            cands[i].avail = MIN(node->memFree, node->memTotal - committed);
+    }
+
+    qsort(cands, nnodes, sizeof(*cands), virNumaPlacementCandidateCompare);
+
+    for (i = 0; i < nnodes; i++) {
+        if (cands[i].ncpus >= vcpus && cands[i].avail >= memory) {
+            cands[0] = cands[i];
+            nchosen = 1;
+            break;
+        }
+    }
+
+    for (i = 0; !nchosen && i < nnodes; i++) {
+        ncpus += cands[i].ncpus;
+        avail += cands[i].avail;
+        if (ncpus >= vcpus && avail >= memory)
+            nchosen = i + 1;
+    }
 
-    virCommandFree(cmd);
-    return output;
+    if (!nchosen) {
+        VIR_DEBUG("Guest with %u vCPUs and %lluKiB does not fit, "
+                  "using all host nodes", vcpus, memory);
+        nchosen = nnodes;
+    }
+
+    if (!(chosenNodes = virBitmapNew(VIR_NUMA_PLACEMENT_NODESET_LEN)) ||
+        (cpuset && maxcpus && !(chosenCpus = virBitmapNew(maxcpus)))) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    for (i = 0; i < nchosen; i++) {
+        ignore_value(virBitmapSetBit(chosenNodes, cands[i].node->id));
+
+        if (chosenCpus && cands[i].node->cpus) {
+            ssize_t cpu = -1;
+
+            while ((cpu = virBitmapNextSetBit(cands[i].node->cpus, cpu)) >= 0)
+                ignore_value(virBitmapSetBit(chosenCpus, cpu));
+        }
+    }
+
+    if (virNumaPlacementAccount(placement, chosenNodes,
+                                vcpus, memory, true) < 0)
+        goto cleanup;
+
+    *nodeset = chosenNodes;
+    chosenNodes = NULL;
+    if (cpuset) {
+        *cpuset = chosenCpus;
+        chosenCpus = NULL;
+    }
+    ret = 0;
+
+cleanup:
+    virObjectUnlock(placement);
+    virBitmapFree(chosenNodes);
+    virBitmapFree(chosenCpus);
+    VIR_FREE(cands);
+    return ret;
 }
-#else
-char *
-virNumaGetAutoPlacementAdvice(unsigned short vcpus ATTRIBUTE_UNUSED,
-                              unsigned long long balloon ATTRIBUTE_UNUSED)
+
+
+/**
+ * virNumaPlacementReserve:
+ * @placement: bookkeeping of already placed guests
+ * @nodeset: host nodes the guest was placed on
+ * @vcpus: number of vCPUs of the guest
+ * @memory: guest memory in KiB
+ *
+ * Account for a guest placed earlier, for example one that was
+ * found running when the driver restarted.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int
+virNumaPlacementReserve(virNumaPlacementPtr placement,
+                        virBitmapPtr nodeset,
+                        unsigned short vcpus,
+                        unsigned long long memory)
 {
-    virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
-                   _("numad is not available on this host"));
-    return NULL;
+    int ret;
+
+    virObjectLock(placement);
+    ret = virNumaPlacementAccount(placement, nodeset, vcpus, memory, true);
+    virObjectUnlock(placement);
+
+    return ret;
+}
+
+
+/**
+ * virNumaPlacementRelease:
+ * @placement: bookkeeping of already placed guests
+ * @nodeset: host nodes the guest was placed on
+ * @vcpus: number of vCPUs of the guest
+ * @memory: guest memory in KiB
+ *
+ * Give back the load of a guest that is no longer running.
+ */
+void
+virNumaPlacementRelease(virNumaPlacementPtr placement,
+                        virBitmapPtr nodeset,
+                        unsigned short vcpus,
+                        unsigned long long memory)
+{
+    if (!placement || !nodeset)
+        return;
+
+    virObjectLock(placement);
+    ignore_value(virNumaPlacementAccount(placement, nodeset,
+                                         vcpus, memory, false));
+    virObjectUnlock(placement);
 }
-#endif
 
 #if WITH_NUMACTL
 int
@@ -99,7 +439,7 @@ virNumaSetupMemoryPolicy(virNumaTuneDef numatune,
         tmp_nodemask = numatune.memory.nodemask;
     } else if (numatune.memory.placement_mode ==
                VIR_NUMA_TUNE_MEM_PLACEMENT_MODE_AUTO) {
-        VIR_DEBUG("Set NUMA memory policy with advisory nodeset from numad");
+        VIR_DEBUG("Set NUMA memory policy with automatically placed nodeset");
         tmp_nodemask = nodemask;
     } else {
         return 0;
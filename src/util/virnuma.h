@@ -38,6 +38,13 @@ VIR_ENUM_DECL(virNumaTuneMemPlacementMode)
 
 VIR_ENUM_DECL(virDomainNumatuneMemMode)
 
+typedef struct _virNumaTuneNodeDef virNumaTuneNodeDef;
+typedef virNumaTuneNodeDef *virNumaTuneNodeDefPtr;
+struct _virNumaTuneNodeDef {
+    virBitmapPtr nodeset; /* NULL if the guest cell is not bound */
+    int mode; /* enum virDomainNumatuneMemMode */
+};
+
 typedef struct _virNumaTuneDef virNumaTuneDef;
 typedef virNumaTuneDef *virNumaTuneDefPtr;
 struct _virNumaTuneDef {
@@ -47,11 +54,47 @@ struct _virNumaTuneDef {
         int placement_mode; /* enum virNumaTuneMemPlacementMode */
     } memory;
 
+    /* Host binding of guest NUMA cells, indexed by guest cell id */
+    size_t nmem_nodes;
+    virNumaTuneNodeDefPtr mem_nodes;
+
     /* Future NUMA tuning related stuff should go here. */
 };
 
-char *virNumaGetAutoPlacementAdvice(unsigned short vcups,
-                                    unsigned long long balloon);
+typedef struct _virNumaPlacementNode virNumaPlacementNode;
+typedef virNumaPlacementNode *virNumaPlacementNodePtr;
+struct _virNumaPlacementNode {
+    unsigned int id;                /* host NUMA node number */
+    virBitmapPtr cpus;              /* host CPUs local to the node */
+    unsigned long long memTotal;    /* in KiB */
+    unsigned long long memFree;     /* in KiB */
+};
+
+void virNumaPlacementNodesFree(virNumaPlacementNodePtr nodes,
+                               size_t nnodes);
+
+typedef struct _virNumaPlacement virNumaPlacement;
+typedef virNumaPlacement *virNumaPlacementPtr;
+
+virNumaPlacementPtr virNumaPlacementNew(void);
+
+int virNumaPlacementChoose(virNumaPlacementPtr placement,
+                           virNumaPlacementNodePtr nodes,
+                           size_t nnodes,
+                           unsigned short vcpus,
+                           unsigned long long memory,
+                           virBitmapPtr *nodeset,
+                           virBitmapPtr *cpuset)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(6);
+int virNumaPlacementReserve(virNumaPlacementPtr placement,
+                            virBitmapPtr nodeset,
+                            unsigned short vcpus,
+                            unsigned long long memory)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+void virNumaPlacementRelease(virNumaPlacementPtr placement,
+                             virBitmapPtr nodeset,
+                             unsigned short vcpus,
+                             unsigned long long memory);
 
 int virNumaSetupMemoryPolicy(virNumaTuneDef numatune,
                              virBitmapPtr nodemask);
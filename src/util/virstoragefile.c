@@ -45,6 +45,7 @@
 #include "virendian.h"
 #include "virstring.h"
 #include "virutil.h"
+#include "stat-time.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -700,6 +701,11 @@ virStorageFileGetMetadataInternal(const char *path,
         goto cleanup;
     }
 
+    meta->dev = sb.st_dev;
+    meta->ino = sb.st_ino;
+    meta->size = sb.st_size;
+    meta->mtime = get_stat_mtime(&sb);
+
     /* No header to probe for directories, but also no backing file */
     if (S_ISDIR(sb.st_mode))
         return meta;
@@ -930,11 +936,69 @@ virStorageFileGetMetadataFromFD(const char *path,
     return virStorageFileGetMetadataInternal(path, fd, NULL, format);
 }
 
+/* Look for metadata about PATH in CACHE which is still valid, i.e.
+ * read the same way from an image which has not changed since, and
+ * whose backing file name still resolves to the same file, and
+ * remove it from CACHE.  Each image of a chain is checked this way
+ * as the chain is walked, so a hit never covers more than one image.  */
+static virStorageFileMetadataPtr
+virStorageFileMetadataCacheSteal(virHashTablePtr cache,
+                                 const char *path,
+                                 const char *directory,
+                                 int format,
+                                 bool allow_probe)
+{
+    virStorageFileMetadataPtr meta;
+    struct timespec mtime;
+    struct stat sb;
+    char *canonical = NULL;
+    bool same;
+
+    if (!cache || !(meta = virHashLookup(cache, path)))
+        return NULL;
+
+    if (meta->format != format || meta->allowProbe != allow_probe ||
+        STRNEQ_NULLABLE(meta->pathDirectory, directory))
+        return NULL;
+
+    /* A backing file which was missing may have appeared since, and
+     * reading the image again is also what reports it still missing */
+    if (meta->backingStoreRaw && !meta->backingStoreIsFile)
+        return NULL;
+
+    /* Anything we can't stat is probed again, to get the error right */
+    if (stat(path, &sb) < 0)
+        return NULL;
+
+    mtime = get_stat_mtime(&sb);
+    if (meta->dev != sb.st_dev ||
+        meta->ino != sb.st_ino ||
+        meta->size != sb.st_size ||
+        meta->mtime.tv_sec != mtime.tv_sec ||
+        meta->mtime.tv_nsec != mtime.tv_nsec)
+        return NULL;
+
+    /* The image is unchanged, but a relative backing name or a symlink
+     * on the way to the backing file may now lead somewhere else */
+    if (meta->backingStoreIsFile) {
+        if (virFindBackingFile(directory ? directory : path, !!directory,
+                               meta->backingStoreRaw, NULL, &canonical) < 0)
+            return NULL;
+        same = STREQ_NULLABLE(canonical, meta->backingStore);
+        VIR_FREE(canonical);
+        if (!same)
+            return NULL;
+    }
+
+    return virHashSteal(cache, path);
+}
+
 /* Recursive workhorse for virStorageFileGetMetadata.  */
 static virStorageFileMetadataPtr
 virStorageFileGetMetadataRecurse(const char *path, const char *directory,
                                  int format, uid_t uid, gid_t gid,
-                                 bool allow_probe, virHashTablePtr cycle)
+                                 bool allow_probe, virHashTablePtr cycle,
+                                 virHashTablePtr cache, size_t *reused)
 {
     int fd;
     VIR_DEBUG("path=%s format=%d uid=%d gid=%d probe=%d",
@@ -951,28 +1015,51 @@ virStorageFileGetMetadataRecurse(const char *path, const char *directory,
     if (virHashAddEntry(cycle, path, (void *)1) < 0)
         return NULL;
 
-    if ((fd = virFileOpenAs(path, O_RDONLY, 0, uid, gid, 0)) < 0) {
-        virReportSystemError(-fd, _("cannot open file '%s'"), path);
-        return NULL;
-    }
+    if ((ret = virStorageFileMetadataCacheSteal(cache, path, directory,
+                                                format, allow_probe))) {
+        VIR_DEBUG("reusing metadata of unchanged file %s", path);
+        (*reused)++;
+    } else {
+        if ((fd = virFileOpenAs(path, O_RDONLY, 0, uid, gid, 0)) < 0) {
+            virReportSystemError(-fd, _("cannot open file '%s'"), path);
+            return NULL;
+        }
+
+        ret = virStorageFileGetMetadataInternal(path, fd, directory, format);
 
-    ret = virStorageFileGetMetadataInternal(path, fd, directory, format);
+        if (VIR_CLOSE(fd) < 0)
+            VIR_WARN("could not close file %s", path);
 
-    if (VIR_CLOSE(fd) < 0)
-        VIR_WARN("could not close file %s", path);
+        if (!ret)
+            return NULL;
+
+        if (!(ret->path = strdup(path)) ||
+            (directory && !(ret->pathDirectory = strdup(directory)))) {
+            virReportOOMError();
+            virStorageFileFreeMetadata(ret);
+            return NULL;
+        }
+        ret->format = format;
+        ret->allowProbe = allow_probe;
+
+        if (ret->backingStoreIsFile) {
+            if (ret->backingStoreFormat == VIR_STORAGE_FILE_AUTO &&
+                !allow_probe)
+                ret->backingStoreFormat = VIR_STORAGE_FILE_RAW;
+            else if (ret->backingStoreFormat == VIR_STORAGE_FILE_AUTO_SAFE)
+                ret->backingStoreFormat = VIR_STORAGE_FILE_AUTO;
+        }
+    }
 
-    if (ret && ret->backingStoreIsFile) {
-        if (ret->backingStoreFormat == VIR_STORAGE_FILE_AUTO && !allow_probe)
-            ret->backingStoreFormat = VIR_STORAGE_FILE_RAW;
-        else if (ret->backingStoreFormat == VIR_STORAGE_FILE_AUTO_SAFE)
-            ret->backingStoreFormat = VIR_STORAGE_FILE_AUTO;
+    if (ret->backingStoreIsFile) {
         format = ret->backingStoreFormat;
         ret->backingMeta = virStorageFileGetMetadataRecurse(ret->backingStore,
                                                             ret->directory,
                                                             format,
                                                             uid, gid,
                                                             allow_probe,
-                                                            cycle);
+                                                            cycle,
+                                                            cache, reused);
     }
 
     return ret;
@@ -1017,7 +1104,79 @@ virStorageFileGetMetadata(const char *path, int format,
     if (format <= VIR_STORAGE_FILE_NONE)
         format = allow_probe ? VIR_STORAGE_FILE_AUTO : VIR_STORAGE_FILE_RAW;
     ret = virStorageFileGetMetadataRecurse(path, NULL, format, uid, gid,
-                                           allow_probe, cycle);
+                                           allow_probe, cycle, NULL, NULL);
+    virHashFree(cycle);
+    return ret;
+}
+
+
+static void
+virStorageFileMetadataCacheFree(void *payload,
+                                const void *name ATTRIBUTE_UNUSED)
+{
+    virStorageFileFreeMetadata(payload);
+}
+
+/**
+ * virStorageFileGetMetadataCached:
+ *
+ * Same as virStorageFileGetMetadata, except that the metadata of the
+ * images of the previous chain in CACHE which are still found in the
+ * chain is reused as long as they have the same device, inode, size
+ * and modification time as when they were read, saving opening and
+ * parsing them again. Every image of the chain is checked on its own,
+ * its backing file name is resolved again, and images whose backing
+ * file was missing are always read again. CACHE is consumed, and set
+ * to NULL.
+ *
+ * If REUSED is not NULL, it is incremented by the number of images
+ * which were not read again.
+ *
+ * Caller MUST free result after use via virStorageFileFreeMetadata.
+ */
+virStorageFileMetadataPtr
+virStorageFileGetMetadataCached(const char *path, int format,
+                                uid_t uid, gid_t gid,
+                                bool allow_probe,
+                                virStorageFileMetadataPtr *cache,
+                                size_t *reused)
+{
+    virHashTablePtr cycle = NULL;
+    virHashTablePtr entries = NULL;
+    virStorageFileMetadataPtr ret = NULL;
+    virStorageFileMetadataPtr meta;
+    size_t count = 0;
+
+    VIR_DEBUG("path=%s format=%d uid=%d gid=%d probe=%d cache=%p",
+              path, format, (int)uid, (int)gid, allow_probe, *cache);
+
+    if (!(cycle = virHashCreate(5, NULL)) ||
+        !(entries = virHashCreate(5, virStorageFileMetadataCacheFree)))
+        goto cleanup;
+
+    /* Index the previous chain by path, unlinking it as we go so that
+     * each entry can be reused or freed on its own */
+    while ((meta = *cache)) {
+        *cache = meta->backingMeta;
+        meta->backingMeta = NULL;
+        if (!meta->path || virHashAddEntry(entries, meta->path, meta) < 0)
+            virStorageFileFreeMetadata(meta);
+    }
+
+    if (format <= VIR_STORAGE_FILE_NONE)
+        format = allow_probe ? VIR_STORAGE_FILE_AUTO : VIR_STORAGE_FILE_RAW;
+    ret = virStorageFileGetMetadataRecurse(path, NULL, format, uid, gid,
+                                           allow_probe, cycle,
+                                           entries, &count);
+
+    VIR_DEBUG("reused metadata of %zu files in the chain of %s", count, path);
+    if (reused)
+        *reused += count;
+
+cleanup:
+    virStorageFileFreeMetadata(*cache);
+    *cache = NULL;
+    virHashFree(entries);
     virHashFree(cycle);
     return ret;
 }
@@ -1034,6 +1193,8 @@ virStorageFileFreeMetadata(virStorageFileMetadata *meta)
         return;
 
     virStorageFileFreeMetadata(meta->backingMeta);
+    VIR_FREE(meta->path);
+    VIR_FREE(meta->pathDirectory);
     VIR_FREE(meta->backingStore);
     VIR_FREE(meta->backingStoreRaw);
     VIR_FREE(meta->directory);
@@ -24,6 +24,9 @@
 #ifndef __VIR_STORAGE_FILE_H__
 # define __VIR_STORAGE_FILE_H__
 
+# include <sys/stat.h>
+# include <time.h>
+
 # include "virutil.h"
 
 enum virStorageFileFormat {
@@ -62,6 +65,17 @@ struct _virStorageFileMetadata {
     virStorageFileMetadataPtr backingMeta;
     unsigned long long capacity;
     bool encrypted;
+
+    /* Identity of the image this was read from, which lets
+     * virStorageFileGetMetadataCached reuse it while unchanged */
+    char *path;
+    char *pathDirectory; /* DIRECTORY it was resolved from, if any */
+    int format; /* enum virStorageFileFormat, as requested */
+    bool allowProbe;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
 };
 
 # ifndef DEV_BSIZE
@@ -76,6 +90,13 @@ virStorageFileMetadataPtr virStorageFileGetMetadata(const char *path,
                                                     int format,
                                                     uid_t uid, gid_t gid,
                                                     bool allow_probe);
+virStorageFileMetadataPtr virStorageFileGetMetadataCached(const char *path,
+                                                          int format,
+                                                          uid_t uid, gid_t gid,
+                                                          bool allow_probe,
+                                                          virStorageFileMetadataPtr *cache,
+                                                          size_t *reused)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(6);
 virStorageFileMetadataPtr virStorageFileGetMetadataFromFD(const char *path,
                                                           int fd,
                                                           int format);
@@ -112,7 +112,9 @@ static void virThreadPoolWorker(void *opaque)
         if (pool->quit)
             break;
 
-        if (priority) {
+        /* Normal workers also serve queued priority jobs first,
+         * so they never wait behind a backlog of bulk ones */
+        if (priority || pool->jobList.firstPrio) {
             job = pool->jobList.firstPrio;
         } else {
             job = pool->jobList.head;
@@ -66,6 +66,9 @@
 #if defined HAVE_MNTENT_H && defined HAVE_GETMNTENT_R
 # include <mntent.h>
 #endif
+#ifdef __linux__
+# include <sys/statfs.h>
+#endif
 
 #ifdef WIN32
 # ifdef HAVE_WINSOCK2_H
@@ -2836,6 +2839,44 @@ virFileFindMountPoint(const char *type ATTRIBUTE_UNUSED)
 
 #endif /* defined HAVE_MNTENT_H && defined HAVE_GETMNTENT_R */
 
+#ifdef __linux__
+# ifndef HUGETLBFS_MAGIC
+#  define HUGETLBFS_MAGIC 0x958458f6
+# endif
+
+/* Find out the size of hugepages backing the hugetlbfs mounted
+ * at @path and store it in @size, in KiB. Returns 0 on success,
+ * -1 with errno set on failure. */
+int
+virFileGetHugepageSize(const char *path,
+                       unsigned long long *size)
+{
+    struct statfs fs;
+
+    if (statfs(path, &fs) < 0)
+        return -1;
+
+    if (fs.f_type != HUGETLBFS_MAGIC) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *size = fs.f_bsize / 1024;
+    return 0;
+}
+
+#else /* __linux__ */
+
+int
+virFileGetHugepageSize(const char *path ATTRIBUTE_UNUSED,
+                       unsigned long long *size ATTRIBUTE_UNUSED)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif /* __linux__ */
+
 #if defined(UDEVADM) || defined(UDEVSETTLE)
 void virFileWaitForDevices(void)
 {
@@ -225,6 +225,8 @@ int virGetGroupID(const char *name,
                   gid_t *gid) ATTRIBUTE_RETURN_CHECK;
 
 char *virFileFindMountPoint(const char *type);
+int virFileGetHugepageSize(const char *path,
+                           unsigned long long *size);
 
 void virFileWaitForDevices(void);
 
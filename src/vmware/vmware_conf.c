@@ -141,6 +141,7 @@ vmwareLoadDomains(struct vmware_driver *driver)
     virVMXContext ctx;
     char *outbuf = NULL;
     char *str;
+    int pid;
     char *saveptr = NULL;
     virCommandPtr cmd;
 
@@ -182,8 +183,9 @@ vmwareLoadDomains(struct vmware_driver *driver)
 
         vmwareDomainConfigDisplay(pDomain, vmdef);
 
-        if ((vm->def->id = vmwareExtractPid(vmxPath)) < 0)
+        if ((pid = vmwareExtractPid(vmxPath)) < 0)
             goto cleanup;
+        virDomainObjListSetID(driver->domains, vm, pid);
         /* vmrun list only reports running vms */
         virDomainObjSetState(vm, VIR_DOMAIN_RUNNING,
                              VIR_DOMAIN_RUNNING_UNKNOWN);
@@ -232,7 +232,7 @@ vmwareUpdateVMStatus(struct vmware_driver *driver, virDomainObjPtr vm)
     }
 
     if (!found) {
-        vm->def->id = -1;
+        virDomainObjListSetID(driver->domains, vm, -1);
         newState = VIR_DOMAIN_SHUTOFF;
     }
 
@@ -264,7 +264,7 @@ vmwareStopVM(struct vmware_driver *driver,
         return -1;
     }
 
-    vm->def->id = -1;
+    virDomainObjListSetID(driver->domains, vm, -1);
     virDomainObjSetState(vm, VIR_DOMAIN_SHUTOFF, reason);
 
     return 0;
@@ -278,6 +278,7 @@ vmwareStartVM(struct vmware_driver *driver, virDomainObjPtr vm)
         PROGRAM_SENTINAL, PROGRAM_SENTINAL, NULL
     };
     const char *vmxPath = ((vmwareDomainPtr) vm->privateData)->vmxPath;
+    int pid;
 
     if (virDomainObjGetState(vm, NULL) != VIR_DOMAIN_SHUTOFF) {
         virReportError(VIR_ERR_OPERATION_INVALID, "%s",
@@ -296,10 +297,11 @@ vmwareStartVM(struct vmware_driver *driver, virDomainObjPtr vm)
         return -1;
     }
 
-    if ((vm->def->id = vmwareExtractPid(vmxPath)) < 0) {
+    if ((pid = vmwareExtractPid(vmxPath)) < 0) {
         vmwareStopVM(driver, vm, VIR_DOMAIN_SHUTOFF_FAILED);
         return -1;
     }
+    virDomainObjListSetID(driver->domains, vm, pid);
 
     virDomainObjSetState(vm, VIR_DOMAIN_RUNNING, VIR_DOMAIN_RUNNING_BOOTED);
 
@@ -0,0 +1,403 @@
+/*
+ * domainconfindextest.c: test deferred loading of domain configs
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "testutils.h"
+#include "internal.h"
+#include "domain_conf.h"
+#include "viralloc.h"
+#include "vircommand.h"
+#include "virfile.h"
+#include "virstring.h"
+#include "virutil.h"
+#include "stat-time.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define NUM_DOMAINS 3
+
+static char *tmpdir;
+static char *configDir;
+static char *autostartDir;
+static char *indexFile;
+static virCapsPtr caps;
+static virDomainXMLOptionPtr xmlopt;
+
+static const char *domxml =
+    "<domain type='test'>\n"
+    "  <name>vm%d</name>\n"
+    "  <uuid>c7a5fdbd-edaf-9455-926a-d65c16db180%d</uuid>\n"
+    "  <memory unit='KiB'>%d</memory>\n"
+    "  <os><type>hvm</type></os>\n"
+    "</domain>\n";
+
+
+static char *
+testIndexConfigFile(int i)
+{
+    char *path = NULL;
+
+    ignore_value(virAsprintf(&path, "%s/vm%d.xml", configDir, i));
+    return path;
+}
+
+/* Write the config of domain 'i', which uses 'memory' KiB */
+static int
+testIndexWriteConfig(int i, int memory)
+{
+    char *path = NULL;
+    char *xml = NULL;
+    int ret = -1;
+
+    if (!(path = testIndexConfigFile(i)) ||
+        virAsprintf(&xml, domxml, i, i, memory) < 0)
+        goto cleanup;
+
+    ret = virFileWriteStr(path, xml, 0600);
+
+cleanup:
+    VIR_FREE(path);
+    VIR_FREE(xml);
+    return ret;
+}
+
+/* Replace the config of domain 'i' with garbage of the same size
+ * and modification time, which the index can't tell apart */
+static int
+testIndexBreakConfig(int i)
+{
+    struct stat sb;
+    struct timespec times[2];
+    char *path = NULL;
+    char *garbage = NULL;
+    int ret = -1;
+
+    if (!(path = testIndexConfigFile(i)) ||
+        stat(path, &sb) < 0 ||
+        VIR_ALLOC_N(garbage, sb.st_size + 1) < 0)
+        goto cleanup;
+
+    memset(garbage, '<', sb.st_size);
+    if (virFileWriteStr(path, garbage, 0600) < 0)
+        goto cleanup;
+
+    times[0] = times[1] = get_stat_mtime(&sb);
+    if (utimensat(AT_FDCWD, path, times, 0) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(path);
+    VIR_FREE(garbage);
+    return ret;
+}
+
+static virDomainObjListPtr
+testIndexLoad(void)
+{
+    virDomainObjListPtr doms;
+
+    if (!(doms = virDomainObjListNew()))
+        return NULL;
+
+    if (virDomainObjListLoadAllConfigsCached(doms, configDir, autostartDir,
+                                             indexFile, caps, xmlopt,
+                                             1 << VIR_DOMAIN_VIRT_TEST,
+                                             NULL, NULL) < 0) {
+        virObjectUnref(doms);
+        return NULL;
+    }
+
+    return doms;
+}
+
+static int
+testIndexCountDeferred(virDomainObjPtr vm,
+                       void *opaque)
+{
+    int *count = opaque;
+
+    virObjectLock(vm);
+    if (vm->defFile)
+        (*count)++;
+    virObjectUnlock(vm);
+    return 0;
+}
+
+static int
+testIndexDeferred(virDomainObjListPtr doms)
+{
+    int count = 0;
+
+    virDomainObjListForEachLazy(doms, testIndexCountDeferred, &count);
+    return count;
+}
+
+/* Check that domain 'i' is found with 'memory' KiB, or not at all */
+static int
+testIndexLookup(virDomainObjListPtr doms, int i, int memory)
+{
+    virDomainObjPtr vm;
+    char name[16];
+    int ret = -1;
+
+    snprintf(name, sizeof(name), "vm%d", i);
+    vm = virDomainObjListFindByName(doms, name);
+
+    if (!memory) {
+        if (vm) {
+            fprintf(stderr, "broken domain %s still found\n", name);
+            goto cleanup;
+        }
+        return 0;
+    }
+
+    if (!vm) {
+        fprintf(stderr, "domain %s not found\n", name);
+        goto cleanup;
+    }
+    if (vm->defFile || vm->def->mem.max_balloon != memory) {
+        fprintf(stderr, "domain %s not loaded\n", name);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    if (vm)
+        virObjectUnlock(vm);
+    return ret;
+}
+
+
+/* Unchanged configs are only parsed on first use */
+static int
+testIndexDefer(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virDomainObjListPtr doms = NULL;
+    int count = 0;
+    int ret = -1;
+    int i;
+
+    for (i = 1; i <= NUM_DOMAINS; i++) {
+        if (testIndexWriteConfig(i, 1024 * i) < 0)
+            return -1;
+    }
+
+    /* Without an index, everything is parsed */
+    unlink(indexFile);
+    if (!(doms = testIndexLoad()) || testIndexDeferred(doms) != 0)
+        goto cleanup;
+    virObjectUnref(doms);
+
+    if (!(doms = testIndexLoad()) ||
+        testIndexDeferred(doms) != NUM_DOMAINS ||
+        virDomainObjListNumOfDomains(doms, false) != NUM_DOMAINS)
+        goto cleanup;
+
+    if (testIndexLookup(doms, 2, 2048) < 0 ||
+        testIndexDeferred(doms) != NUM_DOMAINS - 1)
+        goto cleanup;
+
+    if (virDomainObjListForEach(doms, testIndexCountDeferred, &count) < 0 ||
+        testIndexDeferred(doms) != 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virObjectUnref(doms);
+    return ret;
+}
+
+
+/* A config which changed since the index was written is parsed */
+static int
+testIndexChanged(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virDomainObjListPtr doms = NULL;
+    int ret = -1;
+
+    if (testIndexWriteConfig(1, 1024) < 0 ||
+        !(doms = testIndexLoad()))
+        goto cleanup;
+    virObjectUnref(doms);
+
+    if (testIndexWriteConfig(1, 10240) < 0 ||
+        !(doms = testIndexLoad()) ||
+        testIndexDeferred(doms) != NUM_DOMAINS - 1 ||
+        testIndexLookup(doms, 1, 10240) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virObjectUnref(doms);
+    return ret;
+}
+
+
+/* A deferred config which fails to parse leaves no trace of the
+ * domain, just like it would have if it had been parsed right away */
+static int
+testIndexBroken(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virDomainObjListPtr doms = NULL;
+    virDomainDefPtr def = NULL;
+    virDomainObjPtr vm = NULL;
+    char **names = NULL;
+    char *xml = NULL;
+    int nnames = 0;
+    int count = 0;
+    int ret = -1;
+    int i;
+
+    if (VIR_ALLOC_N(names, NUM_DOMAINS) < 0)
+        goto cleanup;
+
+    for (i = 1; i <= NUM_DOMAINS; i++) {
+        if (testIndexWriteConfig(i, 1024 * i) < 0)
+            goto cleanup;
+    }
+    if (!(doms = testIndexLoad()))
+        goto cleanup;
+    virObjectUnref(doms);
+
+    /* Looked up by name */
+    if (testIndexBreakConfig(1) < 0 ||
+        !(doms = testIndexLoad()) ||
+        testIndexDeferred(doms) != NUM_DOMAINS)
+        goto cleanup;
+
+    if (testIndexLookup(doms, 1, 0) < 0 ||
+        virDomainObjListNumOfDomains(doms, false) != NUM_DOMAINS - 1 ||
+        (nnames = virDomainObjListGetInactiveNames(doms, names,
+                                                   NUM_DOMAINS)) < 0)
+        goto cleanup;
+    for (i = 0; i < nnames; i++) {
+        if (STREQ(names[i], "vm1")) {
+            fprintf(stderr, "broken domain still listed\n");
+            goto cleanup;
+        }
+    }
+    if (nnames != NUM_DOMAINS - 1)
+        goto cleanup;
+
+    /* Walked over, with the others loaded fine */
+    if (testIndexBreakConfig(2) < 0)
+        goto cleanup;
+    virObjectUnref(doms);
+    if (!(doms = testIndexLoad()))
+        goto cleanup;
+    if (virDomainObjListForEach(doms, testIndexCountDeferred, &count) == 0 ||
+        testIndexDeferred(doms) != 0 ||
+        virDomainObjListNumOfDomains(doms, false) != NUM_DOMAINS - 2 ||
+        testIndexLookup(doms, 3, 3072) < 0)
+        goto cleanup;
+
+    /* Defined again without looking it up first */
+    virObjectUnref(doms);
+    if (!(doms = testIndexLoad()) ||
+        virAsprintf(&xml, domxml, 1, 1, 4096) < 0 ||
+        !(def = virDomainDefParseString(xml, caps, xmlopt,
+                                        1 << VIR_DOMAIN_VIRT_TEST,
+                                        VIR_DOMAIN_XML_INACTIVE)) ||
+        !(vm = virDomainObjListAdd(doms, def, xmlopt, 0, NULL)))
+        goto cleanup;
+    def = NULL;
+    virObjectUnlock(vm);
+
+    if (testIndexLookup(doms, 1, 4096) < 0 ||
+        virDomainObjListNumOfDomains(doms, false) != NUM_DOMAINS)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    for (i = 0; i < nnames; i++)
+        VIR_FREE(names[i]);
+    VIR_FREE(names);
+    VIR_FREE(xml);
+    virDomainDefFree(def);
+    virObjectUnref(doms);
+    virResetLastError();
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    virCapsGuestPtr guest;
+    virCommandPtr cmd;
+
+    if (virAsprintf(&tmpdir, "%s/domainconfindexdata-XXXXXX",
+                    abs_builddir) < 0 ||
+        !mkdtemp(tmpdir) ||
+        virAsprintf(&configDir, "%s/qemu", tmpdir) < 0 ||
+        virAsprintf(&autostartDir, "%s/qemu/autostart", tmpdir) < 0 ||
+        virAsprintf(&indexFile, "%s/domains.index", tmpdir) < 0 ||
+        virFileMakePath(autostartDir) < 0) {
+        fprintf(stderr, "unable to create directories\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!(caps = virCapabilitiesNew(VIR_ARCH_I686, 0, 0)) ||
+        !(guest = virCapabilitiesAddGuest(caps, "hvm", VIR_ARCH_I686,
+                                          "/usr/bin/test-hv", NULL,
+                                          0, NULL)) ||
+        !virCapabilitiesAddGuestDomain(guest, "test", NULL, NULL, 0, NULL) ||
+        !(xmlopt = virDomainXMLOptionNew(NULL, NULL, NULL))) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (virtTestRun("Defer unchanged configs", 1,
+                    testIndexDefer, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Parse changed configs", 1,
+                    testIndexChanged, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Drop broken deferred configs", 1,
+                    testIndexBroken, NULL) < 0)
+        ret = -1;
+
+cleanup:
+    cmd = virCommandNewArgList("rm", "-rf", tmpdir, NULL);
+    ignore_value(virCommandRun(cmd, NULL));
+    virCommandFree(cmd);
+    VIR_FREE(tmpdir);
+    VIR_FREE(configDir);
+    VIR_FREE(autostartDir);
+    VIR_FREE(indexFile);
+    virObjectUnref(caps);
+    virObjectUnref(xmlopt);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -0,0 +1,286 @@
+/*
+ * domainlisttest.c: measure domain listing under concurrent changes
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+
+#include "testutils.h"
+#include "internal.h"
+#include "virthread.h"
+#include "virtime.h"
+#include "viralloc.h"
+#include "viratomic.h"
+#include "virstring.h"
+
+#define NUM_READERS 4
+#define NUM_DOMAINS 40
+#define WRITER_ROUNDS 100
+
+struct testListData {
+    virConnectPtr conn;
+    int *done;
+    unsigned long long ops;
+    bool failed;
+};
+
+static const char *domxml =
+    "<domain type='test'>"
+    "  <name>listbench</name>"
+    "  <memory>8192</memory>"
+    "  <os><type>hvm</type></os>"
+    "</domain>";
+
+
+/* Keep defining, starting, stopping and undefining a domain */
+static void
+testListWriter(void *opaque)
+{
+    struct testListData *data = opaque;
+    virDomainPtr dom;
+
+    while (data->ops < WRITER_ROUNDS) {
+        if (!(dom = virDomainDefineXML(data->conn, domxml)) ||
+            virDomainCreate(dom) < 0 ||
+            virDomainDestroy(dom) < 0 ||
+            virDomainUndefine(dom) < 0) {
+            if (dom)
+                virDomainFree(dom);
+            data->failed = true;
+            break;
+        }
+        virDomainFree(dom);
+        data->ops++;
+    }
+    virAtomicIntSet(data->done, 1);
+}
+
+
+/* Keep listing and counting domains, checking that the
+ * domain from the default config is always seen */
+static void
+testListReader(void *opaque)
+{
+    struct testListData *data = opaque;
+    virDomainPtr *doms;
+    int ndoms;
+    int i;
+    bool found;
+
+    while (!virAtomicIntGet(data->done)) {
+        if ((ndoms = virConnectListAllDomains(data->conn, &doms, 0)) < 0) {
+            data->failed = true;
+            return;
+        }
+
+        found = false;
+        for (i = 0; i < ndoms; i++) {
+            if (STREQ(virDomainGetName(doms[i]), "test"))
+                found = true;
+            virDomainFree(doms[i]);
+        }
+        VIR_FREE(doms);
+
+        if (!found ||
+            virConnectNumOfDomains(data->conn) < 1 ||
+            virConnectNumOfDefinedDomains(data->conn) < 0) {
+            data->failed = true;
+            return;
+        }
+        data->ops++;
+    }
+}
+
+
+static int
+testListContention(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virConnectPtr conn;
+    int done = 0;
+    struct testListData writer = { 0 };
+    struct testListData readers[NUM_READERS] = { { 0 } };
+    virThread writerThread;
+    virThread readerThreads[NUM_READERS];
+    unsigned long long start;
+    unsigned long long end;
+    unsigned long long reads = 0;
+    int ret = -1;
+    int i;
+
+    if (!(conn = virConnectOpen("test:///default")))
+        return -1;
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+
+    for (i = 0; i < NUM_READERS; i++) {
+        readers[i].conn = conn;
+        readers[i].done = &done;
+        if (virThreadCreate(&readerThreads[i], true,
+                            testListReader, &readers[i]) < 0) {
+            readers[i].failed = true;
+            break;
+        }
+    }
+
+    writer.conn = conn;
+    writer.done = &done;
+    testListWriter(&writer);
+
+    while (--i >= 0)
+        virThreadJoin(&readerThreads[i]);
+
+    if (writer.failed)
+        goto cleanup;
+    for (i = 0; i < NUM_READERS; i++) {
+        if (readers[i].failed)
+            goto cleanup;
+        reads += readers[i].ops;
+    }
+
+    if (virTestGetDebug() &&
+        virTimeMillisNow(&end) == 0 && end > start)
+        fprintf(stderr, "\n%d readers: %llu list rounds/s, "
+                "writer: %llu define/start/stop/undefine rounds/s\n",
+                NUM_READERS, reads * 1000 / (end - start),
+                writer.ops * 1000 / (end - start));
+
+    ret = 0;
+
+cleanup:
+    virConnectClose(conn);
+    return ret;
+}
+
+
+static bool
+testListHasName(char **names, int nnames, const char *name)
+{
+    int i;
+
+    for (i = 0; i < nnames; i++) {
+        if (STREQ(names[i], name))
+            return true;
+    }
+    return false;
+}
+
+
+/* Check counts and names while domains come, go, start and stop */
+static int
+testListMembership(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virConnectPtr conn;
+    virDomainPtr doms[NUM_DOMAINS] = { NULL };
+    char *names[NUM_DOMAINS + 1] = { NULL };
+    char name[32];
+    char *xml = NULL;
+    int nactive, ninactive, nnames;
+    int ret = -1;
+    int i;
+
+    if (!(conn = virConnectOpen("test:///default")))
+        return -1;
+
+    if ((nactive = virConnectNumOfDomains(conn)) < 0 ||
+        (ninactive = virConnectNumOfDefinedDomains(conn)) < 0)
+        goto cleanup;
+
+    for (i = 0; i < NUM_DOMAINS; i++) {
+        snprintf(name, sizeof(name), "list%d", i);
+        if (virAsprintf(&xml, "<domain type='test'><name>%s</name>"
+                        "<memory>8192</memory><os><type>hvm</type></os>"
+                        "</domain>", name) < 0)
+            goto cleanup;
+        doms[i] = virDomainDefineXML(conn, xml);
+        VIR_FREE(xml);
+        if (!doms[i])
+            goto cleanup;
+        /* start every other one */
+        if (i % 2 && virDomainCreate(doms[i]) < 0)
+            goto cleanup;
+    }
+
+    if (virConnectNumOfDomains(conn) != nactive + NUM_DOMAINS / 2 ||
+        virConnectNumOfDefinedDomains(conn) != ninactive + NUM_DOMAINS / 2)
+        goto cleanup;
+
+    /* undefine the inactive ones, leaving holes all over the list */
+    for (i = 0; i < NUM_DOMAINS; i += 2) {
+        if (virDomainUndefine(doms[i]) < 0)
+            goto cleanup;
+    }
+
+    if (virConnectNumOfDomains(conn) != nactive + NUM_DOMAINS / 2 ||
+        virConnectNumOfDefinedDomains(conn) != ninactive)
+        goto cleanup;
+
+    /* stop a few, which moves them to the inactive names */
+    for (i = 1; i < NUM_DOMAINS; i += 4) {
+        if (virDomainDestroy(doms[i]) < 0)
+            goto cleanup;
+    }
+
+    nnames = virConnectListDefinedDomains(conn, names, NUM_DOMAINS + 1);
+    if (nnames != ninactive + NUM_DOMAINS / 4)
+        goto cleanup;
+    for (i = 0; i < NUM_DOMAINS; i++) {
+        snprintf(name, sizeof(name), "list%d", i);
+        if (testListHasName(names, nnames, name) != (i % 4 == 1))
+            goto cleanup;
+    }
+
+    if (virConnectNumOfDomains(conn) !=
+        nactive + NUM_DOMAINS / 2 - NUM_DOMAINS / 4)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    for (i = 0; i < NUM_DOMAINS + 1; i++)
+        VIR_FREE(names[i]);
+    for (i = 0; i < NUM_DOMAINS; i++) {
+        if (doms[i])
+            virDomainFree(doms[i]);
+    }
+    virConnectClose(conn);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virThreadInitialize() < 0)
+        return EXIT_FAILURE;
+
+    if (virtTestRun("List domains while they change", 1,
+                    testListMembership, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("List domains under contention", 1,
+                    testListContention, NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
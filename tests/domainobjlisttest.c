@@ -0,0 +1,374 @@
+/*
+ * domainobjlisttest.c: test the lookup indexes of domain lists
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+
+#include "testutils.h"
+#include "internal.h"
+#include "domain_conf.h"
+#include "viralloc.h"
+#include "virstring.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define NUM_DOMAINS 10
+
+static virCapsPtr caps;
+static virDomainXMLOptionPtr xmlopt;
+
+static const char *domxml =
+    "<domain type='test'%s>\n"
+    "  <name>%s</name>\n"
+    "  <uuid>c7a5fdbd-edaf-9455-926a-d65c16db18%02d</uuid>\n"
+    "  <memory unit='KiB'>8192</memory>\n"
+    "  <os><type>hvm</type></os>\n"
+    "</domain>\n";
+
+
+/* Define domain 'i' as 'name', running with 'id' unless that is -1.
+ * Returns 0 if it was added or updated, 1 if it was refused */
+static int
+testObjListDefine(virDomainObjListPtr doms, int i, const char *name, int id)
+{
+    virDomainDefPtr def = NULL;
+    virDomainObjPtr vm;
+    char *idattr = NULL;
+    char *xml = NULL;
+    unsigned int flags = 0;
+    int ret = -1;
+
+    if (id != -1) {
+        if (virAsprintf(&idattr, " id='%d'", id) < 0)
+            goto cleanup;
+        flags = VIR_DOMAIN_OBJ_LIST_ADD_LIVE;
+    }
+
+    if (virAsprintf(&xml, domxml, idattr ? idattr : "", name, i) < 0 ||
+        !(def = virDomainDefParseString(xml, caps, xmlopt,
+                                        1 << VIR_DOMAIN_VIRT_TEST,
+                                        id == -1 ?
+                                        VIR_DOMAIN_XML_INACTIVE : 0)))
+        goto cleanup;
+
+    if (!(vm = virDomainObjListAdd(doms, def, xmlopt, flags, NULL))) {
+        virResetLastError();
+        ret = 1;
+        goto cleanup;
+    }
+    def = NULL;
+    virObjectUnlock(vm);
+    ret = 0;
+
+cleanup:
+    virDomainDefFree(def);
+    VIR_FREE(idattr);
+    VIR_FREE(xml);
+    return ret;
+}
+
+/* Define domains vm0 to vm<NUM_DOMAINS - 1>, none running */
+static virDomainObjListPtr
+testObjListNew(void)
+{
+    virDomainObjListPtr doms;
+    char name[16];
+    int i;
+
+    if (!(doms = virDomainObjListNew()))
+        return NULL;
+
+    for (i = 0; i < NUM_DOMAINS; i++) {
+        snprintf(name, sizeof(name), "vm%d", i);
+        if (testObjListDefine(doms, i, name, -1) != 0) {
+            virObjectUnref(doms);
+            return NULL;
+        }
+    }
+
+    return doms;
+}
+
+/* Check that a lookup found domain 'i' under 'name' with 'id',
+ * or nothing if 'i' is -1, and unlock what it found */
+static int
+testObjListCheck(const char *lookup, virDomainObjPtr vm,
+                 int i, const char *name, int id)
+{
+    char uuid[VIR_UUID_STRING_BUFLEN];
+    char expect[VIR_UUID_STRING_BUFLEN];
+    int ret = -1;
+
+    if (i == -1) {
+        if (vm) {
+            fprintf(stderr, "%s found %s\n", lookup, vm->def->name);
+            goto cleanup;
+        }
+        return 0;
+    }
+
+    if (!vm) {
+        fprintf(stderr, "%s found nothing\n", lookup);
+        goto cleanup;
+    }
+
+    virUUIDFormat(vm->def->uuid, uuid);
+    snprintf(expect, sizeof(expect),
+             "c7a5fdbd-edaf-9455-926a-d65c16db18%02d", i);
+    if (STRNEQ(uuid, expect) || STRNEQ(vm->def->name, name) ||
+        vm->def->id != id) {
+        fprintf(stderr, "%s found %s %s with id %d\n",
+                lookup, vm->def->name, uuid, vm->def->id);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    if (vm)
+        virObjectUnlock(vm);
+    return ret;
+}
+
+/* Look up 'name', which must be domain 'i' running with 'id',
+ * or not be found if 'i' is -1 */
+static int
+testObjListFindName(virDomainObjListPtr doms, const char *name,
+                    int i, int id)
+{
+    return testObjListCheck(name, virDomainObjListFindByName(doms, name),
+                            i, name, id);
+}
+
+/* Look up 'id', which must be domain 'i' named 'name',
+ * or not be found if 'i' is -1 */
+static int
+testObjListFindID(virDomainObjListPtr doms, int id,
+                  int i, const char *name)
+{
+    char lookup[32];
+
+    snprintf(lookup, sizeof(lookup), "id %d", id);
+    return testObjListCheck(lookup, virDomainObjListFindByID(doms, id),
+                            i, name, id);
+}
+
+/* Start or stop 'name', as drivers do */
+static int
+testObjListSetID(virDomainObjListPtr doms, const char *name, int id)
+{
+    virDomainObjPtr vm;
+
+    if (!(vm = virDomainObjListFindByName(doms, name)))
+        return -1;
+
+    virDomainObjListSetID(doms, vm, id);
+    virObjectUnlock(vm);
+    return 0;
+}
+
+static int
+testObjListRemove(virDomainObjListPtr doms, const char *name)
+{
+    virDomainObjPtr vm;
+
+    if (!(vm = virDomainObjListFindByName(doms, name)))
+        return -1;
+
+    virDomainObjListRemove(doms, vm);
+    return 0;
+}
+
+
+/* Domains are found by name as long as they are in the list */
+static int
+testObjListAddRemove(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virDomainObjListPtr doms;
+    int ret = -1;
+
+    if (!(doms = testObjListNew()))
+        return -1;
+
+    if (testObjListFindName(doms, "vm0", 0, -1) < 0 ||
+        testObjListFindName(doms, "vm4", 4, -1) < 0 ||
+        testObjListFindName(doms, "vm9", 9, -1) < 0 ||
+        testObjListFindName(doms, "vm10", -1, -1) < 0 ||
+        virDomainObjListNumOfDomains(doms, false) != NUM_DOMAINS)
+        goto cleanup;
+
+    if (testObjListRemove(doms, "vm0") < 0 ||
+        testObjListRemove(doms, "vm4") < 0 ||
+        testObjListRemove(doms, "vm9") < 0)
+        goto cleanup;
+
+    if (testObjListFindName(doms, "vm0", -1, -1) < 0 ||
+        testObjListFindName(doms, "vm4", -1, -1) < 0 ||
+        testObjListFindName(doms, "vm9", -1, -1) < 0 ||
+        testObjListFindName(doms, "vm1", 1, -1) < 0 ||
+        testObjListFindName(doms, "vm8", 8, -1) < 0 ||
+        virDomainObjListNumOfDomains(doms, false) != NUM_DOMAINS - 3)
+        goto cleanup;
+
+    /* The name of a removed domain is free for another one */
+    if (testObjListDefine(doms, 4, "vm4", -1) != 0 ||
+        testObjListDefine(doms, 12, "vm9", -1) != 0 ||
+        testObjListFindName(doms, "vm4", 4, -1) < 0 ||
+        testObjListFindName(doms, "vm9", 12, -1) < 0 ||
+        virDomainObjListNumOfDomains(doms, false) != NUM_DOMAINS - 1)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virObjectUnref(doms);
+    return ret;
+}
+
+
+/* Running domains are found by ID, and only by their current one */
+static int
+testObjListIDs(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virDomainObjListPtr doms;
+    int ret = -1;
+
+    if (!(doms = testObjListNew()))
+        return -1;
+
+    if (testObjListSetID(doms, "vm1", 1) < 0 ||
+        testObjListSetID(doms, "vm2", 2) < 0 ||
+        testObjListFindID(doms, 1, 1, "vm1") < 0 ||
+        testObjListFindID(doms, 2, 2, "vm2") < 0 ||
+        testObjListFindName(doms, "vm1", 1, 1) < 0 ||
+        virDomainObjListNumOfDomains(doms, true) != 2)
+        goto cleanup;
+
+    /* Restarted under a new ID */
+    if (testObjListSetID(doms, "vm1", -1) < 0 ||
+        testObjListFindID(doms, 1, -1, NULL) < 0 ||
+        testObjListSetID(doms, "vm1", 11) < 0 ||
+        testObjListFindID(doms, 1, -1, NULL) < 0 ||
+        testObjListFindID(doms, 11, 1, "vm1") < 0)
+        goto cleanup;
+
+    /* An ID goes to another domain once its owner stopped */
+    if (testObjListSetID(doms, "vm2", -1) < 0 ||
+        testObjListFindID(doms, 2, -1, NULL) < 0 ||
+        testObjListSetID(doms, "vm3", 2) < 0 ||
+        testObjListFindID(doms, 2, 3, "vm3") < 0 ||
+        testObjListFindName(doms, "vm2", 2, -1) < 0)
+        goto cleanup;
+
+    /* Removed while running */
+    if (testObjListRemove(doms, "vm3") < 0 ||
+        testObjListFindID(doms, 2, -1, NULL) < 0 ||
+        testObjListFindName(doms, "vm3", -1, -1) < 0)
+        goto cleanup;
+
+    /* Given an ID by a live definition */
+    if (testObjListDefine(doms, 4, "vm4", 7) != 0 ||
+        testObjListFindID(doms, 7, 4, "vm4") < 0 ||
+        testObjListFindName(doms, "vm4", 4, 7) < 0 ||
+        virDomainObjListNumOfDomains(doms, true) != 2 ||
+        virDomainObjListNumOfDomains(doms, false) != NUM_DOMAINS - 3)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virObjectUnref(doms);
+    return ret;
+}
+
+
+/* Domains can't be renamed by defining them again, nor take the
+ * name of another one, and neither attempt disturbs the indexes */
+static int
+testObjListRename(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virDomainObjListPtr doms;
+    int ret = -1;
+
+    if (!(doms = testObjListNew()))
+        return -1;
+
+    if (testObjListDefine(doms, 5, "renamed", -1) != 1 ||
+        testObjListFindName(doms, "renamed", -1, -1) < 0 ||
+        testObjListFindName(doms, "vm5", 5, -1) < 0)
+        goto cleanup;
+
+    if (testObjListDefine(doms, 6, "vm5", -1) != 1 ||
+        testObjListDefine(doms, 20, "vm5", -1) != 1 ||
+        testObjListFindName(doms, "vm5", 5, -1) < 0 ||
+        testObjListFindName(doms, "vm6", 6, -1) < 0)
+        goto cleanup;
+
+    if (testObjListSetID(doms, "vm5", 5) < 0 ||
+        testObjListDefine(doms, 5, "renamed", 5) != 1 ||
+        testObjListFindName(doms, "renamed", -1, -1) < 0 ||
+        testObjListFindID(doms, 5, 5, "vm5") < 0 ||
+        virDomainObjListNumOfDomains(doms, true) != 1 ||
+        virDomainObjListNumOfDomains(doms, false) != NUM_DOMAINS - 1)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virObjectUnref(doms);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    virCapsGuestPtr guest;
+
+    if (!(caps = virCapabilitiesNew(VIR_ARCH_I686, 0, 0)) ||
+        !(guest = virCapabilitiesAddGuest(caps, "hvm", VIR_ARCH_I686,
+                                          "/usr/bin/test-hv", NULL,
+                                          0, NULL)) ||
+        !virCapabilitiesAddGuestDomain(guest, "test", NULL, NULL, 0, NULL) ||
+        !(xmlopt = virDomainXMLOptionNew(NULL, NULL, NULL))) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (virtTestRun("Add and remove domains", 1,
+                    testObjListAddRemove, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Find running domains by ID", 1,
+                    testObjListIDs, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Refuse renaming domains", 1,
+                    testObjListRename, NULL) < 0)
+        ret = -1;
+
+cleanup:
+    virObjectUnref(caps);
+    virObjectUnref(xmlopt);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
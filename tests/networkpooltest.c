@@ -0,0 +1,339 @@
+/*
+ * networkpooltest.c: test and measure forward device pool allocation
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+
+#include "testutils.h"
+#include "internal.h"
+#include "network_conf.h"
+#include "virbuffer.h"
+#include "virthread.h"
+#include "virtime.h"
+#include "viralloc.h"
+
+#define POOL_SIZE 256
+#define NUM_STARTERS 4
+#define RUN_TIME_MS 1000
+
+static virNetworkDefPtr
+testPoolDefine(bool hostdev)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virNetworkDefPtr def = NULL;
+    char *xml = NULL;
+    int i;
+
+    virBufferAsprintf(&buf, "<network><name>pool</name><forward mode='%s'>",
+                      hostdev ? "hostdev" : "bridge");
+    for (i = 0; i < POOL_SIZE; i++) {
+        if (hostdev)
+            virBufferAsprintf(&buf, "<address type='pci' domain='0x0000' "
+                              "bus='0x%02x' slot='0x%02x' function='0x%x'/>",
+                              i / 128 + 1, i / 8 % 16, i % 8);
+        else
+            virBufferAsprintf(&buf, "<interface dev='eth%d'/>", i);
+    }
+    virBufferAddLit(&buf, "</forward></network>");
+
+    if (virBufferError(&buf)) {
+        virBufferFreeAndReset(&buf);
+        return NULL;
+    }
+    xml = virBufferContentAndReset(&buf);
+    def = virNetworkDefParseString(xml);
+    VIR_FREE(xml);
+    return def;
+}
+
+
+/* What the allocator used to do: walk the whole pool */
+static virNetworkForwardIfDefPtr
+testPoolLinearLeastUsed(virNetworkDefPtr def)
+{
+    virNetworkForwardIfDefPtr dev = &def->forward.ifs[0];
+    size_t i;
+
+    for (i = 1; i < def->forward.nifs; i++) {
+        if (def->forward.ifs[i].connections < dev->connections)
+            dev = &def->forward.ifs[i];
+    }
+    return dev;
+}
+
+
+/* Exclusive use hands out the devices in pool order, and a
+ * released device is the next one handed out */
+static int
+testPoolExclusive(const void *opaque)
+{
+    bool hostdev = *(const bool *)opaque;
+    virNetworkDefPtr def;
+    virNetworkForwardIfDefPtr dev;
+    virNetworkForwardIfDefPtr found;
+    int ret = -1;
+    int i;
+
+    if (!(def = testPoolDefine(hostdev)))
+        return -1;
+
+    for (i = 0; i < POOL_SIZE; i++) {
+        if (virNetworkForwardIfLeastUsed(def, true, &dev) < 0 ||
+            dev != &def->forward.ifs[i])
+            goto cleanup;
+        virNetworkForwardIfAddConnections(def, dev, 1);
+    }
+
+    if (virNetworkForwardIfLeastUsed(def, true, &dev) < 0 || dev)
+        goto cleanup;
+
+    for (i = POOL_SIZE - 1; i >= 0; i -= 3) {
+        dev = &def->forward.ifs[i];
+        if (hostdev) {
+            if (virNetworkForwardIfFindByPCI(def, &dev->device.pci,
+                                             &found) < 0)
+                goto cleanup;
+        } else {
+            if (virNetworkForwardIfFindByDev(def, dev->device.dev,
+                                             &found) < 0)
+                goto cleanup;
+        }
+        if (found != dev)
+            goto cleanup;
+
+        virNetworkForwardIfAddConnections(def, dev, -1);
+        if (virNetworkForwardIfLeastUsed(def, true, &found) < 0 ||
+            found != dev)
+            goto cleanup;
+        virNetworkForwardIfAddConnections(def, dev, 1);
+    }
+
+    if (hostdev) {
+        if (virNetworkForwardIfFindByDev(def, "eth0", &found) < 0 || found)
+            goto cleanup;
+    } else {
+        if (virNetworkForwardIfFindByDev(def, "eth999", &found) < 0 || found)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virNetworkDefFree(def);
+    return ret;
+}
+
+
+/* Shared use always agrees with a scan of the whole pool */
+static int
+testPoolShared(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virNetworkDefPtr def;
+    virNetworkForwardIfDefPtr dev;
+    unsigned int seed = 1;
+    int ret = -1;
+    int i;
+
+    if (!(def = testPoolDefine(false)))
+        return -1;
+
+    for (i = 0; i < POOL_SIZE * 16; i++) {
+        if (virNetworkForwardIfLeastUsed(def, false, &dev) < 0 ||
+            dev != testPoolLinearLeastUsed(def))
+            goto cleanup;
+        virNetworkForwardIfAddConnections(def, dev, 1);
+
+        /* release a random busy device now and then */
+        dev = &def->forward.ifs[rand_r(&seed) % POOL_SIZE];
+        if (i % 3 == 0 && dev->connections > 0)
+            virNetworkForwardIfAddConnections(def, dev, -1);
+    }
+
+    ret = 0;
+
+cleanup:
+    virNetworkDefFree(def);
+    return ret;
+}
+
+
+struct testPoolData {
+    virMutexPtr lock;
+    virNetworkDefPtr def;
+    bool linear;
+    unsigned long long deadline;
+    unsigned long long ops;
+    bool failed;
+};
+
+/* Keep allocating a device for a guest and releasing it, with the
+ * pool locked the way the network object lock protects it */
+static void
+testPoolStarter(void *opaque)
+{
+    struct testPoolData *data = opaque;
+    virNetworkForwardIfDefPtr dev;
+    unsigned long long now;
+    char *name;
+
+    while (virTimeMillisNow(&now) == 0 && now < data->deadline) {
+        virMutexLock(data->lock);
+        if (data->linear) {
+            dev = testPoolLinearLeastUsed(data->def);
+            dev->connections++;
+        } else if (virNetworkForwardIfLeastUsed(data->def, false, &dev) < 0) {
+            virMutexUnlock(data->lock);
+            data->failed = true;
+            return;
+        } else {
+            virNetworkForwardIfAddConnections(data->def, dev, 1);
+        }
+        name = dev->device.dev;
+        virMutexUnlock(data->lock);
+
+        virMutexLock(data->lock);
+        if (data->linear) {
+            size_t i;
+            for (i = 0; i < data->def->forward.nifs; i++) {
+                if (STREQ(name, data->def->forward.ifs[i].device.dev)) {
+                    data->def->forward.ifs[i].connections--;
+                    break;
+                }
+            }
+        } else if (virNetworkForwardIfFindByDev(data->def, name, &dev) < 0 ||
+                   !dev) {
+            virMutexUnlock(data->lock);
+            data->failed = true;
+            return;
+        } else {
+            virNetworkForwardIfAddConnections(data->def, dev, -1);
+        }
+        virMutexUnlock(data->lock);
+
+        data->ops++;
+    }
+}
+
+static int
+testPoolRun(bool linear, unsigned long long *rate)
+{
+    virMutex lock;
+    virNetworkDefPtr def;
+    struct testPoolData starters[NUM_STARTERS];
+    virThread threads[NUM_STARTERS];
+    unsigned long long now;
+    int ret = -1;
+    int i;
+
+    if (virMutexInit(&lock) < 0)
+        return -1;
+    if (!(def = testPoolDefine(false)))
+        goto cleanup;
+    if (virTimeMillisNow(&now) < 0)
+        goto cleanup;
+
+    /* a few guests already hold devices */
+    for (i = 0; i < POOL_SIZE; i += 2)
+        virNetworkForwardIfAddConnections(def, &def->forward.ifs[i], 1);
+
+    memset(starters, 0, sizeof(starters));
+    for (i = 0; i < NUM_STARTERS; i++) {
+        starters[i].lock = &lock;
+        starters[i].def = def;
+        starters[i].linear = linear;
+        starters[i].deadline = now + RUN_TIME_MS;
+        if (virThreadCreate(&threads[i], true,
+                            testPoolStarter, &starters[i]) < 0) {
+            starters[i].failed = true;
+            break;
+        }
+    }
+    while (--i >= 0)
+        virThreadJoin(&threads[i]);
+
+    *rate = 0;
+    for (i = 0; i < NUM_STARTERS; i++) {
+        if (starters[i].failed)
+            goto cleanup;
+        *rate += starters[i].ops * 1000 / RUN_TIME_MS;
+    }
+
+    /* every allocation was released again */
+    for (i = 0; i < POOL_SIZE; i++) {
+        if (def->forward.ifs[i].connections != !(i % 2))
+            goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virNetworkDefFree(def);
+    virMutexDestroy(&lock);
+    return ret;
+}
+
+static int
+testPoolContention(const void *opaque ATTRIBUTE_UNUSED)
+{
+    unsigned long long indexed;
+    unsigned long long linear;
+
+    if (testPoolRun(false, &indexed) < 0 ||
+        testPoolRun(true, &linear) < 0)
+        return -1;
+
+    fprintf(stderr, "\n%d starters, %d devices: %llu allocations/s, "
+            "%llu with a linear scan\n",
+            NUM_STARTERS, POOL_SIZE, indexed, linear);
+    return 0;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    bool hostdev;
+
+    if (virThreadInitialize() < 0)
+        return EXIT_FAILURE;
+
+    hostdev = false;
+    if (virtTestRun("Exclusive interface pool", 1,
+                    testPoolExclusive, &hostdev) < 0)
+        ret = -1;
+    hostdev = true;
+    if (virtTestRun("Exclusive PCI device pool", 1,
+                    testPoolExclusive, &hostdev) < 0)
+        ret = -1;
+    if (virtTestRun("Shared interface pool", 1,
+                    testPoolShared, NULL) < 0)
+        ret = -1;
+    /* Only a measurement, and it takes a few seconds */
+    if (virTestGetDebug() &&
+        virtTestRun("Allocate from pool under contention", 1,
+                    testPoolContention, NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
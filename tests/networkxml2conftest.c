@@ -47,6 +47,10 @@ testCompareXMLToConfFiles(const char *inxml, const char *outconf, dnsmasqCapsPtr
     if (dctx == NULL)
         goto fail;
 
+    if (dnsmasqCapsGet(caps, DNSMASQ_CAPS_HOSTSDIR) &&
+        dnsmasqContextUseHostsDirs(dctx) < 0)
+        goto fail;
+
     if (networkDnsmasqConfContents(obj, pidfile, &actual,
                         dctx, caps) < 0)
         goto fail;
@@ -118,6 +122,10 @@ mymain(void)
         = dnsmasqCapsNewFromBuffer("Dnsmasq version 2.63\n--bind-dynamic", DNSMASQ);
     dnsmasqCapsPtr dhcpv6
         = dnsmasqCapsNewFromBuffer("Dnsmasq version 2.64\n--bind-dynamic", DNSMASQ);
+    dnsmasqCapsPtr hostsdir
+        = dnsmasqCapsNewFromBuffer("Dnsmasq version 2.73\n--bind-dynamic\n"
+                                   "    --dhcp-hostsdir=<path>\n"
+                                   "    --hostsdir=<path>", DNSMASQ);
 
     networkDnsmasqLeaseFileName = testDnsmasqLeaseFileName;
 
@@ -145,6 +153,7 @@ mymain(void)
     DO_TEST("dhcp6-network", dhcpv6);
     DO_TEST("dhcp6-nat-network", dhcpv6);
     DO_TEST("dhcp6host-routed-network", dhcpv6);
+    DO_TEST("nat-network-hostsdir", hostsdir);
 
     return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -8,7 +8,9 @@
 #include "testutils.h"
 #include "internal.h"
 #include "nodeinfo.h"
+#include "virbuffer.h"
 #include "virfile.h"
+#include "virnuma.h"
 #include "virstring.h"
 
 #if ! (defined __linux__  &&  (defined(__x86_64__) || \
@@ -28,6 +30,17 @@ main(void)
 extern int linuxNodeInfoCPUPopulate(FILE *cpuinfo,
                                     char *sysfs_dir,
                                     virNodeInfoPtr nodeinfo);
+extern int linuxNodeGetNumaPlacementNodes(const char *sysfs_dir,
+                                          virNumaPlacementNodePtr *nodes,
+                                          size_t *nnodes);
+extern int linuxNodeStatsSamplerInit(size_t ncpus,
+                                     size_t ncells,
+                                     unsigned int interval,
+                                     unsigned int window);
+extern int linuxNodeStatsSamplerCollect(const char *procstat,
+                                        const char *meminfo,
+                                        const char *sysfs_dir,
+                                        unsigned long long when);
 
 static int
 linuxTestCompareFiles(const char *cpuinfofile,
@@ -117,6 +130,294 @@ cleanup:
 }
 
 
+struct testPlacementGuest {
+    unsigned short vcpus;
+    unsigned long long memory; /* KiB */
+};
+
+struct testPlacementData {
+    const char *topology;
+    const struct testPlacementGuest *guests;
+};
+
+
+static int
+testPlaceGuest(virNumaPlacementPtr placement,
+               virNumaPlacementNodePtr nodes,
+               size_t nnodes,
+               const struct testPlacementGuest *guest,
+               virBitmapPtr *nodeset,
+               virBufferPtr buf)
+{
+    virBitmapPtr cpuset = NULL;
+    char *nodestr = NULL;
+    char *cpustr = NULL;
+    int ret = -1;
+
+    if (virNumaPlacementChoose(placement, nodes, nnodes,
+                               guest->vcpus, guest->memory,
+                               nodeset, &cpuset) < 0)
+        goto cleanup;
+
+    if (!(nodestr = virBitmapFormat(*nodeset)) ||
+        !(cpustr = virBitmapFormat(cpuset)))
+        goto cleanup;
+
+    virBufferAsprintf(buf, "vcpus=%u memory=%llu: nodes=%s cpus=%s\n",
+                      guest->vcpus, guest->memory, nodestr, cpustr);
+    ret = 0;
+
+cleanup:
+    virBitmapFree(cpuset);
+    VIR_FREE(nodestr);
+    VIR_FREE(cpustr);
+    return ret;
+}
+
+
+static int
+linuxTestNumaPlacement(const void *opaque)
+{
+    const struct testPlacementData *data = opaque;
+    virNumaPlacementPtr placement = NULL;
+    virNumaPlacementNodePtr nodes = NULL;
+    virBitmapPtr *nodesets = NULL;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    size_t nnodes = 0;
+    size_t nguests = 0;
+    char *sysfs_dir = NULL;
+    char *output = NULL;
+    char *expectData = NULL;
+    char *actualData = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (virAsprintf(&sysfs_dir, "%s/nodeinfodata/linux-%s",
+                    abs_srcdir, data->topology) < 0 ||
+        virAsprintf(&output, "%s/nodeinfodata/linux-%s.expected",
+                    abs_srcdir, data->topology) < 0)
+        goto cleanup;
+
+    if (virtTestLoadFile(output, &expectData) < 0)
+        goto cleanup;
+
+    if (linuxNodeGetNumaPlacementNodes(sysfs_dir, &nodes, &nnodes) < 0 ||
+        !(placement = virNumaPlacementNew()))
+        goto cleanup;
+
+    for (i = 0; i < nnodes; i++)
+        virBufferAsprintf(&buf, "node%u: cpus=%zu total=%llu free=%llu\n",
+                          nodes[i].id, virBitmapCountBits(nodes[i].cpus),
+                          nodes[i].memTotal, nodes[i].memFree);
+
+    while (data->guests[nguests].vcpus)
+        nguests++;
+
+    if (VIR_ALLOC_N(nodesets, nguests) < 0)
+        goto cleanup;
+
+    /* Every guest is placed with the load of the earlier ones */
+    for (i = 0; i < nguests; i++) {
+        if (testPlaceGuest(placement, nodes, nnodes, &data->guests[i],
+                           &nodesets[i], &buf) < 0)
+            goto cleanup;
+    }
+
+    /* Once all of them are gone, the host is empty again and the
+     * first guest must land where it did at the start */
+    for (i = 0; i < nguests; i++) {
+        virNumaPlacementRelease(placement, nodesets[i],
+                                data->guests[i].vcpus,
+                                data->guests[i].memory);
+        virBitmapFree(nodesets[i]);
+        nodesets[i] = NULL;
+    }
+
+    if (testPlaceGuest(placement, nodes, nnodes, &data->guests[0],
+                       &nodesets[0], &buf) < 0)
+        goto cleanup;
+
+    if (virBufferError(&buf))
+        goto cleanup;
+    actualData = virBufferContentAndReset(&buf);
+
+    if (STRNEQ(actualData, expectData)) {
+        virtTestDifference(stderr, expectData, actualData);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    if (ret < 0 && virTestGetDebug()) {
+        virErrorPtr error = virSaveLastError();
+        if (error && error->code != VIR_ERR_OK)
+            fprintf(stderr, "\n%s\n", error->message);
+        virFreeError(error);
+    }
+    for (i = 0; i < nguests; i++)
+        virBitmapFree(nodesets[i]);
+    VIR_FREE(nodesets);
+    virBufferFreeAndReset(&buf);
+    virNumaPlacementNodesFree(nodes, nnodes);
+    virObjectUnref(placement);
+    VIR_FREE(sysfs_dir);
+    VIR_FREE(output);
+    VIR_FREE(expectData);
+    VIR_FREE(actualData);
+    return ret;
+}
+
+
+/* Take sample @n of the stats fixture, @n seconds into the test */
+static int
+linuxTestStatsCollect(const char *dir,
+                      int n)
+{
+    char *procstat = NULL;
+    char *meminfo = NULL;
+    int ret = -1;
+
+    if (virAsprintf(&procstat, "%s/stat%d", dir, n) < 0 ||
+        virAsprintf(&meminfo, "%s/meminfo", dir) < 0)
+        goto cleanup;
+
+    ret = linuxNodeStatsSamplerCollect(procstat, meminfo, dir, n * 1000ull);
+
+cleanup:
+    VIR_FREE(procstat);
+    VIR_FREE(meminfo);
+    return ret;
+}
+
+static int
+linuxTestStatsUtilization(int cpuNum,
+                          unsigned int seconds,
+                          int expected)
+{
+    unsigned long long utilization;
+
+    if (nodeGetCPUUtilization(cpuNum, seconds, &utilization) < 0) {
+        virResetLastError();
+        if (expected < 0)
+            return 0;
+        fprintf(stderr, "\nno utilization for CPU %d over %us\n",
+                cpuNum, seconds);
+        return -1;
+    }
+
+    if (utilization != expected) {
+        fprintf(stderr, "\nCPU %d over %us: expected %d%%, got %llu%%\n",
+                cpuNum, seconds, expected, utilization);
+        return -1;
+    }
+    return 0;
+}
+
+/* Two CPUs and NUMA nodes 0 and 2 but no node 1, sampled once a
+ * second; the second CPU goes offline before the third sample */
+static int
+linuxTestStatsSampler(const void *opaque ATTRIBUTE_UNUSED)
+{
+    unsigned long long tick = 1000ull * 1000ull * 1000ull /
+                              sysconf(_SC_CLK_TCK);
+    virNodeCPUStats cpu[4];
+    virNodeMemoryStats mem[4];
+    virNodeMemoryStats cell[2];
+    int ncpu = ARRAY_CARDINALITY(cpu);
+    int nmem = ARRAY_CARDINALITY(mem);
+    int ncell = ARRAY_CARDINALITY(cell);
+    char *dir = NULL;
+    int ret = -1;
+
+    if (virAsprintf(&dir, "%s/nodeinfodata/linux-stats1", abs_srcdir) < 0)
+        return -1;
+
+    if (linuxNodeStatsSamplerInit(2, 3, 1, 5) < 0 ||
+        linuxTestStatsCollect(dir, 1) < 0)
+        goto cleanup;
+
+    if (nodeGetCPUStats(NULL, VIR_NODE_CPU_STATS_ALL_CPUS,
+                        cpu, &ncpu, 0) < 0 ||
+        nodeGetMemoryStats(NULL, VIR_NODE_MEMORY_STATS_ALL_CELLS,
+                           mem, &nmem, 0) < 0 ||
+        nodeGetMemoryStats(NULL, 2, cell, &ncell, 0) < 0)
+        goto cleanup;
+
+    if (STRNEQ(cpu[0].field, VIR_NODE_CPU_STATS_KERNEL) ||
+        cpu[0].value != 100 * tick ||
+        STRNEQ(cpu[1].field, VIR_NODE_CPU_STATS_USER) ||
+        cpu[1].value != 120 * tick ||
+        STRNEQ(cpu[2].field, VIR_NODE_CPU_STATS_IDLE) ||
+        cpu[2].value != 700 * tick ||
+        STRNEQ(cpu[3].field, VIR_NODE_CPU_STATS_IOWAIT) ||
+        cpu[3].value != 40 * tick) {
+        fprintf(stderr, "\nCPU stats not taken from the sample\n");
+        goto cleanup;
+    }
+
+    if (STRNEQ(mem[0].field, VIR_NODE_MEMORY_STATS_TOTAL) ||
+        mem[0].value != 16777216 ||
+        STRNEQ(mem[1].field, VIR_NODE_MEMORY_STATS_FREE) ||
+        mem[1].value != 10485760 ||
+        STRNEQ(mem[2].field, VIR_NODE_MEMORY_STATS_BUFFERS) ||
+        mem[2].value != 524288 ||
+        STRNEQ(mem[3].field, VIR_NODE_MEMORY_STATS_CACHED) ||
+        mem[3].value != 2097152 ||
+        STRNEQ(cell[0].field, VIR_NODE_MEMORY_STATS_TOTAL) ||
+        cell[0].value != 8388608 ||
+        STRNEQ(cell[1].field, VIR_NODE_MEMORY_STATS_FREE) ||
+        cell[1].value != 4194304) {
+        fprintf(stderr, "\nmemory stats not taken from the sample\n");
+        goto cleanup;
+    }
+
+    /* A rate needs two samples */
+    if (linuxTestStatsUtilization(VIR_NODE_CPU_STATS_ALL_CPUS, 0, -1) < 0 ||
+        linuxTestStatsCollect(dir, 2) < 0 ||
+        linuxTestStatsUtilization(VIR_NODE_CPU_STATS_ALL_CPUS, 0, 50) < 0 ||
+        linuxTestStatsUtilization(0, 0, 75) < 0 ||
+        linuxTestStatsUtilization(1, 0, 25) < 0)
+        goto cleanup;
+
+    /* Only the last second was idle, and the second CPU is gone */
+    if (linuxTestStatsCollect(dir, 3) < 0 ||
+        linuxTestStatsUtilization(VIR_NODE_CPU_STATS_ALL_CPUS, 1, 0) < 0 ||
+        linuxTestStatsUtilization(VIR_NODE_CPU_STATS_ALL_CPUS, 2, 25) < 0 ||
+        linuxTestStatsUtilization(VIR_NODE_CPU_STATS_ALL_CPUS, 0, 25) < 0 ||
+        linuxTestStatsUtilization(0, 0, 25) < 0 ||
+        linuxTestStatsUtilization(1, 0, -1) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    nodeStatsSamplerStop();
+    VIR_FREE(dir);
+    return ret;
+}
+
+
+/* Two nodes with 4 CPUs and 8GiB each */
+static const struct testPlacementGuest placement1[] = {
+    { 2, 2097152 },
+    { 2, 2097152 },
+    { 4, 4194304 },
+    { 8, 4194304 },
+    { 2, 12582912 },
+    { 0, 0 },
+};
+
+/* Three nodes of different sizes and a memory only node */
+static const struct testPlacementGuest placement2[] = {
+    { 4, 8388608 },
+    { 8, 8388608 },
+    { 2, 25165824 },
+    { 1, 1048576 },
+    { 0, 0 },
+};
+
+
 static int
 mymain(void)
 {
@@ -143,6 +444,21 @@ mymain(void)
       if (virtTestRun(nodeData[i], 1, linuxTestNodeInfo, nodeData[i]) != 0)
         ret = -1;
 
+#define DO_TEST_PLACEMENT(topo, guests)                                 \
+    do {                                                                \
+        struct testPlacementData data = { topo, guests };               \
+        if (virtTestRun("NUMA placement " topo, 1,                      \
+                        linuxTestNumaPlacement, &data) < 0)             \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST_PLACEMENT("placement1", placement1);
+    DO_TEST_PLACEMENT("placement2", placement2);
+
+    if (virtTestRun("Host stats sampler", 1,
+                    linuxTestStatsSampler, NULL) < 0)
+        ret = -1;
+
     return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
@@ -493,6 +493,67 @@ cleanup:
 }
 
 
+static int
+testQemuMonitorJSONGetIOThreads(const void *data)
+{
+    const virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNew(true, xmlopt);
+    int ret = -1;
+    int *pids = NULL;
+    int npids = 0;
+
+    if (!test)
+        return -1;
+
+    if (qemuMonitorTestAddItem(test, "query-iothreads",
+                               "{ "
+                               "  \"return\": [ "
+                               "    { "
+                               "      \"id\": \"iothread2\", "
+                               "      \"thread-id\": 30993 "
+                               "    }, "
+                               "    { "
+                               "      \"id\": \"iothread1\", "
+                               "      \"thread-id\": 30992 "
+                               "    } "
+                               "  ]"
+                               "}") < 0)
+        goto cleanup;
+
+    if ((npids = qemuMonitorGetIOThreads(qemuMonitorTestGetMonitor(test),
+                                         &pids)) < 0)
+        goto cleanup;
+
+    if (npids != 2) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "npids %d is not 2", npids);
+        goto cleanup;
+    }
+
+#define CHECK(i, wantpid)                                               \
+    do {                                                                \
+        if (pids[i] != (wantpid)) {                                     \
+            virReportError(VIR_ERR_INTERNAL_ERROR,                      \
+                           "iothread %d pid %d is not %d",              \
+                           i + 1, pids[i], (wantpid));                  \
+            goto cleanup;                                               \
+        }                                                               \
+    } while (0)
+
+    CHECK(0, 30992);
+    CHECK(1, 30993);
+
+#undef CHECK
+
+    ret = 0;
+
+cleanup:
+    qemuMonitorTestFree(test);
+    VIR_FREE(pids);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -520,6 +581,7 @@ mymain(void)
     DO_TEST(GetCPUDefinitions);
     DO_TEST(GetCommands);
     DO_TEST(GetTPMModels);
+    DO_TEST(GetIOThreads);
 
     virObjectUnref(xmlopt);
 
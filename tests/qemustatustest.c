@@ -0,0 +1,332 @@
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "testutils.h"
+
+#ifdef WITH_QEMU
+
+# include "internal.h"
+# include "testutilsqemu.h"
+# include "qemu/qemu_domain.h"
+# include "viralloc.h"
+# include "virfile.h"
+# include "virstring.h"
+# include "viratomic.h"
+
+# define VIR_FROM_THIS VIR_FROM_NONE
+
+static virQEMUDriver driver;
+static unsigned long long mainThread;
+static int flushed;
+static int flushedInMain;
+
+# define STATEDIRTEMPLATE abs_builddir "/qemustatedir-XXXXXX"
+
+static virDomainObjPtr
+testStatusAddDomain(const char *name, int id)
+{
+    virDomainDefPtr def = NULL;
+    virDomainObjPtr vm = NULL;
+    char *xml = NULL;
+
+    if (virAsprintf(&xml,
+                    "<domain type='qemu'>"
+                    "  <name>%s</name>"
+                    "  <memory unit='KiB'>219136</memory>"
+                    "  <os><type arch='i686' machine='pc'>hvm</type></os>"
+                    "  <devices><emulator>/usr/bin/qemu</emulator></devices>"
+                    "</domain>", name) < 0)
+        goto cleanup;
+
+    if (!(def = virDomainDefParseString(xml, driver.caps, driver.xmlopt,
+                                        QEMU_EXPECTED_VIRT_TYPES,
+                                        VIR_DOMAIN_XML_INACTIVE)))
+        goto cleanup;
+
+    if (!(vm = virDomainObjListAdd(driver.domains, def, driver.xmlopt,
+                                   0, NULL)))
+        goto cleanup;
+    def = NULL;
+
+    virDomainObjListSetID(driver.domains, vm, id);
+    virDomainObjSetState(vm, VIR_DOMAIN_RUNNING, VIR_DOMAIN_RUNNING_BOOTED);
+    virObjectUnlock(vm);
+
+cleanup:
+    virDomainDefFree(def);
+    VIR_FREE(xml);
+    return vm;
+}
+
+static bool
+testStatusExists(virDomainObjPtr vm)
+{
+    char *file;
+    bool ret;
+
+    if (!(file = virDomainConfigFile(driver.config->stateDir,
+                                     vm->def->name)))
+        return false;
+    ret = virFileExists(file);
+    VIR_FREE(file);
+    return ret;
+}
+
+static void
+testStatusRemove(virDomainObjPtr vm)
+{
+    char *file;
+
+    if (!(file = virDomainConfigFile(driver.config->stateDir,
+                                     vm->def->name)))
+        return;
+    unlink(file);
+    VIR_FREE(file);
+}
+
+static bool
+testStatusDirty(virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+
+    return priv->statusDirty;
+}
+
+struct testStatusData {
+    virDomainObjPtr vm1;
+    virDomainObjPtr vm2;
+};
+
+
+/* Notes where the timer-triggered writes happened */
+static void
+testStatusFlushJob(void *jobdata,
+                   void *opaque)
+{
+    if (virThreadSelfID() == mainThread)
+        virAtomicIntSet(&flushedInMain, 1);
+    qemuDomainFlushStatusJob(jobdata, opaque);
+    virAtomicIntSet(&flushed, 1);
+}
+
+
+/* Keeps the event loop from sleeping for good once the flush
+ * timer is disarmed, while the worker is still busy */
+static void
+testStatusTick(int timer ATTRIBUTE_UNUSED,
+               void *opaque ATTRIBUTE_UNUSED)
+{
+}
+
+
+/* A burst of deferred writes to several domains arms the timer once,
+ * writes nothing until it fires, and then has a worker thread write
+ * every domain once */
+static int
+testStatusCoalesce(const void *opaque)
+{
+    const struct testStatusData *data = opaque;
+    int tick;
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        virObjectLock(data->vm1);
+        qemuDomainSaveStatusLater(&driver, data->vm1);
+        virObjectUnlock(data->vm1);
+    }
+    virObjectLock(data->vm2);
+    qemuDomainSaveStatusLater(&driver, data->vm2);
+    virObjectUnlock(data->vm2);
+
+    if (!driver.statusPending ||
+        !testStatusDirty(data->vm1) || !testStatusDirty(data->vm2) ||
+        testStatusExists(data->vm1) || testStatusExists(data->vm2)) {
+        fprintf(stderr, "status written before the timer fired\n");
+        return -1;
+    }
+
+    /* The flush delay is well below a second, leave it a few */
+    virAtomicIntSet(&flushed, 0);
+    if ((tick = virEventAddTimeout(100, testStatusTick, NULL, NULL)) < 0)
+        return -1;
+    for (i = 0; i < 50 && !virAtomicIntGet(&flushed); i++) {
+        if (virEventRunDefaultImpl() < 0)
+            break;
+    }
+    virEventRemoveTimeout(tick);
+
+    if (!virAtomicIntGet(&flushed) || virAtomicIntGet(&flushedInMain)) {
+        fprintf(stderr, "status not written by a worker thread\n");
+        return -1;
+    }
+    if (driver.statusPending ||
+        testStatusDirty(data->vm1) || testStatusDirty(data->vm2) ||
+        !testStatusExists(data->vm1) || !testStatusExists(data->vm2)) {
+        fprintf(stderr, "status not written when the timer fired\n");
+        return -1;
+    }
+
+    /* Nothing is left to write */
+    testStatusRemove(data->vm1);
+    testStatusRemove(data->vm2);
+    qemuDomainFlushStatus(&driver);
+    if (testStatusExists(data->vm1) || testStatusExists(data->vm2)) {
+        fprintf(stderr, "clean status written again\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* A synchronous write covers any pending one, and stopped domains
+ * don't get their status written back */
+static int
+testStatusSync(const void *opaque)
+{
+    const struct testStatusData *data = opaque;
+    int ret = -1;
+
+    virObjectLock(data->vm1);
+    qemuDomainSaveStatusLater(&driver, data->vm1);
+    if (qemuDomainSaveStatus(&driver, data->vm1) < 0)
+        goto cleanup;
+    virObjectUnlock(data->vm1);
+
+    if (testStatusDirty(data->vm1) || !testStatusExists(data->vm1)) {
+        fprintf(stderr, "synchronous write left status pending\n");
+        return -1;
+    }
+    testStatusRemove(data->vm1);
+
+    virObjectLock(data->vm2);
+    qemuDomainSaveStatusLater(&driver, data->vm2);
+    virDomainObjListSetID(driver.domains, data->vm2, -1);
+    virObjectUnlock(data->vm2);
+
+    qemuDomainFlushStatus(&driver);
+    if (testStatusExists(data->vm1) || testStatusExists(data->vm2) ||
+        testStatusDirty(data->vm2)) {
+        fprintf(stderr, "status written after it was no longer needed\n");
+        return -1;
+    }
+
+    virObjectLock(data->vm2);
+    virDomainObjListSetID(driver.domains, data->vm2, 2);
+    virObjectUnlock(data->vm2);
+
+    return 0;
+
+cleanup:
+    virObjectUnlock(data->vm1);
+    return ret;
+}
+
+
+/* Reconnecting to qemu does not tell about a pending fake reboot,
+ * so it must be on disk right away */
+static int
+testStatusFakeReboot(const void *opaque)
+{
+    const struct testStatusData *data = opaque;
+    bool written;
+
+    virObjectLock(data->vm1);
+    qemuDomainSetFakeReboot(&driver, data->vm1, true);
+    written = testStatusExists(data->vm1) && !testStatusDirty(data->vm1);
+    qemuDomainSetFakeReboot(&driver, data->vm1, false);
+    virObjectUnlock(data->vm1);
+
+    if (!written) {
+        fprintf(stderr, "fake reboot flag not written right away\n");
+        return -1;
+    }
+
+    testStatusRemove(data->vm1);
+    return 0;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    char *statedir = NULL;
+    struct testStatusData data = { NULL, NULL };
+
+    if (virThreadInitialize() < 0 ||
+        virEventRegisterDefaultImpl() < 0)
+        return EXIT_FAILURE;
+
+    if (!(statedir = strdup(STATEDIRTEMPLATE)) ||
+        !mkdtemp(statedir)) {
+        fprintf(stderr, "Cannot create state directory\n");
+        VIR_FREE(statedir);
+        return EXIT_FAILURE;
+    }
+
+    mainThread = virThreadSelfID();
+    driver.statusTimer = -1;
+    if (!(driver.config = virQEMUDriverConfigNew(false)) ||
+        !(driver.caps = testQemuCapsInit()) ||
+        !(driver.xmlopt = virQEMUDriverCreateXMLConf(&driver)) ||
+        !(driver.domains = virDomainObjListNew())) {
+        ret = -1;
+        goto cleanup;
+    }
+    VIR_FREE(driver.config->stateDir);
+    driver.config->stateDir = statedir;
+    statedir = NULL;
+
+    if (!(driver.statusPool = virThreadPoolNew(0, 1, 0, testStatusFlushJob,
+                                               &driver)) ||
+        (driver.statusTimer = virEventAddTimeout(-1,
+                                                 qemuDomainFlushStatusTimer,
+                                                 &driver, NULL)) < 0 ||
+        !(data.vm1 = testStatusAddDomain("status1", 1)) ||
+        !(data.vm2 = testStatusAddDomain("status2", 2))) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (virtTestRun("Deferred status writes are coalesced", 1,
+                    testStatusCoalesce, &data) < 0)
+        ret = -1;
+    if (virtTestRun("Synchronous status write", 1,
+                    testStatusSync, &data) < 0)
+        ret = -1;
+    if (virtTestRun("Fake reboot is written right away", 1,
+                    testStatusFakeReboot, &data) < 0)
+        ret = -1;
+
+cleanup:
+    if (driver.statusTimer >= 0)
+        virEventRemoveTimeout(driver.statusTimer);
+    virThreadPoolFree(driver.statusPool);
+    if (driver.config)
+        rmdir(driver.config->stateDir);
+    if (statedir)
+        rmdir(statedir);
+    VIR_FREE(statedir);
+    virObjectUnref(driver.domains);
+    virObjectUnref(driver.xmlopt);
+    virObjectUnref(driver.caps);
+    virObjectUnref(driver.config);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
+
+#else
+
+int
+main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* WITH_QEMU */
@@ -307,6 +307,14 @@ mymain(void)
     VIR_FREE(driver.config->hugepagePath);
     if ((driver.config->hugepagePath = strdup("/dev/hugepages/libvirt/qemu")) == NULL)
         return EXIT_FAILURE;
+    driver.config->hugepageSize = 2048;
+    if (VIR_ALLOC_N(driver.config->hugetlbfs, 1) < 0)
+        return EXIT_FAILURE;
+    driver.config->nhugetlbfs = 1;
+    if (!(driver.config->hugetlbfs[0].mnt_dir = strdup("/dev/hugepages1G")) ||
+        !(driver.config->hugetlbfs[0].path = strdup("/dev/hugepages1G/libvirt/qemu")))
+        return EXIT_FAILURE;
+    driver.config->hugetlbfs[0].size = 1048576;
     driver.config->spiceTLS = 1;
     if (!(driver.config->spicePassword = strdup("123456")))
         return EXIT_FAILURE;
@@ -661,6 +669,15 @@ mymain(void)
             QEMU_CAPS_DEVICE, QEMU_CAPS_NODEFCONFIG, QEMU_CAPS_VIRTIO_TX_ALG);
     DO_TEST("net-virtio-netdev",
             QEMU_CAPS_DEVICE, QEMU_CAPS_NETDEV, QEMU_CAPS_NODEFCONFIG);
+    DO_TEST("net-virtio-mq",
+            QEMU_CAPS_DEVICE, QEMU_CAPS_NETDEV, QEMU_CAPS_NODEFCONFIG);
+    /* Only privileged daemons open the queues of TAP devices */
+    driver.config->privileged = true;
+    DO_TEST("net-virtio-mq-bridge",
+            QEMU_CAPS_DEVICE, QEMU_CAPS_NETDEV, QEMU_CAPS_NODEFCONFIG,
+            QEMU_CAPS_VHOST_NET);
+    driver.config->privileged = false;
+    DO_TEST_PARSE_ERROR("net-mq-no-virtio", NONE);
     DO_TEST("net-virtio-s390",
             QEMU_CAPS_DEVICE, QEMU_CAPS_VIRTIO_S390);
     DO_TEST("net-virtio-ccw",
@@ -884,7 +901,14 @@ mymain(void)
     DO_TEST("blkiotune", QEMU_CAPS_NAME);
     DO_TEST("blkiotune-device", QEMU_CAPS_NAME);
     DO_TEST("cputune", QEMU_CAPS_NAME);
+    DO_TEST("iothreads-disk", QEMU_CAPS_DRIVE, QEMU_CAPS_DEVICE,
+            QEMU_CAPS_OBJECT_IOTHREAD);
+    DO_TEST_FAILURE("iothreads-disk", QEMU_CAPS_DRIVE, QEMU_CAPS_DEVICE);
     DO_TEST("numatune-memory", NONE);
+    DO_TEST("numatune-memnode", QEMU_CAPS_OBJECT_MEMORY_RAM,
+            QEMU_CAPS_OBJECT_MEMORY_FILE, QEMU_CAPS_MLOCK);
+    DO_TEST_FAILURE("numatune-memnode", QEMU_CAPS_MLOCK);
+    DO_TEST_PARSE_ERROR("numatune-memnode-no-cell", NONE);
     DO_TEST("numad", NONE);
     DO_TEST("numad-auto-vcpu-static-numatune", NONE);
     DO_TEST("numad-auto-memory-vcpu-cpuset", NONE);
@@ -982,7 +1006,7 @@ mymain(void)
     return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-VIRT_TEST_MAIN(mymain)
+VIRT_TEST_MAIN_PRELOAD(mymain, abs_builddir "/.libs/qemuxml2argvmock.so")
 
 #else
 
@@ -7,6 +7,7 @@
 
 #include <sys/types.h>
 #include <fcntl.h>
+#include <dirent.h>
 
 #include "testutils.h"
 
@@ -17,6 +18,7 @@
 # include "qemu/qemu_domain.h"
 # include "testutilsqemu.h"
 # include "virstring.h"
+# include "virtime.h"
 
 static virQEMUDriver driver;
 
@@ -100,10 +102,93 @@ cleanup:
 }
 
 
+/* Time formatting all the domains in qemuxml2argvdata which parse */
+static int
+testFormatThroughput(const void *data)
+{
+    const unsigned int *rounds = data;
+    char *dirname = NULL;
+    char *path = NULL;
+    char *xml = NULL;
+    DIR *dir = NULL;
+    struct dirent *ent;
+    virDomainDefPtr *defs = NULL;
+    size_t ndefs = 0;
+    unsigned long long start, end;
+    unsigned long long bytes = 0;
+    unsigned int i;
+    size_t j;
+    int ret = -1;
+
+    if (virAsprintf(&dirname, "%s/qemuxml2argvdata", abs_srcdir) < 0 ||
+        !(dir = opendir(dirname)))
+        goto cleanup;
+
+    while ((ent = readdir(dir))) {
+        virDomainDefPtr def;
+
+        if (!STRPREFIX(ent->d_name, "qemuxml2argv-") ||
+            !virFileHasSuffix(ent->d_name, ".xml"))
+            continue;
+
+        if (virAsprintf(&path, "%s/%s", dirname, ent->d_name) < 0 ||
+            virtTestLoadFile(path, &xml) < 0)
+            goto cleanup;
+
+        /* Some of the files are meant to be rejected */
+        def = virDomainDefParseString(xml, driver.caps, driver.xmlopt,
+                                      QEMU_EXPECTED_VIRT_TYPES,
+                                      VIR_DOMAIN_XML_INACTIVE);
+        virResetLastError();
+        VIR_FREE(path);
+        VIR_FREE(xml);
+
+        if (def && VIR_APPEND_ELEMENT(defs, ndefs, def) < 0) {
+            virDomainDefFree(def);
+            goto cleanup;
+        }
+    }
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+
+    for (i = 0; i < *rounds; i++) {
+        for (j = 0; j < ndefs; j++) {
+            if (!(xml = virDomainDefFormat(defs[j], VIR_DOMAIN_XML_SECURE)))
+                goto cleanup;
+            bytes += strlen(xml);
+            VIR_FREE(xml);
+        }
+    }
+
+    if (virTimeMillisNow(&end) < 0)
+        goto cleanup;
+
+    if (virTestGetDebug())
+        fprintf(stderr, "\n%zu domains x %u rounds: %llu ms, %llu KiB/s\n",
+                ndefs, *rounds, end - start,
+                bytes * 1000 / 1024 / (end - start ? end - start : 1));
+
+    ret = 0;
+
+cleanup:
+    if (dir)
+        closedir(dir);
+    for (j = 0; j < ndefs; j++)
+        virDomainDefFree(defs[j]);
+    VIR_FREE(defs);
+    VIR_FREE(dirname);
+    VIR_FREE(path);
+    VIR_FREE(xml);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
     int ret = 0;
+    unsigned int rounds;
 
     if ((driver.caps = testQemuCapsInit()) == NULL)
         return EXIT_FAILURE;
@@ -158,6 +243,7 @@ mymain(void)
     DO_TEST("hyperv");
 
     DO_TEST("hugepages");
+    DO_TEST("numatune-memnode");
     DO_TEST("disk-aio");
     DO_TEST("disk-cdrom");
     DO_TEST("disk-floppy");
@@ -205,6 +291,8 @@ mymain(void)
     DO_TEST("net-user");
     DO_TEST("net-virtio");
     DO_TEST("net-virtio-device");
+    DO_TEST("net-virtio-mq");
+    DO_TEST("net-virtio-mq-bridge");
     DO_TEST("net-eth");
     DO_TEST("net-eth-ifname");
     DO_TEST("net-virtio-network-portgroup");
@@ -240,6 +328,7 @@ mymain(void)
     DO_TEST("blkiotune");
     DO_TEST("blkiotune-device");
     DO_TEST("cputune");
+    DO_TEST("iothreads-disk");
 
     DO_TEST("smp");
     DO_TEST("lease");
@@ -285,6 +374,11 @@ mymain(void)
     DO_TEST_DIFFERENT("pci-autoadd-addr");
     DO_TEST_DIFFERENT("pci-autoadd-idx");
 
+    rounds = virTestGetDebug() ? 100 : 1;
+    if (virtTestRun("QEMU XML-2-XML format throughput", 1,
+                    testFormatThroughput, &rounds) < 0)
+        ret = -1;
+
     virObjectUnref(driver.caps);
     virObjectUnref(driver.xmlopt);
 
@@ -0,0 +1,387 @@
+/*
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+
+#include "testutils.h"
+#include "virerror.h"
+#include "viralloc.h"
+#include "virstring.h"
+
+#include "rpc/virnetmessage.h"
+#include "remote/remote_multicall.h"
+
+#define VIR_FROM_THIS VIR_FROM_REMOTE
+
+/* Large enough for the reply to need several buffer sizes */
+#define TEST_XML_LEN (200 * 1024)
+
+/*
+ * A pretend daemon, which counts the round trips and the procedures
+ * it runs, and knows just enough procedures for the tests
+ */
+static size_t trips;
+static size_t served;
+
+struct testProc {
+    int proc_nr;
+    xdrproc_t args_filter;
+    size_t args_size;
+    xdrproc_t ret_filter;
+    size_t ret_size;
+};
+
+static const struct testProc testProcs[] = {
+    { REMOTE_PROC_DOMAIN_CREATE,
+      (xdrproc_t) xdr_remote_domain_create_args,
+      sizeof(remote_domain_create_args),
+      (xdrproc_t) xdr_void, 0 },
+    { REMOTE_PROC_DOMAIN_LOOKUP_BY_UUID,
+      (xdrproc_t) xdr_remote_domain_lookup_by_uuid_args,
+      sizeof(remote_domain_lookup_by_uuid_args),
+      (xdrproc_t) xdr_remote_domain_lookup_by_uuid_ret,
+      sizeof(remote_domain_lookup_by_uuid_ret) },
+    { REMOTE_PROC_DOMAIN_GET_XML_DESC,
+      (xdrproc_t) xdr_remote_domain_get_xml_desc_args,
+      sizeof(remote_domain_get_xml_desc_args),
+      (xdrproc_t) xdr_remote_domain_get_xml_desc_ret,
+      sizeof(remote_domain_get_xml_desc_ret) },
+};
+
+
+static int
+testServeProc(int proc_nr,
+              char *args,
+              char *ret)
+{
+    served++;
+
+    switch (proc_nr) {
+    case REMOTE_PROC_DOMAIN_CREATE: {
+        remote_domain_create_args *create = (void *) args;
+
+        if (STREQ(create->dom.name, "broken")) {
+            virReportError(VIR_ERR_OPERATION_FAILED,
+                           _("cannot start '%s'"), create->dom.name);
+            return -1;
+        }
+        return 0;
+    }
+
+    case REMOTE_PROC_DOMAIN_LOOKUP_BY_UUID: {
+        remote_domain_lookup_by_uuid_args *lookup = (void *) args;
+        remote_domain_lookup_by_uuid_ret *found = (void *) ret;
+
+        if (!(found->dom.name = strdup("test"))) {
+            virReportOOMError();
+            return -1;
+        }
+        memcpy(found->dom.uuid, lookup->uuid, VIR_UUID_BUFLEN);
+        found->dom.id = lookup->uuid[0];
+        return 0;
+    }
+
+    case REMOTE_PROC_DOMAIN_GET_XML_DESC: {
+        remote_domain_get_xml_desc_ret *desc = (void *) ret;
+
+        if (VIR_ALLOC_N(desc->xml, TEST_XML_LEN + 1) < 0) {
+            virReportOOMError();
+            return -1;
+        }
+        memset(desc->xml, 'x', TEST_XML_LEN);
+        return 0;
+    }
+    }
+
+    virReportError(VIR_ERR_RPC, _("unknown procedure: %d"), proc_nr);
+    return -1;
+}
+
+
+static const struct testProc *
+testFindProc(int proc_nr)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_CARDINALITY(testProcs); i++) {
+        if (testProcs[i].proc_nr == proc_nr)
+            return &testProcs[i];
+    }
+    return NULL;
+}
+
+
+/* Run an embedded call the way virNetServerProgramDispatchSubCall does */
+static int
+testServeSubCall(remote_connect_multi_call_entry *entry,
+                 remote_connect_multi_call_result *result)
+{
+    const struct testProc *proc = testFindProc(entry->proc);
+    virNetMessageError rerr;
+    char *args = NULL;
+    char *ret = NULL;
+    char *data = NULL;
+    size_t len;
+    XDR xdr;
+    int rv = -1;
+
+    memset(&rerr, 0, sizeof(rerr));
+
+    if (!proc ||
+        VIR_ALLOC_N(args, proc->args_size) < 0 ||
+        VIR_ALLOC_N(ret, MAX(proc->ret_size, 1)) < 0)
+        goto cleanup;
+
+    xdrmem_create(&xdr, entry->args.args_val, entry->args.args_len,
+                  XDR_DECODE);
+    if (!(*proc->args_filter)(&xdr, args)) {
+        xdr_destroy(&xdr);
+        goto cleanup;
+    }
+    xdr_destroy(&xdr);
+
+    if (testServeProc(entry->proc, args, ret) < 0) {
+        virNetMessageSaveError(&rerr);
+        if (virNetMessageEncodeData((xdrproc_t) xdr_virNetMessageError,
+                                    &rerr, REMOTE_CONNECT_MULTI_CALL_PAYLOAD_MAX,
+                                    &data, &len) < 0)
+            goto cleanup;
+        result->status = VIR_NET_ERROR;
+    } else {
+        if (virNetMessageEncodeData(proc->ret_filter, ret,
+                                    REMOTE_CONNECT_MULTI_CALL_PAYLOAD_MAX,
+                                    &data, &len) < 0)
+            goto cleanup;
+        result->status = VIR_NET_OK;
+    }
+    result->data.data_val = data;
+    result->data.data_len = len;
+    rv = 0;
+
+cleanup:
+    if (proc) {
+        xdr_free(proc->args_filter, args);
+        xdr_free(proc->ret_filter, ret);
+    }
+    xdr_free((xdrproc_t) xdr_virNetMessageError, (char *) &rerr);
+    VIR_FREE(args);
+    VIR_FREE(ret);
+    return rv;
+}
+
+
+/* Stands for call() in the remote driver, one round trip each */
+static int
+testCall(int proc_nr,
+         xdrproc_t args_filter ATTRIBUTE_UNUSED, char *args,
+         xdrproc_t ret_filter ATTRIBUTE_UNUSED, char *ret,
+         void *opaque ATTRIBUTE_UNUSED)
+{
+    remote_connect_multi_call_args *multi = (void *) args;
+    remote_connect_multi_call_ret *results = (void *) ret;
+    size_t i;
+
+    trips++;
+
+    if (proc_nr != REMOTE_PROC_CONNECT_MULTI_CALL)
+        return testServeProc(proc_nr, args, ret);
+
+    if (VIR_ALLOC_N(results->results.results_val,
+                    multi->calls.calls_len) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    for (i = 0; i < multi->calls.calls_len; i++) {
+        remote_connect_multi_call_result *result =
+            &results->results.results_val[i];
+
+        if (testServeSubCall(&multi->calls.calls_val[i], result) < 0)
+            return -1;
+        results->results.results_len++;
+
+        if (result->status != VIR_NET_OK &&
+            (multi->flags & REMOTE_CONNECT_MULTI_CALL_STOP_ON_ERROR))
+            break;
+    }
+
+    return 0;
+}
+
+
+struct testMultiData {
+    const char *name;       /* of the domain to start */
+    unsigned int flags;
+    bool compound;
+    size_t trips;           /* round trips expected */
+    size_t served;          /* procedures run by the daemon */
+    int rv[3];              /* expected for create, lookup and XML */
+};
+
+static int
+testMultiCall(const void *opaque)
+{
+    const struct testMultiData *data = opaque;
+    remote_domain_create_args create;
+    remote_domain_lookup_by_uuid_args lookup;
+    remote_domain_lookup_by_uuid_ret found;
+    remote_domain_get_xml_desc_args desc;
+    remote_domain_get_xml_desc_ret xml;
+    remoteMultiCall calls[3];
+    virErrorPtr err;
+    int rv;
+    int ret = -1;
+    size_t i;
+
+    memset(&create, 0, sizeof(create));
+    memset(&lookup, 0, sizeof(lookup));
+    memset(&found, 0, sizeof(found));
+    memset(&desc, 0, sizeof(desc));
+    memset(&xml, 0, sizeof(xml));
+    memset(calls, 0, sizeof(calls));
+
+    create.dom.name = (char *) data->name;
+    memset(create.dom.uuid, 7, VIR_UUID_BUFLEN);
+    memcpy(lookup.uuid, create.dom.uuid, VIR_UUID_BUFLEN);
+    desc.dom = create.dom;
+
+    calls[0].proc_nr = REMOTE_PROC_DOMAIN_CREATE;
+    calls[0].args_filter = (xdrproc_t) xdr_remote_domain_create_args;
+    calls[0].args = (char *) &create;
+    calls[0].ret_filter = (xdrproc_t) xdr_void;
+    calls[1].proc_nr = REMOTE_PROC_DOMAIN_LOOKUP_BY_UUID;
+    calls[1].args_filter = (xdrproc_t) xdr_remote_domain_lookup_by_uuid_args;
+    calls[1].args = (char *) &lookup;
+    calls[1].ret_filter = (xdrproc_t) xdr_remote_domain_lookup_by_uuid_ret;
+    calls[1].ret = (char *) &found;
+    calls[2].proc_nr = REMOTE_PROC_DOMAIN_GET_XML_DESC;
+    calls[2].args_filter = (xdrproc_t) xdr_remote_domain_get_xml_desc_args;
+    calls[2].args = (char *) &desc;
+    calls[2].ret_filter = (xdrproc_t) xdr_remote_domain_get_xml_desc_ret;
+    calls[2].ret = (char *) &xml;
+
+    trips = served = 0;
+    virResetLastError();
+    rv = remoteMultiCallRun(calls, ARRAY_CARDINALITY(calls), data->flags,
+                            data->compound, testCall, NULL);
+
+    if (trips != data->trips || served != data->served) {
+        if (virTestGetDebug())
+            fprintf(stderr, "%zu round trips, %zu procedures\n",
+                    trips, served);
+        goto cleanup;
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(calls); i++) {
+        if (calls[i].rv != data->rv[i])
+            goto cleanup;
+    }
+
+    /* The first failure is the one reported */
+    err = virGetLastError();
+    if (data->rv[0] < 0) {
+        if (rv != -1 || !err || err->code != VIR_ERR_OPERATION_FAILED ||
+            !strstr(err->message, data->name))
+            goto cleanup;
+    } else if (rv != 0 || err) {
+        goto cleanup;
+    }
+
+    if (calls[1].rv == 0 &&
+        (STRNEQ(found.dom.name, "test") || found.dom.id != 7 ||
+         memcmp(found.dom.uuid, lookup.uuid, VIR_UUID_BUFLEN) != 0))
+        goto cleanup;
+    if (calls[2].rv == 0 &&
+        (strlen(xml.xml) != TEST_XML_LEN || xml.xml[TEST_XML_LEN - 1] != 'x'))
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    if (calls[1].rv == 0)
+        xdr_free((xdrproc_t) xdr_remote_domain_lookup_by_uuid_ret,
+                 (char *) &found);
+    if (calls[2].rv == 0)
+        xdr_free((xdrproc_t) xdr_remote_domain_get_xml_desc_ret,
+                 (char *) &xml);
+    virResetLastError();
+    return ret;
+}
+
+
+/* Nothing goes out when there are more calls than a compound call holds */
+static int
+testMultiCallTooMany(const void *opaque ATTRIBUTE_UNUSED)
+{
+    remoteMultiCallPtr calls = NULL;
+    size_t ncalls = REMOTE_CONNECT_MULTI_CALL_MAX + 1;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(calls, ncalls) < 0)
+        return -1;
+
+    trips = 0;
+    if (remoteMultiCallRun(calls, ncalls, 0, true, testCall, NULL) == 0 ||
+        trips != 0 || calls[0].rv != -1)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virResetLastError();
+    VIR_FREE(calls);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+#define DO_TEST(desc, name, flags, compound, trips, served,              \
+                create, lookup, xml)                                    \
+    do {                                                                \
+        struct testMultiData data = {                                   \
+            name, flags, compound, trips, served,                       \
+            { create, lookup, xml },                                    \
+        };                                                              \
+        if (virtTestRun("Multi call " desc, 1,                          \
+                        testMultiCall, &data) < 0)                      \
+            ret = -1;                                                   \
+    } while (0)
+
+#define STOP REMOTE_CONNECT_MULTI_CALL_STOP_ON_ERROR
+
+    DO_TEST("compound", "good", 0, true, 1, 3, 0, 0, 0);
+    DO_TEST("compound stop on error", "broken", STOP, true, 1, 1, -1, -1, -1);
+    DO_TEST("compound carry on", "broken", 0, true, 1, 3, -1, 0, 0);
+    DO_TEST("fallback", "good", 0, false, 3, 3, 0, 0, 0);
+    DO_TEST("fallback stop on error", "broken", STOP, false, 1, 1, -1, -1, -1);
+    DO_TEST("fallback carry on", "broken", 0, false, 3, 3, -1, 0, 0);
+
+    if (virtTestRun("Multi call too many calls", 1,
+                    testMultiCallTooMany, NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -1,5 +1,6 @@
 #include <config.h>
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -196,6 +197,116 @@ cleanup:
 }
 
 
+static int testBufFormat(const void *data ATTRIBUTE_UNUSED)
+{
+    virBuffer bufinit = VIR_BUFFER_INITIALIZER;
+    virBufferPtr buf = &bufinit;
+    char *expected = NULL;
+    char *result = NULL;
+    int ret = -1;
+
+    /* Formats handled without vsnprintf must still give the same output */
+#define FORMAT(fmt, ...)                                     \
+    do {                                                     \
+        char *tmp = NULL;                                    \
+        virBufferAsprintf(buf, fmt, __VA_ARGS__);            \
+        if (virAsprintf(&tmp, "%s" fmt,                      \
+                        expected ? expected : "",            \
+                        __VA_ARGS__) < 0)                    \
+            goto cleanup;                                    \
+        VIR_FREE(expected);                                  \
+        expected = tmp;                                      \
+    } while (0)
+
+    FORMAT("<memory unit='KiB'>%llu</memory>\n", 1048576ULL);
+    FORMAT("%d %d %d %i", 0, -1, INT_MIN, INT_MAX);
+    FORMAT("%u %x %lu %lx", 0U, 0xdeadbeefU, ULONG_MAX, 255UL);
+    FORMAT("%lld %llu %llx", LLONG_MIN, ULLONG_MAX, 0x1234ULL);
+    FORMAT("%zu %zd %zx", (size_t)42, (ssize_t)-42, (size_t)4096);
+    FORMAT("%s=%s %c%%", "name", "value", 'x');
+    FORMAT("100%%%s", "");
+    FORMAT("%s", "");
+    FORMAT("%-5s|%05d|%.2f|%#x", "ab", 7, 0.5, 16U);
+
+    result = virBufferContentAndReset(buf);
+    if (!result || STRNEQ(result, expected)) {
+        virtTestDifference(stderr, expected, result);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virBufferFreeAndReset(buf);
+    VIR_FREE(expected);
+    VIR_FREE(result);
+    return ret;
+#undef FORMAT
+}
+
+static int testBufEscapeString(const void *data ATTRIBUTE_UNUSED)
+{
+    virBuffer bufinit = VIR_BUFFER_INITIALIZER;
+    virBufferPtr buf = &bufinit;
+    const char expected[] =
+        "  <name>a&lt;b&gt;c&amp;d&quot;e&apos;f</name>\n"
+        "  <x a='&lt;&lt;'/>\n"
+        "  plain\tline\n"
+        "  99 &amp;&amp; 100%\n";
+    char *result = NULL;
+    int ret = -1;
+
+    virBufferAdjustIndent(buf, 2);
+    virBufferEscapeString(buf, "<name>%s</name>\n", "a<b>c&d\"e'f");
+    virBufferEscapeString(buf, "<x a='%s'/>\n", "<\001<");
+    virBufferEscapeString(buf, "%s\n", "plain\tline");
+    virBufferEscapeString(buf, "99 %s 100%%\n", "&&");
+
+    result = virBufferContentAndReset(buf);
+    if (!result || STRNEQ(result, expected)) {
+        virtTestDifference(stderr, expected, result);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(result);
+    return ret;
+}
+
+static int testBufGrow(const void *data ATTRIBUTE_UNUSED)
+{
+    virBuffer bufinit = VIR_BUFFER_INITIALIZER;
+    virBufferPtr buf = &bufinit;
+    char *result = NULL;
+    int ret = -1;
+    size_t i;
+
+    for (i = 0; i < 100000; i++)
+        virBufferAsprintf(buf, "<item id='%zu'/>\n", i);
+
+    if (virBufferError(buf)) {
+        TEST_ERROR("Buffer had error set");
+        goto cleanup;
+    }
+
+    result = virBufferContentAndReset(buf);
+    if (!result || !STRPREFIX(result, "<item id='0'/>\n<item id='1'/>\n") ||
+        !strstr(result, "<item id='99999'/>\n")) {
+        TEST_ERROR("Wrong content");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virBufferFreeAndReset(buf);
+    VIR_FREE(result);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -213,6 +324,9 @@ mymain(void)
     DO_TEST("VSprintf infinite loop", testBufInfiniteLoop, 0);
     DO_TEST("Auto-indentation", testBufAutoIndent, 0);
     DO_TEST("Trim", testBufTrim, 0);
+    DO_TEST("Format", testBufFormat, 0);
+    DO_TEST("EscapeString", testBufEscapeString, 0);
+    DO_TEST("Grow", testBufGrow, 0);
 
     return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
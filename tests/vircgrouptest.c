@@ -493,6 +493,100 @@ cleanup:
     return ret;
 }
 
+static int testCgroupWriteStat(virCgroupPtr cgroup,
+                               int controller,
+                               const char *key,
+                               const char *value)
+{
+    char *path = NULL;
+    int ret = -1;
+
+    if (virCgroupPathOfController(cgroup, controller, key, &path) < 0)
+        return -1;
+
+    if (virFileWriteStr(path, value, 0600) < 0) {
+        fprintf(stderr, "Cannot write %s\n", path);
+        goto cleanup;
+    }
+
+    ret = 0;
+cleanup:
+    VIR_FREE(path);
+    return ret;
+}
+
+static int testCgroupGetStats(const void *args ATTRIBUTE_UNUSED)
+{
+    virCgroupPtr cgroup = NULL;
+    virCgroupStats stats = { 0 };
+    unsigned long long ticks = 1000000000ULL / sysconf(_SC_CLK_TCK);
+    int fd;
+    int ret = -1;
+    int rv;
+
+    if ((rv = virCgroupNewPartition("/stats", true, -1, &cgroup)) != 0) {
+        fprintf(stderr, "Failed to create /stats cgroup: %d\n", -rv);
+        goto cleanup;
+    }
+
+    if (testCgroupWriteStat(cgroup, VIR_CGROUP_CONTROLLER_CPUACCT,
+                            "cpuacct.usage", "1000\n") < 0 ||
+        testCgroupWriteStat(cgroup, VIR_CGROUP_CONTROLLER_CPUACCT,
+                            "cpuacct.usage_percpu", "600 400 \n") < 0 ||
+        testCgroupWriteStat(cgroup, VIR_CGROUP_CONTROLLER_CPUACCT,
+                            "cpuacct.stat", "user 10\nsystem 5\n") < 0 ||
+        testCgroupWriteStat(cgroup, VIR_CGROUP_CONTROLLER_MEMORY,
+                            "memory.usage_in_bytes", "4096\n") < 0)
+        goto cleanup;
+
+    if ((rv = virCgroupGetStats(cgroup,
+                                VIR_CGROUP_STATS_CPU |
+                                VIR_CGROUP_STATS_CPU_TIMES |
+                                VIR_CGROUP_STATS_PERCPU |
+                                VIR_CGROUP_STATS_MEMORY,
+                                &stats)) < 0) {
+        fprintf(stderr, "Failed to get stats: %d\n", -rv);
+        goto cleanup;
+    }
+
+    if (stats.cpuTime != 1000 ||
+        stats.userTime != 10 * ticks ||
+        stats.sysTime != 5 * ticks ||
+        stats.npercpuTime != 2 ||
+        stats.percpuTime[0] != 600 ||
+        stats.percpuTime[1] != 400 ||
+        stats.memUsage != 4096) {
+        fprintf(stderr, "Unexpected stats values\n");
+        goto cleanup;
+    }
+
+    /* A changed value must be seen through the cached descriptor */
+    fd = cgroup->statfds[VIR_CGROUP_STAT_FILE_CPUACCT_USAGE];
+    if (testCgroupWriteStat(cgroup, VIR_CGROUP_CONTROLLER_CPUACCT,
+                            "cpuacct.usage", "2000\n") < 0)
+        goto cleanup;
+
+    virCgroupStatsClear(&stats);
+    if ((rv = virCgroupGetStats(cgroup, VIR_CGROUP_STATS_CPU, &stats)) < 0) {
+        fprintf(stderr, "Failed to get stats: %d\n", -rv);
+        goto cleanup;
+    }
+
+    if (fd < 0 ||
+        cgroup->statfds[VIR_CGROUP_STAT_FILE_CPUACCT_USAGE] != fd ||
+        stats.cpuTime != 2000) {
+        fprintf(stderr, "Stat file was not read through its cached fd\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virCgroupStatsClear(&stats);
+    virCgroupFree(&cgroup);
+    return ret;
+}
+
 # define FAKESYSFSDIRTEMPLATE abs_builddir "/fakesysfsdir-XXXXXX"
 
 static int
@@ -537,6 +631,9 @@ mymain(void)
     if (virtTestRun("New cgroup for domain partition escaped", 1, testCgroupNewForPartitionDomainEscaped, NULL) < 0)
         ret = -1;
 
+    if (virtTestRun("Cgroup stats", 1, testCgroupGetStats, NULL) < 0)
+        ret = -1;
+
     if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
         virFileDeleteTree(fakesysfsdir);
 
@@ -0,0 +1,433 @@
+/*
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "testutils.h"
+#include "internal.h"
+#include "virdnsmasq.h"
+#include "virsocketaddr.h"
+#include "virfile.h"
+#include "viralloc.h"
+#include "virstring.h"
+#include "virutil.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define TESTDIRTEMPLATE abs_builddir "/virdnsmasqdata-XXXXXX"
+
+static char *testdir;
+
+struct testDhcpHost {
+    const char *mac;
+    const char *ip;
+    const char *name;
+};
+
+struct testDnsHost {
+    const char *ip;
+    const char *name;
+};
+
+struct testFile {
+    const char *name;
+    const char *contents;
+};
+
+struct testUpdateData {
+    dnsmasqContext *ctx;
+    bool save;                          /* dnsmasqSave, not dnsmasqUpdate */
+    const struct testDhcpHost *dhcp;    /* up to an empty entry */
+    const struct testDnsHost *dns;
+    bool reload;                        /* expected from dnsmasqUpdate */
+    const struct testFile *hostsdir;    /* expected contents */
+    const struct testFile *addnhostsdir;
+};
+
+#define TEST_MAX_FILES 8
+
+
+static int
+testSetHosts(dnsmasqContext *ctx,
+             const struct testDhcpHost *dhcp,
+             const struct testDnsHost *dns)
+{
+    virSocketAddr addr;
+
+    dnsmasqClearHosts(ctx);
+
+    for (; dhcp->ip; dhcp++) {
+        if (virSocketAddrParse(&addr, dhcp->ip, AF_INET) < 0 ||
+            dnsmasqAddDhcpHost(ctx, dhcp->mac, &addr, dhcp->name,
+                               NULL, false) < 0)
+            return -1;
+    }
+
+    for (; dns->ip; dns++) {
+        if (virSocketAddrParse(&addr, dns->ip, AF_INET) < 0 ||
+            dnsmasqAddHost(ctx, &addr, dns->name) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+/* Remember the inode of each of @files in @dir that already has the
+ * expected contents, 0 for the others */
+static int
+testSnapshotDir(const char *dir,
+                const struct testFile *files,
+                ino_t *inodes)
+{
+    char *path = NULL;
+    char *contents = NULL;
+    struct stat sb;
+    size_t i;
+    int ret = -1;
+
+    for (i = 0; files[i].name; i++) {
+        inodes[i] = 0;
+
+        if (virAsprintf(&path, "%s/%s", dir, files[i].name) < 0)
+            goto cleanup;
+
+        if (stat(path, &sb) == 0 &&
+            virFileReadAll(path, 1024, &contents) >= 0 &&
+            STREQ(contents, files[i].contents))
+            inodes[i] = sb.st_ino;
+
+        VIR_FREE(contents);
+        VIR_FREE(path);
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(path);
+    return ret;
+}
+
+
+/* Check that @dir holds exactly @files, and that the files which had
+ * their contents already, as recorded in @inodes, were left alone */
+static int
+testCheckDir(const char *dir,
+             const struct testFile *files,
+             const ino_t *inodes)
+{
+    DIR *dh = NULL;
+    struct dirent *de;
+    char *path = NULL;
+    char *contents = NULL;
+    struct stat sb;
+    size_t nfiles = 0;
+    size_t nfound = 0;
+    size_t i;
+    int ret = -1;
+
+    while (files[nfiles].name)
+        nfiles++;
+
+    if (!(dh = opendir(dir))) {
+        fprintf(stderr, "\ncannot open %s\n", dir);
+        goto cleanup;
+    }
+
+    while ((de = readdir(dh)) != NULL) {
+        if (STREQ(de->d_name, ".") || STREQ(de->d_name, ".."))
+            continue;
+
+        for (i = 0; i < nfiles; i++) {
+            if (STREQ(de->d_name, files[i].name))
+                break;
+        }
+        if (i == nfiles) {
+            fprintf(stderr, "\nunexpected file %s in %s\n", de->d_name, dir);
+            goto cleanup;
+        }
+
+        if (virAsprintf(&path, "%s/%s", dir, de->d_name) < 0 ||
+            stat(path, &sb) < 0 ||
+            virFileReadAll(path, 1024, &contents) < 0)
+            goto cleanup;
+
+        if (STRNEQ(contents, files[i].contents)) {
+            virtTestDifference(stderr, files[i].contents, contents);
+            goto cleanup;
+        }
+
+        if (inodes[i] && inodes[i] != sb.st_ino) {
+            fprintf(stderr, "\nunchanged file %s was rewritten\n", path);
+            goto cleanup;
+        }
+
+        VIR_FREE(contents);
+        VIR_FREE(path);
+        nfound++;
+    }
+
+    if (nfound != nfiles) {
+        fprintf(stderr, "\n%zu files missing in %s\n", nfiles - nfound, dir);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    if (dh)
+        closedir(dh);
+    VIR_FREE(contents);
+    VIR_FREE(path);
+    return ret;
+}
+
+
+static int
+testUpdate(const void *opaque)
+{
+    const struct testUpdateData *data = opaque;
+    ino_t hostsInodes[TEST_MAX_FILES];
+    ino_t addnhostsInodes[TEST_MAX_FILES];
+    char *hostsdir = NULL;
+    char *addnhostsdir = NULL;
+    bool reload = !data->reload;
+    int ret = -1;
+
+    if (virAsprintf(&hostsdir, "%s/default.hostsdir", testdir) < 0 ||
+        virAsprintf(&addnhostsdir, "%s/default.addnhostsdir", testdir) < 0)
+        goto cleanup;
+
+    if (testSnapshotDir(hostsdir, data->hostsdir, hostsInodes) < 0 ||
+        testSnapshotDir(addnhostsdir, data->addnhostsdir,
+                        addnhostsInodes) < 0 ||
+        testSetHosts(data->ctx, data->dhcp, data->dns) < 0)
+        goto cleanup;
+
+    if (data->save) {
+        if (dnsmasqSave(data->ctx) < 0)
+            goto cleanup;
+        reload = data->reload;
+    } else if (dnsmasqUpdate(data->ctx, &reload) < 0) {
+        goto cleanup;
+    }
+
+    if (reload != data->reload) {
+        fprintf(stderr, "\nexpected %s\n",
+                data->reload ? "a reload" : "no reload");
+        goto cleanup;
+    }
+
+    if (testCheckDir(hostsdir, data->hostsdir, hostsInodes) < 0 ||
+        testCheckDir(addnhostsdir, data->addnhostsdir, addnhostsInodes) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(hostsdir);
+    VIR_FREE(addnhostsdir);
+    return ret;
+}
+
+
+/* Without hosts directories, every update rewrites the hostsfile,
+ * needs a reload and drops the directories of an earlier dnsmasq */
+static int
+testUpdateHostsfile(const void *opaque ATTRIBUTE_UNUSED)
+{
+    static const struct testDhcpHost dhcp[] = {
+        { "52:54:00:00:00:02", "192.168.122.2", "alpha" },
+        { "52:54:00:00:00:03", "192.168.122.3", "beta" },
+        { NULL, NULL, NULL },
+    };
+    static const struct testDnsHost dns[] = {
+        { NULL, NULL },
+    };
+    dnsmasqContext *ctx = NULL;
+    char *path = NULL;
+    char *dir = NULL;
+    char *contents = NULL;
+    bool reload = false;
+    int ret = -1;
+
+    if (!(ctx = dnsmasqContextNew("legacy", testdir)) ||
+        virAsprintf(&path, "%s/legacy.hostsfile", testdir) < 0 ||
+        virAsprintf(&dir, "%s/legacy.hostsdir", testdir) < 0 ||
+        virFileMakePath(dir) < 0 ||
+        testSetHosts(ctx, dhcp, dns) < 0 ||
+        dnsmasqUpdate(ctx, &reload) < 0)
+        goto cleanup;
+
+    if (!reload || virFileExists(dir) ||
+        virFileReadAll(path, 1024, &contents) < 0 ||
+        STRNEQ(contents,
+               "52:54:00:00:00:02,192.168.122.2,alpha\n"
+               "52:54:00:00:00:03,192.168.122.3,beta\n"))
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    dnsmasqContextFree(ctx);
+    VIR_FREE(contents);
+    VIR_FREE(path);
+    VIR_FREE(dir);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    dnsmasqContext *ctx = NULL;
+    char *staledir = NULL;
+    char *stale = NULL;
+
+    static const struct testDhcpHost dhcpNone[] = {
+        { NULL, NULL, NULL },
+    };
+    static const struct testDhcpHost dhcpOne[] = {
+        { "52:54:00:00:00:02", "192.168.122.2", "alpha" },
+        { NULL, NULL, NULL },
+    };
+    static const struct testDhcpHost dhcpTwo[] = {
+        { "52:54:00:00:00:02", "192.168.122.2", "alpha" },
+        { "52:54:00:00:00:03", "192.168.122.3", "beta" },
+        { NULL, NULL, NULL },
+    };
+    static const struct testDhcpHost dhcpRenamed[] = {
+        { "52:54:00:00:00:02", "192.168.122.2", "alpha" },
+        { "52:54:00:00:00:03", "192.168.122.3", "gamma" },
+        { NULL, NULL, NULL },
+    };
+    static const struct testDhcpHost dhcpRemoved[] = {
+        { "52:54:00:00:00:03", "192.168.122.3", "gamma" },
+        { NULL, NULL, NULL },
+    };
+    static const struct testDnsHost dnsNone[] = {
+        { NULL, NULL },
+    };
+    static const struct testDnsHost dnsOne[] = {
+        { "192.168.122.10", "www" },
+        { NULL, NULL },
+    };
+    static const struct testDnsHost dnsAlias[] = {
+        { "192.168.122.10", "www" },
+        { "192.168.122.10", "ftp" },
+        { NULL, NULL },
+    };
+
+    static const struct testFile filesNone[] = {
+        { NULL, NULL },
+    };
+    static const struct testFile hostsOne[] = {
+        { "192.168.122.2", "52:54:00:00:00:02,192.168.122.2,alpha\n" },
+        { NULL, NULL },
+    };
+    static const struct testFile hostsTwo[] = {
+        { "192.168.122.2", "52:54:00:00:00:02,192.168.122.2,alpha\n" },
+        { "192.168.122.3", "52:54:00:00:00:03,192.168.122.3,beta\n" },
+        { NULL, NULL },
+    };
+    static const struct testFile hostsRenamed[] = {
+        { "192.168.122.2", "52:54:00:00:00:02,192.168.122.2,alpha\n" },
+        { "192.168.122.3", "52:54:00:00:00:03,192.168.122.3,gamma\n" },
+        { NULL, NULL },
+    };
+    static const struct testFile hostsRemoved[] = {
+        { "192.168.122.3", "52:54:00:00:00:03,192.168.122.3,gamma\n" },
+        { NULL, NULL },
+    };
+    static const struct testFile addnOne[] = {
+        { "192.168.122.10", "192.168.122.10\twww\t\n" },
+        { NULL, NULL },
+    };
+    static const struct testFile addnAlias[] = {
+        { "192.168.122.10", "192.168.122.10\twww\tftp\t\n" },
+        { NULL, NULL },
+    };
+
+    if (!(testdir = strdup(TESTDIRTEMPLATE)) ||
+        !mkdtemp(testdir)) {
+        fprintf(stderr, "Cannot create test directory\n");
+        VIR_FREE(testdir);
+        return EXIT_FAILURE;
+    }
+
+    /* Left over by an earlier dnsmasq, the first save must drop it */
+    if (!(ctx = dnsmasqContextNew("default", testdir)) ||
+        dnsmasqContextUseHostsDirs(ctx) < 0 ||
+        virAsprintf(&staledir, "%s/default.hostsdir", testdir) < 0 ||
+        virAsprintf(&stale, "%s/192.168.122.99", staledir) < 0 ||
+        virFileMakePath(staledir) < 0 ||
+        virFileWriteStr(stale, "52:54:00:00:00:99,192.168.122.99,old\n",
+                        0644) < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+
+#define DO_TEST_FULL(name, save, dhcp, dns, reload, hosts, addnhosts)   \
+    do {                                                                \
+        struct testUpdateData data = {                                  \
+            ctx, save, dhcp, dns, reload, hosts, addnhosts,             \
+        };                                                              \
+        if (virtTestRun(name, 1, testUpdate, &data) < 0)                \
+            ret = -1;                                                   \
+    } while (0)
+#define DO_TEST_UPDATE(name, dhcp, dns, reload, hosts, addnhosts)       \
+    DO_TEST_FULL(name, false, dhcp, dns, reload, hosts, addnhosts)
+
+    DO_TEST_FULL("Save all hosts", true, dhcpOne, dnsNone,
+                 false, hostsOne, filesNone);
+    DO_TEST_UPDATE("Add a DHCP host", dhcpTwo, dnsNone,
+                   false, hostsTwo, filesNone);
+    DO_TEST_UPDATE("Add a DNS host", dhcpTwo, dnsOne,
+                   false, hostsTwo, addnOne);
+    DO_TEST_UPDATE("Nothing changed", dhcpTwo, dnsOne,
+                   false, hostsTwo, addnOne);
+    DO_TEST_UPDATE("Rename a DHCP host", dhcpRenamed, dnsOne,
+                   true, hostsRenamed, addnOne);
+    DO_TEST_UPDATE("Add a DNS alias", dhcpRenamed, dnsAlias,
+                   true, hostsRenamed, addnAlias);
+    DO_TEST_UPDATE("Remove a DHCP host", dhcpRemoved, dnsAlias,
+                   true, hostsRemoved, addnAlias);
+    DO_TEST_UPDATE("Remove all hosts", dhcpNone, dnsNone,
+                   true, filesNone, filesNone);
+
+    if (virtTestRun("Update a hostsfile", 1,
+                    testUpdateHostsfile, NULL) < 0)
+        ret = -1;
+
+cleanup:
+    dnsmasqContextFree(ctx);
+    if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
+        virFileDeleteTree(testdir);
+    VIR_FREE(testdir);
+    VIR_FREE(staledir);
+    VIR_FREE(stale);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -12,6 +12,7 @@
 #include "viralloc.h"
 #include "virlog.h"
 #include "virstring.h"
+#include "virtime.h"
 
 #define testError(...)                                          \
     do {                                                        \
@@ -25,13 +26,24 @@
     } while (0)
 
 
+/* Whether the tests run against open addressing tables */
+static bool testHashOpen;
+
+static virHashTablePtr
+testHashCreate(int size)
+{
+    if (testHashOpen)
+        return virHashCreateOpen(size, NULL);
+    return virHashCreate(size, NULL);
+}
+
 static virHashTablePtr
 testHashInit(int size)
 {
     virHashTablePtr hash;
     ssize_t i;
 
-    if (!(hash = virHashCreate(size, NULL)))
+    if (!(hash = testHashCreate(size)))
         return NULL;
 
     /* entires are added in reverse order so that they will be linked in
@@ -523,7 +535,7 @@ testHashGetItems(const void *data ATTRIBUTE_UNUSED)
     char value2[] = "2";
     char value3[] = "3";
 
-    if (!(hash = virHashCreate(0, NULL)) ||
+    if (!(hash = testHashCreate(0)) ||
         virHashAddEntry(hash, keya, value3) < 0 ||
         virHashAddEntry(hash, keyc, value1) < 0 ||
         virHashAddEntry(hash, keyb, value2) < 0) {
@@ -601,8 +613,8 @@ testHashEqual(const void *data ATTRIBUTE_UNUSED)
     char value3_u[] = "O";
     char value4_u[] = "P";
 
-    if (!(hash1 = virHashCreate(0, NULL)) ||
-        !(hash2 = virHashCreate(0, NULL)) ||
+    if (!(hash1 = testHashCreate(0)) ||
+        !(hash2 = testHashCreate(0)) ||
         virHashAddEntry(hash1, keya, value1_l) < 0 ||
         virHashAddEntry(hash1, keyb, value2_l) < 0 ||
         virHashAddEntry(hash1, keyc, value3_l) < 0 ||
@@ -658,10 +670,209 @@ cleanup:
 }
 
 
+static int
+testHashChurnSearcher(const void *payload,
+                      const void *name ATTRIBUTE_UNUSED,
+                      const void *data ATTRIBUTE_UNUSED)
+{
+    return (size_t) payload % 5 == 0;
+}
+
+/*
+ * Interleave additions and removals on a growing table, checking
+ * every entry is still where expected after each round
+ */
+static int
+testHashChurn(const void *data ATTRIBUTE_UNUSED)
+{
+    virHashTablePtr hash;
+    char key[32];
+    size_t round, i;
+    size_t count = 0;
+    int ret = -1;
+
+    if (!(hash = testHashCreate(0)))
+        return -1;
+
+    for (round = 1; round <= 16; round++) {
+        /* add a growing number of entries, then drop every third one */
+        for (i = 0; i < round * 100; i++) {
+            snprintf(key, sizeof(key), "churn-%zu-%zu", round, i);
+            if (virHashAddEntry(hash, key, (void *) (i + 1)) < 0)
+                goto cleanup;
+            count++;
+        }
+        for (i = 0; i < round * 100; i += 3) {
+            snprintf(key, sizeof(key), "churn-%zu-%zu", round, i);
+            if (virHashRemoveEntry(hash, key) < 0) {
+                testError("\nentry \"%s\" could not be removed\n", key);
+                goto cleanup;
+            }
+            count--;
+        }
+
+        for (i = 0; i < round * 100; i++) {
+            void *payload;
+
+            snprintf(key, sizeof(key), "churn-%zu-%zu", round, i);
+            payload = virHashLookup(hash, key);
+            if (i % 3 == 0 ? payload != NULL : payload != (void *) (i + 1)) {
+                testError("\nunexpected payload for \"%s\"\n", key);
+                goto cleanup;
+            }
+        }
+
+        if (testHashCheckCount(hash, count) < 0)
+            goto cleanup;
+    }
+
+    count -= virHashRemoveSet(hash, testHashChurnSearcher, NULL);
+    if (testHashCheckCount(hash, count) < 0 ||
+        virHashSearch(hash, testHashChurnSearcher, NULL))
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virHashFree(hash);
+    return ret;
+}
+
+
+typedef int (*testHashBenchFunc)(virHashTablePtr hash,
+                                 char **keys,
+                                 size_t count);
+
+static int
+testHashBenchInsert(virHashTablePtr hash, char **keys, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if (virHashAddEntry(hash, keys[i], keys[i]) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int
+testHashBenchLookup(virHashTablePtr hash, char **keys, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if (virHashLookup(hash, keys[(i * 7919) % count]) !=
+            keys[(i * 7919) % count])
+            return -1;
+    }
+    return 0;
+}
+
+static void
+testHashBenchIter(void *payload ATTRIBUTE_UNUSED,
+                  const void *name ATTRIBUTE_UNUSED,
+                  void *data)
+{
+    (*(size_t *)data)++;
+}
+
+static int
+testHashBenchIterate(virHashTablePtr hash,
+                     char **keys ATTRIBUTE_UNUSED,
+                     size_t count)
+{
+    size_t seen = 0;
+
+    if (virHashForEach(hash, testHashBenchIter, &seen) != (ssize_t) count ||
+        seen != count)
+        return -1;
+    return 0;
+}
+
+static int
+testHashBenchRun(virHashTablePtr hash,
+                 testHashBenchFunc func,
+                 char **keys,
+                 size_t count,
+                 unsigned long long *elapsed)
+{
+    unsigned long long start, end;
+
+    if (virTimeMillisNow(&start) < 0 ||
+        func(hash, keys, count) < 0 ||
+        virTimeMillisNow(&end) < 0)
+        return -1;
+
+    *elapsed = end - start;
+    return 0;
+}
+
+/*
+ * Compare chained and open addressing tables, printing the time
+ * taken by each operation in debug mode
+ */
+static int
+testHashBench(const void *data)
+{
+    const struct testInfo *info = data;
+    testHashBenchFunc funcs[] = {
+        testHashBenchInsert, testHashBenchLookup, testHashBenchIterate,
+    };
+    unsigned long long elapsed[2][ARRAY_CARDINALITY(funcs)];
+    virHashTablePtr hash = NULL;
+    char **keys = NULL;
+    size_t i, j;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(keys, info->count) < 0)
+        return -1;
+
+    for (i = 0; i < info->count; i++) {
+        if (virAsprintf(&keys[i], "bench-%zu", i) < 0)
+            goto cleanup;
+    }
+
+    for (i = 0; i < 2; i++) {
+        if (!(hash = i ? virHashCreateOpen(0, NULL) : virHashCreate(0, NULL)))
+            goto cleanup;
+
+        for (j = 0; j < ARRAY_CARDINALITY(funcs); j++) {
+            if (testHashBenchRun(hash, funcs[j], keys, info->count,
+                                 &elapsed[i][j]) < 0)
+                goto cleanup;
+        }
+
+        if (testHashCheckCount(hash, info->count) < 0)
+            goto cleanup;
+
+        virHashFree(hash);
+        hash = NULL;
+    }
+
+    if (virTestGetDebug())
+        fprintf(stderr, "\n%8zu entries: insert %llu/%llu ms, "
+                "lookup %llu/%llu ms, iterate %llu/%llu ms (chained/open)\n",
+                info->count,
+                elapsed[0][0], elapsed[1][0],
+                elapsed[0][1], elapsed[1][1],
+                elapsed[0][2], elapsed[1][2]);
+
+    ret = 0;
+
+cleanup:
+    virHashFree(hash);
+    for (i = 0; keys && i < info->count; i++)
+        VIR_FREE(keys[i]);
+    VIR_FREE(keys);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
     int ret = 0;
+    size_t i;
 
 #define DO_TEST_FULL(name, cmd, data, count)                        \
     do {                                                            \
@@ -682,20 +893,34 @@ mymain(void)
 #define DO_TEST(name, cmd)                                          \
     DO_TEST_FULL(name, cmd, NULL, -1)
 
-    DO_TEST_COUNT("Grow", Grow, 1);
-    DO_TEST_COUNT("Grow", Grow, 10);
-    DO_TEST_COUNT("Grow", Grow, 42);
-    DO_TEST("Update", Update);
-    DO_TEST("Remove", Remove);
-    DO_TEST_DATA("Remove in ForEach", RemoveForEach, Some);
-    DO_TEST_DATA("Remove in ForEach", RemoveForEach, All);
-    DO_TEST_DATA("Remove in ForEach", RemoveForEach, Forbidden);
-    DO_TEST("Steal", Steal);
-    DO_TEST("Forbidden ops in ForEach", ForEach);
-    DO_TEST("RemoveSet", RemoveSet);
-    DO_TEST("Search", Search);
-    DO_TEST("GetItems", GetItems);
-    DO_TEST("Equal", Equal);
+    /* Run everything against both chained and open addressing tables */
+    for (i = 0; i < 2; i++) {
+        testHashOpen = i;
+
+        DO_TEST_COUNT("Grow", Grow, 1);
+        DO_TEST_COUNT("Grow", Grow, 10);
+        DO_TEST_COUNT("Grow", Grow, 42);
+        DO_TEST("Update", Update);
+        DO_TEST("Remove", Remove);
+        DO_TEST_DATA("Remove in ForEach", RemoveForEach, Some);
+        DO_TEST_DATA("Remove in ForEach", RemoveForEach, All);
+        DO_TEST_DATA("Remove in ForEach", RemoveForEach, Forbidden);
+        DO_TEST("Steal", Steal);
+        DO_TEST("Forbidden ops in ForEach", ForEach);
+        DO_TEST("RemoveSet", RemoveSet);
+        DO_TEST("Search", Search);
+        DO_TEST("GetItems", GetItems);
+        DO_TEST("Equal", Equal);
+        DO_TEST("Churn", Churn);
+    }
+
+    /* Timings are only of interest when asked for */
+    if (virTestGetDebug()) {
+        DO_TEST_COUNT("Benchmark", Bench, 1000);
+        DO_TEST_COUNT("Benchmark", Bench, 10000);
+        DO_TEST_COUNT("Benchmark", Bench, 100000);
+        DO_TEST_COUNT("Benchmark", Bench, 1000000);
+    }
 
     return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
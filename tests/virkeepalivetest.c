@@ -0,0 +1,345 @@
+/*
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "testutils.h"
+#include "virerror.h"
+#include "viralloc.h"
+
+#include "rpc/virkeepalive.h"
+
+#define VIR_FROM_THIS VIR_FROM_RPC
+
+extern int virKeepAliveSchedAdd(virKeepAlivePtr ka, time_t deadline);
+extern bool virKeepAliveSchedRemove(virKeepAlivePtr ka);
+extern int virKeepAliveSchedTakeDue(time_t now,
+                                    virKeepAlivePtr **due,
+                                    size_t *ndue);
+
+#define NKA 8
+
+static virKeepAlivePtr ka[NKA];
+static time_t base;
+
+/* What the scheduler last did to its timer */
+static int timeout = -1;
+static size_t nupdates;
+
+
+static int
+testAddTimeout(int frequency ATTRIBUTE_UNUSED,
+               virEventTimeoutCallback cb ATTRIBUTE_UNUSED,
+               void *opaque ATTRIBUTE_UNUSED,
+               virFreeCallback ff ATTRIBUTE_UNUSED)
+{
+    return 1;
+}
+
+static void
+testUpdateTimeout(int timer ATTRIBUTE_UNUSED, int frequency)
+{
+    timeout = frequency;
+    nupdates++;
+}
+
+static int
+testRemoveTimeout(int timer ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+
+
+static int
+testSend(void *client ATTRIBUTE_UNUSED, virNetMessagePtr msg)
+{
+    virNetMessageFree(msg);
+    return 0;
+}
+
+static void
+testDead(void *client ATTRIBUTE_UNUSED)
+{
+}
+
+static void
+testFree(void *client ATTRIBUTE_UNUSED)
+{
+}
+
+
+static int
+testAdd(size_t i, time_t delay)
+{
+    if (virKeepAliveSchedAdd(ka[i], base + delay) < 0) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nCannot queue keepalive %zu\n", i);
+        return -1;
+    }
+    return 0;
+}
+
+
+/* Removing @i must succeed exactly if it is @queued */
+static int
+testRemove(size_t i, bool queued)
+{
+    if (virKeepAliveSchedRemove(ka[i]) != queued) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nKeepalive %zu %s queued\n",
+                    i, queued ? "was not" : "was still");
+        return -1;
+    }
+    if (queued)
+        virObjectUnref(ka[i]);
+    return 0;
+}
+
+
+/* Everything due after @delay must come out as @expect, in order,
+ * terminated by -1 */
+static int
+testTakeDue(time_t delay, const int *expect)
+{
+    virKeepAlivePtr *due;
+    size_t ndue;
+    size_t i;
+    int ret = -1;
+
+    if (virKeepAliveSchedTakeDue(base + delay, &due, &ndue) < 0)
+        return -1;
+
+    for (i = 0 ; i < ndue ; i++) {
+        if (expect[i] < 0 || due[i] != ka[expect[i]]) {
+            if (virTestGetDebug())
+                fprintf(stderr, "\nUnexpected keepalive at position %zu\n", i);
+            goto cleanup;
+        }
+    }
+    if (expect[ndue] >= 0) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nOnly %zu keepalives due\n", ndue);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    for (i = 0 ; i < ndue ; i++)
+        virObjectUnref(due[i]);
+    VIR_FREE(due);
+    return ret;
+}
+
+
+/* The timer must be set for @delay from now, or off if -1. Some
+ * seconds may have passed since the test started. */
+static int
+testArmed(time_t delay)
+{
+    if (delay < 0 ? timeout != -1 :
+        timeout > delay * 1000 || timeout < (delay - 2) * 1000) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nExpected timeout %lld s, got %d ms\n",
+                    (long long) delay, timeout);
+        return -1;
+    }
+    return 0;
+}
+
+
+/* Whatever is left is the previous test's failure, don't let it
+ * spill over into the next one */
+static void
+testEmpty(void)
+{
+    size_t i;
+
+    for (i = 0 ; i < NKA ; i++) {
+        if (virKeepAliveSchedRemove(ka[i]))
+            virObjectUnref(ka[i]);
+    }
+}
+
+
+/* Keepalives come out earliest first, however they went in */
+static int
+testOrder(const void *opaque ATTRIBUTE_UNUSED)
+{
+    static const time_t delays[NKA] = { 50, 30, 80, 10, 70, 20, 60, 40 };
+    static const int first[] = { 3, 5, 1, 7, -1 };
+    static const int rest[] = { 0, 6, 4, 2, -1 };
+    static const int none[] = { -1 };
+    size_t i;
+    int ret = -1;
+
+    for (i = 0 ; i < NKA ; i++) {
+        if (testAdd(i, delays[i]) < 0)
+            goto cleanup;
+    }
+
+    /* Being queued already keeps the earlier deadline */
+    if (testAdd(3, 75) < 0)
+        goto cleanup;
+
+    if (testTakeDue(5, none) < 0 ||
+        testTakeDue(45, first) < 0 ||
+        testTakeDue(100, rest) < 0 ||
+        testTakeDue(100, none) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    testEmpty();
+    return ret;
+}
+
+
+/* Taking out entries anywhere in the heap keeps the rest in order */
+static int
+testRemoval(const void *opaque ATTRIBUTE_UNUSED)
+{
+    static const time_t delays[NKA] = { 70, 80, 60, 50, 30, 10, 20, 40 };
+    static const int left[] = { 6, 4, 3, 2, 0, -1 };
+    size_t i;
+    int ret = -1;
+
+    for (i = 0 ; i < NKA ; i++) {
+        if (testAdd(i, delays[i]) < 0)
+            goto cleanup;
+    }
+
+    /* One in the middle, a leaf whose replacement from the other
+     * subtree has to move up, and the top */
+    if (testRemove(7, true) < 0 ||
+        testRemove(1, true) < 0 ||
+        testRemove(5, true) < 0 ||
+        testRemove(1, false) < 0)
+        goto cleanup;
+
+    if (testTakeDue(100, left) < 0 ||
+        testRemove(6, false) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    testEmpty();
+    return ret;
+}
+
+
+/* The timer follows the earliest deadline, touching the event loop
+ * only when that changes, and a keepalive put back after its turn
+ * takes its new place */
+static int
+testRearm(const void *opaque ATTRIBUTE_UNUSED)
+{
+    static const int first[] = { 0, -1 };
+    static const int second[] = { 1, -1 };
+    static const int none[] = { -1 };
+    size_t updates;
+    int ret = -1;
+
+    if (testAdd(0, 300) < 0 ||
+        testArmed(300) < 0)
+        goto cleanup;
+
+    updates = nupdates;
+    if (testAdd(1, 600) < 0 ||
+        testArmed(300) < 0)
+        goto cleanup;
+    if (nupdates != updates) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nTimer updated for a later deadline\n");
+        goto cleanup;
+    }
+
+    if (testAdd(2, 100) < 0 ||
+        testArmed(100) < 0 ||
+        testRemove(2, true) < 0 ||
+        testArmed(300) < 0)
+        goto cleanup;
+
+    /* Firing early finds nothing, but the timer is set again */
+    updates = nupdates;
+    if (testTakeDue(0, none) < 0 ||
+        testArmed(300) < 0)
+        goto cleanup;
+    if (nupdates == updates) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nTimer not set again after firing\n");
+        goto cleanup;
+    }
+
+    /* 0 is due and goes back for another interval, behind 1 */
+    if (testTakeDue(300, first) < 0 ||
+        testArmed(600) < 0 ||
+        testAdd(0, 900) < 0 ||
+        testArmed(600) < 0 ||
+        testTakeDue(600, second) < 0 ||
+        testArmed(900) < 0 ||
+        testRemove(0, true) < 0 ||
+        testArmed(-1) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    testEmpty();
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    size_t i;
+
+    virEventRegisterImpl(NULL, NULL, NULL,
+                         testAddTimeout, testUpdateTimeout, testRemoveTimeout);
+
+    for (i = 0 ; i < NKA ; i++) {
+        if (!(ka[i] = virKeepAliveNew(5, 3, &ka[i],
+                                      testSend, testDead, testFree))) {
+            ret = -1;
+            goto cleanup;
+        }
+    }
+
+    base = time(NULL);
+
+    if (virtTestRun("Keepalive heap order", 1, testOrder, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Keepalive heap removal", 1, testRemoval, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Keepalive timer rearm", 1, testRearm, NULL) < 0)
+        ret = -1;
+
+cleanup:
+    for (i = 0 ; i < NKA ; i++)
+        virObjectUnref(ka[i]);
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -0,0 +1,558 @@
+/*
+ * virlogtest.c: test the log filtering cache of call sites
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "testutils.h"
+#include "internal.h"
+#include "virlog.h"
+#include "virtime.h"
+#include "virthread.h"
+#include "virutil.h"
+#include "viralloc.h"
+#include "virstring.h"
+#include "virendian.h"
+#include "viratomic.h"
+
+#define BENCH_LOOPS (10 * 1000 * 1000)
+#define DUMP_THREADS 8
+#define DUMP_LOOPS 2000
+#define ASYNC_LOOPS 10000
+#define RESIZE_LOOPS 300
+
+static int counter;
+
+struct testDumpData {
+    virMutex lock;
+    int serial;
+};
+
+
+/* A single call site, so that its cached decision gets reused */
+static void
+testLogDebug(void)
+{
+    VIR_DEBUG("counter=%d", counter++);
+}
+
+
+/* Returns true if something was logged since the last call */
+static bool
+testLogSomething(void)
+{
+    char *log = virtTestLogContentAndReset();
+    bool ret = log && *log;
+
+    VIR_FREE(log);
+    return ret;
+}
+
+
+static int
+testLogCallsite(const void *opaque ATTRIBUTE_UNUSED)
+{
+    if (virLogSetBufferSize(0) < 0 ||
+        virLogSetDefaultPriority(VIR_LOG_WARN) < 0)
+        return -1;
+
+    testLogSomething();
+
+    testLogDebug();
+    if (testLogSomething()) {
+        if (virTestGetDebug())
+            fprintf(stderr, "debug message logged at default priority\n");
+        return -1;
+    }
+
+    if (virLogDefineFilter("virlogtest", VIR_LOG_DEBUG, 0) < 0)
+        return -1;
+    testLogDebug();
+    if (!testLogSomething()) {
+        if (virTestGetDebug())
+            fprintf(stderr, "new filter not applied to the call site\n");
+        return -1;
+    }
+
+    if (virLogDefineFilter("virlogtest", VIR_LOG_ERROR, 0) < 0)
+        return -1;
+    testLogDebug();
+    if (testLogSomething()) {
+        if (virTestGetDebug())
+            fprintf(stderr, "changed filter not applied to the call site\n");
+        return -1;
+    }
+
+    if (virLogSetDefaultPriority(VIR_LOG_DEBUG) < 0)
+        return -1;
+    testLogDebug();
+    if (testLogSomething()) {
+        if (virTestGetDebug())
+            fprintf(stderr, "filter overridden by default priority\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+testLogBench(const void *opaque ATTRIBUTE_UNUSED)
+{
+    unsigned long long start, cached, uncached;
+    int i;
+
+    if (virLogDefineFilter("virlogtest", VIR_LOG_WARN, 0) < 0 ||
+        virLogSetBufferSize(0) < 0)
+        return -1;
+
+    if (virTimeMillisNow(&start) < 0)
+        return -1;
+    for (i = 0; i < BENCH_LOOPS; i++)
+        VIR_DEBUG("loop %d", i);
+    if (virTimeMillisNow(&cached) < 0)
+        return -1;
+    for (i = 0; i < BENCH_LOOPS; i++)
+        virLogMessage(VIR_LOG_FROM_FILE, VIR_LOG_DEBUG,
+                      __FILE__, __LINE__, __func__, NULL, "loop %d", i);
+    if (virTimeMillisNow(&uncached) < 0)
+        return -1;
+
+    if (testLogSomething())
+        return -1;
+
+    if (virTestGetDebug())
+        fprintf(stderr, "\n%d disabled messages: %llu ms cached, "
+                "%llu ms uncached\n", BENCH_LOOPS,
+                cached - start, uncached - cached);
+
+    return 0;
+}
+
+
+struct testDumpThread {
+    struct testDumpData *data;
+    int id;
+};
+
+
+/* Log alternately on our own, and serialized with the other threads */
+static void
+testLogDumpWorker(void *opaque)
+{
+    struct testDumpThread *thread = opaque;
+    int i;
+
+    for (i = 0; i < DUMP_LOOPS; i++) {
+        if (i % 2) {
+            virMutexLock(&thread->data->lock);
+            VIR_DEBUG("serial=%d", thread->data->serial++);
+            virMutexUnlock(&thread->data->lock);
+        } else {
+            VIR_DEBUG("thread=%d count=%d", thread->id, i);
+        }
+    }
+}
+
+
+static int
+testLogDumpCheck(char *dump)
+{
+    int last[DUMP_THREADS];
+    int seen[DUMP_THREADS] = { 0 };
+    int serial = 0;
+    char *saveptr = NULL;
+    char *line;
+    const char *tmp;
+    int i;
+
+    for (i = 0; i < DUMP_THREADS; i++)
+        last[i] = -1;
+
+    for (line = strtok_r(dump, "\n", &saveptr); line;
+         line = strtok_r(NULL, "\n", &saveptr)) {
+        int id, count;
+
+        if ((tmp = strstr(line, "serial="))) {
+            if (sscanf(tmp, "serial=%d", &count) != 1 ||
+                count != serial) {
+                if (virTestGetDebug())
+                    fprintf(stderr, "expected serial=%d: %s\n", serial, line);
+                return -1;
+            }
+            serial++;
+        } else if ((tmp = strstr(line, "thread="))) {
+            if (sscanf(tmp, "thread=%d count=%d", &id, &count) != 2 ||
+                id < 0 || id >= DUMP_THREADS || count <= last[id]) {
+                if (virTestGetDebug())
+                    fprintf(stderr, "out of order: %s\n", line);
+                return -1;
+            }
+            last[id] = count;
+            seen[id]++;
+        }
+    }
+
+    if (serial != DUMP_THREADS * DUMP_LOOPS / 2) {
+        if (virTestGetDebug())
+            fprintf(stderr, "found %d serialized messages\n", serial);
+        return -1;
+    }
+    for (i = 0; i < DUMP_THREADS; i++) {
+        if (seen[i] != DUMP_LOOPS / 2) {
+            if (virTestGetDebug())
+                fprintf(stderr, "found %d messages from thread %d\n",
+                        seen[i], i);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int
+testLogDump(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testDumpData data = { .serial = 0 };
+    struct testDumpThread threads[DUMP_THREADS];
+    virThread workers[DUMP_THREADS];
+    char *path = NULL;
+    char *outputs = NULL;
+    char *dump = NULL;
+    int ret = -1;
+    int i;
+
+    if (virMutexInit(&data.lock) < 0)
+        return -1;
+
+    if (virAsprintf(&path, "%s/virlogtest-%d.log",
+                    abs_builddir, (int) getpid()) < 0 ||
+        virAsprintf(&outputs, "1:file:%s", path) < 0)
+        goto cleanup;
+
+    /* Big enough for nothing to be dropped */
+    if (virLogSetDefaultPriority(VIR_LOG_ERROR) < 0 ||
+        virLogSetBufferSize(1024) < 0 ||
+        virLogParseOutputs(outputs) != 1)
+        goto cleanup;
+
+    for (i = 0; i < DUMP_THREADS; i++) {
+        threads[i].data = &data;
+        threads[i].id = i;
+        if (virThreadCreate(&workers[i], true,
+                            testLogDumpWorker, &threads[i]) < 0)
+            break;
+    }
+    if (i < DUMP_THREADS) {
+        while (--i >= 0)
+            virThreadJoin(&workers[i]);
+        goto cleanup;
+    }
+    for (i = 0; i < DUMP_THREADS; i++)
+        virThreadJoin(&workers[i]);
+
+    virLogEmergencyDumpAll(SIGUSR2);
+
+    if (virFileReadAll(path, 16 * 1024 * 1024, &dump) < 0)
+        goto cleanup;
+
+    ret = testLogDumpCheck(dump);
+
+cleanup:
+    virLogReset();
+    if (path)
+        unlink(path);
+    VIR_FREE(path);
+    VIR_FREE(outputs);
+    VIR_FREE(dump);
+    virMutexDestroy(&data.lock);
+    return ret;
+}
+
+
+struct testResizeThread {
+    int id;
+    int *stop;
+};
+
+
+static void
+testLogResizeWorker(void *opaque)
+{
+    struct testResizeThread *thread = opaque;
+    int i = 0;
+
+    while (!virAtomicIntGet(thread->stop))
+        VIR_DEBUG("thread=%d count=%d", thread->id, i++);
+}
+
+
+static void
+testLogResizer(void *opaque)
+{
+    struct testResizeThread *thread = opaque;
+    int i = 0;
+
+    while (!virAtomicIntGet(thread->stop))
+        virLogSetBufferSize(i++ % 3);
+}
+
+
+/* Dump the rings while they get resized and their owners keep
+ * recording */
+static int
+testLogResize(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testResizeThread threads[DUMP_THREADS + 1];
+    virThread workers[DUMP_THREADS + 1];
+    int stop = 0;
+    int ret = -1;
+    int i, n;
+
+    if (virLogSetDefaultPriority(VIR_LOG_ERROR) < 0 ||
+        virLogParseOutputs("1:file:/dev/null") != 1)
+        goto cleanup;
+
+    for (n = 0; n < DUMP_THREADS + 1; n++) {
+        threads[n].id = n;
+        threads[n].stop = &stop;
+        if (virThreadCreate(&workers[n], true,
+                            n ? testLogResizeWorker : testLogResizer,
+                            &threads[n]) < 0)
+            break;
+    }
+
+    for (i = 0; i < RESIZE_LOOPS; i++)
+        virLogEmergencyDumpAll(SIGUSR2);
+
+    virAtomicIntSet(&stop, 1);
+    while (--n >= 0)
+        virThreadJoin(&workers[n]);
+
+    ret = 0;
+
+cleanup:
+    virLogReset();
+    return ret;
+}
+
+
+struct testAsyncData {
+    int queue;
+    bool binary;
+};
+
+
+/* Check the messages written by an async output, returns their count */
+static int
+testLogAsyncCheckText(char *content,
+                      int *noted)
+{
+    char *saveptr = NULL;
+    char *line;
+    const char *tmp;
+    int next = 0;
+    int n = 0;
+    int count;
+
+    for (line = strtok_r(content, "\n", &saveptr); line;
+         line = strtok_r(NULL, "\n", &saveptr)) {
+        if ((tmp = strstr(line, "Log queue overflow, ")) &&
+            sscanf(tmp, "Log queue overflow, %d", &count) == 1) {
+            *noted += count;
+        } else if ((tmp = strstr(line, "async=")) &&
+                   sscanf(tmp, "async=%d", &count) == 1) {
+            if (count < next) {
+                if (virTestGetDebug())
+                    fprintf(stderr, "out of order: %s\n", line);
+                return -1;
+            }
+            next = count + 1;
+            n++;
+        }
+    }
+
+    return n;
+}
+
+
+static int
+testLogAsyncCheckBinary(const char *content,
+                        size_t len,
+                        int *noted)
+{
+    const char *cur = content + strlen("VIRLOG01");
+    const char *end = content + len;
+    int next = 0;
+    int n = 0;
+
+    if (len < strlen("VIRLOG01") || memcmp(content, "VIRLOG01", 8) != 0)
+        return -1;
+
+    while (cur < end) {
+        unsigned int reclen, filelen, funclen;
+        char *msg = NULL;
+        int count;
+
+        if (end - cur < 32 ||
+            (reclen = virReadBufInt32LE(cur)) < 32 ||
+            reclen > end - cur ||
+            cur[4] != 1 || cur[6] < VIR_LOG_DEBUG || cur[6] > VIR_LOG_ERROR)
+            return -1;
+
+        filelen = cur[28] | (cur[29] << 8);
+        funclen = cur[30] | (cur[31] << 8);
+        if (32 + filelen + funclen > reclen)
+            return -1;
+        if (!(msg = strndup(cur + 32 + filelen + funclen,
+                            reclen - 32 - filelen - funclen)))
+            return -1;
+
+        if (sscanf(msg, "Log queue overflow, %d", &count) == 1) {
+            *noted += count;
+        } else if (sscanf(msg, "async=%d", &count) == 1) {
+            if (count < next ||
+                filelen < strlen("virlogtest.c") ||
+                !STRPREFIX(cur + 32 + filelen - strlen("virlogtest.c"),
+                           "virlogtest.c")) {
+                VIR_FREE(msg);
+                return -1;
+            }
+            next = count + 1;
+            n++;
+        }
+        VIR_FREE(msg);
+        cur += reclen;
+    }
+
+    return n;
+}
+
+
+static int
+testLogAsync(const void *opaque)
+{
+    const struct testAsyncData *data = opaque;
+    char *path = NULL;
+    char *outputs = NULL;
+    char *content = NULL;
+    int len;
+    int written;
+    int noted = 0;
+    int ret = -1;
+    int i;
+
+    if (virAsprintf(&path, "%s/virlogtest-%d.log",
+                    abs_builddir, (int) getpid()) < 0 ||
+        virAsprintf(&outputs, "1:%s:%s",
+                    data->binary ? "binaryfile" : "asyncfile", path) < 0)
+        goto cleanup;
+
+    if (virLogReset() < 0 ||
+        virLogSetBufferSize(0) < 0 ||
+        virLogSetQueueSize(data->queue) < 0 ||
+        virLogParseFilters("1:virlogtest") != 1 ||
+        virLogParseOutputs(outputs) != 1)
+        goto cleanup;
+
+    for (i = 0; i < ASYNC_LOOPS; i++)
+        VIR_DEBUG("async=%d", i);
+
+    /* Waits for the writer to be done */
+    virLogReset();
+
+    if ((len = virFileReadAll(path, 16 * 1024 * 1024, &content)) < 0)
+        goto cleanup;
+
+    if (data->binary)
+        written = testLogAsyncCheckBinary(content, len, &noted);
+    else
+        written = testLogAsyncCheckText(content, &noted);
+
+    if (virTestGetDebug())
+        fprintf(stderr, "\n%d messages written, %d reported as dropped\n",
+                written, noted);
+
+    if (written < 0 || written + noted != ASYNC_LOOPS)
+        goto cleanup;
+    /* Nothing may be lost while there is room */
+    if (data->queue >= ASYNC_LOOPS && noted != 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virLogReset();
+    if (path)
+        unlink(path);
+    VIR_FREE(path);
+    VIR_FREE(outputs);
+    VIR_FREE(content);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    /* Messages go to stderr rather than to the test log then */
+    if (getenv("LIBVIRT_DEBUG"))
+        return EXIT_AM_SKIP;
+
+    if (virtTestRun("Call site filter cache", 1,
+                    testLogCallsite, NULL) < 0)
+        ret = -1;
+    /* Only measured on request, it takes a while */
+    if (virTestGetDebug() &&
+        virtTestRun("Disabled message cost", 1,
+                    testLogBench, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Dump ordering across threads", 1,
+                    testLogDump, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Resize rings while dumping", 1,
+                    testLogResize, NULL) < 0)
+        ret = -1;
+
+#define DO_TEST_ASYNC(name, queue, binary)                              \
+    do {                                                                \
+        struct testAsyncData data = { queue, binary };                  \
+        if (virtTestRun("Async output " name, 1,                        \
+                        testLogAsync, &data) < 0)                       \
+            ret = -1;                                                   \
+    } while (0)
+
+    /* A tiny queue, so that it overflows */
+    DO_TEST_ASYNC("text drop", 4, false);
+    DO_TEST_ASYNC("binary drop", 4, true);
+    DO_TEST_ASYNC("text", ASYNC_LOOPS, false);
+    DO_TEST_ASYNC("binary", ASYNC_LOOPS, true);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
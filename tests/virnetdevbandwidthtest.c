@@ -0,0 +1,324 @@
+/*
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+
+#include "testutils.h"
+
+#if defined(__linux__) && defined(HAVE_LIBNL)
+
+# include <arpa/inet.h>
+# include <linux/if_ether.h>
+# include <linux/pkt_cls.h>
+# include <linux/pkt_sched.h>
+# include <linux/rtnetlink.h>
+
+# include "virnetdevbandwidth.h"
+# include "virnetlink.h"
+# include "virmacaddr.h"
+
+# define VIR_FROM_THIS VIR_FROM_NONE
+
+extern struct nl_msg *virNetDevBandwidthHTBClassMsgNew(int ifindex,
+                                                       int flags,
+                                                       uint32_t parent,
+                                                       uint32_t classid,
+                                                       unsigned long long rate,
+                                                       unsigned long long ceil,
+                                                       unsigned long long burst);
+extern struct nl_msg *virNetDevBandwidthU32FilterMsgNew(int ifindex,
+                                                        uint32_t parent,
+                                                        uint32_t prio,
+                                                        const virMacAddrPtr mac,
+                                                        uint32_t classid,
+                                                        unsigned long long rate,
+                                                        unsigned long long burst);
+
+/* Nothing here makes the library read /proc/net/psched, so the
+ * scheduler clock keeps its defaults: ticks are microseconds and
+ * HZ is 100. */
+# define TEST_HZ 100
+
+static const virMacAddr testMac = {
+    { 0xfe, 0x54, 0x00, 0x12, 0x34, 0x56 }
+};
+
+
+/* Microseconds it takes to send @size bytes at @rate bytes/s; the
+ * library computes it in floating point, hence the slack of one */
+static bool
+testXmitTimeIs(uint32_t ticks,
+               unsigned long long rate,
+               unsigned long long size)
+{
+    unsigned long long usec = size * 1000000 / rate;
+
+    return ticks == usec || ticks + 1 == usec;
+}
+
+
+/* @rtab must give the time to send 1, 2, ..., 256 cells of
+ * 1 << @cell_log bytes at @rate bytes/s */
+static bool
+testRateTableIs(const struct tc_ratespec *spec,
+                const uint32_t *rtab,
+                unsigned long long rate,
+                int cell_log)
+{
+    size_t i;
+
+    if (spec->rate != rate || spec->cell_log != cell_log ||
+        spec->cell_align != -1)
+        return false;
+
+    for (i = 0; i < 256; i++) {
+        if (!testXmitTimeIs(rtab[i], rate, (i + 1) << cell_log))
+            return false;
+    }
+    return true;
+}
+
+
+/* Parse the tcmsg in front of @nl_msg and its TCA_OPTIONS into @opts */
+static struct tcmsg *
+testParseTC(struct nl_msg *nl_msg,
+            int type,
+            const char *kind,
+            struct nlattr **opts,
+            int maxtype)
+{
+    struct nlmsghdr *hdr = nlmsg_hdr(nl_msg);
+    struct nlattr *tb[TCA_MAX + 1];
+
+    if (hdr->nlmsg_type != type ||
+        nlmsg_parse(hdr, sizeof(struct tcmsg), tb, TCA_MAX, NULL) < 0 ||
+        !tb[TCA_KIND] || STRNEQ(nla_data(tb[TCA_KIND]), kind) ||
+        !tb[TCA_OPTIONS] ||
+        nla_parse_nested(opts, maxtype, tb[TCA_OPTIONS], NULL) < 0)
+        return NULL;
+
+    return nlmsg_data(hdr);
+}
+
+
+struct testHTBData {
+    int flags;
+    unsigned long long rate;    /* kbytes/s */
+    unsigned long long ceil;    /* kbytes/s, 0 for @rate */
+    unsigned long long burst;   /* kbytes, 0 for the default */
+};
+
+static int
+testHTBClass(const void *opaque)
+{
+    const struct testHTBData *data = opaque;
+    struct nl_msg *nl_msg = NULL;
+    struct nlattr *opts[TCA_HTB_MAX + 1];
+    struct tcmsg *tcm;
+    struct tc_htb_opt *opt;
+    unsigned long long rate = data->rate * 1000;
+    unsigned long long ceil = data->ceil ? data->ceil * 1000 : rate;
+    unsigned long long buffer;
+    unsigned long long cbuffer;
+    int ret = -1;
+
+    /* tc's defaults: enough for one tick at full rate, plus an MTU */
+    buffer = data->burst ? data->burst * 1024 : rate / TEST_HZ + 1600;
+    cbuffer = ceil / TEST_HZ + 1600;
+
+    if (!(nl_msg = virNetDevBandwidthHTBClassMsgNew(7, data->flags,
+                                                    TC_H_MAKE(1 << 16, 1),
+                                                    TC_H_MAKE(1 << 16, 3),
+                                                    data->rate, data->ceil,
+                                                    data->burst)))
+        goto cleanup;
+
+    if (!(tcm = testParseTC(nl_msg, RTM_NEWTCLASS, "htb",
+                            opts, TCA_HTB_MAX)) ||
+        tcm->tcm_ifindex != 7 ||
+        tcm->tcm_parent != TC_H_MAKE(1 << 16, 1) ||
+        tcm->tcm_handle != TC_H_MAKE(1 << 16, 3) ||
+        (nlmsg_hdr(nl_msg)->nlmsg_flags & (NLM_F_CREATE | NLM_F_EXCL)) !=
+        data->flags)
+        goto cleanup;
+
+    if (!opts[TCA_HTB_PARMS] || nla_len(opts[TCA_HTB_PARMS]) != sizeof(*opt) ||
+        !opts[TCA_HTB_RTAB] || nla_len(opts[TCA_HTB_RTAB]) != 1024 ||
+        !opts[TCA_HTB_CTAB] || nla_len(opts[TCA_HTB_CTAB]) != 1024)
+        goto cleanup;
+    opt = nla_data(opts[TCA_HTB_PARMS]);
+
+    /* An MTU of 1600 bytes fits 256 cells of 8 bytes */
+    if (!testRateTableIs(&opt->rate, nla_data(opts[TCA_HTB_RTAB]), rate, 3) ||
+        !testRateTableIs(&opt->ceil, nla_data(opts[TCA_HTB_CTAB]), ceil, 3) ||
+        !testXmitTimeIs(opt->buffer, rate, buffer) ||
+        !testXmitTimeIs(opt->cbuffer, ceil, cbuffer))
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    nlmsg_free(nl_msg);
+    return ret;
+}
+
+
+struct testU32Data {
+    bool mac;                   /* match the MAC or all traffic */
+    unsigned long long rate;    /* kbytes/s, 0 not to police */
+    unsigned long long burst;   /* kbytes */
+};
+
+static int
+testU32Filter(const void *opaque)
+{
+    const struct testU32Data *data = opaque;
+    struct nl_msg *nl_msg = NULL;
+    struct nlattr *opts[TCA_U32_MAX + 1];
+    struct nlattr *police[TCA_POLICE_MAX + 1];
+    struct tcmsg *tcm;
+    struct tc_u32_sel *sel;
+    struct tc_police *tbf;
+    int ret = -1;
+
+    if (!(nl_msg = virNetDevBandwidthU32FilterMsgNew(7, TC_H_MAKE(1 << 16, 0),
+                                                     5,
+                                                     data->mac ?
+                                                     (virMacAddrPtr) &testMac :
+                                                     NULL,
+                                                     TC_H_MAKE(1 << 16, 5),
+                                                     data->rate, data->burst)))
+        goto cleanup;
+
+    if (!(tcm = testParseTC(nl_msg, RTM_NEWTFILTER, "u32",
+                            opts, TCA_U32_MAX)) ||
+        tcm->tcm_ifindex != 7 ||
+        tcm->tcm_parent != TC_H_MAKE(1 << 16, 0) ||
+        tcm->tcm_info != TC_H_MAKE(5 << 16, htons(ETH_P_IP)) ||
+        !opts[TCA_U32_CLASSID] ||
+        nla_get_u32(opts[TCA_U32_CLASSID]) != TC_H_MAKE(1 << 16, 5) ||
+        !opts[TCA_U32_SEL] || nla_len(opts[TCA_U32_SEL]) < sizeof(*sel))
+        goto cleanup;
+
+    sel = nla_data(opts[TCA_U32_SEL]);
+    if (!(sel->flags & TC_U32_TERMINAL) ||
+        nla_len(opts[TCA_U32_SEL]) !=
+        sizeof(*sel) + sel->nkeys * sizeof(sel->keys[0]))
+        goto cleanup;
+
+    if (data->mac) {
+        /* 'match u16 0x0800 0xffff at -2', the ethertype, then
+         * 'match u32 0x00123456 0xffffffff at -12' and
+         * 'match u16 0xfe54 0xffff at -14', the source MAC */
+        if (sel->nkeys != 3 ||
+            sel->keys[0].off != -4 ||
+            ntohl(sel->keys[0].val) != 0x0800 ||
+            ntohl(sel->keys[0].mask) != 0xffff ||
+            sel->keys[1].off != -12 ||
+            ntohl(sel->keys[1].val) != 0x00123456 ||
+            sel->keys[1].mask != 0xffffffff ||
+            sel->keys[2].off != -16 ||
+            ntohl(sel->keys[2].val) != 0xfe54 ||
+            ntohl(sel->keys[2].mask) != 0xffff)
+            goto cleanup;
+    } else {
+        /* 'match ip src 0.0.0.0/0' */
+        if (sel->nkeys != 1 ||
+            sel->keys[0].off != 12 ||
+            sel->keys[0].val != 0 || sel->keys[0].mask != 0)
+            goto cleanup;
+    }
+
+    if (!data->rate) {
+        if (opts[TCA_U32_POLICE])
+            goto cleanup;
+    } else {
+        unsigned long long rate = data->rate * 1000;
+
+        if (!opts[TCA_U32_POLICE] ||
+            nla_parse_nested(police, TCA_POLICE_MAX,
+                             opts[TCA_U32_POLICE], NULL) < 0 ||
+            !police[TCA_POLICE_TBF] ||
+            nla_len(police[TCA_POLICE_TBF]) != sizeof(*tbf) ||
+            !police[TCA_POLICE_RATE] ||
+            nla_len(police[TCA_POLICE_RATE]) != 1024)
+            goto cleanup;
+        tbf = nla_data(police[TCA_POLICE_TBF]);
+
+        /* 'mtu 64kb drop' fits 256 cells of 512 bytes */
+        if (tbf->action != TC_POLICE_SHOT || tbf->mtu != 64 * 1024 ||
+            !testRateTableIs(&tbf->rate, nla_data(police[TCA_POLICE_RATE]),
+                             rate, 9) ||
+            !testXmitTimeIs(tbf->burst, rate, data->burst * 1024))
+            goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    nlmsg_free(nl_msg);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+# define DO_TEST_HTB(name, flags, rate, ceil, burst)                    \
+    do {                                                                \
+        struct testHTBData data = { flags, rate, ceil, burst };         \
+        if (virtTestRun("HTB class " name, 1,                           \
+                        testHTBClass, &data) < 0)                       \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST_HTB("rate only", NLM_F_CREATE | NLM_F_EXCL, 1000, 0, 0);
+    DO_TEST_HTB("with ceil", NLM_F_CREATE | NLM_F_EXCL, 1000, 2000, 0);
+    DO_TEST_HTB("with burst", NLM_F_CREATE | NLM_F_EXCL, 1000, 2000, 64);
+    DO_TEST_HTB("change", 0, 12345, 54321, 0);
+
+# define DO_TEST_U32(name, mac, rate, burst)                            \
+    do {                                                                \
+        struct testU32Data data = { mac, rate, burst };                 \
+        if (virtTestRun("u32 filter " name, 1,                          \
+                        testU32Filter, &data) < 0)                      \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST_U32("all traffic", false, 0, 0);
+    DO_TEST_U32("all traffic policed", false, 500, 100);
+    DO_TEST_U32("source MAC", true, 0, 0);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
+
+#else
+
+int
+main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* __linux__ && HAVE_LIBNL */
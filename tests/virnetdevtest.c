@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+
+#include "testutils.h"
+
+#if defined(__linux__) && defined(HAVE_LIBNL)
+
+# include <errno.h>
+# include <net/if.h>
+# include <linux/rtnetlink.h>
+
+# include "virnetdev.h"
+# include "virnetlink.h"
+# include "virmacaddr.h"
+
+# define VIR_FROM_THIS VIR_FROM_NONE
+
+extern struct nl_msg *virNetDevLinkSetMsgNew(const char *ifname,
+                                             const virNetDevLinkInfoPtr info);
+extern int virNetDevLinkInfoParse(struct nlmsghdr *resp,
+                                  virNetDevLinkInfoPtr info);
+extern bool virNetDevLinkMasterIgnored(const virNetDevLinkInfoPtr info,
+                                       int err,
+                                       const virNetDevLinkInfoPtr actual);
+
+static const virMacAddr testMac = {
+    { 0xfe, 0x54, 0x00, 0x12, 0x34, 0x56 }
+};
+
+
+/* Only the attributes selected by the fields end up in the request */
+static int
+testLinkSetMsg(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virNetDevLinkInfo info;
+    struct nl_msg *nl_msg = NULL;
+    struct nlmsghdr *hdr;
+    struct ifinfomsg *ifi;
+    struct nlattr *tb[IFLA_MAX + 1];
+    int ret = -1;
+
+    memset(&info, 0, sizeof(info));
+    info.fields = VIR_NETDEV_LINK_MAC | VIR_NETDEV_LINK_MTU |
+        VIR_NETDEV_LINK_ONLINE | VIR_NETDEV_LINK_MASTER;
+    info.mac = testMac;
+    info.mtu = 9000;
+    info.online = true;
+    info.master = 3;
+
+    if (!(nl_msg = virNetDevLinkSetMsgNew("vnet0", &info)))
+        goto cleanup;
+
+    hdr = nlmsg_hdr(nl_msg);
+    ifi = nlmsg_data(hdr);
+    if (hdr->nlmsg_type != RTM_SETLINK ||
+        nlmsg_parse(hdr, sizeof(*ifi), tb, IFLA_MAX, NULL) < 0 ||
+        ifi->ifi_change != IFF_UP || ifi->ifi_flags != IFF_UP ||
+        !tb[IFLA_IFNAME] || STRNEQ(nla_data(tb[IFLA_IFNAME]), "vnet0") ||
+        !tb[IFLA_ADDRESS] || nla_len(tb[IFLA_ADDRESS]) != VIR_MAC_BUFLEN ||
+        virMacAddrCmpRaw(&testMac, nla_data(tb[IFLA_ADDRESS])) != 0 ||
+        !tb[IFLA_MTU] || nla_get_u32(tb[IFLA_MTU]) != 9000 ||
+        !tb[IFLA_MASTER] || nla_get_u32(tb[IFLA_MASTER]) != 3)
+        goto cleanup;
+    nlmsg_free(nl_msg);
+
+    /* Taking the link down, nothing else */
+    info.fields = VIR_NETDEV_LINK_ONLINE;
+    info.online = false;
+    if (!(nl_msg = virNetDevLinkSetMsgNew("vnet0", &info)))
+        goto cleanup;
+
+    hdr = nlmsg_hdr(nl_msg);
+    ifi = nlmsg_data(hdr);
+    if (nlmsg_parse(hdr, sizeof(*ifi), tb, IFLA_MAX, NULL) < 0 ||
+        ifi->ifi_change != IFF_UP || ifi->ifi_flags != 0 ||
+        tb[IFLA_ADDRESS] || tb[IFLA_MTU] || tb[IFLA_MASTER])
+        goto cleanup;
+    nlmsg_free(nl_msg);
+
+    /* The MTU alone leaves the flags untouched */
+    info.fields = VIR_NETDEV_LINK_MTU;
+    if (!(nl_msg = virNetDevLinkSetMsgNew("vnet0", &info)))
+        goto cleanup;
+
+    hdr = nlmsg_hdr(nl_msg);
+    ifi = nlmsg_data(hdr);
+    if (nlmsg_parse(hdr, sizeof(*ifi), tb, IFLA_MAX, NULL) < 0 ||
+        ifi->ifi_change != 0 ||
+        tb[IFLA_ADDRESS] || !tb[IFLA_MTU] || tb[IFLA_MASTER])
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    nlmsg_free(nl_msg);
+    return ret;
+}
+
+
+/* Build the kernel's answer to RTM_GETLINK, @master 0 for none */
+static struct nl_msg *
+testLinkReply(int type,
+              int master)
+{
+    struct ifinfomsg ifinfo = {
+        .ifi_family = AF_UNSPEC,
+        .ifi_index = 7,
+        .ifi_flags = IFF_UP | IFF_BROADCAST,
+    };
+    struct nl_msg *nl_msg;
+
+    if (!(nl_msg = nlmsg_alloc_simple(type, 0)))
+        return NULL;
+
+    if (nlmsg_append(nl_msg, &ifinfo, sizeof(ifinfo), NLMSG_ALIGNTO) < 0 ||
+        nla_put(nl_msg, IFLA_IFNAME, sizeof("vnet0"), "vnet0") < 0 ||
+        nla_put(nl_msg, IFLA_ADDRESS, VIR_MAC_BUFLEN, testMac.addr) < 0 ||
+        nla_put_u32(nl_msg, IFLA_MTU, 1500) < 0 ||
+        (master && nla_put_u32(nl_msg, IFLA_MASTER, master) < 0)) {
+        nlmsg_free(nl_msg);
+        return NULL;
+    }
+
+    return nl_msg;
+}
+
+static int
+testLinkInfoParse(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virNetDevLinkInfo info;
+    struct nl_msg *nl_msg = NULL;
+    int ret = -1;
+
+    if (!(nl_msg = testLinkReply(RTM_NEWLINK, 3)) ||
+        virNetDevLinkInfoParse(nlmsg_hdr(nl_msg), &info) < 0)
+        goto cleanup;
+
+    if (info.fields != (VIR_NETDEV_LINK_MAC | VIR_NETDEV_LINK_MTU |
+                        VIR_NETDEV_LINK_ONLINE | VIR_NETDEV_LINK_MASTER) ||
+        info.ifindex != 7 || !info.online || info.mtu != 1500 ||
+        virMacAddrCmp(&info.mac, &testMac) != 0 || info.master != 3)
+        goto cleanup;
+    nlmsg_free(nl_msg);
+
+    if (!(nl_msg = testLinkReply(RTM_NEWLINK, 0)) ||
+        virNetDevLinkInfoParse(nlmsg_hdr(nl_msg), &info) < 0 ||
+        (info.fields & VIR_NETDEV_LINK_MASTER) || info.master != 0)
+        goto cleanup;
+    nlmsg_free(nl_msg);
+
+    /* Anything but a link description is refused */
+    if (!(nl_msg = testLinkReply(RTM_DELLINK, 3)))
+        goto cleanup;
+    if (virNetDevLinkInfoParse(nlmsg_hdr(nl_msg), &info) == 0 ||
+        virNetDevLinkInfoParse(NULL, &info) == 0)
+        goto cleanup;
+    virResetLastError();
+
+    ret = 0;
+
+cleanup:
+    nlmsg_free(nl_msg);
+    return ret;
+}
+
+
+struct testMasterData {
+    bool wanted;       /* whether the request sets the bridge */
+    int err;           /* the kernel's answer to it */
+    int actual;        /* bridge read back afterwards, 0 for none */
+    bool ignored;      /* whether the bridge ioctl is needed */
+};
+
+static int
+testLinkMasterIgnored(const void *opaque)
+{
+    const struct testMasterData *data = opaque;
+    virNetDevLinkInfo info;
+    virNetDevLinkInfo actual;
+
+    memset(&info, 0, sizeof(info));
+    info.fields = VIR_NETDEV_LINK_MTU;
+    info.mtu = 1500;
+    if (data->wanted) {
+        info.fields |= VIR_NETDEV_LINK_MASTER;
+        info.master = 3;
+    }
+
+    memset(&actual, 0, sizeof(actual));
+    actual.fields = VIR_NETDEV_LINK_MTU | VIR_NETDEV_LINK_ONLINE;
+    actual.mtu = 1500;
+    if (data->actual) {
+        actual.fields |= VIR_NETDEV_LINK_MASTER;
+        actual.master = data->actual;
+    }
+
+    if (virNetDevLinkMasterIgnored(&info, data->err, &actual) !=
+        data->ignored)
+        return -1;
+    return 0;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virtTestRun("Set link request", 1,
+                    testLinkSetMsg, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Parse link reply", 1,
+                    testLinkInfoParse, NULL) < 0)
+        ret = -1;
+
+# define DO_TEST_MASTER(name, wanted, err, actual, ignored)             \
+    do {                                                                \
+        struct testMasterData data = { wanted, err, actual, ignored };  \
+        if (virtTestRun("Bridge port " name, 1,                         \
+                        testLinkMasterIgnored, &data) < 0)              \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST_MASTER("not asked for", false, 0, 0, false);
+    DO_TEST_MASTER("added", true, 0, 3, false);
+    DO_TEST_MASTER("silently ignored", true, 0, 0, true);
+    DO_TEST_MASTER("on another bridge", true, 0, 5, true);
+    DO_TEST_MASTER("not supported", true, -EOPNOTSUPP, 0, true);
+    DO_TEST_MASTER("refused", true, -EPERM, 0, false);
+    DO_TEST_MASTER("failed without bridge", false, -EOPNOTSUPP, 0, false);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
+
+#else
+
+int
+main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* __linux__ && HAVE_LIBNL */
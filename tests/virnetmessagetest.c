@@ -46,7 +46,7 @@ static int testMessageHeaderEncode(const void *args ATTRIBUTE_UNUSED)
     };
     /* According to doc to virNetMessageEncodeHeader(&msg):
      * msg->buffer will be this long */
-    unsigned long msg_buf_size = VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX;
+    unsigned long msg_buf_size = VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX;
     int ret = -1;
 
     if (!msg) {
@@ -525,6 +525,107 @@ cleanup:
     return ret;
 }
 
+/* A payload of @len arbitrary bytes */
+struct testPayloadData {
+    size_t len;
+    bool fits;
+};
+
+static bool_t testPayloadFilter(XDR *xdr, struct testPayloadData *data)
+{
+    char *buf = NULL;
+    u_int len = data->len;
+    bool_t ret;
+    size_t i;
+
+    if (VIR_ALLOC_N(buf, len) < 0)
+        return FALSE;
+    for (i = 0 ; i < len ; i++)
+        buf[i] = i % 251;
+
+    ret = xdr_bytes(xdr, &buf, &len, VIR_NET_MESSAGE_MAX);
+    VIR_FREE(buf);
+    return ret;
+}
+
+/* Payloads bigger than VIR_NET_MESSAGE_INITIAL make the buffer
+ * grow, possibly several times, up to VIR_NET_MESSAGE_MAX */
+static int testMessagePayloadEncodeGrow(const void *args)
+{
+    const struct testPayloadData *data = args;
+    virNetMessagePtr msg = virNetMessageNew(true);
+    /* The payload follows the length word and the header */
+    size_t start = VIR_NET_MESSAGE_HEADER_XDR_LEN + VIR_NET_MESSAGE_HEADER_MAX;
+    size_t len = start + 4 + VIR_DIV_UP(data->len, 4) * 4;
+    XDR xdr;
+    unsigned int msglen;
+    unsigned int payloadlen;
+    size_t i;
+    int ret = -1;
+
+    if (!msg) {
+        virReportOOMError();
+        return -1;
+    }
+
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_REPLY;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_OK;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (virNetMessageEncodePayload(msg, (xdrproc_t)testPayloadFilter,
+                                   (void *)data) < 0) {
+        if (!data->fits) {
+            virResetLastError();
+            ret = 0;
+        }
+        goto cleanup;
+    }
+
+    if (!data->fits) {
+        VIR_DEBUG("Expect a payload of %zu bytes to be refused", data->len);
+        goto cleanup;
+    }
+
+    if (msg->bufferLength != len || msg->bufferOffset != 0) {
+        VIR_DEBUG("Expect message length %zu offset 0 got %zu offset %zu",
+                  len, msg->bufferLength, msg->bufferOffset);
+        goto cleanup;
+    }
+
+    xdrmem_create(&xdr, msg->buffer, msg->bufferLength, XDR_DECODE);
+    if (!xdr_u_int(&xdr, &msglen) ||
+        !xdr_setpos(&xdr, start) ||
+        !xdr_u_int(&xdr, &payloadlen)) {
+        xdr_destroy(&xdr);
+        goto cleanup;
+    }
+    xdr_destroy(&xdr);
+
+    if (msglen != len || payloadlen != data->len) {
+        VIR_DEBUG("Expect length %zu payload %zu got %u payload %u",
+                  len, data->len, msglen, payloadlen);
+        goto cleanup;
+    }
+
+    for (i = 0 ; i < data->len ; i++) {
+        if (msg->buffer[start + 4 + i] != (char)(i % 251)) {
+            VIR_DEBUG("Payload differs at byte %zu", i);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+cleanup:
+    virNetMessageFree(msg);
+    return ret;
+}
+
 
 static int
 mymain(void)
@@ -548,6 +649,20 @@ mymain(void)
     if (virtTestRun("Message Payload Stream Encode", 1, testMessagePayloadStreamEncode, NULL) < 0)
         ret = -1;
 
+#define DO_TEST_GROW(name, len, fits)                                   \
+    do {                                                                \
+        struct testPayloadData data = { len, fits };                    \
+        if (virtTestRun("Message Payload Encode " name, 1,              \
+                        testMessagePayloadEncodeGrow, &data) < 0)       \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST_GROW("Initial Buffer", 1000, true);
+    DO_TEST_GROW("Grow Once", 100 * 1024, true);
+    DO_TEST_GROW("Grow Three Times", 3 * 1024 * 1024, true);
+    DO_TEST_GROW("Largest", VIR_NET_MESSAGE_MAX - 28, true);
+    DO_TEST_GROW("Too Large", VIR_NET_MESSAGE_MAX - 27, false);
+
     return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
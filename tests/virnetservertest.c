@@ -0,0 +1,314 @@
+/*
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#include "testutils.h"
+#include "virerror.h"
+#include "viralloc.h"
+#include "virfile.h"
+
+#include "rpc/virnetserver.h"
+
+#define VIR_FROM_THIS VIR_FROM_RPC
+
+#define TEST_PROGRAM 0x11223344
+
+extern int virNetServerFlowPush(virNetServerPtr srv,
+                                virNetServerClientPtr client,
+                                virNetServerProgramPtr prog,
+                                virNetMessagePtr msg);
+extern virNetMessagePtr virNetServerFlowPop(virNetServerPtr srv,
+                                            unsigned long long now,
+                                            virNetServerClientPtr *client,
+                                            unsigned long long *wait);
+
+/* A point in time, in milliseconds, at which no bucket has been
+ * looked at yet; 0 would mean the clock could not be read */
+#define TEST_START 100000
+
+static virNetServerPtr srv;
+static virNetServerProgramPtr prog;
+
+
+static virNetServerClientPtr testClientNew(void)
+{
+    virNetServerClientPtr client = NULL;
+    virNetSocketPtr sock = NULL;
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        virReportSystemError(errno, "%s", "Cannot create socket pair");
+        return NULL;
+    }
+
+    if (virNetSocketNewConnectSockFD(fds[0], &sock) < 0) {
+        VIR_FORCE_CLOSE(fds[0]);
+        goto cleanup;
+    }
+
+    client = virNetServerClientNew(sock, VIR_NET_SERVER_SERVICE_AUTH_NONE,
+                                   false, 1,
+#ifdef WITH_GNUTLS
+                                   NULL,
+#endif
+                                   NULL, NULL, NULL, NULL);
+
+cleanup:
+    VIR_FORCE_CLOSE(fds[1]);
+    virObjectUnref(sock);
+    return client;
+}
+
+
+static void testClientFree(virNetServerClientPtr client)
+{
+    if (!client)
+        return;
+
+    virNetServerClientClose(client);
+    virObjectUnref(client);
+}
+
+
+/* Queue a call of @proc identified by @serial for @client */
+static int testPush(virNetServerClientPtr client,
+                    int proc,
+                    unsigned serial)
+{
+    virNetMessagePtr msg;
+
+    if (!(msg = virNetMessageNew(true)))
+        return -1;
+
+    msg->header.prog = TEST_PROGRAM;
+    msg->header.vers = 1;
+    msg->header.proc = proc;
+    msg->header.type = VIR_NET_CALL;
+    msg->header.serial = serial;
+
+    if (virNetServerFlowPush(srv, client, prog, msg) < 0) {
+        virNetMessageFree(msg);
+        return -1;
+    }
+    return 0;
+}
+
+
+/* The next job at @now must be the call @serial of @client,
+ * or if @client is NULL, nothing for another @wait ms */
+static int testPop(unsigned long long now,
+                   virNetServerClientPtr client,
+                   unsigned serial,
+                   unsigned long long wait)
+{
+    virNetServerClientPtr actualClient = NULL;
+    unsigned long long actualWait = 0;
+    virNetMessagePtr msg;
+    int ret = -1;
+
+    msg = virNetServerFlowPop(srv, now, &actualClient, &actualWait);
+
+    if (!client) {
+        if (msg) {
+            if (virTestGetDebug())
+                fprintf(stderr, "\nUnexpected call %u\n", msg->header.serial);
+            goto cleanup;
+        }
+        if (actualWait != wait) {
+            if (virTestGetDebug())
+                fprintf(stderr, "\nExpected wait %llu, got %llu\n",
+                        wait, actualWait);
+            goto cleanup;
+        }
+    } else {
+        if (!msg) {
+            if (virTestGetDebug())
+                fprintf(stderr, "\nExpected call %u, got none\n", serial);
+            goto cleanup;
+        }
+        if (actualClient != client || msg->header.serial != serial) {
+            if (virTestGetDebug())
+                fprintf(stderr, "\nExpected call %u, got %u\n",
+                        serial, msg->header.serial);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    virNetMessageFree(msg);
+    return ret;
+}
+
+
+/* Each client with queued work gets a turn, in order */
+static int testFairQueue(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virNetServerClientPtr a = NULL;
+    virNetServerClientPtr b = NULL;
+    virNetServerClientPtr c = NULL;
+    int ret = -1;
+
+    if (!(a = testClientNew()) || !(b = testClientNew()) ||
+        !(c = testClientNew()))
+        goto cleanup;
+
+    if (testPush(a, 1, 1) < 0 || testPush(a, 1, 2) < 0 ||
+        testPush(a, 1, 3) < 0 || testPush(b, 1, 4) < 0 ||
+        testPush(b, 1, 5) < 0)
+        goto cleanup;
+
+    if (testPop(0, a, 1, 0) < 0 ||
+        testPop(0, b, 4, 0) < 0)
+        goto cleanup;
+
+    /* A newcomer queues behind those already waiting */
+    if (testPush(c, 1, 6) < 0 || testPush(a, 1, 7) < 0)
+        goto cleanup;
+
+    if (testPop(0, a, 2, 0) < 0 ||
+        testPop(0, b, 5, 0) < 0 ||
+        testPop(0, c, 6, 0) < 0 ||
+        testPop(0, a, 3, 0) < 0 ||
+        testPop(0, a, 7, 0) < 0 ||
+        testPop(0, NULL, 0, 0) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    testClientFree(a);
+    testClientFree(b);
+    testClientFree(c);
+    return ret;
+}
+
+
+/* A client over its rate waits without holding back others,
+ * unless it went away, in which case its backlog drains */
+static int testClientRate(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virNetServerClientPtr a = NULL;
+    virNetServerClientPtr b = NULL;
+    int ret = -1;
+
+    /* One request per second, two at once after idling */
+    if (virNetServerSetRateLimits(srv, 1, 2, 0, 0) < 0)
+        goto cleanup;
+
+    if (!(a = testClientNew()) || !(b = testClientNew()))
+        goto cleanup;
+
+    if (testPush(a, 1, 1) < 0 || testPush(a, 1, 2) < 0 ||
+        testPush(a, 1, 3) < 0 || testPush(a, 1, 4) < 0 ||
+        testPush(a, 1, 5) < 0 || testPush(b, 1, 6) < 0)
+        goto cleanup;
+
+    if (testPop(TEST_START, a, 1, 0) < 0 ||
+        testPop(TEST_START, b, 6, 0) < 0 ||
+        testPop(TEST_START, a, 2, 0) < 0 ||
+        testPop(TEST_START, NULL, 0, 1000) < 0 ||
+        testPop(TEST_START + 600, NULL, 0, 400) < 0 ||
+        testPop(TEST_START + 1000, a, 3, 0) < 0 ||
+        testPop(TEST_START + 1000, NULL, 0, 1000) < 0)
+        goto cleanup;
+
+    virNetServerClientClose(a);
+    if (testPop(TEST_START + 1000, a, 4, 0) < 0 ||
+        testPop(TEST_START + 1000, a, 5, 0) < 0 ||
+        testPop(TEST_START + 1000, NULL, 0, 0) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    ignore_value(virNetServerSetRateLimits(srv, 0, 0, 0, 0));
+    testClientFree(a);
+    testClientFree(b);
+    return ret;
+}
+
+
+/* A procedure over its rate waits, whoever calls it */
+static int testProcRate(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virNetServerClientPtr a = NULL;
+    virNetServerClientPtr b = NULL;
+    int ret = -1;
+
+    /* One call of each procedure per second */
+    if (virNetServerSetRateLimits(srv, 0, 0, 1, 1) < 0)
+        goto cleanup;
+
+    if (!(a = testClientNew()) || !(b = testClientNew()))
+        goto cleanup;
+
+    if (testPush(a, 1, 1) < 0 || testPush(a, 2, 2) < 0 ||
+        testPush(b, 1, 3) < 0 || testPush(b, 2, 4) < 0)
+        goto cleanup;
+
+    /* b's turn is skipped while procedure 1 is throttled */
+    if (testPop(TEST_START, a, 1, 0) < 0 ||
+        testPop(TEST_START, a, 2, 0) < 0 ||
+        testPop(TEST_START, NULL, 0, 1000) < 0 ||
+        testPop(TEST_START + 1000, b, 3, 0) < 0 ||
+        testPop(TEST_START + 1000, b, 4, 0) < 0 ||
+        testPop(TEST_START + 1000, NULL, 0, 0) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    ignore_value(virNetServerSetRateLimits(srv, 0, 0, 0, 0));
+    testClientFree(a);
+    testClientFree(b);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (!(srv = virNetServerNew(0, 0, 0, 10, -1, 0, false, NULL,
+                                NULL, NULL, NULL, NULL)) ||
+        !(prog = virNetServerProgramNew(TEST_PROGRAM, 1, NULL, 0))) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (virtTestRun("Fair queueing", 1, testFairQueue, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Client rate limit", 1, testClientRate, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Procedure rate limit", 1, testProcRate, NULL) < 0)
+        ret = -1;
+
+cleanup:
+    virObjectUnref(prog);
+    virObjectUnref(srv);
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
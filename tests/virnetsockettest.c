@@ -329,6 +329,166 @@ cleanup:
     return ret;
 }
 
+# if WITH_ZLIB
+#  define COMPRESS_DATA_LEN (300 * 1024)
+
+static int testSocketCompressPair(virNetSocketPtr *ssock,
+                                  virNetSocketPtr *csock)
+{
+    int fds[2];
+
+    if (socketpair(PF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        virReportSystemError(errno, "%s", "Unable to create socket pair");
+        return -1;
+    }
+
+    if (virNetSocketNewListenFD(fds[0], ssock) < 0) {
+        VIR_FORCE_CLOSE(fds[0]);
+        VIR_FORCE_CLOSE(fds[1]);
+        return -1;
+    }
+
+    if (virNetSocketNewConnectSockFD(fds[1], csock) < 0) {
+        VIR_FORCE_CLOSE(fds[1]);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* Half very compressible text, half pseudo random noise, so that
+ * both deflated and stored chunks end up on the wire */
+static char *testSocketCompressData(void)
+{
+    char *data;
+    unsigned int seed = 42;
+    size_t i;
+
+    if (VIR_ALLOC_N(data, COMPRESS_DATA_LEN) < 0)
+        return NULL;
+
+    for (i = 0 ; i < COMPRESS_DATA_LEN / 2 ; i++)
+        data[i] = "<domain type='kvm'>"[i % 19];
+    for (; i < COMPRESS_DATA_LEN ; i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (seed >> 16) & 0xff;
+    }
+
+    return data;
+}
+
+
+static int testSocketCompressTransfer(const void *data ATTRIBUTE_UNUSED)
+{
+    virNetSocketPtr ssock = NULL;
+    virNetSocketPtr csock = NULL;
+    char *in = NULL;
+    char *out = NULL;
+    size_t woff = 0, roff = 0;
+    int ret = -1;
+
+    if (testSocketCompressPair(&ssock, &csock) < 0)
+        goto cleanup;
+
+    if (virNetSocketSetCompression(ssock, 1024) < 0 ||
+        virNetSocketSetCompression(csock, 1024) < 0)
+        goto cleanup;
+
+    if (!(in = testSocketCompressData()) ||
+        VIR_ALLOC_N(out, COMPRESS_DATA_LEN) < 0)
+        goto cleanup;
+
+    /* Both ends are non-blocking, so interleave writing and reading
+     * to keep the socket buffers from filling up */
+    while (roff < COMPRESS_DATA_LEN) {
+        ssize_t got;
+
+        if (woff < COMPRESS_DATA_LEN) {
+            if ((got = virNetSocketWrite(csock, in + woff,
+                                         COMPRESS_DATA_LEN - woff)) < 0)
+                goto cleanup;
+            woff += got;
+        }
+
+        if ((got = virNetSocketRead(ssock, out + roff,
+                                    COMPRESS_DATA_LEN - roff)) < 0)
+            goto cleanup;
+        roff += got;
+    }
+
+    if (memcmp(in, out, COMPRESS_DATA_LEN) != 0) {
+        VIR_DEBUG("Data corrupted by compressed transfer");
+        goto cleanup;
+    }
+
+    if (virNetSocketHasCachedData(ssock) ||
+        virNetSocketHasPendingData(csock)) {
+        VIR_DEBUG("Unexpected leftover data after transfer");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(in);
+    VIR_FREE(out);
+    virObjectUnref(ssock);
+    virObjectUnref(csock);
+    return ret;
+}
+
+
+static int testSocketCompressShrink(const void *data ATTRIBUTE_UNUSED)
+{
+    virNetSocketPtr ssock = NULL;
+    virNetSocketPtr csock = NULL;
+    char *in = NULL;
+    char *out = NULL;
+    size_t len = COMPRESS_DATA_LEN / 2;
+    size_t woff = 0, roff = 0;
+    ssize_t got;
+    int ret = -1;
+
+    if (testSocketCompressPair(&ssock, &csock) < 0)
+        goto cleanup;
+
+    /* Only the writer compresses, so we see what hits the wire */
+    if (virNetSocketSetCompression(csock, 1024) < 0)
+        goto cleanup;
+
+    if (!(in = testSocketCompressData()) ||
+        VIR_ALLOC_N(out, len) < 0)
+        goto cleanup;
+
+    while (woff < len) {
+        if ((got = virNetSocketWrite(csock, in + woff, len - woff)) <= 0)
+            goto cleanup;
+        woff += got;
+    }
+
+    while ((got = virNetSocketRead(ssock, out + roff, len - roff)) > 0)
+        roff += got;
+    if (got < 0)
+        goto cleanup;
+
+    if (roff == 0 || roff > len / 10) {
+        VIR_DEBUG("Expected compressible data to shrink, got %zu bytes", roff);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(in);
+    VIR_FREE(out);
+    virObjectUnref(ssock);
+    virObjectUnref(csock);
+    return ret;
+}
+# endif
+
+
 static int testSocketCommandNormal(const void *data ATTRIBUTE_UNUSED)
 {
     virNetSocketPtr csock = NULL; /* Client socket */
@@ -497,6 +657,13 @@ mymain(void)
     if (virtTestRun("Socket UNIX Addrs", 1, testSocketUNIXAddrs, NULL) < 0)
         ret = -1;
 
+# if WITH_ZLIB
+    if (virtTestRun("Socket compressed transfer", 1, testSocketCompressTransfer, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Socket compressed data shrinks", 1, testSocketCompressShrink, NULL) < 0)
+        ret = -1;
+# endif
+
     if (virtTestRun("Socket External Command /dev/zero", 1, testSocketCommandNormal, NULL) < 0)
         ret = -1;
     if (virtTestRun("Socket External Command /dev/does-not-exist", 1, testSocketCommandFail, NULL) < 0)
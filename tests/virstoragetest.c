@@ -213,35 +213,21 @@ struct testChainData
 };
 
 static int
-testStorageChain(const void *args)
+testStorageChainCheck(const struct testChainData *data,
+                      virStorageFileMetadataPtr meta)
 {
-    const struct testChainData *data = args;
-    int ret = -1;
-    virStorageFileMetadataPtr meta;
     virStorageFileMetadataPtr elt;
     int i = 0;
 
-    meta = virStorageFileGetMetadata(data->start, data->format, -1, -1,
-                                     (data->flags & ALLOW_PROBE) != 0);
-    if (!meta) {
-        if (data->flags & EXP_FAIL) {
-            virResetLastError();
-            ret = 0;
-        }
-        goto cleanup;
-    } else if (data->flags & EXP_FAIL) {
-        fprintf(stderr, "call should have failed\n");
-        goto cleanup;
-    }
     if (data->flags & EXP_WARN) {
         if (!virGetLastError()) {
             fprintf(stderr, "call should have warned\n");
-            goto cleanup;
+            return -1;
         }
         virResetLastError();
     } else if (virGetLastError()) {
         fprintf(stderr, "call should not have warned\n");
-        goto cleanup;
+        return -1;
     }
 
     elt = meta;
@@ -251,7 +237,7 @@ testStorageChain(const void *args)
 
         if (i == data->nfiles) {
             fprintf(stderr, "probed chain was too long\n");
-            goto cleanup;
+            return -1;
         }
 
         if (virAsprintf(&expect,
@@ -273,13 +259,13 @@ testStorageChain(const void *args)
             virReportOOMError();
             VIR_FREE(expect);
             VIR_FREE(actual);
-            goto cleanup;
+            return -1;
         }
         if (STRNEQ(expect, actual)) {
             virtTestDifference(stderr, expect, actual);
             VIR_FREE(expect);
             VIR_FREE(actual);
-            goto cleanup;
+            return -1;
         }
         VIR_FREE(expect);
         VIR_FREE(actual);
@@ -288,12 +274,132 @@ testStorageChain(const void *args)
     }
     if (i != data->nfiles) {
         fprintf(stderr, "probed chain was too short\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+testStorageChain(const void *args)
+{
+    const struct testChainData *data = args;
+    int ret = -1;
+    virStorageFileMetadataPtr meta;
+    virStorageFileMetadataPtr cached = NULL;
+    size_t reused = 0;
+    int expReused = 0;
+    int i;
+
+    meta = virStorageFileGetMetadata(data->start, data->format, -1, -1,
+                                     (data->flags & ALLOW_PROBE) != 0);
+    if (!meta) {
+        if (data->flags & EXP_FAIL) {
+            virResetLastError();
+            ret = 0;
+        }
+        goto cleanup;
+    } else if (data->flags & EXP_FAIL) {
+        fprintf(stderr, "call should have failed\n");
+        goto cleanup;
+    }
+    if (testStorageChainCheck(data, meta) < 0)
+        goto cleanup;
+
+    /* Nothing changed, so the same chain must be found again without
+     * reading any of its images, except for those whose backing file
+     * is missing, which are read again to warn about it again */
+    cached = virStorageFileGetMetadataCached(data->start, data->format,
+                                             -1, -1,
+                                             (data->flags & ALLOW_PROBE) != 0,
+                                             &meta, &reused);
+    if (!cached) {
+        fprintf(stderr, "cached call should not have failed\n");
+        goto cleanup;
+    }
+    if (testStorageChainCheck(data, cached) < 0)
+        goto cleanup;
+    for (i = 0; i < data->nfiles; i++) {
+        if (!data->files[i].expBackingStoreRaw || data->files[i].expIsFile)
+            expReused++;
+    }
+    if (reused != expReused) {
+        fprintf(stderr, "reused %zu images instead of %d\n",
+                reused, expReused);
+        goto cleanup;
+    }
+
+    ret = 0;
+cleanup:
+    virStorageFileFreeMetadata(meta);
+    virStorageFileFreeMetadata(cached);
+    return ret;
+}
+
+/* A backing file which was missing when the chain was first
+ * resolved must be found once it appears, even though the image
+ * referring to it did not change */
+static int
+testStorageChainAppear(const void *args ATTRIBUTE_UNUSED)
+{
+    int ret = -1;
+    virCommandPtr cmd = NULL;
+    virStorageFileMetadataPtr meta = NULL;
+    virStorageFileMetadataPtr cached = NULL;
+    char *canonappear = NULL;
+    size_t reused = 0;
+
+    const testFileData qcow2_missing = {
+        NULL, "appear", ".", VIR_STORAGE_FILE_NONE, false, 1024, false,
+    };
+    const testFileData qcow2_found = {
+        NULL, "appear", ".", VIR_STORAGE_FILE_RAW, true, 1024, false,
+    };
+    const testFileData raw = {
+        NULL, NULL, NULL, VIR_STORAGE_FILE_NONE, false, 0, false,
+    };
+    const testFileData chainMissing[] = { qcow2_missing };
+    testFileData chainFound[] = { qcow2_found, raw };
+    const struct testChainData missing = {
+        "qcow2", VIR_STORAGE_FILE_QCOW2, chainMissing,
+        ARRAY_CARDINALITY(chainMissing), EXP_WARN,
+    };
+    const struct testChainData found = {
+        "qcow2", VIR_STORAGE_FILE_QCOW2, chainFound,
+        ARRAY_CARDINALITY(chainFound), EXP_PASS,
+    };
+
+    meta = virStorageFileGetMetadata("qcow2", VIR_STORAGE_FILE_QCOW2,
+                                     -1, -1, false);
+    if (!meta || testStorageChainCheck(&missing, meta) < 0)
+        goto cleanup;
+
+    cmd = virCommandNewArgList("cp", "raw", "appear", NULL);
+    if (virCommandRun(cmd, NULL) < 0)
+        goto cleanup;
+    if (!(canonappear = canonicalize_file_name(datadir "/appear"))) {
+        virReportOOMError();
+        goto cleanup;
+    }
+    chainFound[0].expBackingStore = canonappear;
+
+    cached = virStorageFileGetMetadataCached("qcow2", VIR_STORAGE_FILE_QCOW2,
+                                             -1, -1, false, &meta, &reused);
+    if (!cached || testStorageChainCheck(&found, cached) < 0)
+        goto cleanup;
+    if (reused != 0) {
+        fprintf(stderr, "reused %zu images of a chain which changed\n",
+                reused);
         goto cleanup;
     }
 
     ret = 0;
 cleanup:
+    unlink("appear");
+    VIR_FREE(canonappear);
+    virCommandFree(cmd);
     virStorageFileFreeMetadata(meta);
+    virStorageFileFreeMetadata(cached);
     return ret;
 }
 
@@ -527,6 +633,17 @@ mymain(void)
                chain12a, EXP_PASS,
                chain12b, ALLOW_PROBE | EXP_PASS);
 
+    /* Rewrite qcow2 to a backing file which only appears later on */
+    virCommandFree(cmd);
+    cmd = virCommandNewArgList(qemuimg, "rebase", "-u", "-f", "qcow2",
+                               "-F", "raw", "-b", "appear", "qcow2", NULL);
+    if (virCommandRun(cmd, NULL) < 0)
+        ret = -1;
+
+    if (virtTestRun("Storage backing chain with appearing backing file", 1,
+                    testStorageChainAppear, NULL) < 0)
+        ret = -1;
+
 #ifdef HAVE_SYMLINK
     /* Rewrite qcow2 and wrap file to use backing names relative to a
      * symlink from a different directory */
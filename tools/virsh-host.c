@@ -291,6 +291,10 @@ static const vshCmdOptDef opts_node_cpustats[] = {
      .type = VSH_OT_BOOL,
      .help = N_("prints by percentage during 1 second.")
     },
+    {.name = "average",
+     .type = VSH_OT_BOOL,
+     .help = N_("prints the usage averaged by the host stats sampler.")
+    },
     {.name = NULL}
 };
 
@@ -313,13 +317,19 @@ cmdNodeCpuStats(vshControl *ctl, const vshCmd *cmd)
     } cpu_stats[2];
     double user_time, sys_time, idle_time, iowait_time, total_time;
     double usage;
+    unsigned int flags = 0;
+
+    if (vshCommandOptBool(cmd, "average")) {
+        flags |= VIR_NODE_CPU_STATS_AVERAGE;
+        flag_percent = true;
+    }
 
     if (vshCommandOptInt(cmd, "cpu", &cpuNum) < 0) {
         vshError(ctl, "%s", _("Invalid value of cpuNum"));
         return false;
     }
 
-    if (virNodeGetCPUStats(ctl->conn, cpuNum, NULL, &nparams, 0) != 0) {
+    if (virNodeGetCPUStats(ctl->conn, cpuNum, NULL, &nparams, flags) != 0) {
         vshError(ctl, "%s",
                  _("Unable to get number of cpu stats"));
         return false;
@@ -336,7 +346,7 @@ cmdNodeCpuStats(vshControl *ctl, const vshCmd *cmd)
         if (i > 0)
             sleep(1);
 
-        if (virNodeGetCPUStats(ctl->conn, cpuNum, params, &nparams, 0) != 0) {
+        if (virNodeGetCPUStats(ctl->conn, cpuNum, params, &nparams, flags) != 0) {
             vshError(ctl, "%s", _("Unable to get node cpu stats"));
             goto cleanup;
         }